@@ -161,6 +161,65 @@
 #   define PJ_DNS_RESOLVER_BAD_NS_TTL		    (1*60)
 #endif
 
+/**
+ * Refresh a cached response when it's used after this percentage of its
+ * TTL is left, so that frequently used names don't all miss the cache at
+ * once when the entry expires. A value of 10 is a good choice for
+ * applications which resolve the same names continuously. Zero disables
+ * prefetching.
+ *
+ * Default: 0 (disabled)
+ */
+#ifndef PJ_DNS_RESOLVER_PREFETCH_PCT
+#   define PJ_DNS_RESOLVER_PREFETCH_PCT		    0
+#endif
+
+/**
+ * The interval, in seconds, after a cached response has expired during
+ * which it's still kept and returned to the application when the
+ * nameservers fail to answer (timeout, SERVFAIL or REFUSED response).
+ * See RFC 8767. Zero disables serving stale responses.
+ *
+ * Default: 0
+ */
+#ifndef PJ_DNS_RESOLVER_STALE_TTL
+#   define PJ_DNS_RESOLVER_STALE_TTL		    0
+#endif
+
+/**
+ * Number of UDP sockets used by the resolver for each address family.
+ * Each socket is bound to a random port, new queries are spread over
+ * the sockets, and a response is only accepted on the socket which its
+ * query was sent from.
+ *
+ * Default: 4
+ */
+#ifndef PJ_DNS_RESOLVER_UDP_SOCK_CNT
+#   define PJ_DNS_RESOLVER_UDP_SOCK_CNT		    4
+#endif
+
+/**
+ * Retry the query over TCP when the nameserver answers with a truncated
+ * (TC bit set) UDP response. Queries to the same nameserver are pipelined
+ * on one TCP connection. When disabled, the truncated response is
+ * returned to the application.
+ *
+ * Default: 1 (yes)
+ */
+#ifndef PJ_DNS_RESOLVER_TCP_FALLBACK
+#   define PJ_DNS_RESOLVER_TCP_FALLBACK		    1
+#endif
+
+/**
+ * Idle time, in seconds, after which the TCP connection to a nameserver
+ * is closed.
+ *
+ * Default: 10
+ */
+#ifndef PJ_DNS_RESOLVER_TCP_IDLE_TIME
+#   define PJ_DNS_RESOLVER_TCP_IDLE_TIME	    10
+#endif
+
 
 /**
  * Maximum size of UDP packet. RFC 1035 states that maximum size of
@@ -211,6 +270,19 @@
 #endif
 
 
+/**
+ * Macro PJ_SCANNER_USE_SIMD is defined and non-zero (by default yes)
+ * will enable vectorized scanning of character input specification
+ * (SSSE3 or AVX2 on x86, NEON on ARM64), selected at run-time according
+ * to the CPU features. This speeds up scanning of long tokens. On other
+ * platforms and compilers the plain scanner is used. Each cis will take
+ * 32 more bytes when this is enabled.
+ */
+#ifndef PJ_SCANNER_USE_SIMD
+#  define PJ_SCANNER_USE_SIMD			    1
+#endif
+
+
 
 /* **************************************************************************
  * STUN CLIENT CONFIGURATION
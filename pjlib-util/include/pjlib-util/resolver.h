@@ -83,6 +83,16 @@ PJ_BEGIN_DECL
  * so that there would be no additional delay for the query.
  *
  *
+ * \subsection PJ_DNS_RESOLVER_FEATURES_TRANSPORT Sockets and TCP Fallback
+ *
+ * The resolver sends the queries from several UDP sockets bound to
+ * random ports, with random transaction IDs, and only accepts a response
+ * on the socket which its query was sent from (see
+ * #PJ_DNS_RESOLVER_UDP_SOCK_CNT). When a nameserver answers with a
+ * truncated response, the query is repeated over a TCP connection to
+ * that nameserver, which is shared by the queries to the same nameserver
+ * (see #PJ_DNS_RESOLVER_TCP_FALLBACK).
+ *
  * \subsection PJ_DNS_RESOLVER_FEATURES_REC Supported Resource Records
  *
  * The low-level DNS parsing utility (see @ref PJ_DNS) supports parsing of
@@ -196,6 +206,9 @@ typedef struct pj_dns_settings
 				     value is zero, caching is disabled.    */
     unsigned	good_ns_ttl;	/**< See #PJ_DNS_RESOLVER_GOOD_NS_TTL	    */
     unsigned	bad_ns_ttl;	/**< See #PJ_DNS_RESOLVER_BAD_NS_TTL	    */
+    unsigned	cache_prefetch_pct;/**< See #PJ_DNS_RESOLVER_PREFETCH_PCT   */
+    unsigned	cache_stale_ttl;/**< See #PJ_DNS_RESOLVER_STALE_TTL	    */
+    pj_bool_t	tcp_fallback;	/**< See #PJ_DNS_RESOLVER_TCP_FALLBACK	    */
 } pj_dns_settings;
 
 
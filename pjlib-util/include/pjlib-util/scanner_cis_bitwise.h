@@ -60,8 +60,31 @@ typedef struct pj_cis_t
 {
     pj_cis_elem_t   *cis_buf;       /**< Pointer to buffer.     */
     int              cis_id;        /**< Id.                    */
+#if defined(PJ_SCANNER_USE_SIMD) && PJ_SCANNER_USE_SIMD != 0
+    pj_uint8_t	     cis_map[32];   /**< Membership map for the
+					 vectorized scanner.	    */
+#endif
 } pj_cis_t;
 
+#if defined(PJ_SCANNER_USE_SIMD) && PJ_SCANNER_USE_SIMD != 0
+/**
+ * Index and bit of a character in the membership map (cis_map) of the
+ * cis. The map is laid out for the vectorized scanner: the first 16 bytes
+ * are for characters 0-127 and the rest for characters 128-255, indexed
+ * by the low nibble, with one bit for each value of the high nibble.
+ */
+#   define PJ_CIS_MAP_IDX(c)	((((pj_uint8_t)(c)) & 0x0F) | \
+				 ((((pj_uint8_t)(c)) & 0x80) >> 3))
+#   define PJ_CIS_MAP_BIT(c)	((pj_uint8_t)(1 << ((((pj_uint8_t)(c)) >> 4) & 7)))
+#   define PJ_CIS_MAP_SET(cis,c) \
+	((cis)->cis_map[PJ_CIS_MAP_IDX(c)] |= PJ_CIS_MAP_BIT(c))
+#   define PJ_CIS_MAP_CLR(cis,c) \
+	((cis)->cis_map[PJ_CIS_MAP_IDX(c)] &= (pj_uint8_t)~PJ_CIS_MAP_BIT(c))
+#else
+#   define PJ_CIS_MAP_SET(cis,c)	((void)0)
+#   define PJ_CIS_MAP_CLR(cis,c)	((void)0)
+#endif
+
 
 /**
  * Set the membership of the specified character.
@@ -70,7 +93,8 @@ typedef struct pj_cis_t
  * @param cis       Pointer to character input specification.
  * @param c         The character.
  */
-#define PJ_CIS_SET(cis,c)   ((cis)->cis_buf[(int)(c)] |= (1 << (cis)->cis_id))
+#define PJ_CIS_SET(cis,c)   ((cis)->cis_buf[(int)(c)] |= (1 << (cis)->cis_id), \
+			     PJ_CIS_MAP_SET(cis,c))
 
 /**
  * Remove the membership of the specified character.
@@ -79,7 +103,8 @@ typedef struct pj_cis_t
  * @param cis       Pointer to character input specification.
  * @param c         The character to be removed from the membership.
  */
-#define PJ_CIS_CLR(cis,c)   ((cis)->cis_buf[(int)c] &= ~(1 << (cis)->cis_id))
+#define PJ_CIS_CLR(cis,c)   ((cis)->cis_buf[(int)c] &= ~(1 << (cis)->cis_id), \
+			     PJ_CIS_MAP_CLR(cis,c))
 
 /**
  * Check the membership of the specified character.
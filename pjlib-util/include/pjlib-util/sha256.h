@@ -0,0 +1,84 @@
+/* $Id$ */
+/* 
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA 
+ */
+#ifndef __PJLIB_UTIL_SHA256_H__
+#define __PJLIB_UTIL_SHA256_H__
+
+/**
+ * @file sha256.h
+ * @brief SHA-256 hash implementation
+ */
+
+#include <pj/types.h>
+
+PJ_BEGIN_DECL
+
+/**
+ * @defgroup PJLIB_UTIL_SHA256 SHA-256
+ * @ingroup PJLIB_UTIL_ENCRYPTION
+ * @{
+ *
+ * This module contains the implementation of the SHA-256 hash function,
+ * as described in FIPS PUB 180-4. It is used among other things by the
+ * SHA-256 digest authentication of RFC 8760.
+ */
+
+/** SHA-256 context */
+typedef struct pj_sha256_context
+{
+    pj_uint32_t state[8];	/**< State			*/
+    pj_uint32_t count[2];	/**< Message length in bits	*/
+    pj_uint8_t	buffer[64];	/**< Buffer			*/
+} pj_sha256_context;
+
+/** SHA-256 digest size is 32 bytes */
+#define PJ_SHA256_DIGEST_SIZE	32
+
+
+/** Initialize the algorithm. 
+ *  @param ctx		SHA-256 context.
+ */
+PJ_DECL(void) pj_sha256_init(pj_sha256_context *ctx);
+
+/** Append a stream to the message. 
+ *  @param ctx		SHA-256 context.
+ *  @param data		Data.
+ *  @param nbytes	Length of data.
+ */
+PJ_DECL(void) pj_sha256_update(pj_sha256_context *ctx, 
+			       const pj_uint8_t *data, 
+			       const pj_size_t nbytes);
+
+/** Finish the message and return the digest. 
+ *  @param ctx		SHA-256 context.
+ *  @param digest	32 byte digest.
+ */
+PJ_DECL(void) pj_sha256_final(pj_sha256_context *ctx, 
+			      pj_uint8_t digest[PJ_SHA256_DIGEST_SIZE]);
+
+
+/**
+ * @}
+ */
+
+PJ_END_DECL
+
+
+#endif	/* __PJLIB_UTIL_SHA256_H__ */
+
@@ -142,6 +142,11 @@ typedef struct pj_dns_srv_record
 
     } entry[PJ_DNS_SRV_MAX_ADDR];
 
+    /** The smallest TTL, in seconds, of the DNS records used to build this
+     *  record. Negative answers count as #PJ_DNS_RESOLVER_INVALID_TTL.
+     */
+    unsigned	ttl;
+
 } pj_dns_srv_record;
 
 
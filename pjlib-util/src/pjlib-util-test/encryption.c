@@ -194,6 +194,52 @@ static int sha1_test2(void)
 }
 
 
+/*
+ * SHA-256 digests of the rfc 3174 test vectors above.
+ */
+static char *sha256_resultarray[4] =
+{
+    "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+    "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+    "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+    "594847328451bdfa85056225462cc1d867d877fb388df0ce35f25ab5562bfbb5"
+};
+
+static int sha256_test(void)
+{
+    pj_sha256_context sha;
+    int i;
+    pj_uint8_t digest[PJ_SHA256_DIGEST_SIZE];
+    char char_digest[PJ_SHA256_DIGEST_SIZE*2+1];
+
+    PJ_LOG(3, (THIS_FILE, "  SHA-256 test.."));
+
+    for(i = 0; i < 4; ++i) {
+	int j;
+
+        pj_sha256_init(&sha);
+
+        for(j = 0; j < repeatcount[i]; ++j) {
+            pj_sha256_update(&sha,
+			     (const pj_uint8_t *) testarray[i],
+			     pj_ansi_strlen(testarray[i]));
+        }
+
+        pj_sha256_final(&sha, digest);
+
+	for (j = 0; j < PJ_SHA256_DIGEST_SIZE; ++j)
+	    pj_ansi_sprintf(char_digest+j*2, "%02x", digest[j]);
+
+	if (pj_ansi_strcmp(char_digest, sha256_resultarray[i])) {
+	    PJ_LOG(3, (THIS_FILE, "    digest mismatch in test %d", i));
+	    return -45;
+	}
+    }
+
+    return 0;
+}
+
+
 /*
  * HMAC-MD5 and HMAC-SHA1 test vectors from RFC 2202
  */
@@ -643,6 +689,10 @@ int encryption_test()
     if (rc != 0)
 	return rc;
 
+    rc = sha256_test();
+    if (rc != 0)
+	return rc;
+
     rc = rfc2202_test();
     if (rc != 0)
 	return rc;
@@ -672,6 +722,7 @@ int encryption_benchmark()
     union {
 	pj_md5_context md5_context;
 	pj_sha1_context sha1_context;
+	pj_sha256_context sha256_context;
     } context;
     pj_uint8_t digest[32];
     pj_size_t input_len;
@@ -696,6 +747,12 @@ int encryption_benchmark()
 	    (void (*)(void*, const pj_uint8_t*, unsigned))&pj_sha1_update,
 	    (void (*)(void*, void*))&pj_sha1_final
 	},
+	{
+	    "SHA256",
+	    (void (*)(void*))&pj_sha256_init,
+	    (void (*)(void*, const pj_uint8_t*, unsigned))&pj_sha256_update,
+	    (void (*)(void*, void*))&pj_sha256_final
+	},
 	{
 	    "CRC32",
 	    (void (*)(void*))&pj_crc32_init,
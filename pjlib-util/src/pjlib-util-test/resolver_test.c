@@ -56,6 +56,12 @@ static struct server_t
 
     unsigned	    pkt_count;
 
+    /* TCP listener, serving one connection at a time */
+    pj_sock_t	    tcp_sock;
+    pj_thread_t	   *tcp_thread;
+    unsigned	    tcp_conn_count;
+    unsigned	    tcp_pkt_count;
+
 } g_server[2];
 
 static pj_pool_t *pool;
@@ -379,8 +385,11 @@ static int server_thread(void *p)
 	pj_assert(req->hdr.qdcount == 1);
 	pj_assert(req->q[0].dnsclass == 1);
 
-	/* Simulate network RTT */
-	pj_thread_sleep(50);
+	/* Simulate network RTT. The second server is slower, so the resolver
+	 * prefers the first one when both are active, rather than whichever
+	 * happened to answer a millisecond faster.
+	 */
+	pj_thread_sleep(srv == &g_server[0] ? 50 : 60);
 
 	if (srv->action == ACTION_IGNORE) {
 	    continue;
@@ -404,6 +413,86 @@ static int server_thread(void *p)
     return 0;
 }
 
+/* Answer to the queries received over TCP */
+static void (*tcp_action_cb)(const pj_dns_parsed_packet *pkt,
+			     pj_dns_parsed_packet **p_res);
+
+static int tcp_server_thread(void *p)
+{
+    struct server_t *srv = (struct server_t*)p;
+    pj_sock_t conn = PJ_INVALID_SOCKET;
+    char pkt[1024];
+    int len = 0;
+
+    while (!thread_quit) {
+	pj_fd_set_t rset;
+	pj_time_val timeout = {0, 100};
+	pj_sock_t sock;
+	pj_ssize_t size;
+	int rc;
+
+	sock = (conn == PJ_INVALID_SOCKET) ? srv->tcp_sock : conn;
+	PJ_FD_ZERO(&rset);
+	PJ_FD_SET(sock, &rset);
+
+	rc = pj_sock_select((int)(sock+1), &rset, NULL, NULL, &timeout);
+	if (rc != 1)
+	    continue;
+
+	if (conn == PJ_INVALID_SOCKET) {
+	    rc = pj_sock_accept(srv->tcp_sock, &conn, NULL, NULL);
+	    if (rc == PJ_SUCCESS)
+		srv->tcp_conn_count++;
+	    len = 0;
+	    continue;
+	}
+
+	size = sizeof(pkt) - len;
+	rc = pj_sock_recv(conn, pkt + len, &size, 0);
+	if (rc != PJ_SUCCESS || size <= 0) {
+	    pj_sock_close(conn);
+	    conn = PJ_INVALID_SOCKET;
+	    continue;
+	}
+	len += (int)size;
+
+	/* Answer each complete query, which is prefixed with its length */
+	while (len >= 2) {
+	    int qlen = ((pj_uint8_t)pkt[0] << 8) | (pj_uint8_t)pkt[1];
+	    pj_dns_parsed_packet *req, *resp;
+	    char ans[1024];
+	    pj_ssize_t ans_len;
+	    pj_pool_t *tmp_pool;
+
+	    if (len < qlen + 2)
+		break;
+
+	    tmp_pool = pj_pool_create(mem, NULL, 1000, 1000, NULL);
+	    rc = pj_dns_parse_packet(tmp_pool, pkt + 2, qlen, &req);
+	    if (rc == PJ_SUCCESS) {
+		srv->tcp_pkt_count++;
+		(*tcp_action_cb)(req, &resp);
+		resp->hdr.id = req->hdr.id;
+		ans_len = print_packet(resp, (pj_uint8_t*)ans + 2,
+				       sizeof(ans) - 2);
+		ans[0] = (char)(ans_len >> 8);
+		ans[1] = (char)(ans_len & 0xFF);
+		ans_len += 2;
+		pj_sock_send(conn, ans, &ans_len, 0);
+	    }
+	    pj_pool_release(tmp_pool);
+
+	    pj_memmove(pkt, pkt + qlen + 2, len - qlen - 2);
+	    len -= qlen + 2;
+	}
+    }
+
+    if (conn != PJ_INVALID_SOCKET)
+	pj_sock_close(conn);
+
+    return 0;
+}
+
 static int poll_worker_thread(void *p)
 {
     PJ_UNUSED_ARG(p);
@@ -465,6 +554,25 @@ static int init(pj_bool_t use_ipv6)
 				  0, 0, &g_server[i].thread);
 	if (status != PJ_SUCCESS)
 	    return -30;
+
+	status = pj_sock_socket((use_ipv6? pj_AF_INET6() : pj_AF_INET()),
+				pj_SOCK_STREAM(), 0, &g_server[i].tcp_sock);
+	if (status != PJ_SUCCESS)
+	    return -32;
+
+	status = pj_sock_bind(g_server[i].tcp_sock, &addr,
+			      pj_sockaddr_get_len(&addr));
+	if (status != PJ_SUCCESS)
+	    return -34;
+
+	status = pj_sock_listen(g_server[i].tcp_sock, 4);
+	if (status != PJ_SUCCESS)
+	    return -36;
+
+	status = pj_thread_create(pool, NULL, &tcp_server_thread, &g_server[i],
+				  0, 0, &g_server[i].tcp_thread);
+	if (status != PJ_SUCCESS)
+	    return -38;
     }
 
     status = pj_timer_heap_create(pool, 16, &timer_heap);
@@ -501,6 +609,8 @@ static void destroy(void)
     for (i=0; i<2; ++i) {
 	pj_thread_join(g_server[i].thread);
 	pj_sock_close(g_server[i].sock);
+	pj_thread_join(g_server[i].tcp_thread);
+	pj_sock_close(g_server[i].tcp_sock);
     }
 
     pj_thread_join(poll_thread);
@@ -1182,6 +1292,388 @@ static int dns_test(void)
 }
 
 
+////////////////////////////////////////////////////////////////////////////
+/* Cache prefetch and serve-stale test */
+static struct cache_test_result
+{
+    pj_status_t	status;
+    pj_uint32_t	addr;
+} cache_res;
+
+static void cache_callback(void *user_data,
+			   pj_status_t status,
+			   pj_dns_parsed_packet *resp)
+{
+    PJ_UNUSED_ARG(user_data);
+
+    cache_res.status = status;
+    cache_res.addr = 0;
+    if (status == PJ_SUCCESS && resp && resp->hdr.anscount)
+	cache_res.addr = resp->ans[0].rdata.a.ip_addr.s_addr;
+
+    pj_sem_post(sem);
+}
+
+static int cache_test(void)
+{
+    pj_str_t name = pj_str("cachetest");
+    pj_dns_settings cache_set;
+    int saved_action[2];
+    pj_dns_parsed_packet saved_resp[2];
+    pj_status_t status;
+    int i, rc = 0;
+
+    PJ_LOG(3,(THIS_FILE, "  cache prefetch and serve-stale test"));
+
+    /* Subsequent tests expect the nameservers to be left as they are */
+    for (i=0; i<2; ++i) {
+	saved_action[i] = g_server[i].action;
+	pj_memcpy(&saved_resp[i], &g_server[i].resp, sizeof(saved_resp[i]));
+    }
+
+    pj_memcpy(&cache_set, &set, sizeof(set));
+    cache_set.cache_prefetch_pct = 50;
+    cache_set.cache_stale_ttl = 60;
+    pj_dns_resolver_set_settings(resolver, &cache_set);
+
+    for (i=0; i<2; ++i) {
+	pj_dns_parsed_packet *r = &g_server[i].resp;
+
+	g_server[i].action = ACTION_REPLY;
+	pj_bzero(r, sizeof(*r));
+	r->hdr.qdcount = 1;
+	r->hdr.anscount = 1;
+	r->q = PJ_POOL_ZALLOC_T(pool, pj_dns_parsed_query);
+	r->q[0].type = PJ_DNS_TYPE_A;
+	r->q[0].dnsclass = 1;
+	r->q[0].name = name;
+	r->ans = PJ_POOL_ZALLOC_T(pool, pj_dns_parsed_rr);
+	r->ans[0].type = PJ_DNS_TYPE_A;
+	r->ans[0].dnsclass = 1;
+	r->ans[0].name = name;
+	r->ans[0].ttl = 2;
+	r->ans[0].rdata.a.ip_addr.s_addr = IP_ADDR0;
+    }
+
+    /* Populate the cache */
+    status = pj_dns_resolver_start_query(resolver, &name, PJ_DNS_TYPE_A, 0,
+					 &cache_callback, NULL, NULL);
+    if (status != PJ_SUCCESS) {
+	rc = -1000;
+	goto on_return;
+    }
+    pj_sem_wait(sem);
+    if (cache_res.status != PJ_SUCCESS || cache_res.addr != IP_ADDR0) {
+	rc = -1010;
+	goto on_return;
+    }
+
+    /* Using the entry when less than half of its TTL is left must answer
+     * from the cache and refresh the entry.
+     */
+    pj_thread_sleep(1300);
+    g_server[0].pkt_count = 0;
+    g_server[1].pkt_count = 0;
+
+    status = pj_dns_resolver_start_query(resolver, &name, PJ_DNS_TYPE_A, 0,
+					 &cache_callback, NULL, NULL);
+    if (status != PJ_SUCCESS) {
+	rc = -1020;
+	goto on_return;
+    }
+    pj_sem_wait(sem);
+    if (cache_res.status != PJ_SUCCESS || cache_res.addr != IP_ADDR0) {
+	rc = -1030;
+	goto on_return;
+    }
+
+    pj_thread_sleep(500);
+    if (g_server[0].pkt_count + g_server[1].pkt_count == 0) {
+	PJ_LOG(3,(THIS_FILE, "   error: entry was not prefetched"));
+	rc = -1040;
+	goto on_return;
+    }
+
+    /* Let the refreshed entry expire, then the nameservers fail. The
+     * stale entry must be returned.
+     */
+    g_server[0].action = PJ_DNS_RCODE_SERVFAIL;
+    g_server[1].action = PJ_DNS_RCODE_SERVFAIL;
+    pj_thread_sleep(2500);
+
+    status = pj_dns_resolver_start_query(resolver, &name, PJ_DNS_TYPE_A, 0,
+					 &cache_callback, NULL, NULL);
+    if (status != PJ_SUCCESS) {
+	rc = -1050;
+	goto on_return;
+    }
+    pj_sem_wait(sem);
+    if (cache_res.status != PJ_SUCCESS || cache_res.addr != IP_ADDR0) {
+	PJ_LOG(3,(THIS_FILE, "   error: stale entry was not used"));
+	rc = -1060;
+	goto on_return;
+    }
+
+    pj_dns_resolver_dump(resolver, PJ_FALSE);
+
+on_return:
+    pj_dns_resolver_set_settings(resolver, &set);
+    pj_thread_sleep(500);
+    for (i=0; i<2; ++i) {
+	g_server[i].action = saved_action[i];
+	pj_memcpy(&g_server[i].resp, &saved_resp[i], sizeof(saved_resp[i]));
+    }
+    return rc;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+/* Truncated response is retried over TCP */
+#define TCP_QUERIES	4
+#define IP_ADDR4	0x04040404
+
+static struct tcp_test_result
+{
+    pj_status_t	status;
+    pj_uint32_t	addr;
+} tcp_res[TCP_QUERIES];
+
+/* UDP answer is truncated */
+static void action_tc(const pj_dns_parsed_packet *pkt,
+		      pj_dns_parsed_packet **p_res)
+{
+    pj_dns_parsed_packet *res;
+
+    res = PJ_POOL_ZALLOC_T(pool, pj_dns_parsed_packet);
+    res->hdr.flags = PJ_DNS_SET_QR(1) | PJ_DNS_SET_TC(1);
+    res->hdr.qdcount = 1;
+    res->q = PJ_POOL_ZALLOC_T(pool, pj_dns_parsed_query);
+    pj_memcpy(res->q, pkt->q, sizeof(pj_dns_parsed_query));
+
+    *p_res = res;
+}
+
+/* TCP answer is complete */
+static void action_tcp(const pj_dns_parsed_packet *pkt,
+		       pj_dns_parsed_packet **p_res)
+{
+    pj_dns_parsed_packet *res;
+
+    res = PJ_POOL_ZALLOC_T(pool, pj_dns_parsed_packet);
+    res->hdr.flags = PJ_DNS_SET_QR(1);
+    res->hdr.qdcount = 1;
+    res->q = PJ_POOL_ZALLOC_T(pool, pj_dns_parsed_query);
+    pj_memcpy(res->q, pkt->q, sizeof(pj_dns_parsed_query));
+    res->hdr.anscount = 1;
+    res->ans = PJ_POOL_ZALLOC_T(pool, pj_dns_parsed_rr);
+    res->ans[0].type = PJ_DNS_TYPE_A;
+    res->ans[0].dnsclass = 1;
+    res->ans[0].name = res->q->name;
+    res->ans[0].ttl = 1;
+    res->ans[0].rdata.a.ip_addr.s_addr = IP_ADDR4;
+
+    *p_res = res;
+}
+
+static void tcp_callback(void *user_data,
+			 pj_status_t status,
+			 pj_dns_parsed_packet *resp)
+{
+    struct tcp_test_result *res = (struct tcp_test_result*) user_data;
+
+    res->status = status;
+    res->addr = 0;
+    if (status == PJ_SUCCESS && resp && resp->hdr.anscount &&
+	PJ_DNS_GET_TC(resp->hdr.flags) == 0)
+    {
+	res->addr = resp->ans[0].rdata.a.ip_addr.s_addr;
+    }
+
+    pj_sem_post(sem);
+}
+
+static int tcp_fallback_test(void)
+{
+    unsigned i, conn_cnt, pkt_cnt;
+    pj_status_t status;
+    int rc = 0;
+
+    PJ_LOG(3,(THIS_FILE, "  TCP fallback test"));
+
+    tcp_action_cb = &action_tcp;
+    for (i=0; i<2; ++i) {
+	g_server[i].action = ACTION_CB;
+	g_server[i].action_cb = &action_tc;
+	g_server[i].tcp_conn_count = 0;
+	g_server[i].tcp_pkt_count = 0;
+    }
+
+    for (i=0; i<TCP_QUERIES; ++i) {
+	char buf[16];
+	pj_str_t name;
+
+	name.ptr = buf;
+	name.slen = pj_ansi_snprintf(buf, sizeof(buf), "tcp%u", i);
+	tcp_res[i].status = -1;
+
+	status = pj_dns_resolver_start_query(resolver, &name, PJ_DNS_TYPE_A,
+					     0, &tcp_callback, &tcp_res[i],
+					     NULL);
+	if (status != PJ_SUCCESS)
+	    return -1100;
+    }
+
+    for (i=0; i<TCP_QUERIES; ++i)
+	pj_sem_wait(sem);
+
+    for (i=0; i<TCP_QUERIES; ++i) {
+	if (tcp_res[i].status != PJ_SUCCESS || tcp_res[i].addr != IP_ADDR4) {
+	    PJ_LOG(3,(THIS_FILE, "   error: query %u was not answered over "
+		      "TCP (status=%d)", i, tcp_res[i].status));
+	    rc = -1110;
+	    goto on_return;
+	}
+    }
+
+    /* The queries to each nameserver share one connection */
+    conn_cnt = g_server[0].tcp_conn_count + g_server[1].tcp_conn_count;
+    pkt_cnt = g_server[0].tcp_pkt_count + g_server[1].tcp_pkt_count;
+    if (conn_cnt == 0 || conn_cnt > 2 || pkt_cnt < TCP_QUERIES) {
+	PJ_LOG(3,(THIS_FILE, "   error: %u TCP connections, %u TCP queries",
+		  conn_cnt, pkt_cnt));
+	rc = -1120;
+	goto on_return;
+    }
+
+on_return:
+    g_server[0].action = ACTION_REPLY;
+    g_server[1].action = ACTION_REPLY;
+    pj_thread_sleep(500);
+    return rc;
+}
+
+
+////////////////////////////////////////////////////////////////////////////
+/* Load test with the DNS server stand-in */
+#define LOAD_PORT	5560
+#define LOAD_NAMES	64
+#define LOAD_QUERIES	20000
+#define LOAD_WINDOW	64
+
+static struct load_test_result
+{
+    unsigned	done;
+    unsigned	failed;
+} load_res;
+
+static void load_callback(void *user_data,
+			  pj_status_t status,
+			  pj_dns_parsed_packet *resp)
+{
+    PJ_UNUSED_ARG(user_data);
+    PJ_UNUSED_ARG(resp);
+
+    ++load_res.done;
+    if (status != PJ_SUCCESS)
+	++load_res.failed;
+}
+
+static int load_test(void)
+{
+    pj_dns_server *srv;
+    pj_dns_resolver *res;
+    pj_dns_settings load_set;
+    pj_str_t names[LOAD_NAMES];
+    pj_str_t ns = pj_str("127.0.0.1");
+    pj_uint16_t port = LOAD_PORT;
+    pj_timestamp t1, t2;
+    unsigned i, sent, msec;
+    pj_status_t status;
+    int rc = 0;
+
+    PJ_LOG(3,(THIS_FILE, "  load test"));
+
+    status = pj_dns_server_create(mem, ioqueue, pj_AF_INET(), LOAD_PORT,
+				  0, &srv);
+    if (status != PJ_SUCCESS)
+	return -1200;
+
+    for (i=0; i<LOAD_NAMES; ++i) {
+	pj_dns_parsed_rr rr;
+	pj_in_addr addr;
+	char buf[16];
+
+	pj_ansi_snprintf(buf, sizeof(buf), "load%u", i);
+	pj_strdup2(pool, &names[i], buf);
+	addr.s_addr = IP_ADDR4 + i;
+	pj_dns_init_a_rr(&rr, &names[i], PJ_DNS_CLASS_IN, 60, &addr);
+	pj_dns_server_add_rec(srv, 1, &rr);
+    }
+
+    /* The resolver has its own timer heap and ioqueue, polled below */
+    status = pj_dns_resolver_create(mem, "loadres", 0, NULL, NULL, &res);
+    if (status != PJ_SUCCESS) {
+	pj_dns_server_destroy(srv);
+	return -1210;
+    }
+
+    /* Disable caching, so that every query is sent to the server */
+    pj_dns_resolver_get_settings(res, &load_set);
+    load_set.cache_max_ttl = 0;
+    pj_dns_resolver_set_settings(res, &load_set);
+    pj_dns_resolver_set_ns(res, 1, &ns, &port);
+
+    pj_bzero(&load_res, sizeof(load_res));
+    sent = 0;
+    pj_get_timestamp(&t1);
+
+    while (load_res.done < LOAD_QUERIES) {
+	pj_time_val timeout = {0, 1};
+
+	while (sent < LOAD_QUERIES && sent - load_res.done < LOAD_WINDOW) {
+	    status = pj_dns_resolver_start_query(res, &names[sent % LOAD_NAMES],
+						 PJ_DNS_TYPE_A, 0,
+						 &load_callback, NULL, NULL);
+	    if (status != PJ_SUCCESS) {
+		rc = -1220;
+		goto on_return;
+	    }
+	    ++sent;
+	}
+
+	pj_dns_resolver_handle_events(res, &timeout);
+
+	pj_get_timestamp(&t2);
+	if (pj_elapsed_msec(&t1, &t2) > 60000) {
+	    rc = -1230;
+	    goto on_return;
+	}
+    }
+
+    pj_get_timestamp(&t2);
+    msec = pj_elapsed_msec(&t1, &t2);
+    if (msec == 0)
+	msec = 1;
+
+    PJ_LOG(3,(THIS_FILE, "   %u queries (%u outstanding) in %u ms: "
+	      "%u queries/sec, %u failed",
+	      LOAD_QUERIES, LOAD_WINDOW, msec,
+	      (unsigned)(LOAD_QUERIES * 1000.0 / msec), load_res.failed));
+
+    if (load_res.failed)
+	rc = -1240;
+
+on_return:
+    if (rc != 0) {
+	PJ_LOG(3,(THIS_FILE, "   error: %u of %u queries done, %u failed",
+		  load_res.done, sent, load_res.failed));
+    }
+    pj_dns_resolver_destroy(res, PJ_FALSE);
+    pj_dns_server_destroy(srv);
+    return rc;
+}
+
+
 ////////////////////////////////////////////////////////////////////////////
 /* Resolver test, normal, with CNAME */
 #define IP_ADDR1    0x02030405
@@ -1650,6 +2142,9 @@ static int srv_resolver_fallback_test(void)
 
     pj_sem_wait(sem);
 
+    /* The resolver saves the response after calling the callback */
+    pj_thread_sleep(50);
+
     /* Subsequent query should just get the response from the cache */
     PJ_LOG(3,(THIS_FILE, "  srv_resolve(): cache test"));
     g_server[0].pkt_count = 0;
@@ -1871,6 +2366,18 @@ int resolver_test(void)
     if (rc != 0)
 	goto on_error;
 
+    rc = cache_test();
+    if (rc != 0)
+	goto on_error;
+
+    rc = tcp_fallback_test();
+    if (rc != 0)
+	goto on_error;
+
+    rc = load_test();
+    if (rc != 0)
+	goto on_error;
+
     srv_resolver_test();
     srv_resolver_fallback_test();
     srv_resolver_many_test();
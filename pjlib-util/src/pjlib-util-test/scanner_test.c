@@ -0,0 +1,285 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "test.h"
+
+#define THIS_FILE	"scanner_test.c"
+
+#if INCLUDE_SCANNER_TEST
+
+#include <pjlib-util/scanner.h>
+#include <pj/log.h>
+#include <pj/os.h>
+#include <pj/pool.h>
+#include <pj/rand.h>
+#include <pj/string.h>
+
+#define BUF_LEN		1024
+#define ROUNDS		2000
+#define BENCH_LEN	(64 * 1024)
+#define BENCH_LOOP	200
+
+enum { CIS_TOKEN, CIS_NOT_NEWLINE, CIS_HIGH, CIS_ODD, CIS_COUNT };
+
+static pj_cis_buf_t cis_buf;
+static pj_cis_t cis[CIS_COUNT];
+
+static void on_syntax_error(pj_scanner *scanner)
+{
+    PJ_UNUSED_ARG(scanner);
+}
+
+static void init_cis(void)
+{
+    int c;
+
+    pj_cis_buf_init(&cis_buf);
+
+    pj_cis_init(&cis_buf, &cis[CIS_TOKEN]);
+    pj_cis_add_alpha(&cis[CIS_TOKEN]);
+    pj_cis_add_num(&cis[CIS_TOKEN]);
+    pj_cis_add_str(&cis[CIS_TOKEN], "-.!%*_+`'~");
+
+    pj_cis_init(&cis_buf, &cis[CIS_NOT_NEWLINE]);
+    pj_cis_add_str(&cis[CIS_NOT_NEWLINE], "\r\n");
+    pj_cis_invert(&cis[CIS_NOT_NEWLINE]);
+
+    pj_cis_init(&cis_buf, &cis[CIS_HIGH]);
+    pj_cis_add_range(&cis[CIS_HIGH], 0x70, 256);
+
+    pj_cis_init(&cis_buf, &cis[CIS_ODD]);
+    for (c=1; c<256; c+=2)
+	PJ_CIS_SET(&cis[CIS_ODD], c);
+}
+
+/* Scalar reference implementation */
+static pj_ssize_t ref_span(const pj_cis_t *spec, const char *s,
+			   const char *end, int match)
+{
+    const char *start = s;
+
+    if (match) {
+	while (pj_cis_match(spec, *s))
+	    ++s;
+    } else {
+	while (s != end && !pj_cis_match(spec, *s))
+	    ++s;
+    }
+    return s - start;
+}
+
+/* Fill the buffer with random runs of members and non-members */
+static void fill_buf(const pj_cis_t *spec, char *buf, unsigned len)
+{
+    unsigned i = 0;
+
+    while (i < len) {
+	unsigned run = (pj_rand() % 80) + 1;
+	int member = pj_rand() & 1;
+
+	while (run-- && i < len) {
+	    int c;
+	    do {
+		c = (pj_rand() % 255) + 1;
+	    } while ((pj_cis_match(spec, (pj_uint8_t)c) != 0) != member);
+	    buf[i++] = (char)c;
+	}
+    }
+    buf[len] = '\0';
+}
+
+static int verify_test(void)
+{
+    char buf[BUF_LEN+1];
+    unsigned round;
+
+    PJ_LOG(3,(THIS_FILE, "  verifying against scalar scanner.."));
+
+    for (round=0; round<ROUNDS; ++round) {
+	const pj_cis_t *spec = &cis[round % CIS_COUNT];
+	unsigned len = (pj_rand() % BUF_LEN) + 1;
+	unsigned i;
+
+	fill_buf(spec, buf, len);
+
+	for (i=0; i<len; i+=(pj_rand() % 7) + 1) {
+	    pj_scanner scanner;
+	    pj_str_t out;
+
+	    pj_scan_init(&scanner, buf, len, 0, &on_syntax_error);
+	    scanner.curptr = buf + i;
+
+	    pj_scan_peek(&scanner, spec, &out);
+	    if (out.ptr != buf+i ||
+		out.slen != ref_span(spec, buf+i, buf+len, 1))
+	    {
+		PJ_LOG(1,(THIS_FILE, "  error: pj_scan_peek() mismatch"));
+		return -10;
+	    }
+
+	    pj_scan_peek_until(&scanner, spec, &out);
+	    if (out.ptr != buf+i ||
+		out.slen != ref_span(spec, buf+i, buf+len, 0))
+	    {
+		PJ_LOG(1,(THIS_FILE, "  error: pj_scan_peek_until() mismatch"));
+		return -20;
+	    }
+
+	    if (pj_cis_match(spec, (pj_uint8_t)buf[i])) {
+		pj_scan_get(&scanner, spec, &out);
+		if (out.slen != ref_span(spec, buf+i, buf+len, 1) ||
+		    scanner.curptr != buf+i+out.slen)
+		{
+		    PJ_LOG(1,(THIS_FILE, "  error: pj_scan_get() mismatch"));
+		    return -30;
+		}
+	    }
+
+	    scanner.curptr = buf + i;
+	    pj_scan_get_until(&scanner, spec, &out);
+	    if (out.slen != ref_span(spec, buf+i, buf+len, 0) ||
+		scanner.curptr != buf+i+out.slen)
+	    {
+		PJ_LOG(1,(THIS_FILE, "  error: pj_scan_get_until() mismatch"));
+		return -40;
+	    }
+
+	    scanner.curptr = buf + i;
+	    pj_scan_get_until_ch(&scanner, buf[len-1], &out);
+	    if ((char*)pj_memchr(buf+i, buf[len-1], len-i) !=
+		buf+i+out.slen)
+	    {
+		PJ_LOG(1,(THIS_FILE, "  error: pj_scan_get_until_ch() "
+			  "mismatch"));
+		return -50;
+	    }
+	}
+    }
+
+    return 0;
+}
+
+/* Make a buffer of tokens of the specified length, separated by ';' */
+static char *make_bench_buf(pj_pool_t *pool, unsigned token_len)
+{
+    static const char chars[] = "abcdefghijklmnopqrstuvwxyz0123456789-.";
+    char *buf = (char*) pj_pool_alloc(pool, BENCH_LEN + 1);
+    unsigned i;
+
+    for (i=0; i<BENCH_LEN; ++i) {
+	if ((i % (token_len+1)) == token_len)
+	    buf[i] = ';';
+	else
+	    buf[i] = chars[i % (sizeof(chars)-1)];
+    }
+    buf[BENCH_LEN] = '\0';
+    return buf;
+}
+
+static int bench_one(pj_pool_t *pool, unsigned token_len)
+{
+    char *buf = make_bench_buf(pool, token_len);
+    const pj_cis_t *spec = &cis[CIS_TOKEN];
+    pj_timestamp t1, t2, t3;
+    pj_uint32_t scalar_usec, scan_usec;
+    unsigned loop, total = 0;
+
+    /* Scalar loop as used by the scanner without vectorization */
+    pj_get_timestamp(&t1);
+    for (loop=0; loop<BENCH_LOOP; ++loop) {
+	const char *s = buf, *end = buf + BENCH_LEN;
+	while (s < end) {
+	    pj_ssize_t n = ref_span(spec, s, end, 1);
+	    total += (unsigned)n;
+	    s += n + 1;
+	}
+    }
+    pj_get_timestamp(&t2);
+
+    for (loop=0; loop<BENCH_LOOP; ++loop) {
+	pj_scanner scanner;
+	pj_str_t out;
+
+	pj_scan_init(&scanner, buf, BENCH_LEN, 0, &on_syntax_error);
+	while (!pj_scan_is_eof(&scanner)) {
+	    pj_scan_get(&scanner, spec, &out);
+	    total -= (unsigned)out.slen;
+	    if (!pj_scan_is_eof(&scanner))
+		pj_scan_get_char(&scanner);
+	}
+    }
+    pj_get_timestamp(&t3);
+
+    if (total != 0) {
+	PJ_LOG(1,(THIS_FILE, "  error: benchmark result mismatch"));
+	return -100;
+    }
+
+    scalar_usec = pj_elapsed_usec(&t1, &t2);
+    scan_usec = pj_elapsed_usec(&t2, &t3);
+    if (scalar_usec == 0) scalar_usec = 1;
+    if (scan_usec == 0) scan_usec = 1;
+
+    PJ_LOG(3,(THIS_FILE, "   token length %3u: scalar %4u MB/s, "
+			 "pj_scan_get() %4u MB/s",
+	      token_len,
+	      (unsigned)((pj_uint64_t)BENCH_LEN * BENCH_LOOP / scalar_usec),
+	      (unsigned)((pj_uint64_t)BENCH_LEN * BENCH_LOOP / scan_usec)));
+    return 0;
+}
+
+static int benchmark(void)
+{
+    static const unsigned token_len[] = { 4, 8, 16, 32, 64, 256 };
+    pj_pool_t *pool;
+    unsigned i;
+    int rc = 0;
+
+    PJ_LOG(3,(THIS_FILE, "  benchmarking (%u KB, %u loops)..",
+	      BENCH_LEN / 1024, BENCH_LOOP));
+
+    pool = pj_pool_create(mem, "scanbench", BENCH_LEN + 1000, 1000, NULL);
+
+    for (i=0; i<PJ_ARRAY_SIZE(token_len) && rc==0; ++i)
+	rc = bench_one(pool, token_len[i]);
+
+    pj_pool_release(pool);
+    return rc;
+}
+
+int scanner_test(void)
+{
+    int rc;
+
+    init_cis();
+
+    rc = verify_test();
+    if (rc)
+	return rc;
+
+    rc = benchmark();
+    if (rc)
+	return rc;
+
+    return 0;
+}
+
+
+#else
+int scanner_test_dummy;
+#endif
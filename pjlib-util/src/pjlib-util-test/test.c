@@ -68,6 +68,10 @@ static int test_inner(void)
     pj_dump_config();
     pj_caching_pool_init( &caching_pool, &pj_pool_factory_default_policy, 0 );
 
+#if INCLUDE_SCANNER_TEST
+    DO_TEST(scanner_test());
+#endif
+
 #if INCLUDE_XML_TEST
     DO_TEST(xml_test());
 #endif
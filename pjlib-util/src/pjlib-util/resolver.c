@@ -45,16 +45,48 @@
 #   error "PJ_DNS_RESOLVER_MAX_NS is too large (max=256)"
 #endif
 
+#if PJ_DNS_RESOLVER_UDP_SOCK_CNT < 1
+#   error "PJ_DNS_RESOLVER_UDP_SOCK_CNT must be at least 1"
+#endif
+
 
-#define RES_HASH_TABLE_SIZE 127		/**< Hash table size (must be 2^n-1 */
+#define RES_HASH_TABLE_SIZE 127		/**< Initial hash table size.	    */
 #define PORT		    53		/**< Default NS port.		    */
-#define Q_HASH_TABLE_SIZE   127		/**< Query hash table size	    */
+#define Q_HASH_TABLE_SIZE   127		/**< Initial query hash table size  */
 #define TIMER_SIZE	    127		/**< Initial number of timers.	    */
-#define MAX_FD		    3		/**< Maximum internal sockets.	    */
+#define UDP_SOCK_CNT	    PJ_DNS_RESOLVER_UDP_SOCK_CNT
+#define MAX_FD		    (2*UDP_SOCK_CNT + PJ_DNS_RESOLVER_MAX_NS)
+					/**< Maximum internal sockets.	    */
+#define PORT_RANGE_START    49152	/**< Random source port range.	    */
+#define BIND_RETRY	    8		/**< Random port bind attempts.	    */
+#define ID_RETRY	    16		/**< Random query ID attempts.	    */
 
 #define RES_BUF_SZ	    PJ_DNS_RESOLVER_RES_BUF_SIZE
 #define UDPSZ		    PJ_DNS_RESOLVER_MAX_UDP_SIZE
 #define TMP_SZ		    PJ_DNS_RESOLVER_TMP_BUF_SIZE
+#define TCP_RX_SZ	    (2 + 65535)	/**< Largest DNS message over TCP.  */
+#define TCP_TX_SZ	    (8 * (2 + UDPSZ)) /**< Queued TCP queries.	    */
+
+
+/* The response cache is looked up with only the cache read lock held, so
+ * the reference counter of the entry and the hit counter are updated with
+ * atomic operations. Without them, lookups take the write lock instead.
+ */
+#if defined(__GNUC__) && PJ_HAS_THREADS
+#   define CACHE_HAS_ATOMIC	    1
+#   define CACHE_LOCK_READ(r)	    pj_rwmutex_lock_read((r)->cache_lock)
+#   define CACHE_UNLOCK_READ(r)	    pj_rwmutex_unlock_read((r)->cache_lock)
+#   define ATOMIC_INC(var)	    __sync_add_and_fetch(&(var), 1)
+#   define ATOMIC_DEC(var)	    __sync_sub_and_fetch(&(var), 1)
+#   define ATOMIC_CAS(var, o, n)    __sync_bool_compare_and_swap(&(var), o, n)
+#else
+#   define CACHE_HAS_ATOMIC	    0
+#   define CACHE_LOCK_READ(r)	    pj_rwmutex_lock_write((r)->cache_lock)
+#   define CACHE_UNLOCK_READ(r)	    pj_rwmutex_unlock_write((r)->cache_lock)
+#   define ATOMIC_INC(var)	    (++(var))
+#   define ATOMIC_DEC(var)	    (--(var))
+#   define ATOMIC_CAS(var, o, n)    ((var)==(o) ? ((var)=(n), 1) : 0)
+#endif
 
 
 /* Nameserver state */
@@ -102,6 +134,50 @@ struct query_head
 };
 
 
+/* 
+ * Each UDP socket. New queries are spread over the sockets, and the
+ * response to a query is only accepted on the socket it was sent from.
+ */
+struct udp_sock
+{
+    pj_dns_resolver	*resolver;	/**< The resolver instance.	    */
+    unsigned		 idx;		/**< Index in the socket array.	    */
+    pj_sock_t		 sock;		/**< UDP socket.		    */
+    pj_ioqueue_key_t	*key;		/**< UDP socket ioqueue key.	    */
+    unsigned char	 rx_pkt[UDPSZ];	/**< UDP receive buffer.	    */
+    pj_ioqueue_op_key_t	 op_rx_key;	/**< UDP read operation key.	    */
+    pj_ioqueue_op_key_t	 op_tx_key;	/**< UDP write operation key.	    */
+    pj_sockaddr		 src_addr;	/**< Source address of packet	    */
+    int			 addr_len;	/**< Source address length.	    */
+    char		 tmp_pool[TMP_SZ];/**< Temporary pool buffer.	    */
+};
+
+
+/*
+ * TCP connection to a nameserver, to retry the queries which response
+ * is truncated. The queries to the nameserver are pipelined on the
+ * connection, and the responses are matched with the transaction ID.
+ */
+struct tcp_conn
+{
+    pj_dns_resolver	*resolver;	/**< The resolver instance.	    */
+    pj_sockaddr		 addr;		/**< Nameserver address.	    */
+    pj_ioqueue_key_t	*key;		/**< Ioqueue key, NULL if closed.   */
+    pj_bool_t		 connected;	/**< Connection established?	    */
+    unsigned char	*rx_pkt;	/**< Receive buffer.		    */
+    unsigned		 rx_len;	/**< Received, unprocessed length.  */
+    unsigned char	*tx_pkt;	/**< Buffer being sent.		    */
+    unsigned		 tx_len;	/**< Length being sent, or zero.    */
+    unsigned		 tx_sent;	/**< Length sent.		    */
+    unsigned char	*tx_queue;	/**< Queries waiting to be sent.    */
+    unsigned		 queue_len;	/**< Length of the queued queries.  */
+    pj_ioqueue_op_key_t	 op_rx_key;	/**< Read operation key.	    */
+    pj_ioqueue_op_key_t	 op_tx_key;	/**< Write operation key.	    */
+    struct query_head	 pending;	/**< Queries waiting for response.  */
+    pj_timer_entry	 idle_timer;	/**< Timer to close idle connection */
+};
+
+
 /* Key to look for outstanding query and/or cached response */
 struct res_key
 {
@@ -134,6 +210,9 @@ struct pj_dns_async_query
     pj_uint16_t		 id;		/**< Transaction ID.		    */
 
     unsigned		 transmit_cnt;	/**< Number of transmissions.	    */
+    unsigned		 sock_idx;	/**< UDP socket the query is sent on*/
+    struct tcp_conn	*tcp;		/**< TCP connection, if the query is
+					     retried over TCP.		    */
 
     struct res_key	 key;		/**< Key to index this query.	    */
     pj_hash_entry_buf	 hbufid;	/**< Hash buffer 1		    */
@@ -158,7 +237,10 @@ struct cached_res
     pj_hash_entry_buf	     hbuf;	    /**< Hash buffer		    */
     pj_time_val		     expiry_time;   /**< Expiration time.	    */
     pj_dns_parsed_packet    *pkt;	    /**< The response packet.	    */
+    unsigned		     ttl;	    /**< Original TTL, zero if the
+						 entry doesn't expire.	    */
     unsigned		     ref_cnt;	    /**< Reference counter.	    */
+    int			     prefetching;   /**< Being refreshed?	    */
 };
 
 
@@ -174,29 +256,17 @@ struct pj_dns_resolver
     pj_timer_heap_t	*timer;		/**< Timer instance.		    */
     pj_bool_t		 own_ioqueue;	/**< Do we own ioqueue?		    */
     pj_ioqueue_t	*ioqueue;	/**< Ioqueue instance.		    */
-    char		 tmp_pool[TMP_SZ];/**< Temporary pool buffer.	    */
-
-    /* Socket */
-    pj_sock_t		 udp_sock;	/**< UDP socket.		    */
-    pj_ioqueue_key_t	*udp_key;	/**< UDP socket ioqueue key.	    */
-    unsigned char	 udp_rx_pkt[UDPSZ];/**< UDP receive buffer.	    */
-    unsigned char	 udp_tx_pkt[UDPSZ];/**< UDP transmit buffer.	    */
-    pj_ioqueue_op_key_t	 udp_op_rx_key;	/**< UDP read operation key.	    */
-    pj_ioqueue_op_key_t	 udp_op_tx_key;	/**< UDP write operation key.	    */
-    pj_sockaddr		 udp_src_addr;	/**< Source address of packet	    */
-    int			 udp_addr_len;	/**< Source address length.	    */
 
+    /* Sockets */
+    struct udp_sock	 udp[UDP_SOCK_CNT];	/**< IPv4 UDP sockets.	    */
 #if PJ_HAS_IPV6
-    /* IPv6 socket */
-    pj_sock_t		 udp6_sock;	/**< UDP socket.		    */
-    pj_ioqueue_key_t	*udp6_key;	/**< UDP socket ioqueue key.	    */
-    unsigned char	 udp6_rx_pkt[UDPSZ];/**< UDP receive buffer.	    */
-    //unsigned char	 udp6_tx_pkt[UDPSZ];/**< UDP transmit buffer.	    */
-    pj_ioqueue_op_key_t	 udp6_op_rx_key;/**< UDP read operation key.	    */
-    pj_ioqueue_op_key_t	 udp6_op_tx_key;/**< UDP write operation key.	    */
-    pj_sockaddr		 udp6_src_addr;	/**< Source address of packet	    */
-    int			 udp6_addr_len;	/**< Source address length.	    */
+    struct udp_sock	 udp6[UDP_SOCK_CNT];	/**< IPv6 UDP sockets.	    */
 #endif
+    unsigned char	 udp_tx_pkt[UDP_SOCK_CNT][UDPSZ];
+					/**< UDP transmit buffers.	    */
+    unsigned		 udp_next;	/**< Next socket to send queries.   */
+    struct tcp_conn	 tcp[PJ_DNS_RESOLVER_MAX_NS];
+					/**< TCP connection to each NS.	    */
 
     /* Settings */
     pj_dns_settings	 settings;	/**< Resolver settings.		    */
@@ -205,11 +275,18 @@ struct pj_dns_resolver
     unsigned		 ns_count;	/**< Number of name servers.	    */
     struct nameserver	 ns[PJ_DNS_RESOLVER_MAX_NS];	/**< Array of NS.   */
 
-    /* Last DNS transaction ID used. */
-    pj_uint16_t		 last_id;
-
-    /* Hash table for cached response */
+    /* Hash table for cached response. It's modified with both the group
+     * lock and the write lock of cache_lock held, and looked up with either
+     * of them.
+     */
     pj_hash_table_t	*hrescache;	/**< Cached response in hash table  */
+    pj_rwmutex_t	*cache_lock;	/**< Response cache lock.	    */
+
+    /* Response cache statistics */
+    unsigned		 cache_hit;	/**< Answered from the cache.	    */
+    unsigned		 cache_miss;	/**< Not found or expired.	    */
+    unsigned		 cache_prefetch;/**< Entries refreshed early.	    */
+    unsigned		 cache_stale;	/**< Answered with stale entries.   */
 
     /* Pending asynchronous query, hashed by transaction ID. */
     pj_hash_table_t	*hquerybyid;
@@ -239,47 +316,129 @@ static pj_status_t select_nameservers(pj_dns_resolver *resolver,
 /* Destructor */
 static void dns_resolver_on_destroy(void *member);
 
-/* Close UDP socket */
-static void close_sock(pj_dns_resolver *resv)
+/* Callbacks from ioqueue for the TCP connections */
+static void tcp_on_read_complete(pj_ioqueue_key_t *key, 
+				 pj_ioqueue_op_key_t *op_key, 
+				 pj_ssize_t bytes_read);
+static void tcp_on_write_complete(pj_ioqueue_key_t *key, 
+				  pj_ioqueue_op_key_t *op_key, 
+				  pj_ssize_t bytes_sent);
+static void tcp_on_connect_complete(pj_ioqueue_key_t *key,
+				    pj_status_t status);
+
+/* Callback to close idle TCP connection */
+static void on_tcp_idle(pj_timer_heap_t *timer_heap,
+			struct pj_timer_entry *entry);
+
+/* TCP fallback for truncated responses */
+static void check_tcp_idle(struct tcp_conn *tc);
+static pj_status_t send_tcp_query(pj_dns_resolver *resolver,
+				  pj_dns_async_query *q,
+				  const pj_sockaddr *ns_addr);
+
+
+/* Close one UDP socket */
+static void close_udp_sock(struct udp_sock *us)
 {
-    /* Close existing socket */
-    if (resv->udp_key != NULL) {
-	pj_ioqueue_unregister(resv->udp_key);
-	resv->udp_key = NULL;
-	resv->udp_sock = PJ_INVALID_SOCKET;
-    } else if (resv->udp_sock != PJ_INVALID_SOCKET) {
-	pj_sock_close(resv->udp_sock);
-	resv->udp_sock = PJ_INVALID_SOCKET;
+    if (us->key != NULL) {
+	pj_ioqueue_unregister(us->key);
+	us->key = NULL;
+	us->sock = PJ_INVALID_SOCKET;
+    } else if (us->sock != PJ_INVALID_SOCKET) {
+	pj_sock_close(us->sock);
+	us->sock = PJ_INVALID_SOCKET;
     }
+}
 
-#if PJ_HAS_IPV6
-    if (resv->udp6_key != NULL) {
-	pj_ioqueue_unregister(resv->udp6_key);
-	resv->udp6_key = NULL;
-	resv->udp6_sock = PJ_INVALID_SOCKET;
-    } else if (resv->udp6_sock != PJ_INVALID_SOCKET) {
-	pj_sock_close(resv->udp6_sock);
-	resv->udp6_sock = PJ_INVALID_SOCKET;
+
+/* Close TCP connection. Queries still waiting for response over the
+ * connection will time out.
+ */
+static void close_tcp(struct tcp_conn *tc)
+{
+    if (tc->idle_timer.id) {
+	pj_timer_heap_cancel(tc->resolver->timer, &tc->idle_timer);
+	tc->idle_timer.id = 0;
+    }
+
+    while (!pj_list_empty(&tc->pending)) {
+	pj_dns_async_query *q = tc->pending.next;
+	pj_list_erase(q);
+	q->tcp = NULL;
     }
+
+    if (tc->key != NULL) {
+	pj_ioqueue_unregister(tc->key);
+	tc->key = NULL;
+    }
+    tc->connected = PJ_FALSE;
+    tc->tx_len = tc->queue_len = 0;
+}
+
+
+/* Close UDP sockets and TCP connections */
+static void close_sock(pj_dns_resolver *resv)
+{
+    unsigned i;
+
+    for (i=0; i<PJ_ARRAY_SIZE(resv->tcp); ++i)
+	close_tcp(&resv->tcp[i]);
+
+    for (i=0; i<UDP_SOCK_CNT; ++i) {
+	close_udp_sock(&resv->udp[i]);
+#if PJ_HAS_IPV6
+	close_udp_sock(&resv->udp6[i]);
 #endif
+    }
 }
 
 
-/* Initialize UDP socket */
-static pj_status_t init_sock(pj_dns_resolver *resv)
+/* Bind the socket to a random port (RFC 5452), taken from the dynamic
+ * port range to not collide with the ports configured for other
+ * services. Let the OS choose the port if these are all busy.
+ */
+static pj_status_t bind_random_port(pj_sock_t sock, int af)
 {
-    pj_ioqueue_callback socket_cb;
     pj_sockaddr bound_addr;
+    unsigned i;
+    pj_status_t status;
+
+    pj_sockaddr_init(af, &bound_addr, NULL, 0);
+
+    for (i=0; i<BIND_RETRY; ++i) {
+	unsigned port = PORT_RANGE_START +
+			(unsigned)pj_rand() % (65536 - PORT_RANGE_START);
+
+	pj_sockaddr_set_port(&bound_addr, (pj_uint16_t)port);
+	status = pj_sock_bind(sock, &bound_addr,
+			      pj_sockaddr_get_len(&bound_addr));
+	if (status == PJ_SUCCESS)
+	    return PJ_SUCCESS;
+    }
+
+    pj_sockaddr_set_port(&bound_addr, 0);
+    return pj_sock_bind(sock, &bound_addr, pj_sockaddr_get_len(&bound_addr));
+}
+
+
+/* Initialize one UDP socket */
+static pj_status_t init_udp_sock(pj_dns_resolver *resv,
+				 struct udp_sock *us,
+				 int af)
+{
+    pj_ioqueue_callback socket_cb;
     pj_ssize_t rx_pkt_size;
     pj_status_t status;
 
     /* Create the UDP socket */
-    status = pj_sock_socket(pj_AF_INET(), pj_SOCK_DGRAM(), 0, &resv->udp_sock);
-    if (status != PJ_SUCCESS)
+    status = pj_sock_socket(af, pj_SOCK_DGRAM(), 0, &us->sock);
+    if (status != PJ_SUCCESS) {
+	us->sock = PJ_INVALID_SOCKET;
 	return status;
+    }
 
-    /* Bind to any address/port */
-    status = pj_sock_bind_in(resv->udp_sock, 0, 0);
+    /* Bind to any address and random port */
+    status = bind_random_port(us->sock, af);
     if (status != PJ_SUCCESS)
 	return status;
 
@@ -287,74 +446,54 @@ static pj_status_t init_sock(pj_dns_resolver *resv)
     pj_bzero(&socket_cb, sizeof(socket_cb));
     socket_cb.on_read_complete = &on_read_complete;
     status = pj_ioqueue_register_sock2(resv->pool, resv->ioqueue,
-				       resv->udp_sock, resv->grp_lock,
-				       resv, &socket_cb, &resv->udp_key);
+				       us->sock, resv->grp_lock,
+				       us, &socket_cb, &us->key);
     if (status != PJ_SUCCESS)
 	return status;
 
-    pj_ioqueue_op_key_init(&resv->udp_op_rx_key, sizeof(resv->udp_op_rx_key));
-    pj_ioqueue_op_key_init(&resv->udp_op_tx_key, sizeof(resv->udp_op_tx_key));
+    pj_ioqueue_op_key_init(&us->op_rx_key, sizeof(us->op_rx_key));
+    pj_ioqueue_op_key_init(&us->op_tx_key, sizeof(us->op_tx_key));
 
     /* Start asynchronous read to the UDP socket */
-    rx_pkt_size = sizeof(resv->udp_rx_pkt);
-    resv->udp_addr_len = sizeof(resv->udp_src_addr);
-    status = pj_ioqueue_recvfrom(resv->udp_key, &resv->udp_op_rx_key,
-				 resv->udp_rx_pkt, &rx_pkt_size,
+    rx_pkt_size = sizeof(us->rx_pkt);
+    us->addr_len = sizeof(us->src_addr);
+    status = pj_ioqueue_recvfrom(us->key, &us->op_rx_key,
+				 us->rx_pkt, &rx_pkt_size,
 				 PJ_IOQUEUE_ALWAYS_ASYNC,
-				 &resv->udp_src_addr, &resv->udp_addr_len);
+				 &us->src_addr, &us->addr_len);
     if (status != PJ_EPENDING)
 	return status;
 
+    return PJ_SUCCESS;
+}
 
-#if PJ_HAS_IPV6
-    /* Also setup IPv6 socket */
 
-    /* Create the UDP socket */
-    status = pj_sock_socket(pj_AF_INET6(), pj_SOCK_DGRAM(), 0,
-			    &resv->udp6_sock);
-    if (status != PJ_SUCCESS) {
-	/* Skip IPv6 socket on system without IPv6 (see ticket #1953) */
+/* Initialize UDP sockets */
+static pj_status_t init_sock(pj_dns_resolver *resv)
+{
+    unsigned i;
+    pj_status_t status;
+
+    for (i=0; i<UDP_SOCK_CNT; ++i) {
+	status = init_udp_sock(resv, &resv->udp[i], pj_AF_INET());
+	if (status != PJ_SUCCESS)
+	    return status;
+    }
+
+#if PJ_HAS_IPV6
+    /* Also setup IPv6 sockets */
+    for (i=0; i<UDP_SOCK_CNT; ++i) {
+	status = init_udp_sock(resv, &resv->udp6[i], pj_AF_INET6());
 	if (status == PJ_STATUS_FROM_OS(OSERR_EAFNOSUPPORT)) {
+	    /* Skip IPv6 socket on system without IPv6 (see ticket #1953) */
 	    PJ_LOG(3,(resv->name.ptr,
 		      "System does not support IPv6, resolver will "
 		      "ignore any IPv6 nameservers"));
 	    return PJ_SUCCESS;
+	} else if (status != PJ_SUCCESS) {
+	    return status;
 	}
-	return status;
     }
-
-    /* Bind to any address/port */
-    pj_sockaddr_init(pj_AF_INET6(), &bound_addr, NULL, 0);
-    status = pj_sock_bind(resv->udp6_sock, &bound_addr,
-			  pj_sockaddr_get_len(&bound_addr));
-    if (status != PJ_SUCCESS)
-	return status;
-
-    /* Register to ioqueue */
-    pj_bzero(&socket_cb, sizeof(socket_cb));
-    socket_cb.on_read_complete = &on_read_complete;
-    status = pj_ioqueue_register_sock2(resv->pool, resv->ioqueue,
-				       resv->udp6_sock, resv->grp_lock,
-				       resv, &socket_cb, &resv->udp6_key);
-    if (status != PJ_SUCCESS)
-	return status;
-
-    pj_ioqueue_op_key_init(&resv->udp6_op_rx_key,
-			   sizeof(resv->udp6_op_rx_key));
-    pj_ioqueue_op_key_init(&resv->udp6_op_tx_key,
-			   sizeof(resv->udp6_op_tx_key));
-
-    /* Start asynchronous read to the UDP socket */
-    rx_pkt_size = sizeof(resv->udp6_rx_pkt);
-    resv->udp6_addr_len = sizeof(resv->udp6_src_addr);
-    status = pj_ioqueue_recvfrom(resv->udp6_key, &resv->udp6_op_rx_key,
-				 resv->udp6_rx_pkt, &rx_pkt_size,
-				 PJ_IOQUEUE_ALWAYS_ASYNC,
-				 &resv->udp6_src_addr, &resv->udp6_addr_len);
-    if (status != PJ_EPENDING)
-	return status;
-#else
-    PJ_UNUSED_ARG(bound_addr);
 #endif
 
     return PJ_SUCCESS;
@@ -370,6 +509,9 @@ PJ_DEF(void) pj_dns_settings_default(pj_dns_settings *s)
     s->cache_max_ttl = PJ_DNS_RESOLVER_MAX_TTL;
     s->good_ns_ttl = PJ_DNS_RESOLVER_GOOD_NS_TTL;
     s->bad_ns_ttl = PJ_DNS_RESOLVER_BAD_NS_TTL;
+    s->cache_prefetch_pct = PJ_DNS_RESOLVER_PREFETCH_PCT;
+    s->cache_stale_ttl = PJ_DNS_RESOLVER_STALE_TTL;
+    s->tcp_fallback = PJ_DNS_RESOLVER_TCP_FALLBACK;
 }
 
 
@@ -385,6 +527,7 @@ PJ_DEF(pj_status_t) pj_dns_resolver_create( pj_pool_factory *pf,
 {
     pj_pool_t *pool;
     pj_dns_resolver *resv;
+    unsigned i;
     pj_status_t status;
 
     /* Sanity check */
@@ -401,8 +544,25 @@ PJ_DEF(pj_status_t) pj_dns_resolver_create( pj_pool_factory *pf,
     /* Create pool and name */
     resv = PJ_POOL_ZALLOC_T(pool, struct pj_dns_resolver);
     resv->pool = pool;
-    resv->udp_sock = PJ_INVALID_SOCKET;
     pj_strdup2_with_null(pool, &resv->name, name);
+
+    for (i=0; i<UDP_SOCK_CNT; ++i) {
+	resv->udp[i].resolver = resv;
+	resv->udp[i].idx = i;
+	resv->udp[i].sock = PJ_INVALID_SOCKET;
+#if PJ_HAS_IPV6
+	resv->udp6[i].resolver = resv;
+	resv->udp6[i].idx = i;
+	resv->udp6[i].sock = PJ_INVALID_SOCKET;
+#endif
+    }
+    for (i=0; i<PJ_ARRAY_SIZE(resv->tcp); ++i) {
+	struct tcp_conn *tc = &resv->tcp[i];
+
+	tc->resolver = resv;
+	pj_list_init(&tc->pending);
+	pj_timer_entry_init(&tc->idle_timer, 0, tc, &on_tcp_idle);
+    }
     
     /* Create group lock */
     status = pj_grp_lock_create_w_handler(pool, NULL, resv,
@@ -413,10 +573,14 @@ PJ_DEF(pj_status_t) pj_dns_resolver_create( pj_pool_factory *pf,
 
     pj_grp_lock_add_ref(resv->grp_lock);
 
+    /* Create response cache lock */
+    status = pj_rwmutex_create(pool, name, &resv->cache_lock);
+    if (status != PJ_SUCCESS)
+	goto on_error;
+
     /* Timer, ioqueue, and settings */
     resv->timer = timer;
     resv->ioqueue = ioqueue;
-    resv->last_id = 1;
 
     pj_dns_settings_default(&resv->settings);
     resv->settings.options = options;
@@ -438,11 +602,14 @@ PJ_DEF(pj_status_t) pj_dns_resolver_create( pj_pool_factory *pf,
     }
 
     /* Response cache hash table */
-    resv->hrescache = pj_hash_create(pool, RES_HASH_TABLE_SIZE);
+    resv->hrescache = pj_hash_create2(pool, RES_HASH_TABLE_SIZE,
+				      PJ_HASH_OPT_OPEN_ADDRESSING);
 
     /* Query hash table and free list. */
-    resv->hquerybyid = pj_hash_create(pool, Q_HASH_TABLE_SIZE);
-    resv->hquerybyres = pj_hash_create(pool, Q_HASH_TABLE_SIZE);
+    resv->hquerybyid = pj_hash_create2(pool, Q_HASH_TABLE_SIZE,
+				       PJ_HASH_OPT_OPEN_ADDRESSING);
+    resv->hquerybyres = pj_hash_create2(pool, Q_HASH_TABLE_SIZE,
+				        PJ_HASH_OPT_OPEN_ADDRESSING);
     pj_list_init(&resv->query_free_nodes);
 
     /* Initialize the UDP socket */
@@ -463,6 +630,11 @@ on_error:
 void dns_resolver_on_destroy(void *member)
 {
     pj_dns_resolver *resolver = (pj_dns_resolver*)member;
+
+    if (resolver->cache_lock) {
+	pj_rwmutex_destroy(resolver->cache_lock);
+	resolver->cache_lock = NULL;
+    }
     pj_pool_safe_release(&resolver->pool);
 }
 
@@ -511,13 +683,13 @@ PJ_DEF(pj_status_t) pj_dns_resolver_destroy( pj_dns_resolver *resolver,
 	it = pj_hash_first(resolver->hrescache, &it_buf);
     }
 
+    close_sock(resolver);
+
     if (resolver->own_timer && resolver->timer) {
 	pj_timer_heap_destroy(resolver->timer);
 	resolver->timer = NULL;
     }
 
-    close_sock(resolver);
-
     if (resolver->own_ioqueue && resolver->ioqueue) {
 	pj_ioqueue_destroy(resolver->ioqueue);
 	resolver->ioqueue = NULL;
@@ -553,6 +725,10 @@ PJ_DEF(pj_status_t) pj_dns_resolver_set_ns( pj_dns_resolver *resolver,
     resolver->ns_count = 0;
     pj_bzero(resolver->ns, sizeof(resolver->ns));
 
+    /* The TCP connections are to the previous nameservers */
+    for (i=0; i<PJ_ARRAY_SIZE(resolver->tcp); ++i)
+	close_tcp(&resolver->tcp[i]);
+
     pj_gettimeofday(&now);
 
     for (i=0; i<count; ++i) {
@@ -659,12 +835,57 @@ static pj_dns_async_query *alloc_qnode(pj_dns_resolver *resolver,
 }
 
 
+/* Check if a send operation is pending on the socket(s) with this index */
+static pj_bool_t is_sock_busy(pj_dns_resolver *resolver, unsigned idx)
+{
+    if (pj_ioqueue_is_pending(resolver->udp[idx].key,
+			      &resolver->udp[idx].op_tx_key))
+    {
+	return PJ_TRUE;
+    }
+#if PJ_HAS_IPV6
+    if (resolver->udp6[idx].key &&
+	pj_ioqueue_is_pending(resolver->udp6[idx].key,
+			      &resolver->udp6[idx].op_tx_key))
+    {
+	return PJ_TRUE;
+    }
+#endif
+    return PJ_FALSE;
+}
+
+
+/* Select the socket to send a new query on, in round robin, skipping
+ * the busy ones.
+ */
+static unsigned select_sock(pj_dns_resolver *resolver)
+{
+    unsigned i, idx = resolver->udp_next;
+
+    for (i=0; i<UDP_SOCK_CNT; ++i) {
+	unsigned j = (resolver->udp_next + i) % UDP_SOCK_CNT;
+	if (!is_sock_busy(resolver, j)) {
+	    idx = j;
+	    break;
+	}
+    }
+
+    resolver->udp_next = (idx + 1) % UDP_SOCK_CNT;
+    return idx;
+}
+
+
 /*
  * Transmit query.
  */
 static pj_status_t transmit_query(pj_dns_resolver *resolver,
 				  pj_dns_async_query *q)
 {
+    struct udp_sock *us;
+#if PJ_HAS_IPV6
+    struct udp_sock *us6;
+#endif
+    unsigned char *tx_pkt;
     unsigned pkt_size;
     unsigned i, server_cnt, send_cnt;
     unsigned servers[PJ_DNS_RESOLVER_MAX_NS];
@@ -701,15 +922,18 @@ static pj_status_t transmit_query(pj_dns_resolver *resolver,
 	return status;
     }
 
-    /* Check if the socket is available for sending */
-    if (pj_ioqueue_is_pending(resolver->udp_key, &resolver->udp_op_tx_key)
+    /* Spread new queries over the sockets. Retransmissions are sent on
+     * the same socket, since the response is only accepted there.
+     */
+    if (q->transmit_cnt == 0)
+	q->sock_idx = select_sock(resolver);
+    us = &resolver->udp[q->sock_idx];
 #if PJ_HAS_IPV6
-	|| (resolver->udp6_key &&
-	    pj_ioqueue_is_pending(resolver->udp6_key,
-				  &resolver->udp6_op_tx_key))
+    us6 = &resolver->udp6[q->sock_idx];
 #endif
-	)
-    {
+
+    /* Check if the socket is available for sending */
+    if (is_sock_busy(resolver, q->sock_idx)) {
 	++q->transmit_cnt;
 	PJ_LOG(4,(resolver->name.ptr,
 		  "Socket busy in transmitting DNS %s query for %s%s",
@@ -721,9 +945,10 @@ static pj_status_t transmit_query(pj_dns_resolver *resolver,
     }
 
     /* Create DNS query packet */
-    pkt_size = sizeof(resolver->udp_tx_pkt);
+    tx_pkt = resolver->udp_tx_pkt[q->sock_idx];
+    pkt_size = UDPSZ;
     name = pj_str(q->key.name);
-    status = pj_dns_make_query(resolver->udp_tx_pkt, &pkt_size,
+    status = pj_dns_make_query(tx_pkt, &pkt_size,
 			       q->id, q->key.qtype, &name);
     if (status != PJ_SUCCESS) {
 	pj_timer_heap_cancel(resolver->timer, &q->timer_entry);
@@ -741,19 +966,17 @@ static pj_status_t transmit_query(pj_dns_resolver *resolver,
 	struct nameserver *ns = &resolver->ns[servers[i]];
 
 	if (ns->addr.addr.sa_family == pj_AF_INET()) {
-	    status = pj_ioqueue_sendto(resolver->udp_key,
-				       &resolver->udp_op_tx_key,
-				       resolver->udp_tx_pkt, &sent, 0,
+	    status = pj_ioqueue_sendto(us->key, &us->op_tx_key,
+				       tx_pkt, &sent, 0,
 				       &ns->addr,
 				       pj_sockaddr_get_len(&ns->addr));
 	    if (status == PJ_SUCCESS || status == PJ_EPENDING)
 		send_cnt++;
 	}
 #if PJ_HAS_IPV6
-	else if (resolver->udp6_key) {
-	    status = pj_ioqueue_sendto(resolver->udp6_key,
-				       &resolver->udp6_op_tx_key,
-				       resolver->udp_tx_pkt, &sent, 0,
+	else if (us6->key) {
+	    status = pj_ioqueue_sendto(us6->key, &us6->op_tx_key,
+				       tx_pkt, &sent, 0,
 				       &ns->addr,
 				       pj_sockaddr_get_len(&ns->addr));
 	    if (status == PJ_SUCCESS || status == PJ_EPENDING)
@@ -773,7 +996,15 @@ static pj_status_t transmit_query(pj_dns_resolver *resolver,
 		  pj_dns_get_type_name(q->key.qtype), 
 		  q->key.name));
 
-	if (ns->q_id == 0) {
+	/* Measure the response time with this query, unless the query
+	 * being measured is still pending. A query which was never answered
+	 * by this nameserver must not stop the measurement, and its random
+	 * ID could be picked again by a later query.
+	 */
+	if (ns->q_id == 0 ||
+	    pj_hash_get(resolver->hquerybyid, &ns->q_id,
+			sizeof(ns->q_id), NULL) == NULL)
+	{
 	    ns->q_id = q->id;
 	    ns->sent_time = now;
 	}
@@ -853,152 +1084,193 @@ static void free_entry(pj_dns_resolver *resolver, struct cached_res *cache)
     pj_pool_release(cache->pool);
 }
 
+/* Release a reference to the cache entry, with the cache write lock held */
+static void unref_entry(pj_dns_resolver *resolver, struct cached_res *cache)
+{
+    if (ATOMIC_DEC(cache->ref_cnt) == 0)
+	free_entry(resolver, cache);
+}
+
+/* Release a reference to the cache entry, without holding any lock */
+static void release_entry(pj_dns_resolver *resolver, struct cached_res *cache)
+{
+#if CACHE_HAS_ATOMIC
+    unref_entry(resolver, cache);
+#else
+    pj_rwmutex_lock_write(resolver->cache_lock);
+    unref_entry(resolver, cache);
+    pj_rwmutex_unlock_write(resolver->cache_lock);
+#endif
+}
 
-/*
- * Create and start asynchronous DNS query for a single resource.
+/* Check if the cache entry may still be returned when the nameservers fail
+ * to answer, i.e. it hasn't expired or it's within the stale period.
  */
-PJ_DEF(pj_status_t) pj_dns_resolver_start_query( pj_dns_resolver *resolver,
-						 const pj_str_t *name,
-						 int type,
-						 unsigned options,
-						 pj_dns_callback *cb,
-						 void *user_data,
-						 pj_dns_async_query **p_query)
+static pj_bool_t is_entry_usable(pj_dns_resolver *resolver,
+				 const struct cached_res *cache,
+				 const pj_time_val *now)
+{
+    return PJ_TIME_VAL_GT(cache->expiry_time, *now) ||
+	   now->sec - cache->expiry_time.sec <
+	   (long)resolver->settings.cache_stale_ttl;
+}
+
+/* Look up a cached response which hasn't expired, and add a reference to
+ * it. This only takes the cache read lock. If the entry is about to expire,
+ * it's marked as being refreshed and *prefetch is set.
+ */
+static struct cached_res *get_entry(pj_dns_resolver *resolver,
+				    const struct res_key *key,
+				    const pj_time_val *now,
+				    pj_bool_t *prefetch)
 {
-    pj_time_val now;
-    struct res_key key;
     struct cached_res *cache;
-    pj_dns_async_query *q, *p_q = NULL;
-    pj_uint32_t hval;
-    pj_status_t status = PJ_SUCCESS;
 
-    /* Validate arguments */
-    PJ_ASSERT_RETURN(resolver && name && type, PJ_EINVAL);
+    *prefetch = PJ_FALSE;
 
-    /* Check name is not too long. */
-    PJ_ASSERT_RETURN(name->slen>0 && name->slen < PJ_MAX_HOSTNAME,
-		     PJ_ENAMETOOLONG);
+    CACHE_LOCK_READ(resolver);
 
-    /* Check type */
-    PJ_ASSERT_RETURN(type > 0 && type < 0xFFFF, PJ_EINVAL);
+    cache = (struct cached_res *) pj_hash_get(resolver->hrescache, key,
+					      sizeof(*key), NULL);
+    if (cache && PJ_TIME_VAL_GT(cache->expiry_time, *now)) {
+	unsigned pct = resolver->settings.cache_prefetch_pct;
 
-    /* Build resource key for looking up hash tables */
-    init_res_key(&key, type, name);
+	ATOMIC_INC(cache->ref_cnt);
+	ATOMIC_INC(resolver->cache_hit);
 
-    /* Start working with the resolver */
-    pj_grp_lock_acquire(resolver->grp_lock);
+	if (pct && cache->ttl) {
+	    pj_time_val left = cache->expiry_time;
 
-    /* Get current time. */
-    pj_gettimeofday(&now);
+	    PJ_TIME_VAL_SUB(left, *now);
+	    if ((unsigned)PJ_TIME_VAL_MSEC(left) / 10 < cache->ttl * pct &&
+		ATOMIC_CAS(cache->prefetching, 0, 1))
+	    {
+		*prefetch = PJ_TRUE;
+	    }
+	}
+    } else {
+	cache = NULL;
+    }
 
-    /* First, check if we have cached response for the specified name/type,
-     * and the cached entry has not expired.
-     */
-    hval = 0;
-    cache = (struct cached_res *) pj_hash_get(resolver->hrescache, &key, 
-    					      sizeof(key), &hval);
-    if (cache) {
-	/* We've found a cached entry. */
+    CACHE_UNLOCK_READ(resolver);
 
-	/* Check for expiration */
-	if (PJ_TIME_VAL_GT(cache->expiry_time, now)) {
+    return cache;
+}
 
-	    /* Log */
-	    PJ_LOG(5,(resolver->name.ptr, 
-		      "Picked up DNS %s record for %.*s from cache, ttl=%d",
-		      pj_dns_get_type_name(type),
-		      (int)name->slen, name->ptr,
-		      (int)(cache->expiry_time.sec - now.sec)));
+/* Get the cached response to be returned instead when the nameservers fail
+ * to answer, and add a reference to it. Must be called with the group lock
+ * held.
+ */
+static struct cached_res *get_fallback_entry(pj_dns_resolver *resolver,
+					     const struct res_key *key)
+{
+    struct cached_res *cache;
+    pj_time_val now;
 
-	    /* Map DNS Rcode in the response into PJLIB status name space */
-	    status = PJ_DNS_GET_RCODE(cache->pkt->hdr.flags);
-	    status = PJ_STATUS_FROM_DNS_RCODE(status);
+    pj_gettimeofday(&now);
 
-	    /* Workaround for deadlock problem. Need to increment the cache's
-	     * ref counter first before releasing mutex, so the cache won't be
-	     * destroyed by other thread while in callback.
-	     */
-	    cache->ref_cnt++;
-	    pj_grp_lock_release(resolver->grp_lock);
+    CACHE_LOCK_READ(resolver);
 
-	    /* This cached response is still valid. Just return this
-	     * response to caller.
-	     */
-	    if (cb) {
-		(*cb)(user_data, status, cache->pkt);
-	    }
+    cache = (struct cached_res *) pj_hash_get(resolver->hrescache, key,
+					      sizeof(*key), NULL);
+    if (cache && is_entry_usable(resolver, cache, &now)) {
+	ATOMIC_INC(cache->ref_cnt);
+	if (PJ_TIME_VAL_LTE(cache->expiry_time, now)) {
+	    ++resolver->cache_stale;
+	    PJ_LOG(4,(resolver->name.ptr,
+		      "Nameservers failed, using stale DNS %s record for %s",
+		      pj_dns_get_type_name(key->qtype), key->name));
+	}
+    } else {
+	cache = NULL;
+    }
 
-	    /* Done. No host resolution is necessary */
-	    pj_grp_lock_acquire(resolver->grp_lock);
+    CACHE_UNLOCK_READ(resolver);
 
-	    /* Decrement the ref counter. Also check if it is time to free
-	     * the cache (as it has been expired).
-	     */
-	    cache->ref_cnt--;
-	    if (cache->ref_cnt <= 0)
-		free_entry(resolver, cache);
+    return cache;
+}
 
-	    /* Must return PJ_SUCCESS */
-	    status = PJ_SUCCESS;
+/* The cache entry is no longer being refreshed, without being updated */
+static void end_prefetch(pj_dns_resolver *resolver, const struct res_key *key)
+{
+    struct cached_res *cache;
 
-	    /*
-	     * We cannot write to *p_query after calling cb because what
-	     * p_query points to may have been freed by cb.
-             * Refer to ticket #1974.
-	     */
-	    pj_grp_lock_release(resolver->grp_lock);
-	    return status;
-	}
+    CACHE_LOCK_READ(resolver);
+    cache = (struct cached_res *) pj_hash_get(resolver->hrescache, key,
+					      sizeof(*key), NULL);
+    if (cache)
+	ATOMIC_CAS(cache->prefetching, 1, 0);
+    CACHE_UNLOCK_READ(resolver);
+}
 
-	/* At this point, we have a cached entry, but this entry has expired.
-	 * Remove this entry from the cached list.
-	 */
-	pj_hash_set(NULL, resolver->hrescache, &key, sizeof(key), 0, NULL);
+/* Remove the cached response which has expired, unless it may still be
+ * served stale. Must be called with the group lock held.
+ */
+static void remove_expired_entry(pj_dns_resolver *resolver,
+				 const struct res_key *key,
+				 const pj_time_val *now)
+{
+    struct cached_res *cache;
+    pj_uint32_t hval = 0;
 
-	/* Also free the cache, if it is not being used (by callback). */
-	cache->ref_cnt--;
-	if (cache->ref_cnt <= 0)
-	    free_entry(resolver, cache);
+    pj_rwmutex_lock_write(resolver->cache_lock);
 
-	/* Must continue with creating a query now */
-    }
+    cache = (struct cached_res *) pj_hash_get(resolver->hrescache, key,
+					      sizeof(*key), &hval);
+    if (cache && !is_entry_usable(resolver, cache, now)) {
+	pj_hash_set(NULL, resolver->hrescache, key, sizeof(*key), hval, NULL);
 
-    /* Next, check if we have pending query on the same resource */
-    q = (pj_dns_async_query *) pj_hash_get(resolver->hquerybyres, &key, 
-    					   sizeof(key), NULL);
-    if (q) {
-	/* Yes, there's another pending query to the same key.
-	 * Just create a new child query and add this query to
-	 * pending query's child queries.
-	 */
-	pj_dns_async_query *nq;
+	/* Also free the cache, if it is not being used (by callback). */
+	unref_entry(resolver, cache);
+    }
 
-	nq = alloc_qnode(resolver, options, user_data, cb);
-	pj_list_push_back(&q->child_head, nq);
+    pj_rwmutex_unlock_write(resolver->cache_lock);
+}
 
-	/* Done. This child query will be notified once the "parent"
-	 * query completes.
-	 */
-	p_q = nq;
-	status = PJ_SUCCESS;
-	goto on_return;
-    } 
 
-    /* There's no pending query to the same key, initiate a new one. */
-    q = alloc_qnode(resolver, options, user_data, cb);
+/* Pick a random transaction ID (RFC 5452) which is not used by pending
+ * queries. Returns zero if all of them are.
+ */
+static pj_uint16_t new_query_id(pj_dns_resolver *resolver)
+{
+    pj_uint16_t id = (pj_uint16_t)pj_rand();
+    unsigned i;
+
+    for (i=0; i<0xFFFF; ++i) {
+	if (id != 0 &&
+	    pj_hash_get(resolver->hquerybyid, &id, sizeof(id), NULL)==NULL)
+	{
+	    return id;
+	}
+	id = (pj_uint16_t)(i < ID_RETRY ? pj_rand() : id + 1);
+    }
+
+    return 0;
+}
+
+
+/* Assign ID to a new query, send it, and register it to the hash tables.
+ * The query is recycled on failure.
+ */
+static pj_status_t send_new_query(pj_dns_resolver *resolver,
+				  pj_dns_async_query *q,
+				  const struct res_key *key)
+{
+    pj_status_t status;
 
     /* Save the ID and key */
-    /* TODO: dnsext-forgery-resilient: randomize id for security */
-    q->id = resolver->last_id++;
-    if (resolver->last_id == 0)
-	resolver->last_id = 1;
-    pj_memcpy(&q->key, &key, sizeof(struct res_key));
+    q->id = new_query_id(resolver);
+    if (q->id == 0) {
+	pj_list_push_back(&resolver->query_free_nodes, q);
+	return PJ_ETOOMANY;
+    }
+    pj_memcpy(&q->key, key, sizeof(struct res_key));
 
     /* Send the query */
     status = transmit_query(resolver, q);
     if (status != PJ_SUCCESS) {
 	pj_list_push_back(&resolver->query_free_nodes, q);
-	goto on_return;
+	return status;
     }
 
     /* Add query entry to the hash tables */
@@ -1007,6 +1279,165 @@ PJ_DEF(pj_status_t) pj_dns_resolver_start_query( pj_dns_resolver *resolver,
     pj_hash_set_np(resolver->hquerybyres, &q->key, sizeof(q->key),
 		   0, q->hbufkey, q);
 
+    return PJ_SUCCESS;
+}
+
+
+/* Refresh the cached response before it expires. */
+static void prefetch_entry(pj_dns_resolver *resolver,
+			   const struct res_key *key)
+{
+    pj_grp_lock_acquire(resolver->grp_lock);
+
+    /* A pending query to the same resource will update the cache anyway */
+    if (pj_hash_get(resolver->hquerybyres, key, sizeof(*key), NULL) == NULL) {
+	pj_dns_async_query *q;
+	pj_status_t status;
+
+	q = alloc_qnode(resolver, 0, NULL, NULL);
+	status = send_new_query(resolver, q, key);
+	if (status == PJ_SUCCESS) {
+	    ++resolver->cache_prefetch;
+	    PJ_LOG(5,(resolver->name.ptr, "Prefetching DNS %s record for %s",
+		      pj_dns_get_type_name(key->qtype), key->name));
+	} else {
+	    PJ_PERROR(4,(resolver->name.ptr, status,
+			 "Error prefetching DNS %s record for %s",
+			 pj_dns_get_type_name(key->qtype), key->name));
+	    end_prefetch(resolver, key);
+	}
+    }
+
+    pj_grp_lock_release(resolver->grp_lock);
+}
+
+
+/*
+ * Create and start asynchronous DNS query for a single resource.
+ */
+PJ_DEF(pj_status_t) pj_dns_resolver_start_query( pj_dns_resolver *resolver,
+						 const pj_str_t *name,
+						 int type,
+						 unsigned options,
+						 pj_dns_callback *cb,
+						 void *user_data,
+						 pj_dns_async_query **p_query)
+{
+    pj_time_val now;
+    struct res_key key;
+    struct cached_res *cache;
+    pj_dns_async_query *q, *p_q = NULL;
+    pj_bool_t prefetch;
+    pj_status_t status = PJ_SUCCESS;
+
+    /* Validate arguments */
+    PJ_ASSERT_RETURN(resolver && name && type, PJ_EINVAL);
+
+    /* Check name is not too long. */
+    PJ_ASSERT_RETURN(name->slen>0 && name->slen < PJ_MAX_HOSTNAME,
+		     PJ_ENAMETOOLONG);
+
+    /* Check type */
+    PJ_ASSERT_RETURN(type > 0 && type < 0xFFFF, PJ_EINVAL);
+
+    /* Build resource key for looking up hash tables */
+    init_res_key(&key, type, name);
+
+    /* Get current time. */
+    pj_gettimeofday(&now);
+
+    /* First, check if we have cached response for the specified name/type,
+     * and the cached entry has not expired. This doesn't take the group
+     * lock, and the entry won't be destroyed while we hold its reference.
+     */
+    cache = get_entry(resolver, &key, &now, &prefetch);
+    if (cache) {
+	/* Log */
+	PJ_LOG(5,(resolver->name.ptr, 
+		  "Picked up DNS %s record for %.*s from cache, ttl=%d",
+		  pj_dns_get_type_name(type),
+		  (int)name->slen, name->ptr,
+		  (int)(cache->expiry_time.sec - now.sec)));
+
+	/* Map DNS Rcode in the response into PJLIB status name space */
+	status = PJ_DNS_GET_RCODE(cache->pkt->hdr.flags);
+	status = PJ_STATUS_FROM_DNS_RCODE(status);
+
+	/* This cached response is still valid. Just return this
+	 * response to caller.
+	 */
+	if (cb) {
+	    (*cb)(user_data, status, cache->pkt);
+	}
+
+	/* Done. No host resolution is necessary */
+	release_entry(resolver, cache);
+
+	/* Refresh the entry if it's about to expire */
+	if (prefetch)
+	    prefetch_entry(resolver, &key);
+
+	/*
+	 * We cannot write to *p_query after calling cb because what
+	 * p_query points to may have been freed by cb.
+	 * Refer to ticket #1974.
+	 */
+	return PJ_SUCCESS;
+    }
+
+    /* Start working with the resolver */
+    pj_grp_lock_acquire(resolver->grp_lock);
+
+    ++resolver->cache_miss;
+
+    /* If we have a cached entry which has expired, remove it from the
+     * cached list unless it may still be used when the query fails.
+     */
+    remove_expired_entry(resolver, &key, &now);
+
+    /* Next, check if we have pending query on the same resource */
+    q = (pj_dns_async_query *) pj_hash_get(resolver->hquerybyres, &key, 
+    					   sizeof(key), NULL);
+    if (q) {
+	/* Yes, there's another pending query to the same key.
+	 * Just create a new child query and add this query to
+	 * pending query's child queries.
+	 */
+	pj_dns_async_query *nq;
+
+	nq = alloc_qnode(resolver, options, user_data, cb);
+	pj_list_push_back(&q->child_head, nq);
+
+	/* Done. This child query will be notified once the "parent"
+	 * query completes.
+	 */
+	p_q = nq;
+	status = PJ_SUCCESS;
+	goto on_return;
+    } 
+
+    /* There's no pending query to the same key, initiate a new one. */
+    q = alloc_qnode(resolver, options, user_data, cb);
+
+    status = send_new_query(resolver, q, &key);
+    if (status != PJ_SUCCESS) {
+	/* No nameserver to send the query to, use the stale entry if
+	 * there's one.
+	 */
+	cache = get_fallback_entry(resolver, &key);
+	if (cache) {
+	    pj_grp_lock_release(resolver->grp_lock);
+
+	    status = PJ_DNS_GET_RCODE(cache->pkt->hdr.flags);
+	    if (cb)
+		(*cb)(user_data, PJ_STATUS_FROM_DNS_RCODE(status), cache->pkt);
+
+	    release_entry(resolver, cache);
+	    return PJ_SUCCESS;
+	}
+	goto on_return;
+    }
+
     p_q = q;
 
 on_return:
@@ -1455,6 +1886,8 @@ static void update_res_cache(pj_dns_resolver *resolver,
     struct cached_res *cache;
     pj_uint32_t hval=0, ttl;
 
+    pj_rwmutex_lock_write(resolver->cache_lock);
+
     /* If status is unsuccessful, clear the same entry from the cache */
     if (status != PJ_SUCCESS) {
 	cache = (struct cached_res *) pj_hash_get(resolver->hrescache, key, 
@@ -1463,8 +1896,8 @@ static void update_res_cache(pj_dns_resolver *resolver,
 	pj_hash_set(NULL, resolver->hrescache, key, sizeof(*key), hval, NULL);
 	
 	/* Free the entry */
-	if (cache && --cache->ref_cnt <= 0)
-	    free_entry(resolver, cache);
+	if (cache)
+	    unref_entry(resolver, cache);
     }
 
 
@@ -1504,8 +1937,9 @@ static void update_res_cache(pj_dns_resolver *resolver,
 	pj_hash_set(NULL, resolver->hrescache, key, sizeof(*key), hval, NULL);
 
 	/* Free the entry */
-	if (cache && --cache->ref_cnt <= 0)
-	    free_entry(resolver, cache);
+	if (cache)
+	    unref_entry(resolver, cache);
+	pj_rwmutex_unlock_write(resolver->cache_lock);
 	return;
     }
 
@@ -1520,7 +1954,7 @@ static void update_res_cache(pj_dns_resolver *resolver,
 	     * just decrement ref_cnt so it will be freed after
 	     * the callback returns and allocate new entry.
 	     */
-	    cache->ref_cnt--;
+	    unref_entry(resolver, cache);
 	    cache = alloc_entry(resolver);
 	} else {
 	    /* Reset cache to avoid bloated cache pool */
@@ -1542,6 +1976,7 @@ static void update_res_cache(pj_dns_resolver *resolver,
     if (set_expiry) {
 	pj_gettimeofday(&cache->expiry_time);
 	cache->expiry_time.sec += ttl;
+	cache->ttl = ttl;
     } else {
 	cache->expiry_time.sec = 0x7FFFFFFFL;
 	cache->expiry_time.msec = 0;
@@ -1554,6 +1989,7 @@ static void update_res_cache(pj_dns_resolver *resolver,
     pj_hash_set_np(resolver->hrescache, &cache->key, sizeof(*key), hval,
 		   cache->hbuf, cache);
 
+    pj_rwmutex_unlock_write(resolver->cache_lock);
 }
 
 
@@ -1563,6 +1999,8 @@ static void on_timeout( pj_timer_heap_t *timer_heap,
 {
     pj_dns_resolver *resolver;
     pj_dns_async_query *q, *cq;
+    struct cached_res *cache;
+    pj_dns_parsed_packet *pkt;
     pj_status_t status;
 
     PJ_UNUSED_ARG(timer_heap);
@@ -1604,21 +2042,44 @@ static void on_timeout( pj_timer_heap_t *timer_heap,
     pj_hash_set(NULL, resolver->hquerybyid, &q->id, sizeof(q->id), 0, NULL);
     pj_hash_set(NULL, resolver->hquerybyres, &q->key, sizeof(q->key), 0, NULL);
 
+    /* Stop waiting for the response over TCP */
+    if (q->tcp) {
+	struct tcp_conn *tc = q->tcp;
+
+	pj_list_erase(q);
+	q->tcp = NULL;
+	check_tcp_idle(tc);
+    }
+
+    /* Answer with the cached response instead, if it may still be used */
+    end_prefetch(resolver, &q->key);
+    cache = get_fallback_entry(resolver, &q->key);
+    if (cache) {
+	pkt = cache->pkt;
+	status = PJ_STATUS_FROM_DNS_RCODE(PJ_DNS_GET_RCODE(pkt->hdr.flags));
+    } else {
+	pkt = NULL;
+	status = PJ_ETIMEDOUT;
+    }
+
     /* Workaround for deadlock problem in #1565 (similar to #1108) */
     pj_grp_lock_release(resolver->grp_lock);
 
     /* Call application callback, if any. */
     if (q->cb)
-	(*q->cb)(q->user_data, PJ_ETIMEDOUT, NULL);
+	(*q->cb)(q->user_data, status, pkt);
 
     /* Call application callback for child queries. */
     cq = q->child_head.next;
     while (cq != (void*)&q->child_head) {
 	if (cq->cb)
-	    (*cq->cb)(cq->user_data, PJ_ETIMEDOUT, NULL);
+	    (*cq->cb)(cq->user_data, status, pkt);
 	cq = cq->next;
     }
 
+    if (cache)
+	release_entry(resolver, cache);
+
     /* Workaround for deadlock problem in #1565 (similar to #1108) */
     pj_grp_lock_acquire(resolver->grp_lock);
 
@@ -1641,91 +2102,21 @@ static void on_timeout( pj_timer_heap_t *timer_heap,
 }
 
 
-/* Callback from ioqueue when packet is received */
-static void on_read_complete(pj_ioqueue_key_t *key, 
-                             pj_ioqueue_op_key_t *op_key, 
-                             pj_ssize_t bytes_read)
+/* Handle DNS response received from a nameserver, on the UDP socket
+ * (us) or on the TCP connection (tc). Called with the group lock held,
+ * which is released while the callbacks are called.
+ */
+static void on_dns_response(pj_dns_resolver *resolver,
+			    pj_dns_parsed_packet *dns_pkt,
+			    const pj_sockaddr *src_addr,
+			    const struct udp_sock *us,
+			    struct tcp_conn *tc)
 {
-    pj_dns_resolver *resolver;
-    pj_pool_t *pool = NULL;
-    pj_dns_parsed_packet *dns_pkt;
+    pj_dns_parsed_packet *res_pkt;
     pj_dns_async_query *q;
+    struct cached_res *cache;
     char addr[PJ_INET6_ADDRSTRLEN];
-    pj_sockaddr *src_addr;
-    int *src_addr_len;
-    unsigned char *rx_pkt;
-    pj_ssize_t rx_pkt_size;
     pj_status_t status;
-    PJ_USE_EXCEPTION;
-
-
-    resolver = (pj_dns_resolver *) pj_ioqueue_get_user_data(key);
-    pj_assert(resolver);
-
-#if PJ_HAS_IPV6
-    if (key == resolver->udp6_key) {
-	src_addr = &resolver->udp6_src_addr;
-	src_addr_len = &resolver->udp6_addr_len;
-	rx_pkt = resolver->udp6_rx_pkt;
-	rx_pkt_size = sizeof(resolver->udp6_rx_pkt);
-    } else 
-#endif
-    {
-	src_addr = &resolver->udp_src_addr;
-	src_addr_len = &resolver->udp_addr_len;
-	rx_pkt = resolver->udp_rx_pkt;
-	rx_pkt_size = sizeof(resolver->udp_rx_pkt);
-    }
-
-    pj_grp_lock_acquire(resolver->grp_lock);
-
-
-    /* Check for errors */
-    if (bytes_read < 0) {
-	status = (pj_status_t)-bytes_read;
-	PJ_PERROR(4,(resolver->name.ptr, status, "DNS resolver read error"));
-
-	goto read_next_packet;
-    }
-
-    PJ_LOG(5,(resolver->name.ptr, 
-	      "Received %d bytes DNS response from %s:%d",
-	      (int)bytes_read, 
-	      pj_sockaddr_print(src_addr, addr, sizeof(addr), 2),
-	      pj_sockaddr_get_port(src_addr)));
-
-
-    /* Check for zero packet */
-    if (bytes_read == 0)
-	goto read_next_packet;
-
-    /* Create temporary pool from a fixed buffer */
-    pool = pj_pool_create_on_buf("restmp", resolver->tmp_pool, 
-				 sizeof(resolver->tmp_pool));
-
-    /* Parse DNS response */
-    status = -1;
-    dns_pkt = NULL;
-    PJ_TRY {
-	status = pj_dns_parse_packet(pool, rx_pkt, 
-				     (unsigned)bytes_read, &dns_pkt);
-    }
-    PJ_CATCH_ANY {
-	status = PJ_ENOMEM;
-    }
-    PJ_END;
-
-    /* Update nameserver status */
-    report_nameserver_status(resolver, src_addr, dns_pkt);
-
-    /* Handle parse error */
-    if (status != PJ_SUCCESS) {
-	PJ_PERROR(3,(resolver->name.ptr, status,
-		     "Error parsing DNS response from %s:%d", 
-		     pj_sockaddr_print(src_addr, addr, sizeof(addr), 2),
-		     pj_sockaddr_get_port(src_addr)));
-	goto read_next_packet;
-    }
 
     /* Find the query based on the transaction ID */
     q = (pj_dns_async_query*) 
@@ -1737,7 +2128,36 @@ static void on_read_complete(pj_ioqueue_key_t *key,
 		  pj_sockaddr_print(src_addr, addr, sizeof(addr), 2),
 		  pj_sockaddr_get_port(src_addr),
 		  (unsigned)dns_pkt->hdr.id));
-	goto read_next_packet;
+	return;
+    }
+
+    /* The response must arrive where the query was sent from */
+    if (q->tcp != tc || (us && q->sock_idx != us->idx)) {
+	PJ_LOG(5,(resolver->name.ptr, 
+		  "DNS response from %s:%d id=%d discarded: not received "
+		  "on the query socket",
+		  pj_sockaddr_print(src_addr, addr, sizeof(addr), 2),
+		  pj_sockaddr_get_port(src_addr),
+		  (unsigned)dns_pkt->hdr.id));
+	return;
+    }
+
+    /* Retry truncated response over TCP */
+    if (us && PJ_DNS_GET_TC(dns_pkt->hdr.flags) &&
+	resolver->settings.tcp_fallback)
+    {
+	status = send_tcp_query(resolver, q, src_addr);
+	if (status == PJ_SUCCESS)
+	    return;
+
+	PJ_PERROR(4,(resolver->name.ptr, status,
+		     "Error retrying DNS %s query for %s over TCP",
+		     pj_dns_get_type_name(q->key.qtype), q->key.name));
+    }
+
+    if (tc) {
+	pj_list_erase(q);
+	q->tcp = NULL;
     }
 
     /* Map DNS Rcode in the response into PJLIB status name space */
@@ -1752,6 +2172,22 @@ static void on_read_complete(pj_ioqueue_key_t *key,
     pj_hash_set(NULL, resolver->hquerybyid, &q->id, sizeof(q->id), 0, NULL);
     pj_hash_set(NULL, resolver->hquerybyres, &q->key, sizeof(q->key), 0, NULL);
 
+    /* If the nameserver fails, answer with the cached response instead
+     * if it may still be used, and keep it in the cache.
+     */
+    cache = NULL;
+    res_pkt = dns_pkt;
+    if (PJ_DNS_GET_RCODE(dns_pkt->hdr.flags) == PJ_DNS_RCODE_SERVFAIL ||
+	PJ_DNS_GET_RCODE(dns_pkt->hdr.flags) == PJ_DNS_RCODE_REFUSED)
+    {
+	cache = get_fallback_entry(resolver, &q->key);
+	if (cache) {
+	    res_pkt = cache->pkt;
+	    status = PJ_DNS_GET_RCODE(res_pkt->hdr.flags);
+	    status = PJ_STATUS_FROM_DNS_RCODE(status);
+	}
+    }
+
     /* Workaround for deadlock problem in #1108 */
     pj_grp_lock_release(resolver->grp_lock);
 
@@ -1759,7 +2195,7 @@ static void on_read_complete(pj_ioqueue_key_t *key,
      * record before it is saved to the hash table.
      */
     if (q->cb)
-	(*q->cb)(q->user_data, status, dns_pkt);
+	(*q->cb)(q->user_data, status, res_pkt);
 
     /* If query has subqueries, notify subqueries's application callback */
     if (!pj_list_empty(&q->child_head)) {
@@ -1768,7 +2204,7 @@ static void on_read_complete(pj_ioqueue_key_t *key,
 	child_q = q->child_head.next;
 	while (child_q != (pj_dns_async_query*)&q->child_head) {
 	    if (child_q->cb)
-		(*child_q->cb)(child_q->user_data, status, dns_pkt);
+		(*child_q->cb)(child_q->user_data, status, res_pkt);
 	    child_q = child_q->next;
 	}
     }
@@ -1776,10 +2212,16 @@ static void on_read_complete(pj_ioqueue_key_t *key,
     /* Workaround for deadlock problem in #1108 */
     pj_grp_lock_acquire(resolver->grp_lock);
 
-    /* Truncated responses MUST NOT be saved (cached). */
-    if (PJ_DNS_GET_TC(dns_pkt->hdr.flags) == 0) {
+    if (cache) {
+	/* The cached response is kept */
+	end_prefetch(resolver, &q->key);
+	release_entry(resolver, cache);
+    } else if (PJ_DNS_GET_TC(dns_pkt->hdr.flags) == 0) {
 	/* Save/update response cache. */
 	update_res_cache(resolver, &q->key, status, PJ_TRUE, dns_pkt);
+    } else {
+	/* Truncated responses MUST NOT be saved (cached). */
+	end_prefetch(resolver, &q->key);
     }
 
     /* Recycle query objects, starting with the child queries */
@@ -1795,6 +2237,82 @@ static void on_read_complete(pj_ioqueue_key_t *key,
 	}
     }
     pj_list_push_back(&resolver->query_free_nodes, q);
+}
+
+
+/* Callback from ioqueue when packet is received */
+static void on_read_complete(pj_ioqueue_key_t *key, 
+                             pj_ioqueue_op_key_t *op_key, 
+                             pj_ssize_t bytes_read)
+{
+    struct udp_sock *us;
+    pj_dns_resolver *resolver;
+    pj_pool_t *pool = NULL;
+    pj_dns_parsed_packet *dns_pkt;
+    char addr[PJ_INET6_ADDRSTRLEN];
+    pj_ssize_t rx_pkt_size;
+    pj_status_t status;
+    PJ_USE_EXCEPTION;
+
+
+    us = (struct udp_sock *) pj_ioqueue_get_user_data(key);
+    pj_assert(us);
+    resolver = us->resolver;
+
+    pj_grp_lock_acquire(resolver->grp_lock);
+
+
+    /* Check for errors */
+    if (bytes_read < 0) {
+	status = (pj_status_t)-bytes_read;
+	PJ_PERROR(4,(resolver->name.ptr, status, "DNS resolver read error"));
+
+	goto read_next_packet;
+    }
+
+    PJ_LOG(5,(resolver->name.ptr, 
+	      "Received %d bytes DNS response from %s:%d",
+	      (int)bytes_read, 
+	      pj_sockaddr_print(&us->src_addr, addr, sizeof(addr), 2),
+	      pj_sockaddr_get_port(&us->src_addr)));
+
+
+    /* Check for zero packet */
+    if (bytes_read == 0)
+	goto read_next_packet;
+
+    /* Create temporary pool from a fixed buffer. Each socket has its own
+     * buffer, since the responses on different sockets may be processed
+     * at the same time while the group lock is released.
+     */
+    pool = pj_pool_create_on_buf("restmp", us->tmp_pool, 
+				 sizeof(us->tmp_pool));
+
+    /* Parse DNS response */
+    status = -1;
+    dns_pkt = NULL;
+    PJ_TRY {
+	status = pj_dns_parse_packet(pool, us->rx_pkt, 
+				     (unsigned)bytes_read, &dns_pkt);
+    }
+    PJ_CATCH_ANY {
+	status = PJ_ENOMEM;
+    }
+    PJ_END;
+
+    /* Update nameserver status */
+    report_nameserver_status(resolver, &us->src_addr, dns_pkt);
+
+    /* Handle parse error */
+    if (status != PJ_SUCCESS) {
+	PJ_PERROR(3,(resolver->name.ptr, status,
+		     "Error parsing DNS response from %s:%d", 
+		     pj_sockaddr_print(&us->src_addr, addr, sizeof(addr), 2),
+		     pj_sockaddr_get_port(&us->src_addr)));
+	goto read_next_packet;
+    }
+
+    on_dns_response(resolver, dns_pkt, &us->src_addr, us, NULL);
 
 read_next_packet:
     if (pool) {
@@ -1802,9 +2320,11 @@ read_next_packet:
 	pj_pool_release(pool);
     }
 
-    status = pj_ioqueue_recvfrom(key, op_key, rx_pkt, &rx_pkt_size,
+    rx_pkt_size = sizeof(us->rx_pkt);
+    us->addr_len = sizeof(us->src_addr);
+    status = pj_ioqueue_recvfrom(key, op_key, us->rx_pkt, &rx_pkt_size,
 				 PJ_IOQUEUE_ALWAYS_ASYNC,
-				 src_addr, src_addr_len);
+				 &us->src_addr, &us->addr_len);
 
     if (status != PJ_EPENDING && status != PJ_ECANCELLED) {
 	PJ_PERROR(4,(resolver->name.ptr, status,
@@ -1817,6 +2337,417 @@ read_next_packet:
 }
 
 
+/* Close the TCP connection when no query is waiting for it, after the
+ * idle time.
+ */
+static void check_tcp_idle(struct tcp_conn *tc)
+{
+    pj_time_val delay;
+
+    if (tc->key == NULL || tc->idle_timer.id != 0 ||
+	!pj_list_empty(&tc->pending) || tc->tx_len || tc->queue_len)
+    {
+	return;
+    }
+
+    delay.sec = PJ_DNS_RESOLVER_TCP_IDLE_TIME;
+    delay.msec = 0;
+    pj_timer_heap_schedule_w_grp_lock(tc->resolver->timer, &tc->idle_timer,
+				      &delay, 1, tc->resolver->grp_lock);
+}
+
+
+/* Timer callback to close idle TCP connection */
+static void on_tcp_idle(pj_timer_heap_t *timer_heap,
+			struct pj_timer_entry *entry)
+{
+    struct tcp_conn *tc = (struct tcp_conn*) entry->user_data;
+    pj_dns_resolver *resolver = tc->resolver;
+
+    PJ_UNUSED_ARG(timer_heap);
+
+    pj_grp_lock_acquire(resolver->grp_lock);
+    if (entry->id) {
+	entry->id = 0;
+	PJ_LOG(5,(resolver->name.ptr, "Closing idle DNS TCP connection"));
+	close_tcp(tc);
+    }
+    pj_grp_lock_release(resolver->grp_lock);
+}
+
+
+/* Start reading from the TCP connection */
+static pj_status_t start_tcp_read(struct tcp_conn *tc)
+{
+    pj_ssize_t size = TCP_RX_SZ - tc->rx_len;
+    pj_status_t status;
+
+    status = pj_ioqueue_recv(tc->key, &tc->op_rx_key, tc->rx_pkt + tc->rx_len,
+			     &size, PJ_IOQUEUE_ALWAYS_ASYNC);
+    return (status == PJ_EPENDING) ? PJ_SUCCESS : status;
+}
+
+
+/* Send the queued queries, unless a previous send is still pending. The
+ * queries are written one after another without waiting for responses.
+ */
+static pj_status_t flush_tcp(struct tcp_conn *tc)
+{
+    pj_status_t status = PJ_SUCCESS;
+
+    if (!tc->connected)
+	return PJ_SUCCESS;
+
+    for (;;) {
+	pj_ssize_t sent;
+
+	if (tc->tx_len == 0) {
+	    unsigned char *tmp;
+
+	    if (tc->queue_len == 0)
+		break;
+
+	    tmp = tc->tx_pkt;
+	    tc->tx_pkt = tc->tx_queue;
+	    tc->tx_queue = tmp;
+	    tc->tx_len = tc->queue_len;
+	    tc->tx_sent = 0;
+	    tc->queue_len = 0;
+	} else if (tc->tx_sent == 0) {
+	    /* Previous send is pending */
+	    break;
+	}
+
+	sent = tc->tx_len - tc->tx_sent;
+	status = pj_ioqueue_send(tc->key, &tc->op_tx_key,
+				 tc->tx_pkt + tc->tx_sent, &sent, 0);
+	if (status == PJ_EPENDING) {
+	    /* Completion resets tx_len */
+	    tc->tx_sent = 0;
+	    status = PJ_SUCCESS;
+	    break;
+	} else if (status != PJ_SUCCESS) {
+	    break;
+	}
+
+	tc->tx_sent += (unsigned)sent;
+	if (tc->tx_sent >= tc->tx_len)
+	    tc->tx_len = tc->tx_sent = 0;
+    }
+
+    return status;
+}
+
+
+/* TCP connection is established */
+static pj_status_t on_tcp_connected(struct tcp_conn *tc)
+{
+    pj_status_t status;
+
+    tc->connected = PJ_TRUE;
+
+    status = start_tcp_read(tc);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    return flush_tcp(tc);
+}
+
+
+/* Open TCP connection to the nameserver */
+static pj_status_t open_tcp(pj_dns_resolver *resolver,
+			    struct tcp_conn *tc,
+			    const pj_sockaddr *addr)
+{
+    pj_ioqueue_callback socket_cb;
+    pj_sock_t sock;
+    pj_status_t status;
+
+    /* The buffers are kept for subsequent connections */
+    if (tc->rx_pkt == NULL) {
+	tc->rx_pkt = (unsigned char*) pj_pool_alloc(resolver->pool,
+						    TCP_RX_SZ);
+	tc->tx_pkt = (unsigned char*) pj_pool_alloc(resolver->pool,
+						    TCP_TX_SZ);
+	tc->tx_queue = (unsigned char*) pj_pool_alloc(resolver->pool,
+						      TCP_TX_SZ);
+    }
+
+    pj_sockaddr_cp(&tc->addr, addr);
+    tc->connected = PJ_FALSE;
+    tc->rx_len = tc->tx_len = tc->tx_sent = tc->queue_len = 0;
+
+    status = pj_sock_socket(addr->addr.sa_family, pj_SOCK_STREAM(), 0,
+			    &sock);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    pj_bzero(&socket_cb, sizeof(socket_cb));
+    socket_cb.on_read_complete = &tcp_on_read_complete;
+    socket_cb.on_write_complete = &tcp_on_write_complete;
+    socket_cb.on_connect_complete = &tcp_on_connect_complete;
+    status = pj_ioqueue_register_sock2(resolver->pool, resolver->ioqueue,
+				       sock, resolver->grp_lock,
+				       tc, &socket_cb, &tc->key);
+    if (status != PJ_SUCCESS) {
+	pj_sock_close(sock);
+	return status;
+    }
+
+    pj_ioqueue_op_key_init(&tc->op_rx_key, sizeof(tc->op_rx_key));
+    pj_ioqueue_op_key_init(&tc->op_tx_key, sizeof(tc->op_tx_key));
+
+    status = pj_ioqueue_connect(tc->key, addr, pj_sockaddr_get_len(addr));
+    if (status == PJ_SUCCESS)
+	status = on_tcp_connected(tc);
+    else if (status == PJ_EPENDING)
+	status = PJ_SUCCESS;
+
+    if (status != PJ_SUCCESS)
+	close_tcp(tc);
+
+    return status;
+}
+
+
+/* Retry the query over TCP to the nameserver which sent the truncated
+ * response.
+ */
+static pj_status_t send_tcp_query(pj_dns_resolver *resolver,
+				  pj_dns_async_query *q,
+				  const pj_sockaddr *ns_addr)
+{
+    struct tcp_conn *tc = NULL;
+    unsigned i, pkt_size;
+    pj_str_t name;
+    pj_time_val delay;
+    pj_status_t status;
+
+    for (i=0; i<resolver->ns_count; ++i) {
+	if (pj_sockaddr_cmp(&resolver->ns[i].addr, ns_addr) == 0) {
+	    tc = &resolver->tcp[i];
+	    break;
+	}
+    }
+    if (tc == NULL)
+	return PJ_ENOTFOUND;
+
+    if (tc->key == NULL) {
+	status = open_tcp(resolver, tc, ns_addr);
+	if (status != PJ_SUCCESS)
+	    return status;
+    }
+
+    if (tc->queue_len + 2 + UDPSZ > TCP_TX_SZ)
+	return PJ_ETOOMANY;
+
+    /* Queue the query, prefixed with its length */
+    pkt_size = UDPSZ;
+    name = pj_str(q->key.name);
+    status = pj_dns_make_query(tc->tx_queue + tc->queue_len + 2, &pkt_size,
+			       q->id, q->key.qtype, &name);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    tc->tx_queue[tc->queue_len] = (unsigned char)(pkt_size >> 8);
+    tc->tx_queue[tc->queue_len + 1] = (unsigned char)(pkt_size & 0xFF);
+    tc->queue_len += 2 + pkt_size;
+
+    pj_list_push_back(&tc->pending, q);
+    q->tcp = tc;
+
+    if (tc->idle_timer.id) {
+	pj_timer_heap_cancel(resolver->timer, &tc->idle_timer);
+	tc->idle_timer.id = 0;
+    }
+
+    status = flush_tcp(tc);
+    if (status != PJ_SUCCESS) {
+	close_tcp(tc);
+	return status;
+    }
+
+    /* Wait for the response for the rest of the retransmission time, and
+     * don't retransmit over UDP.
+     */
+    pj_timer_heap_cancel(resolver->timer, &q->timer_entry);
+    delay.sec = 0;
+    delay.msec = resolver->settings.qretr_delay;
+    if (resolver->settings.qretr_count > 1)
+	delay.msec *= resolver->settings.qretr_count;
+    pj_time_val_normalize(&delay);
+    q->timer_entry.id = 1;
+    q->transmit_cnt = resolver->settings.qretr_count;
+    pj_timer_heap_schedule_w_grp_lock(resolver->timer, &q->timer_entry,
+				      &delay, 1, resolver->grp_lock);
+
+    PJ_LOG(5,(resolver->name.ptr,
+	      "Truncated response, retrying DNS %s query for %s over TCP",
+	      pj_dns_get_type_name(q->key.qtype), q->key.name));
+
+    return PJ_SUCCESS;
+}
+
+
+/* Callback from ioqueue when TCP connection is established */
+static void tcp_on_connect_complete(pj_ioqueue_key_t *key,
+				    pj_status_t status)
+{
+    struct tcp_conn *tc = (struct tcp_conn*) pj_ioqueue_get_user_data(key);
+    pj_dns_resolver *resolver = tc->resolver;
+
+    pj_grp_lock_acquire(resolver->grp_lock);
+
+    if (key == tc->key) {
+	if (status == PJ_SUCCESS)
+	    status = on_tcp_connected(tc);
+
+	if (status != PJ_SUCCESS) {
+	    PJ_PERROR(4,(resolver->name.ptr, status,
+			 "DNS TCP connection error"));
+	    close_tcp(tc);
+	}
+    }
+
+    pj_grp_lock_release(resolver->grp_lock);
+}
+
+
+/* Callback from ioqueue when queries have been sent over TCP */
+static void tcp_on_write_complete(pj_ioqueue_key_t *key, 
+				  pj_ioqueue_op_key_t *op_key, 
+				  pj_ssize_t bytes_sent)
+{
+    struct tcp_conn *tc = (struct tcp_conn*) pj_ioqueue_get_user_data(key);
+    pj_dns_resolver *resolver = tc->resolver;
+    pj_status_t status;
+
+    PJ_UNUSED_ARG(op_key);
+
+    pj_grp_lock_acquire(resolver->grp_lock);
+
+    if (key == tc->key) {
+	if (bytes_sent > 0) {
+	    tc->tx_len = tc->tx_sent = 0;
+	    status = flush_tcp(tc);
+	} else {
+	    status = bytes_sent ? (pj_status_t)-bytes_sent : PJ_ECANCELLED;
+	}
+
+	if (status != PJ_SUCCESS) {
+	    PJ_PERROR(4,(resolver->name.ptr, status,
+			 "DNS TCP send error"));
+	    close_tcp(tc);
+	}
+    }
+
+    pj_grp_lock_release(resolver->grp_lock);
+}
+
+
+/* Handle one DNS message received over TCP */
+static void on_tcp_packet(struct tcp_conn *tc,
+			  const unsigned char *data,
+			  unsigned len)
+{
+    pj_dns_resolver *resolver = tc->resolver;
+    pj_dns_parsed_packet *dns_pkt;
+    pj_pool_t *pool;
+    pj_status_t status;
+    PJ_USE_EXCEPTION;
+
+    /* Messages over TCP may be large, don't use fixed buffer */
+    pool = pj_pool_create(resolver->pool->factory, "restcp", 1000, 1000,
+			  NULL);
+    if (pool == NULL)
+	return;
+
+    status = -1;
+    dns_pkt = NULL;
+    PJ_TRY {
+	status = pj_dns_parse_packet(pool, data, len, &dns_pkt);
+    }
+    PJ_CATCH_ANY {
+	status = PJ_ENOMEM;
+    }
+    PJ_END;
+
+    report_nameserver_status(resolver, &tc->addr, dns_pkt);
+
+    if (status != PJ_SUCCESS) {
+	PJ_PERROR(3,(resolver->name.ptr, status,
+		     "Error parsing DNS response over TCP"));
+    } else {
+	on_dns_response(resolver, dns_pkt, &tc->addr, NULL, tc);
+    }
+
+    pj_pool_release(pool);
+}
+
+
+/* Callback from ioqueue when data is received over TCP */
+static void tcp_on_read_complete(pj_ioqueue_key_t *key, 
+				 pj_ioqueue_op_key_t *op_key, 
+				 pj_ssize_t bytes_read)
+{
+    struct tcp_conn *tc = (struct tcp_conn*) pj_ioqueue_get_user_data(key);
+    pj_dns_resolver *resolver = tc->resolver;
+    unsigned pos;
+    pj_status_t status;
+
+    PJ_UNUSED_ARG(op_key);
+
+    pj_grp_lock_acquire(resolver->grp_lock);
+
+    if (key != tc->key)
+	goto on_return;
+
+    if (bytes_read <= 0) {
+	status = bytes_read ? (pj_status_t)-bytes_read : PJ_EEOF;
+	PJ_PERROR(5,(resolver->name.ptr, status,
+		     "DNS TCP connection closed"));
+	close_tcp(tc);
+	goto on_return;
+    }
+
+    /* Handle the complete messages, each is prefixed with its length */
+    tc->rx_len += (unsigned)bytes_read;
+    pos = 0;
+    while (tc->rx_len - pos >= 2) {
+	unsigned len = (tc->rx_pkt[pos] << 8) | tc->rx_pkt[pos+1];
+
+	if (tc->rx_len - pos - 2 < len)
+	    break;
+
+	on_tcp_packet(tc, tc->rx_pkt + pos + 2, len);
+
+	/* The connection may have been closed by the callback */
+	if (key != tc->key)
+	    goto on_return;
+
+	pos += 2 + len;
+    }
+
+    /* Keep the partial message */
+    if (pos) {
+	pj_memmove(tc->rx_pkt, tc->rx_pkt + pos, tc->rx_len - pos);
+	tc->rx_len -= pos;
+    }
+
+    status = start_tcp_read(tc);
+    if (status != PJ_SUCCESS) {
+	PJ_PERROR(4,(resolver->name.ptr, status, "DNS TCP read error"));
+	close_tcp(tc);
+	goto on_return;
+    }
+
+    check_tcp_idle(tc);
+
+on_return:
+    pj_grp_lock_release(resolver->grp_lock);
+}
+
+
 /*
  * Put the specified DNS packet into DNS cache. This function is mainly used
  * for testing the resolver, however it can also be used to inject entries
@@ -1891,7 +2822,7 @@ PJ_DEF(void) pj_dns_resolver_dump(pj_dns_resolver *resolver,
 				  pj_bool_t detail)
 {
 #if PJ_LOG_MAX_LEVEL >= 3
-    unsigned i;
+    unsigned i, tcp_cnt;
     pj_time_val now;
 
     pj_grp_lock_acquire(resolver->grp_lock);
@@ -1915,8 +2846,20 @@ PJ_DEF(void) pj_dns_resolver_dump(pj_dns_resolver *resolver,
 		  PJ_TIME_VAL_MSEC(ns->rt_delay)));
     }
 
+    tcp_cnt = 0;
+    for (i=0; i<PJ_ARRAY_SIZE(resolver->tcp); ++i) {
+	if (resolver->tcp[i].key)
+	    ++tcp_cnt;
+    }
+    PJ_LOG(3,(resolver->name.ptr, "  UDP sockets: %u, TCP connections: %u",
+	      UDP_SOCK_CNT, tcp_cnt));
+
     PJ_LOG(3,(resolver->name.ptr, "  Nb. of cached responses: %u",
 	      pj_hash_count(resolver->hrescache)));
+    PJ_LOG(3,(resolver->name.ptr, "  Cache hits: %u, misses: %u, "
+	      "prefetches: %u, stale answers: %u",
+	      resolver->cache_hit, resolver->cache_miss,
+	      resolver->cache_prefetch, resolver->cache_stale));
     if (detail) {
 	pj_hash_iterator_t itbuf, *it;
 	it = pj_hash_first(resolver->hrescache, &itbuf);
@@ -40,6 +40,69 @@
 #  include "scanner_cis_uint.c"
 #endif
 
+#if defined(PJ_SCANNER_USE_SIMD) && PJ_SCANNER_USE_SIMD != 0
+#  include "scanner_simd.c"
+#endif
+
+/* Number of characters to scan with the scalar loop before switching to
+ * the vectorized scanner, since most tokens are short.
+ */
+#define PJ_SCAN_SIMD_THRESHOLD		16
+
+/* Skip characters which are member of the spec. The buffer must be NULL
+ * terminated.
+ */
+PJ_INLINE(char*) scan_span(const pj_cis_t *spec, char *s, const char *end)
+{
+#if defined(PJ_SCAN_SPAN)
+    if (end - s > PJ_SCAN_SIMD_THRESHOLD) {
+	unsigned i;
+
+	/* Unrolled to keep the cost of short tokens the same as the
+	 * plain loop.
+	 */
+	for (i=0; i<PJ_SCAN_SIMD_THRESHOLD; i+=4, s+=4) {
+	    if (!pj_cis_match(spec, s[0])) return s;
+	    if (!pj_cis_match(spec, s[1])) return s+1;
+	    if (!pj_cis_match(spec, s[2])) return s+2;
+	    if (!pj_cis_match(spec, s[3])) return s+3;
+	}
+
+	s = PJ_SCAN_SPAN(spec, s, end, 1);
+    }
+#else
+    PJ_UNUSED_ARG(end);
+#endif
+
+    while (pj_cis_match(spec, *s))
+	++s;
+    return s;
+}
+
+/* Skip characters which are not member of the spec, until end. */
+PJ_INLINE(char*) scan_span_until(const pj_cis_t *spec, char *s, 
+				 const char *end)
+{
+#if defined(PJ_SCAN_SPAN)
+    if (end - s > PJ_SCAN_SIMD_THRESHOLD) {
+	unsigned i;
+
+	for (i=0; i<PJ_SCAN_SIMD_THRESHOLD; i+=4, s+=4) {
+	    if (pj_cis_match(spec, s[0])) return s;
+	    if (pj_cis_match(spec, s[1])) return s+1;
+	    if (pj_cis_match(spec, s[2])) return s+2;
+	    if (pj_cis_match(spec, s[3])) return s+3;
+	}
+
+	s = PJ_SCAN_SPAN(spec, s, end, 0);
+    }
+#endif
+
+    while (s != end && !pj_cis_match(spec, *s))
+	++s;
+    return s;
+}
+
 
 static void pj_scan_syntax_err(pj_scanner *scanner)
 {
@@ -215,8 +278,7 @@ PJ_DEF(int) pj_scan_peek( pj_scanner *scanner,
     }
 
     /* Don't need to check EOF with PJ_SCAN_CHECK_EOF(s) */
-    while (pj_cis_match(spec, *s))
-	++s;
+    s = scan_span(spec, s, scanner->end);
 
     pj_strset3(out, scanner->curptr, s);
     return *s;
@@ -249,8 +311,7 @@ PJ_DEF(int) pj_scan_peek_until( pj_scanner *scanner,
 	return -1;
     }
 
-    while (PJ_SCAN_CHECK_EOF(s) && !pj_cis_match( spec, *s))
-	++s;
+    s = scan_span_until(spec, s, scanner->end);
 
     pj_strset3(out, scanner->curptr, s);
     return *s;
@@ -270,9 +331,7 @@ PJ_DEF(void) pj_scan_get( pj_scanner *scanner,
 	return;
     }
 
-    do {
-	++s;
-    } while (pj_cis_match(spec, *s));
+    s = scan_span(spec, s+1, scanner->end);
     /* No need to check EOF here (PJ_SCAN_CHECK_EOF(s)) because
      * buffer is NULL terminated and pj_cis_match(spec,0) should be
      * false.
@@ -507,9 +566,7 @@ PJ_DEF(void) pj_scan_get_until( pj_scanner *scanner,
 	return;
     }
 
-    while (PJ_SCAN_CHECK_EOF(s) && !pj_cis_match(spec, *s)) {
-	++s;
-    }
+    s = scan_span_until(spec, s, scanner->end);
 
     pj_strset3(out, scanner->curptr, s);
 
@@ -531,8 +588,15 @@ PJ_DEF(void) pj_scan_get_until_ch( pj_scanner *scanner,
 	return;
     }
 
-    while (PJ_SCAN_CHECK_EOF(s) && *s != until_char) {
-	++s;
+    if ((unsigned)until_char < 128) {
+	/* memchr() is vectorized by the C library */
+	s = (char*) pj_memchr(s, until_char, scanner->end - s);
+	if (!s)
+	    s = scanner->end;
+    } else {
+	while (PJ_SCAN_CHECK_EOF(s) && *s != until_char) {
+	    ++s;
+	}
     }
 
     pj_strset3(out, scanner->curptr, s);
@@ -0,0 +1,212 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * THIS FILE IS INCLUDED BY scanner.c.
+ * DO NOT COMPILE THIS FILE ALONE!
+ */
+
+/*
+ * Vectorized cis scanning.
+ *
+ * The membership of a block of characters is looked up in the cis_map of
+ * the cis with byte shuffles: the low nibble of the character selects the
+ * map byte, and the high nibble selects the bit in that byte.
+ *
+ * The span functions skip whole blocks of characters whose membership is
+ * equal to "match", and return the first character which is not, or the
+ * start of the last partial block before "end". The caller always
+ * finishes the scan with the scalar loop, hence the result is the same as
+ * the scalar scanner.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#   define PJ_SCAN_SIMD_X86	1
+#   include <immintrin.h>
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__ARM_NEON)
+#   define PJ_SCAN_SIMD_NEON	1
+#   include <arm_neon.h>
+#endif
+
+#if defined(PJ_SCAN_SIMD_X86) || defined(PJ_SCAN_SIMD_NEON)
+
+typedef char* (*cis_span_func)(const pj_cis_t *cis, char *s,
+			       const char *end, int match);
+
+static char *cis_span_resolve(const pj_cis_t *cis, char *s,
+			      const char *end, int match);
+
+/* Selected on the first call according to the CPU features. */
+static cis_span_func cis_span = &cis_span_resolve;
+
+/* Only use the vectorized scanner when there's at least a block left. */
+#define PJ_SCAN_SPAN(cis, s, end, match) \
+	((end) - (s) >= 16 ? (*cis_span)(cis, s, end, match) : (s))
+
+
+static char *cis_span_none(const pj_cis_t *cis, char *s,
+			   const char *end, int match)
+{
+    PJ_UNUSED_ARG(cis);
+    PJ_UNUSED_ARG(end);
+    PJ_UNUSED_ARG(match);
+    return s;
+}
+
+#if defined(PJ_SCAN_SIMD_X86)
+
+__attribute__((target("ssse3")))
+static char *cis_span_ssse3(const pj_cis_t *cis, char *s,
+			    const char *end, int match)
+{
+    const __m128i map_lo = _mm_loadu_si128((const __m128i*)cis->cis_map);
+    const __m128i map_hi = _mm_loadu_si128((const __m128i*)
+					   (cis->cis_map + 16));
+    const __m128i bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+				       1, 2, 4, 8, 16, 32, 64, -128);
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i zero = _mm_setzero_si128();
+    const unsigned flip = match ? 0 : 0xFFFF;
+
+    while (end - s >= 16) {
+	__m128i v, lo, hi, upper, row, in;
+	unsigned stop;
+
+	v = _mm_loadu_si128((const __m128i*)s);
+	lo = _mm_and_si128(v, nibble);
+	hi = _mm_and_si128(_mm_srli_epi16(v, 4), nibble);
+	upper = _mm_cmplt_epi8(v, zero);
+	row = _mm_or_si128(_mm_and_si128(upper, _mm_shuffle_epi8(map_hi, lo)),
+			   _mm_andnot_si128(upper,
+					    _mm_shuffle_epi8(map_lo, lo)));
+	in = _mm_and_si128(row, _mm_shuffle_epi8(bits, hi));
+
+	/* Bits of non-member characters, flipped for "until" scanning. */
+	stop = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(in, zero)) ^ flip;
+	if (stop)
+	    return s + __builtin_ctz(stop);
+
+	s += 16;
+    }
+
+    return s;
+}
+
+__attribute__((target("avx2")))
+static char *cis_span_avx2(const pj_cis_t *cis, char *s,
+			   const char *end, int match)
+{
+    const __m256i map_lo = _mm256_broadcastsi128_si256(
+			    _mm_loadu_si128((const __m128i*)cis->cis_map));
+    const __m256i map_hi = _mm256_broadcastsi128_si256(
+			    _mm_loadu_si128((const __m128i*)
+					    (cis->cis_map + 16)));
+    const __m256i bits = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128,
+					  1, 2, 4, 8, 16, 32, 64, -128,
+					  1, 2, 4, 8, 16, 32, 64, -128,
+					  1, 2, 4, 8, 16, 32, 64, -128);
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i zero = _mm256_setzero_si256();
+    const unsigned flip = match ? 0 : 0xFFFFFFFF;
+
+    while (end - s >= 32) {
+	__m256i v, lo, hi, upper, row, in;
+	unsigned stop;
+
+	v = _mm256_loadu_si256((const __m256i*)s);
+	lo = _mm256_and_si256(v, nibble);
+	hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+	upper = _mm256_cmpgt_epi8(zero, v);
+	row = _mm256_blendv_epi8(_mm256_shuffle_epi8(map_lo, lo),
+				 _mm256_shuffle_epi8(map_hi, lo), upper);
+	in = _mm256_and_si256(row, _mm256_shuffle_epi8(bits, hi));
+
+	stop = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(in, zero)) ^
+	       flip;
+	if (stop)
+	    return s + __builtin_ctz(stop);
+
+	s += 32;
+    }
+
+    /* Remaining 16 to 31 characters */
+    return cis_span_ssse3(cis, s, end, match);
+}
+
+#elif defined(PJ_SCAN_SIMD_NEON)
+
+static char *cis_span_neon(const pj_cis_t *cis, char *s,
+			   const char *end, int match)
+{
+    static const pj_uint8_t bit_tbl[16] = { 1, 2, 4, 8, 16, 32, 64, 128,
+					    1, 2, 4, 8, 16, 32, 64, 128 };
+    const uint8x16_t map_lo = vld1q_u8(cis->cis_map);
+    const uint8x16_t map_hi = vld1q_u8(cis->cis_map + 16);
+    const uint8x16_t bits = vld1q_u8(bit_tbl);
+    const uint8x16_t nibble = vdupq_n_u8(0x0F);
+
+    while (end - s >= 16) {
+	uint8x16_t v, upper, row, in;
+	pj_uint64_t stop;
+
+	v = vld1q_u8((const pj_uint8_t*)s);
+	upper = vreinterpretq_u8_s8(vshrq_n_s8(vreinterpretq_s8_u8(v), 7));
+	row = vbslq_u8(upper, vqtbl1q_u8(map_hi, vandq_u8(v, nibble)),
+		       vqtbl1q_u8(map_lo, vandq_u8(v, nibble)));
+	in = vtstq_u8(row, vqtbl1q_u8(bits, vshrq_n_u8(v, 4)));
+	if (match)
+	    in = vmvnq_u8(in);
+
+	/* Narrow to 4 bits per character to find the first stop. */
+	stop = vget_lane_u64(vreinterpret_u64_u8(
+		    vshrn_n_u16(vreinterpretq_u16_u8(in), 4)), 0);
+	if (stop)
+	    return s + (__builtin_ctzll(stop) >> 2);
+
+	s += 16;
+    }
+
+    return s;
+}
+
+#endif	/* PJ_SCAN_SIMD_NEON */
+
+
+static char *cis_span_resolve(const pj_cis_t *cis, char *s,
+			      const char *end, int match)
+{
+    cis_span_func func = &cis_span_none;
+
+#if defined(PJ_SCAN_SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+	func = &cis_span_avx2;
+    else if (__builtin_cpu_supports("ssse3"))
+	func = &cis_span_ssse3;
+#elif defined(PJ_SCAN_SIMD_NEON)
+    func = &cis_span_neon;
+#endif
+
+    /* Benign race: all threads will select the same function. */
+    cis_span = func;
+    return (*func)(cis, s, end, match);
+}
+
+#endif	/* PJ_SCAN_SIMD_X86 || PJ_SCAN_SIMD_NEON */
+
@@ -0,0 +1,176 @@
+/* $Id$ */
+/* 
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA 
+ */
+#include <pjlib-util/sha256.h>
+#include <pj/string.h>
+
+/*
+ * SHA-256 as specified in FIPS PUB 180-4. The message is processed in
+ * 512-bit blocks, read as big-endian words so the code is endian neutral.
+ *
+ * Test Vectors (from FIPS PUB 180-4)
+ * "abc"
+ *   BA7816BF 8F01CFEA 414140DE 5DAE2223 B00361A3 96177A9C B410FF61 F20015AD
+ * "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"
+ *   248D6A61 D20638B8 E5C02693 0C3E6039 A33CE459 64FF2167 F6ECEDD4 19DB06C1
+ * A million repetitions of "a"
+ *   CDC76E5C 9914FB92 81A1C7E2 84D73E67 F1809A48 A497200E 046D39CC C7112CD0
+ */
+
+static const pj_uint32_t K[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ror(value, bits) (((value) >> (bits)) | ((value) << (32 - (bits))))
+
+#define CH(x,y,z)	(((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x,y,z)	(((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
+#define EP0(x)		(ror(x,2) ^ ror(x,13) ^ ror(x,22))
+#define EP1(x)		(ror(x,6) ^ ror(x,11) ^ ror(x,25))
+#define SIG0(x)		(ror(x,7) ^ ror(x,18) ^ ((x) >> 3))
+#define SIG1(x)		(ror(x,17) ^ ror(x,19) ^ ((x) >> 10))
+
+
+/* Hash a single 512-bit block. */
+static void SHA256_Transform(pj_uint32_t state[8], const pj_uint8_t data[64])
+{
+    pj_uint32_t a, b, c, d, e, f, g, h, t1, t2;
+    pj_uint32_t w[64];
+    unsigned i;
+
+    for (i = 0; i < 16; ++i) {
+	w[i] = ((pj_uint32_t)data[i*4] << 24) |
+	       ((pj_uint32_t)data[i*4+1] << 16) |
+	       ((pj_uint32_t)data[i*4+2] << 8) |
+	       ((pj_uint32_t)data[i*4+3]);
+    }
+    for ( ; i < 64; ++i)
+	w[i] = SIG1(w[i-2]) + w[i-7] + SIG0(w[i-15]) + w[i-16];
+
+    a = state[0];
+    b = state[1];
+    c = state[2];
+    d = state[3];
+    e = state[4];
+    f = state[5];
+    g = state[6];
+    h = state[7];
+
+    for (i = 0; i < 64; ++i) {
+	t1 = h + EP1(e) + CH(e,f,g) + K[i] + w[i];
+	t2 = EP0(a) + MAJ(a,b,c);
+	h = g;
+	g = f;
+	f = e;
+	e = d + t1;
+	d = c;
+	c = b;
+	b = a;
+	a = t1 + t2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+
+PJ_DEF(void) pj_sha256_init(pj_sha256_context *ctx)
+{
+    ctx->state[0] = 0x6a09e667;
+    ctx->state[1] = 0xbb67ae85;
+    ctx->state[2] = 0x3c6ef372;
+    ctx->state[3] = 0xa54ff53a;
+    ctx->state[4] = 0x510e527f;
+    ctx->state[5] = 0x9b05688c;
+    ctx->state[6] = 0x1f83d9ab;
+    ctx->state[7] = 0x5be0cd19;
+    ctx->count[0] = ctx->count[1] = 0;
+}
+
+
+PJ_DEF(void) pj_sha256_update(pj_sha256_context *ctx, 
+			      const pj_uint8_t *data, const pj_size_t len)
+{
+    pj_size_t i, j;
+
+    j = (ctx->count[0] >> 3) & 63;
+    if ((ctx->count[0] += (pj_uint32_t)len << 3) < ((pj_uint32_t)len << 3))
+	ctx->count[1]++;
+    ctx->count[1] += ((pj_uint32_t)len >> 29);
+
+    if ((j + len) > 63) {
+	pj_memcpy(&ctx->buffer[j], data, (i = 64-j));
+	SHA256_Transform(ctx->state, ctx->buffer);
+	for ( ; i + 63 < len; i += 64)
+	    SHA256_Transform(ctx->state, data + i);
+	j = 0;
+    } else {
+	i = 0;
+    }
+    pj_memcpy(&ctx->buffer[j], &data[i], len - i);
+}
+
+
+PJ_DEF(void) pj_sha256_final(pj_sha256_context *ctx, 
+			     pj_uint8_t digest[PJ_SHA256_DIGEST_SIZE])
+{
+    pj_uint8_t finalcount[8];
+    unsigned i;
+
+    /* Message length in bits, big-endian */
+    for (i = 0; i < 8; ++i) {
+	finalcount[i] = (pj_uint8_t)
+	    ((ctx->count[(i >= 4 ? 0 : 1)] >> ((3-(i & 3)) * 8)) & 255);
+    }
+
+    pj_sha256_update(ctx, (const pj_uint8_t*)"\200", 1);
+    while ((ctx->count[0] & 504) != 448)
+	pj_sha256_update(ctx, (const pj_uint8_t*)"\0", 1);
+    pj_sha256_update(ctx, finalcount, 8);
+
+    for (i = 0; i < PJ_SHA256_DIGEST_SIZE; ++i) {
+	digest[i] = (pj_uint8_t)
+	    ((ctx->state[i>>2] >> ((3-(i & 3)) * 8)) & 255);
+    }
+
+    /* Wipe variables */
+    pj_bzero(ctx, sizeof(*ctx));
+}
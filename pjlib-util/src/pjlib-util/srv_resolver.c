@@ -83,6 +83,9 @@ struct pj_dns_srv_async_query
     /* Number of hosts in SRV records that the IP address has been resolved */
     unsigned		     host_resolved;
 
+    /* The smallest TTL of the DNS responses */
+    unsigned		     ttl;
+
 };
 
 
@@ -138,6 +141,7 @@ PJ_DEF(pj_status_t) pj_dns_srv_resolve( const pj_str_t *domain_name,
     query_job->domain_part.ptr = target_name.ptr + len;
     query_job->domain_part.slen = target_name.slen - len;
     query_job->def_port = (pj_uint16_t)def_port;
+    query_job->ttl = 0xFFFFFFFF;
 
     /* Normalize query job option PJ_DNS_SRV_RESOLVE_AAAA_ONLY */
     if (query_job->option & PJ_DNS_SRV_RESOLVE_AAAA_ONLY)
@@ -550,6 +554,32 @@ static pj_status_t resolve_hostnames(pj_dns_srv_async_query *query_job)
     return (err_cnt == query_job->srv_cnt) ? err : PJ_SUCCESS;
 }
 
+/* Keep the smallest TTL of the DNS responses */
+static void update_ttl(pj_dns_srv_async_query *query_job,
+		       pj_status_t status,
+		       const pj_dns_parsed_packet *pkt)
+{
+    unsigned i, ttl;
+
+    if (status == PJ_SUCCESS && pkt && pkt->hdr.anscount) {
+	ttl = 0xFFFFFFFF;
+	for (i=0; i<pkt->hdr.anscount; ++i) {
+	    if (pkt->ans[i].ttl < ttl)
+		ttl = pkt->ans[i].ttl;
+	}
+	for (i=0; i<pkt->hdr.arcount; ++i) {
+	    if (pkt->arr[i].ttl < ttl)
+		ttl = pkt->arr[i].ttl;
+	}
+    } else {
+	/* Negative answers are cached for this long by the resolver */
+	ttl = PJ_DNS_RESOLVER_INVALID_TTL;
+    }
+
+    if (ttl < query_job->ttl)
+	query_job->ttl = ttl;
+}
+
 /* 
  * This callback is called by PJLIB-UTIL DNS resolver when asynchronous
  * query_job has completed (successfully or with error).
@@ -577,6 +607,8 @@ static void dns_callback(void *user_data,
 	return;
     }
 
+    update_ttl(query_job, status, pkt);
+
     /* Proceed to next stage */
     if (query_job->dns_state == PJ_DNS_TYPE_SRV) {
 
@@ -798,6 +830,7 @@ static void dns_callback(void *user_data,
 	pj_dns_srv_record srv_rec;
 
 	srv_rec.count = 0;
+	srv_rec.ttl = query_job->ttl;
 	for (i=0; i<query_job->srv_cnt; ++i) {
 	    unsigned j;
 	    struct srv_target *srv2 = &query_job->srv[i];
@@ -492,6 +492,28 @@
 #   define PJ_LOG_THREAD_WIDTH	    12
 #endif
 
+/**
+ * Default size of the ring buffer of each thread in the asynchronous log
+ * writer, see pj_log_async_param. The value is rounded up to a power of
+ * two.
+ *
+ * Default: 65536
+ */
+#ifndef PJ_LOG_ASYNC_RING_SIZE
+#   define PJ_LOG_ASYNC_RING_SIZE	    65536
+#endif
+
+/**
+ * Default maximum number of threads which get their own ring buffer in
+ * the asynchronous log writer. Other threads share a single ring which
+ * is protected by a mutex.
+ *
+ * Default: 32
+ */
+#ifndef PJ_LOG_ASYNC_MAX_THREADS
+#   define PJ_LOG_ASYNC_MAX_THREADS	    32
+#endif
+
 /**
  * Colorfull terminal (for logging etc).
  *
@@ -531,6 +553,56 @@
 #endif
 
 
+/**
+ * Default number of free pools of each size to be kept in the per-thread
+ * cache of a caching pool, to be applied by #pj_caching_pool_init(). Zero
+ * disables the per-thread cache. See #pj_caching_pool_enable_thread_cache()
+ * for more info.
+ *
+ * Default: 0
+ */
+#ifndef PJ_CACHING_POOL_MAGAZINE_SIZE
+#  define PJ_CACHING_POOL_MAGAZINE_SIZE	    0
+#endif
+
+
+/**
+ * Default engine used by #pj_timer_heap_create(). Valid values are
+ * PJ_TIMER_ENGINE_HEAP (0) for the binary heap, or PJ_TIMER_ENGINE_WHEEL
+ * (1) for the hierarchical timing wheel. See #pj_timer_engine for more
+ * info.
+ *
+ * Default: 0 (PJ_TIMER_ENGINE_HEAP)
+ */
+#ifndef PJ_TIMER_HEAP_ENGINE
+#  define PJ_TIMER_HEAP_ENGINE	    0
+#endif
+
+
+/**
+ * Resolution of the timing wheel timer engine, in milliseconds. Timers
+ * scheduled in the timing wheel never expire early, but may expire up to
+ * this much later than requested.
+ *
+ * Default: 10
+ */
+#ifndef PJ_TIMER_WHEEL_RESOLUTION
+#  define PJ_TIMER_WHEEL_RESOLUTION	    10
+#endif
+
+
+/**
+ * Number of shards in the timing wheel timer engine. Each shard has its
+ * own wheel and lock, and timer entries are assigned to a shard based on
+ * the entry's address.
+ *
+ * Default: 4
+ */
+#ifndef PJ_TIMER_WHEEL_SHARD_COUNT
+#  define PJ_TIMER_WHEEL_SHARD_COUNT	    4
+#endif
+
+
 /**
  * Enable timer heap debugging facility. When this is enabled, application
  * can call pj_timer_heap_dump() to show the contents of the timer heap
@@ -37,6 +37,12 @@ PJ_BEGIN_DECL
  * hash functions. Having the keys of more than one item map to the same 
  * position is called a collision. In this library, we will chain the nodes
  * that have the same key in a list.
+ *
+ * Alternatively, a hash table can be created with
+ * #PJ_HASH_OPT_OPEN_ADDRESSING option, in which case the entries are
+ * stored in the table itself and collisions are resolved by linear
+ * probing. Such table grows automatically as entries are added, so the
+ * size given at creation is only the initial capacity.
  */
 
 /**
@@ -55,6 +61,28 @@ PJ_BEGIN_DECL
  */
 typedef void *pj_hash_entry_buf[(PJ_HASH_ENTRY_BUF_SIZE+sizeof(void*)-1)/(sizeof(void*))];
 
+/**
+ * Hash table creation options, to be specified in #pj_hash_create2().
+ */
+typedef enum pj_hash_option
+{
+    /**
+     * Use open addressing instead of chaining. The entries are kept in
+     * arrays allocated from the pool given to #pj_hash_create2(), together
+     * with their hash values, and the arrays are rehashed incrementally
+     * into larger ones as the table fills up. When this option is used:
+     *  - the pool must remain valid for the lifetime of the table, and
+     *    the table must only be modified with the owner's lock held,
+     *  - the entry_buf argument of #pj_hash_set_np() is not used,
+     *  - the current entry may be deleted while iterating the table, but
+     *    adding entries while iterating may cause entries to be skipped
+     *    or visited twice.
+     */
+    PJ_HASH_OPT_OPEN_ADDRESSING = 1
+
+} pj_hash_option;
+
+
 /**
  * This is the function that is used by the hash table to calculate hash value
  * of the specified key.
@@ -96,6 +124,21 @@ PJ_DECL(pj_uint32_t) pj_hash_calc_tolower(pj_uint32_t hval,
 PJ_DECL(pj_hash_table_t*) pj_hash_create(pj_pool_t *pool, unsigned size);
 
 
+/**
+ * Create a hash table with the specified options.
+ *
+ * @param pool	    the pool from which the hash table will be allocated from.
+ * @param size	    the bucket size, or the initial number of entries when
+ *		    #PJ_HASH_OPT_OPEN_ADDRESSING is specified.
+ * @param options   bitmask of #pj_hash_option, or zero to create the same
+ *		    table as #pj_hash_create().
+ *
+ * @return the hash table.
+ */
+PJ_DECL(pj_hash_table_t*) pj_hash_create2(pj_pool_t *pool, unsigned size,
+					  unsigned options);
+
+
 /**
  * Get the value associated with the specified key.
  *
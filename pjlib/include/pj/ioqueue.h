@@ -94,6 +94,10 @@ PJ_BEGIN_DECL
  *  - <tt><b>/dev/epoll</b></tt> on Linux (user mode and kernel mode), 
  *    a much faster replacement for select() on Linux (and more importantly
  *    doesn't have limitation on number of descriptors).
+ *  - <tt><b>io_uring</b></tt> on Linux 5.11 or later (configure with
+ *    \c --enable-uring), where the socket operations themselves are
+ *    submitted to the kernel, and operations started from the callbacks
+ *    are submitted in batch with the next wait for completion.
  *  - <b>I/O Completion ports</b> on Windows NT/2000/XP, which is the most 
  *    efficient way to dispatch events in Windows NT based OSes, and most 
  *    importantly, it doesn't have the limit on how many handles to monitor.
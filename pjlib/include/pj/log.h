@@ -242,6 +242,104 @@ PJ_DECL(void) pj_log_set_color(int level, pj_color_t color);
  */
 PJ_DECL(pj_color_t) pj_log_get_color(int level);
 
+/**
+ * Settings of the asynchronous log writer.
+ */
+typedef struct pj_log_async_param
+{
+    /**
+     * Size of the ring buffer of each thread, in bytes. Messages which
+     * don't fit in the ring are dropped.
+     *
+     * Default: PJ_LOG_ASYNC_RING_SIZE
+     */
+    unsigned	ring_size;
+
+    /**
+     * Maximum number of threads which get their own ring buffer. Threads
+     * which log after all rings are taken share one extra ring.
+     *
+     * Default: PJ_LOG_ASYNC_MAX_THREADS
+     */
+    unsigned	max_threads;
+
+    /**
+     * Join consecutive messages of the same level which are pending in a
+     * ring, and pass them to the log writer function in one call. This
+     * reduces the number of calls when the writer is slow, e.g. when it
+     * writes to a file, but the writer then receives several lines at
+     * once, so it must not expect a single message per call.
+     *
+     * Default: PJ_FALSE
+     */
+    pj_bool_t	batch;
+
+} pj_log_async_param;
+
+/**
+ * Statistics of the asynchronous log writer.
+ */
+typedef struct pj_log_async_stat
+{
+    pj_uint32_t	written;	/**< Messages written to the ring buffers. */
+    pj_uint32_t	dropped;	/**< Messages dropped as the ring was full. */
+    pj_uint32_t	batches;	/**< Calls to the underlying log writer.   */
+    unsigned	rings;		/**< Number of rings owned by threads.	   */
+} pj_log_async_stat;
+
+/**
+ * Initialize the asynchronous log writer settings with the default values.
+ *
+ * @param prm	    The settings to be initialized.
+ */
+PJ_DECL(void) pj_log_async_param_default(pj_log_async_param *prm);
+
+/**
+ * Start the asynchronous log writer. Each thread copies its formatted
+ * messages into its own ring buffer without taking any lock, and a
+ * background thread drains the rings and passes the messages one by one
+ * (or in batches, see pj_log_async_param.batch) to the log writer
+ * function which was installed before this function was called. When a
+ * ring is full the message is dropped and counted, the logging thread
+ * never blocks. Messages of one thread keep their order, messages of
+ * different threads may be written out of order. The ring of a thread is
+ * reused by another thread once the thread has exited, where the platform
+ * supports thread exit notification (see #pj_thread_local_alloc2()).
+ *
+ * The function installs #pj_log_async_write() with #pj_log_set_log_func().
+ *
+ * @param pf	    Pool factory to allocate the ring buffers.
+ * @param prm	    The settings, or NULL to use the default values.
+ *
+ * @return	    PJ_SUCCESS on success.
+ */
+PJ_DECL(pj_status_t) pj_log_async_start(pj_pool_factory *pf,
+					const pj_log_async_param *prm);
+
+/**
+ * Stop the asynchronous log writer. The pending messages are written and
+ * the previous log writer function is installed again. Application must
+ * make sure that no other thread is logging while this function is called.
+ */
+PJ_DECL(void) pj_log_async_stop(void);
+
+/**
+ * Get the statistics of the asynchronous log writer.
+ *
+ * @param stat	    The statistics.
+ */
+PJ_DECL(void) pj_log_async_get_stat(pj_log_async_stat *stat);
+
+/**
+ * The log writer function which is installed by #pj_log_async_start().
+ * Application normally doesn't need to call this function.
+ *
+ * @param level	    Log level.
+ * @param buffer    Log message.
+ * @param len	    Message length.
+ */
+PJ_DECL(void) pj_log_async_write(int level, const char *buffer, int len);
+
 /**
  * Internal function to be called by pj_init()
  */
@@ -344,6 +442,16 @@ pj_status_t pj_log_init(void);
 #  define pj_log_get_color(level) 0
 
 
+/**
+ * Start the asynchronous log writer.
+ */
+#  define pj_log_async_start(pf, prm)	PJ_SUCCESS
+
+/**
+ * Stop the asynchronous log writer.
+ */
+#  define pj_log_async_stop()
+
 /**
  * Internal.
  */
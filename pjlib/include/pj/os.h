@@ -523,6 +523,36 @@ PJ_DECL(void) pj_symbianos_set_connection_status(pj_bool_t up);
  */
 PJ_DECL(pj_status_t) pj_thread_local_alloc(long *index);
 
+/**
+ * Type of function to be called when a thread exits, with the value of a
+ * thread local variable of the thread. See #pj_thread_local_alloc2().
+ *
+ * @param value	    The value of the variable, which is not NULL.
+ */
+typedef void pj_thread_local_dtor(void *value);
+
+/**
+ * Allocate thread local storage index, with a function to be called when
+ * a thread exits while its value of the variable is not NULL. The
+ * function is not called for the values of the threads that exit after
+ * the index is freed, nor for the value of the main thread when the
+ * process exits.
+ *
+ * The thread may already be unknown to pjlib when the function is
+ * called, so the function should not call pjlib functions which need the
+ * calling thread to be registered, such as locking a mutex. Registering
+ * the thread there is not safe either, since the thread descriptor would
+ * have to outlive the thread.
+ *
+ * @param index	    Pointer to hold the return value.
+ * @param dtor	    The function to be called on thread exit.
+ *
+ * @return	    PJ_SUCCESS on success, PJ_ENOTSUP if the platform can't
+ *		    call a function on thread exit, or the error code.
+ */
+PJ_DECL(pj_status_t) pj_thread_local_alloc2(long *index,
+					    pj_thread_local_dtor *dtor);
+
 /**
  * Deallocate thread local variable.
  *
@@ -877,6 +877,22 @@ struct pj_caching_pool
      * Mutex.
      */
     pj_lock_t	   *lock;
+
+    /**
+     * Number of free pools of each size kept in each thread's cache, or
+     * zero if per-thread cache is disabled.
+     */
+    unsigned	    magazine_size;
+
+    /**
+     * Thread local index to get the calling thread's cache.
+     */
+    long	    thread_cache_tls;
+
+    /**
+     * List of per-thread caches.
+     */
+    pj_list	    thread_cache_list;
 };
 
 
@@ -904,6 +920,39 @@ PJ_DECL(void) pj_caching_pool_init( pj_caching_pool *ch_pool,
  */
 PJ_DECL(void) pj_caching_pool_destroy( pj_caching_pool *ch_pool );
 
+/**
+ * Enable per-thread cache of free pools in the caching pool. With this
+ * enabled, each thread keeps up to \a magazine_size free pools of each
+ * size, so that #pj_pool_create() and #pj_pool_release() don't need to
+ * acquire the caching pool's mutex as long as the thread's cache can
+ * serve the request. The thread's cache is refilled from, and flushed
+ * to, the shared free list with half of \a magazine_size pools at a time.
+ * The hit and miss rates of each thread's cache are shown by
+ * #pj_pool_factory_dump().
+ *
+ * Pools created from the thread's cache are not kept in the used list,
+ * so they are not shown in the detailed dump, and they will not be
+ * released by #pj_caching_pool_destroy() if application forgets to
+ * release them. When a thread exits, its cache, with the pools in it, is
+ * taken over by the next thread which needs a cache. On platforms which
+ * can't notify thread exit (see #pj_thread_local_alloc2()), the cache of
+ * a thread is only freed when the caching pool is destroyed.
+ *
+ * This must be called before any pool is created from the caching pool.
+ * The per-thread cache requires the compiler's atomic builtins, and is
+ * currently only supported with GCC compatible compilers.
+ *
+ * @param ch_pool	The caching pool.
+ * @param magazine_size	Number of free pools of each size to be kept in
+ *			each thread's cache. Zero disables the cache.
+ *
+ * @return		PJ_SUCCESS on success, PJ_EINVALIDOP if pools have
+ *			been created, or PJ_ENOTSUP.
+ */
+PJ_DECL(pj_status_t) pj_caching_pool_enable_thread_cache(
+					    pj_caching_pool *ch_pool,
+					    unsigned magazine_size);
+
 /**
  * @}	// PJ_CACHING_POOL
  */
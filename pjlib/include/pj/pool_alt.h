@@ -193,6 +193,7 @@ typedef struct pj_pool_block
 
 #define pj_caching_pool_init( cp, pol, mac)
 #define pj_caching_pool_destroy(cp)
+#define pj_caching_pool_enable_thread_cache(cp, sz)	PJ_ENOTSUP
 #define pj_pool_factory_dump(pf, detail)
 
 PJ_END_DECL
@@ -52,6 +52,13 @@ PJ_BEGIN_DECL
  *
  * ACE is Copyright (C)1993-2006 Douglas C. Schmidt <d.schmidt@vanderbilt.edu>
  *
+ * Alternatively, the timer heap may be created with a hierarchical timing
+ * wheel engine (see #pj_timer_heap_create2()), where scheduling and
+ * cancelling are O(1), entries are spread over several independently
+ * locked shards, and expired entries are collected in batches. This is
+ * more suitable for applications with a very large number of timers
+ * which don't require sub-resolution accuracy.
+ *
  * @{
  *
  * \section pj_timer_examples_sec Examples
@@ -67,6 +74,30 @@ PJ_BEGIN_DECL
  */
 typedef int pj_timer_id_t;
 
+/**
+ * Timer engine to be used by the timer heap.
+ */
+typedef enum pj_timer_engine
+{
+    /**
+     * Binary heap. Schedule and cancel are O(log N), and the expiration
+     * time is accurate up to the clock resolution. All operations are
+     * serialized by the lock set with #pj_timer_heap_set_lock().
+     */
+    PJ_TIMER_ENGINE_HEAP,
+
+    /**
+     * Hierarchical timing wheel. Schedule and cancel are O(1), and timers
+     * may expire up to #PJ_TIMER_WHEEL_RESOLUTION msec late. Entries are
+     * distributed to #PJ_TIMER_WHEEL_SHARD_COUNT shards, each protected by
+     * its own internal lock, unless a lock is set with
+     * #pj_timer_heap_set_lock(), in which case all shards are serialized
+     * by that lock.
+     */
+    PJ_TIMER_ENGINE_WHEEL
+
+} pj_timer_engine;
+
 /** 
  * Forward declaration for pj_timer_entry. 
  */
@@ -159,6 +190,26 @@ PJ_DECL(pj_status_t) pj_timer_heap_create( pj_pool_t *pool,
 					   pj_size_t count,
                                            pj_timer_heap_t **ht);
 
+/**
+ * Create a timer heap with the specified engine. #pj_timer_heap_create()
+ * is equal to calling this function with #PJ_TIMER_HEAP_ENGINE.
+ *
+ * @param pool      The pool where allocations in the timer heap will be 
+ *                  allocated. The pool must not be used by other threads
+ *                  while the timer heap is in use.
+ * @param count     The maximum number of timer entries to be supported 
+ *                  initially. If the application registers more entries 
+ *                  during runtime, then the timer heap will resize.
+ * @param engine    The timer engine.
+ * @param ht        Pointer to receive the created timer heap.
+ *
+ * @return          PJ_SUCCESS, or the appropriate error code.
+ */
+PJ_DECL(pj_status_t) pj_timer_heap_create2( pj_pool_t *pool,
+					    pj_size_t count,
+					    pj_timer_engine engine,
+					    pj_timer_heap_t **ht);
+
 /**
  * Destroy the timer heap.
  *
@@ -169,7 +220,10 @@ PJ_DECL(void) pj_timer_heap_destroy( pj_timer_heap_t *ht );
 
 /**
  * Set lock object to be used by the timer heap. By default, the timer heap
- * uses dummy synchronization.
+ * uses dummy synchronization. With #PJ_TIMER_ENGINE_WHEEL, the timer heap
+ * is synchronized with its internal shard locks by default, and setting a
+ * lock here makes all shards use this lock instead (NULL restores the
+ * internal locks).
  *
  * @param ht        The timer heap.
  * @param lock      The lock object to be used for synchronization.
@@ -324,7 +378,9 @@ PJ_DECL(pj_size_t) pj_timer_heap_count( pj_timer_heap_t *ht );
 /**
  * Get the earliest time registered in the timer heap. The timer heap
  * MUST have at least one timer being scheduled (application should use
- * #pj_timer_heap_count() before calling this function).
+ * #pj_timer_heap_count() before calling this function). With
+ * #PJ_TIMER_ENGINE_WHEEL, the returned time may be earlier than the
+ * actual earliest entry, but never later.
  *
  * @param ht        The timer heap.
  * @param timeval   The time deadline of the earliest timer entry.
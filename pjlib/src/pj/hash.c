@@ -41,11 +41,39 @@ struct pj_hash_entry
 };
 
 
+/*
+ * Open addressing slot array. The meta array holds the tag of the hash
+ * value of each slot, so that probing only needs to touch the entries
+ * whose hash value is likely to match.
+ */
+typedef struct oa_table
+{
+    pj_uint32_t	       *meta;
+    pj_hash_entry      *slot;
+    unsigned		mask;
+    unsigned		used;	    /* Live and deleted slots.	*/
+} oa_table;
+
+#define OA_EMPTY	0
+#define OA_DELETED	1
+#define OA_TAG(hash)	((hash) > OA_DELETED ? (hash) : (hash) + 2)
+#define OA_MIN_SIZE	16
+#define OA_MAX_LOAD(cap) ((cap) - ((cap) >> 2))
+#define OA_REHASH_STEP	16
+
+
 struct pj_hash_table_t
 {
     pj_hash_entry     **table;
     unsigned		count, rows;
     pj_hash_iterator_t	iterator;
+
+    /* Open addressing tables only (table is NULL) */
+    pj_pool_t	       *pool;
+    oa_table		cur;
+    oa_table		old;	    /* Being rehashed into cur.		*/
+    unsigned		rehash_pos;
+    oa_table		spare;	    /* Previous array, for reuse.	*/
 };
 
 
@@ -96,8 +124,7 @@ PJ_DEF(pj_hash_table_t*) pj_hash_create(pj_pool_t *pool, unsigned size)
     /* Check that PJ_HASH_ENTRY_BUF_SIZE is correct. */
     PJ_ASSERT_RETURN(sizeof(pj_hash_entry)<=PJ_HASH_ENTRY_BUF_SIZE, NULL);
 
-    h = PJ_POOL_ALLOC_T(pool, pj_hash_table_t);
-    h->count = 0;
+    h = PJ_POOL_ZALLOC_T(pool, pj_hash_table_t);
 
     PJ_LOG( 6, ("hashtbl", "hash table %p created from pool %s", h, pj_pool_getobjname(pool)));
 
@@ -117,25 +144,54 @@ PJ_DEF(pj_hash_table_t*) pj_hash_create(pj_pool_t *pool, unsigned size)
     return h;
 }
 
-static pj_hash_entry **find_entry( pj_pool_t *pool, pj_hash_table_t *ht, 
-				   const void *key, unsigned keylen,
-				   void *val, pj_uint32_t *hval,
-				   void *entry_buf, pj_bool_t lower)
+PJ_DEF(pj_hash_table_t*) pj_hash_create2(pj_pool_t *pool, unsigned size,
+					 unsigned options)
+{
+    pj_hash_table_t *h;
+    unsigned cap;
+
+    if ((options & PJ_HASH_OPT_OPEN_ADDRESSING) == 0)
+	return pj_hash_create(pool, size);
+
+    h = PJ_POOL_ZALLOC_T(pool, pj_hash_table_t);
+    h->pool = pool;
+
+    for (cap = OA_MIN_SIZE; OA_MAX_LOAD(cap) <= size; cap <<= 1)
+	;
+
+    h->cur.meta = (pj_uint32_t*) pj_pool_calloc(pool, cap, 
+						sizeof(pj_uint32_t));
+    h->cur.slot = (pj_hash_entry*) pj_pool_alloc(pool, 
+						 cap * sizeof(pj_hash_entry));
+    if (!h->cur.meta || !h->cur.slot)
+	return NULL;
+    h->cur.mask = cap - 1;
+
+    PJ_LOG( 6, ("hashtbl", "open addressing hash table %p created from "
+		"pool %s, %u slots", h, pj_pool_getobjname(pool), cap));
+
+    return h;
+}
+
+/* Calculate the hash value of the key, and the key length when keylen
+ * is PJ_HASH_KEY_STRING.
+ */
+static pj_uint32_t calc_key_hash(const void *key, unsigned *keylen,
+				 pj_uint32_t *hval, pj_bool_t lower)
 {
     pj_uint32_t hash;
-    pj_hash_entry **p_entry, *entry;
 
     if (hval && *hval != 0) {
 	hash = *hval;
-	if (keylen==PJ_HASH_KEY_STRING) {
-	    keylen = (unsigned)pj_ansi_strlen((const char*)key);
+	if (*keylen==PJ_HASH_KEY_STRING) {
+	    *keylen = (unsigned)pj_ansi_strlen((const char*)key);
 	}
     } else {
 	/* This slightly differs with pj_hash_calc() because we need 
 	 * to get the keylen when keylen is PJ_HASH_KEY_STRING.
 	 */
 	hash=0;
-	if (keylen==PJ_HASH_KEY_STRING) {
+	if (*keylen==PJ_HASH_KEY_STRING) {
 	    const pj_uint8_t *p = (const pj_uint8_t*)key;
 	    for ( ; *p; ++p ) {
                 if (lower)
@@ -143,10 +199,10 @@ static pj_hash_entry **find_entry( pj_pool_t *pool, pj_hash_table_t *ht,
                 else 
 		    hash = hash * PJ_HASH_MULTIPLIER + *p;
 	    }
-	    keylen = (unsigned)(p - (const unsigned char*)key);
+	    *keylen = (unsigned)(p - (const unsigned char*)key);
 	} else {
 	    const pj_uint8_t *p = (const pj_uint8_t*)key,
-				  *end = p + keylen;
+				  *end = p + *keylen;
 	    for ( ; p!=end; ++p) {
 		if (lower)
                     hash = hash * PJ_HASH_MULTIPLIER + pj_tolower(*p);
@@ -160,18 +216,36 @@ static pj_hash_entry **find_entry( pj_pool_t *pool, pj_hash_table_t *ht,
 	    *hval = hash;
     }
 
+    return hash;
+}
+
+PJ_INLINE(pj_bool_t) key_equal(const pj_hash_entry *entry,
+			       const void *key, unsigned keylen,
+			       pj_uint32_t hash, pj_bool_t lower)
+{
+    return entry->hash==hash && entry->keylen==keylen &&
+           ((lower && pj_ansi_strnicmp((const char*)entry->key,
+				       (const char*)key, keylen)==0) ||
+	    (!lower && pj_memcmp(entry->key, key, keylen)==0));
+}
+
+static pj_hash_entry **find_entry( pj_pool_t *pool, pj_hash_table_t *ht, 
+				   const void *key, unsigned keylen,
+				   void *val, pj_uint32_t *hval,
+				   void *entry_buf, pj_bool_t lower)
+{
+    pj_uint32_t hash;
+    pj_hash_entry **p_entry, *entry;
+
+    hash = calc_key_hash(key, &keylen, hval, lower);
+
     /* scan the linked list */
     for (p_entry = &ht->table[hash & ht->rows], entry=*p_entry; 
 	 entry; 
 	 p_entry = &entry->next, entry = *p_entry)
     {
-	if (entry->hash==hash && entry->keylen==keylen &&
-            ((lower && pj_ansi_strnicmp((const char*)entry->key,
-        			        (const char*)key, keylen)==0) ||
-	     (!lower && pj_memcmp(entry->key, key, keylen)==0)))
-	{
+	if (key_equal(entry, key, keylen, hash, lower))
 	    break;
-	}
     }
 
     if (entry || val==NULL)
@@ -209,12 +283,249 @@ static pj_hash_entry **find_entry( pj_pool_t *pool, pj_hash_table_t *ht,
     return p_entry;
 }
 
+/*
+ * Open addressing implementation.
+ */
+
+/* Find the entry in the slot array. The array always has an empty slot,
+ * so the probing terminates.
+ */
+static pj_hash_entry *oa_find(const oa_table *t, const void *key,
+			      unsigned keylen, pj_uint32_t hash,
+			      pj_bool_t lower)
+{
+    pj_uint32_t tag = OA_TAG(hash);
+    unsigned i;
+
+    for (i = hash & t->mask; t->meta[i] != OA_EMPTY; i = (i+1) & t->mask) {
+	if (t->meta[i] == tag && key_equal(&t->slot[i], key, keylen, hash,
+					   lower))
+	{
+	    return &t->slot[i];
+	}
+    }
+
+    return NULL;
+}
+
+/* Get a free slot for the specified hash value. */
+static pj_hash_entry *oa_insert(oa_table *t, pj_uint32_t hash)
+{
+    unsigned i;
+
+    for (i = hash & t->mask; t->meta[i] > OA_DELETED; i = (i+1) & t->mask)
+	;
+
+    if (t->meta[i] == OA_EMPTY)
+	++t->used;
+    t->meta[i] = OA_TAG(hash);
+    return &t->slot[i];
+}
+
+/* Delete the entry in the specified slot. */
+static void oa_erase(oa_table *t, unsigned i)
+{
+    t->slot[i].value = NULL;
+
+    if (t->meta[(i+1) & t->mask] == OA_EMPTY) {
+	/* No probe sequence goes past this slot, so this slot and the
+	 * deleted slots before it can be made empty again.
+	 */
+	do {
+	    t->meta[i] = OA_EMPTY;
+	    --t->used;
+	    i = (i-1) & t->mask;
+	} while (t->meta[i] == OA_DELETED);
+    } else {
+	t->meta[i] = OA_DELETED;
+    }
+}
+
+/* Move some entries of the old array to the current array. */
+static void oa_rehash_step(pj_hash_table_t *ht, unsigned steps)
+{
+    oa_table *old = &ht->old;
+
+    for (; steps && ht->rehash_pos <= old->mask; --steps) {
+	unsigned i = ht->rehash_pos++;
+
+	if (old->meta[i] > OA_DELETED) {
+	    *oa_insert(&ht->cur, old->slot[i].hash) = old->slot[i];
+	    old->meta[i] = OA_DELETED;
+	}
+    }
+
+    if (ht->rehash_pos > old->mask) {
+	/* Done, keep the old array so that it can be reused */
+	ht->spare = *old;
+	old->meta = NULL;
+    }
+}
+
+/* Make sure there is room for a new entry in the current array, starting
+ * a rehash when the array is getting full.
+ */
+static void oa_reserve(pj_hash_table_t *ht)
+{
+    oa_table t;
+    unsigned cap;
+
+    if (ht->old.meta) {
+	oa_rehash_step(ht, OA_REHASH_STEP);
+	if (ht->old.meta == NULL ||
+	    ht->cur.used < OA_MAX_LOAD(ht->cur.mask+1))
+	{
+	    return;
+	}
+	/* Shouldn't happen, but finish the rehash before starting another */
+	oa_rehash_step(ht, ht->old.mask+1);
+    }
+
+    cap = ht->cur.mask + 1;
+    if (ht->cur.used < OA_MAX_LOAD(cap))
+	return;
+
+    /* Grow the table if it's at least half full of live entries, otherwise
+     * just get rid of the deleted slots.
+     */
+    if (ht->count >= OA_MAX_LOAD(cap) / 2)
+	cap <<= 1;
+
+    if (ht->spare.meta && ht->spare.mask+1 == cap) {
+	t = ht->spare;
+	pj_bzero(t.meta, cap * sizeof(pj_uint32_t));
+	ht->spare.meta = NULL;
+    } else {
+	t.meta = (pj_uint32_t*) pj_pool_calloc(ht->pool, cap, 
+					       sizeof(pj_uint32_t));
+	t.slot = (pj_hash_entry*) pj_pool_alloc(ht->pool, 
+						cap * sizeof(pj_hash_entry));
+	if (!t.meta || !t.slot)
+	    return;
+	t.mask = cap - 1;
+    }
+    t.used = 0;
+
+    PJ_LOG(6, ("hashtbl", "%p: rehashing %u entries into %u slots",
+	       ht, ht->count, cap));
+
+    ht->old = ht->cur;
+    ht->cur = t;
+    ht->rehash_pos = 0;
+    oa_rehash_step(ht, OA_REHASH_STEP);
+}
+
+static pj_hash_entry *oa_find_entry(pj_hash_table_t *ht, 
+				    const void *key, unsigned keylen,
+				    pj_uint32_t *hval, pj_bool_t lower)
+{
+    pj_uint32_t hash;
+    pj_hash_entry *entry;
+
+    hash = calc_key_hash(key, &keylen, hval, lower);
+    entry = oa_find(&ht->cur, key, keylen, hash, lower);
+    if (!entry && ht->old.meta)
+	entry = oa_find(&ht->old, key, keylen, hash, lower);
+
+    return entry;
+}
+
+static void oa_set( pj_pool_t *pool, pj_hash_table_t *ht,
+		    const void *key, unsigned keylen, pj_uint32_t hval,
+		    void *value, pj_bool_t lower )
+{
+    oa_table *t = &ht->cur;
+    pj_hash_entry *entry;
+    pj_uint32_t hash;
+
+    hash = calc_key_hash(key, &keylen, &hval, lower);
+    entry = oa_find(t, key, keylen, hash, lower);
+    if (!entry && ht->old.meta) {
+	t = &ht->old;
+	entry = oa_find(t, key, keylen, hash, lower);
+    }
+
+    if (entry) {
+	if (value == NULL) {
+	    /* delete entry */
+	    PJ_LOG(6, ("hashtbl", "%p: entry %p deleted", ht, entry));
+	    oa_erase(t, (unsigned)(entry - t->slot));
+	    --ht->count;
+	} else {
+	    /* overwrite */
+	    entry->value = value;
+	    PJ_LOG(6, ("hashtbl", "%p: entry %p value set to %p", ht, 
+		       entry, value));
+	}
+	return;
+    }
+
+    if (value == NULL)
+	return;
+
+    oa_reserve(ht);
+
+    /* There must always be an empty slot left */
+    if (ht->cur.used >= ht->cur.mask) {
+	PJ_LOG(2, ("hashtbl", "%p: unable to grow hash table", ht));
+	return;
+    }
+
+    entry = oa_insert(&ht->cur, hash);
+    entry->next = NULL;
+    entry->hash = hash;
+    if (pool) {
+	entry->key = pj_pool_alloc(pool, keylen);
+	pj_memcpy(entry->key, key, keylen);
+    } else {
+	entry->key = (void*)key;
+    }
+    entry->keylen = keylen;
+    entry->value = value;
+
+    ++ht->count;
+}
+
+/* Find the live slot starting from the iterator's index. The index spans
+ * the old array (if rehashing is in progress), then the current array.
+ */
+static pj_hash_iterator_t *oa_iterate(pj_hash_table_t *ht,
+				      pj_hash_iterator_t *it)
+{
+    unsigned old_cap = ht->old.meta ? ht->old.mask + 1 : 0;
+    unsigned end = old_cap + ht->cur.mask + 1;
+
+    for (; it->index < end; ++it->index) {
+	const oa_table *t = &ht->cur;
+	unsigned i = it->index;
+
+	if (i < old_cap) {
+	    t = &ht->old;
+	} else {
+	    i -= old_cap;
+	}
+
+	if (t->meta[i] > OA_DELETED) {
+	    it->entry = &t->slot[i];
+	    return it;
+	}
+    }
+
+    it->entry = NULL;
+    return NULL;
+}
+
+
 PJ_DEF(void *) pj_hash_get( pj_hash_table_t *ht,
 			    const void *key, unsigned keylen,
 			    pj_uint32_t *hval)
 {
     pj_hash_entry *entry;
-    entry = *find_entry( NULL, ht, key, keylen, NULL, hval, NULL, PJ_FALSE);
+    if (ht->pool)
+	entry = oa_find_entry(ht, key, keylen, hval, PJ_FALSE);
+    else
+	entry = *find_entry( NULL, ht, key, keylen, NULL, hval, NULL, 
+			     PJ_FALSE);
     return entry ? entry->value : NULL;
 }
 
@@ -223,7 +534,11 @@ PJ_DEF(void *) pj_hash_get_lower( pj_hash_table_t *ht,
 			          pj_uint32_t *hval)
 {
     pj_hash_entry *entry;
-    entry = *find_entry( NULL, ht, key, keylen, NULL, hval, NULL, PJ_TRUE);
+    if (ht->pool)
+	entry = oa_find_entry(ht, key, keylen, hval, PJ_TRUE);
+    else
+	entry = *find_entry( NULL, ht, key, keylen, NULL, hval, NULL, 
+			     PJ_TRUE);
     return entry ? entry->value : NULL;
 }
 
@@ -233,6 +548,11 @@ static void hash_set( pj_pool_t *pool, pj_hash_table_t *ht,
 {
     pj_hash_entry **p_entry;
 
+    if (ht->pool) {
+	oa_set(pool, ht, key, keylen, hval, value, lower);
+	return;
+    }
+
     p_entry = find_entry( pool, ht, key, keylen, value, &hval, entry_buf,
                           lower);
     if (*p_entry) {
@@ -293,6 +613,9 @@ PJ_DEF(pj_hash_iterator_t*) pj_hash_first( pj_hash_table_t *ht,
     it->index = 0;
     it->entry = NULL;
 
+    if (ht->pool)
+	return oa_iterate(ht, it);
+
     for (; it->index <= ht->rows; ++it->index) {
 	it->entry = ht->table[it->index];
 	if (it->entry) {
@@ -306,6 +629,11 @@ PJ_DEF(pj_hash_iterator_t*) pj_hash_first( pj_hash_table_t *ht,
 PJ_DEF(pj_hash_iterator_t*) pj_hash_next( pj_hash_table_t *ht, 
 					  pj_hash_iterator_t *it )
 {
+    if (ht->pool) {
+	++it->index;
+	return oa_iterate(ht, it);
+    }
+
     it->entry = it->entry->next;
     if (it->entry) {
 	return it;
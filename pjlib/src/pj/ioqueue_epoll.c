@@ -53,6 +53,12 @@
 #define os_epoll_ctl		epoll_ctl
 #define os_epoll_wait		epoll_wait
 
+/* Atomic operations on the key's reference counter. Epoll is only
+ * available on Linux, where the compiler always provides these.
+ */
+#define EPOLL_ATOMIC_INC(p)	__sync_add_and_fetch(p, 1)
+#define EPOLL_ATOMIC_DEC(p)	__sync_sub_and_fetch(p, 1)
+
 #define THIS_FILE   "ioq_epoll"
 
 //#define TRACE_(expr) PJ_LOG(3,expr)
@@ -92,7 +98,6 @@ struct pj_ioqueue_t
     //struct queue       *queue;
 
 #if PJ_IOQUEUE_HAS_SAFE_UNREG
-    pj_mutex_t	       *ref_cnt_mutex;
     pj_ioqueue_key_t	closing_list;
     pj_ioqueue_key_t	free_list;
 #endif
@@ -148,17 +153,10 @@ PJ_DEF(pj_status_t) pj_ioqueue_create( pj_pool_t *pool,
 
 #if PJ_IOQUEUE_HAS_SAFE_UNREG
     /* When safe unregistration is used (the default), we pre-create
-     * all keys and put them in the free list.
-     */
-
-    /* Mutex to protect key's reference counter 
-     * We don't want to use key's mutex or ioqueue's mutex because
-     * that would create deadlock situation in some cases.
+     * all keys and put them in the free list. The key's reference
+     * counter is maintained with atomic operations, so no mutex is
+     * needed to protect it.
      */
-    rc = pj_mutex_create_simple(pool, NULL, &ioqueue->ref_cnt_mutex);
-    if (rc != PJ_SUCCESS)
-	return rc;
-
 
     /* Init key list */
     pj_list_init(&ioqueue->free_list);
@@ -178,7 +176,6 @@ PJ_DEF(pj_status_t) pj_ioqueue_create( pj_pool_t *pool,
 		pj_lock_destroy(key->lock);
 		key = key->next;
 	    }
-	    pj_mutex_destroy(ioqueue->ref_cnt_mutex);
 	    return rc;
 	}
 
@@ -247,8 +244,6 @@ PJ_DEF(pj_status_t) pj_ioqueue_destroy(pj_ioqueue_t *ioqueue)
 	pj_lock_destroy(key->lock);
 	key = key->next;
     }
-
-    pj_mutex_destroy(ioqueue->ref_cnt_mutex);
 #endif
     return ioqueue_destroy(ioqueue);
 }
@@ -369,27 +364,26 @@ PJ_DEF(pj_status_t) pj_ioqueue_register_sock( pj_pool_t *pool,
 }
 
 #if PJ_IOQUEUE_HAS_SAFE_UNREG
-/* Increment key's reference counter */
-static void increment_counter(pj_ioqueue_key_t *key)
-{
-    pj_mutex_lock(key->ioqueue->ref_cnt_mutex);
-    ++key->ref_count;
-    pj_mutex_unlock(key->ioqueue->ref_cnt_mutex);
-}
-
 /* Decrement the key's reference counter, and when the counter reach zero,
  * destroy the key.
  *
+ * The counter is manipulated with atomic operations, so the ioqueue's
+ * lock is only taken when the key is moved to the closing list. The
+ * group lock reference of the registration is released here too rather
+ * than in pj_ioqueue_unregister(), so that it stays valid for a poller
+ * which has incremented the counter before the key was marked closing.
+ *
  * Note: MUST NOT CALL THIS FUNCTION WHILE HOLDING ioqueue's LOCK.
  */
 static void decrement_counter(pj_ioqueue_key_t *key)
 {
-    pj_lock_acquire(key->ioqueue->lock);
-    pj_mutex_lock(key->ioqueue->ref_cnt_mutex);
-    --key->ref_count;
-    if (key->ref_count == 0) {
+    if (EPOLL_ATOMIC_DEC(&key->ref_count) == 0) {
+	pj_grp_lock_t *grp_lock = key->grp_lock;
 
 	pj_assert(key->closing == 1);
+
+	pj_lock_acquire(key->ioqueue->lock);
+
 	pj_gettickcount(&key->free_time);
 	key->free_time.msec += PJ_IOQUEUE_KEY_FREE_DELAY;
 	pj_time_val_normalize(&key->free_time);
@@ -397,10 +391,29 @@ static void decrement_counter(pj_ioqueue_key_t *key)
 	pj_list_erase(key);
 	pj_list_push_back(&key->ioqueue->closing_list, key);
 
+	pj_lock_release(key->ioqueue->lock);
+
+	if (grp_lock)
+	    pj_grp_lock_dec_ref_dbg(grp_lock, "ioqueue", 0);
+    }
+}
+
+/* Increment key's reference counter, unless the key is being closed.
+ * The closing flag is checked after the increment, so that a concurrent
+ * unregistration either sees our reference, or we see its closing flag.
+ */
+static pj_bool_t try_increment_counter(pj_ioqueue_key_t *key)
+{
+    EPOLL_ATOMIC_INC(&key->ref_count);
+    if (IS_CLOSING(key)) {
+	decrement_counter(key);
+	return PJ_FALSE;
     }
-    pj_mutex_unlock(key->ioqueue->ref_cnt_mutex);
-    pj_lock_release(key->ioqueue->lock);
+    return PJ_TRUE;
 }
+#else
+/* Without safe unregistration there is no reference counter to maintain */
+#   define try_increment_counter(key)	(!IS_CLOSING(key))
 #endif
 
 /*
@@ -468,23 +481,13 @@ PJ_DEF(pj_status_t) pj_ioqueue_unregister( pj_ioqueue_key_t *key)
     /* Mark key is closing. */
     key->closing = 1;
 
+    /* Unlock before decrementing the counter, which releases our
+     * reference to the group lock once no poller uses the key anymore.
+     */
+    pj_ioqueue_unlock_key(key);
+
     /* Decrement counter. */
     decrement_counter(key);
-
-    /* Done. */
-    if (key->grp_lock) {
-	/* just dec_ref and unlock. we will set grp_lock to NULL
-	 * elsewhere */
-	pj_grp_lock_t *grp_lock = key->grp_lock;
-	// Don't set grp_lock to NULL otherwise the other thread
-	// will crash. Just leave it as dangling pointer, but this
-	// should be safe
-	//key->grp_lock = NULL;
-	pj_grp_lock_dec_ref_dbg(grp_lock, "ioqueue", 0);
-	pj_grp_lock_release(grp_lock);
-    } else {
-	pj_ioqueue_unlock_key(key);
-    }
 #else
     if (key->grp_lock) {
 	/* set grp_lock to NULL and unlock */
@@ -582,6 +585,7 @@ PJ_DEF(int) pj_ioqueue_poll( pj_ioqueue_t *ioqueue, const pj_time_val *timeout)
     enum { MAX_EVENTS = PJ_IOQUEUE_MAX_CAND_EVENTS };
     struct epoll_event events[MAX_EVENTS];
     struct queue queue[MAX_EVENTS];
+    pj_grp_lock_t *grp_lock;
     pj_timestamp t1, t2;
     
     PJ_CHECK_STACK();
@@ -616,95 +620,77 @@ PJ_DEF(int) pj_ioqueue_poll( pj_ioqueue_t *ioqueue, const pj_time_val *timeout)
     TRACE_((THIS_FILE, "os_epoll_wait returns %d, time=%d usec",
 		       count, pj_elapsed_usec(&t1, &t2)));
 
-    /* Lock ioqueue. */
+    /* The events are collected without holding the ioqueue's lock. Each
+     * candidate key is protected by its (atomic) reference counter, so
+     * several threads can run this loop in parallel. Without safe
+     * unregistration there is no counter, so the lock is still needed to
+     * keep unregistration from releasing the group lock meanwhile.
+     */
+#if !PJ_IOQUEUE_HAS_SAFE_UNREG
     pj_lock_acquire(ioqueue->lock);
-
+#endif
     for (event_cnt=0, i=0; i<count; ++i) {
 	pj_ioqueue_key_t *h = (pj_ioqueue_key_t*)(epoll_data_type)
 				events[i].epoll_data;
+	enum ioqueue_event_type event_type = NO_EVENT;
 
 	TRACE_((THIS_FILE, "event %d: events=%d", i, events[i].events));
 
-	/*
-	 * Check readability.
-	 */
-	if ((events[i].events & EPOLLIN) && 
-	    (key_has_pending_read(h) || key_has_pending_accept(h)) && !IS_CLOSING(h) ) {
-
-#if PJ_IOQUEUE_HAS_SAFE_UNREG
-	    increment_counter(h);
-#endif
-	    queue[event_cnt].key = h;
-	    queue[event_cnt].event_type = READABLE_EVENT;
-	    ++event_cnt;
+	if (IS_CLOSING(h))
 	    continue;
-	}
 
-	/*
-	 * Check for writeability.
-	 */
-	if ((events[i].events & EPOLLOUT) && key_has_pending_write(h) && !IS_CLOSING(h)) {
+	if ((events[i].events & EPOLLIN) && 
+	    (key_has_pending_read(h) || key_has_pending_accept(h)))
+	{
+	    /*
+	     * Check readability.
+	     */
+	    event_type = READABLE_EVENT;
 
-#if PJ_IOQUEUE_HAS_SAFE_UNREG
-	    increment_counter(h);
-#endif
-	    queue[event_cnt].key = h;
-	    queue[event_cnt].event_type = WRITEABLE_EVENT;
-	    ++event_cnt;
-	    continue;
-	}
+	} else if ((events[i].events & EPOLLOUT) && key_has_pending_write(h)) {
+	    /*
+	     * Check for writeability.
+	     */
+	    event_type = WRITEABLE_EVENT;
 
 #if PJ_HAS_TCP
-	/*
-	 * Check for completion of connect() operation.
-	 */
-	if ((events[i].events & EPOLLOUT) && (h->connecting) && !IS_CLOSING(h)) {
-
-#if PJ_IOQUEUE_HAS_SAFE_UNREG
-	    increment_counter(h);
-#endif
-	    queue[event_cnt].key = h;
-	    queue[event_cnt].event_type = WRITEABLE_EVENT;
-	    ++event_cnt;
-	    continue;
-	}
+	} else if ((events[i].events & EPOLLOUT) && (h->connecting)) {
+	    /*
+	     * Check for completion of connect() operation.
+	     */
+	    event_type = WRITEABLE_EVENT;
 #endif /* PJ_HAS_TCP */
 
-	/*
-	 * Check for error condition.
-	 */
-	if ((events[i].events & EPOLLERR) && !IS_CLOSING(h)) {
+	} else if (events[i].events & EPOLLERR) {
 	    /*
 	     * We need to handle this exception event.  If it's related to us
 	     * connecting, report it as such.  If not, just report it as a
 	     * read event and the higher layers will handle it.
 	     */
-	    if (h->connecting) {
-#if PJ_IOQUEUE_HAS_SAFE_UNREG
-		increment_counter(h);
-#endif
-		queue[event_cnt].key = h;
-		queue[event_cnt].event_type = EXCEPTION_EVENT;
-		++event_cnt;
-	    } else if (key_has_pending_read(h) || key_has_pending_accept(h)) {
-#if PJ_IOQUEUE_HAS_SAFE_UNREG
-		increment_counter(h);
-#endif
-		queue[event_cnt].key = h;
-		queue[event_cnt].event_type = READABLE_EVENT;
-		++event_cnt;
-	    }
-	    continue;
+	    if (h->connecting)
+		event_type = EXCEPTION_EVENT;
+	    else if (key_has_pending_read(h) || key_has_pending_accept(h))
+		event_type = READABLE_EVENT;
 	}
-    }
-    for (i=0; i<event_cnt; ++i) {
-	if (queue[i].key->grp_lock)
-	    pj_grp_lock_add_ref_dbg(queue[i].key->grp_lock, "ioqueue", 0);
-    }
 
-    PJ_RACE_ME(5);
+	/* The counter must be held before the group lock is referenced: it
+	 * keeps the reference of the registration, which unregistration
+	 * only releases when the counter drops to zero.
+	 */
+	if (event_type == NO_EVENT || !try_increment_counter(h))
+	    continue;
+
+	if (h->grp_lock)
+	    pj_grp_lock_add_ref_dbg(h->grp_lock, "ioqueue", 0);
 
+	queue[event_cnt].key = h;
+	queue[event_cnt].event_type = event_type;
+	++event_cnt;
+    }
+
+#if !PJ_IOQUEUE_HAS_SAFE_UNREG
     pj_lock_release(ioqueue->lock);
+#endif
 
     PJ_RACE_ME(5);
 
@@ -734,13 +720,16 @@ PJ_DEF(int) pj_ioqueue_poll( pj_ioqueue_t *ioqueue, const pj_time_val *timeout)
 	    }
 	}
 
+	/* Release the counter first, our own group lock reference keeps
+	 * the group lock alive until the end.
+	 */
+	grp_lock = queue[i].key->grp_lock;
 #if PJ_IOQUEUE_HAS_SAFE_UNREG
 	decrement_counter(queue[i].key);
 #endif
 
-	if (queue[i].key->grp_lock)
-	    pj_grp_lock_dec_ref_dbg(queue[i].key->grp_lock,
-	                            "ioqueue", 0);
+	if (grp_lock)
+	    pj_grp_lock_dec_ref_dbg(grp_lock, "ioqueue", 0);
     }
 
     /* Special case:
@@ -0,0 +1,1809 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+/*
+ * ioqueue_uring.c
+ *
+ * This is the implementation of IOQueue framework using Linux io_uring.
+ *
+ * Unlike the select/epoll backends, which emulate the proactor pattern
+ * on top of readiness notification (ioqueue_common_abs.c), this backend
+ * submits the actual recvmsg/sendmsg/accept operations to the kernel and
+ * reports their completion. Operations which are posted from inside an
+ * ioqueue callback are not submitted one by one; they are collected in
+ * the submission ring and submitted in a single io_uring_enter() call
+ * together with the wait for the next completions.
+ *
+ * The ring is set up directly with the io_uring system calls, so no
+ * additional library is needed. Linux 5.11 or later is required
+ * (IORING_FEAT_EXT_ARG, for waiting with timeout).
+ */
+#include <pj/ioqueue.h>
+#include <pj/os.h>
+#include <pj/lock.h>
+#include <pj/log.h>
+#include <pj/list.h>
+#include <pj/pool.h>
+#include <pj/string.h>
+#include <pj/assert.h>
+#include <pj/errno.h>
+#include <pj/sock.h>
+#include <pj/compat/socket.h>
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <errno.h>
+#include <unistd.h>
+
+#define THIS_FILE   "ioq_uring"
+
+//#define TRACE_(expr) PJ_LOG(3,expr)
+#define TRACE_(expr)
+
+/* Memory barriers for the shared rings. */
+#define ring_load_acquire(p)	    __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define ring_store_release(p, v)    __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+/* Atomic operations on the key's reference counter. */
+#define URING_ATOMIC_INC(p)	__sync_add_and_fetch(p, 1)
+#define URING_ATOMIC_DEC(p)	__sync_sub_and_fetch(p, 1)
+
+/* Maximum number of submission queue entries. */
+#define MAX_SQ_ENTRIES		4096
+
+
+/*
+ * Internal request, one for each operation submitted to the kernel.
+ * Requests are owned by the ioqueue rather than by the application's
+ * pj_ioqueue_op_key_t, so that a late completion of a cancelled
+ * operation never touches memory that the application has released.
+ */
+struct uring_req
+{
+    PJ_DECL_LIST_MEMBER(struct uring_req);
+    pj_ioqueue_key_t	   *key;
+    pj_ioqueue_op_key_t	   *op_key;	/* NULL when orphaned.		*/
+    pj_ioqueue_operation_e  op;
+    pj_bool_t		    polling;	/* Waiting readiness to retry.	*/
+    pj_bool_t		    submitted;	/* Has been given to the kernel.*/
+    pj_bool_t		    cancel_queued; /* In ioqueue's cancel_queue.*/
+    struct uring_req	   *cancel_next;
+
+    char		   *buf;
+    pj_size_t		    size;
+    pj_ssize_t		    done;
+    unsigned		    flags;
+
+    struct msghdr	    msg;
+    struct iovec	    iov;
+    pj_sockaddr		    addr;
+    socklen_t		    addrlen;
+
+    /* Application's output parameters */
+    pj_sock_t		   *accept_fd;
+    pj_sockaddr_t	   *local_addr;
+    pj_sockaddr_t	   *rmt_addr;
+    int			   *rmt_addrlen;
+};
+
+/*
+ * Overlay of pj_ioqueue_op_key_t.
+ */
+struct op_rec
+{
+    pj_ioqueue_operation_e  op;
+    struct uring_req	   *req;
+};
+
+/*
+ * This describes each key.
+ */
+struct pj_ioqueue_key_t
+{
+    PJ_DECL_LIST_MEMBER(struct pj_ioqueue_key_t);
+    pj_ioqueue_t	   *ioqueue;
+    pj_grp_lock_t	   *grp_lock;
+    pj_lock_t		   *lock;
+    pj_bool_t		    allow_concurrent;
+    pj_sock_t		    fd;
+    int			    fd_type;
+    void		   *user_data;
+    pj_ioqueue_callback	    cb;
+    int			    connecting;
+
+    /* Requests which are currently owned by the kernel */
+    struct uring_req	    req_list;
+
+    /* Stream sends waiting for the previous send to complete */
+    struct uring_req	    write_list;
+    pj_bool_t		    write_busy;
+
+    unsigned		    ref_count;
+    pj_bool_t		    closing;
+    pj_time_val		    free_time;
+};
+
+/*
+ * This describes the I/O queue.
+ */
+struct pj_ioqueue_t
+{
+    pj_lock_t		   *lock;
+    pj_bool_t		    auto_delete_lock;
+    pj_bool_t		    default_concurrency;
+
+    pj_pool_t		   *pool;
+    unsigned		    max, count;
+    pj_ioqueue_key_t	    active_list;
+    pj_ioqueue_key_t	    closing_list;
+    pj_ioqueue_key_t	    free_list;
+
+    /* The ring */
+    int			    ring_fd;
+    void		   *sq_ptr;
+    pj_size_t		    sq_len;
+    void		   *cq_ptr;
+    pj_size_t		    cq_len;
+    struct io_uring_sqe	   *sqes;
+    pj_size_t		    sqes_len;
+
+    unsigned		   *sq_head;
+    unsigned		   *sq_tail;
+    unsigned		    sq_mask;
+    unsigned		    sq_entries;
+    unsigned		   *sq_array;
+
+    unsigned		   *cq_head;
+    unsigned		   *cq_tail;
+    unsigned		    cq_mask;
+    struct io_uring_cqe	   *cqes;
+
+    /* Protects the submission ring and the request free list */
+    pj_lock_t		   *sq_lock;
+    struct uring_req	    req_free_list;
+
+    /* Requests whose cancellation did not fit in the submission ring */
+    struct uring_req	   *cancel_queue;
+
+    /* Protects reaping of the completion ring */
+    pj_lock_t		   *cq_lock;
+
+    /* Thread local flag, set while a thread is dispatching completions */
+    long		    tls_dispatch;
+};
+
+
+/* Scan closing keys to be put to free list again */
+static void scan_closing_keys(pj_ioqueue_t *ioqueue);
+
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit,
+			      unsigned min_complete, unsigned flags,
+			      void *arg, pj_size_t argsz)
+{
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+			 flags, arg, argsz);
+}
+
+/* Number of queued entries that the kernel has not consumed yet.
+ * Must be called with sq_lock held.
+ */
+PJ_INLINE(unsigned) sq_pending(pj_ioqueue_t *ioqueue)
+{
+    return *ioqueue->sq_tail - ring_load_acquire(ioqueue->sq_head);
+}
+
+/* Submit all queued entries to the kernel. Must be called with sq_lock
+ * held.
+ */
+static void sq_flush(pj_ioqueue_t *ioqueue)
+{
+    while (sq_pending(ioqueue)) {
+	int rc = sys_io_uring_enter(ioqueue->ring_fd, sq_pending(ioqueue),
+				    0, 0, NULL, 0);
+	if (rc < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+	    PJ_PERROR(4,(THIS_FILE, PJ_STATUS_FROM_OS(errno),
+			 "io_uring_enter() submit error"));
+	    break;
+	}
+	if (rc <= 0)
+	    break;
+    }
+}
+
+/* Get a free submission entry. Must be called with sq_lock held. */
+static struct io_uring_sqe *sq_get_entry(pj_ioqueue_t *ioqueue)
+{
+    struct io_uring_sqe *sqe;
+    unsigned tail;
+
+    if (sq_pending(ioqueue) >= ioqueue->sq_entries) {
+	sq_flush(ioqueue);
+	if (sq_pending(ioqueue) >= ioqueue->sq_entries)
+	    return NULL;
+    }
+
+    tail = *ioqueue->sq_tail;
+    sqe = &ioqueue->sqes[tail & ioqueue->sq_mask];
+    pj_bzero(sqe, sizeof(*sqe));
+    ioqueue->sq_array[tail & ioqueue->sq_mask] = tail & ioqueue->sq_mask;
+    return sqe;
+}
+
+/* Publish the entry obtained with sq_get_entry(). The entry is submitted
+ * right away, unless the calling thread is dispatching completions, in
+ * which case it is submitted in batch when the dispatching is done.
+ * Must be called with sq_lock held.
+ */
+static void sq_commit_entry(pj_ioqueue_t *ioqueue)
+{
+    ring_store_release(ioqueue->sq_tail, *ioqueue->sq_tail + 1);
+
+    if (pj_thread_local_get(ioqueue->tls_dispatch) == NULL)
+	sq_flush(ioqueue);
+}
+
+/* Allocate internal request. Must be called with sq_lock held. */
+static struct uring_req *req_alloc(pj_ioqueue_t *ioqueue)
+{
+    struct uring_req *req;
+
+    if (!pj_list_empty(&ioqueue->req_free_list)) {
+	req = ioqueue->req_free_list.next;
+	pj_list_erase(req);
+    } else {
+	req = PJ_POOL_ALLOC_T(ioqueue->pool, struct uring_req);
+    }
+    pj_bzero(req, sizeof(*req));
+    return req;
+}
+
+/* Release internal request. Must be called with sq_lock held. */
+static void req_free(pj_ioqueue_t *ioqueue, struct uring_req *req)
+{
+    /* Completed before its cancellation could be submitted */
+    if (req->cancel_queued) {
+	struct uring_req **p = &ioqueue->cancel_queue;
+
+	while (*p != req)
+	    p = &(*p)->cancel_next;
+	*p = req->cancel_next;
+	req->cancel_queued = PJ_FALSE;
+    }
+    pj_list_push_back(&ioqueue->req_free_list, req);
+}
+
+/* Decrement the key's reference counter, and when the counter reach zero,
+ * put the key in the closing list.
+ *
+ * Every request given to the kernel holds a reference, so the counter
+ * only drops to zero once the kernel has completed all of them. This is
+ * also where the group lock reference of the registration is released:
+ * the application's buffers, which are typically owned by the group
+ * lock's object, must stay valid until then.
+ */
+static void decrement_counter(pj_ioqueue_key_t *key)
+{
+    if (URING_ATOMIC_DEC(&key->ref_count) == 0) {
+	pj_ioqueue_t *ioqueue = key->ioqueue;
+	pj_grp_lock_t *grp_lock = key->grp_lock;
+
+	pj_assert(key->closing);
+
+	pj_lock_acquire(ioqueue->lock);
+
+	pj_gettickcount(&key->free_time);
+	key->free_time.msec += PJ_IOQUEUE_KEY_FREE_DELAY;
+	pj_time_val_normalize(&key->free_time);
+
+	pj_list_erase(key);
+	pj_list_push_back(&ioqueue->closing_list, key);
+
+	pj_lock_release(ioqueue->lock);
+
+	if (grp_lock)
+	    pj_grp_lock_dec_ref_dbg(grp_lock, "ioqueue", 0);
+    }
+}
+
+/*
+ * Prepare the submission entry for the request's operation (or for the
+ * readiness poll when the request is polling). Must be called with
+ * sq_lock held.
+ */
+static pj_status_t submit_req(pj_ioqueue_t *ioqueue, struct uring_req *req)
+{
+    pj_ioqueue_key_t *key = req->key;
+    struct io_uring_sqe *sqe;
+
+    sqe = sq_get_entry(ioqueue);
+    if (!sqe)
+	return PJ_ETOOMANY;
+
+    sqe->fd = key->fd;
+    sqe->user_data = (__u64)(pj_size_t)req;
+
+    if (req->polling) {
+	sqe->opcode = IORING_OP_POLL_ADD;
+	if (req->op == PJ_IOQUEUE_OP_SEND || req->op == PJ_IOQUEUE_OP_SEND_TO
+#if PJ_HAS_TCP
+	    || req->op == PJ_IOQUEUE_OP_CONNECT
+#endif
+	    )
+	{
+	    sqe->poll_events = POLLOUT;
+	} else {
+	    sqe->poll_events = POLLIN;
+	}
+
+    } else switch (req->op) {
+    case PJ_IOQUEUE_OP_RECV:
+    case PJ_IOQUEUE_OP_RECV_FROM:
+    case PJ_IOQUEUE_OP_READ:
+	req->iov.iov_base = req->buf;
+	req->iov.iov_len = req->size;
+	pj_bzero(&req->msg, sizeof(req->msg));
+	req->msg.msg_iov = &req->iov;
+	req->msg.msg_iovlen = 1;
+	if (req->op == PJ_IOQUEUE_OP_RECV_FROM) {
+	    req->msg.msg_name = &req->addr;
+	    req->msg.msg_namelen = sizeof(req->addr);
+	}
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->addr = (__u64)(pj_size_t)&req->msg;
+	sqe->len = 1;
+	sqe->msg_flags = req->flags;
+	break;
+
+    case PJ_IOQUEUE_OP_SEND:
+    case PJ_IOQUEUE_OP_SEND_TO:
+    case PJ_IOQUEUE_OP_WRITE:
+	req->iov.iov_base = req->buf + req->done;
+	req->iov.iov_len = req->size - req->done;
+	pj_bzero(&req->msg, sizeof(req->msg));
+	req->msg.msg_iov = &req->iov;
+	req->msg.msg_iovlen = 1;
+	if (req->op == PJ_IOQUEUE_OP_SEND_TO) {
+	    req->msg.msg_name = &req->addr;
+	    req->msg.msg_namelen = req->addrlen;
+	}
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->addr = (__u64)(pj_size_t)&req->msg;
+	sqe->len = 1;
+	sqe->msg_flags = req->flags | MSG_NOSIGNAL;
+	break;
+
+#if PJ_HAS_TCP
+    case PJ_IOQUEUE_OP_ACCEPT:
+	req->addrlen = sizeof(req->addr);
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->addr = (__u64)(pj_size_t)&req->addr;
+	sqe->addr2 = (__u64)(pj_size_t)&req->addrlen;
+	break;
+#endif
+
+    default:
+	pj_assert(!"Invalid operation");
+	return PJ_EBUG;
+    }
+
+    req->submitted = PJ_TRUE;
+    sq_commit_entry(ioqueue);
+    return PJ_SUCCESS;
+}
+
+/*
+ * Queue a new request for the key. The key must be locked.
+ */
+static pj_status_t queue_req(pj_ioqueue_key_t *key, struct uring_req *req,
+			     pj_ioqueue_op_key_t *op_key)
+{
+    pj_ioqueue_t *ioqueue = key->ioqueue;
+    struct op_rec *rec = (struct op_rec*)op_key;
+    pj_bool_t stream_write = PJ_FALSE;
+    pj_status_t status = PJ_SUCCESS;
+
+    req->key = key;
+    req->op_key = op_key;
+    rec->op = req->op;
+    rec->req = req;
+
+    URING_ATOMIC_INC(&key->ref_count);
+
+    /* Sends on stream sockets must be submitted one at a time, since
+     * the kernel may run them in parallel and reorder the stream.
+     */
+    if ((req->op == PJ_IOQUEUE_OP_SEND || req->op == PJ_IOQUEUE_OP_WRITE) &&
+	key->fd_type != pj_SOCK_DGRAM())
+    {
+	if (key->write_busy) {
+	    pj_list_push_back(&key->write_list, req);
+	    return PJ_SUCCESS;
+	}
+	key->write_busy = stream_write = PJ_TRUE;
+    }
+
+    pj_list_push_back(&key->req_list, req);
+
+    pj_lock_acquire(ioqueue->sq_lock);
+    status = submit_req(ioqueue, req);
+    pj_lock_release(ioqueue->sq_lock);
+
+    if (status != PJ_SUCCESS) {
+	pj_list_erase(req);
+	if (stream_write)
+	    key->write_busy = PJ_FALSE;
+	rec->op = PJ_IOQUEUE_OP_NONE;
+	rec->req = NULL;
+	URING_ATOMIC_DEC(&key->ref_count);
+    }
+
+    return status;
+}
+
+/* Submit the cancellation of the request. Must be called with sq_lock
+ * held.
+ */
+static pj_bool_t submit_cancel(pj_ioqueue_t *ioqueue, struct uring_req *req)
+{
+    struct io_uring_sqe *sqe;
+
+    sqe = sq_get_entry(ioqueue);
+    if (!sqe)
+	return PJ_FALSE;
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (__u64)(pj_size_t)req;
+    sqe->user_data = 0;
+    sq_commit_entry(ioqueue);
+    return PJ_TRUE;
+}
+
+/* Cancel the request in the kernel. The request itself is released when
+ * its completion is reaped, cancelled or not. If the submission ring is
+ * full, the cancellation is queued and retried by pj_ioqueue_poll(), as
+ * a request which is never cancelled may never complete. Must be called
+ * with sq_lock held.
+ */
+static void cancel_req(pj_ioqueue_t *ioqueue, struct uring_req *req)
+{
+    if (!req->submitted || req->cancel_queued)
+	return;
+
+    if (!submit_cancel(ioqueue, req)) {
+	req->cancel_queued = PJ_TRUE;
+	req->cancel_next = ioqueue->cancel_queue;
+	ioqueue->cancel_queue = req;
+    }
+}
+
+/* Retry the queued cancellations. Must be called with sq_lock held. */
+static void flush_cancel_queue(pj_ioqueue_t *ioqueue)
+{
+    while (ioqueue->cancel_queue) {
+	struct uring_req *req = ioqueue->cancel_queue;
+
+	if (!submit_cancel(ioqueue, req))
+	    break;
+
+	ioqueue->cancel_queue = req->cancel_next;
+	req->cancel_queued = PJ_FALSE;
+    }
+}
+
+/*
+ * pj_ioqueue_name()
+ */
+PJ_DEF(const char*) pj_ioqueue_name(void)
+{
+    return "io_uring";
+}
+
+/* Unmap the rings and close the ring descriptor */
+static void destroy_ring(pj_ioqueue_t *ioqueue)
+{
+    if (ioqueue->sqes)
+	munmap(ioqueue->sqes, ioqueue->sqes_len);
+    if (ioqueue->cq_ptr && ioqueue->cq_ptr != ioqueue->sq_ptr)
+	munmap(ioqueue->cq_ptr, ioqueue->cq_len);
+    if (ioqueue->sq_ptr)
+	munmap(ioqueue->sq_ptr, ioqueue->sq_len);
+    if (ioqueue->ring_fd >= 0)
+	close(ioqueue->ring_fd);
+
+    ioqueue->sqes = NULL;
+    ioqueue->cq_ptr = ioqueue->sq_ptr = NULL;
+    ioqueue->ring_fd = -1;
+}
+
+/* Set up the ring and map the shared memory areas */
+static pj_status_t create_ring(pj_ioqueue_t *ioqueue, unsigned entries)
+{
+    struct io_uring_params p;
+    char *sq, *cq;
+
+    pj_bzero(&p, sizeof(p));
+    ioqueue->ring_fd = sys_io_uring_setup(entries, &p);
+    if (ioqueue->ring_fd < 0)
+	return PJ_STATUS_FROM_OS(errno);
+
+    if ((p.features & IORING_FEAT_EXT_ARG) == 0 ||
+	(p.features & IORING_FEAT_NODROP) == 0)
+    {
+	PJ_LOG(2,(THIS_FILE, "io_uring: kernel is too old, need Linux 5.11"));
+	close(ioqueue->ring_fd);
+	ioqueue->ring_fd = -1;
+	return PJ_ENOTSUP;
+    }
+
+    ioqueue->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ioqueue->cq_len = p.cq_off.cqes +
+		      p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+	if (ioqueue->cq_len > ioqueue->sq_len)
+	    ioqueue->sq_len = ioqueue->cq_len;
+	ioqueue->cq_len = ioqueue->sq_len;
+    }
+
+    ioqueue->sq_ptr = mmap(NULL, ioqueue->sq_len, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, ioqueue->ring_fd,
+			   IORING_OFF_SQ_RING);
+    if (ioqueue->sq_ptr == MAP_FAILED) {
+	ioqueue->sq_ptr = NULL;
+	goto on_error;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+	ioqueue->cq_ptr = ioqueue->sq_ptr;
+    } else {
+	ioqueue->cq_ptr = mmap(NULL, ioqueue->cq_len, PROT_READ | PROT_WRITE,
+			       MAP_SHARED | MAP_POPULATE, ioqueue->ring_fd,
+			       IORING_OFF_CQ_RING);
+	if (ioqueue->cq_ptr == MAP_FAILED) {
+	    ioqueue->cq_ptr = NULL;
+	    goto on_error;
+	}
+    }
+
+    ioqueue->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ioqueue->sqes = (struct io_uring_sqe*)
+		    mmap(NULL, ioqueue->sqes_len, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, ioqueue->ring_fd,
+			 IORING_OFF_SQES);
+    if (ioqueue->sqes == MAP_FAILED) {
+	ioqueue->sqes = NULL;
+	goto on_error;
+    }
+
+    sq = (char*)ioqueue->sq_ptr;
+    ioqueue->sq_head = (unsigned*)(sq + p.sq_off.head);
+    ioqueue->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    ioqueue->sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+    ioqueue->sq_entries = *(unsigned*)(sq + p.sq_off.ring_entries);
+    ioqueue->sq_array = (unsigned*)(sq + p.sq_off.array);
+
+    cq = (char*)ioqueue->cq_ptr;
+    ioqueue->cq_head = (unsigned*)(cq + p.cq_off.head);
+    ioqueue->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    ioqueue->cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+    ioqueue->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    return PJ_SUCCESS;
+
+on_error:
+    {
+	pj_status_t status = PJ_STATUS_FROM_OS(errno);
+	destroy_ring(ioqueue);
+	return status;
+    }
+}
+
+/*
+ * pj_ioqueue_create()
+ *
+ * Create io_uring ioqueue.
+ */
+PJ_DEF(pj_status_t) pj_ioqueue_create( pj_pool_t *pool,
+                                       pj_size_t max_fd,
+                                       pj_ioqueue_t **p_ioqueue)
+{
+    pj_ioqueue_t *ioqueue;
+    pj_lock_t *lock;
+    unsigned i, entries;
+    pj_status_t rc;
+
+    /* Check that arguments are valid. */
+    PJ_ASSERT_RETURN(pool != NULL && p_ioqueue != NULL &&
+                     max_fd > 0, PJ_EINVAL);
+
+    /* Check that size of pj_ioqueue_op_key_t is sufficient */
+    PJ_ASSERT_RETURN(sizeof(pj_ioqueue_op_key_t)-sizeof(void*) >=
+                     sizeof(struct op_rec), PJ_EBUG);
+
+    ioqueue = PJ_POOL_ZALLOC_T(pool, pj_ioqueue_t);
+    ioqueue->pool = pool;
+    ioqueue->max = (unsigned)max_fd;
+    ioqueue->default_concurrency = PJ_IOQUEUE_DEFAULT_ALLOW_CONCURRENCY;
+    ioqueue->ring_fd = -1;
+    ioqueue->tls_dispatch = -1;
+    pj_list_init(&ioqueue->active_list);
+    pj_list_init(&ioqueue->closing_list);
+    pj_list_init(&ioqueue->free_list);
+    pj_list_init(&ioqueue->req_free_list);
+
+    /* Pre-create all keys according to max_fd. The keys must stay valid
+     * until the kernel has completed all of their requests.
+     */
+    for (i=0; i<max_fd; ++i) {
+	pj_ioqueue_key_t *key;
+
+	key = PJ_POOL_ZALLOC_T(pool, pj_ioqueue_key_t);
+	rc = pj_lock_create_recursive_mutex(pool, NULL, &key->lock);
+	if (rc != PJ_SUCCESS)
+	    goto on_error;
+
+	pj_list_push_back(&ioqueue->free_list, key);
+    }
+
+    rc = pj_lock_create_simple_mutex(pool, "ioq%p", &lock);
+    if (rc != PJ_SUCCESS)
+	goto on_error;
+
+    rc = pj_ioqueue_set_lock(ioqueue, lock, PJ_TRUE);
+    if (rc != PJ_SUCCESS)
+	goto on_error;
+
+    rc = pj_lock_create_simple_mutex(pool, "ioqsq%p", &ioqueue->sq_lock);
+    if (rc != PJ_SUCCESS)
+	goto on_error;
+
+    rc = pj_lock_create_simple_mutex(pool, "ioqcq%p", &ioqueue->cq_lock);
+    if (rc != PJ_SUCCESS)
+	goto on_error;
+
+    rc = pj_thread_local_alloc(&ioqueue->tls_dispatch);
+    if (rc != PJ_SUCCESS) {
+	ioqueue->tls_dispatch = -1;
+	goto on_error;
+    }
+
+    /* Two requests per socket (one read and one write) is the typical
+     * load; the completion ring is twice as large by default.
+     */
+    for (entries=32; entries < max_fd * 2 && entries < MAX_SQ_ENTRIES;
+	 entries <<= 1)
+	;
+
+    rc = create_ring(ioqueue, entries);
+    if (rc != PJ_SUCCESS)
+	goto on_error;
+
+    PJ_LOG(4, ("pjlib", "io_uring I/O Queue created (%p), %d entries",
+	       ioqueue, ioqueue->sq_entries));
+
+    *p_ioqueue = ioqueue;
+    return PJ_SUCCESS;
+
+on_error:
+    pj_ioqueue_destroy(ioqueue);
+    return rc;
+}
+
+/*
+ * pj_ioqueue_destroy()
+ *
+ * Destroy ioqueue.
+ */
+PJ_DEF(pj_status_t) pj_ioqueue_destroy(pj_ioqueue_t *ioqueue)
+{
+    pj_ioqueue_key_t *key;
+
+    PJ_ASSERT_RETURN(ioqueue, PJ_EINVAL);
+
+    if (ioqueue->lock)
+	pj_lock_acquire(ioqueue->lock);
+
+    destroy_ring(ioqueue);
+
+    /* Unregistered keys whose requests were still in the kernel will
+     * never see their completion now; release their group lock.
+     */
+    key = ioqueue->active_list.next;
+    while (key != &ioqueue->active_list) {
+	if (key->closing && key->grp_lock)
+	    pj_grp_lock_dec_ref_dbg(key->grp_lock, "ioqueue", 0);
+	pj_lock_destroy(key->lock);
+	key = key->next;
+    }
+
+    key = ioqueue->closing_list.next;
+    while (key != &ioqueue->closing_list) {
+	pj_lock_destroy(key->lock);
+	key = key->next;
+    }
+
+    key = ioqueue->free_list.next;
+    while (key != &ioqueue->free_list) {
+	if (key->lock)
+	    pj_lock_destroy(key->lock);
+	key = key->next;
+    }
+
+    if (ioqueue->tls_dispatch != -1) {
+	pj_thread_local_free(ioqueue->tls_dispatch);
+	ioqueue->tls_dispatch = -1;
+    }
+    if (ioqueue->cq_lock) {
+	pj_lock_destroy(ioqueue->cq_lock);
+	ioqueue->cq_lock = NULL;
+    }
+    if (ioqueue->sq_lock) {
+	pj_lock_destroy(ioqueue->sq_lock);
+	ioqueue->sq_lock = NULL;
+    }
+
+    if (ioqueue->auto_delete_lock && ioqueue->lock) {
+	pj_lock_release(ioqueue->lock);
+	pj_lock_destroy(ioqueue->lock);
+    } else if (ioqueue->lock) {
+	pj_lock_release(ioqueue->lock);
+    }
+    ioqueue->lock = NULL;
+
+    return PJ_SUCCESS;
+}
+
+/*
+ * pj_ioqueue_set_lock()
+ */
+PJ_DEF(pj_status_t) pj_ioqueue_set_lock( pj_ioqueue_t *ioqueue,
+					 pj_lock_t *lock,
+					 pj_bool_t auto_delete )
+{
+    PJ_ASSERT_RETURN(ioqueue && lock, PJ_EINVAL);
+
+    if (ioqueue->auto_delete_lock && ioqueue->lock) {
+        pj_lock_destroy(ioqueue->lock);
+    }
+
+    ioqueue->lock = lock;
+    ioqueue->auto_delete_lock = auto_delete;
+
+    return PJ_SUCCESS;
+}
+
+PJ_DEF(pj_status_t) pj_ioqueue_set_default_concurrency( pj_ioqueue_t *ioqueue,
+							pj_bool_t allow)
+{
+    PJ_ASSERT_RETURN(ioqueue != NULL, PJ_EINVAL);
+    ioqueue->default_concurrency = allow;
+    return PJ_SUCCESS;
+}
+
+/*
+ * pj_ioqueue_register_sock()
+ *
+ * Register a socket to ioqueue.
+ */
+PJ_DEF(pj_status_t) pj_ioqueue_register_sock2(pj_pool_t *pool,
+					      pj_ioqueue_t *ioqueue,
+					      pj_sock_t sock,
+					      pj_grp_lock_t *grp_lock,
+					      void *user_data,
+					      const pj_ioqueue_callback *cb,
+                                              pj_ioqueue_key_t **p_key)
+{
+    pj_ioqueue_key_t *key = NULL;
+    pj_uint32_t value;
+    int optlen;
+    pj_status_t rc = PJ_SUCCESS;
+
+    PJ_ASSERT_RETURN(pool && ioqueue && sock != PJ_INVALID_SOCKET &&
+                     cb && p_key, PJ_EINVAL);
+
+    pj_lock_acquire(ioqueue->lock);
+
+    if (ioqueue->count >= ioqueue->max) {
+        rc = PJ_ETOOMANY;
+	TRACE_((THIS_FILE, "pj_ioqueue_register_sock error: too many files"));
+	goto on_return;
+    }
+
+    /* Set socket to nonblocking, so that the immediate operations in
+     * pj_ioqueue_recv() etc. never block. The kernel arms an internal
+     * poll for requests on nonblocking sockets (see also on_completion()
+     * for older kernels which do not).
+     */
+    value = 1;
+    if (ioctl(sock, FIONBIO, &value)) {
+        rc = pj_get_netos_error();
+	goto on_return;
+    }
+
+    /* Scan closing_keys first to let them come back to free_list */
+    scan_closing_keys(ioqueue);
+
+    if (pj_list_empty(&ioqueue->free_list)) {
+	rc = PJ_ETOOMANY;
+	goto on_return;
+    }
+
+    key = ioqueue->free_list.next;
+    pj_list_erase(key);
+
+    key->ioqueue = ioqueue;
+    key->fd = sock;
+    key->user_data = user_data;
+    key->connecting = 0;
+    key->closing = 0;
+    key->write_busy = PJ_FALSE;
+    key->ref_count = 1;
+    pj_list_init(&key->req_list);
+    pj_list_init(&key->write_list);
+    pj_memcpy(&key->cb, cb, sizeof(pj_ioqueue_callback));
+    key->allow_concurrent = ioqueue->default_concurrency;
+
+    optlen = sizeof(key->fd_type);
+    rc = pj_sock_getsockopt(sock, pj_SOL_SOCKET(), pj_SO_TYPE(),
+                            &key->fd_type, &optlen);
+    if (rc != PJ_SUCCESS)
+        key->fd_type = pj_SOCK_STREAM();
+    rc = PJ_SUCCESS;
+
+    key->grp_lock = grp_lock;
+    if (key->grp_lock) {
+	pj_grp_lock_add_ref_dbg(key->grp_lock, "ioqueue", 0);
+    }
+
+    /* Register */
+    pj_list_insert_before(&ioqueue->active_list, key);
+    ++ioqueue->count;
+
+on_return:
+    *p_key = key;
+    pj_lock_release(ioqueue->lock);
+
+    return rc;
+}
+
+PJ_DEF(pj_status_t) pj_ioqueue_register_sock( pj_pool_t *pool,
+					      pj_ioqueue_t *ioqueue,
+					      pj_sock_t sock,
+					      void *user_data,
+					      const pj_ioqueue_callback *cb,
+					      pj_ioqueue_key_t **p_key)
+{
+    return pj_ioqueue_register_sock2(pool, ioqueue, sock, NULL, user_data,
+                                     cb, p_key);
+}
+
+/*
+ * pj_ioqueue_unregister()
+ *
+ * Unregister handle from ioqueue.
+ */
+PJ_DEF(pj_status_t) pj_ioqueue_unregister( pj_ioqueue_key_t *key)
+{
+    pj_ioqueue_t *ioqueue;
+    struct uring_req *req;
+
+    PJ_ASSERT_RETURN(key != NULL, PJ_EINVAL);
+
+    ioqueue = key->ioqueue;
+
+    pj_ioqueue_lock_key(key);
+
+    /* Best effort to avoid double key-unregistration */
+    if (key->closing) {
+	pj_ioqueue_unlock_key(key);
+	return PJ_SUCCESS;
+    }
+
+    pj_lock_acquire(ioqueue->lock);
+    if (ioqueue->count > 0) {
+	--ioqueue->count;
+    } else {
+	pj_assert(!"Bad ioqueue count in key unregistration!");
+	PJ_LOG(1,(THIS_FILE, "Bad ioqueue count in key unregistration!"));
+    }
+    pj_lock_release(ioqueue->lock);
+
+    /* Mark key is closing, from now on no callback will be called. */
+    key->closing = 1;
+
+    /* Cancel all requests in the kernel. Their completion will still be
+     * reported, and will release the key's reference.
+     */
+    pj_lock_acquire(ioqueue->sq_lock);
+    for (req=key->req_list.next; req!=&key->req_list; req=req->next) {
+	req->op_key = NULL;
+	cancel_req(ioqueue, req);
+    }
+    sq_flush(ioqueue);
+
+    /* Requests which have not been submitted can be released now */
+    while (!pj_list_empty(&key->write_list)) {
+	req = key->write_list.next;
+	pj_list_erase(req);
+	req_free(ioqueue, req);
+	URING_ATOMIC_DEC(&key->ref_count);
+    }
+    pj_lock_release(ioqueue->sq_lock);
+
+    pj_sock_close(key->fd);
+
+    pj_ioqueue_unlock_key(key);
+
+    /* Release the initial reference. The group lock reference is only
+     * released when the cancelled requests have completed as well.
+     */
+    decrement_counter(key);
+
+    return PJ_SUCCESS;
+}
+
+/*
+ * pj_ioqueue_get_user_data()
+ */
+PJ_DEF(void*) pj_ioqueue_get_user_data( pj_ioqueue_key_t *key )
+{
+    PJ_ASSERT_RETURN(key != NULL, NULL);
+    return key->user_data;
+}
+
+/*
+ * pj_ioqueue_set_user_data()
+ */
+PJ_DEF(pj_status_t) pj_ioqueue_set_user_data( pj_ioqueue_key_t *key,
+                                              void *user_data,
+                                              void **old_data)
+{
+    PJ_ASSERT_RETURN(key, PJ_EINVAL);
+
+    if (old_data)
+        *old_data = key->user_data;
+    key->user_data = user_data;
+
+    return PJ_SUCCESS;
+}
+
+/* Scan closing keys to be put to free list again */
+static void scan_closing_keys(pj_ioqueue_t *ioqueue)
+{
+    pj_time_val now;
+    pj_ioqueue_key_t *h;
+
+    pj_gettickcount(&now);
+    h = ioqueue->closing_list.next;
+    while (h != &ioqueue->closing_list) {
+	pj_ioqueue_key_t *next = h->next;
+
+	pj_assert(h->closing != 0);
+
+	if (PJ_TIME_VAL_GTE(now, h->free_time)) {
+	    pj_list_erase(h);
+	    pj_list_push_back(&ioqueue->free_list, h);
+	}
+	h = next;
+    }
+}
+
+/* Get the status of a completed connect() */
+static pj_status_t get_connect_status(pj_ioqueue_key_t *key)
+{
+    int value = 0;
+    int vallen = sizeof(value);
+
+    if (pj_sock_getsockopt(key->fd, SOL_SOCKET, SO_ERROR,
+			   &value, &vallen) != 0)
+    {
+	/* Let the application find out the error when using the socket */
+	return PJ_SUCCESS;
+    }
+    return value ? PJ_STATUS_FROM_OS(value) : PJ_SUCCESS;
+}
+
+/*
+ * Process one completion. Returns PJ_TRUE if a callback was called.
+ */
+static pj_bool_t on_completion(pj_ioqueue_t *ioqueue, struct uring_req *req,
+			       int res)
+{
+    pj_ioqueue_key_t *key = req->key;
+    pj_ioqueue_op_key_t *op_key;
+    pj_ioqueue_operation_e op = req->op;
+    pj_ssize_t bytes = 0;
+    pj_status_t status = PJ_SUCCESS;
+    pj_sock_t new_sock = PJ_INVALID_SOCKET;
+    struct uring_req *next_write = NULL;
+    pj_bool_t has_lock, called = PJ_FALSE;
+
+    pj_ioqueue_lock_key(key);
+
+    op_key = req->op_key;
+
+    /* The request has been cancelled, either because the key is being
+     * unregistered or by pj_ioqueue_post_completion().
+     */
+    if (op_key == NULL || key->closing) {
+#if PJ_HAS_TCP
+	if (op == PJ_IOQUEUE_OP_ACCEPT && !req->polling && res >= 0)
+	    close(res);
+#endif
+	pj_list_erase(req);
+	if (op_key)
+	    ((struct op_rec*)op_key)->op = PJ_IOQUEUE_OP_NONE;
+	pj_lock_acquire(ioqueue->sq_lock);
+	req_free(ioqueue, req);
+	pj_lock_release(ioqueue->sq_lock);
+	pj_ioqueue_unlock_key(key);
+	decrement_counter(key);
+	return PJ_FALSE;
+    }
+
+    if (req->polling) {
+	/* The socket has become ready, retry the operation */
+	req->polling = PJ_FALSE;
+
+#if PJ_HAS_TCP
+	if (op == PJ_IOQUEUE_OP_CONNECT) {
+	    key->connecting = 0;
+	    status = get_connect_status(key);
+	    goto on_complete;
+	}
+#endif
+	pj_lock_acquire(ioqueue->sq_lock);
+	status = submit_req(ioqueue, req);
+	pj_lock_release(ioqueue->sq_lock);
+	if (status != PJ_SUCCESS) {
+	    res = -EAGAIN;
+	    goto on_complete_with_error;
+	}
+	pj_ioqueue_unlock_key(key);
+	return PJ_FALSE;
+    }
+
+    /* Older kernels complete requests on nonblocking sockets with EAGAIN
+     * instead of waiting; wait for readiness and then retry.
+     */
+    if (res == -EAGAIN || res == -EINTR) {
+	req->polling = PJ_TRUE;
+	pj_lock_acquire(ioqueue->sq_lock);
+	status = submit_req(ioqueue, req);
+	pj_lock_release(ioqueue->sq_lock);
+	if (status == PJ_SUCCESS) {
+	    pj_ioqueue_unlock_key(key);
+	    return PJ_FALSE;
+	}
+	req->polling = PJ_FALSE;
+    }
+
+    /* Partial write on stream socket, send the remaining data */
+    if ((op == PJ_IOQUEUE_OP_SEND || op == PJ_IOQUEUE_OP_WRITE) && res > 0 &&
+	key->fd_type != pj_SOCK_DGRAM() &&
+	req->done + res < (pj_ssize_t)req->size)
+    {
+	req->done += res;
+	pj_lock_acquire(ioqueue->sq_lock);
+	status = submit_req(ioqueue, req);
+	pj_lock_release(ioqueue->sq_lock);
+	if (status == PJ_SUCCESS) {
+	    pj_ioqueue_unlock_key(key);
+	    return PJ_FALSE;
+	}
+	res = -EAGAIN;
+    }
+
+on_complete_with_error:
+    if (res < 0) {
+	status = PJ_STATUS_FROM_OS(-res);
+	bytes = -status;
+    } else {
+	bytes = res;
+    }
+
+    switch (op) {
+    case PJ_IOQUEUE_OP_RECV_FROM:
+	if (res >= 0 && req->rmt_addr && req->rmt_addrlen) {
+	    int len = (int)req->msg.msg_namelen;
+	    if (len > *req->rmt_addrlen)
+		len = *req->rmt_addrlen;
+	    pj_memcpy(req->rmt_addr, &req->addr, len);
+	    *req->rmt_addrlen = len;
+	}
+	break;
+    case PJ_IOQUEUE_OP_SEND:
+    case PJ_IOQUEUE_OP_SEND_TO:
+    case PJ_IOQUEUE_OP_WRITE:
+	if (res >= 0)
+	    bytes = req->done + res;
+	if (key->write_busy && op != PJ_IOQUEUE_OP_SEND_TO) {
+	    key->write_busy = PJ_FALSE;
+	    if (!pj_list_empty(&key->write_list)) {
+		next_write = key->write_list.next;
+		pj_list_erase(next_write);
+	    }
+	}
+	break;
+#if PJ_HAS_TCP
+    case PJ_IOQUEUE_OP_ACCEPT:
+	if (res >= 0) {
+	    new_sock = res;
+	    status = PJ_SUCCESS;
+	    if (req->rmt_addr && req->rmt_addrlen) {
+		int len = (int)req->addrlen;
+		if (len > *req->rmt_addrlen)
+		    len = *req->rmt_addrlen;
+		pj_memcpy(req->rmt_addr, &req->addr, len);
+		*req->rmt_addrlen = len;
+	    }
+	    if (req->local_addr && req->rmt_addrlen) {
+		status = pj_sock_getsockname(new_sock, req->local_addr,
+					     req->rmt_addrlen);
+	    }
+	}
+	if (req->accept_fd)
+	    *req->accept_fd = new_sock;
+	break;
+#endif
+    default:
+	break;
+    }
+
+#if PJ_HAS_TCP
+on_complete:
+#endif
+    /* The operation is complete. Release the request before calling the
+     * callback, since the callback may reuse the operation key.
+     */
+    pj_list_erase(req);
+    ((struct op_rec*)op_key)->op = PJ_IOQUEUE_OP_NONE;
+    ((struct op_rec*)op_key)->req = NULL;
+    pj_lock_acquire(ioqueue->sq_lock);
+    req_free(ioqueue, req);
+    pj_lock_release(ioqueue->sq_lock);
+
+    /* Start the next queued stream send */
+    if (next_write) {
+	key->write_busy = PJ_TRUE;
+	pj_list_push_back(&key->req_list, next_write);
+	pj_lock_acquire(ioqueue->sq_lock);
+	if (submit_req(ioqueue, next_write) != PJ_SUCCESS) {
+	    /* Put it back; it will be retried with the next send
+	     * completion or reported when the key is unregistered.
+	     */
+	    pj_list_erase(next_write);
+	    pj_list_push_front(&key->write_list, next_write);
+	    key->write_busy = PJ_FALSE;
+	}
+	pj_lock_release(ioqueue->sq_lock);
+    }
+
+    /* Unlock; from this point we don't need to hold key's mutex
+     * (unless concurrency is disabled, which in this case we should
+     * hold the mutex while calling the callback) */
+    if (key->allow_concurrent) {
+	has_lock = PJ_FALSE;
+	pj_ioqueue_unlock_key(key);
+    } else {
+	has_lock = PJ_TRUE;
+    }
+
+    if (!key->closing) {
+	switch (op) {
+	case PJ_IOQUEUE_OP_RECV:
+	case PJ_IOQUEUE_OP_RECV_FROM:
+	case PJ_IOQUEUE_OP_READ:
+	    if (key->cb.on_read_complete) {
+		(*key->cb.on_read_complete)(key, op_key, bytes);
+		called = PJ_TRUE;
+	    }
+	    break;
+	case PJ_IOQUEUE_OP_SEND:
+	case PJ_IOQUEUE_OP_SEND_TO:
+	case PJ_IOQUEUE_OP_WRITE:
+	    if (key->cb.on_write_complete) {
+		(*key->cb.on_write_complete)(key, op_key, bytes);
+		called = PJ_TRUE;
+	    }
+	    break;
+#if PJ_HAS_TCP
+	case PJ_IOQUEUE_OP_ACCEPT:
+	    if (key->cb.on_accept_complete) {
+		(*key->cb.on_accept_complete)(key, op_key, new_sock, status);
+		called = PJ_TRUE;
+	    }
+	    break;
+	case PJ_IOQUEUE_OP_CONNECT:
+	    if (key->cb.on_connect_complete) {
+		(*key->cb.on_connect_complete)(key, status);
+		called = PJ_TRUE;
+	    }
+	    break;
+#endif
+	default:
+	    break;
+	}
+    }
+
+    if (has_lock)
+	pj_ioqueue_unlock_key(key);
+
+    decrement_counter(key);
+
+    return called;
+}
+
+/*
+ * pj_ioqueue_poll()
+ *
+ */
+PJ_DEF(int) pj_ioqueue_poll( pj_ioqueue_t *ioqueue, const pj_time_val *timeout)
+{
+    enum { MAX_EVENTS = PJ_IOQUEUE_MAX_CAND_EVENTS };
+    struct io_uring_cqe events[MAX_EVENTS];
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned head, tail;
+    int i, rc, count, processed_cnt;
+
+    PJ_CHECK_STACK();
+
+    pj_bzero(&arg, sizeof(arg));
+    if (timeout) {
+	ts.tv_sec = timeout->sec;
+	ts.tv_nsec = (long long)timeout->msec * 1000000;
+	arg.ts = (__u64)(pj_size_t)&ts;
+    }
+
+    /* Submit the pending requests and wait for completion in one call */
+    pj_lock_acquire(ioqueue->sq_lock);
+    if (ioqueue->cancel_queue)
+	flush_cancel_queue(ioqueue);
+    count = sq_pending(ioqueue);
+    pj_lock_release(ioqueue->sq_lock);
+
+    if (ring_load_acquire(ioqueue->cq_tail) == *ioqueue->cq_head) {
+	TRACE_((THIS_FILE, "start io_uring_enter, submit=%d", count));
+	rc = sys_io_uring_enter(ioqueue->ring_fd, count, 1,
+				IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+				&arg, sizeof(arg));
+	if (rc < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+	    TRACE_((THIS_FILE, "io_uring_enter error"));
+	    return -pj_get_os_error();
+	}
+    }
+
+    /* Reap completions */
+    pj_lock_acquire(ioqueue->cq_lock);
+    head = *ioqueue->cq_head;
+    tail = ring_load_acquire(ioqueue->cq_tail);
+    for (count=0; head != tail && count < MAX_EVENTS; ++head) {
+	struct io_uring_cqe *cqe = &ioqueue->cqes[head & ioqueue->cq_mask];
+
+	/* Ignore completion of cancellation requests */
+	if (cqe->user_data == 0)
+	    continue;
+
+	events[count++] = *cqe;
+    }
+    ring_store_release(ioqueue->cq_head, head);
+    pj_lock_release(ioqueue->cq_lock);
+
+    if (count == 0) {
+	/* Check the closing keys only when there's no activity and when
+	 * there are pending closing keys.
+	 */
+	if (!pj_list_empty(&ioqueue->closing_list)) {
+	    pj_lock_acquire(ioqueue->lock);
+	    scan_closing_keys(ioqueue);
+	    pj_lock_release(ioqueue->lock);
+	}
+	return 0;
+    }
+
+    /* Requests posted from the callbacks are submitted in batch below */
+    pj_thread_local_set(ioqueue->tls_dispatch, ioqueue);
+
+    processed_cnt = 0;
+    for (i=0; i<count; ++i) {
+	struct uring_req *req = (struct uring_req*)(pj_size_t)
+				events[i].user_data;
+	if (on_completion(ioqueue, req, events[i].res))
+	    ++processed_cnt;
+    }
+
+    pj_thread_local_set(ioqueue->tls_dispatch, NULL);
+
+    pj_lock_acquire(ioqueue->sq_lock);
+    sq_flush(ioqueue);
+    if (ioqueue->cancel_queue)
+	flush_cancel_queue(ioqueue);
+    pj_lock_release(ioqueue->sq_lock);
+
+    TRACE_((THIS_FILE, "     poll: count=%d processed=%d",
+		       count, processed_cnt));
+
+    return processed_cnt;
+}
+
+/*
+ * Start an asynchronous read operation.
+ */
+static pj_status_t start_read(pj_ioqueue_key_t *key,
+			      pj_ioqueue_op_key_t *op_key,
+			      pj_ioqueue_operation_e op,
+			      void *buffer, pj_ssize_t *length,
+			      unsigned flags,
+			      pj_sockaddr_t *addr, int *addrlen)
+{
+    struct op_rec *rec = (struct op_rec*)op_key;
+    struct uring_req *req;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(key && op_key && buffer && length, PJ_EINVAL);
+    PJ_CHECK_STACK();
+
+    if (key->closing)
+	return PJ_ECANCELLED;
+
+    PJ_ASSERT_RETURN(rec->op == PJ_IOQUEUE_OP_NONE, PJ_EPENDING);
+
+    /* Try to see if there's data immediately available. */
+    if ((flags & PJ_IOQUEUE_ALWAYS_ASYNC) == 0) {
+	pj_ssize_t size = *length;
+
+	if (op == PJ_IOQUEUE_OP_RECV_FROM) {
+	    status = pj_sock_recvfrom(key->fd, buffer, &size, flags,
+				      addr, addrlen);
+	} else {
+	    status = pj_sock_recv(key->fd, buffer, &size, flags);
+	}
+	if (status == PJ_SUCCESS) {
+	    *length = size;
+	    return PJ_SUCCESS;
+	} else if (status != PJ_STATUS_FROM_OS(PJ_BLOCKING_ERROR_VAL)) {
+	    return status;
+	}
+    }
+
+    flags &= ~(PJ_IOQUEUE_ALWAYS_ASYNC);
+
+    pj_ioqueue_lock_key(key);
+    if (key->closing) {
+	pj_ioqueue_unlock_key(key);
+	return PJ_ECANCELLED;
+    }
+
+    pj_lock_acquire(key->ioqueue->sq_lock);
+    req = req_alloc(key->ioqueue);
+    pj_lock_release(key->ioqueue->sq_lock);
+
+    req->op = op;
+    req->buf = (char*)buffer;
+    req->size = *length;
+    req->flags = flags;
+    req->rmt_addr = addr;
+    req->rmt_addrlen = addrlen;
+
+    status = queue_req(key, req, op_key);
+    if (status != PJ_SUCCESS) {
+	pj_lock_acquire(key->ioqueue->sq_lock);
+	req_free(key->ioqueue, req);
+	pj_lock_release(key->ioqueue->sq_lock);
+    }
+    pj_ioqueue_unlock_key(key);
+
+    return status==PJ_SUCCESS ? PJ_EPENDING : status;
+}
+
+/*
+ * pj_ioqueue_recv()
+ */
+PJ_DEF(pj_status_t) pj_ioqueue_recv(  pj_ioqueue_key_t *key,
+                                      pj_ioqueue_op_key_t *op_key,
+				      void *buffer,
+				      pj_ssize_t *length,
+				      unsigned flags )
+{
+    return start_read(key, op_key, PJ_IOQUEUE_OP_RECV, buffer, length,
+		      flags, NULL, NULL);
+}
+
+/*
+ * pj_ioqueue_recvfrom()
+ */
+PJ_DEF(pj_status_t) pj_ioqueue_recvfrom( pj_ioqueue_key_t *key,
+                                         pj_ioqueue_op_key_t *op_key,
+				         void *buffer,
+				         pj_ssize_t *length,
+                                         unsigned flags,
+				         pj_sockaddr_t *addr,
+				         int *addrlen)
+{
+    return start_read(key, op_key, PJ_IOQUEUE_OP_RECV_FROM, buffer, length,
+		      flags, addr, addrlen);
+}
+
+/*
+ * Start an asynchronous write operation.
+ */
+static pj_status_t start_write(pj_ioqueue_key_t *key,
+			       pj_ioqueue_op_key_t *op_key,
+			       pj_ioqueue_operation_e op,
+			       const void *data, pj_ssize_t *length,
+			       unsigned flags,
+			       const pj_sockaddr_t *addr, int addrlen)
+{
+    struct op_rec *rec = (struct op_rec*)op_key;
+    struct uring_req *req;
+    pj_status_t status;
+    pj_ssize_t sent;
+
+    PJ_ASSERT_RETURN(key && op_key && data && length, PJ_EINVAL);
+    PJ_CHECK_STACK();
+
+    if (key->closing)
+	return PJ_ECANCELLED;
+
+    /* We can not use PJ_IOQUEUE_ALWAYS_ASYNC for socket write. */
+    flags &= ~(PJ_IOQUEUE_ALWAYS_ASYNC);
+
+    /* Fast track: try to send data immediately, only if there's no
+     * pending write on stream socket (see the note on the list
+     * speculation in ioqueue_common_abs.c).
+     */
+    if (key->fd_type == pj_SOCK_DGRAM() ||
+	(!key->write_busy && pj_list_empty(&key->write_list)))
+    {
+	sent = *length;
+	if (op == PJ_IOQUEUE_OP_SEND_TO) {
+	    status = pj_sock_sendto(key->fd, data, &sent, flags, addr,
+				    addrlen);
+	} else {
+	    status = pj_sock_send(key->fd, data, &sent, flags);
+	}
+	if (status == PJ_SUCCESS) {
+	    *length = sent;
+	    return PJ_SUCCESS;
+	} else if (status != PJ_STATUS_FROM_OS(PJ_BLOCKING_ERROR_VAL)) {
+	    return status;
+	}
+    }
+
+    PJ_ASSERT_RETURN(addrlen <= (int)sizeof(pj_sockaddr), PJ_EBUG);
+
+    /* The operation key must not have pending operation */
+    if (rec->op != PJ_IOQUEUE_OP_NONE)
+	return PJ_EBUSY;
+
+    pj_ioqueue_lock_key(key);
+    if (key->closing) {
+	pj_ioqueue_unlock_key(key);
+	return PJ_ECANCELLED;
+    }
+
+    pj_lock_acquire(key->ioqueue->sq_lock);
+    req = req_alloc(key->ioqueue);
+    pj_lock_release(key->ioqueue->sq_lock);
+
+    req->op = op;
+    req->buf = (char*)data;
+    req->size = *length;
+    req->flags = flags;
+    if (addr) {
+	pj_memcpy(&req->addr, addr, addrlen);
+	req->addrlen = addrlen;
+    }
+
+    status = queue_req(key, req, op_key);
+    if (status != PJ_SUCCESS) {
+	pj_lock_acquire(key->ioqueue->sq_lock);
+	req_free(key->ioqueue, req);
+	pj_lock_release(key->ioqueue->sq_lock);
+    }
+    pj_ioqueue_unlock_key(key);
+
+    return status==PJ_SUCCESS ? PJ_EPENDING : status;
+}
+
+/*
+ * pj_ioqueue_send()
+ */
+PJ_DEF(pj_status_t) pj_ioqueue_send( pj_ioqueue_key_t *key,
+                                     pj_ioqueue_op_key_t *op_key,
+			             const void *data,
+			             pj_ssize_t *length,
+                                     unsigned flags)
+{
+    return start_write(key, op_key, PJ_IOQUEUE_OP_SEND, data, length,
+		       flags, NULL, 0);
+}
+
+/*
+ * pj_ioqueue_sendto()
+ */
+PJ_DEF(pj_status_t) pj_ioqueue_sendto( pj_ioqueue_key_t *key,
+                                       pj_ioqueue_op_key_t *op_key,
+			               const void *data,
+			               pj_ssize_t *length,
+                                       pj_uint32_t flags,
+			               const pj_sockaddr_t *addr,
+			               int addrlen)
+{
+    return start_write(key, op_key, PJ_IOQUEUE_OP_SEND_TO, data, length,
+		       flags, addr, addrlen);
+}
+
+#if PJ_HAS_TCP
+/*
+ * Initiate overlapped accept() operation.
+ */
+PJ_DEF(pj_status_t) pj_ioqueue_accept( pj_ioqueue_key_t *key,
+                                       pj_ioqueue_op_key_t *op_key,
+			               pj_sock_t *new_sock,
+			               pj_sockaddr_t *local,
+			               pj_sockaddr_t *remote,
+			               int *addrlen)
+{
+    struct op_rec *rec = (struct op_rec*)op_key;
+    struct uring_req *req;
+    pj_status_t status;
+
+    /* check parameters. All must be specified! */
+    PJ_ASSERT_RETURN(key && op_key && new_sock, PJ_EINVAL);
+
+    if (key->closing)
+	return PJ_ECANCELLED;
+
+    PJ_ASSERT_RETURN(rec->op == PJ_IOQUEUE_OP_NONE, PJ_EPENDING);
+
+    /* Fast track: see if there's new connection available immediately. */
+    status = pj_sock_accept(key->fd, new_sock, remote, addrlen);
+    if (status == PJ_SUCCESS) {
+	if (local && addrlen) {
+	    status = pj_sock_getsockname(*new_sock, local, addrlen);
+	    if (status != PJ_SUCCESS) {
+		pj_sock_close(*new_sock);
+		*new_sock = PJ_INVALID_SOCKET;
+		return status;
+	    }
+	}
+	return PJ_SUCCESS;
+    } else if (status != PJ_STATUS_FROM_OS(PJ_BLOCKING_ERROR_VAL)) {
+	return status;
+    }
+
+    pj_ioqueue_lock_key(key);
+    if (key->closing) {
+	pj_ioqueue_unlock_key(key);
+	return PJ_ECANCELLED;
+    }
+
+    pj_lock_acquire(key->ioqueue->sq_lock);
+    req = req_alloc(key->ioqueue);
+    pj_lock_release(key->ioqueue->sq_lock);
+
+    req->op = PJ_IOQUEUE_OP_ACCEPT;
+    req->accept_fd = new_sock;
+    req->local_addr = local;
+    req->rmt_addr = remote;
+    req->rmt_addrlen = addrlen;
+
+    status = queue_req(key, req, op_key);
+    if (status != PJ_SUCCESS) {
+	pj_lock_acquire(key->ioqueue->sq_lock);
+	req_free(key->ioqueue, req);
+	pj_lock_release(key->ioqueue->sq_lock);
+    }
+    pj_ioqueue_unlock_key(key);
+
+    return status==PJ_SUCCESS ? PJ_EPENDING : status;
+}
+
+/*
+ * Initiate non-blocking connect() operation. Completion is detected by
+ * polling the socket for writability through the ring.
+ */
+PJ_DEF(pj_status_t) pj_ioqueue_connect( pj_ioqueue_key_t *key,
+					const pj_sockaddr_t *addr,
+					int addrlen )
+{
+    pj_ioqueue_op_key_t *op_key;
+    struct uring_req *req;
+    pj_status_t status;
+
+    /* check parameters. All must be specified! */
+    PJ_ASSERT_RETURN(key && addr && addrlen, PJ_EINVAL);
+
+    if (key->closing)
+	return PJ_ECANCELLED;
+
+    /* Check if socket has not been marked for connecting */
+    if (key->connecting != 0)
+        return PJ_EPENDING;
+
+    status = pj_sock_connect(key->fd, addr, addrlen);
+    if (status == PJ_SUCCESS) {
+	return PJ_SUCCESS;
+    } else if (status != PJ_STATUS_FROM_OS(PJ_BLOCKING_CONNECT_ERROR_VAL)) {
+	return status;
+    }
+
+    pj_ioqueue_lock_key(key);
+    if (key->closing) {
+	pj_ioqueue_unlock_key(key);
+	return PJ_ECANCELLED;
+    }
+
+    /* Connect has no application operation key; the request carries
+     * its own, placed in the request's address storage.
+     */
+    pj_lock_acquire(key->ioqueue->sq_lock);
+    req = req_alloc(key->ioqueue);
+    pj_lock_release(key->ioqueue->sq_lock);
+
+    req->op = PJ_IOQUEUE_OP_CONNECT;
+    req->polling = PJ_TRUE;
+    op_key = (pj_ioqueue_op_key_t*)&req->addr;
+    key->connecting = 1;
+
+    status = queue_req(key, req, op_key);
+    if (status != PJ_SUCCESS) {
+	key->connecting = 0;
+	pj_lock_acquire(key->ioqueue->sq_lock);
+	req_free(key->ioqueue, req);
+	pj_lock_release(key->ioqueue->sq_lock);
+    }
+    pj_ioqueue_unlock_key(key);
+
+    return status==PJ_SUCCESS ? PJ_EPENDING : status;
+}
+#endif	/* PJ_HAS_TCP */
+
+
+PJ_DEF(void) pj_ioqueue_op_key_init( pj_ioqueue_op_key_t *op_key,
+				     pj_size_t size )
+{
+    pj_bzero(op_key, size);
+}
+
+
+/*
+ * pj_ioqueue_is_pending()
+ */
+PJ_DEF(pj_bool_t) pj_ioqueue_is_pending( pj_ioqueue_key_t *key,
+                                         pj_ioqueue_op_key_t *op_key )
+{
+    PJ_UNUSED_ARG(key);
+    return ((struct op_rec*)op_key)->op != PJ_IOQUEUE_OP_NONE;
+}
+
+
+/*
+ * pj_ioqueue_post_completion()
+ */
+PJ_DEF(pj_status_t) pj_ioqueue_post_completion( pj_ioqueue_key_t *key,
+                                                pj_ioqueue_op_key_t *op_key,
+                                                pj_ssize_t bytes_status )
+{
+    struct op_rec *rec = (struct op_rec*)op_key;
+    struct uring_req *req;
+    pj_ioqueue_operation_e op;
+
+    PJ_ASSERT_RETURN(key && op_key, PJ_EINVAL);
+
+    pj_ioqueue_lock_key(key);
+
+    req = rec->req;
+    if (rec->op == PJ_IOQUEUE_OP_NONE || req == NULL ||
+	req->op_key != op_key)
+    {
+	pj_ioqueue_unlock_key(key);
+	return PJ_EINVALIDOP;
+    }
+
+    op = req->op;
+    rec->op = PJ_IOQUEUE_OP_NONE;
+    rec->req = NULL;
+
+    pj_lock_acquire(key->ioqueue->sq_lock);
+    if (req->submitted) {
+	/* Orphan the request; its completion will release it */
+	req->op_key = NULL;
+	cancel_req(key->ioqueue, req);
+    } else {
+	/* Queued stream send which has not been submitted */
+	pj_list_erase(req);
+	req_free(key->ioqueue, req);
+	URING_ATOMIC_DEC(&key->ref_count);
+    }
+    pj_lock_release(key->ioqueue->sq_lock);
+
+    pj_ioqueue_unlock_key(key);
+
+    switch (op) {
+    case PJ_IOQUEUE_OP_RECV:
+    case PJ_IOQUEUE_OP_RECV_FROM:
+    case PJ_IOQUEUE_OP_READ:
+	if (key->cb.on_read_complete)
+	    (*key->cb.on_read_complete)(key, op_key, bytes_status);
+	break;
+    case PJ_IOQUEUE_OP_SEND:
+    case PJ_IOQUEUE_OP_SEND_TO:
+    case PJ_IOQUEUE_OP_WRITE:
+	if (key->cb.on_write_complete)
+	    (*key->cb.on_write_complete)(key, op_key, bytes_status);
+	break;
+#if PJ_HAS_TCP
+    case PJ_IOQUEUE_OP_ACCEPT:
+	if (key->cb.on_accept_complete) {
+	    (*key->cb.on_accept_complete)(key, op_key, PJ_INVALID_SOCKET,
+					  (pj_status_t)bytes_status);
+	}
+	break;
+#endif
+    default:
+	break;
+    }
+
+    return PJ_SUCCESS;
+}
+
+PJ_DEF(pj_status_t) pj_ioqueue_set_concurrency(pj_ioqueue_key_t *key,
+					       pj_bool_t allow)
+{
+    PJ_ASSERT_RETURN(key, PJ_EINVAL);
+    key->allow_concurrent = allow;
+    return PJ_SUCCESS;
+}
+
+PJ_DEF(pj_status_t) pj_ioqueue_lock_key(pj_ioqueue_key_t *key)
+{
+    if (key->grp_lock)
+	return pj_grp_lock_acquire(key->grp_lock);
+    else
+	return pj_lock_acquire(key->lock);
+}
+
+PJ_DEF(pj_status_t) pj_ioqueue_trylock_key(pj_ioqueue_key_t *key)
+{
+    if (key->grp_lock)
+	return pj_grp_lock_tryacquire(key->grp_lock);
+    else
+	return pj_lock_tryacquire(key->lock);
+}
+
+PJ_DEF(pj_status_t) pj_ioqueue_unlock_key(pj_ioqueue_key_t *key)
+{
+    if (key->grp_lock)
+	return pj_grp_lock_release(key->grp_lock);
+    else
+	return pj_lock_release(key->lock);
+}
@@ -84,6 +84,47 @@ static char log_buffer[PJ_LOG_MAX_SIZE];
 
 #define LOG_MAX_INDENT		80
 
+/* Decoding the time takes a process wide lock in the C library, so the
+ * decoded time of the current second is cached. Readers check a sequence
+ * number, which is odd while the cache is being updated.
+ */
+#if defined(__GNUC__) && PJ_HAS_THREADS
+static struct time_cache
+{
+    unsigned		seq;
+    long		sec;
+    pj_parsed_time	ptime;
+} time_cache;
+
+static void log_decode_time(const pj_time_val *now, pj_parsed_time *ptime)
+{
+    unsigned seq = __atomic_load_n(&time_cache.seq, __ATOMIC_ACQUIRE);
+
+    if ((seq & 1) == 0 && time_cache.sec == now->sec) {
+	pj_memcpy(ptime, &time_cache.ptime, sizeof(*ptime));
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&time_cache.seq, __ATOMIC_RELAXED) == seq) {
+	    ptime->msec = now->msec;
+	    return;
+	}
+    }
+
+    pj_time_decode(now, ptime);
+
+    /* Update the cache unless another thread is doing so */
+    if ((seq & 1) == 0 &&
+	__atomic_compare_exchange_n(&time_cache.seq, &seq, seq + 1, PJ_FALSE,
+				    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+	time_cache.sec = now->sec;
+	pj_memcpy(&time_cache.ptime, ptime, sizeof(*ptime));
+	__atomic_store_n(&time_cache.seq, seq + 2, __ATOMIC_RELEASE);
+    }
+}
+#else
+#   define log_decode_time(now, ptime)	pj_time_decode(now, ptime)
+#endif
+
 #if PJ_HAS_THREADS
 static void logging_shutdown(void)
 {
@@ -340,7 +381,7 @@ PJ_DEF(void) pj_log( const char *sender, int level,
 
     /* Get current date/time. */
     pj_gettimeofday(&now);
-    pj_time_decode(&now, &ptime);
+    log_decode_time(&now, &ptime);
 
     pre = log_buffer;
     if (log_decor & PJ_LOG_HAS_LEVEL_TEXT) {
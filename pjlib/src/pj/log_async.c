@@ -0,0 +1,540 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <pj/log.h>
+#include <pj/assert.h>
+#include <pj/errno.h>
+#include <pj/limits.h>
+#include <pj/os.h>
+#include <pj/pool.h>
+#include <pj/string.h>
+
+#if PJ_LOG_MAX_LEVEL >= 1
+
+/*
+ * Asynchronous log writer.
+ *
+ * Each thread owns a single producer, single consumer ring buffer. The
+ * producer only writes the head index and the writer thread only writes
+ * the tail index, so with the GCC atomic builtins no lock is needed.
+ * On other compilers each ring has a mutex which is held just to copy
+ * the message.
+ *
+ * The writer thread sleeps on a semaphore when all rings are empty. It
+ * sets the idle flag before checking the rings a last time, and the
+ * producers check the flag after adding a message, so one of them sees
+ * the other's write and the message is never left behind.
+ */
+#if defined(__GNUC__) && PJ_HAS_THREADS
+#   define LOG_ASYNC_LOCK_FREE	    1
+#   define LOAD_ACQ(var)	    __atomic_load_n(&(var), __ATOMIC_ACQUIRE)
+#   define STORE_REL(var, val)	    __atomic_store_n(&(var), (val), \
+						     __ATOMIC_RELEASE)
+#   define STAT_INC(var)	    __atomic_add_fetch(&(var), 1, \
+						       __ATOMIC_RELAXED)
+#   define FULL_FENCE()		    __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#else
+#   define LOG_ASYNC_LOCK_FREE	    0
+#   define LOAD_ACQ(var)	    (var)
+#   define STORE_REL(var, val)	    ((var) = (val))
+#   define STAT_INC(var)	    (++(var))
+#   define FULL_FENCE()
+#endif
+
+/* Records are aligned to the size of the record header. */
+#define REC_ALIGN	    8
+#define REC_SIZE(len)	    ((sizeof(rec_hdr) + (len) + REC_ALIGN - 1) & \
+			     ~(REC_ALIGN - 1))
+
+/* Record length which marks the unused space at the end of the ring. */
+#define REC_PAD		    -1
+
+/* Size of the buffer where messages are collected before being passed to
+ * the log writer.
+ */
+#define BATCH_SIZE	    (PJ_LOG_MAX_SIZE * 4)
+
+typedef struct rec_hdr
+{
+    int		    level;
+    int		    len;
+} rec_hdr;
+
+/* State of a ring */
+enum ring_state
+{
+    RING_FREE,		/* Not used, may be taken by a new thread	*/
+    RING_OWNED,		/* Used by a running thread			*/
+    RING_EXITED		/* Its thread has exited, to be drained		*/
+};
+
+typedef struct log_ring
+{
+    char	   *buf;
+    int		    state;
+    pj_uint32_t	    mask;
+    pj_uint32_t	    head;
+    pj_uint32_t	    tail;
+    pj_uint32_t	    written;
+    pj_uint32_t	    dropped;
+
+    /* Serializes the producers of the shared ring, and both sides of the
+     * ring when atomic builtins are not available.
+     */
+    pj_mutex_t	   *mutex;
+} log_ring;
+
+static struct log_async
+{
+    pj_pool_t	   *pool;
+    pj_log_func	   *writer;
+    pj_log_async_param param;
+    long	    ring_tls;
+    pj_mutex_t	   *mutex;
+    log_ring	   *ring;
+    unsigned	    ring_cnt;
+    log_ring	    shared;
+    pj_thread_t	   *thread;
+    pj_atomic_t	   *quit;
+    pj_sem_t	   *sem;
+    int		    idle;
+    pj_uint32_t	    batches;
+    char	    batch[BATCH_SIZE+1];
+} la = { NULL, NULL, {0}, -1 };
+
+PJ_DEF(void) pj_log_async_param_default(pj_log_async_param *prm)
+{
+    pj_bzero(prm, sizeof(*prm));
+    prm->ring_size = PJ_LOG_ASYNC_RING_SIZE;
+    prm->max_threads = PJ_LOG_ASYNC_MAX_THREADS;
+    prm->batch = PJ_FALSE;
+}
+
+static pj_status_t ring_init(log_ring *ring, pj_bool_t need_mutex)
+{
+    ring->buf = (char*) pj_pool_alloc(la.pool, la.param.ring_size);
+    ring->state = RING_OWNED;
+    ring->mask = la.param.ring_size - 1;
+    ring->head = ring->tail = 0;
+    ring->written = ring->dropped = 0;
+    ring->mutex = NULL;
+
+    if (need_mutex || !LOG_ASYNC_LOCK_FREE) {
+	return pj_mutex_create_recursive(la.pool, "logring%p", &ring->mutex);
+    }
+    return PJ_SUCCESS;
+}
+
+/* Copy a message to the ring. Called by the thread which owns the ring,
+ * or with the ring mutex held.
+ */
+static void ring_put(log_ring *ring, int level, const char *data, int len)
+{
+    pj_uint32_t size = ring->mask + 1;
+    pj_uint32_t head, tail, off, contig, need, total;
+    rec_hdr hdr;
+
+    /* A message never takes more than half of the ring or a batch */
+    if (REC_SIZE(len) > size / 2)
+	len = (int)(size / 2 - sizeof(rec_hdr));
+    if (len > BATCH_SIZE)
+	len = BATCH_SIZE;
+
+    head = ring->head;
+    tail = LOAD_ACQ(ring->tail);
+    off = head & ring->mask;
+    contig = size - off;
+    need = (pj_uint32_t)REC_SIZE(len);
+    total = (contig < need) ? contig + need : need;
+
+    if (size - (head - tail) < total) {
+	STAT_INC(ring->dropped);
+	return;
+    }
+
+    /* Skip the space at the end of the ring if the record doesn't fit */
+    if (contig < need) {
+	hdr.level = 0;
+	hdr.len = REC_PAD;
+	pj_memcpy(ring->buf + off, &hdr, sizeof(hdr));
+	head += contig;
+	off = 0;
+    }
+
+    hdr.level = level;
+    hdr.len = len;
+    pj_memcpy(ring->buf + off, &hdr, sizeof(hdr));
+    pj_memcpy(ring->buf + off + sizeof(hdr), data, len);
+
+    STORE_REL(ring->head, head + need);
+    STAT_INC(ring->written);
+}
+
+/* Pass the collected batch to the log writer. */
+static void flush_batch(int level, int len)
+{
+    if (len == 0)
+	return;
+
+    la.batch[len] = '\0';
+    ++la.batches;
+    if (la.writer)
+	(*la.writer)(level, la.batch, len);
+}
+
+/* Drain a ring. Called by the writer thread only. */
+static unsigned ring_drain(log_ring *ring)
+{
+    pj_uint32_t head, tail;
+    int level = 0, len = 0;
+    unsigned cnt = 0;
+
+    if (ring->mutex && !LOG_ASYNC_LOCK_FREE)
+	pj_mutex_lock(ring->mutex);
+
+    tail = ring->tail;
+    head = LOAD_ACQ(ring->head);
+
+    while (tail != head) {
+	pj_uint32_t off = tail & ring->mask;
+	rec_hdr hdr;
+
+	pj_memcpy(&hdr, ring->buf + off, sizeof(hdr));
+	if (hdr.len == REC_PAD) {
+	    tail += ring->mask + 1 - off;
+	    continue;
+	}
+
+	/* Unless batching is enabled, each message is written with its own
+	 * call. Otherwise messages with the same level are joined.
+	 */
+	if (len && (!la.param.batch || hdr.level != level ||
+		    len + hdr.len > BATCH_SIZE))
+	{
+	    flush_batch(level, len);
+	    len = 0;
+	}
+	level = hdr.level;
+	pj_memcpy(la.batch + len, ring->buf + off + sizeof(hdr), hdr.len);
+	len += hdr.len;
+	tail += (pj_uint32_t)REC_SIZE(hdr.len);
+	++cnt;
+    }
+
+    STORE_REL(ring->tail, tail);
+
+    if (ring->mutex && !LOG_ASYNC_LOCK_FREE)
+	pj_mutex_unlock(ring->mutex);
+
+    flush_batch(level, len);
+    return cnt;
+}
+
+static unsigned drain_all(void)
+{
+    unsigned i, cnt, ring_cnt;
+
+    cnt = ring_drain(&la.shared);
+
+    ring_cnt = LOAD_ACQ(la.ring_cnt);
+    for (i=0; i<ring_cnt; ++i) {
+	log_ring *ring = &la.ring[i];
+
+	cnt += ring_drain(ring);
+
+	/* The ring of an exited thread can be reused once it's empty */
+	if (LOAD_ACQ(ring->state) == RING_EXITED) {
+	    pj_mutex_lock(la.mutex);
+	    if (ring->tail == LOAD_ACQ(ring->head))
+		ring->state = RING_FREE;
+	    pj_mutex_unlock(la.mutex);
+	}
+    }
+
+    return cnt;
+}
+
+/* Set or clear the idle flag of the writer thread, returning the old
+ * value.
+ */
+static int swap_idle(int idle)
+{
+#if LOG_ASYNC_LOCK_FREE
+    int old = __atomic_exchange_n(&la.idle, idle, __ATOMIC_SEQ_CST);
+    FULL_FENCE();
+    return old;
+#else
+    int old;
+
+    pj_mutex_lock(la.mutex);
+    old = la.idle;
+    la.idle = idle;
+    pj_mutex_unlock(la.mutex);
+    return old;
+#endif
+}
+
+/* Wake up the writer thread if it's waiting for messages. */
+static void wake_writer(void)
+{
+    FULL_FENCE();
+#if LOG_ASYNC_LOCK_FREE
+    if (!__atomic_load_n(&la.idle, __ATOMIC_RELAXED))
+	return;
+#endif
+    if (swap_idle(0))
+	pj_sem_post(la.sem);
+}
+
+static int writer_thread(void *arg)
+{
+    PJ_UNUSED_ARG(arg);
+
+    while (!pj_atomic_get(la.quit)) {
+	if (drain_all())
+	    continue;
+
+	/* Check the rings once more after announcing that we're going to
+	 * wait, a producer which has missed the flag has written before.
+	 */
+	swap_idle(1);
+	if (drain_all() || pj_atomic_get(la.quit)) {
+	    /* A producer may have posted the semaphore already, which
+	     * only makes the next wait return early.
+	     */
+	    swap_idle(0);
+	    continue;
+	}
+	pj_sem_wait(la.sem);
+    }
+
+    return 0;
+}
+
+/* Release the ring of a thread when the thread exits. The ring is freed by
+ * the writer thread after it has written the remaining messages.
+ */
+static void ring_on_thread_exit(void *value)
+{
+    log_ring *ring = (log_ring*) value;
+
+    if (ring != &la.shared) {
+	STORE_REL(ring->state, RING_EXITED);
+	wake_writer();
+    }
+}
+
+/* Get the ring of the calling thread, taking a free one on the first
+ * call.
+ */
+static log_ring *get_ring(void)
+{
+    log_ring *ring;
+    unsigned i;
+
+    ring = (log_ring*) pj_thread_local_get(la.ring_tls);
+    if (ring)
+	return ring;
+
+    /* Messages logged while the ring is being set up, e.g. by the mutex,
+     * go to the shared ring. The mutexes are recursive for the same
+     * reason.
+     */
+    pj_thread_local_set(la.ring_tls, &la.shared);
+
+    pj_mutex_lock(la.mutex);
+    for (i=0; i<la.ring_cnt && la.ring[i].state != RING_FREE; ++i)
+	;
+    if (i < la.ring_cnt) {
+	/* Reuse the ring of an exited thread, which is empty */
+	ring = &la.ring[i];
+	ring->state = RING_OWNED;
+    } else if (la.ring_cnt < la.param.max_threads) {
+	ring = &la.ring[la.ring_cnt];
+	if (ring_init(ring, PJ_FALSE) == PJ_SUCCESS) {
+	    STORE_REL(la.ring_cnt, la.ring_cnt + 1);
+	} else {
+	    ring = &la.shared;
+	}
+    } else {
+	ring = &la.shared;
+    }
+    pj_mutex_unlock(la.mutex);
+
+    pj_thread_local_set(la.ring_tls, ring);
+    return ring;
+}
+
+PJ_DEF(void) pj_log_async_write(int level, const char *buffer, int len)
+{
+    log_ring *ring;
+
+    if (!la.pool)
+	return;
+
+    ring = get_ring();
+    if (ring->mutex) {
+	pj_mutex_lock(ring->mutex);
+	ring_put(ring, level, buffer, len);
+	pj_mutex_unlock(ring->mutex);
+    } else {
+	ring_put(ring, level, buffer, len);
+    }
+
+    wake_writer();
+}
+
+PJ_DEF(pj_status_t) pj_log_async_start(pj_pool_factory *pf,
+				       const pj_log_async_param *prm)
+{
+#if PJ_HAS_THREADS
+    pj_status_t status;
+    unsigned size;
+
+    PJ_ASSERT_RETURN(pf, PJ_EINVAL);
+    PJ_ASSERT_RETURN(la.pool == NULL, PJ_EINVALIDOP);
+
+    if (prm)
+	pj_memcpy(&la.param, prm, sizeof(*prm));
+    else
+	pj_log_async_param_default(&la.param);
+
+    PJ_ASSERT_RETURN(la.param.ring_size >= PJ_LOG_MAX_SIZE, PJ_EINVAL);
+
+    for (size=1024; size < la.param.ring_size; size <<= 1)
+	;
+    la.param.ring_size = size;
+
+    la.pool = pj_pool_create(pf, "logasync", 1024, 1024, NULL);
+    if (!la.pool)
+	return PJ_ENOMEM;
+
+    la.ring = (log_ring*)
+	      pj_pool_calloc(la.pool, la.param.max_threads,
+			     sizeof(log_ring));
+    la.ring_cnt = 0;
+    la.batches = 0;
+    la.idle = 0;
+
+    status = pj_atomic_create(la.pool, 0, &la.quit);
+    if (status != PJ_SUCCESS)
+	goto on_error;
+
+    status = pj_sem_create(la.pool, "logasync", 0, PJ_MAXINT32, &la.sem);
+    if (status != PJ_SUCCESS)
+	goto on_error;
+
+    status = pj_mutex_create_recursive(la.pool, "logasync", &la.mutex);
+    if (status != PJ_SUCCESS)
+	goto on_error;
+
+    status = ring_init(&la.shared, PJ_TRUE);
+    if (status != PJ_SUCCESS)
+	goto on_error;
+
+    /* Without thread exit notification, the rings of exited threads are
+     * not reused.
+     */
+    status = pj_thread_local_alloc2(&la.ring_tls, &ring_on_thread_exit);
+    if (status == PJ_ENOTSUP)
+	status = pj_thread_local_alloc(&la.ring_tls);
+    if (status != PJ_SUCCESS)
+	goto on_error;
+
+    status = pj_thread_create(la.pool, "logasync", &writer_thread, NULL,
+			      0, 0, &la.thread);
+    if (status != PJ_SUCCESS)
+	goto on_error;
+
+    la.writer = pj_log_get_log_func();
+    pj_log_set_log_func(&pj_log_async_write);
+
+    return PJ_SUCCESS;
+
+on_error:
+    if (la.ring_tls != -1) {
+	pj_thread_local_free(la.ring_tls);
+	la.ring_tls = -1;
+    }
+    if (la.sem) {
+	pj_sem_destroy(la.sem);
+	la.sem = NULL;
+    }
+    if (la.quit) {
+	pj_atomic_destroy(la.quit);
+	la.quit = NULL;
+    }
+    pj_pool_release(la.pool);
+    la.pool = NULL;
+    return status;
+#else
+    PJ_UNUSED_ARG(pf);
+    PJ_UNUSED_ARG(prm);
+    return PJ_ENOTSUP;
+#endif
+}
+
+PJ_DEF(void) pj_log_async_stop(void)
+{
+    if (!la.pool)
+	return;
+
+    pj_log_set_log_func(la.writer);
+
+    pj_atomic_set(la.quit, 1);
+    pj_sem_post(la.sem);
+    pj_thread_join(la.thread);
+    pj_thread_destroy(la.thread);
+    la.thread = NULL;
+
+    /* Write what is left */
+    drain_all();
+
+    pj_thread_local_free(la.ring_tls);
+    la.ring_tls = -1;
+
+    pj_sem_destroy(la.sem);
+    la.sem = NULL;
+    pj_atomic_destroy(la.quit);
+    la.quit = NULL;
+
+    pj_pool_release(la.pool);
+    la.pool = NULL;
+}
+
+PJ_DEF(void) pj_log_async_get_stat(pj_log_async_stat *stat)
+{
+    unsigned i;
+
+    pj_bzero(stat, sizeof(*stat));
+    if (!la.pool)
+	return;
+
+    stat->batches = la.batches;
+    stat->written = la.shared.written;
+    stat->dropped = la.shared.dropped;
+    for (i=0; i<LOAD_ACQ(la.ring_cnt); ++i) {
+	stat->written += la.ring[i].written;
+	stat->dropped += la.ring[i].dropped;
+	if (LOAD_ACQ(la.ring[i].state) != RING_FREE)
+	    ++stat->rings;
+    }
+}
+
+#endif	/* PJ_LOG_MAX_LEVEL >= 1 */
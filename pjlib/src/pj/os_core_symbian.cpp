@@ -688,6 +688,18 @@ PJ_DEF(pj_status_t) pj_thread_local_alloc(long *index)
     return PJ_SUCCESS;
 }
 
+/*
+ * pj_thread_local_alloc2()
+ */
+PJ_DEF(pj_status_t) pj_thread_local_alloc2(long *index,
+					   pj_thread_local_dtor *dtor)
+{
+    /* Not supported, thread local storage has no exit notification */
+    PJ_UNUSED_ARG(index);
+    PJ_UNUSED_ARG(dtor);
+    return PJ_ENOTSUP;
+}
+
 /*
  * pj_thread_local_free()
  */
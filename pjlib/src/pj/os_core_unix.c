@@ -1059,6 +1059,31 @@ PJ_DEF(pj_status_t) pj_thread_local_alloc(long *p_index)
 #endif
 }
 
+/*
+ * pj_thread_local_alloc2()
+ */
+PJ_DEF(pj_status_t) pj_thread_local_alloc2(long *p_index,
+					   pj_thread_local_dtor *dtor)
+{
+#if PJ_HAS_THREADS
+    pthread_key_t key;
+    int rc;
+
+    PJ_ASSERT_RETURN(p_index != NULL && dtor != NULL, PJ_EINVAL);
+
+    pj_assert( sizeof(pthread_key_t) <= sizeof(long));
+    if ((rc=pthread_key_create(&key, dtor)) != 0)
+	return PJ_RETURN_OS_ERROR(rc);
+
+    *p_index = key;
+    return PJ_SUCCESS;
+#else
+    /* There is no other thread than the main thread */
+    PJ_UNUSED_ARG(dtor);
+    return pj_thread_local_alloc(p_index);
+#endif
+}
+
 /*
  * pj_thread_local_free()
  */
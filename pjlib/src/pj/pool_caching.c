@@ -24,6 +24,7 @@
 #include <pj/lock.h>
 #include <pj/os.h>
 #include <pj/pool_buf.h>
+#include <pj/errno.h>
 
 #if !PJ_HAS_POOL_ALT_API
 
@@ -49,6 +50,50 @@ static pj_size_t pool_sizes[PJ_CACHING_POOL_ARRAY_SIZE] =
  */
 #define START_SIZE  5
 
+/* Per-thread cache needs atomic counters, since pools may be created and
+ * released without holding the caching pool's mutex.
+ */
+#if defined(__GNUC__)
+#   define CPOOL_HAS_THREAD_CACHE   1
+#   define CPOOL_ADD(var, val)	    __sync_fetch_and_add(&(var), (val))
+#   define CPOOL_SUB(var, val)	    __sync_fetch_and_sub(&(var), (val))
+#   define CPOOL_LOAD_ACQ(var)	    __atomic_load_n(&(var), __ATOMIC_ACQUIRE)
+#   define CPOOL_STORE_REL(var, val) __atomic_store_n(&(var), (val), \
+						       __ATOMIC_RELEASE)
+#else
+#   define CPOOL_HAS_THREAD_CACHE   0
+#   define CPOOL_ADD(var, val)	    ((var) += (val))
+#   define CPOOL_SUB(var, val)	    ((var) -= (val))
+#   define CPOOL_LOAD_ACQ(var)	    (var)
+#   define CPOOL_STORE_REL(var, val) ((var) = (val))
+#endif
+
+/* Flag in pool's factory_data to mark pool that is managed by the thread
+ * cache instead of the used list.
+ */
+#define THREAD_CACHE_POOL   0x100
+#define POOL_IDX_MASK	    0xFF
+
+/* Per-thread cache of free pools ("magazine"). Only the owning thread
+ * accesses the lists and counters, except on pj_caching_pool_destroy()
+ * and cpool_dump_status(). When the thread exits, the cache is marked
+ * as exited and the next thread which needs a cache takes it over, pools
+ * included.
+ */
+struct thread_cache
+{
+    PJ_DECL_LIST_MEMBER(struct thread_cache);
+    pj_caching_pool *cp;
+    unsigned	count[PJ_CACHING_POOL_ARRAY_SIZE];
+    pj_list	free_list[PJ_CACHING_POOL_ARRAY_SIZE];
+    pj_size_t	hit;
+    pj_size_t	miss;
+    pj_size_t	flush;
+    int		exited;
+};
+
+static void thread_cache_on_exit(void *value);
+
 
 PJ_DEF(void) pj_caching_pool_init( pj_caching_pool *cp, 
 				   const pj_pool_factory_policy *policy,
@@ -65,6 +110,8 @@ PJ_DEF(void) pj_caching_pool_init( pj_caching_pool *cp,
     pj_list_init(&cp->used_list);
     for (i=0; i<PJ_CACHING_POOL_ARRAY_SIZE; ++i)
 	pj_list_init(&cp->free_list[i]);
+    cp->thread_cache_tls = -1;
+    pj_list_init(&cp->thread_cache_list);
 
     if (policy == NULL) {
     	policy = &pj_pool_factory_default_policy;
@@ -79,6 +126,45 @@ PJ_DEF(void) pj_caching_pool_init( pj_caching_pool *cp,
 
     pool = pj_pool_create_on_buf("cachingpool", cp->pool_buf, sizeof(cp->pool_buf));
     pj_lock_create_simple_mutex(pool, "cachingpool", &cp->lock);
+
+#if PJ_CACHING_POOL_MAGAZINE_SIZE
+    pj_caching_pool_enable_thread_cache(cp, PJ_CACHING_POOL_MAGAZINE_SIZE);
+#endif
+}
+
+PJ_DEF(pj_status_t) pj_caching_pool_enable_thread_cache(pj_caching_pool *cp,
+							unsigned magazine_size)
+{
+#if CPOOL_HAS_THREAD_CACHE
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(cp, PJ_EINVAL);
+    PJ_ASSERT_RETURN(cp->used_count == 0 && cp->magazine_size == 0,
+		     PJ_EINVALIDOP);
+
+    if (magazine_size == 0)
+	return PJ_SUCCESS;
+
+    if (cp->thread_cache_tls == -1) {
+	status = pj_thread_local_alloc2(&cp->thread_cache_tls,
+					&thread_cache_on_exit);
+	if (status == PJ_ENOTSUP) {
+	    /* The caches of exited threads stay until the pool is
+	     * destroyed.
+	     */
+	    status = pj_thread_local_alloc(&cp->thread_cache_tls);
+	}
+	if (status != PJ_SUCCESS)
+	    return status;
+    }
+
+    cp->magazine_size = magazine_size;
+    return PJ_SUCCESS;
+#else
+    PJ_UNUSED_ARG(cp);
+    PJ_UNUSED_ARG(magazine_size);
+    return PJ_ENOTSUP;
+#endif
 }
 
 PJ_DEF(void) pj_caching_pool_destroy( pj_caching_pool *cp )
@@ -110,12 +196,247 @@ PJ_DEF(void) pj_caching_pool_destroy( pj_caching_pool *cp )
 	pool = next;
     }
 
+    /* Delete all thread caches */
+    while (!pj_list_empty(&cp->thread_cache_list)) {
+	struct thread_cache *tc = cp->thread_cache_list.next;
+
+	for (i=0; i < PJ_CACHING_POOL_ARRAY_SIZE; ++i) {
+	    while (!pj_list_empty(&tc->free_list[i])) {
+		pool = (pj_pool_t*) tc->free_list[i].next;
+		pj_list_erase(pool);
+		pj_pool_destroy_int(pool);
+	    }
+	}
+	pj_list_erase(tc);
+	(*cp->factory.policy.block_free)(&cp->factory, tc, sizeof(*tc));
+    }
+
+    if (cp->thread_cache_tls != -1) {
+	pj_thread_local_free(cp->thread_cache_tls);
+	cp->thread_cache_tls = -1;
+    }
+    cp->magazine_size = 0;
+
     if (cp->lock) {
 	pj_lock_destroy(cp->lock);
 	pj_lock_create_null_mutex(NULL, "cachingpool", &cp->lock);
     }
 }
 
+/* Get the calling thread's cache, taking over the cache of a thread that
+ * has exited or creating a new one if it doesn't exist yet.
+ */
+static struct thread_cache *get_thread_cache(pj_caching_pool *cp)
+{
+    struct thread_cache *tc;
+    unsigned i;
+
+    tc = (struct thread_cache*) pj_thread_local_get(cp->thread_cache_tls);
+    if (tc)
+	return tc;
+
+    pj_lock_acquire(cp->lock);
+    for (tc = cp->thread_cache_list.next;
+	 tc != (void*)&cp->thread_cache_list;
+	 tc = tc->next)
+    {
+	if (CPOOL_LOAD_ACQ(tc->exited)) {
+	    tc->exited = 0;
+	    break;
+	}
+    }
+    pj_lock_release(cp->lock);
+
+    if (tc != (void*)&cp->thread_cache_list) {
+	if (pj_thread_local_set(cp->thread_cache_tls, tc) != PJ_SUCCESS) {
+	    CPOOL_STORE_REL(tc->exited, 1);
+	    return NULL;
+	}
+	return tc;
+    }
+
+    tc = (struct thread_cache*)
+	 (*cp->factory.policy.block_alloc)(&cp->factory, sizeof(*tc));
+    if (!tc)
+	return NULL;
+
+    pj_bzero(tc, sizeof(*tc));
+    tc->cp = cp;
+    for (i=0; i<PJ_CACHING_POOL_ARRAY_SIZE; ++i)
+	pj_list_init(&tc->free_list[i]);
+
+    if (pj_thread_local_set(cp->thread_cache_tls, tc) != PJ_SUCCESS) {
+	(*cp->factory.policy.block_free)(&cp->factory, tc, sizeof(*tc));
+	return NULL;
+    }
+
+    pj_lock_acquire(cp->lock);
+    pj_list_push_back(&cp->thread_cache_list, tc);
+    pj_lock_release(cp->lock);
+
+    return tc;
+}
+
+/* Move half a magazine of free pools from the shared list to the thread
+ * cache.
+ */
+static void thread_cache_refill(pj_caching_pool *cp, struct thread_cache *tc,
+				int idx)
+{
+    unsigned cnt = cp->magazine_size / 2;
+
+    if (cnt == 0)
+	cnt = 1;
+
+    pj_lock_acquire(cp->lock);
+    while (cnt-- && !pj_list_empty(&cp->free_list[idx])) {
+	pj_pool_t *pool = (pj_pool_t*) cp->free_list[idx].next;
+
+	pj_list_erase(pool);
+	if (cp->capacity > pj_pool_get_capacity(pool)) {
+	    cp->capacity -= pj_pool_get_capacity(pool);
+	} else {
+	    cp->capacity = 0;
+	}
+	pj_list_push_back(&tc->free_list[idx], pool);
+	++tc->count[idx];
+    }
+    pj_lock_release(cp->lock);
+}
+
+/* Move cnt of the least recently used pools from the thread cache back
+ * to the shared list, destroying those that don't fit in the caching
+ * pool's maximum capacity. The caching pool must be locked.
+ */
+static void thread_cache_return(pj_caching_pool *cp, struct thread_cache *tc,
+				int idx, unsigned cnt)
+{
+    while (cnt-- && tc->count[idx]) {
+	pj_pool_t *pool = (pj_pool_t*) tc->free_list[idx].prev;
+	pj_size_t pool_capacity = pj_pool_get_capacity(pool);
+
+	pj_list_erase(pool);
+	--tc->count[idx];
+
+	if (cp->capacity + pool_capacity > cp->max_capacity) {
+	    pj_pool_destroy_int(pool);
+	} else {
+	    pool->factory_data = (void*) (pj_ssize_t) idx;
+	    pj_list_insert_after(&cp->free_list[idx], pool);
+	    cp->capacity += pool_capacity;
+	}
+    }
+}
+
+/* Move half a magazine of free pools from the thread cache back to the
+ * shared list.
+ */
+static void thread_cache_flush(pj_caching_pool *cp, struct thread_cache *tc,
+			       int idx)
+{
+    unsigned cnt = cp->magazine_size / 2;
+
+    if (cnt == 0)
+	cnt = 1;
+
+    pj_lock_acquire(cp->lock);
+    thread_cache_return(cp, tc, idx, cnt);
+    pj_lock_release(cp->lock);
+
+    ++tc->flush;
+}
+
+/* Called when a thread which has a cache exits. The thread may already
+ * be unknown to pjlib here, so just mark the cache as exited and let
+ * get_thread_cache() of another thread (or pj_caching_pool_destroy())
+ * pick up its pools.
+ */
+static void thread_cache_on_exit(void *value)
+{
+    struct thread_cache *tc = (struct thread_cache*) value;
+
+    CPOOL_STORE_REL(tc->exited, 1);
+}
+
+/* Create pool from the calling thread's cache. Returns NULL if the
+ * thread cache can't be used, in which case caller should continue with
+ * the shared list.
+ */
+static pj_pool_t *thread_cache_create_pool(pj_caching_pool *cp, int idx,
+					   const char *name,
+					   pj_size_t increment_sz,
+					   pj_pool_callback *callback,
+					   pj_bool_t *p_failed)
+{
+    struct thread_cache *tc;
+    pj_pool_t *pool;
+
+    tc = get_thread_cache(cp);
+    if (!tc)
+	return NULL;
+
+    if (tc->count[idx] == 0) {
+	thread_cache_refill(cp, tc, idx);
+	++tc->miss;
+    } else {
+	++tc->hit;
+    }
+
+    if (tc->count[idx]) {
+	pool = (pj_pool_t*) tc->free_list[idx].next;
+	pj_list_erase(pool);
+	--tc->count[idx];
+
+	pj_pool_init_int(pool, name, increment_sz, callback);
+	PJ_LOG(6, (pool->obj_name, "pool reused from thread cache, size=%u",
+		   pool->capacity));
+    } else {
+	pool = pj_pool_create_int(&cp->factory, name, pool_sizes[idx],
+				  increment_sz, callback);
+	if (!pool) {
+	    *p_failed = PJ_TRUE;
+	    return NULL;
+	}
+    }
+
+    pool->factory_data = (void*) (pj_ssize_t) (idx | THREAD_CACHE_POOL);
+    CPOOL_ADD(cp->used_count, 1);
+
+    return pool;
+}
+
+/* Release pool created by thread_cache_create_pool() */
+static void thread_cache_release_pool(pj_caching_pool *cp, pj_pool_t *pool)
+{
+    struct thread_cache *tc;
+    pj_size_t pool_capacity;
+    int idx;
+
+    CPOOL_SUB(cp->used_count, 1);
+
+    idx = (int) ((pj_ssize_t) pool->factory_data & POOL_IDX_MASK);
+    pool_capacity = pj_pool_get_capacity(pool);
+
+    tc = get_thread_cache(cp);
+    if (!tc || idx >= PJ_CACHING_POOL_ARRAY_SIZE ||
+	pool_capacity > pool_sizes[PJ_CACHING_POOL_ARRAY_SIZE-1])
+    {
+	pj_pool_destroy_int(pool);
+	return;
+    }
+
+    PJ_LOG(6, (pool->obj_name, "recycle() to thread cache: cap=%d, "
+	       "used=%d(%d%%)", pool_capacity, pj_pool_get_used_size(pool),
+	       pj_pool_get_used_size(pool)*100/pool_capacity));
+    pj_pool_reset(pool);
+
+    if (tc->count[idx] >= cp->magazine_size)
+	thread_cache_flush(cp, tc, idx);
+
+    pj_list_insert_after(&tc->free_list[idx], pool);
+    ++tc->count[idx];
+}
+
 static pj_pool_t* cpool_create_pool(pj_pool_factory *pf, 
 					      const char *name, 
 					      pj_size_t initial_size, 
@@ -128,8 +449,6 @@ static pj_pool_t* cpool_create_pool(pj_pool_factory *pf,
 
     PJ_CHECK_STACK();
 
-    pj_lock_acquire(cp->lock);
-
     /* Use pool factory's policy when callback is NULL */
     if (callback == NULL) {
 	callback = pf->policy.callback;
@@ -154,6 +473,18 @@ static pj_pool_t* cpool_create_pool(pj_pool_factory *pf,
 	    ;
     }
 
+    /* Try the calling thread's cache first. */
+    if (cp->magazine_size && idx < PJ_CACHING_POOL_ARRAY_SIZE) {
+	pj_bool_t failed = PJ_FALSE;
+
+	pool = thread_cache_create_pool(cp, idx, name, increment_sz,
+					callback, &failed);
+	if (pool || failed)
+	    return pool;
+    }
+
+    pj_lock_acquire(cp->lock);
+
     /* Check whether there's a pool in the list. */
     if (idx==PJ_CACHING_POOL_ARRAY_SIZE || pj_list_empty(&cp->free_list[idx])) {
 	/* No pool is available. */
@@ -194,7 +525,7 @@ static pj_pool_t* cpool_create_pool(pj_pool_factory *pf,
     pool->factory_data = (void*) (pj_ssize_t) idx;
 
     /* Increment used count. */
-    ++cp->used_count;
+    CPOOL_ADD(cp->used_count, 1);
 
     pj_lock_release(cp->lock);
     return pool;
@@ -210,6 +541,11 @@ static void cpool_release_pool( pj_pool_factory *pf, pj_pool_t *pool)
 
     PJ_ASSERT_ON_FAIL(pf && pool, return);
 
+    if ((pj_ssize_t) pool->factory_data & THREAD_CACHE_POOL) {
+	thread_cache_release_pool(cp, pool);
+	return;
+    }
+
     pj_lock_acquire(cp->lock);
 
 #if PJ_SAFE_POOL
@@ -224,7 +560,7 @@ static void cpool_release_pool( pj_pool_factory *pf, pj_pool_t *pool)
     pj_list_erase(pool);
 
     /* Decrement used count. */
-    --cp->used_count;
+    CPOOL_SUB(cp->used_count, 1);
 
     pool_capacity = pj_pool_get_capacity(pool);
 
@@ -277,6 +613,26 @@ static void cpool_dump_status(pj_pool_factory *factory, pj_bool_t detail )
     PJ_LOG(3,("cachpool", " Dumping caching pool:"));
     PJ_LOG(3,("cachpool", "   Capacity=%u, max_capacity=%u, used_cnt=%u", \
 			     cp->capacity, cp->max_capacity, cp->used_count));
+    if (cp->magazine_size) {
+	struct thread_cache *tc = cp->thread_cache_list.next;
+	unsigned n = 0;
+
+	PJ_LOG(3,("cachpool", "  Thread caches (magazine size=%u):",
+		  cp->magazine_size));
+	for (; tc != (void*)&cp->thread_cache_list; tc = tc->next, ++n) {
+	    pj_size_t total = tc->hit + tc->miss;
+	    unsigned i, cached = 0;
+
+	    for (i=0; i<PJ_CACHING_POOL_ARRAY_SIZE; ++i)
+		cached += tc->count[i];
+
+	    PJ_LOG(3,("cachpool", "   #%u: hit=%u, miss=%u (%u%% hit), "
+		      "flush=%u, cached=%u", n, (unsigned)tc->hit,
+		      (unsigned)tc->miss,
+		      (unsigned)(total ? tc->hit * 100 / total : 0),
+		      (unsigned)tc->flush, cached));
+	}
+    }
     if (detail) {
 	pj_pool_t *pool = (pj_pool_t*) cp->used_list.next;
 	pj_size_t total_used = 0, total_capacity = 0;
@@ -314,7 +670,7 @@ static pj_bool_t cpool_on_block_alloc(pj_pool_factory *f, pj_size_t sz)
     //Can't lock because mutex is not recursive
     //if (cp->mutex) pj_mutex_lock(cp->mutex);
 
-    cp->used_size += sz;
+    CPOOL_ADD(cp->used_size, sz);
     if (cp->used_size > cp->peak_used_size)
 	cp->peak_used_size = cp->used_size;
 
@@ -329,7 +685,7 @@ static void cpool_on_block_free(pj_pool_factory *f, pj_size_t sz)
     pj_caching_pool *cp = (pj_caching_pool*)f;
 
     //pj_mutex_lock(cp->mutex);
-    cp->used_size -= sz;
+    CPOOL_SUB(cp->used_size, sz);
     //pj_mutex_unlock(cp->mutex);
 }
 
@@ -106,6 +106,9 @@ struct pj_timer_heap_t
     /** Callback to be called when a timer expires. */
     pj_timer_heap_callback *callback;
 
+    /** Timing wheel, if PJ_TIMER_ENGINE_WHEEL is used. */
+    struct timer_wheel *wheel;
+
 };
 
 
@@ -359,6 +362,617 @@ static int cancel( pj_timer_heap_t *ht,
     }
 }
 
+/*
+ * Hierarchical timing wheel engine.
+ *
+ * Time is divided into ticks of PJ_TIMER_WHEEL_RESOLUTION msec. Level 0 of
+ * the wheel has one slot per tick for the next WHEEL_L0_SIZE ticks, and
+ * each higher level has WHEEL_LN_SIZE slots, each covering a whole
+ * revolution of the level below it. When level 0 wraps around, the
+ * current slot of the next level is cascaded (redistributed) to the lower
+ * levels. Each slot is a doubly linked list of nodes, so schedule and
+ * cancel are O(1).
+ *
+ * Entries are distributed to shards by their address, each shard being a
+ * complete wheel with its own lock and node array. The timer id of an
+ * entry encodes both the shard and the node index within the shard.
+ */
+#define WHEEL_L0_BITS	    8
+#define WHEEL_LN_BITS	    6
+#define WHEEL_LEVELS	    4
+#define WHEEL_L0_SIZE	    (1 << WHEEL_L0_BITS)
+#define WHEEL_LN_SIZE	    (1 << WHEEL_LN_BITS)
+#define WHEEL_SLOT_CNT	    (WHEEL_L0_SIZE + (WHEEL_LEVELS-1)*WHEEL_LN_SIZE)
+#define WHEEL_MAX_TICKS	    ((pj_uint32_t)1 << (WHEEL_L0_BITS + \
+				(WHEEL_LEVELS-1)*WHEEL_LN_BITS))
+
+/* Max number of entries to collect under the shard lock in each round of
+ * pj_timer_heap_poll().
+ */
+#define WHEEL_POLL_BATCH    16
+
+struct wheel_node
+{
+    /** The entry, or NULL if the node is free. */
+    pj_timer_entry  *entry;
+
+    /** Expiration tick. */
+    pj_uint32_t	     expires;
+
+    /** Links in the slot list, or in the free list (next only). */
+    pj_timer_id_t    prev, next;
+
+    /** Head of the slot list containing this node. */
+    pj_timer_id_t   *slot;
+};
+
+struct wheel_shard
+{
+    pj_lock_t	      *lock;	    /**< own_lock or the heap's lock.	    */
+    pj_lock_t	      *own_lock;
+    pj_size_t	       count;
+    pj_uint32_t	       cur_tick;    /**< Next tick to be processed.	    */
+    pj_bool_t	       cascaded;    /**< Cascade done for cur_tick?	    */
+    pj_size_t	       max_nodes;
+    struct wheel_node *nodes;	    /**< Node 0 is unused (nil).	    */
+    pj_timer_id_t      free_list;
+    pj_timer_id_t      slots[WHEEL_SLOT_CNT];
+};
+
+struct timer_wheel
+{
+    pj_time_val		base;	    /**< Time of tick 0.		    */
+    unsigned		shard_cnt;
+    unsigned		next_shard; /**< Shard to poll first.	    */
+    pj_lock_t	       *pool_lock;
+    struct wheel_shard *shards;
+};
+
+
+static pj_int64_t wheel_msec(const struct timer_wheel *w,
+			     const pj_time_val *t)
+{
+    return ((pj_int64_t)t->sec - w->base.sec) * 1000 +
+	   (t->msec - w->base.msec);
+}
+
+/* Convert time to tick. Expiration is rounded up so that timers never
+ * expire early, while current time is rounded down.
+ */
+static pj_uint32_t wheel_tick(const struct timer_wheel *w,
+			      const pj_time_val *t,
+			      pj_bool_t round_up)
+{
+    pj_int64_t msec = wheel_msec(w, t);
+
+    if (msec < 0)
+	msec = 0;
+    if (round_up)
+	msec += PJ_TIMER_WHEEL_RESOLUTION - 1;
+    return (pj_uint32_t)(msec / PJ_TIMER_WHEEL_RESOLUTION);
+}
+
+static unsigned wheel_shard_idx(const struct timer_wheel *w,
+				const pj_timer_entry *entry)
+{
+    pj_size_t addr = (pj_size_t)entry;
+    return (unsigned)(((addr >> 4) ^ (addr >> 12)) % w->shard_cnt);
+}
+
+/* Put node in the slot according to its expiration. */
+static void wheel_link(struct wheel_shard *sh, pj_timer_id_t idx)
+{
+    struct wheel_node *node = &sh->nodes[idx];
+    pj_uint32_t expires = node->expires;
+    pj_uint32_t delta;
+    pj_timer_id_t *slot;
+
+    /* Already expired entries go to the current slot */
+    if ((pj_int32_t)(expires - sh->cur_tick) < 0)
+	expires = sh->cur_tick;
+    delta = expires - sh->cur_tick;
+
+    if (delta < WHEEL_L0_SIZE) {
+	slot = &sh->slots[expires & (WHEEL_L0_SIZE-1)];
+    } else {
+	unsigned level = 1, shift = WHEEL_L0_BITS;
+
+	/* Entries beyond the wheel's range are parked in the furthest
+	 * slot, and will be cascaded again later.
+	 */
+	if (delta >= WHEEL_MAX_TICKS) {
+	    delta = WHEEL_MAX_TICKS - 1;
+	    expires = sh->cur_tick + delta;
+	}
+	while (delta >= ((pj_uint32_t)1 << (shift + WHEEL_LN_BITS))) {
+	    ++level;
+	    shift += WHEEL_LN_BITS;
+	}
+	slot = &sh->slots[WHEEL_L0_SIZE + (level-1)*WHEEL_LN_SIZE +
+			  ((expires >> shift) & (WHEEL_LN_SIZE-1))];
+    }
+
+    node->slot = slot;
+    node->prev = 0;
+    node->next = *slot;
+    if (*slot)
+	sh->nodes[*slot].prev = idx;
+    *slot = idx;
+}
+
+static void wheel_unlink(struct wheel_shard *sh, pj_timer_id_t idx)
+{
+    struct wheel_node *node = &sh->nodes[idx];
+
+    if (node->prev)
+	sh->nodes[node->prev].next = node->next;
+    else
+	*node->slot = node->next;
+    if (node->next)
+	sh->nodes[node->next].prev = node->prev;
+    node->slot = NULL;
+}
+
+/* Redistribute the current slot of the specified level to lower levels.
+ * Returns the index of the slot.
+ */
+static unsigned wheel_cascade(struct wheel_shard *sh, unsigned level)
+{
+    unsigned shift = WHEEL_L0_BITS + (level-1)*WHEEL_LN_BITS;
+    unsigned index = (sh->cur_tick >> shift) & (WHEEL_LN_SIZE-1);
+    pj_timer_id_t *slot = &sh->slots[WHEEL_L0_SIZE + (level-1)*WHEEL_LN_SIZE
+				     + index];
+    pj_timer_id_t idx = *slot;
+
+    *slot = 0;
+    while (idx) {
+	pj_timer_id_t next = sh->nodes[idx].next;
+	wheel_link(sh, idx);
+	idx = next;
+    }
+
+    return index;
+}
+
+static pj_status_t wheel_grow_shard(pj_timer_heap_t *ht,
+				    struct wheel_shard *sh)
+{
+    pj_size_t new_size = sh->max_nodes * 2;
+    struct wheel_node *new_nodes;
+    pj_size_t i;
+
+    pj_lock_acquire(ht->wheel->pool_lock);
+    new_nodes = (struct wheel_node*)
+		pj_pool_calloc(ht->pool, new_size, sizeof(struct wheel_node));
+    pj_lock_release(ht->wheel->pool_lock);
+    if (!new_nodes)
+	return PJ_ENOMEM;
+
+    pj_memcpy(new_nodes, sh->nodes, sh->max_nodes*sizeof(struct wheel_node));
+
+    /* Slot heads are kept in the shard, so nodes' slot pointers remain
+     * valid. Add the new nodes to the free list.
+     */
+    for (i = sh->max_nodes; i < new_size; ++i)
+	new_nodes[i].next = (i+1 < new_size) ? (pj_timer_id_t)(i+1) : 0;
+    sh->free_list = (pj_timer_id_t) sh->max_nodes;
+
+    sh->nodes = new_nodes;
+    sh->max_nodes = new_size;
+    return PJ_SUCCESS;
+}
+
+static pj_status_t wheel_create(pj_pool_t *pool, pj_size_t size,
+				struct timer_wheel **p_wheel)
+{
+    struct timer_wheel *w;
+    unsigned i;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(PJ_TIMER_WHEEL_SHARD_COUNT > 0 &&
+		     PJ_TIMER_WHEEL_RESOLUTION > 0, PJ_EBUG);
+
+    w = PJ_POOL_ZALLOC_T(pool, struct timer_wheel);
+    if (!w)
+	return PJ_ENOMEM;
+
+    pj_gettickcount(&w->base);
+    w->shard_cnt = PJ_TIMER_WHEEL_SHARD_COUNT;
+    w->shards = (struct wheel_shard*)
+		pj_pool_calloc(pool, w->shard_cnt, sizeof(struct wheel_shard));
+    if (!w->shards)
+	return PJ_ENOMEM;
+
+    status = pj_lock_create_simple_mutex(pool, "tmrwheel", &w->pool_lock);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    for (i=0; i<w->shard_cnt; ++i) {
+	struct wheel_shard *sh = &w->shards[i];
+	pj_size_t j;
+
+	/* Node 0 is nil, and one extra for rounding. */
+	sh->max_nodes = size / w->shard_cnt + 2;
+	sh->nodes = (struct wheel_node*)
+		    pj_pool_calloc(pool, sh->max_nodes,
+				   sizeof(struct wheel_node));
+	if (!sh->nodes)
+	    return PJ_ENOMEM;
+
+	for (j=1; j<sh->max_nodes; ++j)
+	    sh->nodes[j].next = (j+1 < sh->max_nodes) ?
+				(pj_timer_id_t)(j+1) : 0;
+	sh->free_list = 1;
+
+	/* Callbacks are called without holding the lock, but group lock
+	 * handlers may be invoked by pj_timer_heap_cancel() while holding it.
+	 */
+	status = pj_lock_create_recursive_mutex(pool, "tmrshard",
+						&sh->own_lock);
+	if (status != PJ_SUCCESS)
+	    return status;
+	sh->lock = sh->own_lock;
+    }
+
+    *p_wheel = w;
+    return PJ_SUCCESS;
+}
+
+static void wheel_destroy(struct timer_wheel *w)
+{
+    unsigned i;
+
+    for (i=0; i<w->shard_cnt; ++i) {
+	if (w->shards[i].own_lock) {
+	    pj_lock_destroy(w->shards[i].own_lock);
+	    w->shards[i].own_lock = NULL;
+	}
+	w->shards[i].lock = NULL;
+    }
+    if (w->pool_lock) {
+	pj_lock_destroy(w->pool_lock);
+	w->pool_lock = NULL;
+    }
+}
+
+/* Make all shards use the specified lock, or their own lock if it's NULL */
+static void wheel_set_lock(struct timer_wheel *w, pj_lock_t *lock)
+{
+    unsigned i;
+
+    for (i=0; i<w->shard_cnt; ++i) {
+	struct wheel_shard *sh = &w->shards[i];
+	sh->lock = lock ? lock : sh->own_lock;
+    }
+}
+
+static pj_status_t wheel_schedule(pj_timer_heap_t *ht,
+				  pj_timer_entry *entry,
+				  const pj_time_val *expires,
+				  pj_bool_t set_id,
+				  int id_val,
+				  pj_grp_lock_t *grp_lock)
+{
+    struct timer_wheel *w = ht->wheel;
+    unsigned shard_idx = wheel_shard_idx(w, entry);
+    struct wheel_shard *sh = &w->shards[shard_idx];
+    struct wheel_node *node;
+    pj_timer_id_t idx;
+
+    pj_lock_acquire(sh->lock);
+
+    /* Prevent same entry from being scheduled more than once */
+    if (pj_timer_entry_running(entry)) {
+	pj_lock_release(sh->lock);
+	PJ_LOG(3,(THIS_FILE, "Bug! Rescheduling outstanding entry (%p)",
+		  entry));
+	return PJ_EINVALIDOP;
+    }
+
+    if (!sh->free_list && wheel_grow_shard(ht, sh) != PJ_SUCCESS) {
+	pj_lock_release(sh->lock);
+	return PJ_ENOMEM;
+    }
+
+    idx = sh->free_list;
+    node = &sh->nodes[idx];
+    sh->free_list = node->next;
+
+    node->entry = entry;
+    node->expires = wheel_tick(w, expires, PJ_TRUE);
+    wheel_link(sh, idx);
+    ++sh->count;
+
+    entry->_timer_id = (pj_timer_id_t)(idx * w->shard_cnt + shard_idx);
+    entry->_timer_value = *expires;
+    if (set_id)
+	entry->id = id_val;
+    entry->_grp_lock = grp_lock;
+    if (entry->_grp_lock) {
+	pj_grp_lock_add_ref(entry->_grp_lock);
+    }
+
+    pj_lock_release(sh->lock);
+
+    return PJ_SUCCESS;
+}
+
+static int wheel_cancel(pj_timer_heap_t *ht,
+			pj_timer_entry *entry,
+			unsigned flags,
+			int id_val)
+{
+    struct timer_wheel *w = ht->wheel;
+    unsigned shard_idx = wheel_shard_idx(w, entry);
+    struct wheel_shard *sh = &w->shards[shard_idx];
+    pj_timer_id_t id;
+    int count = 0;
+
+    pj_lock_acquire(sh->lock);
+
+    id = entry->_timer_id;
+    if (id >= 1 && (unsigned)id % w->shard_cnt == shard_idx &&
+	(pj_size_t)id / w->shard_cnt < sh->max_nodes)
+    {
+	pj_timer_id_t idx = (pj_timer_id_t)((unsigned)id / w->shard_cnt);
+	struct wheel_node *node = &sh->nodes[idx];
+
+	if (node->entry == entry) {
+	    wheel_unlink(sh, idx);
+	    node->entry = NULL;
+	    node->next = sh->free_list;
+	    sh->free_list = idx;
+	    --sh->count;
+	    count = 1;
+	} else if (node->entry && (flags & F_DONT_ASSERT) == 0) {
+	    pj_assert(node->entry == entry);
+	}
+    }
+    entry->_timer_id = -1;
+
+    if (count > 0) {
+	/* Timer entry found & cancelled */
+	if (flags & F_SET_ID) {
+	    entry->id = id_val;
+	}
+	if (entry->_grp_lock) {
+	    pj_grp_lock_t *grp_lock = entry->_grp_lock;
+	    entry->_grp_lock = NULL;
+	    pj_grp_lock_dec_ref(grp_lock);
+	}
+    }
+
+    pj_lock_release(sh->lock);
+
+    return count;
+}
+
+/* Collect up to max expired entries from the shard, advancing the shard's
+ * wheel up to now_tick. Must be called with the shard lock held.
+ */
+static unsigned wheel_expire(struct wheel_shard *sh, pj_uint32_t now_tick,
+			     pj_timer_entry *batch[],
+			     pj_grp_lock_t *grp_locks[],
+			     unsigned max)
+{
+    unsigned n = 0;
+
+    while (n < max && (pj_int32_t)(now_tick - sh->cur_tick) >= 0) {
+	pj_timer_id_t *slot, idx;
+	struct wheel_node *node;
+
+	if (sh->count == 0) {
+	    /* Nothing to cascade, just catch up with current time */
+	    sh->cur_tick = now_tick + 1;
+	    sh->cascaded = PJ_FALSE;
+	    break;
+	}
+
+	if (!sh->cascaded) {
+	    if ((sh->cur_tick & (WHEEL_L0_SIZE-1)) == 0) {
+		unsigned level;
+		for (level=1; level<WHEEL_LEVELS; ++level) {
+		    if (wheel_cascade(sh, level) != 0)
+			break;
+		}
+	    }
+	    sh->cascaded = PJ_TRUE;
+	}
+
+	slot = &sh->slots[sh->cur_tick & (WHEEL_L0_SIZE-1)];
+	if (*slot == 0) {
+	    ++sh->cur_tick;
+	    sh->cascaded = PJ_FALSE;
+	    continue;
+	}
+
+	idx = *slot;
+	node = &sh->nodes[idx];
+	wheel_unlink(sh, idx);
+
+	batch[n] = node->entry;
+	grp_locks[n] = node->entry->_grp_lock;
+	node->entry->_grp_lock = NULL;
+	node->entry->_timer_id = -1;
+	++n;
+
+	node->entry = NULL;
+	node->next = sh->free_list;
+	sh->free_list = idx;
+	--sh->count;
+    }
+
+    return n;
+}
+
+/* Get the earliest tick in which an entry in the shard may expire. The
+ * result is exact for entries in the level 0 of the wheel, otherwise the
+ * next cascade tick is returned. Must be called with the shard lock held.
+ */
+static pj_uint32_t wheel_next_tick(const struct wheel_shard *sh)
+{
+    pj_uint32_t tick = sh->cur_tick;
+
+    if (!sh->cascaded && (tick & (WHEEL_L0_SIZE-1)) == 0)
+	return tick;
+
+    do {
+	if (sh->slots[tick & (WHEEL_L0_SIZE-1)])
+	    return tick;
+	++tick;
+    } while (tick & (WHEEL_L0_SIZE-1));
+
+    return tick;
+}
+
+/* Get the earliest tick of all shards. Returns PJ_FALSE if there is no
+ * entry.
+ */
+static pj_bool_t wheel_earliest_tick(struct timer_wheel *w,
+				     pj_uint32_t *p_tick)
+{
+    pj_bool_t found = PJ_FALSE;
+    unsigned i;
+
+    for (i=0; i<w->shard_cnt; ++i) {
+	struct wheel_shard *sh = &w->shards[i];
+	pj_uint32_t tick;
+
+	if (sh->count == 0)
+	    continue;
+
+	pj_lock_acquire(sh->lock);
+	if (sh->count) {
+	    tick = wheel_next_tick(sh);
+	    if (!found || (pj_int32_t)(tick - *p_tick) < 0)
+		*p_tick = tick;
+	    found = PJ_TRUE;
+	}
+	pj_lock_release(sh->lock);
+    }
+
+    return found;
+}
+
+static unsigned wheel_poll(pj_timer_heap_t *ht, pj_time_val *next_delay)
+{
+    struct timer_wheel *w = ht->wheel;
+    pj_timer_entry *batch[WHEEL_POLL_BATCH];
+    pj_grp_lock_t *grp_locks[WHEEL_POLL_BATCH];
+    pj_time_val now;
+    pj_uint32_t now_tick, tick;
+    unsigned i, first, count = 0;
+
+    pj_gettickcount(&now);
+    now_tick = wheel_tick(w, &now, PJ_FALSE);
+
+    /* Rotate the first shard to poll, so that all shards get a chance
+     * when max_entries_per_poll is reached.
+     */
+    first = w->next_shard++ % w->shard_cnt;
+
+    for (i=0; i<w->shard_cnt && count < ht->max_entries_per_poll; ++i) {
+	struct wheel_shard *sh = &w->shards[(first + i) % w->shard_cnt];
+	unsigned n, max;
+
+	do {
+	    unsigned j;
+
+	    max = ht->max_entries_per_poll - count;
+	    if (max > WHEEL_POLL_BATCH)
+		max = WHEEL_POLL_BATCH;
+
+	    pj_lock_acquire(sh->lock);
+	    n = wheel_expire(sh, now_tick, batch, grp_locks, max);
+	    pj_lock_release(sh->lock);
+
+	    for (j=0; j<n; ++j) {
+		PJ_RACE_ME(5);
+
+		if (batch[j]->cb)
+		    (*batch[j]->cb)(ht, batch[j]);
+
+		if (grp_locks[j])
+		    pj_grp_lock_dec_ref(grp_locks[j]);
+	    }
+	    count += n;
+
+	} while (n == max && count < ht->max_entries_per_poll);
+    }
+
+    if (next_delay) {
+	if (wheel_earliest_tick(w, &tick)) {
+	    pj_int64_t msec = (pj_int64_t)tick * PJ_TIMER_WHEEL_RESOLUTION -
+			      wheel_msec(w, &now);
+	    if (msec <= 0) {
+		next_delay->sec = next_delay->msec = 0;
+	    } else {
+		next_delay->sec = (long)(msec / 1000);
+		next_delay->msec = (long)(msec % 1000);
+	    }
+	} else {
+	    next_delay->sec = next_delay->msec = PJ_MAXINT32;
+	}
+    }
+
+    return count;
+}
+
+static pj_size_t wheel_count(struct timer_wheel *w)
+{
+    pj_size_t count = 0;
+    unsigned i;
+
+    for (i=0; i<w->shard_cnt; ++i)
+	count += w->shards[i].count;
+
+    return count;
+}
+
+#if PJ_TIMER_DEBUG
+static void wheel_dump(struct timer_wheel *w)
+{
+    pj_time_val now;
+    unsigned i;
+
+    PJ_LOG(3,(THIS_FILE, "Dumping timer wheel:"));
+    PJ_LOG(3,(THIS_FILE, "  Cur size: %d entries, %d shards",
+			 (int)wheel_count(w), w->shard_cnt));
+    PJ_LOG(3,(THIS_FILE, "  Entries: "));
+    PJ_LOG(3,(THIS_FILE, "    _id\tId\tElapsed\tSource"));
+    PJ_LOG(3,(THIS_FILE, "    ----------------------------------"));
+
+    pj_gettickcount(&now);
+
+    for (i=0; i<w->shard_cnt; ++i) {
+	struct wheel_shard *sh = &w->shards[i];
+	pj_size_t j;
+
+	pj_lock_acquire(sh->lock);
+	for (j=1; j<sh->max_nodes; ++j) {
+	    pj_timer_entry *e = sh->nodes[j].entry;
+	    pj_time_val delta;
+
+	    if (!e)
+		continue;
+
+	    if (PJ_TIME_VAL_LTE(e->_timer_value, now))
+		delta.sec = delta.msec = 0;
+	    else {
+		delta = e->_timer_value;
+		PJ_TIME_VAL_SUB(delta, now);
+	    }
+
+	    PJ_LOG(3,(THIS_FILE, "    %d\t%d\t%d.%03d\t%s:%d",
+		      e->_timer_id, e->id,
+		      (int)delta.sec, (int)delta.msec,
+		      e->src_file, e->src_line));
+	}
+	pj_lock_release(sh->lock);
+    }
+}
+#endif
+
 
 /*
  * Calculate memory size required to create a timer heap.
@@ -379,11 +993,26 @@ PJ_DEF(pj_size_t) pj_timer_heap_mem_size(pj_size_t count)
 PJ_DEF(pj_status_t) pj_timer_heap_create( pj_pool_t *pool,
 					  pj_size_t size,
                                           pj_timer_heap_t **p_heap)
+{
+    return pj_timer_heap_create2(pool, size,
+				 (pj_timer_engine)PJ_TIMER_HEAP_ENGINE,
+				 p_heap);
+}
+
+/*
+ * Create a new timer heap with the specified engine.
+ */
+PJ_DEF(pj_status_t) pj_timer_heap_create2( pj_pool_t *pool,
+					   pj_size_t size,
+					   pj_timer_engine engine,
+					   pj_timer_heap_t **p_heap)
 {
     pj_timer_heap_t *ht;
     pj_size_t i;
 
     PJ_ASSERT_RETURN(pool && p_heap, PJ_EINVAL);
+    PJ_ASSERT_RETURN(engine==PJ_TIMER_ENGINE_HEAP ||
+		     engine==PJ_TIMER_ENGINE_WHEEL, PJ_EINVAL);
 
     *p_heap = NULL;
 
@@ -406,6 +1035,25 @@ PJ_DEF(pj_status_t) pj_timer_heap_create( pj_pool_t *pool,
     ht->lock = NULL;
     ht->auto_delete_lock = 0;
 
+    ht->wheel = NULL;
+    if (engine == PJ_TIMER_ENGINE_WHEEL) {
+	pj_status_t status;
+
+	ht->max_size = 0;
+	ht->heap = NULL;
+	ht->timer_ids = NULL;
+
+	status = wheel_create(pool, size, &ht->wheel);
+	if (status != PJ_SUCCESS) {
+	    if (ht->wheel)
+		wheel_destroy(ht->wheel);
+	    return status;
+	}
+
+	*p_heap = ht;
+	return PJ_SUCCESS;
+    }
+
     // Create the heap array.
     ht->heap = (pj_timer_entry**)
     	       pj_pool_alloc(pool, sizeof(pj_timer_entry*) * size);
@@ -430,6 +1078,10 @@ PJ_DEF(pj_status_t) pj_timer_heap_create( pj_pool_t *pool,
 
 PJ_DEF(void) pj_timer_heap_destroy( pj_timer_heap_t *ht )
 {
+    if (ht->wheel) {
+	wheel_destroy(ht->wheel);
+	ht->wheel = NULL;
+    }
     if (ht->lock && ht->auto_delete_lock) {
         pj_lock_destroy(ht->lock);
         ht->lock = NULL;
@@ -445,6 +1097,9 @@ PJ_DEF(void) pj_timer_heap_set_lock(  pj_timer_heap_t *ht,
 
     ht->lock = lock;
     ht->auto_delete_lock = auto_del;
+
+    if (ht->wheel)
+	wheel_set_lock(ht->wheel, lock);
 }
 
 
@@ -510,6 +1165,9 @@ static pj_status_t schedule_w_grp_lock(pj_timer_heap_t *ht,
 #endif
     pj_gettickcount(&expires);
     PJ_TIME_VAL_ADD(expires, *delay);
+
+    if (ht->wheel)
+	return wheel_schedule(ht, entry, &expires, set_id, id_val, grp_lock);
     
     lock_timer_heap(ht);
 
@@ -587,6 +1245,9 @@ static int cancel_timer(pj_timer_heap_t *ht,
 
     PJ_ASSERT_RETURN(ht && entry, PJ_EINVAL);
 
+    if (ht->wheel)
+	return wheel_cancel(ht, entry, flags, id_val);
+
     lock_timer_heap(ht);
     count = cancel(ht, entry, flags | F_DONT_CALL);
     if (count > 0) {
@@ -626,6 +1287,9 @@ PJ_DEF(unsigned) pj_timer_heap_poll( pj_timer_heap_t *ht,
 
     PJ_ASSERT_RETURN(ht, 0);
 
+    if (ht->wheel)
+	return wheel_poll(ht, next_delay);
+
     lock_timer_heap(ht);
     if (!ht->cur_size && next_delay) {
 	next_delay->sec = next_delay->msec = PJ_MAXINT32;
@@ -682,12 +1346,30 @@ PJ_DEF(pj_size_t) pj_timer_heap_count( pj_timer_heap_t *ht )
 {
     PJ_ASSERT_RETURN(ht, 0);
 
+    if (ht->wheel)
+	return wheel_count(ht->wheel);
+
     return ht->cur_size;
 }
 
 PJ_DEF(pj_status_t) pj_timer_heap_earliest_time( pj_timer_heap_t * ht,
 					         pj_time_val *timeval)
 {
+    if (ht->wheel) {
+	pj_uint32_t tick;
+	pj_int64_t msec;
+
+	if (!wheel_earliest_tick(ht->wheel, &tick))
+	    return PJ_ENOTFOUND;
+
+	msec = (pj_int64_t)tick * PJ_TIMER_WHEEL_RESOLUTION;
+	*timeval = ht->wheel->base;
+	timeval->sec += (long)(msec / 1000);
+	timeval->msec += (long)(msec % 1000);
+	pj_time_val_normalize(timeval);
+	return PJ_SUCCESS;
+    }
+
     pj_assert(ht->cur_size != 0);
     if (ht->cur_size == 0)
         return PJ_ENOTFOUND;
@@ -702,6 +1384,11 @@ PJ_DEF(pj_status_t) pj_timer_heap_earliest_time( pj_timer_heap_t * ht,
 #if PJ_TIMER_DEBUG
 PJ_DEF(void) pj_timer_heap_dump(pj_timer_heap_t *ht)
 {
+    if (ht->wheel) {
+	wheel_dump(ht->wheel);
+	return;
+    }
+
     lock_timer_heap(ht);
 
     PJ_LOG(3,(THIS_FILE, "Dumping timer heap:"));
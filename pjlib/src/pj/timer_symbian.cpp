@@ -311,6 +311,19 @@ PJ_DEF(pj_status_t) pj_timer_heap_create( pj_pool_t *pool,
     return PJ_SUCCESS;
 }
 
+/*
+ * Create a new timer heap. Timers are always managed by the Active
+ * Scheduler on Symbian, so the engine is ignored.
+ */
+PJ_DEF(pj_status_t) pj_timer_heap_create2( pj_pool_t *pool,
+					   pj_size_t size,
+					   pj_timer_engine engine,
+					   pj_timer_heap_t **p_heap)
+{
+    PJ_UNUSED_ARG(engine);
+    return pj_timer_heap_create(pool, size, p_heap);
+}
+
 PJ_DEF(void) pj_timer_heap_destroy( pj_timer_heap_t *ht )
 {
     /* Cancel and delete pending active objects */
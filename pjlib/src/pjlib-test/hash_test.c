@@ -21,20 +21,26 @@
 #include <pj/rand.h>
 #include <pj/log.h>
 #include <pj/pool.h>
+#include <pj/os.h>
+#include <pj/string.h>
 #include "test.h"
 
 #if INCLUDE_HASH_TEST
 
 #define HASH_COUNT  31
 
-static int hash_test_with_key(pj_pool_t *pool, unsigned char key)
+/* The benchmark takes some time, disable it for quick runs */
+#define INCLUDE_HASH_BENCHMARK	1
+
+static int hash_test_with_key(pj_pool_t *pool, unsigned options,
+			      unsigned char key)
 {
     pj_hash_table_t *ht;
     unsigned value = 0x12345;
     pj_hash_iterator_t it_buf, *it;
     unsigned *entry;
 
-    ht = pj_hash_create(pool, HASH_COUNT);
+    ht = pj_hash_create2(pool, HASH_COUNT, options);
     if (!ht)
 	return -10;
 
@@ -83,7 +89,7 @@ static int hash_test_with_key(pj_pool_t *pool, unsigned char key)
 }
 
 
-static int hash_collision_test(pj_pool_t *pool)
+static int hash_collision_test(pj_pool_t *pool, unsigned options)
 {
     enum {
 	COUNT = HASH_COUNT * 4
@@ -93,7 +99,7 @@ static int hash_collision_test(pj_pool_t *pool)
     unsigned char *values;
     unsigned i;
 
-    ht = pj_hash_create(pool, HASH_COUNT);
+    ht = pj_hash_create2(pool, HASH_COUNT, options);
     if (!ht)
 	return -200;
 
@@ -130,34 +136,197 @@ static int hash_collision_test(pj_pool_t *pool)
 }
 
 
+/*
+ * Random insertions and deletions on an open addressing table, which
+ * grows and rehashes, checked against a plain array.
+ */
+static int hash_churn_test(pj_pool_t *pool)
+{
+    enum {
+	KEYS = 2000,
+	ROUNDS = 50000
+    };
+    pj_hash_table_t *ht;
+    pj_hash_iterator_t it_buf, *it;
+    pj_hash_entry_buf *entry_buf;
+    char (*keys)[16];
+    unsigned *values, count = 0;
+    unsigned i, round;
+
+    ht = pj_hash_create2(pool, 4, PJ_HASH_OPT_OPEN_ADDRESSING);
+    if (!ht)
+	return -300;
+
+    keys = (char(*)[16]) pj_pool_alloc(pool, KEYS * 16);
+    values = (unsigned*) pj_pool_calloc(pool, KEYS, sizeof(unsigned));
+    entry_buf = (pj_hash_entry_buf*)
+		pj_pool_alloc(pool, KEYS * sizeof(pj_hash_entry_buf));
+    for (i=0; i<KEYS; ++i)
+	pj_ansi_snprintf(keys[i], sizeof(keys[i]), "key-%u", i);
+
+    for (round=0; round<ROUNDS; ++round) {
+	/* Grow to about half of the keys, then keep churning */
+	unsigned idx = pj_rand() % (round < ROUNDS/4 ? KEYS/2 : KEYS);
+	void *entry;
+
+	if (values[idx] && (pj_rand() & 1)) {
+	    if (round & 2)
+		pj_hash_set_lower(NULL, ht, keys[idx], PJ_HASH_KEY_STRING,
+				  0, NULL);
+	    else
+		pj_hash_set(NULL, ht, keys[idx], PJ_HASH_KEY_STRING, 0, NULL);
+	    values[idx] = 0;
+	    --count;
+	} else if (!values[idx]) {
+	    values[idx] = round + 1;
+	    pj_hash_set_np_lower(ht, keys[idx], PJ_HASH_KEY_STRING, 0,
+				 entry_buf[idx], &values[idx]);
+	    ++count;
+	}
+
+	entry = pj_hash_get_lower(ht, keys[idx], PJ_HASH_KEY_STRING, NULL);
+	if (entry != (values[idx] ? &values[idx] : NULL))
+	    return -310;
+
+	if (pj_hash_count(ht) != count)
+	    return -320;
+    }
+
+    for (i=0; i<KEYS; ++i) {
+	void *entry = pj_hash_get_lower(ht, keys[i], PJ_HASH_KEY_STRING, 
+					NULL);
+	if (entry != (values[i] ? &values[i] : NULL))
+	    return -330;
+    }
+
+    /* Delete every other entry while iterating */
+    i = 0;
+    it = pj_hash_first(ht, &it_buf);
+    while (it) {
+	unsigned *value = (unsigned*) pj_hash_this(ht, it);
+	unsigned idx = (unsigned)(value - values);
+
+	if (!*value)
+	    return -340;
+	if (i++ & 1) {
+	    pj_hash_set(NULL, ht, keys[idx], PJ_HASH_KEY_STRING, 0, NULL);
+	    *value = 0;
+	    --count;
+	}
+	it = pj_hash_next(ht, it);
+    }
+
+    if (i != count + i/2 || pj_hash_count(ht) != count)
+	return -350;
+
+    return 0;
+}
+
+
+#if INCLUDE_HASH_BENCHMARK
+/*
+ * Compare the speed of the chained and open addressing tables when the
+ * table holds many more entries than its initial size.
+ */
+static int hash_benchmark(pj_pool_t *pool, unsigned options,
+			  const char *title)
+{
+    enum {
+	INITIAL_SIZE = 511,
+	COUNT = 64000,
+	LOOKUPS = 1000000
+    };
+    pj_hash_table_t *ht;
+    pj_hash_entry_buf *entry_buf;
+    char (*keys)[24];
+    pj_timestamp t0, t1, t2;
+    unsigned i, found = 0;
+
+    ht = pj_hash_create2(pool, INITIAL_SIZE, options);
+    keys = (char(*)[24]) pj_pool_alloc(pool, COUNT * 24);
+    entry_buf = (pj_hash_entry_buf*)
+		pj_pool_alloc(pool, COUNT * sizeof(pj_hash_entry_buf));
+    if (!ht || !keys || !entry_buf)
+	return -400;
+
+    for (i=0; i<COUNT; ++i) {
+	pj_ansi_snprintf(keys[i], sizeof(keys[i]), "z9hG4bK%08x%u",
+			 pj_rand(), i);
+    }
+
+    pj_get_timestamp(&t0);
+    for (i=0; i<COUNT; ++i) {
+	pj_hash_set_np_lower(ht, keys[i], PJ_HASH_KEY_STRING, 0,
+			     entry_buf[i], keys[i]);
+    }
+    pj_get_timestamp(&t1);
+    for (i=0; i<LOOKUPS; ++i) {
+	if (pj_hash_get_lower(ht, keys[i % COUNT], PJ_HASH_KEY_STRING, NULL))
+	    ++found;
+    }
+    pj_get_timestamp(&t2);
+
+    if (found != LOOKUPS)
+	return -410;
+
+    PJ_LOG(3,("hash_test", "  %s: %u inserts in %u usec, "
+	      "%u lookups in %u usec", title,
+	      COUNT, pj_elapsed_usec(&t0, &t1),
+	      LOOKUPS, pj_elapsed_usec(&t1, &t2)));
+
+    return 0;
+}
+#endif	/* INCLUDE_HASH_BENCHMARK */
+
+
 /*
  * Hash table test.
  */
 int hash_test(void)
 {
+    static const unsigned options[] = { 0, PJ_HASH_OPT_OPEN_ADDRESSING };
     pj_pool_t *pool = pj_pool_create(mem, "hash", 512, 512, NULL);
     int rc;
-    unsigned i;
+    unsigned i, j;
+
+    for (j=0; j<PJ_ARRAY_SIZE(options); ++j) {
+	/* Test to fill in each row in the table */
+	for (i=0; i<=HASH_COUNT; ++i) {
+	    rc = hash_test_with_key(pool, options[j], (unsigned char)i);
+	    if (rc != 0) {
+		pj_pool_release(pool);
+		return rc;
+	    }
+	}
 
-    /* Test to fill in each row in the table */
-    for (i=0; i<=HASH_COUNT; ++i) {
-	rc = hash_test_with_key(pool, (unsigned char)i);
+	/* Collision test */
+	rc = hash_collision_test(pool, options[j]);
 	if (rc != 0) {
 	    pj_pool_release(pool);
 	    return rc;
 	}
     }
 
-    /* Collision test */
-    rc = hash_collision_test(pool);
+    /* Growing and rehashing */
+    rc = hash_churn_test(pool);
     if (rc != 0) {
 	pj_pool_release(pool);
 	return rc;
     }
 
+#if INCLUDE_HASH_BENCHMARK
+    rc = hash_benchmark(pool, 0, "chained        ");
+    if (rc == 0)
+	rc = hash_benchmark(pool, PJ_HASH_OPT_OPEN_ADDRESSING, 
+			    "open addressing");
+    if (rc != 0) {
+	pj_pool_release(pool);
+	return rc;
+    }
+#endif
+
     pj_pool_release(pool);
     return 0;
 }
 
 #endif	/* INCLUDE_HASH_TEST */
-
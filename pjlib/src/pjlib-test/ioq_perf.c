@@ -228,7 +228,7 @@ static int perform_test(pj_bool_t allow_concur,
                         pj_size_t buffer_size, 
                         pj_size_t *p_bandwidth)
 {
-    enum { MSEC_DURATION = 5000 };
+    enum { MSEC_DURATION = 1000 };
     pj_pool_t *pool;
     test_item *items;
     pj_thread_t **thread;
@@ -390,7 +390,7 @@ static int perform_test(pj_bool_t allow_concur,
 	    break;
 	}
 
-	if (pj_elapsed_usec(&start,&stop)<MSEC_DURATION * 1000) {
+	if (pj_elapsed_usec(&start,&stop) >= MSEC_DURATION * 1000) {
 	    TRACE_((THIS_FILE, "      time limit reached.."));
 	    break;
 	}
@@ -428,7 +428,7 @@ static int perform_test(pj_bool_t allow_concur,
     /* Calculate total bytes received. */
     total_received = 0;
     for (i=0; i<sockpair_cnt; ++i) {
-        total_received = (pj_uint32_t)items[i].bytes_recv;
+        total_received += (pj_uint32_t)items[i].bytes_recv;
     }
 
     /* bandwidth = total_received*1000/total_elapsed_usec */
@@ -548,6 +548,48 @@ static int ioqueue_perf_test_imp(pj_bool_t allow_concur)
     return 0;
 }
 
+/*
+ * Measure how the ioqueue dispatch scales with the number of polling
+ * threads, with a fixed number of socket pairs.
+ */
+static int ioqueue_perf_scaling_test(void)
+{
+    enum { BUF_SIZE = 512, SOCKPAIR_CNT = 16, MAX_THREADS = 16 };
+    unsigned thread_cnt;
+    pj_size_t base_bandwidth = 0;
+    int rc;
+
+    PJ_LOG(3,(THIS_FILE, "   Thread scaling of %s ioqueue "
+			 "(%d udp socket pairs):",
+			 pj_ioqueue_name(), SOCKPAIR_CNT));
+    PJ_LOG(3,(THIS_FILE, "   ======================================="));
+    PJ_LOG(3,(THIS_FILE, "   Type  Threads  Skt.Pairs      Bandwidth"));
+    PJ_LOG(3,(THIS_FILE, "   ======================================="));
+
+    for (thread_cnt=1; thread_cnt<=MAX_THREADS; thread_cnt*=2) {
+	pj_size_t bandwidth;
+
+	rc = perform_test(PJ_TRUE, pj_SOCK_DGRAM(), "udp", thread_cnt,
+			  SOCKPAIR_CNT, BUF_SIZE, &bandwidth);
+	if (rc != 0)
+	    return rc;
+
+	if (thread_cnt == 1)
+	    base_bandwidth = bandwidth;
+
+	if (base_bandwidth) {
+	    PJ_LOG(3,(THIS_FILE, "   speed-up with %2d threads: %u.%02ux",
+		      thread_cnt, 
+		      (unsigned)(bandwidth / base_bandwidth),
+		      (unsigned)(bandwidth * 100 / base_bandwidth % 100)));
+	}
+
+	pj_thread_sleep(500);
+    }
+
+    return 0;
+}
+
 /*
  * main test entry.
  */
@@ -555,6 +597,10 @@ int ioqueue_perf_test(void)
 {
     int rc;
 
+    rc = ioqueue_perf_scaling_test();
+    if (rc != 0)
+	return rc;
+
     rc = ioqueue_perf_test_imp(PJ_TRUE);
     if (rc != 0)
 	return rc;
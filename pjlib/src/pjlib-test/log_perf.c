@@ -0,0 +1,314 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "test.h"
+
+/**
+ * \page page_pjlib_log_perf_test Test: Log Performance
+ *
+ * This file benchmarks the cost of a PJ_LOG() call at level 5, with the
+ * messages written synchronously and with the asynchronous log writer.
+ * The rings of the asynchronous writer are large enough to hold all the
+ * messages of a thread, so no message may be dropped. It also checks that
+ * a ring which is too small drops messages rather than blocking, that
+ * every message is either written or counted as dropped, and that the
+ * rings are released when the threads exit.
+ *
+ * This file is <b>pjlib-test/log_perf.c</b>
+ *
+ * \include pjlib-test/log_perf.c
+ */
+
+#if INCLUDE_LOG_PERF_TEST
+
+#include <pjlib.h>
+
+#define THIS_FILE	"log_perf.c"
+#define MAX_THREADS	4
+#define LOOP		5000
+
+/* Ring size to hold all the messages of a thread, which take less than
+ * 200 bytes each in the ring.
+ */
+#define BENCH_RING_SIZE	(LOOP * 200)
+
+/* The sink stands for the output device: it serializes the callers and
+ * copies the messages somewhere.
+ */
+static struct sink
+{
+    pj_mutex_t	*mutex;
+    unsigned	 count;
+    pj_log_func	*old_func;
+    char	 buf[PJ_LOG_MAX_SIZE * 4];
+} sink;
+
+static void sink_write(int level, const char *data, int len)
+{
+    int i;
+
+    PJ_UNUSED_ARG(level);
+
+    pj_mutex_lock(sink.mutex);
+    if (len > (int)sizeof(sink.buf))
+	len = sizeof(sink.buf);
+    pj_memcpy(sink.buf, data, len);
+    for (i=0; i<len; ++i) {
+	if (data[i] == '\n')
+	    ++sink.count;
+    }
+    pj_mutex_unlock(sink.mutex);
+}
+
+/* Send the log to the sink, results are printed with the original writer */
+static void sink_start(void)
+{
+    sink.count = 0;
+    sink.old_func = pj_log_get_log_func();
+    pj_log_set_log_func(&sink_write);
+}
+
+static void sink_stop(void)
+{
+    pj_log_set_log_func(sink.old_func);
+}
+
+static int log_worker(void *arg)
+{
+    unsigned i;
+
+    PJ_UNUSED_ARG(arg);
+
+    for (i=0; i<LOOP; ++i) {
+	PJ_LOG(5,(THIS_FILE, "Message %u from thread %p, some more text "
+		  "to make it the size of a usual trace line", i, arg));
+    }
+    return 0;
+}
+
+static int run_bench(pj_pool_t *pool, unsigned thread_cnt,
+		     pj_uint32_t *p_nsec)
+{
+    pj_thread_t *threads[MAX_THREADS];
+    pj_timestamp start, end;
+    unsigned i;
+
+    pj_get_timestamp(&start);
+    for (i=0; i<thread_cnt; ++i) {
+	pj_status_t status;
+
+	status = pj_thread_create(pool, "logperf", &log_worker,
+				  (void*)(pj_ssize_t)i, 0, 0, &threads[i]);
+	if (status != PJ_SUCCESS) {
+	    thread_cnt = i;
+	    break;
+	}
+    }
+    for (i=0; i<thread_cnt; ++i) {
+	pj_thread_join(threads[i]);
+	pj_thread_destroy(threads[i]);
+    }
+    pj_get_timestamp(&end);
+
+    if (thread_cnt == 0)
+	return -10;
+
+    /* Average time per call, the threads may share the CPUs */
+    *p_nsec = pj_elapsed_nanosec(&start, &end) / (thread_cnt * LOOP);
+    return 0;
+}
+
+static void ring_dtor(void *value)
+{
+    PJ_UNUSED_ARG(value);
+}
+
+static int async_bench(pj_pool_t *pool, unsigned thread_cnt,
+		       unsigned ring_size, pj_bool_t batch,
+		       pj_uint32_t *p_nsec, pj_log_async_stat *stat)
+{
+    pj_log_async_param prm;
+    pj_bool_t ring_reuse;
+    long tls;
+    pj_status_t status;
+    unsigned i;
+    int rc;
+
+    /* The rings are released when the threads exit, if the platform
+     * tells when a thread exits.
+     */
+    ring_reuse = (pj_thread_local_alloc2(&tls, &ring_dtor) == PJ_SUCCESS);
+    if (ring_reuse)
+	pj_thread_local_free(tls);
+
+    pj_log_async_param_default(&prm);
+    prm.ring_size = ring_size;
+    prm.batch = batch;
+
+    sink_start();
+    status = pj_log_async_start(mem, &prm);
+    if (status != PJ_SUCCESS) {
+	sink_stop();
+	return status==PJ_ENOTSUP ? 1 : -20;
+    }
+
+    rc = run_bench(pool, thread_cnt, p_nsec);
+
+    /* Wait until the writer thread has caught up, so that the number of
+     * calls matches the messages written.
+     */
+    for (i=0; i<200; ++i) {
+	unsigned count;
+
+	pj_log_async_get_stat(stat);
+	pj_mutex_lock(sink.mutex);
+	count = sink.count;
+	pj_mutex_unlock(sink.mutex);
+	if (count >= stat->written && (!ring_reuse || stat->rings == 0))
+	    break;
+	pj_thread_sleep(10);
+    }
+    pj_log_async_stop();
+    sink_stop();
+
+    if (rc != 0)
+	return rc;
+
+    if (stat->written + stat->dropped != thread_cnt * LOOP) {
+	PJ_LOG(3,(THIS_FILE, "...error: written=%u dropped=%u, expecting %u",
+		  stat->written, stat->dropped, thread_cnt * LOOP));
+	return -30;
+    }
+    if (sink.count != stat->written) {
+	PJ_LOG(3,(THIS_FILE, "...error: sink got %u messages, expecting %u",
+		  sink.count, stat->written));
+	return -40;
+    }
+    if (ring_reuse && stat->rings != 0) {
+	PJ_LOG(3,(THIS_FILE, "...error: %u rings not released after the "
+		  "threads have exited", stat->rings));
+	return -42;
+    }
+    if ((batch && stat->batches > stat->written) ||
+	(!batch && stat->batches != stat->written))
+    {
+	PJ_LOG(3,(THIS_FILE, "...error: %u messages written in %u calls",
+		  stat->written, stat->batches));
+	return -45;
+    }
+    return 0;
+}
+
+static int log_perf(pj_pool_t *pool)
+{
+    unsigned thread_cnt;
+    pj_log_async_stat stat;
+    pj_uint32_t nsec;
+    int rc;
+
+    for (thread_cnt=1; thread_cnt<=MAX_THREADS; thread_cnt*=2) {
+	pj_uint32_t sync_nsec, async_nsec;
+
+	sink_start();
+	rc = run_bench(pool, thread_cnt, &sync_nsec);
+	sink_stop();
+	if (rc != 0)
+	    return rc;
+	if (sink.count < thread_cnt * LOOP)
+	    return -50;
+
+	rc = async_bench(pool, thread_cnt, BENCH_RING_SIZE, PJ_FALSE,
+			 &async_nsec, &stat);
+	if (rc != 0)
+	    return rc;
+
+	/* Dropped messages would make the writer look faster */
+	if (stat.dropped) {
+	    PJ_LOG(3,(THIS_FILE, "...error: %u of %u messages dropped",
+		      stat.dropped, thread_cnt * LOOP));
+	    return -60;
+	}
+
+	PJ_LOG(3,(THIS_FILE, "..%u thread(s), %u level 5 messages each: "
+		  "sync=%u ns/call, async=%u ns/call",
+		  thread_cnt, LOOP, sync_nsec, async_nsec));
+    }
+
+    /* Batching joins the messages, but doesn't lose any */
+    rc = async_bench(pool, MAX_THREADS, BENCH_RING_SIZE, PJ_TRUE,
+		     &nsec, &stat);
+    if (rc != 0)
+	return rc;
+    if (stat.dropped) {
+	PJ_LOG(3,(THIS_FILE, "...error: %u of %u messages dropped",
+		  stat.dropped, MAX_THREADS * LOOP));
+	return -70;
+    }
+    PJ_LOG(3,(THIS_FILE, "..%u thread(s) with batching: async=%u ns/call, "
+	      "%u messages in %u calls", MAX_THREADS, nsec, stat.written,
+	      stat.batches));
+
+    /* A ring which can't keep up must drop messages, not block */
+    rc = async_bench(pool, MAX_THREADS, PJ_LOG_MAX_SIZE, PJ_FALSE,
+		     &nsec, &stat);
+    if (rc != 0)
+	return rc;
+    PJ_LOG(3,(THIS_FILE, "..small ring: %u ns/call, %u of %u dropped",
+	      nsec, stat.dropped, MAX_THREADS * LOOP));
+
+    return 0;
+}
+
+int log_perf_test(void)
+{
+    pj_pool_t *pool;
+    int old_level;
+    int rc;
+
+    PJ_LOG(3,(THIS_FILE, "Benchmarking logging.."));
+
+    pool = pj_pool_create(mem, NULL, 4000, 4000, NULL);
+    if (pj_mutex_create_simple(pool, "sink", &sink.mutex) != PJ_SUCCESS) {
+	pj_pool_release(pool);
+	return -1;
+    }
+
+    old_level = pj_log_get_level();
+    pj_log_set_level(5);
+
+    rc = log_perf(pool);
+
+    pj_log_set_level(old_level);
+
+    if (rc == 1) {
+	PJ_LOG(3,(THIS_FILE, "..asynchronous log writer is not supported"));
+	rc = 0;
+    }
+
+    pj_mutex_destroy(sink.mutex);
+    pj_pool_release(pool);
+    return rc;
+}
+
+#else
+/* To prevent warning about "translation unit is empty"
+ * when this test is disabled.
+ */
+int dummy_log_perf_test;
+#endif	/* INCLUDE_LOG_PERF_TEST */
@@ -118,6 +118,161 @@ static int pool_test_malloc_free()
 
 #endif /* PJ_SYMBIAN */
 
+/*
+ * Multithreaded benchmark: each thread repeatedly creates a pool from a
+ * shared caching pool, allocates a bit from it, and releases it. This is
+ * run with and without the per-thread cache of the caching pool.
+ */
+#define MT_MAX_THREADS	4
+#define MT_LOOP		200000
+#define MT_POOLS	4
+
+struct mt_param
+{
+    pj_caching_pool *cp;
+    int		     rc;
+};
+
+static int mt_worker(void *arg)
+{
+    struct mt_param *prm = (struct mt_param*) arg;
+    pj_pool_t *pools[MT_POOLS];
+    unsigned i, j;
+
+    for (i=0; i<MT_LOOP; i+=MT_POOLS) {
+	for (j=0; j<MT_POOLS; ++j) {
+	    pools[j] = pj_pool_create(&prm->cp->factory, "mt", 1000, 1000,
+				      NULL);
+	    if (!pools[j] || !pj_pool_alloc(pools[j], sizes[(i+j) % COUNT])) {
+		prm->rc = -1;
+		return -1;
+	    }
+	}
+	for (j=0; j<MT_POOLS; ++j)
+	    pj_pool_release(pools[j]);
+    }
+
+    return 0;
+}
+
+static void mt_dummy_dtor(void *value)
+{
+    PJ_UNUSED_ARG(value);
+}
+
+/* Run thread_cnt threads of mt_worker() and wait for them to exit */
+static int mt_run(pj_pool_t *pool, pj_caching_pool *cp, unsigned thread_cnt)
+{
+    pj_thread_t *threads[MT_MAX_THREADS];
+    struct mt_param prm[MT_MAX_THREADS];
+    unsigned i;
+    pj_status_t status;
+    int rc = 0;
+
+    for (i=0; i<thread_cnt; ++i) {
+	prm[i].cp = cp;
+	prm[i].rc = 0;
+	status = pj_thread_create(pool, "poolmt", &mt_worker, &prm[i],
+				  0, 0, &threads[i]);
+	if (status != PJ_SUCCESS) {
+	    rc = -20;
+	    thread_cnt = i;
+	    break;
+	}
+    }
+    for (i=0; i<thread_cnt; ++i) {
+	pj_thread_join(threads[i]);
+	pj_thread_destroy(threads[i]);
+	if (prm[i].rc != 0)
+	    rc = -30;
+    }
+
+    return rc;
+}
+
+static int mt_bench(unsigned thread_cnt, unsigned magazine_size,
+		    pj_uint32_t *p_msec)
+{
+    pj_caching_pool cp;
+    pj_pool_t *pool;
+    pj_timestamp start, end;
+    pj_status_t status;
+    int rc;
+
+    pool = pj_pool_create(mem, NULL, 4000, 4000, NULL);
+    pj_caching_pool_init(&cp, NULL, 0x100000);
+
+    if (magazine_size) {
+	status = pj_caching_pool_enable_thread_cache(&cp, magazine_size);
+	if (status != PJ_SUCCESS) {
+	    pj_caching_pool_destroy(&cp);
+	    pj_pool_release(pool);
+	    return status==PJ_ENOTSUP ? 1 : -10;
+	}
+    }
+
+    pj_get_timestamp(&start);
+    rc = mt_run(pool, &cp, thread_cnt);
+    pj_get_timestamp(&end);
+    *p_msec = pj_elapsed_msec(&start, &end);
+
+    if (rc == 0 && cp.used_count != 0)
+	rc = -40;
+
+    /* The caches of the threads that have exited are taken over by new
+     * threads, so the number of caches stays at the number of threads.
+     */
+    if (rc == 0 && magazine_size) {
+	long dummy_tls;
+
+	rc = mt_run(pool, &cp, thread_cnt);
+	if (rc == 0 &&
+	    pj_list_size(&cp.thread_cache_list) > thread_cnt &&
+	    pj_thread_local_alloc2(&dummy_tls, &mt_dummy_dtor) == PJ_SUCCESS)
+	{
+	    pj_thread_local_free(dummy_tls);
+	    rc = -50;
+	}
+    }
+
+    if (magazine_size)
+	pj_pool_factory_dump(&cp.factory, PJ_FALSE);
+
+    pj_caching_pool_destroy(&cp);
+    pj_pool_release(pool);
+    return rc;
+}
+
+static int pool_mt_perf_test(void)
+{
+    unsigned thread_cnt;
+
+    PJ_LOG(3, (THIS_FILE, "Benchmarking multithreaded caching pool.."));
+
+    for (thread_cnt=1; thread_cnt<=MT_MAX_THREADS; thread_cnt*=2) {
+	pj_uint32_t shared_msec, cached_msec;
+	int rc;
+
+	rc = mt_bench(thread_cnt, 0, &shared_msec);
+	if (rc != 0)
+	    return rc;
+
+	rc = mt_bench(thread_cnt, 16, &cached_msec);
+	if (rc == 1) {
+	    PJ_LOG(3, (THIS_FILE, "..thread cache is not supported"));
+	    return 0;
+	} else if (rc != 0) {
+	    return rc;
+	}
+
+	PJ_LOG(3, (THIS_FILE, "..%u thread(s), %u create/release each: "
+			      "shared=%u ms, thread cache=%u ms",
+			      thread_cnt, MT_LOOP, shared_msec, cached_msec));
+    }
+
+    return 0;
+}
+
 int pool_perf_test()
 {
     unsigned i;
@@ -186,6 +341,10 @@ int pool_perf_test()
     PJ_LOG(3, (THIS_FILE, "..pool speedup over malloc best=%dx, worst=%dx", 
 			  (int)(malloc_time/best),
 			  (int)(malloc_time/worst)));
+
+    if (pool_mt_perf_test())
+	return 8;
+
     return 0;
 }
 
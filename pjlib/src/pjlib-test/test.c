@@ -95,6 +95,10 @@ int test_inner(void)
     DO_TEST( pool_perf_test() );
 #endif
 
+#if INCLUDE_LOG_PERF_TEST
+    DO_TEST( log_perf_test() );
+#endif
+
 #if INCLUDE_STRING_TEST
     DO_TEST( string_test() );
 #endif
@@ -40,6 +40,7 @@
 #define INCLUDE_HASH_TEST	    GROUP_DATA_STRUCTURE
 #define INCLUDE_POOL_TEST	    GROUP_LIBC
 #define INCLUDE_POOL_PERF_TEST	    GROUP_LIBC
+#define INCLUDE_LOG_PERF_TEST	    (PJ_HAS_THREADS && GROUP_LIBC)
 #define INCLUDE_STRING_TEST	    GROUP_DATA_STRUCTURE
 #define INCLUDE_FIFOBUF_TEST	    0	// GROUP_DATA_STRUCTURE
 #define INCLUDE_RBTREE_TEST	    GROUP_DATA_STRUCTURE
@@ -82,6 +83,7 @@ extern int hash_test(void);
 extern int os_test(void);
 extern int pool_test(void);
 extern int pool_perf_test(void);
+extern int log_perf_test(void);
 extern int string_test(void);
 extern int fifobuf_test(void);
 extern int timer_test(void);
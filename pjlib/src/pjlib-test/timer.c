@@ -51,7 +51,12 @@ static void timer_callback(pj_timer_heap_t *ht, pj_timer_entry *e)
     PJ_UNUSED_ARG(e);
 }
 
-static int test_timer_heap(void)
+static const char *engine_name(pj_timer_engine engine)
+{
+    return engine==PJ_TIMER_ENGINE_WHEEL ? "wheel" : "heap";
+}
+
+static int test_timer_heap(pj_timer_engine engine)
 {
     int i, j;
     pj_timer_entry *entry;
@@ -63,7 +68,7 @@ static int test_timer_heap(void)
     pj_size_t size;
     unsigned count;
 
-    PJ_LOG(3,("test", "...Basic test"));
+    PJ_LOG(3,("test", "...Basic test (%s)", engine_name(engine)));
 
     size = pj_timer_heap_mem_size(MAX_COUNT)+MAX_COUNT*sizeof(pj_timer_entry);
     pool = pj_pool_create( mem, NULL, size, 4000, NULL);
@@ -80,7 +85,7 @@ static int test_timer_heap(void)
     for (i=0; i<MAX_COUNT; ++i) {
 	entry[i].cb = &timer_callback;
     }
-    status = pj_timer_heap_create(pool, MAX_COUNT, &timer);
+    status = pj_timer_heap_create2(pool, MAX_COUNT, engine, &timer);
     if (status != PJ_SUCCESS) {
         app_perror("...error: unable to create timer heap", status);
 	return -30;
@@ -180,6 +185,180 @@ static int test_timer_heap(void)
 	    break;
     }
 
+    pj_timer_heap_destroy(timer);
+    pj_pool_release(pool);
+    return err;
+}
+
+
+/*************
+ * Benchmark *
+ *************
+ * Schedule a large number of entries with random delays, then cancel
+ * them all, to compare schedule/cancel cost of the timer engines.
+ */
+#define BENCH_ENTRY_COUNT	    100000
+#define BENCH_MAX_DELAY_SEC	    3600
+
+static int timer_bench(pj_timer_engine engine)
+{
+    pj_timer_entry *entries;
+    pj_pool_t *pool;
+    pj_timer_heap_t *timer;
+    pj_lock_t *lock;
+    pj_timestamp t1, t2, t3;
+    pj_status_t status;
+    unsigned i;
+    int err = 0;
+
+    pool = pj_pool_create(mem, NULL, 4000, 4000, NULL);
+    if (!pool)
+	return -200;
+
+    entries = (pj_timer_entry*)pj_pool_calloc(pool, BENCH_ENTRY_COUNT,
+					      sizeof(*entries));
+    if (!entries) {
+	err = -210;
+	goto on_return;
+    }
+
+    status = pj_timer_heap_create2(pool, 1000, engine, &timer);
+    if (status != PJ_SUCCESS) {
+        app_perror("...error: unable to create timer heap", status);
+	err = -220;
+	goto on_return;
+    }
+
+    /* Use the same kind of lock as pjsip endpoint for fair comparison */
+    status = pj_lock_create_recursive_mutex(pool, "bench", &lock);
+    if (status != PJ_SUCCESS) {
+	pj_timer_heap_destroy(timer);
+	err = -225;
+	goto on_return;
+    }
+    pj_timer_heap_set_lock(timer, lock, PJ_TRUE);
+
+    pj_get_timestamp(&t1);
+    for (i=0; i<BENCH_ENTRY_COUNT; ++i) {
+	pj_time_val delay;
+
+	delay.sec = 1 + pj_rand() % BENCH_MAX_DELAY_SEC;
+	delay.msec = pj_rand() % 1000;
+	pj_timer_entry_init(&entries[i], 0, NULL, &timer_callback);
+	if (pj_timer_heap_schedule(timer, &entries[i], &delay) != 0) {
+	    err = -230;
+	    break;
+	}
+    }
+    pj_get_timestamp(&t2);
+
+    /* Cancel in random-ish order */
+    for (i=0; i<BENCH_ENTRY_COUNT && !err; ++i) {
+	unsigned idx = (i * 7919) % BENCH_ENTRY_COUNT;
+	if (pj_timer_heap_cancel(timer, &entries[idx]) != 1) {
+	    err = -240;
+	    break;
+	}
+    }
+    pj_get_timestamp(&t3);
+
+    if (!err && pj_timer_heap_count(timer) != 0)
+	err = -250;
+
+    if (!err) {
+	PJ_LOG(3,("test", "...Benchmark (%s): %d entries, schedule=%d ms, "
+		  "cancel=%d ms", engine_name(engine), BENCH_ENTRY_COUNT,
+		  pj_elapsed_msec(&t1, &t2), pj_elapsed_msec(&t2, &t3)));
+    }
+
+    pj_timer_heap_destroy(timer);
+
+on_return:
+    pj_pool_release(pool);
+    return err;
+}
+
+
+/**************
+ * Lock test  *
+ **************
+ * Check that the lock set with pj_timer_heap_set_lock() serializes the
+ * timer heap operations: a thread scheduling an entry must block while
+ * the lock is held by another thread.
+ */
+struct lock_test_param
+{
+    pj_timer_heap_t *timer;
+    pj_timer_entry   entry;
+    pj_bool_t	     done;
+};
+
+static int lock_test_worker(void *arg)
+{
+    struct lock_test_param *prm = (struct lock_test_param*)arg;
+    pj_time_val delay = { 10, 0 };
+
+    pj_timer_heap_schedule(prm->timer, &prm->entry, &delay);
+    prm->done = PJ_TRUE;
+    return 0;
+}
+
+static int timer_lock_test(pj_timer_engine engine)
+{
+    struct lock_test_param prm;
+    pj_pool_t *pool;
+    pj_lock_t *lock;
+    pj_thread_t *thread;
+    pj_status_t status;
+    int err = 0;
+
+    PJ_LOG(3,("test", "...Lock test (%s)", engine_name(engine)));
+
+    pool = pj_pool_create(mem, NULL, 1000, 1000, NULL);
+    if (!pool)
+	return -260;
+
+    pj_bzero(&prm, sizeof(prm));
+    status = pj_timer_heap_create2(pool, 16, engine, &prm.timer);
+    if (status != PJ_SUCCESS) {
+	err = -262;
+	goto on_return;
+    }
+
+    status = pj_lock_create_recursive_mutex(pool, "tmrlock", &lock);
+    if (status != PJ_SUCCESS) {
+	pj_timer_heap_destroy(prm.timer);
+	err = -264;
+	goto on_return;
+    }
+    pj_timer_heap_set_lock(prm.timer, lock, PJ_TRUE);
+    pj_timer_entry_init(&prm.entry, 0, NULL, &timer_callback);
+
+    pj_lock_acquire(lock);
+    status = pj_thread_create(pool, "tmrlock", &lock_test_worker, &prm,
+			      0, 0, &thread);
+    if (status != PJ_SUCCESS) {
+	pj_lock_release(lock);
+	pj_timer_heap_destroy(prm.timer);
+	err = -266;
+	goto on_return;
+    }
+
+    pj_thread_sleep(200);
+    if (prm.done)
+	err = -268;
+    pj_lock_release(lock);
+
+    pj_thread_join(thread);
+    pj_thread_destroy(thread);
+
+    if (!err && (!prm.done || pj_timer_heap_count(prm.timer) != 1))
+	err = -270;
+
+    pj_timer_heap_cancel(prm.timer, &prm.entry);
+    pj_timer_heap_destroy(prm.timer);
+
+on_return:
     pj_pool_release(pool);
     return err;
 }
@@ -305,7 +484,7 @@ static int cancel_worker(void *arg)
     return 0;
 }
 
-static int timer_stress_test(void)
+static int timer_stress_test(pj_timer_engine engine)
 {
     int i;
     pj_timer_entry *entries = NULL;
@@ -319,8 +498,9 @@ static int timer_stress_test(void)
     pj_thread_t **cancel_threads = NULL;
     struct thread_param tparam = {0};
     pj_time_val now;
+    unsigned total[2] = {0, 0};
 
-    PJ_LOG(3,("test", "...Stress test"));
+    PJ_LOG(3,("test", "...Stress test (%s)", engine_name(engine)));
 
     pj_gettimeofday(&now);
     pj_srand(now.sec);
@@ -333,21 +513,26 @@ static int timer_stress_test(void)
     }
 
     /* Create timer heap */
-    status = pj_timer_heap_create(pool, ST_ENTRY_COUNT, &timer);
+    status = pj_timer_heap_create2(pool, ST_ENTRY_COUNT, engine, &timer);
     if (status != PJ_SUCCESS) {
         app_perror("...error: unable to create timer heap", status);
 	err = -20;
 	goto on_return;
     }
 
-    /* Set recursive lock for the timer heap. */
+    /* Set recursive lock for the timer heap. The wheel is left with its
+     * internal shard locks, to stress them.
+     */
     status = pj_lock_create_recursive_mutex( pool, "lock", &timer_lock);
     if (status != PJ_SUCCESS) {
         app_perror("...error: unable to create lock", status);
 	err = -30;
 	goto on_return;
     }
-    pj_timer_heap_set_lock(timer, timer_lock, PJ_TRUE);
+    if (engine == PJ_TIMER_ENGINE_HEAP)
+	pj_timer_heap_set_lock(timer, timer_lock, PJ_TRUE);
+    else
+	pj_lock_destroy(timer_lock);
 
     /* Create group locks for the timer entry. */
     if (ST_ENTRY_GROUP_LOCK_COUNT) {
@@ -456,10 +641,14 @@ on_return:
     }
     
     for (i=0; i<ST_POLL_THREAD_COUNT+ST_CANCEL_THREAD_COUNT; ++i) {
-	PJ_LOG(3,("test", "...Thread #%d (%s) executed %d entries",
+	PJ_LOG(4,("test", "...Thread #%d (%s) executed %d entries",
 		  i, (tparam.stat[i].is_poll? "poll":"cancel"),
 		  tparam.stat[i].cnt));
+	total[tparam.stat[i].is_poll ? 0 : 1] += tparam.stat[i].cnt;
     }
+    PJ_LOG(3,("test", "...Stress test (%s): %d entries expired, "
+	      "%d entries cancelled", engine_name(engine), total[0],
+	      total[1]));
 
     for (i=0; i<ST_ENTRY_COUNT; ++i) {
 	pj_timer_heap_cancel_if_active(timer, &entries[i], 10);
@@ -487,15 +676,36 @@ on_return:
 
 int timer_test()
 {
+    static const pj_timer_engine engines[] =
+    {
+	PJ_TIMER_ENGINE_HEAP, PJ_TIMER_ENGINE_WHEEL
+    };
+    unsigned i;
     int rc;
 
-    rc = test_timer_heap();
-    if (rc != 0)
-	return rc;
+    for (i=0; i<PJ_ARRAY_SIZE(engines); ++i) {
+	rc = test_timer_heap(engines[i]);
+	if (rc != 0)
+	    return rc;
+    }
 
-    rc = timer_stress_test();
-    if (rc != 0)
-	return rc;
+    for (i=0; i<PJ_ARRAY_SIZE(engines); ++i) {
+	rc = timer_bench(engines[i]);
+	if (rc != 0)
+	    return rc;
+    }
+
+    for (i=0; i<PJ_ARRAY_SIZE(engines); ++i) {
+	rc = timer_lock_test(engines[i]);
+	if (rc != 0)
+	    return rc;
+    }
+
+    for (i=0; i<PJ_ARRAY_SIZE(engines); ++i) {
+	rc = timer_stress_test(engines[i]);
+	if (rc != 0)
+	    return rc;
+    }
 
     return 0;
 }
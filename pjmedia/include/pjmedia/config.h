@@ -84,6 +84,18 @@
 #   define PJMEDIA_CONF_USE_AGC    	    1
 #endif
 
+/**
+ * Specify whether the sample mixing and level adjustment functions in
+ * <pjmedia/mix.h> (used by the conference bridge) may use the SSE2/AVX2
+ * or NEON implementation when the CPU supports it. The implementation is
+ * selected at run-time, and gives the same result as the portable one.
+ *
+ * Default: 1 (enabled)
+ */
+#ifndef PJMEDIA_MIX_USE_SIMD
+#   define PJMEDIA_MIX_USE_SIMD	    1
+#endif
+
 
 /*
  * Types of sound stream backends.
@@ -0,0 +1,173 @@
+/* $Id$ */
+/* 
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA 
+ */
+#ifndef __PJMEDIA_MIX_H__
+#define __PJMEDIA_MIX_H__
+
+
+/**
+ * @file mix.h
+ * @brief Sample mixing and level adjustment.
+ */
+#include <pjmedia/types.h>
+
+
+/**
+ * @defgroup PJMEDIA_MIX Sample Mixing and Level Adjustment
+ * @ingroup PJMEDIA_FRAME_OP
+ * @brief Mixing, level adjustment and level measurement of PCM samples
+ * @{
+ *
+ * These are the per-sample operations of the conference bridge. They
+ * operate on 16-bit PCM samples and on 32-bit mixing buffers, and use
+ * SSE2/AVX2 or NEON instructions when available (see
+ * #PJMEDIA_MIX_USE_SIMD). All implementations give exactly the same
+ * result.
+ *
+ * Level adjustments are expressed the way the conference bridge does,
+ * i.e. as a multiplier where 128 means no adjustment: a sample is
+ * adjusted as (sample * level) >> 7, and clipped to 16-bit.
+ */
+
+
+PJ_BEGIN_DECL
+
+
+/**
+ * Implementations of the mixing functions.
+ */
+typedef enum pjmedia_mix_impl
+{
+    /** Select the best implementation supported by the CPU. */
+    PJMEDIA_MIX_IMPL_AUTO,
+
+    /** Portable C implementation. */
+    PJMEDIA_MIX_IMPL_SCALAR,
+
+    /** SSE2 implementation. */
+    PJMEDIA_MIX_IMPL_SSE2,
+
+    /** AVX2 implementation. */
+    PJMEDIA_MIX_IMPL_AVX2,
+
+    /** NEON implementation. */
+    PJMEDIA_MIX_IMPL_NEON
+
+} pjmedia_mix_impl;
+
+
+/**
+ * Select the implementation of the mixing functions. Normally there is
+ * no need to call this function, since the best implementation is
+ * selected automatically. This is mainly useful for testing.
+ *
+ * @param impl		The implementation.
+ *
+ * @return		PJ_SUCCESS, or PJ_ENOTSUP if the implementation is
+ *			not available in this build or on this CPU.
+ */
+PJ_DECL(pj_status_t) pjmedia_mix_set_impl(pjmedia_mix_impl impl);
+
+
+/**
+ * Calculate the sum of the absolute value of the samples.
+ *
+ * @param src		The 16-bit PCM samples.
+ * @param count		Number of samples.
+ *
+ * @return		The sum of absolute sample values.
+ */
+PJ_DECL(pj_uint32_t) pjmedia_sum_abs_samples(const pj_int16_t *src,
+					     unsigned count);
+
+
+/**
+ * Adjust the level of the samples, with clipping.
+ *
+ * @param dst		Buffer to receive the adjusted samples. This may
+ *			be the same as src.
+ * @param src		The 16-bit PCM samples.
+ * @param count		Number of samples.
+ * @param level		Level adjustment, 128 means no adjustment.
+ *
+ * @return		The sum of absolute value of the adjusted samples.
+ */
+PJ_DECL(pj_uint32_t) pjmedia_scale_samples(pj_int16_t *dst,
+					   const pj_int16_t *src,
+					   unsigned count,
+					   unsigned level);
+
+
+/**
+ * Initialize a mixing buffer with the samples.
+ *
+ * @param mix		The 32-bit mixing buffer.
+ * @param src		The 16-bit PCM samples.
+ * @param count		Number of samples.
+ */
+PJ_DECL(void) pjmedia_mix_copy_samples(pj_int32_t *mix,
+				       const pj_int16_t *src,
+				       unsigned count);
+
+
+/**
+ * Add the samples to a mixing buffer, and find the lowest and highest
+ * value in the mixing buffer.
+ *
+ * @param mix		The 32-bit mixing buffer.
+ * @param src		The 16-bit PCM samples.
+ * @param count		Number of samples.
+ * @param p_min		On input, the current minimum value. On output, it
+ *			is lowered to the lowest mixed value if necessary.
+ * @param p_max		On input, the current maximum value. On output, it
+ *			is raised to the highest mixed value if necessary.
+ */
+PJ_DECL(void) pjmedia_mix_add_samples(pj_int32_t *mix,
+				      const pj_int16_t *src,
+				      unsigned count,
+				      pj_int32_t *p_min,
+				      pj_int32_t *p_max);
+
+
+/**
+ * Convert a mixing buffer to 16-bit PCM samples, adjusting the level
+ * with clipping.
+ *
+ * @param dst		Buffer to receive the 16-bit PCM samples. This may
+ *			point to the mixing buffer itself.
+ * @param mix		The 32-bit mixing buffer.
+ * @param count		Number of samples.
+ * @param level		Level adjustment, 128 means no adjustment.
+ *
+ * @return		The sum of absolute value of the output samples.
+ */
+PJ_DECL(pj_uint32_t) pjmedia_mix_store_samples(pj_int16_t *dst,
+					       const pj_int32_t *mix,
+					       unsigned count,
+					       unsigned level);
+
+
+PJ_END_DECL
+
+
+/**
+ * @}
+ */
+
+
+#endif	/* __PJMEDIA_MIX_H__ */
@@ -20,6 +20,7 @@
 #include <pjmedia/conference.h>
 #include <pjmedia/alaw_ulaw.h>
 #include <pjmedia/errno.h>
+#include <pjmedia/mix.h>
 #include <pjmedia/port.h>
 #include <pjmedia/silencedet.h>
 #include <pjmedia/sound_port.h>
@@ -1107,24 +1108,8 @@ static pj_status_t write_frame(struct conf_port *cport_dst,
 
 	    /* Adjust TX level. */
 	    if (cport_dst->tx_adj_level != NORMAL_LEVEL) {
-		pj_int16_t *p, *p_end;
-
-		p = f_start;
-		p_end = p + nsamples_to_copy;
-		while (p < p_end) {
-		    pj_int32_t itemp = *p;
-
-		    /* Adjust the level */
-		    itemp = (itemp * cport_dst->tx_adj_level) >> 7;
-
-		    /* Clip the signal if it's too loud */
-		    if (itemp > MAX_LEVEL) itemp = MAX_LEVEL;
-		    else if (itemp < MIN_LEVEL) itemp = MIN_LEVEL;
-
-		    /* Put back in the buffer. */
-		    *p = (pj_int16_t)itemp;
-		    ++p;
-		}
+		pjmedia_scale_samples(f_start, f_start, nsamples_to_copy,
+				      cport_dst->tx_adj_level);
 	    }
 
 	    pjmedia_copy_samples((pj_int16_t*)frm_dst->buf + (frm_dst->size>>1),
@@ -1287,26 +1272,10 @@ static pj_status_t get_frame(pjmedia_port *this_port,
 	    /* Calculate & adjust RX level. */
 	    if (f->type == PJMEDIA_FRAME_TYPE_AUDIO) {
 		if (cport->rx_adj_level != NORMAL_LEVEL) {
-		    pj_int16_t *p = (pj_int16_t*)f->buf;
-		    pj_int16_t *end;
-
-		    end = p + (f->size >> 1);
-		    while (p < end) {
-			pj_int32_t itemp = *p;
-
-			/* Adjust the level */
-			itemp = (itemp * cport->rx_adj_level) >> 7;
-
-			/* Clip the signal if it's too loud */
-			if (itemp > MAX_LEVEL) itemp = MAX_LEVEL;
-			else if (itemp < MIN_LEVEL) itemp = MIN_LEVEL;
-
-			level += PJ_ABS(itemp);
-
-			/* Put back in the buffer. */
-			*p = (pj_int16_t)itemp;
-			++p;
-		    }
+		    level = pjmedia_scale_samples((pj_int16_t*)f->buf,
+						  (pj_int16_t*)f->buf,
+						  (unsigned)(f->size >> 1),
+						  cport->rx_adj_level);
 		    level /= (f->size >> 1);
 		} else {
 		    level = pjmedia_calc_avg_signal((const pj_int16_t*)f->buf,
@@ -1510,26 +1479,10 @@ static pj_status_t put_frame(pjmedia_port *this_port,
     /* Calculate & adjust RX level. */
     if (f->type == PJMEDIA_FRAME_TYPE_AUDIO) {
 	if (cport->rx_adj_level != NORMAL_LEVEL) {
-	    pj_int16_t *p = (pj_int16_t*)f->buf;
-	    pj_int16_t *end;
-
-	    end = p + (f->size >> 1);
-	    while (p < end) {
-		pj_int32_t itemp = *p;
-
-		/* Adjust the level */
-		itemp = (itemp * cport->rx_adj_level) >> 7;
-
-		/* Clip the signal if it's too loud */
-		if (itemp > MAX_LEVEL) itemp = MAX_LEVEL;
-		else if (itemp < MIN_LEVEL) itemp = MIN_LEVEL;
-
-		level += PJ_ABS(itemp);
-
-		/* Put back in the buffer. */
-		*p = (pj_int16_t)itemp;
-		++p;
-	    }
+	    level = pjmedia_scale_samples((pj_int16_t*)f->buf,
+					  (pj_int16_t*)f->buf,
+					  (unsigned)(f->size >> 1),
+					  cport->rx_adj_level);
 	    level /= (f->size >> 1);
 	} else {
 	    level = pjmedia_calc_avg_signal((const pj_int16_t*)f->buf,
@@ -21,6 +21,7 @@
 #include <pjmedia/alaw_ulaw.h>
 #include <pjmedia/delaybuf.h>
 #include <pjmedia/errno.h>
+#include <pjmedia/mix.h>
 #include <pjmedia/port.h>
 #include <pjmedia/resample.h>
 #include <pjmedia/silencedet.h>
@@ -28,7 +29,9 @@
 #include <pjmedia/stereo.h>
 #include <pj/array.h>
 #include <pj/assert.h>
+#include <pj/limits.h>
 #include <pj/log.h>
+#include <pj/os.h>
 #include <pj/pool.h>
 #include <pj/string.h>
 
@@ -225,6 +228,48 @@ struct conf_port
 };
 
 
+/*
+ * A connection in the mixing list.
+ */
+struct conf_mix_conn
+{
+    unsigned		 listener;	/**< Listener index in the list.    */
+    unsigned		 adj_level;	/**< Connection level adjustment.   */
+};
+
+
+/*
+ * A port in the mixing list.
+ */
+struct conf_mix_port
+{
+    unsigned		 slot;		/**< Slot number of the port.	    */
+    struct conf_port	*cport;		/**< The port.			    */
+    unsigned		 transmitter_cnt;/**<Number of transmitters.	    */
+    unsigned		 listener_cnt;	/**< Number of listeners.	    */
+    struct conf_mix_conn*listeners;	/**< Array of listeners.	    */
+};
+
+
+/*
+ * The mixing list is a compact snapshot of the ports and connections of
+ * the bridge, used by get_frame() without holding the conference mutex.
+ *
+ * The list is never modified once it has been published. Operations that
+ * change the ports or connections build a new list under the mutex and
+ * swap it in place of the current one. The old list is recycled once
+ * get_frame() has finished using it.
+ */
+struct conf_mix_list
+{
+    struct conf_mix_list *next;		/**< Next list in the free list.    */
+    unsigned		  port_cnt;	/**< Number of ports.		    */
+    struct conf_mix_port *ports;	/**< Array of ports.		    */
+    unsigned		  conn_cap;	/**< Capacity of conns array.	    */
+    struct conf_mix_conn *conns;	/**< Connections of all ports.	    */
+};
+
+
 /*
  * Conference bridge.
  */
@@ -243,6 +288,17 @@ struct pjmedia_conf
     unsigned		  channel_count;/**< Number of channels (1=mono).   */
     unsigned		  samples_per_frame;	/**< Samples per frame.	    */
     unsigned		  bits_per_sample;	/**< Bits per sample.	    */
+
+    pj_pool_t		 *mix_pool;	/**< Pool for the mixing lists.	    */
+    unsigned		 *mix_idx;	/**< Slot to mixing list index.	    */
+    struct conf_mix_list *mix_list;	/**< Current mixing list.	    */
+    struct conf_mix_list *mix_busy;	/**< List used by get_frame().	    */
+    struct conf_mix_list *mix_free;	/**< Recycled mixing lists.	    */
+    pj_thread_t		 *mix_thread;	/**< Thread running get_frame().    */
+    unsigned		  mix_tick;	/**< Number of get_frame() done.    */
+    pj_sem_t		 *mix_sem;	/**< Signalled when get_frame() is
+					     done, for wait_mix_list().	    */
+    unsigned		  mix_waiters;	/**< Number of wait_mix_list().	    */
 };
 
 
@@ -533,6 +589,146 @@ static pj_status_t create_sound_port( pj_pool_t *pool,
     return PJ_SUCCESS;
 }
 
+/*
+ * Get a mixing list that can hold all ports and connections of the bridge,
+ * recycling one from the free list whenever possible.
+ */
+static struct conf_mix_list *alloc_mix_list(pjmedia_conf *conf)
+{
+    struct conf_mix_list *ml, **p_ml;
+
+    for (p_ml = &conf->mix_free; *p_ml; p_ml = &(*p_ml)->next) {
+	if ((*p_ml)->conn_cap >= conf->connect_cnt) {
+	    ml = *p_ml;
+	    *p_ml = ml->next;
+	    return ml;
+	}
+    }
+
+    ml = PJ_POOL_ZALLOC_T(conf->mix_pool, struct conf_mix_list);
+    PJ_ASSERT_RETURN(ml, NULL);
+
+    ml->ports = (struct conf_mix_port*)
+		pj_pool_alloc(conf->mix_pool,
+			      conf->max_ports * sizeof(struct conf_mix_port));
+    PJ_ASSERT_RETURN(ml->ports, NULL);
+
+    /* Leave some room so that we don't grow on every new connection */
+    ml->conn_cap = conf->connect_cnt * 2;
+    if (ml->conn_cap < 16)
+	ml->conn_cap = 16;
+    ml->conns = (struct conf_mix_conn*)
+		pj_pool_alloc(conf->mix_pool,
+			      ml->conn_cap * sizeof(struct conf_mix_conn));
+    PJ_ASSERT_RETURN(ml->conns, NULL);
+
+    return ml;
+}
+
+
+/*
+ * Replace the current mixing list. Mutex must be held.
+ */
+static void publish_mix_list(pjmedia_conf *conf, struct conf_mix_list *ml)
+{
+    struct conf_mix_list *old = conf->mix_list;
+
+    conf->mix_list = ml;
+
+    /* The old list can be recycled right away unless get_frame() is still
+     * using it.
+     */
+    if (old && old != conf->mix_busy) {
+	old->next = conf->mix_free;
+	conf->mix_free = old;
+    }
+}
+
+
+/*
+ * Rebuild the mixing list after the ports or connections have changed,
+ * and publish it for the next get_frame(). Mutex must be held.
+ */
+static pj_status_t update_mix_list(pjmedia_conf *conf)
+{
+    struct conf_mix_list *ml;
+    unsigned i, ci, conn_cnt;
+
+    ml = alloc_mix_list(conf);
+    if (!ml) {
+	/* Never leave a stale list (which may refer to a removed port),
+	 * mix nothing until the next update instead.
+	 */
+	publish_mix_list(conf, NULL);
+	return PJ_ENOMEM;
+    }
+
+    /* Compact the ports */
+    for (i=0, ci=0; i<conf->max_ports && ci<conf->port_cnt; ++i) {
+	struct conf_mix_port *mp;
+
+	if (!conf->ports[i])
+	    continue;
+
+	conf->mix_idx[i] = ci;
+	mp = &ml->ports[ci++];
+	mp->slot = i;
+	mp->cport = conf->ports[i];
+	mp->transmitter_cnt = 0;
+    }
+    ml->port_cnt = ci;
+
+    /* Copy the connections */
+    for (i=0, conn_cnt=0; i<ml->port_cnt; ++i) {
+	struct conf_mix_port *mp = &ml->ports[i];
+	struct conf_port *cport = mp->cport;
+	unsigned j;
+
+	mp->listeners = &ml->conns[conn_cnt];
+	mp->listener_cnt = cport->listener_cnt;
+
+	for (j=0; j<cport->listener_cnt; ++j) {
+	    struct conf_mix_conn *conn = &ml->conns[conn_cnt++];
+
+	    pj_assert(conn_cnt <= ml->conn_cap);
+	    conn->listener = conf->mix_idx[cport->listener_slots[j]];
+	    conn->adj_level = cport->listener_adj_level[j];
+	    ++ml->ports[conn->listener].transmitter_cnt;
+	}
+    }
+
+    publish_mix_list(conf, ml);
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Wait until get_frame() stops using the mixing list that was current
+ * before the last update_mix_list(). Mutex must NOT be held.
+ */
+static void wait_mix_list(pjmedia_conf *conf, pj_bool_t busy, unsigned tick)
+{
+    /* Nothing to wait for, or we're called from get_frame() itself (e.g.
+     * by the callback of a port), which has already been made safe by
+     * checking the ports before using them.
+     */
+    if (!busy || conf->mix_thread == pj_thread_this())
+	return;
+
+    pj_mutex_lock(conf->mutex);
+    while (conf->mix_tick == tick) {
+	++conf->mix_waiters;
+	pj_mutex_unlock(conf->mutex);
+
+	pj_sem_wait(conf->mix_sem);
+
+	pj_mutex_lock(conf->mutex);
+    }
+    pj_mutex_unlock(conf->mutex);
+}
+
+
 /*
  * Create conference bridge.
  */
@@ -601,6 +797,28 @@ PJ_DEF(pj_status_t) pjmedia_conf_create( pj_pool_t *pool,
 	return status;
     }
 
+    status = pj_sem_create(pool, "confmix", 0, PJ_MAXINT32, &conf->mix_sem);
+    if (status != PJ_SUCCESS) {
+	pjmedia_conf_destroy(conf);
+	return status;
+    }
+
+    /* Create the mixing list. */
+    conf->mix_pool = pj_pool_create(pool->factory, "confmix", 1000, 1000,
+				    NULL);
+    conf->mix_idx = (unsigned*) pj_pool_zalloc(pool,
+					       max_ports * sizeof(unsigned));
+    if (!conf->mix_pool || !conf->mix_idx) {
+	pjmedia_conf_destroy(conf);
+	return PJ_ENOMEM;
+    }
+
+    status = update_mix_list(conf);
+    if (status != PJ_SUCCESS) {
+	pjmedia_conf_destroy(conf);
+	return status;
+    }
+
     /* If sound device was created, connect sound device to the
      * master port.
      */
@@ -677,6 +895,18 @@ PJ_DEF(pj_status_t) pjmedia_conf_destroy( pjmedia_conf *conf )
     if (conf->mutex)
 	pj_mutex_destroy(conf->mutex);
 
+    if (conf->mix_sem) {
+	pj_sem_destroy(conf->mix_sem);
+	conf->mix_sem = NULL;
+    }
+
+    /* Release the mixing lists */
+    if (conf->mix_pool) {
+	pj_pool_release(conf->mix_pool);
+	conf->mix_pool = NULL;
+	conf->mix_list = conf->mix_busy = conf->mix_free = NULL;
+    }
+
     return PJ_SUCCESS;
 }
 
@@ -803,6 +1033,14 @@ PJ_DEF(pj_status_t) pjmedia_conf_add_port( pjmedia_conf *conf,
     conf->ports[index] = conf_port;
     conf->port_cnt++;
 
+    status = update_mix_list(conf);
+    if (status != PJ_SUCCESS) {
+	conf->ports[index] = NULL;
+	conf->port_cnt--;
+	pj_mutex_unlock(conf->mutex);
+	return status;
+    }
+
     /* Done. */
     if (p_port) {
 	*p_port = index;
@@ -905,6 +1143,14 @@ PJ_DEF(pj_status_t) pjmedia_conf_add_passive_port( pjmedia_conf *conf,
     conf->ports[index] = conf_port;
     conf->port_cnt++;
 
+    status = update_mix_list(conf);
+    if (status != PJ_SUCCESS) {
+	conf->ports[index] = NULL;
+	conf->port_cnt--;
+	pj_mutex_unlock(conf->mutex);
+	return status;
+    }
+
     /* Done. */
     if (p_slot)
 	*p_slot = index;
@@ -965,6 +1211,7 @@ PJ_DEF(pj_status_t) pjmedia_conf_connect_port( pjmedia_conf *conf,
     struct conf_port *src_port, *dst_port;
     pj_bool_t start_sound = PJ_FALSE;
     unsigned i;
+    pj_status_t status;
 
     /* Check arguments */
     PJ_ASSERT_RETURN(conf && src_slot<conf->max_ports && 
@@ -1001,6 +1248,15 @@ PJ_DEF(pj_status_t) pjmedia_conf_connect_port( pjmedia_conf *conf,
 	++src_port->listener_cnt;
 	++dst_port->transmitter_cnt;
 
+	status = update_mix_list(conf);
+	if (status != PJ_SUCCESS) {
+	    --conf->connect_cnt;
+	    --src_port->listener_cnt;
+	    --dst_port->transmitter_cnt;
+	    pj_mutex_unlock(conf->mutex);
+	    return status;
+	}
+
 	if (conf->connect_cnt == 1)
 	    start_sound = 1;
 
@@ -1078,6 +1334,9 @@ PJ_DEF(pj_status_t) pjmedia_conf_disconnect_port( pjmedia_conf *conf,
 	/* if source port is passive port and has no listener, reset delaybuf */
 	if (src_port->delay_buf && src_port->listener_cnt == 0)
 	    pjmedia_delay_buf_reset(src_port->delay_buf);
+
+	/* On failure the bridge is just silent until the next update */
+	update_mix_list(conf);
     }
 
     pj_mutex_unlock(conf->mutex);
@@ -1113,7 +1372,8 @@ PJ_DEF(pj_status_t) pjmedia_conf_remove_port( pjmedia_conf *conf,
 					      unsigned port )
 {
     struct conf_port *conf_port;
-    unsigned i;
+    pj_bool_t busy;
+    unsigned i, tick;
 
     /* Check arguments */
     PJ_ASSERT_RETURN(conf && port < conf->max_ports, PJ_EINVAL);
@@ -1173,20 +1433,31 @@ PJ_DEF(pj_status_t) pjmedia_conf_remove_port( pjmedia_conf *conf,
 	--conf->connect_cnt;
     }
 
-    /* Destroy pjmedia port if this conf port is passive port,
-     * i.e: has delay buf.
-     */
-    if (conf_port->delay_buf) {
-	pjmedia_port_destroy(conf_port->port);
-	conf_port->port = NULL;
-    }
-
     /* Remove the port. */
     conf->ports[port] = NULL;
     --conf->port_cnt;
 
+    /* On failure the bridge is just silent until the next update */
+    update_mix_list(conf);
+
+    /* get_frame() may still be using the port from the old mixing list */
+    busy = (conf->mix_busy != NULL);
+    tick = conf->mix_tick;
+
     pj_mutex_unlock(conf->mutex);
 
+    wait_mix_list(conf, busy, tick);
+
+    /* Destroy pjmedia port if this conf port is passive port,
+     * i.e: has delay buf. The slot has been released, so do the job of
+     * destroy_port_pasv() here.
+     */
+    if (conf_port->delay_buf) {
+	pjmedia_delay_buf_destroy(conf_port->delay_buf);
+	conf_port->delay_buf = NULL;
+	conf_port->port = NULL;
+    }
+
 
     /* Stop sound if there's no connection. */
     if (conf->connect_cnt == 0) {
@@ -1417,6 +1688,7 @@ PJ_DEF(pj_status_t) pjmedia_conf_adjust_conn_level( pjmedia_conf *conf,
 {
     struct conf_port *src_port, *dst_port;
     unsigned i;
+    pj_status_t status;
 
     /* Check arguments */
     PJ_ASSERT_RETURN(conf && src_slot<conf->max_ports &&
@@ -1452,8 +1724,10 @@ PJ_DEF(pj_status_t) pjmedia_conf_adjust_conn_level( pjmedia_conf *conf,
     /* Set normalized adjustment level. */
     src_port->listener_adj_level[i] = adj_level + NORMAL_LEVEL;
 
+    status = update_mix_list(conf);
+
     pj_mutex_unlock(conf->mutex);
-    return PJ_SUCCESS;
+    return status;
 }
 
 
@@ -1612,11 +1886,12 @@ static pj_status_t read_port( pjmedia_conf *conf,
  * Write the mixed signal to the port.
  */
 static pj_status_t write_port(pjmedia_conf *conf, struct conf_port *cport,
+			      unsigned transmitter_cnt,
 			      const pj_timestamp *timestamp, 
 			      pjmedia_frame_type *frm_type)
 {
     pj_int16_t *buf;
-    unsigned j, ts;
+    unsigned ts;
     pj_status_t status;
     pj_int32_t adj_level;
     pj_int32_t tx_level;
@@ -1627,7 +1902,7 @@ static pj_status_t write_port(pjmedia_conf *conf, struct conf_port *cport,
     /* If port is muted or nobody is transmitting to this port, 
      * transmit NULL frame. 
      */
-    if (cport->tx_setting == PJMEDIA_PORT_MUTE || cport->transmitter_cnt==0) {
+    if (cport->tx_setting == PJMEDIA_PORT_MUTE || transmitter_cnt==0) {
 
 	pjmedia_frame frame;
 
@@ -1701,31 +1976,11 @@ static pj_status_t write_port(pjmedia_conf *conf, struct conf_port *cport,
     adj_level = cport->tx_adj_level * cport->mix_adj;
     adj_level >>= 7;
 
-    tx_level = 0;
-
-    if (adj_level != NORMAL_LEVEL) {
-	for (j=0; j<conf->samples_per_frame; ++j) {
-	    pj_int32_t itemp = cport->mix_buf[j];
-
-	    /* Adjust the level */
-	    /*itemp = itemp * adj_level / NORMAL_LEVEL;*/
-	    itemp = (itemp * adj_level) >> 7;
-
-	    /* Clip the signal if it's too loud */
-	    if (itemp > MAX_LEVEL) itemp = MAX_LEVEL;
-	    else if (itemp < MIN_LEVEL) itemp = MIN_LEVEL;
-
-	    /* Put back in the buffer. */
-	    buf[j] = (pj_int16_t) itemp;
-
-	    tx_level += (buf[j]>=0? buf[j] : -buf[j]);
-	}
-    } else {
-	for (j=0; j<conf->samples_per_frame; ++j) {
-	    buf[j] = (pj_int16_t) cport->mix_buf[j];
-	    tx_level += (buf[j]>=0? buf[j] : -buf[j]);
-	}
-    }
+    /* Convert to 16bit in place, and calculate the level at the same
+     * time. The mixed signal is clipped if it's too loud.
+     */
+    tx_level = pjmedia_mix_store_samples(buf, cport->mix_buf,
+					 conf->samples_per_frame, adj_level);
 
     tx_level /= conf->samples_per_frame;
 
@@ -1856,7 +2111,8 @@ static pj_status_t get_frame(pjmedia_port *this_port,
 {
     pjmedia_conf *conf = (pjmedia_conf*) this_port->port_data.pdata;
     pjmedia_frame_type speaker_frame_type = PJMEDIA_FRAME_TYPE_NONE;
-    unsigned ci, cj, i, j;
+    struct conf_mix_list *ml;
+    unsigned i, cj;
     pj_int16_t *p_in;
     
     TRACE_((THIS_FILE, "- clock -"));
@@ -1865,27 +2121,32 @@ static pj_status_t get_frame(pjmedia_port *this_port,
     pj_assert(frame->size == conf->samples_per_frame *
 			     conf->bits_per_sample / 8);
 
-    /* Must lock mutex */
+    /* Only hold the mutex to take the current mixing list. The list is
+     * not modified while we're using it, and ports removed in the mean
+     * time are kept valid until we're done (see pjmedia_conf_remove_port()).
+     */
     pj_mutex_lock(conf->mutex);
+    ml = conf->mix_busy = conf->mix_list;
+    conf->mix_thread = pj_thread_this();
+    pj_mutex_unlock(conf->mutex);
+
+    if (ml == NULL) {
+	frame->type = PJMEDIA_FRAME_TYPE_NONE;
+	goto on_return;
+    }
 
     /* Reset port source count. We will only reset port's mix
      * buffer when we have someone transmitting to it.
      */
-    for (i=0, ci=0; i<conf->max_ports && ci < conf->port_cnt; ++i) {
-	struct conf_port *conf_port = conf->ports[i];
-
-	/* Skip empty port. */
-	if (!conf_port)
-	    continue;
-
-	/* Var "ci" is to count how many ports have been visited so far. */
-	++ci;
+    for (i=0; i<ml->port_cnt; ++i) {
+	struct conf_mix_port *mp = &ml->ports[i];
+	struct conf_port *conf_port = mp->cport;
 
 	/* Reset buffer (only necessary if the port has transmitter) and
 	 * reset auto adjustment level for mixed signal.
 	 */
 	conf_port->mix_adj = NORMAL_LEVEL;
-	if (conf_port->transmitter_cnt) {
+	if (mp->transmitter_cnt) {
 	    pj_bzero(conf_port->mix_buf,
 		     conf->samples_per_frame*sizeof(conf_port->mix_buf[0]));
 	}
@@ -1894,17 +2155,11 @@ static pj_status_t get_frame(pjmedia_port *this_port,
     /* Get frames from all ports, and "mix" the signal 
      * to mix_buf of all listeners of the port.
      */
-    for (i=0, ci=0; i < conf->max_ports && ci < conf->port_cnt; ++i) {
-	struct conf_port *conf_port = conf->ports[i];
+    for (i=0; i < ml->port_cnt; ++i) {
+	struct conf_mix_port *mp = &ml->ports[i];
+	struct conf_port *conf_port = mp->cport;
 	pj_int32_t level = 0;
 
-	/* Skip empty port. */
-	if (!conf_port)
-	    continue;
-
-	/* Var "ci" is to count how many ports have been visited so far. */
-	++ci;
-
 	/* Skip if we're not allowed to receive from this port. */
 	if (conf_port->rx_setting == PJMEDIA_PORT_DISABLE) {
 	    conf_port->rx_level = 0;
@@ -1912,7 +2167,7 @@ static pj_status_t get_frame(pjmedia_port *this_port,
 	}
 
 	/* Also skip if this port doesn't have listeners. */
-	if (conf_port->listener_cnt == 0) {
+	if (mp->listener_cnt == 0) {
 	    conf_port->rx_level = 0;
 	    continue;
 	}
@@ -1954,7 +2209,7 @@ static pj_status_t get_frame(pjmedia_port *this_port,
 	    }
 
 	    /* Check that the port is not removed when we call get_frame() */
-	    if (conf->ports[i] == NULL) {
+	    if (conf->ports[mp->slot] != conf_port) {
 		conf_port->rx_level = 0;
 		continue;
 	    }
@@ -1973,32 +2228,10 @@ static pj_status_t get_frame(pjmedia_port *this_port,
 	 * and calculate the average level at the same time.
 	 */
 	if (conf_port->rx_adj_level != NORMAL_LEVEL) {
-	    for (j=0; j<conf->samples_per_frame; ++j) {
-		/* For the level adjustment, we need to store the sample to
-		 * a temporary 32bit integer value to avoid overflowing the
-		 * 16bit sample storage.
-		 */
-		pj_int32_t itemp;
-
-		itemp = p_in[j];
-		/*itemp = itemp * adj / NORMAL_LEVEL;*/
-		/* bad code (signed/unsigned badness):
-		 *  itemp = (itemp * conf_port->rx_adj_level) >> 7;
-		 */
-		itemp *= conf_port->rx_adj_level;
-		itemp >>= 7;
-
-		/* Clip the signal if it's too loud */
-		if (itemp > MAX_LEVEL) itemp = MAX_LEVEL;
-		else if (itemp < MIN_LEVEL) itemp = MIN_LEVEL;
-
-		p_in[j] = (pj_int16_t) itemp;
-		level += (p_in[j]>=0? p_in[j] : -p_in[j]);
-	    }
+	    level = pjmedia_scale_samples(p_in, p_in, conf->samples_per_frame,
+					  conf_port->rx_adj_level);
 	} else {
-	    for (j=0; j<conf->samples_per_frame; ++j) {
-		level += (p_in[j]>=0? p_in[j] : -p_in[j]);
-	    }
+	    level = pjmedia_sum_abs_samples(p_in, conf->samples_per_frame);
 	}
 
 	level /= conf->samples_per_frame;
@@ -2016,14 +2249,14 @@ static pj_status_t get_frame(pjmedia_port *this_port,
 	//    continue;
 
 	/* Add the signal to all listeners. */
-	for (cj=0; cj < conf_port->listener_cnt; ++cj) 
+	for (cj=0; cj < mp->listener_cnt; ++cj) 
 	{
-	    struct conf_port *listener;
+	    const struct conf_mix_conn *conn = &mp->listeners[cj];
+	    struct conf_mix_port *mp_listener = &ml->ports[conn->listener];
+	    struct conf_port *listener = mp_listener->cport;
 	    pj_int32_t *mix_buf;	    
 	    pj_int16_t *p_in_conn_leveled;
 
-	    listener = conf->ports[conf_port->listener_slots[cj]];
-
 	    /* Skip if this listener doesn't want to receive audio */
 	    if (listener->tx_setting != PJMEDIA_PORT_ENABLE)
 		continue;
@@ -2031,29 +2264,10 @@ static pj_status_t get_frame(pjmedia_port *this_port,
 	    mix_buf = listener->mix_buf;
 
 	    /* apply connection level, if not normal */
-	    if (conf_port->listener_adj_level[cj] != NORMAL_LEVEL) {
-		unsigned k = 0;
-		for (; k < conf->samples_per_frame; ++k) {
-		    /* For the level adjustment, we need to store the sample to
-		     * a temporary 32bit integer value to avoid overflowing the
-		     * 16bit sample storage.
-		     */
-		    pj_int32_t itemp;
-
-		    itemp = p_in[k];
-		    /*itemp = itemp * adj / NORMAL_LEVEL;*/
-		    /* bad code (signed/unsigned badness):
-		     *  itemp = (itemp * conf_port->listsener_adj_level) >> 7;
-		     */
-		    itemp *= conf_port->listener_adj_level[cj];
-		    itemp >>= 7;
-
-		    /* Clip the signal if it's too loud */
-		    if (itemp > MAX_LEVEL) itemp = MAX_LEVEL;
-		    else if (itemp < MIN_LEVEL) itemp = MIN_LEVEL;
-
-		    conf_port->adj_level_buf[k] = (pj_int16_t)itemp;
-		}
+	    if (conn->adj_level != NORMAL_LEVEL) {
+		pjmedia_scale_samples(conf_port->adj_level_buf, p_in,
+				      conf->samples_per_frame,
+				      conn->adj_level);
 
 		/* take the leveled frame */
 		p_in_conn_leveled = conf_port->adj_level_buf;
@@ -2062,22 +2276,17 @@ static pj_status_t get_frame(pjmedia_port *this_port,
 		p_in_conn_leveled = p_in;
 	    }
 
-	    if (listener->transmitter_cnt > 1) {
+	    if (mp_listener->transmitter_cnt > 1) {
 		/* Mixing signals,
 		 * and calculate appropriate level adjustment if there is
 		 * any overflowed level in the mixed signal.
 		 */
-		unsigned k, samples_per_frame = conf->samples_per_frame;
 		pj_int32_t mix_buf_min = 0;
 		pj_int32_t mix_buf_max = 0;
 
-		for (k = 0; k < samples_per_frame; ++k) {
-		    mix_buf[k] += p_in_conn_leveled[k];
-		    if (mix_buf[k] < mix_buf_min)
-			mix_buf_min = mix_buf[k];
-		    if (mix_buf[k] > mix_buf_max)
-			mix_buf_max = mix_buf[k];
-		}
+		pjmedia_mix_add_samples(mix_buf, p_in_conn_leveled,
+					conf->samples_per_frame,
+					&mix_buf_min, &mix_buf_max);
 
 		/* Check if normalization adjustment needed. */
 		if (mix_buf_min < MIN_LEVEL || mix_buf_max > MAX_LEVEL) {
@@ -2096,11 +2305,8 @@ static pj_status_t get_frame(pjmedia_port *this_port,
 		 * just copy the samples to the mix buffer
 		 * no mixing and level adjustment needed
 		 */
-		unsigned k, samples_per_frame = conf->samples_per_frame;
-
-		for (k = 0; k < samples_per_frame; ++k) {
-		    mix_buf[k] = p_in_conn_leveled[k];
-		}
+		pjmedia_mix_copy_samples(mix_buf, p_in_conn_leveled,
+					 conf->samples_per_frame);
 	    }
 	} /* loop the listeners of conf port */
     } /* loop of all conf ports */
@@ -2108,19 +2314,18 @@ static pj_status_t get_frame(pjmedia_port *this_port,
     /* Time for all ports to transmit whetever they have in their
      * buffer. 
      */
-    for (i=0, ci=0; i<conf->max_ports && ci<conf->port_cnt; ++i) {
-	struct conf_port *conf_port = conf->ports[i];
+    for (i=0; i<ml->port_cnt; ++i) {
+	struct conf_mix_port *mp = &ml->ports[i];
+	struct conf_port *conf_port = mp->cport;
 	pjmedia_frame_type frm_type;
 	pj_status_t status;
 
-	if (!conf_port)
+	/* Skip port that has been removed during this cycle */
+	if (conf->ports[mp->slot] != conf_port)
 	    continue;
 
-	/* Var "ci" is to count how many ports have been visited. */
-	++ci;
-
-	status = write_port( conf, conf_port, &frame->timestamp,
-			     &frm_type);
+	status = write_port( conf, conf_port, mp->transmitter_cnt,
+			     &frame->timestamp, &frm_type);
 	if (status != PJ_SUCCESS) {
 	    /* bennylp: why do we need this????
 	       One thing for sure, put_frame()/write_port() may return
@@ -2141,7 +2346,7 @@ static pj_status_t get_frame(pjmedia_port *this_port,
 	/* Set the type of frame to be returned to sound playback
 	 * device.
 	 */
-	if (i == 0)
+	if (mp->slot == 0)
 	    speaker_frame_type = frm_type;
     }
 
@@ -2160,6 +2365,20 @@ static pj_status_t get_frame(pjmedia_port *this_port,
     /* MUST set frame type */
     frame->type = speaker_frame_type;
 
+on_return:
+    /* Done with the mixing list, recycle it if it has been replaced. */
+    pj_mutex_lock(conf->mutex);
+    conf->mix_busy = NULL;
+    if (ml && ml != conf->mix_list) {
+	ml->next = conf->mix_free;
+	conf->mix_free = ml;
+    }
+    ++conf->mix_tick;
+    /* Wake up wait_mix_list() callers */
+    while (conf->mix_waiters) {
+	pj_sem_post(conf->mix_sem);
+	--conf->mix_waiters;
+    }
     pj_mutex_unlock(conf->mutex);
 
 #ifdef REC_FILE
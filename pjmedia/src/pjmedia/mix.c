@@ -0,0 +1,688 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <pjmedia/mix.h>
+#include <pj/assert.h>
+#include <pj/errno.h>
+
+#if defined(PJMEDIA_MIX_USE_SIMD) && PJMEDIA_MIX_USE_SIMD != 0
+#   if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#	define MIX_SIMD_X86	1
+#	include <immintrin.h>
+#   elif defined(__GNUC__) && defined(__aarch64__) && defined(__ARM_NEON)
+#	define MIX_SIMD_NEON	1
+#	include <arm_neon.h>
+#   endif
+#endif
+
+#define NORMAL_LEVEL	128
+#define MAX_LEVEL	(32767)
+#define MIN_LEVEL	(-32768)
+
+/* The 16-bit multiplication in scale kernels needs the level to fit */
+#define MAX_SIMD_SCALE	0x7FFF
+
+
+/*
+ * The set of mixing functions of an implementation.
+ */
+typedef struct mix_func
+{
+    pj_uint32_t (*sum_abs)(const pj_int16_t *src, unsigned count);
+    pj_uint32_t (*scale)(pj_int16_t *dst, const pj_int16_t *src,
+			 unsigned count, unsigned level);
+    void	(*copy)(pj_int32_t *mix, const pj_int16_t *src,
+			unsigned count);
+    void	(*add)(pj_int32_t *mix, const pj_int16_t *src,
+		       unsigned count, pj_int32_t *p_min, pj_int32_t *p_max);
+    pj_uint32_t (*store)(pj_int16_t *dst, const pj_int32_t *mix,
+			 unsigned count, unsigned level);
+} mix_func;
+
+
+/*
+ * Portable implementation, also used for the remaining samples by the
+ * vectorized implementations.
+ */
+static pj_uint32_t sum_abs_scalar(const pj_int16_t *src, unsigned count)
+{
+    pj_uint32_t sum = 0;
+    unsigned i;
+
+    for (i=0; i<count; ++i)
+	sum += (src[i] >= 0 ? src[i] : -src[i]);
+
+    return sum;
+}
+
+static pj_uint32_t scale_scalar(pj_int16_t *dst, const pj_int16_t *src,
+				unsigned count, unsigned level)
+{
+    pj_uint32_t sum = 0;
+    unsigned i;
+
+    for (i=0; i<count; ++i) {
+	/* Multiply as unsigned to get the wrap-around of the SIMD code. */
+	pj_int32_t itemp = (pj_int32_t)((pj_uint32_t)src[i] * level) >> 7;
+
+	/* Clip the signal if it's too loud */
+	if (itemp > MAX_LEVEL) itemp = MAX_LEVEL;
+	else if (itemp < MIN_LEVEL) itemp = MIN_LEVEL;
+
+	dst[i] = (pj_int16_t)itemp;
+	sum += (itemp >= 0 ? itemp : -itemp);
+    }
+
+    return sum;
+}
+
+static void copy_scalar(pj_int32_t *mix, const pj_int16_t *src,
+			unsigned count)
+{
+    unsigned i;
+
+    for (i=0; i<count; ++i)
+	mix[i] = src[i];
+}
+
+static void add_scalar(pj_int32_t *mix, const pj_int16_t *src,
+		       unsigned count, pj_int32_t *p_min, pj_int32_t *p_max)
+{
+    pj_int32_t mix_min = *p_min, mix_max = *p_max;
+    unsigned i;
+
+    for (i=0; i<count; ++i) {
+	mix[i] += src[i];
+	if (mix[i] < mix_min)
+	    mix_min = mix[i];
+	if (mix[i] > mix_max)
+	    mix_max = mix[i];
+    }
+
+    *p_min = mix_min;
+    *p_max = mix_max;
+}
+
+static pj_uint32_t store_scalar(pj_int16_t *dst, const pj_int32_t *mix,
+				unsigned count, unsigned level)
+{
+    pj_uint32_t sum = 0;
+    unsigned i;
+
+    for (i=0; i<count; ++i) {
+	pj_int32_t itemp = mix[i];
+
+	if (level != NORMAL_LEVEL)
+	    itemp = (pj_int32_t)((pj_uint32_t)itemp * level) >> 7;
+
+	/* Clip the signal if it's too loud */
+	if (itemp > MAX_LEVEL) itemp = MAX_LEVEL;
+	else if (itemp < MIN_LEVEL) itemp = MIN_LEVEL;
+
+	dst[i] = (pj_int16_t)itemp;
+	sum += (itemp >= 0 ? itemp : -itemp);
+    }
+
+    return sum;
+}
+
+static const mix_func mix_scalar =
+{
+    &sum_abs_scalar, &scale_scalar, &copy_scalar, &add_scalar, &store_scalar
+};
+
+
+#if defined(MIX_SIMD_X86)
+
+/*
+ * SSE2 implementation.
+ *
+ * The absolute sum is calculated without widening: for negative samples,
+ * x ^ (x >> 15) is -x - 1, which always fits 16-bit, and the number of
+ * negative samples is added back afterwards.
+ */
+#define SSE2_FUNC   __attribute__((target("sse2")))
+
+SSE2_FUNC static __m128i sum_abs_sse2_step(__m128i acc, __m128i s)
+{
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i neg = _mm_srai_epi16(s, 15);
+
+    acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_xor_si128(s, neg), ones));
+    return _mm_sub_epi32(acc, _mm_madd_epi16(neg, ones));
+}
+
+SSE2_FUNC static pj_uint32_t hsum_sse2(__m128i v)
+{
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1,0,3,2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2,3,0,1)));
+    return (pj_uint32_t)_mm_cvtsi128_si32(v);
+}
+
+SSE2_FUNC static __m128i min_epi32_sse2(__m128i a, __m128i b)
+{
+    __m128i gt = _mm_cmpgt_epi32(a, b);
+    return _mm_or_si128(_mm_and_si128(gt, b), _mm_andnot_si128(gt, a));
+}
+
+SSE2_FUNC static __m128i max_epi32_sse2(__m128i a, __m128i b)
+{
+    __m128i gt = _mm_cmpgt_epi32(a, b);
+    return _mm_or_si128(_mm_and_si128(gt, a), _mm_andnot_si128(gt, b));
+}
+
+SSE2_FUNC static __m128i mullo_epi32_sse2(__m128i a, __m128i b)
+{
+    __m128i p02 = _mm_mul_epu32(a, b);
+    __m128i p13 = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(p02, _MM_SHUFFLE(0,0,2,0)),
+			      _mm_shuffle_epi32(p13, _MM_SHUFFLE(0,0,2,0)));
+}
+
+SSE2_FUNC static pj_uint32_t sum_abs_sse2(const pj_int16_t *src,
+					   unsigned count)
+{
+    __m128i acc = _mm_setzero_si128();
+    unsigned i;
+
+    for (i=0; i+8 <= count; i+=8)
+	acc = sum_abs_sse2_step(acc, _mm_loadu_si128((const __m128i*)(src+i)));
+
+    return hsum_sse2(acc) + sum_abs_scalar(src+i, count-i);
+}
+
+SSE2_FUNC static pj_uint32_t scale_sse2(pj_int16_t *dst,
+					 const pj_int16_t *src,
+					 unsigned count, unsigned level)
+{
+    __m128i acc = _mm_setzero_si128();
+    __m128i lv;
+    unsigned i;
+
+    if (level > MAX_SIMD_SCALE)
+	return scale_scalar(dst, src, count, level);
+
+    lv = _mm_set1_epi16((short)level);
+    for (i=0; i+8 <= count; i+=8) {
+	__m128i s = _mm_loadu_si128((const __m128i*)(src+i));
+	__m128i lo = _mm_mullo_epi16(s, lv);
+	__m128i hi = _mm_mulhi_epi16(s, lv);
+	__m128i d = _mm_packs_epi32(
+			_mm_srai_epi32(_mm_unpacklo_epi16(lo, hi), 7),
+			_mm_srai_epi32(_mm_unpackhi_epi16(lo, hi), 7));
+
+	_mm_storeu_si128((__m128i*)(dst+i), d);
+	acc = sum_abs_sse2_step(acc, d);
+    }
+
+    return hsum_sse2(acc) + scale_scalar(dst+i, src+i, count-i, level);
+}
+
+SSE2_FUNC static void copy_sse2(pj_int32_t *mix, const pj_int16_t *src,
+				unsigned count)
+{
+    unsigned i;
+
+    for (i=0; i+8 <= count; i+=8) {
+	__m128i s = _mm_loadu_si128((const __m128i*)(src+i));
+
+	_mm_storeu_si128((__m128i*)(mix+i),
+			 _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+	_mm_storeu_si128((__m128i*)(mix+i+4),
+			 _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16));
+    }
+
+    copy_scalar(mix+i, src+i, count-i);
+}
+
+SSE2_FUNC static void add_sse2(pj_int32_t *mix, const pj_int16_t *src,
+			       unsigned count, pj_int32_t *p_min,
+			       pj_int32_t *p_max)
+{
+    __m128i vmin = _mm_set1_epi32(*p_min);
+    __m128i vmax = _mm_set1_epi32(*p_max);
+    pj_int32_t tmp[4];
+    unsigned i, j;
+
+    for (i=0; i+8 <= count; i+=8) {
+	__m128i s = _mm_loadu_si128((const __m128i*)(src+i));
+	__m128i m0 = _mm_loadu_si128((const __m128i*)(mix+i));
+	__m128i m1 = _mm_loadu_si128((const __m128i*)(mix+i+4));
+
+	m0 = _mm_add_epi32(m0, _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16));
+	m1 = _mm_add_epi32(m1, _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16));
+	_mm_storeu_si128((__m128i*)(mix+i), m0);
+	_mm_storeu_si128((__m128i*)(mix+i+4), m1);
+
+	vmin = min_epi32_sse2(vmin, min_epi32_sse2(m0, m1));
+	vmax = max_epi32_sse2(vmax, max_epi32_sse2(m0, m1));
+    }
+
+    _mm_storeu_si128((__m128i*)tmp, vmin);
+    for (j=0; j<4; ++j)
+	if (tmp[j] < *p_min) *p_min = tmp[j];
+    _mm_storeu_si128((__m128i*)tmp, vmax);
+    for (j=0; j<4; ++j)
+	if (tmp[j] > *p_max) *p_max = tmp[j];
+
+    add_scalar(mix+i, src+i, count-i, p_min, p_max);
+}
+
+SSE2_FUNC static pj_uint32_t store_sse2(pj_int16_t *dst,
+					 const pj_int32_t *mix,
+					 unsigned count, unsigned level)
+{
+    __m128i acc = _mm_setzero_si128();
+    __m128i lv = _mm_set1_epi32((int)level);
+    unsigned i;
+
+    /* Both inputs are loaded before the store, so dst may overlap mix */
+    for (i=0; i+8 <= count; i+=8) {
+	__m128i m0 = _mm_loadu_si128((const __m128i*)(mix+i));
+	__m128i m1 = _mm_loadu_si128((const __m128i*)(mix+i+4));
+	__m128i d;
+
+	if (level != NORMAL_LEVEL) {
+	    m0 = _mm_srai_epi32(mullo_epi32_sse2(m0, lv), 7);
+	    m1 = _mm_srai_epi32(mullo_epi32_sse2(m1, lv), 7);
+	}
+	d = _mm_packs_epi32(m0, m1);
+
+	_mm_storeu_si128((__m128i*)(dst+i), d);
+	acc = sum_abs_sse2_step(acc, d);
+    }
+
+    return hsum_sse2(acc) + store_scalar(dst+i, mix+i, count-i, level);
+}
+
+static const mix_func mix_sse2 =
+{
+    &sum_abs_sse2, &scale_sse2, &copy_sse2, &add_sse2, &store_sse2
+};
+
+
+/*
+ * AVX2 implementation. The in-lane unpack and pack operations cancel each
+ * other out, except in the store function where the pack needs to be
+ * reordered.
+ */
+#define AVX2_FUNC   __attribute__((target("avx2")))
+
+AVX2_FUNC static __m256i sum_abs_avx2_step(__m256i acc, __m256i s)
+{
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i neg = _mm256_srai_epi16(s, 15);
+
+    acc = _mm256_add_epi32(acc,
+			   _mm256_madd_epi16(_mm256_xor_si256(s, neg), ones));
+    return _mm256_sub_epi32(acc, _mm256_madd_epi16(neg, ones));
+}
+
+AVX2_FUNC static pj_uint32_t hsum_avx2(__m256i v)
+{
+    __m128i h = _mm_add_epi32(_mm256_castsi256_si128(v),
+			      _mm256_extracti128_si256(v, 1));
+
+    h = _mm_add_epi32(h, _mm_shuffle_epi32(h, _MM_SHUFFLE(1,0,3,2)));
+    h = _mm_add_epi32(h, _mm_shuffle_epi32(h, _MM_SHUFFLE(2,3,0,1)));
+    return (pj_uint32_t)_mm_cvtsi128_si32(h);
+}
+
+AVX2_FUNC static pj_uint32_t sum_abs_avx2(const pj_int16_t *src,
+					   unsigned count)
+{
+    __m256i acc = _mm256_setzero_si256();
+    unsigned i;
+
+    for (i=0; i+16 <= count; i+=16)
+	acc = sum_abs_avx2_step(acc,
+				_mm256_loadu_si256((const __m256i*)(src+i)));
+
+    return hsum_avx2(acc) + sum_abs_scalar(src+i, count-i);
+}
+
+AVX2_FUNC static pj_uint32_t scale_avx2(pj_int16_t *dst,
+					 const pj_int16_t *src,
+					 unsigned count, unsigned level)
+{
+    __m256i acc = _mm256_setzero_si256();
+    __m256i lv;
+    unsigned i;
+
+    if (level > MAX_SIMD_SCALE)
+	return scale_scalar(dst, src, count, level);
+
+    lv = _mm256_set1_epi16((short)level);
+    for (i=0; i+16 <= count; i+=16) {
+	__m256i s = _mm256_loadu_si256((const __m256i*)(src+i));
+	__m256i lo = _mm256_mullo_epi16(s, lv);
+	__m256i hi = _mm256_mulhi_epi16(s, lv);
+	__m256i d = _mm256_packs_epi32(
+			_mm256_srai_epi32(_mm256_unpacklo_epi16(lo, hi), 7),
+			_mm256_srai_epi32(_mm256_unpackhi_epi16(lo, hi), 7));
+
+	_mm256_storeu_si256((__m256i*)(dst+i), d);
+	acc = sum_abs_avx2_step(acc, d);
+    }
+
+    return hsum_avx2(acc) + scale_scalar(dst+i, src+i, count-i, level);
+}
+
+AVX2_FUNC static void copy_avx2(pj_int32_t *mix, const pj_int16_t *src,
+				unsigned count)
+{
+    unsigned i;
+
+    for (i=0; i+8 <= count; i+=8) {
+	__m128i s = _mm_loadu_si128((const __m128i*)(src+i));
+	_mm256_storeu_si256((__m256i*)(mix+i), _mm256_cvtepi16_epi32(s));
+    }
+
+    copy_scalar(mix+i, src+i, count-i);
+}
+
+AVX2_FUNC static void add_avx2(pj_int32_t *mix, const pj_int16_t *src,
+			       unsigned count, pj_int32_t *p_min,
+			       pj_int32_t *p_max)
+{
+    __m256i vmin = _mm256_set1_epi32(*p_min);
+    __m256i vmax = _mm256_set1_epi32(*p_max);
+    __m128i h;
+    unsigned i;
+
+    for (i=0; i+8 <= count; i+=8) {
+	__m128i s = _mm_loadu_si128((const __m128i*)(src+i));
+	__m256i m = _mm256_loadu_si256((const __m256i*)(mix+i));
+
+	m = _mm256_add_epi32(m, _mm256_cvtepi16_epi32(s));
+	_mm256_storeu_si256((__m256i*)(mix+i), m);
+
+	vmin = _mm256_min_epi32(vmin, m);
+	vmax = _mm256_max_epi32(vmax, m);
+    }
+
+    h = _mm_min_epi32(_mm256_castsi256_si128(vmin),
+		      _mm256_extracti128_si256(vmin, 1));
+    h = _mm_min_epi32(h, _mm_shuffle_epi32(h, _MM_SHUFFLE(1,0,3,2)));
+    h = _mm_min_epi32(h, _mm_shuffle_epi32(h, _MM_SHUFFLE(2,3,0,1)));
+    *p_min = _mm_cvtsi128_si32(h);
+
+    h = _mm_max_epi32(_mm256_castsi256_si128(vmax),
+		      _mm256_extracti128_si256(vmax, 1));
+    h = _mm_max_epi32(h, _mm_shuffle_epi32(h, _MM_SHUFFLE(1,0,3,2)));
+    h = _mm_max_epi32(h, _mm_shuffle_epi32(h, _MM_SHUFFLE(2,3,0,1)));
+    *p_max = _mm_cvtsi128_si32(h);
+
+    add_scalar(mix+i, src+i, count-i, p_min, p_max);
+}
+
+AVX2_FUNC static pj_uint32_t store_avx2(pj_int16_t *dst,
+					 const pj_int32_t *mix,
+					 unsigned count, unsigned level)
+{
+    __m256i acc = _mm256_setzero_si256();
+    __m256i lv = _mm256_set1_epi32((int)level);
+    unsigned i;
+
+    /* Both inputs are loaded before the store, so dst may overlap mix */
+    for (i=0; i+16 <= count; i+=16) {
+	__m256i m0 = _mm256_loadu_si256((const __m256i*)(mix+i));
+	__m256i m1 = _mm256_loadu_si256((const __m256i*)(mix+i+8));
+	__m256i d;
+
+	if (level != NORMAL_LEVEL) {
+	    m0 = _mm256_srai_epi32(_mm256_mullo_epi32(m0, lv), 7);
+	    m1 = _mm256_srai_epi32(_mm256_mullo_epi32(m1, lv), 7);
+	}
+	d = _mm256_permute4x64_epi64(_mm256_packs_epi32(m0, m1),
+				     _MM_SHUFFLE(3,1,2,0));
+
+	_mm256_storeu_si256((__m256i*)(dst+i), d);
+	acc = sum_abs_avx2_step(acc, d);
+    }
+
+    return hsum_avx2(acc) + store_scalar(dst+i, mix+i, count-i, level);
+}
+
+static const mix_func mix_avx2 =
+{
+    &sum_abs_avx2, &scale_avx2, &copy_avx2, &add_avx2, &store_avx2
+};
+
+#elif defined(MIX_SIMD_NEON)
+
+/*
+ * NEON implementation.
+ */
+static pj_uint32_t sum_abs_neon(const pj_int16_t *src, unsigned count)
+{
+    uint32x4_t acc = vdupq_n_u32(0);
+    unsigned i;
+
+    /* vabsq_s16(-32768) is 0x8000, which is right as unsigned. */
+    for (i=0; i+8 <= count; i+=8)
+	acc = vpadalq_u16(acc, vreinterpretq_u16_s16(vabsq_s16(
+						vld1q_s16(src+i))));
+
+    return vaddvq_u32(acc) + sum_abs_scalar(src+i, count-i);
+}
+
+static pj_uint32_t scale_neon(pj_int16_t *dst, const pj_int16_t *src,
+			      unsigned count, unsigned level)
+{
+    uint32x4_t acc = vdupq_n_u32(0);
+    int16x4_t lv;
+    unsigned i;
+
+    if (level > MAX_SIMD_SCALE)
+	return scale_scalar(dst, src, count, level);
+
+    lv = vdup_n_s16((pj_int16_t)level);
+    for (i=0; i+8 <= count; i+=8) {
+	int16x8_t s = vld1q_s16(src+i);
+	int32x4_t p0 = vshrq_n_s32(vmull_s16(vget_low_s16(s), lv), 7);
+	int32x4_t p1 = vshrq_n_s32(vmull_s16(vget_high_s16(s), lv), 7);
+	int16x8_t d = vcombine_s16(vqmovn_s32(p0), vqmovn_s32(p1));
+
+	vst1q_s16(dst+i, d);
+	acc = vpadalq_u16(acc, vreinterpretq_u16_s16(vabsq_s16(d)));
+    }
+
+    return vaddvq_u32(acc) + scale_scalar(dst+i, src+i, count-i, level);
+}
+
+static void copy_neon(pj_int32_t *mix, const pj_int16_t *src,
+		      unsigned count)
+{
+    unsigned i;
+
+    for (i=0; i+8 <= count; i+=8) {
+	int16x8_t s = vld1q_s16(src+i);
+
+	vst1q_s32(mix+i, vmovl_s16(vget_low_s16(s)));
+	vst1q_s32(mix+i+4, vmovl_s16(vget_high_s16(s)));
+    }
+
+    copy_scalar(mix+i, src+i, count-i);
+}
+
+static void add_neon(pj_int32_t *mix, const pj_int16_t *src,
+		     unsigned count, pj_int32_t *p_min, pj_int32_t *p_max)
+{
+    int32x4_t vmin = vdupq_n_s32(*p_min);
+    int32x4_t vmax = vdupq_n_s32(*p_max);
+    unsigned i;
+
+    for (i=0; i+8 <= count; i+=8) {
+	int16x8_t s = vld1q_s16(src+i);
+	int32x4_t m0 = vaddw_s16(vld1q_s32(mix+i), vget_low_s16(s));
+	int32x4_t m1 = vaddw_s16(vld1q_s32(mix+i+4), vget_high_s16(s));
+
+	vst1q_s32(mix+i, m0);
+	vst1q_s32(mix+i+4, m1);
+
+	vmin = vminq_s32(vmin, vminq_s32(m0, m1));
+	vmax = vmaxq_s32(vmax, vmaxq_s32(m0, m1));
+    }
+
+    *p_min = vminvq_s32(vmin);
+    *p_max = vmaxvq_s32(vmax);
+
+    add_scalar(mix+i, src+i, count-i, p_min, p_max);
+}
+
+static pj_uint32_t store_neon(pj_int16_t *dst, const pj_int32_t *mix,
+			      unsigned count, unsigned level)
+{
+    uint32x4_t acc = vdupq_n_u32(0);
+    int32x4_t lv = vdupq_n_s32((pj_int32_t)level);
+    unsigned i;
+
+    /* Both inputs are loaded before the store, so dst may overlap mix */
+    for (i=0; i+8 <= count; i+=8) {
+	int32x4_t m0 = vld1q_s32(mix+i);
+	int32x4_t m1 = vld1q_s32(mix+i+4);
+	int16x8_t d;
+
+	if (level != NORMAL_LEVEL) {
+	    m0 = vshrq_n_s32(vmulq_s32(m0, lv), 7);
+	    m1 = vshrq_n_s32(vmulq_s32(m1, lv), 7);
+	}
+	d = vcombine_s16(vqmovn_s32(m0), vqmovn_s32(m1));
+
+	vst1q_s16(dst+i, d);
+	acc = vpadalq_u16(acc, vreinterpretq_u16_s16(vabsq_s16(d)));
+    }
+
+    return vaddvq_u32(acc) + store_scalar(dst+i, mix+i, count-i, level);
+}
+
+static const mix_func mix_neon =
+{
+    &sum_abs_neon, &scale_neon, &copy_neon, &add_neon, &store_neon
+};
+
+#endif	/* MIX_SIMD_NEON */
+
+
+static const mix_func *resolve_impl(void);
+
+/* Selected on the first call according to the CPU features. */
+static const mix_func *mix_impl;
+
+#define MIX_FUNC()  (mix_impl ? mix_impl : resolve_impl())
+
+
+/* Get the functions of the implementation, or NULL if not available. */
+static const mix_func *get_impl(pjmedia_mix_impl impl)
+{
+    switch (impl) {
+    case PJMEDIA_MIX_IMPL_AUTO:
+#if defined(MIX_SIMD_X86)
+	if (get_impl(PJMEDIA_MIX_IMPL_AVX2))
+	    return &mix_avx2;
+	if (get_impl(PJMEDIA_MIX_IMPL_SSE2))
+	    return &mix_sse2;
+#elif defined(MIX_SIMD_NEON)
+	return &mix_neon;
+#endif
+	return &mix_scalar;
+
+    case PJMEDIA_MIX_IMPL_SCALAR:
+	return &mix_scalar;
+
+#if defined(MIX_SIMD_X86)
+    case PJMEDIA_MIX_IMPL_SSE2:
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse2") ? &mix_sse2 : NULL;
+
+    case PJMEDIA_MIX_IMPL_AVX2:
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") ? &mix_avx2 : NULL;
+#elif defined(MIX_SIMD_NEON)
+    case PJMEDIA_MIX_IMPL_NEON:
+	return &mix_neon;
+#endif
+
+    default:
+	return NULL;
+    }
+}
+
+static const mix_func *resolve_impl(void)
+{
+    /* Benign race: all threads will select the same functions. */
+    mix_impl = get_impl(PJMEDIA_MIX_IMPL_AUTO);
+    return mix_impl;
+}
+
+
+PJ_DEF(pj_status_t) pjmedia_mix_set_impl(pjmedia_mix_impl impl)
+{
+    const mix_func *func = get_impl(impl);
+
+    if (!func)
+	return PJ_ENOTSUP;
+
+    mix_impl = func;
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(pj_uint32_t) pjmedia_sum_abs_samples(const pj_int16_t *src,
+					    unsigned count)
+{
+    return (*MIX_FUNC()->sum_abs)(src, count);
+}
+
+
+PJ_DEF(pj_uint32_t) pjmedia_scale_samples(pj_int16_t *dst,
+					  const pj_int16_t *src,
+					  unsigned count,
+					  unsigned level)
+{
+    return (*MIX_FUNC()->scale)(dst, src, count, level);
+}
+
+
+PJ_DEF(void) pjmedia_mix_copy_samples(pj_int32_t *mix,
+				      const pj_int16_t *src,
+				      unsigned count)
+{
+    (*MIX_FUNC()->copy)(mix, src, count);
+}
+
+
+PJ_DEF(void) pjmedia_mix_add_samples(pj_int32_t *mix,
+				     const pj_int16_t *src,
+				     unsigned count,
+				     pj_int32_t *p_min,
+				     pj_int32_t *p_max)
+{
+    (*MIX_FUNC()->add)(mix, src, count, p_min, p_max);
+}
+
+
+PJ_DEF(pj_uint32_t) pjmedia_mix_store_samples(pj_int16_t *dst,
+					      const pj_int32_t *mix,
+					      unsigned count,
+					      unsigned level)
+{
+    return (*MIX_FUNC()->store)(dst, mix, count, level);
+}
@@ -20,6 +20,7 @@
 #include <pjmedia/silencedet.h>
 #include <pjmedia/alaw_ulaw.h>
 #include <pjmedia/errno.h>
+#include <pjmedia/mix.h>
 #include <pj/assert.h>
 #include <pj/log.h>
 #include <pj/pool.h>
@@ -190,22 +191,11 @@ PJ_DEF(pj_status_t) pjmedia_silence_det_disable( pjmedia_silence_det *sd )
 PJ_DEF(pj_int32_t) pjmedia_calc_avg_signal( const pj_int16_t samples[],
 					    pj_size_t count)
 {
-    pj_uint32_t sum = 0;
-    
-    const pj_int16_t * pcm = samples;
-    const pj_int16_t * end = samples + count;
-
     if (count==0)
 	return 0;
 
-    while (pcm != end) {
-	if (*pcm < 0)
-	    sum -= *pcm++;
-	else
-	    sum += *pcm++;
-    }
-    
-    return (pj_int32_t)(sum / count);
+    return (pj_int32_t)(pjmedia_sum_abs_samples(samples, (unsigned)count) /
+			count);
 }
 
 PJ_DEF(pj_bool_t) pjmedia_silence_det_apply( pjmedia_silence_det *sd,
@@ -0,0 +1,281 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "test.h"
+
+#define THIS_FILE	"mix_test.c"
+
+#define MAX_COUNT	1000
+#define ROUNDS		500
+#define BENCH_SAMPLES	320	/* 20ms at 16KHz */
+#define BENCH_LOOP	20000
+
+static const struct
+{
+    pjmedia_mix_impl	 impl;
+    const char		*name;
+} impls[] =
+{
+    { PJMEDIA_MIX_IMPL_SCALAR,	"scalar" },
+    { PJMEDIA_MIX_IMPL_SSE2,	"sse2" },
+    { PJMEDIA_MIX_IMPL_AVX2,	"avx2" },
+    { PJMEDIA_MIX_IMPL_NEON,	"neon" },
+};
+
+static const unsigned levels[] =
+{
+    0, 1, 64, 127, 128, 129, 200, 255, 1000, 32767, 40000
+};
+
+
+/* Reference implementations */
+static pj_int32_t ref_clip(pj_int32_t v)
+{
+    return v > 32767 ? 32767 : (v < -32768 ? -32768 : v);
+}
+
+static pj_uint32_t ref_abs(pj_int32_t v)
+{
+    return (pj_uint32_t)(v < 0 ? -v : v);
+}
+
+static pj_int32_t ref_adjust(pj_int32_t v, unsigned level)
+{
+    return (pj_int32_t)((pj_uint32_t)v * level) >> 7;
+}
+
+static pj_uint32_t ref_sum_abs(const pj_int16_t *src, unsigned count)
+{
+    pj_uint32_t sum = 0;
+    unsigned i;
+
+    for (i=0; i<count; ++i)
+	sum += ref_abs(src[i]);
+    return sum;
+}
+
+static pj_uint32_t ref_scale(pj_int16_t *dst, const pj_int16_t *src,
+			     unsigned count, unsigned level)
+{
+    pj_uint32_t sum = 0;
+    unsigned i;
+
+    for (i=0; i<count; ++i) {
+	dst[i] = (pj_int16_t)ref_clip(ref_adjust(src[i], level));
+	sum += ref_abs(dst[i]);
+    }
+    return sum;
+}
+
+static pj_uint32_t ref_store(pj_int16_t *dst, const pj_int32_t *mix,
+			     unsigned count, unsigned level)
+{
+    pj_uint32_t sum = 0;
+    unsigned i;
+
+    for (i=0; i<count; ++i) {
+	pj_int32_t v = (level == 128) ? mix[i] : ref_adjust(mix[i], level);
+	dst[i] = (pj_int16_t)ref_clip(v);
+	sum += ref_abs(dst[i]);
+    }
+    return sum;
+}
+
+
+/* Random samples, with a good share of extreme values */
+static pj_int16_t rand_sample(void)
+{
+    switch (pj_rand() % 8) {
+    case 0:
+	return -32768;
+    case 1:
+	return 32767;
+    default:
+	return (pj_int16_t)(pj_rand() & 0xFFFF);
+    }
+}
+
+static pj_int32_t rand_mix(void)
+{
+    switch (pj_rand() % 4) {
+    case 0:
+	return rand_sample();
+    case 1:
+	return (pj_int32_t)rand_sample() * (pj_int32_t)(pj_rand() % 256);
+    default:
+	return (pj_int32_t)(pj_rand() % 200000) - 100000;
+    }
+}
+
+
+static int verify_impl(const char *name)
+{
+    static pj_int16_t src[MAX_COUNT+8], dst[MAX_COUNT+8], ref[MAX_COUNT+8];
+    static pj_int32_t mix[MAX_COUNT+8], ref_mix[MAX_COUNT+8];
+    unsigned round;
+
+    for (round=0; round<ROUNDS; ++round) {
+	unsigned count = pj_rand() % MAX_COUNT;
+	unsigned off = pj_rand() % 8;
+	unsigned level = levels[round % PJ_ARRAY_SIZE(levels)];
+	pj_int32_t min1, max1, min2, max2;
+	pj_uint32_t sum1, sum2;
+	unsigned i;
+
+	for (i=0; i<count+off; ++i) {
+	    src[i] = rand_sample();
+	    mix[i] = ref_mix[i] = rand_mix();
+	}
+
+	/* Sum of absolute values */
+	if (pjmedia_sum_abs_samples(src+off, count) !=
+	    ref_sum_abs(src+off, count))
+	{
+	    PJ_LOG(1,(THIS_FILE, "  %s: sum_abs mismatch", name));
+	    return -10;
+	}
+
+	/* Level adjustment, also in place */
+	sum1 = pjmedia_scale_samples(dst+off, src+off, count, level);
+	sum2 = ref_scale(ref+off, src+off, count, level);
+	if (sum1 != sum2 ||
+	    pj_memcmp(dst+off, ref+off, count*sizeof(pj_int16_t)))
+	{
+	    PJ_LOG(1,(THIS_FILE, "  %s: scale mismatch, level=%u",
+		      name, level));
+	    return -20;
+	}
+
+	pjmedia_copy_samples(dst+off, src+off, count);
+	sum1 = pjmedia_scale_samples(dst+off, dst+off, count, level);
+	if (sum1 != sum2 ||
+	    pj_memcmp(dst+off, ref+off, count*sizeof(pj_int16_t)))
+	{
+	    PJ_LOG(1,(THIS_FILE, "  %s: in-place scale mismatch", name));
+	    return -30;
+	}
+
+	/* Mixing */
+	min1 = min2 = 0;
+	max1 = max2 = 0;
+	pjmedia_mix_add_samples(mix+off, src+off, count, &min1, &max1);
+	for (i=off; i<count+off; ++i) {
+	    ref_mix[i] += src[i];
+	    if (ref_mix[i] < min2) min2 = ref_mix[i];
+	    if (ref_mix[i] > max2) max2 = ref_mix[i];
+	}
+	if (min1 != min2 || max1 != max2 ||
+	    pj_memcmp(mix+off, ref_mix+off, count*sizeof(pj_int32_t)))
+	{
+	    PJ_LOG(1,(THIS_FILE, "  %s: mix_add mismatch", name));
+	    return -40;
+	}
+
+	/* Store mixed signal, also in place */
+	sum1 = pjmedia_mix_store_samples(dst+off, mix+off, count, level);
+	sum2 = ref_store(ref+off, mix+off, count, level);
+	if (sum1 != sum2 ||
+	    pj_memcmp(dst+off, ref+off, count*sizeof(pj_int16_t)))
+	{
+	    PJ_LOG(1,(THIS_FILE, "  %s: mix_store mismatch, level=%u",
+		      name, level));
+	    return -50;
+	}
+
+	sum1 = pjmedia_mix_store_samples((pj_int16_t*)(mix+off), mix+off,
+					 count, level);
+	if (sum1 != sum2 ||
+	    pj_memcmp(mix+off, ref+off, count*sizeof(pj_int16_t)))
+	{
+	    PJ_LOG(1,(THIS_FILE, "  %s: in-place mix_store mismatch", name));
+	    return -60;
+	}
+
+	/* Mix buffer initialization */
+	pjmedia_mix_copy_samples(mix+off, src+off, count);
+	for (i=off; i<count+off; ++i) {
+	    if (mix[i] != src[i]) {
+		PJ_LOG(1,(THIS_FILE, "  %s: mix_copy mismatch", name));
+		return -70;
+	    }
+	}
+    }
+
+    return 0;
+}
+
+
+/* Time the per-sample work of a 4-party conference tick */
+static void bench_impl(const char *name)
+{
+    static pj_int16_t src[BENCH_SAMPLES], out[BENCH_SAMPLES];
+    static pj_int32_t mix[BENCH_SAMPLES];
+    pj_timestamp t1, t2;
+    pj_uint32_t usec, level = 0;
+    unsigned i, loop;
+
+    for (i=0; i<BENCH_SAMPLES; ++i)
+	src[i] = (pj_int16_t)((i * 997) & 0x3FFF);
+
+    pj_get_timestamp(&t1);
+    for (loop=0; loop<BENCH_LOOP; ++loop) {
+	pj_int32_t mix_min = 0, mix_max = 0;
+
+	level += pjmedia_scale_samples(out, src, BENCH_SAMPLES, 100);
+	pjmedia_mix_copy_samples(mix, out, BENCH_SAMPLES);
+	pjmedia_mix_add_samples(mix, src, BENCH_SAMPLES, &mix_min, &mix_max);
+	pjmedia_mix_add_samples(mix, src, BENCH_SAMPLES, &mix_min, &mix_max);
+	level += pjmedia_mix_store_samples(out, mix, BENCH_SAMPLES, 90);
+	level += pjmedia_sum_abs_samples(out, BENCH_SAMPLES);
+    }
+    pj_get_timestamp(&t2);
+
+    usec = pj_elapsed_usec(&t1, &t2);
+    PJ_LOG(3,(THIS_FILE, "   %-6s: %6u nsec per tick (%u)", name,
+	      (unsigned)((pj_uint64_t)usec * 1000 / BENCH_LOOP), level & 1));
+}
+
+
+int mix_test(void)
+{
+    unsigned i;
+    int rc = 0;
+
+    for (i=0; i<PJ_ARRAY_SIZE(impls) && rc==0; ++i) {
+	if (pjmedia_mix_set_impl(impls[i].impl) != PJ_SUCCESS) {
+	    PJ_LOG(3,(THIS_FILE, "  %s: not available", impls[i].name));
+	    continue;
+	}
+
+	PJ_LOG(3,(THIS_FILE, "  %s: verifying against reference..",
+		  impls[i].name));
+	rc = verify_impl(impls[i].name);
+    }
+
+    if (rc == 0) {
+	PJ_LOG(3,(THIS_FILE, "  benchmarking (%u samples, %u loops)..",
+		  BENCH_SAMPLES, BENCH_LOOP));
+	for (i=0; i<PJ_ARRAY_SIZE(impls); ++i) {
+	    if (pjmedia_mix_set_impl(impls[i].impl) == PJ_SUCCESS)
+		bench_impl(impls[i].name);
+	}
+    }
+
+    pjmedia_mix_set_impl(PJMEDIA_MIX_IMPL_AUTO);
+    return rc;
+}
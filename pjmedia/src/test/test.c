@@ -95,6 +95,9 @@ int test_main(void)
     //DO_TEST(sdp_test (&caching_pool.factory));
     //DO_TEST(rtp_test(&caching_pool.factory));
     //DO_TEST(session_test (&caching_pool.factory));
+#if HAS_MIX_TEST
+    DO_TEST(mix_test());
+#endif
 #if HAS_JBUF_TEST
     DO_TEST(jbuf_main());
 #endif
@@ -30,6 +30,7 @@
 #define HAS_JBUF_TEST		1
 #define HAS_MIPS_TEST		1
 #define HAS_CODEC_VECTOR_TEST	1
+#define HAS_MIX_TEST		1
 
 int session_test(void);
 int rtp_test(void);
@@ -38,6 +39,7 @@ int jbuf_main(void);
 int sdp_neg_test(void);
 int mips_test(void);
 int codec_test_vectors(void);
+int mix_test(void);
 int vid_codec_test(void);
 int vid_dev_test(void);
 int vid_port_test(void);
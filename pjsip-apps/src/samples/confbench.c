@@ -22,8 +22,12 @@
 /**
  * \page page_pjmedia_samples_confbench_c Samples: Benchmarking Conference Bridge
  *
- * Benchmarking pjmedia (conference bridge+resample). For my use only,
- * and it only works in Win32.
+ * Benchmarking pjmedia conference bridge. The bridge is clocked directly
+ * (without sound device or master port) and the CPU time spent in each
+ * clock tick is measured for increasing number of ports. Each test is
+ * then repeated while another thread keeps connecting, disconnecting,
+ * adding and removing ports, to see how much the clock is delayed by these
+ * operations.
  *
  * This file is pjsip-apps/src/samples/confbench.c
  *
@@ -32,29 +36,22 @@
 
 
 #include <pjmedia.h>
-#include <pjlib-util.h>	/* pj_getopt */
+#include <pjlib-util.h>
 #include <pjlib.h>
 #include <stdlib.h>	/* atoi() */
 #include <stdio.h>
-#include <windows.h>
+#include <math.h>	/* sin() */
 
 /* For logging purpose. */
-#define THIS_FILE   "confsample.c"
+#define THIS_FILE   "confbench.c"
 
 
 /* Configurable:
- *   LARGE_SET will create in total of about 232 ports.
- *   HAS_RESAMPLE will activate resampling on about half
- *     the port.
+ *   HAS_RESAMPLE will activate resampling on the sine generator ports.
  */
-#define TEST_SET	    LARGE_SET
 #define HAS_RESAMPLE	    0
 
 
-#define SMALL_SET	    16
-#define LARGE_SET	    100
-
-
 #define PORT_COUNT	    254
 #define CLOCK_RATE	    16000
 #define SAMPLES_PER_FRAME   (CLOCK_RATE/100)
@@ -64,11 +61,12 @@
 #  define SINE_CLOCK	    CLOCK_RATE
 #endif
 #define SINE_PTIME	    20
-#define DURATION	    10
+#define TICK_COUNT	    500
 
-#define SINE_COUNT	    TEST_SET
-#define NULL_COUNT	    TEST_SET
-#define IDLE_COUNT	    32
+/* Each test creates half sine generator and half null ports, and connects
+ * every sine port to port zero and to all null ports.
+ */
+static const unsigned test_ports[] = { 4, 16, 32, 64, 128, 252 };
 
 
 static void app_perror(const char *sender, const char *title, pj_status_t status)
@@ -80,57 +78,6 @@ static void app_perror(const char *sender, const char *title, pj_status_t status
 }
 
 
-struct Times
-{
-    FILETIME	    kernel_time;
-    ULARGE_INTEGER  u_kernel_time;
-    FILETIME	    user_time;
-    ULARGE_INTEGER  u_user_time;
-    ULARGE_INTEGER  u_total;
-};
-
-static void process(struct Times *t)
-{
-    pj_memcpy(&t->u_kernel_time, &t->kernel_time, sizeof(FILETIME));
-    pj_memcpy(&t->u_user_time, &t->user_time, sizeof(FILETIME));
-    t->u_total.QuadPart = t->u_kernel_time.QuadPart + t->u_user_time.QuadPart;
-}
-
-static void benchmark(void)
-{
-    FILETIME creation_time, exit_time;
-    struct Times start, end;
-    DWORD ts, te;
-    LARGE_INTEGER elapsed;
-    BOOL rc;
-    int i;
-    double pct;
-
-    puts("Test started!"); fflush(stdout);
-
-    ts = GetTickCount();
-    rc = GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time,
-			 &start.kernel_time, &start.user_time);
-    for (i=DURATION; i>0; --i) {
-	printf("\r%d ", i); fflush(stdout);
-	pj_thread_sleep(1000);
-    }
-    rc = GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time,
-			 &end.kernel_time, &end.user_time);
-    te = GetTickCount();
-
-    process(&start);
-    process(&end);
-
-    elapsed.QuadPart = end.u_total.QuadPart - start.u_total.QuadPart;
-
-    pct = elapsed.QuadPart * 100.0 / ((te-ts)*10000.0);
-
-    printf("CPU usage=%6.4f%%\n", pct); fflush(stdout);
-}
-
-
-
 /* Struct attached to sine generator */
 typedef struct
 {
@@ -226,37 +173,94 @@ static pj_status_t create_sine_port(pj_pool_t *pool,
     return PJ_SUCCESS;
 }
 
-int main()
+/* State of the connect/disconnect thread */
+static struct control_state
 {
-    pj_caching_pool cp;
-    pjmedia_endpt *med_endpt;
-    pj_pool_t *pool;
-    pjmedia_conf *conf;
-    int i;
-    pjmedia_port *sine_port[SINE_COUNT], *null_port, *conf_port;
-    pjmedia_port *nulls[NULL_COUNT];
-    unsigned null_slots[NULL_COUNT];
-    pjmedia_master_port *master_port;
-    pj_status_t status;
+    pjmedia_conf   *conf;
+    pj_pool_t	   *pool;
+    pjmedia_port   *port;
+    unsigned	    src_slot;
+    unsigned	    dst_slot;
+    pj_bool_t	    quit;
+    unsigned	    op_cnt;
+} control;
+
+/* Keep changing a connection, and adding and removing a port, while the
+ * bridge is being clocked. Removing a port waits for the bridge to stop
+ * using it.
+ */
+static int control_thread(void *arg)
+{
+    PJ_UNUSED_ARG(arg);
+
+    while (!control.quit) {
+	unsigned slot;
+
+	pjmedia_conf_connect_port(control.conf, control.src_slot,
+				  control.dst_slot, 0);
+	pjmedia_conf_disconnect_port(control.conf, control.src_slot,
+				     control.dst_slot);
+	control.op_cnt += 2;
+
+	if (pjmedia_conf_add_port(control.conf, control.pool, control.port,
+				  NULL, &slot) == PJ_SUCCESS)
+	{
+	    pjmedia_conf_connect_port(control.conf, control.src_slot,
+				      slot, 0);
+	    pjmedia_conf_remove_port(control.conf, slot);
+	    control.op_cnt += 3;
+	}
+	pj_thread_sleep(0);
+    }
 
+    return 0;
+}
 
-    pj_log_set_level(3);
 
-    status = pj_init();
-    PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
+/* Clock the bridge, and get the average and maximum time of a tick */
+static void clock_bridge(pjmedia_port *master, void *buf,
+			 pj_uint32_t *avg_nsec, pj_uint32_t *max_nsec)
+{
+    pj_timestamp t_start, t1, t2;
+    unsigned i;
 
-    pj_caching_pool_init(&cp, &pj_pool_factory_default_policy, 0);
-    pool = pj_pool_create( &cp.factory,	    /* pool factory	    */
-			   "wav",	    /* pool name.	    */
-			   4000,	    /* init size	    */
-			   4000,	    /* increment size	    */
-			   NULL		    /* callback on error    */
-			   );
+    *max_nsec = 0;
 
-    status = pjmedia_endpt_create(&cp.factory, NULL, 1, &med_endpt);
-    PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
+    pj_get_timestamp(&t_start);
+    for (i=0; i<TICK_COUNT; ++i) {
+	pjmedia_frame frame;
+	pj_uint32_t nsec;
+
+	frame.buf = buf;
+	frame.size = SAMPLES_PER_FRAME * 2;
+	frame.timestamp.u64 = (pj_uint64_t)i * SAMPLES_PER_FRAME;
+
+	pj_get_timestamp(&t1);
+	pjmedia_port_get_frame(master, &frame);
+	pj_get_timestamp(&t2);
+
+	nsec = pj_elapsed_nanosec(&t1, &t2);
+	if (nsec > *max_nsec)
+	    *max_nsec = nsec;
+    }
+
+    *avg_nsec = pj_elapsed_nanosec(&t_start, &t2) / TICK_COUNT;
+}
 
 
+static int benchmark(pj_pool_factory *pf, unsigned port_cnt)
+{
+    pj_pool_t *pool;
+    pjmedia_conf *conf;
+    pjmedia_port *master;
+    unsigned *null_slots, *sine_slots;
+    unsigned i, j, half = port_cnt / 2;
+    pj_uint32_t avg_nsec, max_nsec, busy_avg_nsec, busy_max_nsec;
+    pj_thread_t *thread;
+    void *buf;
+    pj_status_t status;
+
+    pool = pj_pool_create(pf, "confbench", 4000, 4000, NULL);
 
     status = pjmedia_conf_create( pool,
 				  PORT_COUNT,
@@ -269,80 +273,116 @@ int main()
 	return 1;
     }
 
-    printf("Resampling is %s\n", (HAS_RESAMPLE?"active":"disabled"));
+    master = pjmedia_conf_get_master_port(conf);
+    buf = pj_pool_alloc(pool, SAMPLES_PER_FRAME * 2);
+    null_slots = (unsigned*) pj_pool_calloc(pool, half, sizeof(unsigned));
+    sine_slots = (unsigned*) pj_pool_calloc(pool, half, sizeof(unsigned));
+
+    /* Create null ports */
+    for (i=0; i<half; ++i) {
+	pjmedia_port *port;
 
-    /* Create Null ports */
-    printf("Creating %d null ports..\n", NULL_COUNT);
-    for (i=0; i<NULL_COUNT; ++i) {
-	status = pjmedia_null_port_create(pool, CLOCK_RATE, 1, SAMPLES_PER_FRAME*2, 16, &nulls[i]);
+	status = pjmedia_null_port_create(pool, CLOCK_RATE, 1,
+					  SAMPLES_PER_FRAME*2, 16, &port);
 	PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
 
-	status = pjmedia_conf_add_port(conf, pool, nulls[i], NULL, &null_slots[i]);
+	status = pjmedia_conf_add_port(conf, pool, port, NULL,
+				       &null_slots[i]);
 	PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
     }
 
-    /* Create sine ports. */
-    printf("Creating %d sine generator ports..\n", SINE_COUNT);
-    for (i=0; i<SINE_COUNT; ++i) {
-	unsigned j, slot;
+    /* Create sine ports, and connect them to port zero and all null ports */
+    for (i=0; i<half; ++i) {
+	pjmedia_port *port;
 
-	/* Load the WAV file to file port. */
-	status = create_sine_port(pool, SINE_CLOCK, 1, &sine_port[i]);
+	status = create_sine_port(pool, SINE_CLOCK, 1, &port);
 	PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
 
-	/* Add the file port to conference bridge */
-	status = pjmedia_conf_add_port( conf,		/* The bridge	    */
-					pool,		/* pool		    */
-					sine_port[i],	/* port to connect  */
-					NULL,		/* Use port's name  */
-					&slot		/* ptr for slot #   */
-					);
-	if (status != PJ_SUCCESS) {
-	    app_perror(THIS_FILE, "Unable to add conference port", status);
-	    return 1;
-	}
+	status = pjmedia_conf_add_port(conf, pool, port, NULL,
+				       &sine_slots[i]);
+	PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
 
-	status = pjmedia_conf_connect_port(conf, slot, 0, 0);
+	status = pjmedia_conf_connect_port(conf, sine_slots[i], 0, 0);
 	PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
 
-	for (j=0; j<NULL_COUNT; ++j) {
-	    status = pjmedia_conf_connect_port(conf, slot, null_slots[j], 0);
+	for (j=0; j<half; ++j) {
+	    status = pjmedia_conf_connect_port(conf, sine_slots[i],
+					       null_slots[j], 0);
 	    PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
 	}
     }
 
-    /* Create idle ports */
-    printf("Creating %d idle ports..\n", IDLE_COUNT);
-    for (i=0; i<IDLE_COUNT; ++i) {
-	pjmedia_port *dummy;
-	status = pjmedia_null_port_create(pool, CLOCK_RATE, 1, SAMPLES_PER_FRAME, 16, &dummy);
-	PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
-	status = pjmedia_conf_add_port(conf, pool, dummy, NULL, NULL);
-	PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
-    }
+    /* Warm up, then measure */
+    clock_bridge(master, buf, &avg_nsec, &max_nsec);
+    clock_bridge(master, buf, &avg_nsec, &max_nsec);
 
-    /* Create null port */
-    status = pjmedia_null_port_create(pool, CLOCK_RATE, 1, SAMPLES_PER_FRAME, 16,
-				      &null_port);
+    /* Measure again while connections are being changed */
+    control.conf = conf;
+    control.pool = pool;
+    status = pjmedia_null_port_create(pool, CLOCK_RATE, 1,
+				      SAMPLES_PER_FRAME*2, 16, &control.port);
     PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
+    control.src_slot = sine_slots[0];
+    control.dst_slot = sine_slots[half-1];
+    control.quit = PJ_FALSE;
+    control.op_cnt = 0;
 
-    conf_port = pjmedia_conf_get_master_port(conf);
+    status = pj_thread_create(pool, "control", &control_thread, NULL,
+			      0, 0, &thread);
+    PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
 
-    /* Create master port */
-    status = pjmedia_master_port_create(pool, null_port, conf_port, 0, &master_port);
+    clock_bridge(master, buf, &busy_avg_nsec, &busy_max_nsec);
 
+    control.quit = PJ_TRUE;
+    pj_thread_join(thread);
+    pj_thread_destroy(thread);
 
-    pjmedia_master_port_start(master_port);
+    printf("%5u ports %6u conns: %7.2f usec/tick (max %7.2f), "
+	   "with %5u connect ops: %7.2f usec/tick (max %7.2f)\n",
+	   pjmedia_conf_get_port_count(conf),
+	   pjmedia_conf_get_connect_count(conf),
+	   avg_nsec / 1000.0, max_nsec / 1000.0,
+	   control.op_cnt,
+	   busy_avg_nsec / 1000.0, busy_max_nsec / 1000.0);
+    fflush(stdout);
 
-    puts("Waiting to settle.."); fflush(stdout);
-    pj_thread_sleep(5000);
+    pjmedia_conf_destroy(conf);
+    pj_pool_release(pool);
 
+    return 0;
+}
 
-    benchmark();
 
+int main()
+{
+    pj_caching_pool cp;
+    pjmedia_endpt *med_endpt;
+    unsigned i;
+    pj_status_t status;
+
+
+    pj_log_set_level(3);
+
+    status = pj_init();
+    PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
+
+    pj_caching_pool_init(&cp, &pj_pool_factory_default_policy, 0);
+
+    status = pjmedia_endpt_create(&cp.factory, NULL, 1, &med_endpt);
+    PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
+
+    printf("Resampling is %s, %u ticks per test\n",
+	   (HAS_RESAMPLE?"active":"disabled"), TICK_COUNT);
+
+    for (i=0; i<PJ_ARRAY_SIZE(test_ports); ++i) {
+	if (benchmark(&cp.factory, test_ports[i]) != 0)
+	    return 1;
+    }
 
     /* Done. */
+    pjmedia_endpt_destroy(med_endpt);
+    pj_caching_pool_destroy(&cp);
+    pj_shutdown();
+
     return 0;
 }
-
-
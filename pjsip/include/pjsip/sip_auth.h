@@ -46,6 +46,9 @@ PJ_BEGIN_DECL
 /** Length of digest string. */
 #define PJSIP_MD5STRLEN 32
 
+/** Length of SHA-256 digest string. */
+#define PJSIP_SHA256STRLEN 64
+
 
 /** Type of data in the credential information in #pjsip_cred_info. */
 typedef enum pjsip_cred_data_type
@@ -66,6 +69,14 @@ typedef enum pjsip_auth_qop_type
     PJSIP_AUTH_QOP_UNKNOWN	    /**< Unknown protection. */
 } pjsip_auth_qop_type;
 
+/** Digest algorithm type. */
+typedef enum pjsip_auth_algorithm_type
+{
+    PJSIP_AUTH_ALGORITHM_MD5,	    /**< MD5 (RFC 2617), the default. */
+    PJSIP_AUTH_ALGORITHM_SHA256,    /**< SHA-256 (RFC 8760). */
+    PJSIP_AUTH_ALGORITHM_UNKNOWN    /**< Unsupported algorithm. */
+} pjsip_auth_algorithm_type;
+
 
 /**
  * Type of callback function to create authentication response.
@@ -181,9 +192,33 @@ typedef struct pjsip_cached_auth
 						 each method.		    */
 #endif
 
+    /** Template of the last digest response header. While the challenge,
+     *  the request URI, the method, and the credential stay the same, new
+     *  requests copy the template and only compute the response digest
+     *  (and nonce-count).
+     */
+    pjsip_authorization_hdr	*tmpl_hdr;
+    const pjsip_cred_info	*tmpl_cred; /**< Credential of the template.*/
+    pjsip_method		 tmpl_method;/**< Method of the template.   */
+    pj_str_t			 tmpl_ha2;  /**< H(method ":" uri).	    */
+
 } pjsip_cached_auth;
 
 
+/**
+ * This structure describes the hashed credential (HA1) of a credential,
+ * which the client authentication session keeps so that the password is
+ * hashed once instead of for every request.
+ */
+typedef struct pjsip_cached_ha1
+{
+    pj_str_t			 realm;	    /**< Realm of the HA1.	    */
+    pjsip_auth_algorithm_type	 algorithm; /**< Algorithm of the HA1.	    */
+    pj_str_t			 ha1;	    /**< The HA1, empty if not
+						 computed yet.		    */
+} pjsip_cached_ha1;
+
+
 /**
  * This structure describes client authentication session preference.
  * The preference can be set by calling #pjsip_auth_clt_set_prefs().
@@ -230,6 +265,7 @@ typedef struct pjsip_auth_clt_sess
     pjsip_auth_clt_pref  pref;		/**< Preference/options.	    */
     unsigned		 cred_cnt;	/**< Number of credentials.	    */
     pjsip_cred_info	*cred_info;	/**< Array of credential information*/
+    pjsip_cached_ha1	*cached_ha1;	/**< HA1 of each credential.	    */
     pjsip_cached_auth	 cached_auth;	/**< Cached authorization info.	    */
 
 } pjsip_auth_clt_sess;
@@ -310,6 +346,24 @@ typedef pj_status_t pjsip_auth_lookup_cred2(
 /** Flag to specify that server is a proxy. */
 #define PJSIP_AUTH_SRV_IS_PROXY	    1
 
+/**
+ * Flag to specify that server creates its own signed nonces in the
+ * challenges, and verifies the nonce and the nonce-count of incoming
+ * authorizations. See #pjsip_auth_srv_init2().
+ */
+#define PJSIP_AUTH_SRV_VERIFY_NONCE 2
+
+/**
+ * Flag to specify that server offers a SHA-256 challenge (RFC 8760)
+ * before the MD5 challenge.
+ */
+#define PJSIP_AUTH_SRV_SHA256	    4
+
+/**
+ * Opaque declaration of server credential cache and nonce state.
+ */
+typedef struct pjsip_auth_srv_state pjsip_auth_srv_state;
+
 /**
  * This structure describes server authentication information.
  */
@@ -320,6 +374,8 @@ typedef struct pjsip_auth_srv
     pjsip_auth_lookup_cred  *lookup;	/**< Lookup function.		    */
     pjsip_auth_lookup_cred2 *lookup2;	/**< Lookup function with additional
 					     info in its input param.	    */
+    pjsip_auth_srv_state    *state;	/**< Credential cache and nonce
+					     state, NULL when not used.	    */
 } pjsip_auth_srv;
 
 
@@ -379,6 +435,32 @@ PJ_DECL(pj_status_t) pjsip_auth_clt_set_credentials( pjsip_auth_clt_sess *sess,
 						     const pjsip_cred_info *c);
 
 
+/**
+ * Compute in advance the hashed credentials (HA1) of the session
+ * credentials, so that the requests that are later sent with the session
+ * only need to compute the response digest. The session otherwise computes
+ * the HA1 of a credential when it is first used to answer a challenge, and
+ * keeps it until the credentials are changed.
+ *
+ * Application that manages many sessions, for example thousands of client
+ * registrations, may call this for each session when the sessions are set
+ * up, instead of hashing all the passwords when the registrations are
+ * refreshed at about the same time.
+ *
+ * @param sess		The client authentication session.
+ * @param realm		The realm to compute the HA1 of credentials with
+ *			wildcard realm ("*") for. If NULL, only credentials
+ *			with explicit realm are computed.
+ * @param algorithm	The digest algorithm.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+PJ_DECL(pj_status_t) pjsip_auth_clt_precompute_ha1(
+					pjsip_auth_clt_sess *sess,
+					const pj_str_t *realm,
+					pjsip_auth_algorithm_type algorithm);
+
+
 /**
  * Set the preference for the client authentication session.
  *
@@ -497,9 +579,37 @@ typedef struct pjsip_auth_srv_init_param
      * - PJSIP_AUTH_SRV_IS_PROXY: to specify that the server will authorize
      *   clients as a proxy server (instead of as UAS), which means that
      *   Proxy-Authenticate will be used instead of WWW-Authenticate.
+     * - PJSIP_AUTH_SRV_VERIFY_NONCE: to make the server create nonces
+     *   signed with \a nonce_key, and reject authorizations with a forged
+     *   or expired nonce (after PJSIP_AUTH_SRV_NONCE_EXPIRY seconds), or
+     *   with a nonce-count that has been used before. No per-challenge
+     *   state is kept, only the highest nonce-count of recently used nonces.
+     * - PJSIP_AUTH_SRV_SHA256: to offer SHA-256 digest in the challenges.
      */
     unsigned			 options;
 
+    /**
+     * Number of accounts to keep in the credential cache. The cache keeps
+     * the HA1 of the most recently authenticated accounts for
+     * PJSIP_AUTH_SRV_CACHE_TTL seconds, so the lookup function and the
+     * password hashing are not run for every request. Since the cached
+     * credential is not looked up with the request, the cache must not be
+     * used when the lookup function decides on the credential based on
+     * the request. When an account is deleted or disabled, application
+     * must call #pjsip_auth_srv_invalidate(), otherwise the account is
+     * still authenticated until its cache entry expires.
+     *
+     * Default: 0 (no cache)
+     */
+    unsigned			 cache_size;
+
+    /**
+     * Secret key to sign the nonces with, when PJSIP_AUTH_SRV_VERIFY_NONCE
+     * is set. Servers which share the key accept each other's nonces. If
+     * this is empty, a random key is generated.
+     */
+    pj_str_t			 nonce_key;
+
 } pjsip_auth_srv_init_param;
 
 
@@ -519,6 +629,33 @@ PJ_DECL(pj_status_t) pjsip_auth_srv_init2(
 				    pjsip_auth_srv *auth_srv,
 				    const pjsip_auth_srv_init_param *param);
 
+/**
+ * Release the resources of the server authorization session, i.e. its
+ * credential cache and nonce state. The memory itself belongs to the pool
+ * given to #pjsip_auth_srv_init2().
+ *
+ * @param auth_srv	The authentication server structure.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+PJ_DECL(pj_status_t) pjsip_auth_srv_deinit(pjsip_auth_srv *auth_srv);
+
+/**
+ * Remove the credential of the account from the credential cache, so that
+ * the next request of the account is authenticated with the credential
+ * given by the lookup function. Application must call this when the
+ * account is deleted or disabled, or when its password is changed. A
+ * changed password would otherwise be picked up as well, but the old one
+ * would still be accepted until the cache entry expires.
+ *
+ * @param auth_srv	The server authentication structure.
+ * @param acc_name	The account name, or NULL to remove all accounts.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+PJ_DECL(pj_status_t) pjsip_auth_srv_invalidate(pjsip_auth_srv *auth_srv,
+					       const pj_str_t *acc_name);
+
 /**
  * Request the authorization server framework to verify the authorization 
  * information in the specified request in rdata.
@@ -537,6 +674,13 @@ PJ_DECL(pj_status_t) pjsip_auth_srv_init2(
  *			- PJSIP_EAUTHACCDISABLED
  *			- PJSIP_EAUTHINVALIDREALM
  *			- PJSIP_EAUTHINVALIDDIGEST
+ *			- PJSIP_EINVALIDALGORITHM
+ *			- PJSIP_EAUTHINNONCE, when the nonce was not
+ *			  created by this server.
+ *			- PJSIP_EAUTHSTALENONCE, when the nonce has
+ *			  expired or its nonce-count has been used. The
+ *			  request should be challenged again with
+ *			  stale=true.
  */
 PJ_DECL(pj_status_t) pjsip_auth_srv_verify( pjsip_auth_srv *auth_srv,
 					    pjsip_rx_data *rdata,
@@ -547,7 +691,10 @@ PJ_DECL(pj_status_t) pjsip_auth_srv_verify( pjsip_auth_srv *auth_srv,
  * Add authentication challenge headers to the outgoing response in tdata. 
  * Application may specify its customized nonce and opaque for the challenge, 
  * or can leave the value to NULL to make the function fills them in with 
- * random characters.
+ * random characters. When the server is created with
+ * PJSIP_AUTH_SRV_VERIFY_NONCE option, the nonce must be left NULL so that
+ * a signed nonce is created, since the server would reject any other
+ * nonce.
  *
  * @param auth_srv	The server authentication structure.
  * @param qop		Optional qop value.
@@ -557,7 +704,9 @@ PJ_DECL(pj_status_t) pjsip_auth_srv_verify( pjsip_auth_srv *auth_srv,
  * @param tdata		The outgoing response message. The response must have
  *			401 or 407 response code.
  *
- * @return		PJ_SUCCESS on success.
+ * @return		PJ_SUCCESS on success, or PJ_EINVALIDOP when a
+ *			nonce is given to a server which verifies its own
+ *			nonces.
  */
 PJ_DECL(pj_status_t) pjsip_auth_srv_challenge( pjsip_auth_srv *auth_srv,
 					       const pj_str_t *qop,
@@ -592,6 +741,69 @@ PJ_DECL(void) pjsip_auth_create_digest(pj_str_t *result,
 				       const pjsip_cred_info *cred_info,
 				       const pj_str_t *method);
 
+/**
+ * Get the digest algorithm type from the algorithm parameter of a
+ * challenge or an authorization.
+ *
+ * @param algorithm	The algorithm name, e.g. "MD5" or "SHA-256". Empty
+ *			string means MD5.
+ *
+ * @return		The algorithm type, or PJSIP_AUTH_ALGORITHM_UNKNOWN.
+ */
+PJ_DECL(pjsip_auth_algorithm_type)
+pjsip_auth_get_algorithm_type(const pj_str_t *algorithm);
+
+/**
+ * Helper function to create the hashed credential (HA1) of the credential
+ * for the specified realm and algorithm.
+ *
+ * @param result	String to store the HA1. This string must have been
+ *			preallocated by caller with the buffer at least
+ *			PJSIP_SHA256STRLEN (64 bytes) in size.
+ * @param cred_info	Credential info, with plain text password or with
+ *			the HA1 of the same algorithm.
+ * @param realm		Realm.
+ * @param algorithm	The digest algorithm.
+ *
+ * @return		PJ_SUCCESS, or PJSIP_EINVALIDALGORITHM if the
+ *			credential can't be used with the algorithm.
+ */
+PJ_DECL(pj_status_t) pjsip_auth_create_ha1(pj_str_t *result,
+					   const pjsip_cred_info *cred_info,
+					   const pj_str_t *realm,
+					   pjsip_auth_algorithm_type algorithm);
+
+/**
+ * Helper function to create the response digest with the specified
+ * algorithm. See #pjsip_auth_create_digest() for the parameters.
+ *
+ * @param result	String to store the response digest. This string
+ *			must have been preallocated by caller with the 
+ *			buffer at least PJSIP_SHA256STRLEN (64 bytes) in size.
+ * @param nonce		Optional nonce.
+ * @param nc		Nonce count.
+ * @param cnonce	Optional cnonce.
+ * @param qop		Optional qop.
+ * @param uri		URI.
+ * @param realm		Realm.
+ * @param cred_info	Credential info.
+ * @param method	SIP method.
+ * @param algorithm	The digest algorithm.
+ *
+ * @return		PJ_SUCCESS, or PJSIP_EINVALIDALGORITHM if the
+ *			credential can't be used with the algorithm.
+ */
+PJ_DECL(pj_status_t) pjsip_auth_create_digest2(pj_str_t *result,
+					const pj_str_t *nonce,
+					const pj_str_t *nc,
+					const pj_str_t *cnonce,
+					const pj_str_t *qop,
+					const pj_str_t *uri,
+					const pj_str_t *realm,
+					const pjsip_cred_info *cred_info,
+					const pj_str_t *method,
+					pjsip_auth_algorithm_type algorithm);
+
 /**
  * @}
  */
@@ -181,6 +181,42 @@ typedef struct pjsip_cfg_t
          */
         pj_bool_t accept_multiple_sdp_answers;
 
+	/**
+	 * Number of worker threads to distribute incoming messages to the
+	 * modules. When this is zero, incoming messages are processed by
+	 * the thread which polls the endpoint. Otherwise the polling
+	 * threads only receive and parse the messages, and each message is
+	 * queued to the worker selected by the hash of its Call-ID, so
+	 * messages of the same dialog are still processed in order.
+	 *
+	 * This setting is read by pjsip_endpt_create().
+	 *
+	 * Default is PJSIP_ENDPT_RX_WORKER_CNT.
+	 */
+	unsigned rx_worker_cnt;
+
+	/**
+	 * Maximum number of messages waiting in the queue of each worker.
+	 * Messages received when the queue is full are dropped.
+	 *
+	 * Default is PJSIP_ENDPT_RX_QUEUE_SIZE.
+	 */
+	unsigned rx_queue_size;
+
+	/**
+	 * Number of timer heaps of the endpoint. Each heap has its own lock,
+	 * and a timer entry scheduled with the endpoint timer functions is
+	 * placed in the heap selected by the address of the entry, so
+	 * threads scheduling and cancelling transaction and dialog timers
+	 * no longer contend for a single lock. All heaps are polled by
+	 * pjsip_endpt_handle_events().
+	 *
+	 * This setting is read by pjsip_endpt_create().
+	 *
+	 * Default is PJSIP_ENDPT_TIMER_SHARD_CNT.
+	 */
+	unsigned timer_shard_cnt;
+
     } endpt;
 
     /** Transaction layer settings. */
@@ -211,9 +247,34 @@ typedef struct pjsip_cfg_t
 	 */
 	unsigned td;
 
+	/** Number of shards of the transaction table. Each shard has its own
+	 *  hash table and lock, and a transaction is placed in the shard
+	 *  selected by its key hash. Setting this to more than one reduces
+	 *  lock contention when several threads are processing messages at
+	 *  the same time. The value is clamped to PJSIP_TSX_MAX_SHARD_COUNT.
+	 *  Default value is PJSIP_TSX_SHARD_COUNT.
+	 */
+	unsigned shard_cnt;
+
     } tsx;
 
-    /* Dialog layer settings .. TODO */
+    /** Dialog layer settings. */
+    struct {
+
+	/** Number of shards of the dialog set table. Each shard has its own
+	 *  hash table and lock, and a dialog set is placed in the shard
+	 *  selected by the hash of its Call-ID. Setting this to more than
+	 *  one reduces lock contention when several threads are processing
+	 *  in-dialog messages at the same time, but makes lookups slower
+	 *  when there is only one such thread. Zero means one shard per
+	 *  incoming message worker (pjsip_cfg_t.endpt.rx_worker_cnt), and
+	 *  a single shard when there are no more than one worker. The
+	 *  value is clamped to PJSIP_DLG_MAX_SHARD_COUNT.
+	 *  Default value is PJSIP_DLG_SHARD_COUNT.
+	 */
+	unsigned shard_cnt;
+
+    } dlg;
 
     /** Client registration settings. */
     struct {
@@ -251,6 +312,23 @@ typedef struct pjsip_cfg_t
          */
         long keep_alive_interval;
 
+        /**
+         * Number of I/O worker threads for TCP and TLS connections. Each
+         * worker polls its own ioqueue and timer heap, and each new
+         * connection is assigned to one of the workers in round-robin
+         * fashion, so that the socket events, parsing and timers of a
+         * connection are always handled by the same thread. When this is
+         * zero, the connections are polled with the endpoint's ioqueue.
+         *
+         * The workers are started when a connection is created while
+         * this is non-zero, and they serve the connections until the
+         * endpoint is destroyed, so the number can't be changed
+         * afterwards.
+         *
+         * Default is PJSIP_TCP_IO_WORKER_CNT.
+         */
+        unsigned io_worker_cnt;
+
     } tcp;
 
     /** TLS transport settings */
@@ -296,9 +374,9 @@ PJ_INLINE(pjsip_cfg_t*) pjsip_cfg(void)
 
 
 /**
- * Specify maximum transaction count in transaction hash table.
- * For efficiency, the value should be 2^n-1 since it will be
- * rounded up to 2^n.
+ * Specify maximum transaction count in transaction hash table. This is
+ * the initial capacity of the table, which grows automatically when more
+ * transactions are created.
  *
  * Default value is 1023
  */
@@ -307,9 +385,34 @@ PJ_INLINE(pjsip_cfg_t*) pjsip_cfg(void)
 #endif
 
 /**
- * Specify maximum number of dialogs in the dialog hash table.
- * For efficiency, the value should be 2^n-1 since it will be
- * rounded up to 2^n.
+ * Specify the number of shards of the transaction table. The capacity
+ * specified in PJSIP_MAX_TSX_COUNT is divided evenly among the shards,
+ * and each shard is guarded by its own mutex. Applications which poll
+ * the endpoint from several worker threads should set this to roughly
+ * the number of worker threads (a power of two is recommended).
+ *
+ * This setting can also be changed at run-time via pjsip_cfg()->tsx, 
+ * before the transaction layer is initialized.
+ *
+ * Default value is 1
+ */
+#ifndef PJSIP_TSX_SHARD_COUNT
+#   define PJSIP_TSX_SHARD_COUNT	1
+#endif
+
+/**
+ * Specify the maximum number of shards of the transaction table.
+ *
+ * Default value is 256
+ */
+#ifndef PJSIP_TSX_MAX_SHARD_COUNT
+#   define PJSIP_TSX_MAX_SHARD_COUNT	256
+#endif
+
+/**
+ * Specify the initial number of dialog sets in the dialog hash table.
+ * The capacity is divided evenly among the shards of the table, and the
+ * tables grow automatically as dialogs are added.
  *
  * Default value is 511.
  */
@@ -317,6 +420,34 @@ PJ_INLINE(pjsip_cfg_t*) pjsip_cfg(void)
 #   define PJSIP_MAX_DIALOG_COUNT	(512-1)
 #endif
 
+/**
+ * Specify the number of shards of the dialog set table, see
+ * pjsip_cfg_t.dlg.shard_cnt. The default zero value derives the number
+ * of shards from the number of incoming message workers, so a single
+ * threaded application keeps the faster single table. Applications
+ * which process in-dialog messages from several threads of their own,
+ * such as B2BUAs polling the endpoint from several threads, should set
+ * this to roughly the number of processing threads (a power of two is
+ * recommended).
+ *
+ * This setting can also be changed at run-time via pjsip_cfg()->dlg,
+ * before the user agent module is initialized.
+ *
+ * Default value is 0
+ */
+#ifndef PJSIP_DLG_SHARD_COUNT
+#   define PJSIP_DLG_SHARD_COUNT	0
+#endif
+
+/**
+ * Specify the maximum number of shards of the dialog set table.
+ *
+ * Default value is 256
+ */
+#ifndef PJSIP_DLG_MAX_SHARD_COUNT
+#   define PJSIP_DLG_MAX_SHARD_COUNT	256
+#endif
+
 
 /**
  * Specify maximum number of transports.
@@ -329,7 +460,8 @@ PJ_INLINE(pjsip_cfg_t*) pjsip_cfg(void)
 
 
 /**
- * Transport manager hash table size (must be 2^n-1). 
+ * Transport manager hash table initial size. The table grows
+ * automatically when more transports are registered.
  * See also PJSIP_MAX_TRANSPORTS
  */
 #ifndef PJSIP_TPMGR_HTABLE_SIZE
@@ -363,6 +495,22 @@ PJ_INLINE(pjsip_cfg_t*) pjsip_cfg(void)
 #endif
 
 
+/**
+ * Maximum size of a message received on a stream oriented transport
+ * (TCP, TLS). A message bigger than PJSIP_MAX_PKT_LEN, whose headers
+ * still fit in PJSIP_MAX_PKT_LEN, is received into a buffer allocated
+ * for that message only, and the buffer is released as soon as the
+ * message has been processed. This lets large bodies through while the
+ * receive buffer of every connection stays PJSIP_MAX_PKT_LEN. Set this
+ * to PJSIP_MAX_PKT_LEN to reject messages bigger than the receive buffer.
+ *
+ * Default: 262144
+ */
+#ifndef PJSIP_MAX_STREAM_MSG_LEN
+#   define PJSIP_MAX_STREAM_MSG_LEN	262144
+#endif
+
+
 /**
  * RFC 3261 section 18.1.1:
  * If a request is within 200 bytes of the path MTU, or if it is larger
@@ -605,6 +753,22 @@ PJ_INLINE(pjsip_cfg_t*) pjsip_cfg(void)
 #   define PJSIP_ALLOW_PORT_IN_FROMTO_HDR	0
 #endif
 
+
+/**
+ * If non-zero, the parser records a hash of the printed headers of each
+ * header line whose raw text is kept when parsing #pjsip_rx_data with
+ * #PJSIP_PARSE_LAZY option, and the forwarding functions assert that the
+ * headers have not been modified in place before the raw text is
+ * forwarded (see #pjsip_parser_raw_hdr_check()). This prints every such
+ * header when the message is parsed, so it should only be enabled to
+ * debug applications that forward requests or responses.
+ *
+ * Default: 0
+ */
+#ifndef PJSIP_CHECK_RAW_HDR
+#   define PJSIP_CHECK_RAW_HDR		0
+#endif
+
 /**
  * This macro controls maximum numbers of ioqueue events to be processed
  * in a single pjsip_endpt_handle_events() poll. When PJSIP detects that
@@ -623,6 +787,41 @@ PJ_INLINE(pjsip_cfg_t*) pjsip_cfg(void)
 #endif
 
 
+/**
+ * Default number of worker threads to process incoming messages, see
+ * pjsip_cfg_t.endpt.rx_worker_cnt. Zero means incoming messages are
+ * processed by the thread which polls the endpoint.
+ *
+ * Default: 0
+ */
+#ifndef PJSIP_ENDPT_RX_WORKER_CNT
+#   define PJSIP_ENDPT_RX_WORKER_CNT	0
+#endif
+
+
+/**
+ * Default maximum number of messages waiting in each worker queue, see
+ * pjsip_cfg_t.endpt.rx_queue_size.
+ *
+ * Default: 1024
+ */
+#ifndef PJSIP_ENDPT_RX_QUEUE_SIZE
+#   define PJSIP_ENDPT_RX_QUEUE_SIZE	1024
+#endif
+
+
+/**
+ * Default number of timer heaps of the endpoint, see
+ * pjsip_cfg_t.endpt.timer_shard_cnt. The capacity specified in
+ * PJSIP_MAX_TIMER_COUNT is divided evenly among the heaps.
+ *
+ * Default: 1
+ */
+#ifndef PJSIP_ENDPT_TIMER_SHARD_CNT
+#   define PJSIP_ENDPT_TIMER_SHARD_CNT	1
+#endif
+
+
 /**
  * Max entries to process in timer heap per poll. 
  * 
@@ -786,6 +985,31 @@ PJ_INLINE(pjsip_cfg_t*) pjsip_cfg(void)
 #   define PJSIP_TCP_INITIAL_TIMEOUT	    0
 #endif
 
+
+/**
+ * Size of the buffer in which the messages queued on a TCP or TLS
+ * connection, while a previous write is still in progress, are coalesced
+ * to be sent in a single write (or a single TLS record). The buffer is
+ * only allocated when the connection first needs it. Messages larger than
+ * the buffer are sent on their own. Set to zero to disable coalescing.
+ *
+ * Default: 16384
+ */
+#ifndef PJSIP_TCP_TX_COALESCE_SIZE
+#   define PJSIP_TCP_TX_COALESCE_SIZE	    16384
+#endif
+
+
+/**
+ * Number of I/O worker threads for TCP and TLS connections. See
+ * pjsip_cfg()->tcp.io_worker_cnt.
+ *
+ * Default: 0 (connections are polled with the endpoint's ioqueue)
+ */
+#ifndef PJSIP_TCP_IO_WORKER_CNT
+#   define PJSIP_TCP_IO_WORKER_CNT	    0
+#endif
+
 /**
  * Set the interval to send keep-alive packet for TLS transports.
  * If the value is zero, keep-alive will be disabled for TLS.
@@ -855,6 +1079,39 @@ PJ_INLINE(pjsip_cfg_t*) pjsip_cfg(void)
 #endif
 
 
+/**
+ * Maximum number of resolved targets kept by the SIP resolver, keyed on
+ * the host, port and transport type of the target. A target found in this
+ * cache is resolved synchronously by #pjsip_resolve(), without running the
+ * DNS SRV and A/AAAA resolution again. Each entry takes about the size of
+ * #pjsip_server_addresses, and the memory is allocated as the cache fills.
+ * Set to zero to disable the cache.
+ *
+ * Default: 32
+ *
+ * @see PJSIP_RESOLVE_CACHE_MAX_TTL
+ */
+#ifndef PJSIP_RESOLVE_CACHE_SIZE
+#   define PJSIP_RESOLVE_CACHE_SIZE		    32
+#endif
+
+
+/**
+ * Maximum time, in seconds, a target is kept in the SIP resolver cache.
+ * The entry expires earlier if the smallest TTL of the DNS records used to
+ * resolve it is lower. Note that the TTL of a DNS record taken from the
+ * DNS resolver cache is not reduced by the time it has been cached, so
+ * this also bounds how long an outdated record may be used.
+ *
+ * Default: 60
+ *
+ * @see PJSIP_RESOLVE_CACHE_SIZE
+ */
+#ifndef PJSIP_RESOLVE_CACHE_MAX_TTL
+#   define PJSIP_RESOLVE_CACHE_MAX_TTL		    60
+#endif
+
+
 /**
  * Enable TLS SIP transport support. For most systems this means that
  * OpenSSL must be installed.
@@ -946,6 +1203,29 @@ PJ_INLINE(pjsip_cfg_t*) pjsip_cfg(void)
 #   define PJSIP_POOL_INC_TDATA		4000
 #endif
 
+/**
+ * Maximum number of destroyed transmit data to be kept by each thread for
+ * reuse by #pjsip_tx_data_create(). A recycled tdata keeps its pool, lock
+ * and reference counter, and the pool is rewound instead of released.
+ * Set to zero to always create and destroy the tdata.
+ *
+ * Default: 16
+ */
+#ifndef PJSIP_TDATA_CACHE_SIZE
+#   define PJSIP_TDATA_CACHE_SIZE	16
+#endif
+
+/**
+ * Maximum number of freed rdata clones to be kept by each thread for reuse
+ * by #pjsip_rx_data_clone(). Set to zero to always create and release the
+ * pool of the clone.
+ *
+ * Default: 4
+ */
+#ifndef PJSIP_RDATA_CACHE_SIZE
+#   define PJSIP_RDATA_CACHE_SIZE	4
+#endif
+
 /**
  * Initial memory size for UA layer
  */
@@ -1190,6 +1470,42 @@ PJ_INLINE(pjsip_cfg_t*) pjsip_cfg(void)
 #   define PJSIP_AUTH_CACHED_POOL_MAX_SIZE	(20 * 1024)
 #endif
 
+/**
+ * Number of seconds a credential is kept in the server authentication
+ * cache (see \a cache_size in #pjsip_auth_srv_init_param) before it is
+ * looked up again. A cached credential which fails to verify is looked
+ * up again immediately, so a changed password is picked up anyway.
+ *
+ * Default: 300 seconds
+ */
+#ifndef PJSIP_AUTH_SRV_CACHE_TTL
+#   define PJSIP_AUTH_SRV_CACHE_TTL		300
+#endif
+
+/**
+ * Number of seconds the nonce created by the server authentication with
+ * PJSIP_AUTH_SRV_VERIFY_NONCE option is valid. Authorizations with older
+ * nonces are rejected as stale, and the client retries with a new nonce.
+ *
+ * Default: 300 seconds
+ */
+#ifndef PJSIP_AUTH_SRV_NONCE_EXPIRY
+#   define PJSIP_AUTH_SRV_NONCE_EXPIRY		300
+#endif
+
+/**
+ * Number of nonces whose highest nonce-count is remembered by the server
+ * authentication with PJSIP_AUTH_SRV_VERIFY_NONCE option. Each entry
+ * takes 8 bytes. The table is indexed by the nonce hash, and a nonce which
+ * has been pushed out of the table is treated as stale on its next use
+ * with a nonce-count higher than one.
+ *
+ * Default: 1024
+ */
+#ifndef PJSIP_AUTH_SRV_NC_TABLE_SIZE
+#   define PJSIP_AUTH_SRV_NC_TABLE_SIZE		1024
+#endif
+
 /*****************************************************************************
  *  SIP Event framework and presence settings.
  */
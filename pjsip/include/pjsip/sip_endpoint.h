@@ -216,7 +216,15 @@ PJ_DECL(void) pjsip_endpt_cancel_timer( pjsip_endpoint *endpt,
 					pj_timer_entry *entry );
 
 /**
- * Get the timer heap instance of the SIP endpoint.
+ * Get the timer heap instance of the SIP endpoint. When the endpoint timer
+ * is split into several heaps (see pjsip_cfg_t.endpt.timer_shard_cnt),
+ * this is only the first heap. It is polled by
+ * #pjsip_endpt_handle_events() like the other heaps, but entries which are
+ * scheduled on it directly must also be cancelled on it directly, and must
+ * not be passed to #pjsip_endpt_cancel_timer(), which looks for the entry
+ * in the heap selected by #pjsip_endpt_get_entry_timer_heap(). Debug builds
+ * assert on such mismatch. Likewise, polling this heap directly only
+ * polls the first heap, use #pjsip_endpt_poll_timers() instead.
  *
  * @param endpt	    The endpoint.
  *
@@ -224,6 +232,39 @@ PJ_DECL(void) pjsip_endpt_cancel_timer( pjsip_endpoint *endpt,
  */
 PJ_DECL(pj_timer_heap_t*) pjsip_endpt_get_timer_heap(pjsip_endpoint *endpt);
 
+/**
+ * Get the timer heap on which the endpoint schedules the specified timer
+ * entry. When the endpoint timer is split into several heaps (see
+ * pjsip_cfg_t.endpt.timer_shard_cnt), each entry is placed in the heap
+ * selected by its address, so an entry which is scheduled with
+ * #pjsip_endpt_schedule_timer() must be cancelled with
+ * #pjsip_endpt_cancel_timer() or on the heap returned by this function,
+ * and vice versa.
+ *
+ * @param endpt	    The endpoint.
+ * @param entry	    The timer entry.
+ *
+ * @return	    The timer heap instance.
+ */
+PJ_DECL(pj_timer_heap_t*) pjsip_endpt_get_entry_timer_heap(
+					    pjsip_endpoint *endpt,
+					    const pj_timer_entry *entry);
+
+/**
+ * Poll the timer heaps of the endpoint without polling the transports.
+ * This is used by applications which poll the ioqueue and the timers
+ * from separate threads. #pjsip_endpt_handle_events() already polls the
+ * timer heaps.
+ *
+ * @param endpt	    The endpoint.
+ * @param next_delay Optional argument to receive the delay until the next
+ *		    timer entry expires.
+ *
+ * @return	    The number of timer entries which have been handled.
+ */
+PJ_DECL(unsigned) pjsip_endpt_poll_timers(pjsip_endpoint *endpt,
+					  pj_time_val *next_delay);
+
 
 /**
  * Register new module to the endpoint.
@@ -483,6 +524,20 @@ PJ_DECL(void) pjsip_endpt_resolve( pjsip_endpoint *endpt,
  */
 PJ_DECL(pjsip_tpmgr*) pjsip_endpt_get_tpmgr(pjsip_endpoint *endpt);
 
+/**
+ * Set the options to be used when parsing messages received by the
+ * endpoint's transports. Setting #PJSIP_PARSE_LAZY defers parsing of
+ * headers which are not needed to route and match the message until
+ * they are looked up, see #pjsip_tpmgr_set_parse_options().
+ *
+ * @param endpt	    The endpoint.
+ * @param options   Bitmask of #pjsip_parse_option.
+ *
+ * @return	    PJ_SUCCESS on success.
+ */
+PJ_DECL(pj_status_t) pjsip_endpt_set_parse_options(pjsip_endpoint *endpt,
+						   unsigned options);
+
 /**
  * Get ioqueue instance.
  *
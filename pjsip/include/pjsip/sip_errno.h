@@ -401,6 +401,12 @@ PJ_BEGIN_DECL
  * No challenge is found in the challenge.
  */
 #define PJSIP_EAUTHNOCHAL	(PJSIP_ERRNO_START_PJSIP + 114)	/* 171114 */
+/**
+ * @hideinitializer
+ * The nonce in the authorization has expired or its nonce-count has
+ * been used before. Server should challenge again with stale=true.
+ */
+#define PJSIP_EAUTHSTALENONCE	(PJSIP_ERRNO_START_PJSIP + 115)	/* 171115 */
 
 /************************************************************
  * UA AND DIALOG ERRORS
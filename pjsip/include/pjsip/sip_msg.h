@@ -830,7 +830,14 @@ PJ_DECL(pjsip_msg*) pjsip_msg_clone( pj_pool_t *pool, const pjsip_msg *msg);
 
 
 /** 
- * Find a header in the message by the header type.
+ * Find a header in the message by the header type. Lazy headers (see
+ * #pjsip_lazy_hdr) of the specified type are parsed when they are found.
+ *
+ * Note that despite the const \a msg, parsing a lazy header modifies the
+ * message's header list and allocates from the message's pool, so the
+ * lookup is not thread-safe: a message which may contain lazy headers
+ * (e.g. the message of #pjsip_rx_data) must not be searched by several
+ * threads at the same time without synchronization.
  *
  * @param msg	    The message.
  * @param type	    The header type to find.
@@ -846,7 +853,9 @@ PJ_DECL(void*)  pjsip_msg_find_hdr( const pjsip_msg *msg,
 				    pjsip_hdr_e type, const void *start);
 
 /** 
- * Find a header in the message by its name.
+ * Find a header in the message by its name. Lazy headers with this name,
+ * and lazy headers whose name can't be matched without parsing, are
+ * parsed, with the same thread-safety restriction as #pjsip_msg_find_hdr().
  *
  * @param msg	    The message.
  * @param name	    The header name to find.
@@ -863,7 +872,9 @@ PJ_DECL(void*)  pjsip_msg_find_hdr_by_name( const pjsip_msg *msg,
 					    const void *start);
 
 /** 
- * Find a header in the message by its name and short name version.
+ * Find a header in the message by its name and short name version. Lazy
+ * headers are parsed as in #pjsip_msg_find_hdr_by_name(), with the same
+ * thread-safety restriction as #pjsip_msg_find_hdr().
  *
  * @param msg	    The message.
  * @param name	    The header name to find.
@@ -1060,6 +1071,70 @@ PJ_DECL(void) pjsip_generic_string_hdr_init2(pjsip_generic_string_hdr *h,
 					     pj_str_t *hvalue);
 
 
+/* **************************************************************************/
+
+/**
+ * Lazy header, i.e. a header which has a registered parser but has not
+ * been parsed yet, created by the parser in #PJSIP_PARSE_LAZY mode. Its
+ * type is PJSIP_H_OTHER and its layout is compatible with
+ * #pjsip_generic_string_hdr, with the raw header value as the hvalue.
+ *
+ * The header is replaced by the parsed header(s) when it is looked up
+ * with #pjsip_msg_find_hdr(), #pjsip_msg_find_hdr_by_name(),
+ * #pjsip_msg_find_hdr_by_names(), or #pjsip_msg_find_remove_hdr().
+ * Code which iterates the header list directly may use
+ * #pjsip_lazy_hdr_decode() to parse the header.
+ */
+typedef struct pjsip_lazy_hdr
+{
+    /** Standard header field. */
+    PJSIP_DECL_HDR_MEMBER(struct pjsip_lazy_hdr);
+    /** The raw header value. */
+    pj_str_t hvalue;
+    /** Pool to allocate the parsed header. */
+    pj_pool_t *pool;
+} pjsip_lazy_hdr;
+
+
+/**
+ * Create a lazy header. The name and value are not copied, so they must
+ * remain valid for the lifetime of the header (normally they point to
+ * the packet buffer of #pjsip_rx_data).
+ *
+ * @param pool	    The pool, which will also be used to allocate the
+ *		    parsed header.
+ * @param hname	    The header name.
+ * @param hvalue    The raw header value.
+ *
+ * @return	    The header.
+ */
+PJ_DECL(pjsip_lazy_hdr*) pjsip_lazy_hdr_create(pj_pool_t *pool,
+					       const pj_str_t *hname,
+					       const pj_str_t *hvalue);
+
+/**
+ * Check whether the header is a lazy header which has not been parsed.
+ *
+ * @param hdr	    The header.
+ *
+ * @return	    PJ_TRUE if the header is a lazy header.
+ */
+PJ_DECL(pj_bool_t) pjsip_hdr_is_lazy(const void *hdr);
+
+/**
+ * Parse a lazy header. If the header is in a list (e.g. the message's
+ * header list), it will be replaced by the parsed header(s) in the list.
+ * If the value can't be parsed, the header is converted to a generic
+ * string header.
+ *
+ * @param hdr	    The lazy header.
+ *
+ * @return	    The (first) parsed header, or the header itself if
+ *		    the header can't be parsed or is not a lazy header.
+ */
+PJ_DECL(void*) pjsip_lazy_hdr_decode(pjsip_lazy_hdr *hdr);
+
+
 /* **************************************************************************/
 
 /**
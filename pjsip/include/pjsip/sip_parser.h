@@ -102,6 +102,41 @@ typedef struct pjsip_parser_err_report
 } pjsip_parser_err_report;
 
 
+/**
+ * Raw text of a header line which was parsed into header structure(s)
+ * when parsing #pjsip_rx_data in #PJSIP_PARSE_LAZY mode. It is used to
+ * forward the headers without printing them again (see
+ * #pjsip_endpt_create_request_fwd()).
+ */
+typedef struct pjsip_parser_raw_hdr
+{
+    /** Standard list members. */
+    PJ_DECL_LIST_MEMBER(struct pjsip_parser_raw_hdr);
+    pjsip_hdr  *hdr;		/**< The first header parsed from the line. */
+    unsigned	cnt;		/**< Number of headers parsed from the line. */
+    pj_str_t	name;		/**< Header name as found in the line.	    */
+    pj_str_t	value;		/**< Raw header value.			    */
+    pj_uint32_t	hash;		/**< Hash of the printed headers, only
+				     calculated when PJSIP_CHECK_RAW_HDR
+				     is set.				    */
+} pjsip_parser_raw_hdr;
+
+
+/**
+ * Check that the headers parsed from a raw header line have not been
+ * modified in place since the message was parsed, i.e. that the raw text
+ * may still be forwarded instead of the headers. The check is only done
+ * when #PJSIP_CHECK_RAW_HDR is set, otherwise the function always returns
+ * PJ_TRUE.
+ *
+ * @param raw_hdr	The raw header line.
+ *
+ * @return		PJ_FALSE if the headers have been modified.
+ */
+PJ_DECL(pj_bool_t) pjsip_parser_raw_hdr_check(
+				    const pjsip_parser_raw_hdr *raw_hdr);
+
+
 /**
  * Parsing context, the default argument for parsing functions.
  */
@@ -110,9 +145,39 @@ typedef struct pjsip_parse_ctx
     pj_scanner      *scanner;   /**< The scanner.       */
     pj_pool_t       *pool;      /**< The pool.          */
     pjsip_rx_data   *rdata;     /**< Optional rdata.    */
+    unsigned	     options;	/**< Parse options, bitmask of
+				     #pjsip_parse_option. */
 } pjsip_parse_ctx;
 
 
+/**
+ * Options for #pjsip_parse_msg2() and #pjsip_parse_rdata2().
+ */
+typedef enum pjsip_parse_option
+{
+    /**
+     * Lazy header parsing. Only headers that are needed to route and
+     * match the message, i.e. the ones kept in \a msg_info of
+     * #pjsip_rx_data (Via, From, To, Call-ID, CSeq, Route, Record-Route,
+     * Max-Forwards, Content-Type, Content-Length, Require and Supported),
+     * are parsed. Other headers which have a registered parser are put in
+     * the message as #pjsip_lazy_hdr, whose value points to the packet
+     * buffer, and they are only parsed when they are looked up with
+     * #pjsip_msg_find_hdr() and friends. Syntax errors in lazy headers
+     * are not reported, and such headers are kept as generic string
+     * headers.
+     *
+     * When parsing #pjsip_rx_data, the raw text of the other header lines
+     * is recorded in \a msg_info.raw_hdr, and the request and response
+     * forwarding functions copy unchanged headers as raw text. Headers of
+     * the received message must then not be modified in place before the
+     * message is forwarded.
+     */
+    PJSIP_PARSE_LAZY = 1
+
+} pjsip_parse_option;
+
+
 /**
  * Type of function to parse header. The parsing function must follow these
  * specification:
@@ -254,6 +319,25 @@ PJ_DECL(pjsip_msg *) pjsip_parse_msg( pj_pool_t *pool,
 				      char *buf, pj_size_t size,
 				      pjsip_parser_err_report *err_list);
 
+/**
+ * Variant of #pjsip_parse_msg() with parse options.
+ *
+ * @param pool		The pool to allocate memory.
+ * @param buf		The input buffer, which MUST be NULL terminated. With
+ *			#PJSIP_PARSE_LAZY, the buffer must remain valid as
+ *			long as the message is used.
+ * @param size		The length of the string (not counting NULL terminator).
+ * @param err_list	If this parameter is not NULL, then the parser will
+ *			put error messages during parsing in this list.
+ * @param options	Bitmask of #pjsip_parse_option.
+ *
+ * @return		The message or NULL when failed.
+ */
+PJ_DECL(pjsip_msg *) pjsip_parse_msg2( pj_pool_t *pool, 
+				       char *buf, pj_size_t size,
+				       pjsip_parser_err_report *err_list,
+				       unsigned options);
+
 
 /**
  * Parse a packet buffer and build a rdata. The resulting message will be
@@ -276,6 +360,21 @@ PJ_DECL(pjsip_msg *) pjsip_parse_msg( pj_pool_t *pool,
 PJ_DECL(pjsip_msg *) pjsip_parse_rdata( char *buf, pj_size_t size,
                                         pjsip_rx_data *rdata );
 
+/**
+ * Variant of #pjsip_parse_rdata() with parse options.
+ *
+ * @param buf		The input buffer, which MUST be NULL terminated.
+ * @param size		The length of the string (not counting NULL terminator).
+ * @param rdata         The receive data buffer to store the message and
+ *                      its elements.
+ * @param options	Bitmask of #pjsip_parse_option.
+ *
+ * @return              The message inside the rdata if successfull, or NULL.
+ */
+PJ_DECL(pjsip_msg *) pjsip_parse_rdata2( char *buf, pj_size_t size,
+                                         pjsip_rx_data *rdata,
+					 unsigned options );
+
 /**
  * Check incoming packet to see if a (probably) valid SIP message has been 
  * received.
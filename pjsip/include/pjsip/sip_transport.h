@@ -285,6 +285,25 @@ typedef struct pjsip_rx_data_op_key
 } pjsip_rx_data_op_key;
 
 
+/**
+ * State of the framing of the messages received on a stream oriented
+ * transport (TCP, TLS). It is kept across reads, so that the part of a
+ * message which has been examined is not scanned again when the rest of
+ * the message arrives. It also holds the buffer of a message which is
+ * bigger than the receive buffer, see #PJSIP_MAX_STREAM_MSG_LEN.
+ */
+typedef struct pjsip_rx_framer
+{
+    pj_size_t		 scanned;   /**< Bytes searched for the end of the
+					 headers.			    */
+    pj_size_t		 msg_size;  /**< Size of the message, or zero if
+					 it's not known yet.		    */
+    pj_pool_t		*pool;	    /**< Pool of the oversized message.    */
+    char		*buf;	    /**< Oversized message buffer, or NULL.*/
+    pj_size_t		 len;	    /**< Bytes received in \a buf.	    */
+} pjsip_rx_framer;
+
+
 /**
  * Incoming message buffer.
  * This structure keep all the information regarding the received message. This
@@ -313,6 +332,9 @@ struct pjsip_rx_data
 	/** Ioqueue key. */
 	pjsip_rx_data_op_key	 op_key;
 
+	/** Framing state, used by stream oriented transports. */
+	pjsip_rx_framer		 framer;
+
     } tp_info;
 
 
@@ -414,6 +436,18 @@ struct pjsip_rx_data
 	 */
 	pjsip_parser_err_report parse_err;
 
+	/** The raw text of the parsed (i.e. non-lazy) header lines, in the
+	 *  order of the header list. This is only recorded when the message
+	 *  is parsed in #PJSIP_PARSE_LAZY mode, and the list is empty
+	 *  otherwise.
+	 */
+	pjsip_parser_raw_hdr	raw_hdr;
+
+	/** Messages which refer to the packet buffer, see
+	 *  #pjsip_rx_data_lend_buf().
+	 */
+	struct pjsip_rx_data_lend *lend;
+
     } msg_info;
 
 
@@ -477,6 +511,50 @@ PJ_DECL(pj_status_t) pjsip_rx_data_clone(const pjsip_rx_data *src,
  */
 PJ_DECL(pj_status_t) pjsip_rx_data_free_cloned(pjsip_rx_data *rdata);
 
+/**
+ * Let the message in \a tdata refer to the packet buffer of \a rdata,
+ * (i.e. \a msg_info.msg_buf), instead of to its own copy of the packet.
+ * The forwarding functions such as #pjsip_endpt_create_request_fwd() use
+ * this to forward unchanged header lines and body as raw text.
+ *
+ * The packet is copied to the pool of \a tdata, and the header and body
+ * which still refer to the packet are moved to the copy, when \a tdata is
+ * sent (see #pjsip_tx_data_own_buf()). A reference to \a tdata is held
+ * until #pjsip_rx_data_release_buf() is called for \a rdata, which does
+ * the same if \a tdata hasn't been sent and is still in use. Therefore
+ * \a tdata must not be sent by other thread before the buffer is
+ * released. Headers which are shallow cloned from such message are not
+ * moved, and must not be used after the buffer is released.
+ *
+ * @param rdata	    The receive data buffer.
+ * @param tdata	    The transmit data buffer.
+ *
+ * @return	    PJ_SUCCESS on success or the appropriate error.
+ */
+PJ_DECL(pj_status_t) pjsip_rx_data_lend_buf(pjsip_rx_data *rdata,
+					    pjsip_tx_data *tdata);
+
+/**
+ * Release the references to the packet buffer of \a rdata made with
+ * #pjsip_rx_data_lend_buf(). The transport manager calls this after the
+ * message has been processed, and #pjsip_rx_data_free_cloned() calls it
+ * before freeing a cloned rdata, so application only needs to call it
+ * for rdata that it has created itself.
+ *
+ * @param rdata	    The receive data buffer.
+ */
+PJ_DECL(void) pjsip_rx_data_release_buf(pjsip_rx_data *rdata);
+
+/**
+ * Reset the framing state of a stream oriented transport, releasing the
+ * buffer of the oversized message being received, if any. Transports
+ * must call this for the rdata of the connection when the connection is
+ * destroyed.
+ *
+ * @param framer    The framing state.
+ */
+PJ_DECL(void) pjsip_rx_framer_reset(pjsip_rx_framer *framer);
+
 
 /*****************************************************************************
  *
@@ -642,6 +720,14 @@ struct pjsip_tx_data
      */
     pjsip_host_port          via_addr;      /**< Via address.	        */
     const void              *via_tp;        /**< Via transport.	        */
+
+    /**
+     * Packet buffer of #pjsip_rx_data which the message still refers to,
+     * set by #pjsip_rx_data_lend_buf() until #pjsip_tx_data_own_buf() is
+     * called. Normally application should not use or access these fields.
+     */
+    const char		    *lent_buf;	    /**< The packet.		*/
+    pj_ssize_t		     lent_len;	    /**< Length of the packet.	*/
 };
 
 
@@ -711,6 +797,18 @@ PJ_DECL(pj_bool_t) pjsip_tx_data_is_valid( pjsip_tx_data *tdata );
  */
 PJ_DECL(void) pjsip_tx_data_invalidate_msg( pjsip_tx_data *tdata );
 
+/**
+ * Move the header and body of the message which still refer to the packet
+ * buffer of #pjsip_rx_data (see #pjsip_rx_data_lend_buf()) to a copy of
+ * the packet in the pool of \a tdata. This is called before the message
+ * is handed to the resolver or the transport, which may print it from
+ * another thread, so that the message isn't moved while it's printed.
+ * Nothing is done if the message doesn't refer to a packet buffer.
+ *
+ * @param tdata	    The transmit buffer.
+ */
+PJ_DECL(void) pjsip_tx_data_own_buf( pjsip_tx_data *tdata );
+
 /**
  * Get short printable info about the transmit data. This will normally return
  * short information about the message.
@@ -905,6 +1003,35 @@ struct pjsip_transport
 };
 
 
+/**
+ * Transmit statistics of a connection oriented transport, such as TCP or
+ * TLS. Messages which are sent while a previous write on the connection
+ * is still in progress are queued, and sent together in a single write
+ * once the socket becomes writable again.
+ */
+typedef struct pjsip_transport_tx_stat
+{
+    /** Number of messages currently waiting in the queue. */
+    unsigned	    queued_msgs;
+
+    /** Total size of the messages currently waiting in the queue. */
+    pj_size_t	    queued_bytes;
+
+    /** Highest number of messages that have waited in the queue. */
+    unsigned	    max_queued_msgs;
+
+    /** Number of messages which had to be queued. */
+    pj_uint32_t	    total_queued_msgs;
+
+    /** Number of writes which carried more than one queued message. */
+    pj_uint32_t	    coalesced_writes;
+
+    /** Number of messages sent in the coalesced writes. */
+    pj_uint32_t	    coalesced_msgs;
+
+} pjsip_transport_tx_stat;
+
+
 /**
  * Register a transport instance to the transport manager. This function
  * is normally called by the transport instance when it is created
@@ -1266,6 +1393,58 @@ PJ_DECL(pj_status_t) pjsip_tpmgr_find_local_addr2(pjsip_tpmgr *tpmgr,
 PJ_DECL(unsigned) pjsip_tpmgr_get_transport_count(pjsip_tpmgr *mgr);
 
 
+/**
+ * Statistics of the transmit data and rdata clone recycling of the
+ * transport manager, summed over all threads. See #PJSIP_TDATA_CACHE_SIZE
+ * and #PJSIP_RDATA_CACHE_SIZE.
+ */
+typedef struct pjsip_tpmgr_cache_stat
+{
+    pj_size_t	tdata_reused;	/**< Number of tdata taken from cache.	    */
+    pj_size_t	tdata_created;	/**< Number of tdata newly created.	    */
+    pj_size_t	rdata_reused;	/**< Number of rdata clones from cache.    */
+    pj_size_t	rdata_created;	/**< Number of rdata clones newly created. */
+} pjsip_tpmgr_cache_stat;
+
+
+/**
+ * Get the statistics of transmit data and rdata clone recycling. The
+ * counters are all zero when recycling is disabled.
+ *
+ * @param mgr	    The transport manager.
+ * @param stat	    Pointer to receive the statistics.
+ *
+ * @return	    PJ_SUCCESS, or the appropriate error code.
+ */
+PJ_DECL(pj_status_t) pjsip_tpmgr_get_cache_stat(pjsip_tpmgr *mgr,
+						pjsip_tpmgr_cache_stat *stat);
+
+
+/**
+ * Get the ioqueue and timer heap to be used by a new connection oriented
+ * transport (TCP or TLS). When pjsip_cfg()->tcp.io_worker_cnt is zero,
+ * these are the endpoint's ioqueue and timer heap. Otherwise the first
+ * call starts that many I/O workers, each polling its own ioqueue and
+ * timer heap in its own thread, and each call returns the ioqueue and
+ * timer heap of the next worker in round-robin fashion. The workers are
+ * stopped when the transport manager is destroyed, once the group locks
+ * of their connections have been destroyed.
+ *
+ * @param mgr		The transport manager.
+ * @param grp_lock	The group lock of the connection, which must also be
+ *			the group lock of its ioqueue key. The worker is
+ *			kept until the group lock is destroyed.
+ * @param p_ioqueue	Pointer to receive the ioqueue.
+ * @param p_timer_heap	Pointer to receive the timer heap.
+ *
+ * @return		PJ_SUCCESS, or the error starting the workers.
+ */
+PJ_DECL(pj_status_t) pjsip_tpmgr_get_io_worker(pjsip_tpmgr *mgr,
+					       pj_grp_lock_t *grp_lock,
+					       pj_ioqueue_t **p_ioqueue,
+					       pj_timer_heap_t **p_timer_heap);
+
+
 /**
  * Destroy a transport manager. Normally application doesn't need to call
  * this function directly, since a transport manager will be created and
@@ -1625,6 +1804,20 @@ PJ_DECL(pj_status_t) pjsip_tpmgr_set_drop_data_cb(pjsip_tpmgr *mgr,
 						  pjsip_tp_on_rx_dropped_cb cb);
 
 
+/**
+ * Set the options to be used when parsing incoming messages, e.g.
+ * #PJSIP_PARSE_LAZY to defer parsing of headers which are not needed by
+ * the stack until they are looked up. By default no option is set.
+ *
+ * @param mgr	    Transport manager.
+ * @param options   Bitmask of #pjsip_parse_option.
+ *
+ * @return	    PJ_SUCCESS on success, or the appropriate error code.
+ */
+PJ_DECL(pj_status_t) pjsip_tpmgr_set_parse_options(pjsip_tpmgr *mgr,
+						   unsigned options);
+
+
 /**
  * @}
  */
@@ -234,6 +234,19 @@ PJ_DECL(pj_status_t) pjsip_tcp_transport_start3(
  */
 PJ_DECL(pj_sock_t) pjsip_tcp_transport_get_socket(pjsip_transport *transport);
 
+/**
+ * Retrieve the transmit statistics of the TCP transport, to monitor the
+ * back-pressure on the connection.
+ *
+ * @param transport	The TCP transport.
+ * @param stat		Structure to receive the statistics.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+PJ_DECL(pj_status_t) pjsip_tcp_transport_get_tx_stat(
+					pjsip_transport *transport,
+					pjsip_transport_tx_stat *stat);
+
 /**
  * Start the TCP listener, if the listener is not started yet. This is useful
  * to start the listener manually, if listener was not started when 
@@ -556,6 +556,20 @@ PJ_DECL(pj_status_t) pjsip_tls_transport_restart(pjsip_tpfactory *factory,
 						const pj_sockaddr *local,
 						const pjsip_host_port *a_name);
 
+
+/**
+ * Retrieve the transmit statistics of the TLS transport, to monitor the
+ * back-pressure on the connection.
+ *
+ * @param transport	The TLS transport.
+ * @param stat		Structure to receive the statistics.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+PJ_DECL(pj_status_t) pjsip_tls_transport_get_tx_stat(
+					pjsip_transport *transport,
+					pjsip_transport_tx_stat *stat);
+
 PJ_END_DECL
 
 /**
@@ -519,9 +519,9 @@ static void set_timer( pjsip_evsub *sub, int timer_id,
 	timeout.sec = seconds;
 	timeout.msec = 0;
 
-	pj_timer_heap_schedule_w_grp_lock(
-			    pjsip_endpt_get_timer_heap(sub->endpt),
-			    &sub->timer, &timeout, timer_id, sub->grp_lock);
+	pjsip_endpt_schedule_timer_w_grp_lock(sub->endpt, &sub->timer,
+					      &timeout, timer_id,
+					      sub->grp_lock);
 
 	PJ_LOG(5,(sub->obj_name, "Timer %s scheduled in %d seconds", 
 		  timer_names[sub->timer.id], timeout.sec));
@@ -813,8 +813,9 @@ static void schedule_registration ( pjsip_regc *regc, pj_uint32_t expiration )
     if (regc->auto_reg && expiration > 0 && expiration != NOEXP) {
         pj_time_val delay = { 0, 0};
 
-        pj_timer_heap_cancel_if_active(pjsip_endpt_get_timer_heap(regc->endpt),
-                                       &regc->timer, 0);
+        pj_timer_heap_cancel_if_active(
+                pjsip_endpt_get_entry_timer_heap(regc->endpt, &regc->timer),
+                &regc->timer, 0);
 
         delay.sec = expiration - regc->delay_before_refresh;
         if (regc->expires != PJSIP_REGC_EXPIRATION_NOT_SPECIFIED && 
@@ -26,6 +26,7 @@
 #include <pjsip/sip_errno.h>
 #include <pjsip/sip_util.h>
 #include <pjlib-util/md5.h>
+#include <pjlib-util/sha256.h>
 #include <pj/log.h>
 #include <pj/string.h>
 #include <pj/pool.h>
@@ -36,8 +37,8 @@
 
 
 /* A macro just to get rid of type mismatch between char and unsigned char */
-#define MD5_APPEND(pms,buf,len)	pj_md5_update(pms, (const pj_uint8_t*)buf, \
-					      (unsigned)len)
+#define DIGEST_APPEND(ctx,buf,len)  digest_update(ctx, (const pj_uint8_t*)buf, \
+						  (pj_size_t)len)
 
 /* Logging. */
 #define THIS_FILE   "sip_auth_client.c"
@@ -121,131 +122,293 @@ PJ_DEF(void) pjsip_auth_clt_pref_dup( pj_pool_t *pool,
 
 
 /* Transform digest to string.
- * output must be at least PJSIP_MD5STRLEN+1 bytes.
+ * output must be at least len*2 bytes.
  *
  * NOTE: THE OUTPUT STRING IS NOT NULL TERMINATED!
  */
-static void digest2str(const unsigned char digest[], char *output)
+static void digest2str(const unsigned char digest[], unsigned len,
+		       char *output)
 {
-    int i;
-    for (i = 0; i<16; ++i) {
+    unsigned i;
+    for (i = 0; i<len; ++i) {
 	pj_val_to_hex_digit(digest[i], output);
 	output += 2;
     }
 }
 
 
+/* Hash context of the supported digest algorithms. */
+typedef struct digest_ctx
+{
+    pjsip_auth_algorithm_type	algorithm;
+    union {
+	pj_md5_context		md5;
+	pj_sha256_context	sha256;
+    } u;
+} digest_ctx;
+
+/* Length of the digest string of the algorithm. */
+static unsigned digest_strlen(pjsip_auth_algorithm_type algorithm)
+{
+    return (algorithm == PJSIP_AUTH_ALGORITHM_SHA256) ? PJSIP_SHA256STRLEN :
+						         PJSIP_MD5STRLEN;
+}
+
+static void digest_init(digest_ctx *ctx, pjsip_auth_algorithm_type algorithm)
+{
+    ctx->algorithm = algorithm;
+    if (algorithm == PJSIP_AUTH_ALGORITHM_SHA256)
+	pj_sha256_init(&ctx->u.sha256);
+    else
+	pj_md5_init(&ctx->u.md5);
+}
+
+static void digest_update(digest_ctx *ctx, const pj_uint8_t *data,
+			  pj_size_t len)
+{
+    if (ctx->algorithm == PJSIP_AUTH_ALGORITHM_SHA256)
+	pj_sha256_update(&ctx->u.sha256, data, len);
+    else
+	pj_md5_update(&ctx->u.md5, data, (unsigned)len);
+}
+
+/* Finish the hash and store the digest string in output, which must be
+ * at least digest_strlen() bytes.
+ */
+static void digest_final(digest_ctx *ctx, char *output)
+{
+    unsigned char digest[PJ_SHA256_DIGEST_SIZE];
+
+    if (ctx->algorithm == PJSIP_AUTH_ALGORITHM_SHA256) {
+	pj_sha256_final(&ctx->u.sha256, digest);
+	digest2str(digest, PJ_SHA256_DIGEST_SIZE, output);
+    } else {
+	pj_md5_final(&ctx->u.md5, digest);
+	digest2str(digest, 16, output);
+    }
+}
+
+
 /*
- * Create response digest based on the parameters and store the
- * digest ASCII in 'result'.
+ * Get the digest algorithm type from the algorithm parameter.
  */
-PJ_DEF(void) pjsip_auth_create_digest( pj_str_t *result,
-				       const pj_str_t *nonce,
-				       const pj_str_t *nc,
-				       const pj_str_t *cnonce,
-				       const pj_str_t *qop,
-				       const pj_str_t *uri,
-				       const pj_str_t *realm,
-				       const pjsip_cred_info *cred_info,
-				       const pj_str_t *method)
+PJ_DEF(pjsip_auth_algorithm_type)
+pjsip_auth_get_algorithm_type(const pj_str_t *algorithm)
 {
-    char ha1[PJSIP_MD5STRLEN];
-    char ha2[PJSIP_MD5STRLEN];
-    unsigned char digest[16];
-    pj_md5_context pms;
+    if (algorithm->slen == 0 || pj_stricmp(algorithm, &pjsip_MD5_STR) == 0)
+	return PJSIP_AUTH_ALGORITHM_MD5;
+    else if (pj_stricmp(algorithm, &pjsip_SHA256_STR) == 0)
+	return PJSIP_AUTH_ALGORITHM_SHA256;
+    else
+	return PJSIP_AUTH_ALGORITHM_UNKNOWN;
+}
 
-    pj_assert(result->slen >= PJSIP_MD5STRLEN);
 
-    AUTH_TRACE_((THIS_FILE, "Begin creating digest"));
+/*
+ * Create the HA1 of the credential and store the digest ASCII in 'result'.
+ */
+PJ_DEF(pj_status_t) pjsip_auth_create_ha1( pj_str_t *result,
+					   const pjsip_cred_info *cred_info,
+					   const pj_str_t *realm,
+					   pjsip_auth_algorithm_type algorithm)
+{
+    unsigned len = digest_strlen(algorithm);
+
+    PJ_ASSERT_RETURN(result && cred_info && realm, PJ_EINVAL);
+    PJ_ASSERT_RETURN(algorithm < PJSIP_AUTH_ALGORITHM_UNKNOWN,
+		     PJSIP_EINVALIDALGORITHM);
 
     if ((cred_info->data_type & PASSWD_MASK) == PJSIP_CRED_DATA_PLAIN_PASSWD) {
+	digest_ctx ctx;
+
 	/***
-	 *** ha1 = MD5(username ":" realm ":" password)
+	 *** ha1 = H(username ":" realm ":" password)
 	 ***/
-	pj_md5_init(&pms);
-	MD5_APPEND( &pms, cred_info->username.ptr, cred_info->username.slen);
-	MD5_APPEND( &pms, ":", 1);
-	MD5_APPEND( &pms, realm->ptr, realm->slen);
-	MD5_APPEND( &pms, ":", 1);
-	MD5_APPEND( &pms, cred_info->data.ptr, cred_info->data.slen);
-	pj_md5_final(&pms, digest);
-
-	digest2str(digest, ha1);
+	digest_init(&ctx, algorithm);
+	DIGEST_APPEND( &ctx, cred_info->username.ptr, cred_info->username.slen);
+	DIGEST_APPEND( &ctx, ":", 1);
+	DIGEST_APPEND( &ctx, realm->ptr, realm->slen);
+	DIGEST_APPEND( &ctx, ":", 1);
+	DIGEST_APPEND( &ctx, cred_info->data.ptr, cred_info->data.slen);
+	digest_final(&ctx, result->ptr);
 
     } else if ((cred_info->data_type & PASSWD_MASK) == PJSIP_CRED_DATA_DIGEST) {
-	pj_assert(cred_info->data.slen == 32);
-	pj_memcpy( ha1, cred_info->data.ptr, cred_info->data.slen );
+	/* The hashed credential can only be used with its own algorithm */
+	if (cred_info->data.slen != (pj_ssize_t)len)
+	    return PJSIP_EINVALIDALGORITHM;
+	pj_memcpy( result->ptr, cred_info->data.ptr, len );
     } else {
 	pj_assert(!"Invalid data_type");
+	return PJ_EINVAL;
     }
 
-    AUTH_TRACE_((THIS_FILE, "  ha1=%.32s", ha1));
+    result->slen = len;
+    return PJ_SUCCESS;
+}
 
-    /***
-     *** ha2 = MD5(method ":" req_uri)
-     ***/
-    pj_md5_init(&pms);
-    MD5_APPEND( &pms, method->ptr, method->slen);
-    MD5_APPEND( &pms, ":", 1);
-    MD5_APPEND( &pms, uri->ptr, uri->slen);
-    pj_md5_final(&pms, digest);
-    digest2str(digest, ha2);
 
-    AUTH_TRACE_((THIS_FILE, "  ha2=%.32s", ha2));
+/* Create ha2 = H(method ":" uri). The output must be at least
+ * digest_strlen() bytes.
+ */
+static void create_ha2( char *output,
+			const pj_str_t *method,
+			const pj_str_t *uri,
+			pjsip_auth_algorithm_type algorithm)
+{
+    digest_ctx ctx;
+
+    digest_init(&ctx, algorithm);
+    DIGEST_APPEND( &ctx, method->ptr, method->slen);
+    DIGEST_APPEND( &ctx, ":", 1);
+    DIGEST_APPEND( &ctx, uri->ptr, uri->slen);
+    digest_final(&ctx, output);
+}
+
+
+/* Create the response digest from ha1 and ha2 and store the digest ASCII
+ * in 'result', which must be at least digest_strlen() bytes.
+ */
+static void create_response( pj_str_t *result,
+			     const pj_str_t *ha1,
+			     const char *ha2,
+			     const pj_str_t *nonce,
+			     const pj_str_t *nc,
+			     const pj_str_t *cnonce,
+			     const pj_str_t *qop,
+			     pjsip_auth_algorithm_type algorithm)
+{
+    unsigned len = digest_strlen(algorithm);
+    digest_ctx ctx;
 
     /***
      *** When qop is not used:
-     ***    response = MD5(ha1 ":" nonce ":" ha2)
+     ***    response = H(ha1 ":" nonce ":" ha2)
      ***
      *** When qop=auth is used:
-     ***    response = MD5(ha1 ":" nonce ":" nc ":" cnonce ":" qop ":" ha2)
+     ***    response = H(ha1 ":" nonce ":" nc ":" cnonce ":" qop ":" ha2)
      ***/
-    pj_md5_init(&pms);
-    MD5_APPEND( &pms, ha1, PJSIP_MD5STRLEN);
-    MD5_APPEND( &pms, ":", 1);
-    MD5_APPEND( &pms, nonce->ptr, nonce->slen);
+    digest_init(&ctx, algorithm);
+    DIGEST_APPEND( &ctx, ha1->ptr, ha1->slen);
+    DIGEST_APPEND( &ctx, ":", 1);
+    DIGEST_APPEND( &ctx, nonce->ptr, nonce->slen);
     if (qop && qop->slen != 0) {
-	MD5_APPEND( &pms, ":", 1);
-	MD5_APPEND( &pms, nc->ptr, nc->slen);
-	MD5_APPEND( &pms, ":", 1);
-	MD5_APPEND( &pms, cnonce->ptr, cnonce->slen);
-	MD5_APPEND( &pms, ":", 1);
-	MD5_APPEND( &pms, qop->ptr, qop->slen);
+	DIGEST_APPEND( &ctx, ":", 1);
+	DIGEST_APPEND( &ctx, nc->ptr, nc->slen);
+	DIGEST_APPEND( &ctx, ":", 1);
+	DIGEST_APPEND( &ctx, cnonce->ptr, cnonce->slen);
+	DIGEST_APPEND( &ctx, ":", 1);
+	DIGEST_APPEND( &ctx, qop->ptr, qop->slen);
     }
-    MD5_APPEND( &pms, ":", 1);
-    MD5_APPEND( &pms, ha2, PJSIP_MD5STRLEN);
+    DIGEST_APPEND( &ctx, ":", 1);
+    DIGEST_APPEND( &ctx, ha2, len);
 
-    /* This is the final response digest. */
-    pj_md5_final(&pms, digest);
+    /* This is the final response digest. Convert digest to string and
+     * store in chal->response.
+     */
+    digest_final(&ctx, result->ptr);
+    result->slen = len;
+}
 
-    /* Convert digest to string and store in chal->response. */
-    result->slen = PJSIP_MD5STRLEN;
-    digest2str(digest, result->ptr);
 
-    AUTH_TRACE_((THIS_FILE, "  digest=%.32s", result->ptr));
+/*
+ * Create response digest based on the parameters and store the
+ * digest ASCII in 'result'.
+ */
+PJ_DEF(pj_status_t) pjsip_auth_create_digest2( pj_str_t *result,
+					const pj_str_t *nonce,
+					const pj_str_t *nc,
+					const pj_str_t *cnonce,
+					const pj_str_t *qop,
+					const pj_str_t *uri,
+					const pj_str_t *realm,
+					const pjsip_cred_info *cred_info,
+					const pj_str_t *method,
+					pjsip_auth_algorithm_type algorithm)
+{
+    char ha1_buf[PJSIP_SHA256STRLEN];
+    char ha2[PJSIP_SHA256STRLEN];
+    pj_str_t ha1;
+    unsigned len = digest_strlen(algorithm);
+    pj_status_t status;
+
+    pj_assert(result->slen >= (pj_ssize_t)len);
+
+    AUTH_TRACE_((THIS_FILE, "Begin creating digest"));
+
+    ha1.ptr = ha1_buf;
+    status = pjsip_auth_create_ha1(&ha1, cred_info, realm, algorithm);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    AUTH_TRACE_((THIS_FILE, "  ha1=%.*s", (int)ha1.slen, ha1.ptr));
+
+    create_ha2(ha2, method, uri, algorithm);
+
+    AUTH_TRACE_((THIS_FILE, "  ha2=%.*s", len, ha2));
+
+    create_response(result, &ha1, ha2, nonce, nc, cnonce, qop, algorithm);
+
+    AUTH_TRACE_((THIS_FILE, "  digest=%.*s", len, result->ptr));
     AUTH_TRACE_((THIS_FILE, "Digest created"));
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Create MD5 response digest based on the parameters and store the
+ * digest ASCII in 'result'.
+ */
+PJ_DEF(void) pjsip_auth_create_digest( pj_str_t *result,
+				       const pj_str_t *nonce,
+				       const pj_str_t *nc,
+				       const pj_str_t *cnonce,
+				       const pj_str_t *qop,
+				       const pj_str_t *uri,
+				       const pj_str_t *realm,
+				       const pjsip_cred_info *cred_info,
+				       const pj_str_t *method)
+{
+    pj_status_t status;
+
+    status = pjsip_auth_create_digest2(result, nonce, nc, cnonce, qop, uri,
+				       realm, cred_info, method,
+				       PJSIP_AUTH_ALGORITHM_MD5);
+    pj_assert(status == PJ_SUCCESS);
+    PJ_UNUSED_ARG(status);
+}
+
+static const pj_str_t pjsip_AKAv1_MD5_STR = { "AKAv1-MD5", 9 };
+
+/* Get the algorithm to compute the digest for the challenge with.
+ * AKAv1-MD5 challenge is answered with MD5 when the credential is not AKA.
+ */
+static pjsip_auth_algorithm_type get_chal_algorithm(const pj_str_t *algorithm)
+{
+    if (pj_stricmp(algorithm, &pjsip_AKAv1_MD5_STR) == 0)
+	return PJSIP_AUTH_ALGORITHM_MD5;
+    return pjsip_auth_get_algorithm_type(algorithm);
+}
+
+/* Check if we can respond to the digest algorithm of the challenge. */
+static pj_bool_t is_algorithm_supported(const pj_str_t *algorithm)
+{
+    return get_chal_algorithm(algorithm) != PJSIP_AUTH_ALGORITHM_UNKNOWN;
 }
 
 /*
  * Finds out if qop offer contains "auth" token.
  */
-static pj_bool_t has_auth_qop( pj_pool_t *pool, const pj_str_t *qop_offer)
+static pj_bool_t has_auth_qop( const pj_str_t *qop_offer)
 {
-    pj_str_t qop;
-    char *p;
-
-    pj_strdup_with_null( pool, &qop, qop_offer);
-    p = qop.ptr;
-    while (*p) {
-	*p = (char)pj_tolower(*p);
-	++p;
-    }
+    const char *p = qop_offer->ptr;
+    const char *end = qop_offer->ptr + qop_offer->slen;
 
-    p = qop.ptr;
-    while (*p) {
-	if (*p=='a' && *(p+1)=='u' && *(p+2)=='t' && *(p+3)=='h') {
-	    int e = *(p+4);
-	    if (e=='"' || e==',' || e==0)
+    while (end - p >= 4) {
+	if (pj_tolower(*p)=='a' && pj_tolower(*(p+1))=='u' &&
+	    pj_tolower(*(p+2))=='t' && pj_tolower(*(p+3))=='h')
+	{
+	    if (p+4 == end || *(p+4)=='"' || *(p+4)==',')
 		return PJ_TRUE;
 	    else
 		p += 4;
@@ -257,91 +420,67 @@ static pj_bool_t has_auth_qop( pj_pool_t *pool, const pj_str_t *qop_offer)
     return PJ_FALSE;
 }
 
-/*
- * Generate response digest.
- * Most of the parameters to generate the digest (i.e. username, realm, uri,
- * and nonce) are expected to be in the credential. Additional parameters (i.e.
- * password and method param) should be supplied in the argument.
- *
- * The resulting digest will be stored in cred->response.
- * The pool is used to allocate 32 bytes to store the digest in cred->response.
+/* Copy string to dst, reusing the buffer of dst when the string fits in
+ * it. The buffer of dst must have been allocated by us and not be shared,
+ * this is used for strings that are kept in the session and updated
+ * repeatedly, so that the session pool doesn't grow each time.
  */
-static pj_status_t respond_digest( pj_pool_t *pool,
-				   pjsip_digest_credential *cred,
-				   const pjsip_digest_challenge *chal,
-				   const pj_str_t *uri,
-				   const pjsip_cred_info *cred_info,
-				   const pj_str_t *cnonce,
-				   pj_uint32_t nc,
-				   const pj_str_t *method)
+static void copy_str(pj_pool_t *pool, pj_str_t *dst, const pj_str_t *src)
 {
-    const pj_str_t pjsip_AKAv1_MD5_STR = { "AKAv1-MD5", 9 };
-
-    /* Check algorithm is supported. We support MD5 and AKAv1-MD5. */
-    if (chal->algorithm.slen==0 ||
-	(pj_stricmp(&chal->algorithm, &pjsip_MD5_STR)==0 ||
-	 pj_stricmp(&chal->algorithm, &pjsip_AKAv1_MD5_STR)==0))
-    {
-	;
+    if (dst->ptr && src->slen <= dst->slen) {
+	pj_memcpy(dst->ptr, src->ptr, src->slen);
+	dst->slen = src->slen;
+    } else {
+	pj_strdup(pool, dst, src);
     }
-    else {
+}
+
+/* Duplicate string to dst only if it has changed. The old buffer is never
+ * written to, since headers of the requests may still refer to it.
+ */
+static void update_str(pj_pool_t *pool, pj_str_t *dst, const pj_str_t *src)
+{
+    if (pj_strcmp(dst, src) != 0)
+	pj_strdup(pool, dst, src);
+}
+
+/* The cnonce to use when the session doesn't have one. */
+static const pj_str_t DUMMY_CNONCE = { "b39971", 6 };
+
+/*
+ * Build digest credential from the challenge, except the response digest
+ * and the nonce-count.
+ */
+static pj_status_t init_digest_cred( pj_pool_t *pool,
+				     pjsip_digest_credential *cred,
+				     const pjsip_digest_challenge *chal,
+				     const pj_str_t *uri,
+				     const pjsip_cred_info *cred_info,
+				     const pj_str_t *cnonce,
+				     pjsip_auth_algorithm_type *p_algorithm)
+{
+    /* Check algorithm is supported. We support MD5, SHA-256 and
+     * AKAv1-MD5.
+     */
+    *p_algorithm = get_chal_algorithm(&chal->algorithm);
+    if (*p_algorithm == PJSIP_AUTH_ALGORITHM_UNKNOWN) {
 	PJ_LOG(4,(THIS_FILE, "Unsupported digest algorithm \"%.*s\"",
 		  chal->algorithm.slen, chal->algorithm.ptr));
 	return PJSIP_EINVALIDALGORITHM;
     }
 
-    /* Build digest credential from arguments. */
-    pj_strdup(pool, &cred->username, &cred_info->username);
-    pj_strdup(pool, &cred->realm, &chal->realm);
-    pj_strdup(pool, &cred->nonce, &chal->nonce);
-    pj_strdup(pool, &cred->uri, uri);
-    pj_strdup(pool, &cred->algorithm, &chal->algorithm);
-    pj_strdup(pool, &cred->opaque, &chal->opaque);
-
-    /* Allocate memory. */
-    cred->response.ptr = (char*) pj_pool_alloc(pool, PJSIP_MD5STRLEN);
-    cred->response.slen = PJSIP_MD5STRLEN;
-
     if (chal->qop.slen == 0) {
 	/* Server doesn't require quality of protection. */
+	cred->qop.slen = 0;
+	cred->cnonce.slen = 0;
 
-	if ((cred_info->data_type & EXT_MASK) == PJSIP_CRED_DATA_EXT_AKA) {
-	    /* Call application callback to create the response digest */
-	    return (*cred_info->ext.aka.cb)(pool, chal, cred_info,
-					    method, cred);
-	}
-	else {
-	    /* Convert digest to string and store in chal->response. */
-	    pjsip_auth_create_digest( &cred->response, &cred->nonce, NULL,
-				      NULL,  NULL, uri, &chal->realm,
-				      cred_info, method);
-	}
-
-    } else if (has_auth_qop(pool, &chal->qop)) {
+    } else if (has_auth_qop(&chal->qop)) {
 	/* Server requires quality of protection.
 	 * We respond with selecting "qop=auth" protection.
 	 */
 	cred->qop = pjsip_AUTH_STR;
-	cred->nc.ptr = (char*) pj_pool_alloc(pool, 16);
-	cred->nc.slen = pj_ansi_snprintf(cred->nc.ptr, 16, "%08u", nc);
-
-	if (cnonce && cnonce->slen) {
-	    pj_strdup(pool, &cred->cnonce, cnonce);
-	} else {
-	    pj_str_t dummy_cnonce = { "b39971", 6};
-	    pj_strdup(pool, &cred->cnonce, &dummy_cnonce);
-	}
-
-	if ((cred_info->data_type & EXT_MASK) == PJSIP_CRED_DATA_EXT_AKA) {
-	    /* Call application callback to create the response digest */
-	    return (*cred_info->ext.aka.cb)(pool, chal, cred_info,
-					    method, cred);
-	}
-	else {
-	    pjsip_auth_create_digest( &cred->response, &cred->nonce,
-				      &cred->nc, &cred->cnonce, &pjsip_AUTH_STR,
-				      uri, &chal->realm, cred_info, method );
-	}
+	update_str(pool, &cred->cnonce,
+		 (cnonce && cnonce->slen) ? cnonce : &DUMMY_CNONCE);
 
     } else {
 	/* Server requires quality protection that we don't support. */
@@ -350,6 +489,240 @@ static pj_status_t respond_digest( pj_pool_t *pool,
 	return PJSIP_EINVALIDQOP;
     }
 
+    /* Build digest credential from arguments. */
+    update_str(pool, &cred->username, &cred_info->username);
+    update_str(pool, &cred->realm, &chal->realm);
+    update_str(pool, &cred->nonce, &chal->nonce);
+    update_str(pool, &cred->uri, uri);
+    update_str(pool, &cred->algorithm, &chal->algorithm);
+    update_str(pool, &cred->opaque, &chal->opaque);
+
+    return PJ_SUCCESS;
+}
+
+/* Format the nonce-count of the credential. */
+static void set_nc( pj_pool_t *pool, pjsip_digest_credential *cred,
+		    pj_uint32_t nc)
+{
+    cred->nc.ptr = (char*) pj_pool_alloc(pool, 16);
+    cred->nc.slen = pj_ansi_snprintf(cred->nc.ptr, 16, "%08u", nc);
+}
+
+/*
+ * Generate response digest with AKA credential.
+ *
+ * The resulting digest will be stored in cred->response by the AKA
+ * callback of the credential.
+ */
+static pj_status_t respond_aka( pj_pool_t *pool,
+				pjsip_digest_credential *cred,
+				const pjsip_digest_challenge *chal,
+				const pj_str_t *uri,
+				const pjsip_cred_info *cred_info,
+				const pj_str_t *cnonce,
+				pj_uint32_t nc,
+				const pj_str_t *method)
+{
+    pjsip_auth_algorithm_type algorithm;
+    pj_status_t status;
+
+    status = init_digest_cred(pool, cred, chal, uri, cred_info, cnonce,
+			      &algorithm);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    /* Allocate memory. */
+    cred->response.slen = digest_strlen(algorithm);
+    cred->response.ptr = (char*) pj_pool_alloc(pool, cred->response.slen);
+
+    if (cred->qop.slen)
+	set_nc(pool, cred, nc);
+
+    /* Call application callback to create the response digest */
+    return (*cred_info->ext.aka.cb)(pool, chal, cred_info, method, cred);
+}
+
+/*
+ * Get the HA1 of the session credential for the realm and store the digest
+ * ASCII in ha1->ptr, which must be at least PJSIP_SHA256STRLEN bytes. The
+ * HA1 is taken from the session cache when it's been computed before.
+ */
+static pj_status_t get_ha1( pjsip_auth_clt_sess *sess,
+			    const pjsip_cred_info *cred_info,
+			    const pj_str_t *realm,
+			    pjsip_auth_algorithm_type algorithm,
+			    pj_str_t *ha1)
+{
+    pjsip_cached_ha1 *cached = NULL;
+    pj_status_t status;
+
+    if (sess->cached_ha1 && cred_info >= sess->cred_info &&
+	cred_info < sess->cred_info + sess->cred_cnt)
+    {
+	cached = &sess->cached_ha1[cred_info - sess->cred_info];
+	if (cached->ha1.slen && cached->algorithm == algorithm &&
+	    pj_strcmp(&cached->realm, realm) == 0)
+	{
+	    pj_memcpy(ha1->ptr, cached->ha1.ptr, cached->ha1.slen);
+	    ha1->slen = cached->ha1.slen;
+	    return PJ_SUCCESS;
+	}
+    }
+
+    status = pjsip_auth_create_ha1(ha1, cred_info, realm, algorithm);
+    if (status != PJ_SUCCESS || !cached)
+	return status;
+
+    if (!cached->ha1.ptr)
+	cached->ha1.ptr = (char*) pj_pool_alloc(sess->pool, PJSIP_SHA256STRLEN);
+    pj_memcpy(cached->ha1.ptr, ha1->ptr, ha1->slen);
+    cached->ha1.slen = ha1->slen;
+    cached->algorithm = algorithm;
+    copy_str(sess->pool, &cached->realm, realm);
+
+    return PJ_SUCCESS;
+}
+
+/* Check if the response template of the authorization session was created
+ * for the same challenge, request, and credential.
+ */
+static pj_bool_t match_template( const pjsip_cached_auth *auth,
+				 const pjsip_www_authenticate_hdr *hdr,
+				 const pj_str_t *uri,
+				 const pjsip_cred_info *cred_info,
+				 const pj_str_t *cnonce,
+				 const pjsip_method *method)
+{
+    const pjsip_digest_challenge *chal = &hdr->challenge.digest;
+    const pjsip_digest_credential *tmpl;
+
+    if (!auth->tmpl_hdr || auth->tmpl_cred != cred_info ||
+	(hdr->type == PJSIP_H_WWW_AUTHENTICATE) !=
+	(auth->tmpl_hdr->type == PJSIP_H_AUTHORIZATION) ||
+	pjsip_method_cmp(&auth->tmpl_method, method) != 0)
+    {
+	return PJ_FALSE;
+    }
+
+    tmpl = &auth->tmpl_hdr->credential.digest;
+    if (pj_strcmp(&tmpl->nonce, &chal->nonce) ||
+	pj_strcmp(&tmpl->uri, uri) ||
+	pj_strcmp(&tmpl->realm, &chal->realm) ||
+	pj_strcmp(&tmpl->opaque, &chal->opaque) ||
+	pj_strcmp(&tmpl->algorithm, &chal->algorithm))
+    {
+	return PJ_FALSE;
+    }
+
+    if (chal->qop.slen == 0)
+	return tmpl->qop.slen == 0;
+
+    return tmpl->qop.slen != 0 && has_auth_qop(&chal->qop) &&
+	   pj_strcmp(&tmpl->cnonce,
+		     (cnonce && cnonce->slen) ? cnonce : &DUMMY_CNONCE) == 0;
+}
+
+/* Update the response template of the authorization session for the
+ * challenge. The requests share the strings of the template, so changed
+ * strings are duplicated rather than overwritten.
+ */
+static pj_status_t update_template( pjsip_cached_auth *auth,
+				    const pjsip_www_authenticate_hdr *hdr,
+				    const pj_str_t *uri,
+				    const pjsip_cred_info *cred_info,
+				    const pj_str_t *cnonce,
+				    const pjsip_method *method)
+{
+    pjsip_hdr_e type;
+    pjsip_auth_algorithm_type algorithm;
+    pj_status_t status;
+
+    type = (hdr->type == PJSIP_H_WWW_AUTHENTICATE) ?
+		PJSIP_H_AUTHORIZATION : PJSIP_H_PROXY_AUTHORIZATION;
+    if (!auth->tmpl_hdr || auth->tmpl_hdr->type != type) {
+	if (type == PJSIP_H_AUTHORIZATION)
+	    auth->tmpl_hdr = pjsip_authorization_hdr_create(auth->pool);
+	else
+	    auth->tmpl_hdr = pjsip_proxy_authorization_hdr_create(auth->pool);
+	auth->tmpl_hdr->scheme = pjsip_DIGEST_STR;
+    }
+
+    /* Invalidate the template until it's complete */
+    auth->tmpl_cred = NULL;
+
+    status = init_digest_cred(auth->pool, &auth->tmpl_hdr->credential.digest,
+			      &hdr->challenge.digest, uri, cred_info, cnonce,
+			      &algorithm);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    if (!auth->tmpl_ha2.ptr)
+	auth->tmpl_ha2.ptr = (char*)pj_pool_alloc(auth->pool,
+						  PJSIP_SHA256STRLEN);
+    create_ha2(auth->tmpl_ha2.ptr, &method->name, uri, algorithm);
+    auth->tmpl_ha2.slen = digest_strlen(algorithm);
+
+    pjsip_method_copy(auth->pool, &auth->tmpl_method, method);
+    auth->tmpl_cred = cred_info;
+
+    return PJ_SUCCESS;
+}
+
+/*
+ * Generate the authorization header with the response digest.
+ *
+ * The header is copied from the template of the authorization session,
+ * which is recreated when the challenge, the request URI, the method, or
+ * the credential has changed. Together with the HA1 that the session keeps
+ * for the credential, this leaves only the response digest to be computed
+ * for each request.
+ */
+static pj_status_t respond_digest( pjsip_auth_clt_sess *sess,
+				   pjsip_cached_auth *auth,
+				   pj_pool_t *pool,
+				   const pjsip_www_authenticate_hdr *hdr,
+				   const pj_str_t *uri,
+				   const pjsip_cred_info *cred_info,
+				   const pj_str_t *cnonce,
+				   pj_uint32_t nc,
+				   const pjsip_method *method,
+				   pjsip_authorization_hdr **p_hauth)
+{
+    pjsip_auth_algorithm_type algorithm;
+    pjsip_authorization_hdr *hauth;
+    pjsip_digest_credential *cred;
+    char ha1_buf[PJSIP_SHA256STRLEN];
+    pj_str_t ha1;
+    pj_status_t status;
+
+    if (!match_template(auth, hdr, uri, cred_info, cnonce, method)) {
+	status = update_template(auth, hdr, uri, cred_info, cnonce, method);
+	if (status != PJ_SUCCESS)
+	    return status;
+    }
+
+    /* The template is in the pool of the cached auth, which is recreated
+     * or released while the request may still be queued or retransmitted,
+     * so the header gets its own copy of the strings.
+     */
+    hauth = (pjsip_authorization_hdr*) pjsip_hdr_clone(pool, auth->tmpl_hdr);
+    cred = &hauth->credential.digest;
+    algorithm = get_chal_algorithm(&cred->algorithm);
+
+    ha1.ptr = ha1_buf;
+    status = get_ha1(sess, cred_info, &cred->realm, algorithm, &ha1);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    if (cred->qop.slen)
+	set_nc(pool, cred, nc);
+
+    cred->response.slen = digest_strlen(algorithm);
+    cred->response.ptr = (char*) pj_pool_alloc(pool, cred->response.slen);
+    create_response(&cred->response, &ha1, auth->tmpl_ha2.ptr, &cred->nonce,
+		    &cred->nc, &cred->cnonce, &cred->qop, algorithm);
+
+    *p_hauth = hauth;
     return PJ_SUCCESS;
 }
 
@@ -418,16 +791,16 @@ static void update_digest_session( pjsip_cached_auth *cached_auth,
 	    ++cached_auth->nc;
 	} else {
 	    /* Server gives new nonce. */
-	    pj_strdup(cached_auth->pool, 
-		      &cached_auth->last_chal->challenge.digest.nonce,
-		      &hdr->challenge.digest.nonce);
+	    copy_str(cached_auth->pool,
+		     &cached_auth->last_chal->challenge.digest.nonce,
+		     &hdr->challenge.digest.nonce);
 	    /* Has the opaque changed? */
 	    if (pj_strcmp(&cached_auth->last_chal->challenge.digest.opaque,
 			  &hdr->challenge.digest.opaque))
 	    {
-		pj_strdup(cached_auth->pool,
-			  &cached_auth->last_chal->challenge.digest.opaque,
-			  &hdr->challenge.digest.opaque);
+		copy_str(cached_auth->pool,
+			 &cached_auth->last_chal->challenge.digest.opaque,
+			 &hdr->challenge.digest.opaque);
 	    }
 	    cached_auth->nc = 1;
 	}
@@ -493,6 +866,8 @@ PJ_DEF(pj_status_t) pjsip_auth_clt_init(  pjsip_auth_clt_sess *sess,
     sess->endpt = endpt;
     sess->cred_cnt = 0;
     sess->cred_info = NULL;
+    sess->cached_ha1 = NULL;
+    pj_bzero(&sess->pref, sizeof(sess->pref));
     pj_list_init(&sess->cached_auth);
 
     return PJ_SUCCESS;
@@ -531,6 +906,9 @@ PJ_DEF(pj_status_t) pjsip_auth_clt_clone( pj_pool_t *pool,
     sess->cred_info = (pjsip_cred_info*)
     		      pj_pool_alloc(pool,
 				    sess->cred_cnt*sizeof(pjsip_cred_info));
+    sess->cached_ha1 = (pjsip_cached_ha1*)
+		       pj_pool_calloc(pool, sess->cred_cnt,
+				      sizeof(pjsip_cached_ha1));
     for (i=0; i<rhs->cred_cnt; ++i) {
 	pj_strdup(pool, &sess->cred_info[i].realm, &rhs->cred_info[i].realm);
 	pj_strdup(pool, &sess->cred_info[i].scheme, &rhs->cred_info[i].scheme);
@@ -566,6 +944,9 @@ PJ_DEF(pj_status_t) pjsip_auth_clt_set_credentials( pjsip_auth_clt_sess *sess,
 	int i;
 	sess->cred_info = (pjsip_cred_info*)
 			  pj_pool_alloc(sess->pool, cred_cnt * sizeof(*c));
+	sess->cached_ha1 = (pjsip_cached_ha1*)
+			   pj_pool_calloc(sess->pool, cred_cnt,
+					  sizeof(pjsip_cached_ha1));
 	for (i=0; i<cred_cnt; ++i) {
 	    sess->cred_info[i].data_type = c[i].data_type;
 
@@ -617,6 +998,53 @@ PJ_DEF(pj_status_t) pjsip_auth_clt_set_credentials( pjsip_auth_clt_sess *sess,
 }
 
 
+/*
+ * Compute the HA1 of the session credentials in advance.
+ */
+PJ_DEF(pj_status_t) pjsip_auth_clt_precompute_ha1(
+					pjsip_auth_clt_sess *sess,
+					const pj_str_t *realm,
+					pjsip_auth_algorithm_type algorithm)
+{
+    unsigned i;
+
+    PJ_ASSERT_RETURN(sess, PJ_EINVAL);
+    PJ_ASSERT_RETURN(algorithm < PJSIP_AUTH_ALGORITHM_UNKNOWN,
+		     PJSIP_EINVALIDALGORITHM);
+
+    for (i=0; i<sess->cred_cnt; ++i) {
+	const pjsip_cred_info *c = &sess->cred_info[i];
+	const pj_str_t *cred_realm = &c->realm;
+	char ha1_buf[PJSIP_SHA256STRLEN];
+	pj_str_t ha1;
+	pj_status_t status;
+
+	if ((c->data_type & EXT_MASK) == PJSIP_CRED_DATA_EXT_AKA ||
+	    pj_stricmp(&c->scheme, &pjsip_BEARER_STR) == 0)
+	{
+	    continue;
+	}
+
+	if (c->realm.slen == 1 && c->realm.ptr[0] == '*') {
+	    if (!realm)
+		continue;
+	    cred_realm = realm;
+	} else if (realm && pj_stricmp(&c->realm, realm) != 0) {
+	    continue;
+	}
+
+	ha1.ptr = ha1_buf;
+	status = get_ha1(sess, c, cred_realm, algorithm, &ha1);
+
+	/* Hashed credential of other algorithm is not an error */
+	if (status != PJ_SUCCESS && status != PJSIP_EINVALIDALGORITHM)
+	    return status;
+    }
+
+    return PJ_SUCCESS;
+}
+
+
 /*
  * Set the preference for the client authentication session.
  */
@@ -656,19 +1084,22 @@ static pj_status_t auth_respond( pj_pool_t *req_pool,
 				 const pjsip_uri *uri,
 				 const pjsip_cred_info *cred_info,
 				 const pjsip_method *method,
-				 pj_pool_t *sess_pool,
+				 pjsip_auth_clt_sess *sess,
 				 pjsip_cached_auth *cached_auth,
 				 pjsip_authorization_hdr **p_h_auth)
 {
     pjsip_authorization_hdr *hauth;
     char tmp[PJSIP_MAX_URL_SIZE];
     pj_str_t uri_str;
+    pj_pool_t *sess_pool;
     pj_pool_t *pool;
     pj_status_t status;
 
     /* Verify arguments. */
     PJ_ASSERT_RETURN(req_pool && hdr && uri && cred_info && method &&
-		     sess_pool && cached_auth && p_h_auth, PJ_EINVAL);
+		     sess && cached_auth && p_h_auth, PJ_EINVAL);
+
+    sess_pool = sess->pool;
 
     /* Print URL in the original request. */
     uri_str.ptr = tmp;
@@ -689,11 +1120,9 @@ static pj_status_t auth_respond( pj_pool_t *req_pool,
     }
 #   endif
 
-    if (hdr->type == PJSIP_H_WWW_AUTHENTICATE)
-	hauth = pjsip_authorization_hdr_create(pool);
-    else if (hdr->type == PJSIP_H_PROXY_AUTHENTICATE)
-	hauth = pjsip_proxy_authorization_hdr_create(pool);
-    else {
+    if (hdr->type != PJSIP_H_WWW_AUTHENTICATE &&
+	hdr->type != PJSIP_H_PROXY_AUTHENTICATE)
+    {
 	return PJSIP_EINVALIDHDR;
     }
 
@@ -714,10 +1143,20 @@ static pj_status_t auth_respond( pj_pool_t *req_pool,
 	}
 #	endif	/* PJSIP_AUTH_QOP_SUPPORT */
 
-	hauth->scheme = pjsip_DIGEST_STR;
-	status = respond_digest( pool, &hauth->credential.digest,
-				 &hdr->challenge.digest, &uri_str, cred_info,
-				 cnonce, nc, &method->name);
+	if ((cred_info->data_type & EXT_MASK) == PJSIP_CRED_DATA_EXT_AKA) {
+	    if (hdr->type == PJSIP_H_WWW_AUTHENTICATE)
+		hauth = pjsip_authorization_hdr_create(pool);
+	    else
+		hauth = pjsip_proxy_authorization_hdr_create(pool);
+
+	    hauth->scheme = pjsip_DIGEST_STR;
+	    status = respond_aka( pool, &hauth->credential.digest,
+				  &hdr->challenge.digest, &uri_str, cred_info,
+				  cnonce, nc, &method->name);
+	} else {
+	    status = respond_digest( sess, cached_auth, pool, hdr, &uri_str,
+				     cred_info, cnonce, nc, method, &hauth);
+	}
 	if (status != PJ_SUCCESS)
 	    return status;
 
@@ -797,7 +1236,7 @@ static pj_status_t new_auth_for_req( pjsip_tx_data *tdata,
     status = auth_respond( tdata->pool, auth->last_chal,
 			   tdata->msg->line.req.uri,
 			   cred, &tdata->msg->line.req.method,
-			   sess->pool, auth, &hauth);
+			   sess, auth, &hauth);
     if (status != PJ_SUCCESS)
 	return status;
 
@@ -907,7 +1346,7 @@ PJ_DEF(pj_status_t) pjsip_auth_clt_init_req( pjsip_auth_clt_sess *sess,
 				   tdata->msg->line.req.uri,
 				   cred,
 				   &tdata->msg->line.req.method,
-				   sess->pool, auth, &hauth);
+				   sess, auth, &hauth);
 	    if (status != PJ_SUCCESS)
 		return status;
 
@@ -1008,6 +1447,22 @@ static void recreate_cached_auth_pool( pjsip_endpoint *endpt,
 			  pjsip_hdr_clone(auth_pool, auth->last_chal);
     }
 
+    if (auth->tmpl_hdr) {
+	pjsip_method method;
+	pj_str_t ha2;
+
+	auth->tmpl_hdr = (pjsip_authorization_hdr*)
+			 pjsip_hdr_clone(auth_pool, auth->tmpl_hdr);
+
+	ha2.ptr = (char*) pj_pool_alloc(auth_pool, PJSIP_SHA256STRLEN);
+	pj_memcpy(ha2.ptr, auth->tmpl_ha2.ptr, auth->tmpl_ha2.slen);
+	ha2.slen = auth->tmpl_ha2.slen;
+	pj_strassign(&auth->tmpl_ha2, &ha2);
+
+	pjsip_method_copy(auth_pool, &method, &auth->tmpl_method);
+	auth->tmpl_method = method;
+    }
+
     pjsip_endpt_release_pool(endpt, auth->pool);
     auth->pool = auth_pool;
 }
@@ -1121,11 +1576,32 @@ static pj_status_t process_auth( pj_pool_t *req_pool,
     /* Respond to authorization challenge. */
     status = auth_respond( req_pool, hchal, uri, cred,
 			   &tdata->msg->line.req.method,
-			   sess->pool, cached_auth, h_auth);
+			   sess, cached_auth, h_auth);
     return status;
 }
 
 
+/* Find the next challenge for the same realm after hchal in the message. */
+static const pjsip_www_authenticate_hdr*
+find_next_chal( const pjsip_msg *msg,
+		const pjsip_www_authenticate_hdr *hchal )
+{
+    const pjsip_hdr *hdr = (const pjsip_hdr*)hchal->next;
+
+    while (hdr != &msg->hdr) {
+	if (hdr->type == hchal->type &&
+	    pj_stricmp(&((const pjsip_www_authenticate_hdr*)hdr)->
+			    challenge.common.realm,
+		       &hchal->challenge.common.realm) == 0)
+	{
+	    return (const pjsip_www_authenticate_hdr*)hdr;
+	}
+	hdr = hdr->next;
+    }
+    return NULL;
+}
+
+
 /* Reinitialize outgoing request after 401/407 response is received.
  * The purpose of this function is:
  *  - to add a Authorization/Proxy-Authorization header.
@@ -1140,6 +1616,7 @@ PJ_DEF(pj_status_t) pjsip_auth_clt_reinit_req(	pjsip_auth_clt_sess *sess,
     pjsip_tx_data *tdata;
     const pjsip_hdr *hdr;
     unsigned chal_cnt;
+    pjsip_hdr added;
     pjsip_via_hdr *via;
     pj_status_t status;
 
@@ -1156,6 +1633,7 @@ PJ_DEF(pj_status_t) pjsip_auth_clt_reinit_req(	pjsip_auth_clt_sess *sess,
 
     tdata = old_request;
     tdata->auth_retry = PJ_FALSE;
+    pj_list_init(&added);
 
     /*
      * Respond to each authentication challenge.
@@ -1180,6 +1658,19 @@ PJ_DEF(pj_status_t) pjsip_auth_clt_reinit_req(	pjsip_auth_clt_sess *sess,
 	hchal = (const pjsip_www_authenticate_hdr*)hdr;
 	++chal_cnt;
 
+	/* Server may offer several challenges for a realm, e.g. SHA-256
+	 * and MD5, in its order of preference (RFC 8760). Respond to the
+	 * first one that we support.
+	 */
+	if (get_header_for_realm(&added, &hchal->challenge.common.realm) ||
+	    (pj_stricmp(&hchal->scheme, &pjsip_DIGEST_STR)==0 &&
+	     !is_algorithm_supported(&hchal->challenge.digest.algorithm) &&
+	     find_next_chal(rdata->msg_info.msg, hchal)))
+	{
+	    hdr = hdr->next;
+	    continue;
+	}
+
 	/* Find authentication session for this realm, create a new one
 	 * if not present.
 	 */
@@ -1215,8 +1706,8 @@ PJ_DEF(pj_status_t) pjsip_auth_clt_reinit_req(	pjsip_auth_clt_sess *sess,
 	    recreate_cached_auth_pool(sess->endpt, cached_auth);
 	}	
 
-	/* Add to the message. */
-	pjsip_msg_add_hdr(tdata->msg, (pjsip_hdr*)hauth);
+	/* Add to the message after all challenges are processed. */
+	pj_list_push_back(&added, hauth);
 
 	/* Process next header. */
 	hdr = hdr->next;
@@ -1226,6 +1717,12 @@ PJ_DEF(pj_status_t) pjsip_auth_clt_reinit_req(	pjsip_auth_clt_sess *sess,
     if (chal_cnt == 0)
 	return PJSIP_EAUTHNOCHAL;
 
+    while (!pj_list_empty(&added)) {
+	pjsip_hdr *h = added.next;
+	pj_list_erase(h);
+	pjsip_msg_add_hdr(tdata->msg, h);
+    }
+
     /* Remove branch param in Via header. */
     via = (pjsip_via_hdr*) pjsip_msg_find_hdr(tdata->msg, PJSIP_H_VIA, NULL);
     via->branch_param.slen = 0;
@@ -62,6 +62,7 @@ const pj_str_t	pjsip_USERNAME_STR =	    { "username", 8 },
 		pjsip_BEARER_STR =          { "Bearer", 6 },
 		pjsip_MD5_STR =		    { "md5", 3 },
 		pjsip_QUOTED_MD5_STR =	    { "\"md5\"", 5},
+		pjsip_SHA256_STR =	    { "SHA-256", 7 },
 		pjsip_AUTH_STR =	    { "auth", 4},
 		pjsip_QUOTED_AUTH_STR =	    { "\"auth\"", 6 };
 
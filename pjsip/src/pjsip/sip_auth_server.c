@@ -23,8 +23,124 @@
 #include <pjsip/sip_auth_msg.h>
 #include <pjsip/sip_errno.h>
 #include <pjsip/sip_transport.h>
-#include <pj/string.h>
+#include <pjlib-util/hmac_sha1.h>
 #include <pj/assert.h>
+#include <pj/ctype.h>
+#include <pj/hash.h>
+#include <pj/list.h>
+#include <pj/log.h>
+#include <pj/os.h>
+#include <pj/pool.h>
+#include <pj/rand.h>
+#include <pj/string.h>
+
+
+#define THIS_FILE   "sip_auth_server.c"
+
+/* Longest account name to keep in the credential cache. */
+#define MAX_ACC_NAME	    64
+
+/* Length of the secret key to sign the nonce, when it's generated. */
+#define NONCE_KEY_LEN	    20
+
+/* The signed nonce is the creation time and a random number, 8 hex digits
+ * each, followed by the first NONCE_SIG_LEN bytes of the HMAC-SHA1 of
+ * these and the realm, in hex.
+ */
+#define NONCE_SIG_LEN	    8
+#define NONCE_LEN	    (16 + NONCE_SIG_LEN*2)
+
+#define ALGORITHM_CNT	    PJSIP_AUTH_ALGORITHM_UNKNOWN
+
+
+/* Credential cache entry, with the HA1 of the account for each algorithm.
+ * All entries are in the realm of the server, so the account name alone
+ * is the key.
+ */
+typedef struct cred_entry
+{
+    PJ_DECL_LIST_MEMBER(struct cred_entry);
+
+    pj_hash_entry_buf	 hbuf;
+    pj_str_t		 acc_name;
+    char		 acc_buf[MAX_ACC_NAME];
+    pj_time_val		 expiry;
+    pj_str_t		 ha1[ALGORITHM_CNT];	/* Empty if not available */
+    char		 ha1_buf[ALGORITHM_CNT][PJSIP_SHA256STRLEN];
+} cred_entry;
+
+/* Highest nonce-count used with a nonce. */
+typedef struct nc_entry
+{
+    pj_uint32_t		 hval;			/* Nonce hash, 0 if unused  */
+    pj_uint32_t		 nc;
+} nc_entry;
+
+struct pjsip_auth_srv_state
+{
+    unsigned		 options;
+    pj_mutex_t		*mutex;
+
+    /* Credential cache */
+    pj_hash_table_t	*cache_ht;
+    cred_entry		 lru;			/* Most recently used first */
+    cred_entry		 free_list;
+
+    /* Nonce verification */
+    pj_str_t		 nonce_key;
+    nc_entry		*nc_tbl;
+};
+
+
+static pj_status_t create_state(pj_pool_t *pool,
+				pjsip_auth_srv *auth_srv,
+				const pjsip_auth_srv_init_param *param)
+{
+    pjsip_auth_srv_state *st;
+    unsigned i;
+    pj_status_t status;
+
+    st = PJ_POOL_ZALLOC_T(pool, pjsip_auth_srv_state);
+    st->options = param->options;
+
+    status = pj_mutex_create_simple(pool, "authsrv%p", &st->mutex);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    if (param->cache_size) {
+	cred_entry *entries;
+
+	st->cache_ht = pj_hash_create(pool, param->cache_size);
+	entries = (cred_entry*)
+		  pj_pool_calloc(pool, param->cache_size, sizeof(cred_entry));
+	pj_list_init(&st->lru);
+	pj_list_init(&st->free_list);
+	for (i=0; i<param->cache_size; ++i)
+	    pj_list_push_back(&st->free_list, &entries[i]);
+    }
+
+    if (param->options & PJSIP_AUTH_SRV_VERIFY_NONCE) {
+	if (param->nonce_key.slen) {
+	    pj_strdup(pool, &st->nonce_key, &param->nonce_key);
+	} else {
+	    pj_timestamp ts;
+
+	    pj_get_timestamp(&ts);
+	    st->nonce_key.ptr = (char*) pj_pool_alloc(pool, NONCE_KEY_LEN);
+	    st->nonce_key.slen = NONCE_KEY_LEN;
+	    for (i=0; i<NONCE_KEY_LEN; ++i) {
+		st->nonce_key.ptr[i] = (char)(pj_rand() ^
+					      (ts.u32.lo >> ((i % 4) * 8)));
+	    }
+	}
+	st->nc_tbl = (nc_entry*)
+		     pj_pool_calloc(pool, PJSIP_AUTH_SRV_NC_TABLE_SIZE,
+				    sizeof(nc_entry));
+    }
+
+    auth_srv->state = st;
+    return PJ_SUCCESS;
+}
 
 
 /*
@@ -65,48 +181,322 @@ PJ_DEF(pj_status_t) pjsip_auth_srv_init2(
     auth_srv->lookup2 = param->lookup2;
     auth_srv->is_proxy = (param->options & PJSIP_AUTH_SRV_IS_PROXY);
 
+    if (param->cache_size ||
+	(param->options & (PJSIP_AUTH_SRV_VERIFY_NONCE|PJSIP_AUTH_SRV_SHA256)))
+    {
+	return create_state(pool, auth_srv, param);
+    }
+
     return PJ_SUCCESS;
 }
 
 
+/*
+ * Release the credential cache and nonce state.
+ */
+PJ_DEF(pj_status_t) pjsip_auth_srv_deinit(pjsip_auth_srv *auth_srv)
+{
+    PJ_ASSERT_RETURN(auth_srv, PJ_EINVAL);
+
+    if (auth_srv->state) {
+	pj_mutex_destroy(auth_srv->state->mutex);
+	auth_srv->state = NULL;
+    }
+
+    return PJ_SUCCESS;
+}
+
+
+/* Sign the first 16 characters of the nonce, and put the signature in
+ * hex after them.
+ */
+static void sign_nonce(const pjsip_auth_srv *auth_srv, char *nonce)
+{
+    const pjsip_auth_srv_state *st = auth_srv->state;
+    pj_hmac_sha1_context ctx;
+    pj_uint8_t sig[20];
+    unsigned i;
+
+    pj_hmac_sha1_init(&ctx, (const pj_uint8_t*)st->nonce_key.ptr,
+		      (unsigned)st->nonce_key.slen);
+    pj_hmac_sha1_update(&ctx, (const pj_uint8_t*)nonce, 16);
+    pj_hmac_sha1_update(&ctx, (const pj_uint8_t*)auth_srv->realm.ptr,
+			(unsigned)auth_srv->realm.slen);
+    pj_hmac_sha1_final(&ctx, sig);
+
+    for (i=0; i<NONCE_SIG_LEN; ++i)
+	pj_val_to_hex_digit(sig[i], nonce + 16 + i*2);
+}
+
+/* Create a nonce which can be verified without keeping it. */
+static void create_nonce(const pjsip_auth_srv *auth_srv, pj_pool_t *pool,
+			 pj_str_t *nonce)
+{
+    pj_time_val now;
+
+    pj_gettimeofday(&now);
+
+    nonce->ptr = (char*) pj_pool_alloc(pool, NONCE_LEN + 1);
+    pj_ansi_snprintf(nonce->ptr, NONCE_LEN + 1, "%08x%08x",
+		     (unsigned)now.sec, (unsigned)pj_rand());
+    sign_nonce(auth_srv, nonce->ptr);
+    nonce->slen = NONCE_LEN;
+}
+
+/* Check that the nonce was created by us and has not expired. */
+static pj_status_t check_nonce(const pjsip_auth_srv *auth_srv,
+			       const pj_str_t *nonce)
+{
+    char buf[NONCE_LEN];
+    pj_str_t ts;
+    pj_time_val now;
+    unsigned i, diff;
+
+    if (nonce->slen != NONCE_LEN)
+	return PJSIP_EAUTHINNONCE;
+
+    pj_memcpy(buf, nonce->ptr, 16);
+    sign_nonce(auth_srv, buf);
+
+    /* Compare the whole signature, taking the same time for any nonce */
+    for (i=16, diff=0; i<NONCE_LEN; ++i)
+	diff |= (pj_tolower(buf[i]) ^ pj_tolower(nonce->ptr[i]));
+    if (diff)
+	return PJSIP_EAUTHINNONCE;
+
+    pj_gettimeofday(&now);
+    ts.ptr = nonce->ptr;
+    ts.slen = 8;
+    if ((long)((unsigned)now.sec - pj_strtoul2(&ts, NULL, 16)) >
+	PJSIP_AUTH_SRV_NONCE_EXPIRY)
+    {
+	return PJSIP_EAUTHSTALENONCE;
+    }
+
+    return PJ_SUCCESS;
+}
+
+/* Check that the nonce-count is higher than any used before with the
+ * nonce, and remember it.
+ */
+static pj_status_t update_nonce_count(pjsip_auth_srv_state *st,
+				      const pj_str_t *nonce,
+				      const pj_str_t *nc_str)
+{
+    pj_uint32_t hval, nc;
+    nc_entry *e;
+    pj_status_t status = PJ_SUCCESS;
+
+    nc = (pj_uint32_t)pj_strtoul2(nc_str, NULL, 16);
+    if (nc == 0)
+	return PJSIP_EAUTHSTALENONCE;
+
+    hval = pj_hash_calc(0, nonce->ptr, (unsigned)nonce->slen);
+    if (hval == 0)
+	hval = 1;
+    e = &st->nc_tbl[hval % PJSIP_AUTH_SRV_NC_TABLE_SIZE];
+
+    pj_mutex_lock(st->mutex);
+    if (e->hval == hval) {
+	if (nc > e->nc)
+	    e->nc = nc;
+	else
+	    status = PJSIP_EAUTHSTALENONCE;
+    } else if (nc == 1) {
+	/* First use of the nonce, it takes over the entry */
+	e->hval = hval;
+	e->nc = nc;
+    } else {
+	/* We don't know the nonce anymore, it has been pushed out of the
+	 * table by another nonce.
+	 */
+	status = PJSIP_EAUTHSTALENONCE;
+    }
+    pj_mutex_unlock(st->mutex);
+
+    return status;
+}
+
+
+/* Get the HA1 of the account from the cache. */
+static pj_bool_t cache_get(pjsip_auth_srv_state *st,
+			   const pj_str_t *acc_name,
+			   pjsip_auth_algorithm_type algorithm,
+			   pj_str_t *ha1)
+{
+    cred_entry *e;
+    pj_time_val now;
+    pj_bool_t found = PJ_FALSE;
+
+    pj_gettimeofday(&now);
+
+    pj_mutex_lock(st->mutex);
+    e = (cred_entry*) pj_hash_get(st->cache_ht, acc_name->ptr,
+				  (unsigned)acc_name->slen, NULL);
+    if (e && PJ_TIME_VAL_LT(now, e->expiry) && e->ha1[algorithm].slen) {
+	pj_memcpy(ha1->ptr, e->ha1[algorithm].ptr, e->ha1[algorithm].slen);
+	ha1->slen = e->ha1[algorithm].slen;
+
+	pj_list_erase(e);
+	pj_list_push_front(&st->lru, e);
+	found = PJ_TRUE;
+    }
+    pj_mutex_unlock(st->mutex);
+
+    return found;
+}
+
+/* Put the HA1s of the account in the cache, replacing the least recently
+ * used account when the cache is full.
+ */
+static void cache_put(pjsip_auth_srv_state *st,
+		      const pj_str_t *acc_name,
+		      const pj_str_t ha1[ALGORITHM_CNT])
+{
+    cred_entry *e;
+    unsigned i;
+
+    if (acc_name->slen > MAX_ACC_NAME)
+	return;
+
+    pj_mutex_lock(st->mutex);
+    e = (cred_entry*) pj_hash_get(st->cache_ht, acc_name->ptr,
+				  (unsigned)acc_name->slen, NULL);
+    if (!e) {
+	if (!pj_list_empty(&st->free_list)) {
+	    e = st->free_list.next;
+	} else {
+	    e = st->lru.prev;
+	    pj_hash_set_np(st->cache_ht, e->acc_name.ptr,
+			   (unsigned)e->acc_name.slen, 0, e->hbuf, NULL);
+	}
+	pj_memcpy(e->acc_buf, acc_name->ptr, acc_name->slen);
+	e->acc_name.ptr = e->acc_buf;
+	e->acc_name.slen = acc_name->slen;
+	pj_hash_set_np(st->cache_ht, e->acc_name.ptr,
+		       (unsigned)e->acc_name.slen, 0, e->hbuf, e);
+    }
+    pj_list_erase(e);
+
+    for (i=0; i<ALGORITHM_CNT; ++i) {
+	e->ha1[i].ptr = e->ha1_buf[i];
+	e->ha1[i].slen = ha1[i].slen;
+	pj_memcpy(e->ha1_buf[i], ha1[i].ptr, ha1[i].slen);
+    }
+    pj_gettimeofday(&e->expiry);
+    e->expiry.sec += PJSIP_AUTH_SRV_CACHE_TTL;
+
+    pj_list_push_front(&st->lru, e);
+    pj_mutex_unlock(st->mutex);
+}
+
+/* Remove the account from the cache. */
+static void cache_remove(pjsip_auth_srv_state *st, const pj_str_t *acc_name)
+{
+    cred_entry *e;
+
+    pj_mutex_lock(st->mutex);
+    e = (cred_entry*) pj_hash_get(st->cache_ht, acc_name->ptr,
+				  (unsigned)acc_name->slen, NULL);
+    if (e) {
+	pj_hash_set_np(st->cache_ht, e->acc_name.ptr,
+		       (unsigned)e->acc_name.slen, 0, e->hbuf, NULL);
+	pj_list_erase(e);
+	pj_list_push_back(&st->free_list, e);
+    }
+    pj_mutex_unlock(st->mutex);
+}
+
+
+/*
+ * Remove accounts from the credential cache.
+ */
+PJ_DEF(pj_status_t) pjsip_auth_srv_invalidate(pjsip_auth_srv *auth_srv,
+					      const pj_str_t *acc_name)
+{
+    pjsip_auth_srv_state *st;
+
+    PJ_ASSERT_RETURN(auth_srv, PJ_EINVAL);
+
+    st = auth_srv->state;
+    if (!st || !st->cache_ht)
+	return PJ_SUCCESS;
+
+    if (acc_name) {
+	cache_remove(st, acc_name);
+	return PJ_SUCCESS;
+    }
+
+    pj_mutex_lock(st->mutex);
+    while (!pj_list_empty(&st->lru)) {
+	cred_entry *e = st->lru.next;
+
+	pj_hash_set_np(st->cache_ht, e->acc_name.ptr,
+		       (unsigned)e->acc_name.slen, 0, e->hbuf, NULL);
+	pj_list_erase(e);
+	pj_list_push_back(&st->free_list, e);
+    }
+    pj_mutex_unlock(st->mutex);
+
+    return PJ_SUCCESS;
+}
+
+
+/* Find the credential information for the account. */
+static pj_status_t lookup_cred( pjsip_auth_srv *auth_srv,
+				pjsip_rx_data *rdata,
+				const pj_str_t *acc_name,
+				pjsip_cred_info *cred_info )
+{
+    if (auth_srv->lookup2) {
+	pjsip_auth_lookup_cred_param param;
+
+	pj_bzero(&param, sizeof(param));
+	param.realm = auth_srv->realm;
+	param.acc_name = *acc_name;
+	param.rdata = rdata;
+	return (*auth_srv->lookup2)(rdata->tp_info.pool, &param, cred_info);
+    } else {
+	return (*auth_srv->lookup)(rdata->tp_info.pool, &auth_srv->realm,
+				   acc_name, cred_info);
+    }
+}
+
+
 /* Verify incoming Authorization/Proxy-Authorization header against the 
- * specified credential.
+ * HA1 of the credential.
  */
 static pj_status_t pjsip_auth_verify( const pjsip_authorization_hdr *hdr,
 				      const pj_str_t *method,
-				      const pjsip_cred_info *cred_info )
+				      const pj_str_t *ha1,
+				      pjsip_auth_algorithm_type algorithm )
 {
     if (pj_stricmp(&hdr->scheme, &pjsip_DIGEST_STR) == 0) {
-	char digest_buf[PJSIP_MD5STRLEN];
+	char digest_buf[PJSIP_SHA256STRLEN];
 	pj_str_t digest;
 	const pjsip_digest_credential *dig = &hdr->credential.digest;
+	pjsip_cred_info cred_info;
+	pj_status_t status;
 
-	/* Check that username and realm match. 
-	 * These checks should have been performed before entering this
-	 * function.
-	 */
-	PJ_ASSERT_RETURN(pj_strcmp(&dig->username, &cred_info->username) == 0,
-			 PJ_EINVALIDOP);
-	PJ_ASSERT_RETURN(pj_strcmp(&dig->realm, &cred_info->realm) == 0,
-			 PJ_EINVALIDOP);
+	pj_bzero(&cred_info, sizeof(cred_info));
+	cred_info.username = dig->username;
+	cred_info.data_type = PJSIP_CRED_DATA_DIGEST;
+	cred_info.data = *ha1;
 
 	/* Prepare for our digest calculation. */
 	digest.ptr = digest_buf;
-	digest.slen = PJSIP_MD5STRLEN;
+	digest.slen = PJSIP_SHA256STRLEN;
 
 	/* Create digest for comparison. */
-	pjsip_auth_create_digest(&digest, 
-				 &hdr->credential.digest.nonce,
-				 &hdr->credential.digest.nc, 
-				 &hdr->credential.digest.cnonce,
-				 &hdr->credential.digest.qop,
-				 &hdr->credential.digest.uri,
-				 &cred_info->realm,
-				 cred_info, 
-				 method );
+	status = pjsip_auth_create_digest2(&digest, &dig->nonce, &dig->nc,
+					   &dig->cnonce, &dig->qop, &dig->uri,
+					   &dig->realm, &cred_info, method,
+					   algorithm);
+	if (status != PJ_SUCCESS)
+	    return status;
 
 	/* Compare digest. */
-	return (pj_stricmp(&digest, &hdr->credential.digest.response) == 0) ?
+	return (pj_stricmp(&digest, &dig->response) == 0) ?
 	       PJ_SUCCESS : PJSIP_EAUTHINVALIDDIGEST;
 
     } else {
@@ -126,9 +516,16 @@ PJ_DEF(pj_status_t) pjsip_auth_srv_verify( pjsip_auth_srv *auth_srv,
 {
     pjsip_authorization_hdr *h_auth;
     pjsip_msg *msg = rdata->msg_info.msg;
+    pjsip_auth_srv_state *st;
+    const pjsip_digest_credential *dig;
+    pjsip_auth_algorithm_type algorithm;
     pjsip_hdr_e htype;
     pj_str_t acc_name;
     pjsip_cred_info cred_info;
+    pj_str_t ha1[ALGORITHM_CNT];
+    char ha1_buf[ALGORITHM_CNT][PJSIP_SHA256STRLEN];
+    pj_bool_t cached = PJ_FALSE;
+    unsigned i;
     pj_status_t status;
 
     PJ_ASSERT_RETURN(auth_srv && rdata, PJ_EINVAL);
@@ -136,6 +533,7 @@ PJ_DEF(pj_status_t) pjsip_auth_srv_verify( pjsip_auth_srv *auth_srv,
 
     htype = auth_srv->is_proxy ? PJSIP_H_PROXY_AUTHORIZATION : 
 				 PJSIP_H_AUTHORIZATION;
+    st = auth_srv->state;
 
     /* Initialize status with 200. */
     *status_code = 200;
@@ -168,35 +566,135 @@ PJ_DEF(pj_status_t) pjsip_auth_srv_verify( pjsip_auth_srv *auth_srv,
 	return PJSIP_EINVALIDAUTHSCHEME;
     }
 
-    /* Find the credential information for the account. */
-    if (auth_srv->lookup2) {
-	pjsip_auth_lookup_cred_param param;
+    dig = &h_auth->credential.digest;
+    algorithm = pjsip_auth_get_algorithm_type(&dig->algorithm);
+    if (algorithm == PJSIP_AUTH_ALGORITHM_UNKNOWN) {
+	*status_code = auth_srv->is_proxy ? 407 : 401;
+	return PJSIP_EINVALIDALGORITHM;
+    }
 
-	pj_bzero(&param, sizeof(param));
-	param.realm = auth_srv->realm;
-	param.acc_name = acc_name;
-	param.rdata = rdata;
-	status = (*auth_srv->lookup2)(rdata->tp_info.pool, &param, &cred_info);
+    /* Reject forged and expired nonces before looking at the account. */
+    if (st && (st->options & PJSIP_AUTH_SRV_VERIFY_NONCE)) {
+	status = check_nonce(auth_srv, &dig->nonce);
 	if (status != PJ_SUCCESS) {
-	    *status_code = PJSIP_SC_FORBIDDEN;
+	    *status_code = auth_srv->is_proxy ? 407 : 401;
 	    return status;
 	}
-    } else {
-	status = (*auth_srv->lookup)(rdata->tp_info.pool, &auth_srv->realm,
-				     &acc_name, &cred_info);
+    }
+
+    for (i=0; i<ALGORITHM_CNT; ++i) {
+	ha1[i].ptr = ha1_buf[i];
+	ha1[i].slen = 0;
+    }
+
+    /* Authenticate with the cached credential first. When it fails, the
+     * password may have changed, so the account is looked up again.
+     */
+    status = PJSIP_EAUTHINVALIDDIGEST;
+    if (st && st->cache_ht &&
+	cache_get(st, &acc_name, algorithm, &ha1[algorithm]))
+    {
+	cached = PJ_TRUE;
+	status = pjsip_auth_verify(h_auth, &msg->line.req.method.name,
+				   &ha1[algorithm], algorithm);
+	if (status != PJ_SUCCESS)
+	    cache_remove(st, &acc_name);
+    }
+
+    if (status != PJ_SUCCESS) {
+	/* Find the credential information for the account. */
+	status = lookup_cred(auth_srv, rdata, &acc_name, &cred_info);
 	if (status != PJ_SUCCESS) {
 	    *status_code = PJSIP_SC_FORBIDDEN;
 	    return status;
 	}
+
+	/* Check that username and realm match. */
+	PJ_ASSERT_RETURN(pj_strcmp(&dig->username, &cred_info.username) == 0,
+			 PJ_EINVALIDOP);
+	PJ_ASSERT_RETURN(pj_strcmp(&dig->realm, &cred_info.realm) == 0,
+			 PJ_EINVALIDOP);
+
+	/* Create the HA1 of every algorithm which the credential can be
+	 * used with, to be cached.
+	 */
+	for (i=0; i<ALGORITHM_CNT; ++i) {
+	    if (i != (unsigned)algorithm && !(st && st->cache_ht))
+		continue;
+	    if (pjsip_auth_create_ha1(&ha1[i], &cred_info, &cred_info.realm,
+				      (pjsip_auth_algorithm_type)i)
+		!= PJ_SUCCESS)
+	    {
+		ha1[i].slen = 0;
+	    }
+	}
+
+	/* Authenticate with the specified credential. */
+	if (ha1[algorithm].slen) {
+	    status = pjsip_auth_verify(h_auth, &msg->line.req.method.name,
+				       &ha1[algorithm], algorithm);
+	} else {
+	    status = PJSIP_EINVALIDALGORITHM;
+	}
+
+	if (status == PJ_SUCCESS && st && st->cache_ht)
+	    cache_put(st, &acc_name, ha1);
     }
 
-    /* Authenticate with the specified credential. */
-    status = pjsip_auth_verify(h_auth, &msg->line.req.method.name, 
-			       &cred_info);
     if (status != PJ_SUCCESS) {
+	PJ_LOG(5,(THIS_FILE, "Authorization of %.*s failed%s",
+		  (int)acc_name.slen, acc_name.ptr,
+		  (cached ? " (cached credential was refreshed)" : "")));
 	*status_code = PJSIP_SC_FORBIDDEN;
+	return status;
     }
-    return status;
+
+    /* Reject replays of the authorization. */
+    if (st && (st->options & PJSIP_AUTH_SRV_VERIFY_NONCE) && dig->qop.slen) {
+	status = update_nonce_count(st, &dig->nonce, &dig->nc);
+	if (status != PJ_SUCCESS) {
+	    *status_code = auth_srv->is_proxy ? 407 : 401;
+	    return status;
+	}
+    }
+
+    return PJ_SUCCESS;
+}
+
+
+/* Add a digest challenge header for the algorithm to the response. */
+static void add_challenge( pjsip_auth_srv *auth_srv,
+			   const pj_str_t *algorithm,
+			   const pj_str_t *qop,
+			   const pj_str_t *nonce,
+			   const pj_str_t *opaque,
+			   pj_bool_t stale,
+			   pjsip_tx_data *tdata)
+{
+    pjsip_www_authenticate_hdr *hdr;
+
+    /* Create the header. */
+    if (auth_srv->is_proxy)
+	hdr = pjsip_proxy_authenticate_hdr_create(tdata->pool);
+    else
+	hdr = pjsip_www_authenticate_hdr_create(tdata->pool);
+
+    /* Initialize header. 
+     * Note: only support digest authentication now.
+     */
+    hdr->scheme = pjsip_DIGEST_STR;
+    hdr->challenge.digest.algorithm = *algorithm;
+    hdr->challenge.digest.nonce = *nonce;
+    hdr->challenge.digest.opaque = *opaque;
+    if (qop) {
+	pj_strdup(tdata->pool, &hdr->challenge.digest.qop, qop);
+    } else {
+	hdr->challenge.digest.qop.slen = 0;
+    }
+    pj_strdup(tdata->pool, &hdr->challenge.digest.realm, &auth_srv->realm);
+    hdr->challenge.digest.stale = stale;
+
+    pjsip_msg_add_hdr(tdata->msg, (pjsip_hdr*)hdr);
 }
 
 
@@ -204,7 +702,8 @@ PJ_DEF(pj_status_t) pjsip_auth_srv_verify( pjsip_auth_srv *auth_srv,
  * Add authentication challenge headers to the outgoing response in tdata. 
  * Application may specify its customized nonce and opaque for the challenge, 
  * or can leave the value to NULL to make the function fills them in with 
- * random characters.
+ * random characters. A server which verifies its nonces only accepts the
+ * nonces it has signed.
  */
 PJ_DEF(pj_status_t) pjsip_auth_srv_challenge(  pjsip_auth_srv *auth_srv,
 					       const pj_str_t *qop,
@@ -213,48 +712,43 @@ PJ_DEF(pj_status_t) pjsip_auth_srv_challenge(  pjsip_auth_srv *auth_srv,
 					       pj_bool_t stale,
 					       pjsip_tx_data *tdata)
 {
-    pjsip_www_authenticate_hdr *hdr;
+    pjsip_auth_srv_state *st;
     char nonce_buf[16];
     pj_str_t random;
+    pj_str_t the_nonce, the_opaque;
 
     PJ_ASSERT_RETURN( auth_srv && tdata, PJ_EINVAL );
 
+    st = auth_srv->state;
+
+    /* Only the nonces we have signed would be accepted */
+    if (nonce && st && (st->options & PJSIP_AUTH_SRV_VERIFY_NONCE))
+	return PJ_EINVALIDOP;
     random.ptr = nonce_buf;
     random.slen = sizeof(nonce_buf);
 
-    /* Create the header. */
-    if (auth_srv->is_proxy)
-	hdr = pjsip_proxy_authenticate_hdr_create(tdata->pool);
-    else
-	hdr = pjsip_www_authenticate_hdr_create(tdata->pool);
-
-    /* Initialize header. 
-     * Note: only support digest authentication now.
-     */
-    hdr->scheme = pjsip_DIGEST_STR;
-    hdr->challenge.digest.algorithm = pjsip_MD5_STR;
     if (nonce) {
-	pj_strdup(tdata->pool, &hdr->challenge.digest.nonce, nonce);
+	pj_strdup(tdata->pool, &the_nonce, nonce);
+    } else if (st && (st->options & PJSIP_AUTH_SRV_VERIFY_NONCE)) {
+	create_nonce(auth_srv, tdata->pool, &the_nonce);
     } else {
 	pj_create_random_string(nonce_buf, sizeof(nonce_buf));
-	pj_strdup(tdata->pool, &hdr->challenge.digest.nonce, &random);
+	pj_strdup(tdata->pool, &the_nonce, &random);
     }
     if (opaque) {
-	pj_strdup(tdata->pool, &hdr->challenge.digest.opaque, opaque);
+	pj_strdup(tdata->pool, &the_opaque, opaque);
     } else {
 	pj_create_random_string(nonce_buf, sizeof(nonce_buf));
-	pj_strdup(tdata->pool, &hdr->challenge.digest.opaque, &random);
-    }
-    if (qop) {
-	pj_strdup(tdata->pool, &hdr->challenge.digest.qop, qop);
-    } else {
-	hdr->challenge.digest.qop.slen = 0;
+	pj_strdup(tdata->pool, &the_opaque, &random);
     }
-    pj_strdup(tdata->pool, &hdr->challenge.digest.realm, &auth_srv->realm);
-    hdr->challenge.digest.stale = stale;
 
-    pjsip_msg_add_hdr(tdata->msg, (pjsip_hdr*)hdr);
+    /* The challenges are in our order of preference (RFC 8760) */
+    if (st && (st->options & PJSIP_AUTH_SRV_SHA256)) {
+	add_challenge(auth_srv, &pjsip_SHA256_STR, qop, &the_nonce,
+		      &the_opaque, stale, tdata);
+    }
+    add_challenge(auth_srv, &pjsip_MD5_STR, qop, &the_nonce, &the_opaque,
+		  stale, tdata);
 
     return PJ_SUCCESS;
 }
-
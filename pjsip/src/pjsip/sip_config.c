@@ -36,7 +36,10 @@ pjsip_cfg_t pjsip_sip_cfg_var =
        PJSIP_RESOLVE_HOSTNAME_TO_GET_INTERFACE,
        0,
        PJSIP_ENCODE_SHORT_HNAME,
-       PJSIP_ACCEPT_MULTIPLE_SDP_ANSWERS
+       PJSIP_ACCEPT_MULTIPLE_SDP_ANSWERS,
+       PJSIP_ENDPT_RX_WORKER_CNT,
+       PJSIP_ENDPT_RX_QUEUE_SIZE,
+       PJSIP_ENDPT_TIMER_SHARD_CNT
     },
 
     /* Transaction settings */
@@ -45,7 +48,13 @@ pjsip_cfg_t pjsip_sip_cfg_var =
        PJSIP_T1_TIMEOUT,
        PJSIP_T2_TIMEOUT,
        PJSIP_T4_TIMEOUT,
-       PJSIP_TD_TIMEOUT
+       PJSIP_TD_TIMEOUT,
+       PJSIP_TSX_SHARD_COUNT
+    },
+
+    /* Dialog layer settings */
+    {
+       PJSIP_DLG_SHARD_COUNT
     },
 
     /* Client registration client */
@@ -55,7 +64,8 @@ pjsip_cfg_t pjsip_sip_cfg_var =
 
     /* TCP transport settings */
     {
-        PJSIP_TCP_KEEP_ALIVE_INTERVAL
+        PJSIP_TCP_KEEP_ALIVE_INTERVAL,
+        PJSIP_TCP_IO_WORKER_CNT
     },
 
     /* TLS transport settings */
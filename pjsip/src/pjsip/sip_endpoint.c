@@ -33,6 +33,7 @@
 #include <pj/hash.h>
 #include <pj/assert.h>
 #include <pj/errno.h>
+#include <pj/limits.h>
 #include <pj/lock.h>
 #include <pj/math.h>
 
@@ -50,6 +51,28 @@ typedef struct exit_cb
 } exit_cb;
 
 
+/* Incoming message queued to a worker. */
+typedef struct rx_job
+{
+    PJ_DECL_LIST_MEMBER		    (struct rx_job);
+    pjsip_rx_data		   *rdata;
+} rx_job;
+
+
+/* Worker thread which distributes incoming messages to the modules. */
+typedef struct rx_worker
+{
+    pjsip_endpoint		   *endpt;
+    pj_thread_t			   *thread;
+    pj_mutex_t			   *mutex;
+    pj_sem_t			   *sem;
+    rx_job			    queue;
+    unsigned			    count;
+    unsigned			    peak;
+    unsigned			    dropped;
+} rx_worker;
+
+
 /**
  * The SIP endpoint.
  */
@@ -70,6 +93,15 @@ struct pjsip_endpoint
     /** Timer heap. */
     pj_timer_heap_t	*timer_heap;
 
+    /** Number of timer heaps. */
+    unsigned		 timer_shard_cnt;
+
+    /** Timer heaps, the first one is timer_heap. */
+    pj_timer_heap_t    **timer_shard;
+
+    /** Locks of the timer heaps. */
+    pj_lock_t	       **timer_lock;
+
     /** Transport manager. */
     pjsip_tpmgr		*transport_mgr;
 
@@ -99,6 +131,20 @@ struct pjsip_endpoint
 
     /** List of exit callback. */
     exit_cb		 exit_cb_list;
+
+    /** Number of incoming message workers. */
+    unsigned		 rx_worker_cnt;
+
+    /** Maximum queue length of each worker. */
+    unsigned		 rx_queue_size;
+
+    /** Incoming message workers. */
+    rx_worker		*rx_worker;
+
+    /** Nonzero when the workers are being stopped. Once it's set, no more
+     *  messages are queued to the workers.
+     */
+    pj_atomic_t		*rx_quit;
 };
 
 
@@ -117,6 +163,13 @@ struct pjsip_endpoint
  */
 static void endpt_on_rx_msg( pjsip_endpoint*, 
 			     pj_status_t, pjsip_rx_data*);
+static void endpt_process_rx_msg( pjsip_endpoint *endpt,
+				  pjsip_rx_data *rdata );
+static pj_status_t start_rx_workers(pjsip_endpoint *endpt);
+static pj_status_t create_timer_heaps(pjsip_endpoint *endpt);
+static void destroy_timer_heaps(pjsip_endpoint *endpt);
+static void stop_rx_workers(pjsip_endpoint *endpt);
+static void destroy_rx_workers(pjsip_endpoint *endpt);
 static pj_status_t endpt_on_tx_msg( pjsip_endpoint *endpt,
 				    pjsip_tx_data *tdata );
 static pj_status_t unload_module(pjsip_endpoint *endpt,
@@ -433,7 +486,6 @@ PJ_DEF(pj_status_t) pjsip_endpt_create(pj_pool_factory *pf,
     pj_pool_t *pool;
     pjsip_endpoint *endpt;
     pjsip_max_fwd_hdr *mf_hdr;
-    pj_lock_t *lock = NULL;
 
 
     status = pj_register_strerror(PJSIP_ERRNO_START, PJ_ERRNO_SPACE_SIZE,
@@ -487,24 +539,12 @@ PJ_DEF(pj_status_t) pjsip_endpt_create(pj_pool_factory *pf,
 	goto on_error;
     }
 
-    /* Create timer heap to manage all timers within this endpoint. */
-    status = pj_timer_heap_create( endpt->pool, PJSIP_MAX_TIMER_COUNT, 
-                                   &endpt->timer_heap);
+    /* Create timer heaps to manage all timers within this endpoint. */
+    status = create_timer_heaps(endpt);
     if (status != PJ_SUCCESS) {
 	goto on_error;
     }
 
-    /* Set recursive lock for the timer heap. */
-    status = pj_lock_create_recursive_mutex( endpt->pool, "edpt%p", &lock);
-    if (status != PJ_SUCCESS) {
-	goto on_error;
-    }
-    pj_timer_heap_set_lock(endpt->timer_heap, lock, PJ_TRUE);
-
-    /* Set maximum timed out entries to process in a single poll. */
-    pj_timer_heap_set_max_timed_out_per_poll(endpt->timer_heap, 
-					     PJSIP_MAX_TIMED_OUT_ENTRIES);
-
     /* Create ioqueue. */
     status = pj_ioqueue_create( endpt->pool, PJSIP_MAX_TRANSPORTS, &endpt->ioqueue);
     if (status != PJ_SUCCESS) {
@@ -539,24 +579,32 @@ PJ_DEF(pj_status_t) pjsip_endpt_create(pj_pool_factory *pf,
     /* Initialize capability header list. */
     pj_list_init(&endpt->cap_hdr);
 
+    /* Start incoming message workers. */
+    status = start_rx_workers(endpt);
+    if (status != PJ_SUCCESS) {
+	goto on_error;
+    }
 
     /* Done. */
     *p_endpt = endpt;
     return status;
 
 on_error:
+    stop_rx_workers(endpt);
+    if (endpt->resolver) {
+	pjsip_resolver_destroy(endpt->resolver);
+	endpt->resolver = NULL;
+    }
     if (endpt->transport_mgr) {
 	pjsip_tpmgr_destroy(endpt->transport_mgr);
 	endpt->transport_mgr = NULL;
     }
+    destroy_rx_workers(endpt);
     if (endpt->ioqueue) {
 	pj_ioqueue_destroy(endpt->ioqueue);
 	endpt->ioqueue = NULL;
     }
-    if (endpt->timer_heap) {
-	pj_timer_heap_destroy(endpt->timer_heap);
-	endpt->timer_heap = NULL;
-    }
+    destroy_timer_heaps(endpt);
     if (endpt->mutex) {
 	pj_mutex_destroy(endpt->mutex);
 	endpt->mutex = NULL;
@@ -582,6 +630,9 @@ PJ_DEF(void) pjsip_endpt_destroy(pjsip_endpoint *endpt)
 
     PJ_LOG(5, (THIS_FILE, "Destroying endpoint instance.."));
 
+    /* Phase 0: finish processing the queued messages */
+    stop_rx_workers(endpt);
+
     /* Phase 1: stop all modules */
     mod = endpt->module_list.prev;
     while (mod != &endpt->module_list) {
@@ -606,14 +657,14 @@ PJ_DEF(void) pjsip_endpt_destroy(pjsip_endpoint *endpt)
     /* Shutdown and destroy all transports. */
     pjsip_tpmgr_destroy(endpt->transport_mgr);
 
+    /* No more messages can be delivered to the workers now */
+    destroy_rx_workers(endpt);
+
     /* Destroy ioqueue */
     pj_ioqueue_destroy(endpt->ioqueue);
 
-    /* Destroy timer heap */
-#if PJ_TIMER_DEBUG
-    pj_timer_heap_dump(endpt->timer_heap);
-#endif
-    pj_timer_heap_destroy(endpt->timer_heap);
+    /* Destroy timer heaps */
+    destroy_timer_heaps(endpt);
 
     /* Call all registered exit callbacks */
     ecb = endpt->exit_cb_list.next;
@@ -713,9 +764,7 @@ PJ_DEF(pj_status_t) pjsip_endpt_handle_events2(pjsip_endpoint *endpt,
      * granularity, so we don't need to lock end endpoint. 
      */
     timeout.sec = timeout.msec = 0;
-    c = pj_timer_heap_poll( endpt->timer_heap, &timeout );
-    if (c > 0)
-	count += c;
+    count += pjsip_endpt_poll_timers(endpt, &timeout);
 
     /* timer_heap_poll should never ever returns negative value, or otherwise
      * ioqueue_poll() will block forever!
@@ -777,6 +826,117 @@ PJ_DEF(pj_status_t) pjsip_endpt_handle_events(pjsip_endpoint *endpt,
     return pjsip_endpt_handle_events2(endpt, max_timeout, NULL);
 }
 
+/* Create the timer heaps of the endpoint. */
+static pj_status_t create_timer_heaps(pjsip_endpoint *endpt)
+{
+    unsigned i, cnt, size;
+
+    cnt = pjsip_cfg()->endpt.timer_shard_cnt;
+    if (cnt == 0)
+	cnt = 1;
+
+    endpt->timer_shard = (pj_timer_heap_t**)
+			 pj_pool_calloc(endpt->pool, cnt, sizeof(pj_timer_heap_t*));
+    endpt->timer_lock = (pj_lock_t**)
+			pj_pool_calloc(endpt->pool, cnt, sizeof(pj_lock_t*));
+    size = (PJSIP_MAX_TIMER_COUNT + cnt - 1) / cnt;
+
+    for (i=0; i<cnt; ++i) {
+	pj_lock_t *lock;
+	pj_status_t status;
+
+	status = pj_timer_heap_create(endpt->pool, size,
+				      &endpt->timer_shard[i]);
+	if (status != PJ_SUCCESS)
+	    return status;
+	++endpt->timer_shard_cnt;
+
+	/* Set recursive lock for the timer heap. */
+	status = pj_lock_create_recursive_mutex(endpt->pool, "edpt%p", &lock);
+	if (status != PJ_SUCCESS)
+	    return status;
+	pj_timer_heap_set_lock(endpt->timer_shard[i], lock, PJ_TRUE);
+	endpt->timer_lock[i] = lock;
+
+	/* Set maximum timed out entries to process in a single poll. */
+	pj_timer_heap_set_max_timed_out_per_poll(endpt->timer_shard[i],
+						 PJSIP_MAX_TIMED_OUT_ENTRIES);
+    }
+
+    endpt->timer_heap = endpt->timer_shard[0];
+    return PJ_SUCCESS;
+}
+
+/* Destroy the timer heaps of the endpoint. */
+static void destroy_timer_heaps(pjsip_endpoint *endpt)
+{
+    unsigned i;
+
+    for (i=0; i<endpt->timer_shard_cnt; ++i) {
+#if PJ_TIMER_DEBUG
+	pj_timer_heap_dump(endpt->timer_shard[i]);
+#endif
+	pj_timer_heap_destroy(endpt->timer_shard[i]);
+    }
+    endpt->timer_shard_cnt = 0;
+    endpt->timer_heap = NULL;
+}
+
+/* Select the timer heap of an entry. Entries are embedded in objects
+ * which are allocated from different pools, so the address bits above
+ * the allocation alignment spread well enough.
+ */
+static unsigned entry_timer_shard(pjsip_endpoint *endpt,
+				  const pj_timer_entry *entry)
+{
+    pj_uint32_t h;
+
+    if (endpt->timer_shard_cnt < 2)
+	return 0;
+
+    h = (pj_uint32_t)((pj_size_t)entry >> 4) * 2654435761U;
+    return (h >> 16) % endpt->timer_shard_cnt;
+}
+
+static pj_timer_heap_t* entry_timer_heap(pjsip_endpoint *endpt,
+					 const pj_timer_entry *entry)
+{
+    return endpt->timer_shard[entry_timer_shard(endpt, entry)];
+}
+
+/*
+ * Get the timer heap of an entry.
+ */
+PJ_DEF(pj_timer_heap_t*) pjsip_endpt_get_entry_timer_heap(
+					    pjsip_endpoint *endpt,
+					    const pj_timer_entry *entry)
+{
+    return entry_timer_heap(endpt, entry);
+}
+
+/*
+ * Poll the timer heaps.
+ */
+PJ_DEF(unsigned) pjsip_endpt_poll_timers(pjsip_endpoint *endpt,
+					 pj_time_val *next_delay)
+{
+    unsigned i, count = 0;
+
+    for (i=0; i<endpt->timer_shard_cnt; ++i) {
+	pj_time_val delay = {0, 0};
+	int c;
+
+	c = pj_timer_heap_poll(endpt->timer_shard[i], &delay);
+	if (c > 0)
+	    count += c;
+
+	if (next_delay && (i == 0 || PJ_TIME_VAL_LT(delay, *next_delay)))
+	    *next_delay = delay;
+    }
+
+    return count;
+}
+
 /*
  * Schedule timer.
  */
@@ -789,8 +949,8 @@ PJ_DEF(pj_status_t) pjsip_endpt_schedule_timer_dbg(pjsip_endpoint *endpt,
 {
     PJ_LOG(6, (THIS_FILE, "pjsip_endpt_schedule_timer(entry=%p, delay=%u.%u)",
 			 entry, delay->sec, delay->msec));
-    return pj_timer_heap_schedule_dbg(endpt->timer_heap, entry, delay,
-                                      src_file, src_line);
+    return pj_timer_heap_schedule_dbg(entry_timer_heap(endpt, entry), entry,
+				      delay, src_file, src_line);
 }
 #else
 PJ_DEF(pj_status_t) pjsip_endpt_schedule_timer( pjsip_endpoint *endpt,
@@ -799,7 +959,8 @@ PJ_DEF(pj_status_t) pjsip_endpt_schedule_timer( pjsip_endpoint *endpt,
 {
     PJ_LOG(6, (THIS_FILE, "pjsip_endpt_schedule_timer(entry=%p, delay=%u.%u)",
 			 entry, delay->sec, delay->msec));
-    return pj_timer_heap_schedule( endpt->timer_heap, entry, delay );
+    return pj_timer_heap_schedule( entry_timer_heap(endpt, entry), entry,
+				   delay );
 }
 #endif
 
@@ -819,9 +980,9 @@ PJ_DEF(pj_status_t) pjsip_endpt_schedule_timer_w_grp_lock_dbg(
     PJ_LOG(6, (THIS_FILE, "pjsip_endpt_schedule_timer_w_grp_lock"
 			  "(entry=%p, delay=%u.%u, grp_lock=%p)",
 			  entry, delay->sec, delay->msec, grp_lock));
-    return pj_timer_heap_schedule_w_grp_lock_dbg(endpt->timer_heap, entry,
-						 delay, id_val, grp_lock,
-						 src_file, src_line);
+    return pj_timer_heap_schedule_w_grp_lock_dbg(entry_timer_heap(endpt, entry),
+						 entry, delay, id_val,
+						 grp_lock, src_file, src_line);
 }
 #else
 PJ_DEF(pj_status_t) pjsip_endpt_schedule_timer_w_grp_lock(
@@ -834,8 +995,9 @@ PJ_DEF(pj_status_t) pjsip_endpt_schedule_timer_w_grp_lock(
     PJ_LOG(6, (THIS_FILE, "pjsip_endpt_schedule_timer_w_grp_lock"
 			  "(entry=%p, delay=%u.%u, grp_lock=%p)",
 			  entry, delay->sec, delay->msec, grp_lock));
-    return pj_timer_heap_schedule_w_grp_lock( endpt->timer_heap, entry,
-					      delay, id_val, grp_lock );
+    return pj_timer_heap_schedule_w_grp_lock( entry_timer_heap(endpt, entry),
+					      entry, delay, id_val,
+					      grp_lock );
 }
 #endif
 
@@ -846,7 +1008,32 @@ PJ_DEF(void) pjsip_endpt_cancel_timer( pjsip_endpoint *endpt,
 				       pj_timer_entry *entry )
 {
     PJ_LOG(6, (THIS_FILE, "pjsip_endpt_cancel_timer(entry=%p)", entry));
-    pj_timer_heap_cancel( endpt->timer_heap, entry );
+
+#if defined(PJ_DEBUG) && PJ_DEBUG!=0
+    if (endpt->timer_shard_cnt > 1) {
+	/* A running entry which is not in its heap has been scheduled on
+	 * another heap, e.g. directly on pjsip_endpt_get_timer_heap(). The
+	 * heap lock keeps the entry from expiring while it's checked.
+	 */
+	unsigned idx = entry_timer_shard(endpt, entry);
+	pj_bool_t running;
+	int count;
+
+	pj_lock_acquire(endpt->timer_lock[idx]);
+	running = pj_timer_entry_running(entry);
+	count = pj_timer_heap_cancel(endpt->timer_shard[idx], entry);
+	pj_lock_release(endpt->timer_lock[idx]);
+
+	if (running && count == 0) {
+	    PJ_LOG(1,(THIS_FILE, "Timer entry %p was not scheduled with "
+		      "the endpoint", entry));
+	    pj_assert(!"Timer entry was not scheduled with the endpoint");
+	}
+	return;
+    }
+#endif
+
+    pj_timer_heap_cancel( entry_timer_heap(endpt, entry), entry );
 }
 
 /*
@@ -955,6 +1142,223 @@ on_return:
     return status;
 }
 
+/*
+ * Worker thread to distribute queued incoming messages to the modules.
+ */
+static int PJ_THREAD_FUNC rx_worker_thread(void *arg)
+{
+    rx_worker *w = (rx_worker*) arg;
+
+    for (;;) {
+	rx_job *job;
+
+	pj_sem_wait(w->sem);
+
+	pj_mutex_lock(w->mutex);
+	if (pj_list_empty(&w->queue)) {
+	    pj_bool_t quit = (pj_atomic_get(w->endpt->rx_quit) != 0);
+
+	    pj_mutex_unlock(w->mutex);
+	    if (quit)
+		break;
+	    continue;
+	}
+	job = w->queue.next;
+	pj_list_erase(job);
+	--w->count;
+	pj_mutex_unlock(w->mutex);
+
+	endpt_process_rx_msg(w->endpt, job->rdata);
+	pjsip_rx_data_free_cloned(job->rdata);
+    }
+
+    return 0;
+}
+
+/*
+ * Create and start the incoming message workers, if configured.
+ */
+static pj_status_t start_rx_workers(pjsip_endpoint *endpt)
+{
+    unsigned i;
+    pj_status_t status;
+
+    if (pjsip_cfg()->endpt.rx_worker_cnt == 0)
+	return PJ_SUCCESS;
+
+    endpt->rx_worker = (rx_worker*)
+		       pj_pool_calloc(endpt->pool,
+				      pjsip_cfg()->endpt.rx_worker_cnt,
+				      sizeof(rx_worker));
+    endpt->rx_queue_size = pjsip_cfg()->endpt.rx_queue_size;
+    if (endpt->rx_queue_size == 0)
+	endpt->rx_queue_size = PJSIP_ENDPT_RX_QUEUE_SIZE;
+
+    status = pj_atomic_create(endpt->pool, 0, &endpt->rx_quit);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    for (i=0; i<pjsip_cfg()->endpt.rx_worker_cnt; ++i) {
+	rx_worker *w = &endpt->rx_worker[i];
+
+	w->endpt = endpt;
+	pj_list_init(&w->queue);
+
+	status = pj_mutex_create_simple(endpt->pool, "eptw%p", &w->mutex);
+	if (status != PJ_SUCCESS)
+	    return status;
+
+	status = pj_sem_create(endpt->pool, "eptw%p", 0, PJ_MAXINT32, &w->sem);
+	if (status != PJ_SUCCESS) {
+	    pj_mutex_destroy(w->mutex);
+	    return status;
+	}
+
+	status = pj_thread_create(endpt->pool, "eptw%p", &rx_worker_thread,
+				  w, 0, 0, &w->thread);
+	if (status != PJ_SUCCESS) {
+	    pj_sem_destroy(w->sem);
+	    pj_mutex_destroy(w->mutex);
+	    return status;
+	}
+
+	++endpt->rx_worker_cnt;
+    }
+
+    PJ_LOG(4, (THIS_FILE, "Started %u incoming message worker(s)",
+	       endpt->rx_worker_cnt));
+
+    return PJ_SUCCESS;
+}
+
+/*
+ * Stop the incoming message workers, after the queued messages have been
+ * processed. Messages received afterwards are processed by the thread
+ * which receives them, as if there were no workers.
+ */
+static void stop_rx_workers(pjsip_endpoint *endpt)
+{
+    unsigned i;
+
+    if (endpt->rx_worker_cnt == 0)
+	return;
+
+    /* Stop the transports from queueing more messages. queue_rx_msg()
+     * checks the flag with the worker mutex held, so once we have held
+     * each mutex, nothing more will be added to the queues.
+     */
+    pj_atomic_set(endpt->rx_quit, 1);
+    for (i=0; i<endpt->rx_worker_cnt; ++i) {
+	pj_mutex_lock(endpt->rx_worker[i].mutex);
+	pj_mutex_unlock(endpt->rx_worker[i].mutex);
+	pj_sem_post(endpt->rx_worker[i].sem);
+    }
+
+    for (i=0; i<endpt->rx_worker_cnt; ++i) {
+	rx_worker *w = &endpt->rx_worker[i];
+
+	if (w->thread) {
+	    pj_thread_join(w->thread);
+	    pj_thread_destroy(w->thread);
+	    w->thread = NULL;
+	}
+
+	/* The worker only quits when its queue is empty, but drain it in
+	 * case it has failed.
+	 */
+	pj_mutex_lock(w->mutex);
+	while (!pj_list_empty(&w->queue)) {
+	    rx_job *job = w->queue.next;
+	    pj_list_erase(job);
+	    --w->count;
+	    pjsip_rx_data_free_cloned(job->rdata);
+	}
+	pj_mutex_unlock(w->mutex);
+    }
+}
+
+/*
+ * Release the resources of the incoming message workers. This must only
+ * be called after the transports are destroyed, since a transport may
+ * still be in queue_rx_msg() until then.
+ */
+static void destroy_rx_workers(pjsip_endpoint *endpt)
+{
+    unsigned i;
+
+    for (i=0; i<endpt->rx_worker_cnt; ++i) {
+	rx_worker *w = &endpt->rx_worker[i];
+
+	pj_sem_destroy(w->sem);
+	pj_mutex_destroy(w->mutex);
+    }
+    endpt->rx_worker_cnt = 0;
+
+    if (endpt->rx_quit) {
+	pj_atomic_destroy(endpt->rx_quit);
+	endpt->rx_quit = NULL;
+    }
+}
+
+/*
+ * Queue incoming message to the worker selected by the hash of its
+ * Call-ID. Returns PJ_FALSE if the message should be processed by the
+ * calling thread instead.
+ */
+static pj_bool_t queue_rx_msg(pjsip_endpoint *endpt, pjsip_rx_data *rdata)
+{
+    const pjsip_cid_hdr *cid = rdata->msg_info.cid;
+    pjsip_rx_data *clone;
+    rx_worker *w;
+    rx_job *job;
+    pj_uint32_t hval;
+
+    if (cid == NULL)
+	return PJ_FALSE;
+
+    hval = pj_hash_calc(0, cid->id.ptr, (unsigned)cid->id.slen);
+    w = &endpt->rx_worker[hval % endpt->rx_worker_cnt];
+
+    /* Check the queue length before cloning the message */
+    pj_mutex_lock(w->mutex);
+    if (pj_atomic_get(endpt->rx_quit)) {
+	pj_mutex_unlock(w->mutex);
+	return PJ_FALSE;
+    }
+    if (w->count >= endpt->rx_queue_size) {
+	++w->dropped;
+	pj_mutex_unlock(w->mutex);
+
+	PJ_LOG(2, (THIS_FILE, "Dropping %s from %s:%d: worker queue is full",
+		   pjsip_rx_data_get_info(rdata),
+		   rdata->pkt_info.src_name,
+		   rdata->pkt_info.src_port));
+	return PJ_TRUE;
+    }
+    pj_mutex_unlock(w->mutex);
+
+    if (pjsip_rx_data_clone(rdata, 0, &clone) != PJ_SUCCESS)
+	return PJ_FALSE;
+
+    job = PJ_POOL_ALLOC_T(clone->tp_info.pool, rx_job);
+    job->rdata = clone;
+
+    pj_mutex_lock(w->mutex);
+    if (pj_atomic_get(endpt->rx_quit)) {
+	/* The workers are being stopped, process it ourselves */
+	pj_mutex_unlock(w->mutex);
+	pjsip_rx_data_free_cloned(clone);
+	return PJ_FALSE;
+    }
+    pj_list_push_back(&w->queue, job);
+    if (++w->count > w->peak)
+	w->peak = w->count;
+    pj_mutex_unlock(w->mutex);
+
+    pj_sem_post(w->sem);
+    return PJ_TRUE;
+}
+
 /*
  * This is the callback that is called by the transport manager when it 
  * receives a message from the network.
@@ -963,12 +1367,6 @@ static void endpt_on_rx_msg( pjsip_endpoint *endpt,
 			     pj_status_t status,
 			     pjsip_rx_data *rdata )
 {
-    pjsip_msg *msg = rdata->msg_info.msg;
-    pjsip_process_rdata_param proc_prm;
-    pj_bool_t handled = PJ_FALSE;
-
-    PJ_UNUSED_ARG(msg);
-
     if (status != PJ_SUCCESS) {
 	char info[30];
 	char errmsg[PJ_ERR_MSG_SIZE];
@@ -1010,6 +1408,26 @@ static void endpt_on_rx_msg( pjsip_endpoint *endpt,
 	return;
     }
 
+    /* Hand the message over to the worker selected by its Call-ID */
+    if (endpt->rx_worker_cnt && queue_rx_msg(endpt, rdata))
+	return;
+
+    endpt_process_rx_msg(endpt, rdata);
+}
+
+/*
+ * Distribute incoming message to the modules, either in the thread which
+ * received the message or in a worker thread.
+ */
+static void endpt_process_rx_msg( pjsip_endpoint *endpt,
+				  pjsip_rx_data *rdata )
+{
+    pjsip_msg *msg = rdata->msg_info.msg;
+    pjsip_process_rdata_param proc_prm;
+    pj_bool_t handled = PJ_FALSE;
+
+    PJ_UNUSED_ARG(msg);
+
     PJ_LOG(5, (THIS_FILE, "Processing incoming message: %s", 
 	       pjsip_rx_data_get_info(rdata)));
     pj_log_push_indent();
@@ -1209,6 +1627,16 @@ PJ_DEF(pjsip_tpmgr*) pjsip_endpt_get_tpmgr(pjsip_endpoint *endpt)
     return endpt->transport_mgr;
 }
 
+/*
+ * Set options for parsing incoming messages.
+ */
+PJ_DEF(pj_status_t) pjsip_endpt_set_parse_options(pjsip_endpoint *endpt,
+						  unsigned options)
+{
+    PJ_ASSERT_RETURN(endpt, PJ_EINVAL);
+    return pjsip_tpmgr_set_parse_options(endpt->transport_mgr, options);
+}
+
 /*
  * Get ioqueue instance.
  */
@@ -1302,6 +1730,8 @@ PJ_DEF(void) pjsip_endpt_log_error(  pjsip_endpoint *endpt,
 PJ_DEF(void) pjsip_endpt_dump( pjsip_endpoint *endpt, pj_bool_t detail )
 {
 #if PJ_LOG_MAX_LEVEL >= 3
+    unsigned i;
+
     PJ_LOG(5, (THIS_FILE, "pjsip_endpt_dump()"));
 
     /* Lock mutex. */
@@ -1329,12 +1759,27 @@ PJ_DEF(void) pjsip_endpt_dump( pjsip_endpoint *endpt, pj_bool_t detail )
     pjsip_tpmgr_dump_transports( endpt->transport_mgr );
 
     /* Timer. */
+    for (i=0; i<endpt->timer_shard_cnt; ++i) {
 #if PJ_TIMER_DEBUG
-    pj_timer_heap_dump(endpt->timer_heap);
+	pj_timer_heap_dump(endpt->timer_shard[i]);
 #else
-    PJ_LOG(3,(THIS_FILE, " Timer heap has %u entries", 
-			pj_timer_heap_count(endpt->timer_heap)));
+	PJ_LOG(3,(THIS_FILE, " Timer heap %u has %u entries", i,
+			    pj_timer_heap_count(endpt->timer_shard[i])));
 #endif
+    }
+
+    /* Incoming message workers. */
+    if (endpt->rx_worker_cnt) {
+	PJ_LOG(3,(THIS_FILE, " Incoming message workers:"));
+	for (i=0; i<endpt->rx_worker_cnt; ++i) {
+	    rx_worker *w = &endpt->rx_worker[i];
+
+	    pj_mutex_lock(w->mutex);
+	    PJ_LOG(3,(THIS_FILE, "  worker %u: queued=%u, peak=%u, dropped=%u",
+		      i, w->count, w->peak, w->dropped));
+	    pj_mutex_unlock(w->mutex);
+	}
+    }
 
     /* Unlock mutex. */
     pj_mutex_unlock(endpt->mutex);
@@ -107,6 +107,7 @@ static const struct
     PJ_BUILD_ERR( PJSIP_EAUTHINNONCE,	   "Invalid nonce value in authentication challenge"),
     PJ_BUILD_ERR( PJSIP_EAUTHINAKACRED,	   "Invalid AKA credential"),
     PJ_BUILD_ERR( PJSIP_EAUTHNOCHAL,	   "No challenge is found"),
+    PJ_BUILD_ERR( PJSIP_EAUTHSTALENONCE,   "Stale nonce in authorization"),
 
     /* UA/dialog layer. */
     PJ_BUILD_ERR( PJSIP_EMISSINGTAG,	"Missing From/To tag parameter" ),
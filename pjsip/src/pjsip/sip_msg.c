@@ -292,6 +292,12 @@ PJ_DEF(int) pjsip_method_cmp( const pjsip_method *m1, const pjsip_method *m2)
  * Message.
  */
 
+static pj_bool_t lazy_hdr_has_type(const pjsip_hdr *hdr, pjsip_hdr_e type);
+static pj_bool_t lazy_hdr_needs_decode(const pjsip_hdr *hdr);
+static const pjsip_hdr *lazy_hdr_run(const pjsip_msg *msg,
+				     const pjsip_hdr *hdr,
+				     const char **p_end);
+
 PJ_DEF(pjsip_msg*) pjsip_msg_create( pj_pool_t *pool, pjsip_msg_type_e type)
 {
     pjsip_msg *msg = PJ_POOL_ALLOC_T(pool, pjsip_msg);
@@ -342,9 +348,18 @@ PJ_DEF(void*)  pjsip_msg_find_hdr( const pjsip_msg *msg,
     if (hdr == NULL) {
 	hdr = msg->hdr.next;
     }
+    /* Decoding a lazy header modifies the (const) message, see the
+     * thread-safety note in the header file.
+     */
     for (; hdr!=end; hdr = hdr->next) {
 	if (hdr->type == hdr_type)
 	    return (void*)hdr;
+	if (lazy_hdr_has_type(hdr, hdr_type)) {
+	    hdr = (const pjsip_hdr*)
+		  pjsip_lazy_hdr_decode((pjsip_lazy_hdr*)hdr);
+	    if (hdr->type == hdr_type)
+		return (void*)hdr;
+	}
     }
     return NULL;
 }
@@ -359,6 +374,12 @@ PJ_DEF(void*)  pjsip_msg_find_hdr_by_name( const pjsip_msg *msg,
 	hdr = msg->hdr.next;
     }
     for (; hdr!=end; hdr = hdr->next) {
+	if (lazy_hdr_needs_decode(hdr) || 
+	    (pjsip_hdr_is_lazy(hdr) && pj_stricmp(&hdr->name, name) == 0))
+	{
+	    hdr = (const pjsip_hdr*)
+		  pjsip_lazy_hdr_decode((pjsip_lazy_hdr*)hdr);
+	}
 	if (pj_stricmp(&hdr->name, name) == 0)
 	    return (void*)hdr;
     }
@@ -376,6 +397,14 @@ PJ_DEF(void*)  pjsip_msg_find_hdr_by_names( const pjsip_msg *msg,
 	hdr = msg->hdr.next;
     }
     for (; hdr!=end; hdr = hdr->next) {
+	if (lazy_hdr_needs_decode(hdr) ||
+	    (pjsip_hdr_is_lazy(hdr) && 
+	     (pj_stricmp(&hdr->name, name) == 0 ||
+	      pj_stricmp(&hdr->name, sname) == 0)))
+	{
+	    hdr = (const pjsip_hdr*)
+		  pjsip_lazy_hdr_decode((pjsip_lazy_hdr*)hdr);
+	}
 	if (pj_stricmp(&hdr->name, name) == 0)
 	    return (void*)hdr;
 	if (pj_stricmp(&hdr->name, sname) == 0)
@@ -459,6 +488,26 @@ PJ_DEF(pj_ssize_t) pjsip_msg_print( const pjsip_msg *msg,
 
     /* Print each of the headers. */
     for (hdr=msg->hdr.next; hdr!=&msg->hdr; hdr=hdr->next) {
+	const pjsip_hdr *last;
+	const char *run_end = NULL;
+
+	/* Copy unchanged lazy headers as they were received, with one
+	 * copy for each run of adjacent headers.
+	 */
+	last = lazy_hdr_run(msg, hdr, &run_end);
+	if (last != hdr) {
+	    len = run_end - hdr->name.ptr;
+	    if (len + 3 >= end-p)
+		return -1;
+
+	    pj_memcpy(p, hdr->name.ptr, len);
+	    p += len;
+	    *p++ = '\r';
+	    *p++ = '\n';
+	    hdr = (pjsip_hdr*)last;
+	    continue;
+	}
+
 	len = pjsip_hdr_print_on(hdr, p, end-p);
 	if (len < 0) {
 	   if (len == -2) {
@@ -791,6 +840,195 @@ static pjsip_generic_string_hdr* pjsip_generic_string_hdr_shallow_clone( pj_pool
     return hdr;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/*
+ * Lazy header (header which parsing is deferred until it's needed).
+ */
+
+static pjsip_lazy_hdr* lazy_hdr_clone( pj_pool_t *pool, 
+				       const pjsip_lazy_hdr *hdr);
+static pjsip_lazy_hdr* lazy_hdr_shallow_clone( pj_pool_t *pool,
+					       const pjsip_lazy_hdr *hdr);
+
+static pjsip_hdr_vptr lazy_hdr_vptr = 
+{
+    (pjsip_hdr_clone_fptr) &lazy_hdr_clone,
+    (pjsip_hdr_clone_fptr) &lazy_hdr_shallow_clone,
+    (pjsip_hdr_print_fptr) &pjsip_generic_string_hdr_print,
+};
+
+PJ_DEF(pjsip_lazy_hdr*) pjsip_lazy_hdr_create(pj_pool_t *pool,
+					      const pj_str_t *hname,
+					      const pj_str_t *hvalue)
+{
+    pjsip_lazy_hdr *hdr = PJ_POOL_ALLOC_T(pool, pjsip_lazy_hdr);
+
+    init_hdr(hdr, PJSIP_H_OTHER, &lazy_hdr_vptr);
+    hdr->name = hdr->sname = *hname;
+    hdr->hvalue = *hvalue;
+    hdr->pool = pool;
+    return hdr;
+}
+
+PJ_DEF(pj_bool_t) pjsip_hdr_is_lazy(const void *hdr)
+{
+    return ((const pjsip_hdr*)hdr)->vptr == &lazy_hdr_vptr;
+}
+
+PJ_DEF(void*) pjsip_lazy_hdr_decode(pjsip_lazy_hdr *hdr)
+{
+    pjsip_hdr *parsed;
+    pj_str_t hvalue;
+
+    if (!pjsip_hdr_is_lazy(hdr))
+	return hdr;
+
+    /* The scanner requires NULL terminated input */
+    pj_strdup_with_null(hdr->pool, &hvalue, &hdr->hvalue);
+
+    parsed = (pjsip_hdr*) pjsip_parse_hdr(hdr->pool, &hdr->name, hvalue.ptr,
+					  hvalue.slen, NULL);
+    if (parsed == NULL) {
+	/* Keep the raw value, as the full parser would have done if it
+	 * had ignored the error. The header no longer refers to the packet
+	 * buffer (see pjsip_rx_data_lend_buf()).
+	 */
+	pj_str_t hname = hdr->name;
+
+	pj_strdup(hdr->pool, &hdr->name, &hname);
+	hdr->sname = hdr->name;
+	hdr->hvalue = hvalue;
+	hdr->vptr = &generic_hdr_vptr;
+	return hdr;
+    }
+
+    /* Parsing may produce multiple headers (e.g. comma separated
+     * Contact list), so replace the header with the whole list.
+     */
+    if (hdr->next != (void*)hdr) {
+	pj_list_insert_nodes_before(hdr, parsed);
+	pj_list_erase(hdr);
+    }
+
+    return parsed;
+}
+
+/* Check if hdr is a lazy header of the specified (well known) type. */
+static pj_bool_t lazy_hdr_has_type(const pjsip_hdr *hdr, pjsip_hdr_e type)
+{
+    const pjsip_hdr_name_info_t *info;
+
+    if (hdr->vptr != &lazy_hdr_vptr || type >= PJSIP_H_OTHER)
+	return PJ_FALSE;
+
+    info = &pjsip_hdr_names[type];
+    if (hdr->name.slen == info->name_len &&
+	pj_ansi_strnicmp(hdr->name.ptr, info->name, info->name_len) == 0)
+    {
+	return PJ_TRUE;
+    }
+    if (info->sname && hdr->name.slen == 1 &&
+	pj_tolower(*hdr->name.ptr) == pj_tolower(*info->sname))
+    {
+	return PJ_TRUE;
+    }
+    return PJ_FALSE;
+}
+
+/* Check that the name and value of a lazy header are still in the buffer
+ * where the header was parsed from, separated by the colon, so that the
+ * header can be copied as raw text.
+ */
+static pj_bool_t lazy_hdr_is_raw(const pjsip_hdr *hdr)
+{
+    const pjsip_lazy_hdr *lhdr = (const pjsip_lazy_hdr*)hdr;
+    const char *p = hdr->name.ptr + hdr->name.slen;
+    pj_bool_t colon = PJ_FALSE;
+
+    if (hdr->vptr != &lazy_hdr_vptr || lhdr->hvalue.ptr < p ||
+	lhdr->hvalue.ptr - p > 80)
+    {
+	return PJ_FALSE;
+    }
+
+    for (; p != lhdr->hvalue.ptr; ++p) {
+	if (*p == ':' && !colon)
+	    colon = PJ_TRUE;
+	else if (*p != ' ' && *p != '\t' && (!colon || (*p!='\r' && *p!='\n')))
+	    return PJ_FALSE;
+    }
+    return colon;
+}
+
+/* Get the last header of the run of raw lazy headers starting at hdr,
+ * in which each header line directly follows the previous one, and the
+ * end of the value of that header. If hdr doesn't start a run of at least
+ * two headers, hdr is returned.
+ */
+static const pjsip_hdr *lazy_hdr_run(const pjsip_msg *msg,
+				     const pjsip_hdr *hdr,
+				     const char **p_end)
+{
+    const pjsip_hdr *last = hdr;
+
+    if (!lazy_hdr_is_raw(hdr))
+	return hdr;
+
+    for (;;) {
+	const pjsip_lazy_hdr *lhdr = (const pjsip_lazy_hdr*)last;
+	const pjsip_hdr *next = last->next;
+	const char *p = lhdr->hvalue.ptr + lhdr->hvalue.slen;
+	const char *q;
+
+	*p_end = p;
+	if (next == &msg->hdr || !lazy_hdr_is_raw(next))
+	    break;
+
+	/* Only trailing whitespace and a newline may be in between */
+	q = next->name.ptr;
+	if (q <= p || q - p > 80 || *(q-1) != '\n')
+	    break;
+	--q;
+	if (q != p && *(q-1) == '\r')
+	    --q;
+	while (p != q && (*p == ' ' || *p == '\t'))
+	    ++p;
+	if (p != q)
+	    break;
+
+	last = next;
+    }
+
+    return last;
+}
+
+/* Lazy header in compact form must be decoded before it can be compared
+ * by name, since the parsed header will have the full name.
+ */
+static pj_bool_t lazy_hdr_needs_decode(const pjsip_hdr *hdr)
+{
+    return hdr->vptr == &lazy_hdr_vptr && hdr->name.slen == 1;
+}
+
+static pjsip_lazy_hdr* lazy_hdr_clone( pj_pool_t *pool, 
+				       const pjsip_lazy_hdr *rhs)
+{
+    pj_str_t hname, hvalue;
+
+    pj_strdup(pool, &hname, &rhs->name);
+    pj_strdup(pool, &hvalue, &rhs->hvalue);
+    return pjsip_lazy_hdr_create(pool, &hname, &hvalue);
+}
+
+static pjsip_lazy_hdr* lazy_hdr_shallow_clone( pj_pool_t *pool,
+					       const pjsip_lazy_hdr *rhs)
+{
+    pjsip_lazy_hdr *hdr = PJ_POOL_ALLOC_T(pool, pjsip_lazy_hdr);
+    pj_memcpy(hdr, rhs, sizeof(*hdr));
+    hdr->pool = pool;
+    return hdr;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /*
  * Generic pjsip_hdr_names/integer value header.
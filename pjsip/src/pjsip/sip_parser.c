@@ -186,6 +186,11 @@ static pjsip_hdr*   parse_hdr_to( pjsip_parse_ctx *ctx );
 static pjsip_hdr*   parse_hdr_unsupported( pjsip_parse_ctx *ctx );
 static pjsip_hdr*   parse_hdr_via( pjsip_parse_ctx *ctx );
 static pjsip_hdr*   parse_hdr_generic_string( pjsip_parse_ctx *ctx);
+static pjsip_hdr*   parse_hdr_lazy( pjsip_parse_ctx *ctx,
+				    const pj_str_t *hname );
+static pj_bool_t    is_hot_handler( pjsip_parse_hdr_func *func );
+static void	    record_raw_hdr( pjsip_parse_ctx *ctx, pjsip_hdr *hdr,
+				    const pj_str_t *hname, char *value );
 
 /* Convert non NULL terminated string to integer. */
 static unsigned long pj_strtoul_mindigit(const pj_str_t *str, 
@@ -791,6 +796,15 @@ PJ_DEF(pj_status_t) pjsip_register_uri_parser( char *scheme,
 PJ_DEF(pjsip_msg*) pjsip_parse_msg( pj_pool_t *pool, 
                                     char *buf, pj_size_t size,
 				    pjsip_parser_err_report *err_list)
+{
+    return pjsip_parse_msg2(pool, buf, size, err_list, 0);
+}
+
+/* Public function to parse SIP message, with options. */
+PJ_DEF(pjsip_msg*) pjsip_parse_msg2( pj_pool_t *pool, 
+                                     char *buf, pj_size_t size,
+				     pjsip_parser_err_report *err_list,
+				     unsigned options)
 {
     pjsip_msg *msg = NULL;
     pj_scanner scanner;
@@ -802,6 +816,7 @@ PJ_DEF(pjsip_msg*) pjsip_parse_msg( pj_pool_t *pool,
     context.scanner = &scanner;
     context.pool = pool;
     context.rdata = NULL;
+    context.options = options;
 
     msg = int_parse_msg(&context, err_list);
 
@@ -812,6 +827,14 @@ PJ_DEF(pjsip_msg*) pjsip_parse_msg( pj_pool_t *pool,
 /* Public function to parse as rdata.*/
 PJ_DEF(pjsip_msg *) pjsip_parse_rdata( char *buf, pj_size_t size,
                                        pjsip_rx_data *rdata )
+{
+    return pjsip_parse_rdata2(buf, size, rdata, 0);
+}
+
+/* Public function to parse as rdata, with options. */
+PJ_DEF(pjsip_msg *) pjsip_parse_rdata2( char *buf, pj_size_t size,
+                                        pjsip_rx_data *rdata,
+					unsigned options )
 {
     pj_scanner scanner;
     pjsip_parse_ctx context;
@@ -822,7 +845,9 @@ PJ_DEF(pjsip_msg *) pjsip_parse_rdata( char *buf, pj_size_t size,
     context.scanner = &scanner;
     context.pool = rdata->tp_info.pool;
     context.rdata = rdata;
+    context.options = options;
 
+    pj_list_init(&rdata->msg_info.raw_hdr);
     rdata->msg_info.msg = int_parse_msg(&context, &rdata->msg_info.parse_err);
 
     pj_scan_fini(&scanner);
@@ -1061,6 +1086,7 @@ parse_headers:
 	do {
 	    pjsip_parse_hdr_func * func;
 	    pjsip_hdr *hdr = NULL;
+	    char *hvalue;
 
 	    /* Init hname just in case parsing fails.
 	     * Ref: PROTOS #2412
@@ -1072,6 +1098,7 @@ parse_headers:
 	    if (pj_scan_get_char( scanner ) != ':') {
 		PJ_THROW(PJSIP_SYN_ERR_EXCEPTION);
 	    }
+	    hvalue = scanner->curptr;
 	    
 	    /* Find handler. */
 	    func = find_handler(&hname);
@@ -1080,7 +1107,12 @@ parse_headers:
 	     * If no handler is found, then treat the header as generic
 	     * hname/hvalue pair.
 	     */
-	    if (func) {
+	    if (func && (ctx->options & PJSIP_PARSE_LAZY) &&
+		!is_hot_handler(func))
+	    {
+		hdr = parse_hdr_lazy(ctx, &hname);
+
+	    } else if (func) {
 		hdr = (*func)(ctx);
 
 		/* Note:
@@ -1101,6 +1133,12 @@ parse_headers:
 		hdr = parse_hdr_generic_string(ctx);
 		hdr->name = hdr->sname = hname;
 	    }
+
+	    if (ctx->rdata && (ctx->options & PJSIP_PARSE_LAZY) &&
+		(hdr == NULL || !pjsip_hdr_is_lazy(hdr)))
+	    {
+		record_raw_hdr(ctx, hdr, &hname, hvalue);
+	    }
 	    
 	    /* Single parse of header line can produce multiple headers.
 	     * For example, if one Contact: header contains Contact list
@@ -2355,6 +2393,130 @@ static pjsip_hdr* parse_hdr_generic_string( pjsip_parse_ctx *ctx )
 
 }
 
+/* Headers which are always parsed in lazy mode, since they are needed
+ * by the transport, transaction, and dialog layers for every message.
+ */
+static pj_bool_t is_hot_handler( pjsip_parse_hdr_func *func )
+{
+    return func == &parse_hdr_via || func == &parse_hdr_from ||
+	   func == &parse_hdr_to || func == &parse_hdr_call_id ||
+	   func == &parse_hdr_cseq || func == &parse_hdr_route ||
+	   func == &parse_hdr_rr || func == &parse_hdr_max_forwards ||
+	   func == &parse_hdr_content_len || 
+	   func == &parse_hdr_content_type ||
+	   func == &parse_hdr_require || func == &parse_hdr_supported;
+}
+
+/* Skip header value, including continuation lines, and create lazy
+ * header which value points to the input buffer.
+ */
+static pjsip_hdr* parse_hdr_lazy( pjsip_parse_ctx *ctx, 
+				  const pj_str_t *hname )
+{
+    pj_scanner *scanner = ctx->scanner;
+    pj_str_t hvalue;
+    char *p = scanner->curptr, *end_line, *end_value;
+
+    hvalue.ptr = p;
+    for (;;) {
+	while (p != scanner->end && !IS_NEWLINE(*p))
+	    ++p;
+	end_line = p;
+
+	if (p == scanner->end)
+	    break;
+	if (*p == '\r')
+	    ++p;
+	if (p != scanner->end && *p == '\n')
+	    ++p;
+	if (p == scanner->end || !IS_SPACE(*p))
+	    break;
+    }
+
+    end_value = end_line;
+    while (end_value != hvalue.ptr && IS_SPACE(*(end_value-1)))
+	--end_value;
+    hvalue.slen = end_value - hvalue.ptr;
+
+    /* Move scanner to the end of the (last line of the) header. */
+    pj_scan_advance_n(scanner, (unsigned)(end_line - scanner->curptr),
+		      PJ_FALSE);
+    parse_hdr_end(scanner);
+
+    return (pjsip_hdr*) pjsip_lazy_hdr_create(ctx->pool, hname, &hvalue);
+}
+
+#if PJSIP_CHECK_RAW_HDR
+/* Hash of the printed headers parsed from a raw header line, to detect
+ * modification of the headers.
+ */
+static pj_uint32_t raw_hdr_hash( const pjsip_parser_raw_hdr *raw_hdr )
+{
+    const pjsip_hdr *hdr = raw_hdr->hdr;
+    pj_uint32_t hash = 0;
+    unsigned i;
+
+    for (i=0; i<raw_hdr->cnt; ++i, hdr=hdr->next) {
+	char buf[PJSIP_MAX_URL_SIZE];
+	int len;
+
+	len = pjsip_hdr_print_on((void*)hdr, buf, sizeof(buf));
+	if (len > 0)
+	    hash = pj_hash_calc(hash, buf, len);
+    }
+    return hash;
+}
+#endif
+
+/* Record the raw text of a header line which has just been parsed in lazy
+ * mode. If the parsing has added the values to an existing header instead
+ * of creating one, the raw text of that header is no longer complete, so
+ * the lines recorded so far are discarded.
+ */
+static void record_raw_hdr( pjsip_parse_ctx *ctx, pjsip_hdr *hdr,
+			    const pj_str_t *hname, char *value )
+{
+    pjsip_parser_raw_hdr *raw_hdr;
+    char *end = ctx->scanner->curptr;
+    pjsip_hdr *h;
+
+    if (hdr == NULL) {
+	pj_list_init(&ctx->rdata->msg_info.raw_hdr);
+	return;
+    }
+
+    while (end > value && (IS_SPACE(*(end-1)) || IS_NEWLINE(*(end-1))))
+	--end;
+    while (value < end && (IS_SPACE(*value) || IS_NEWLINE(*value)))
+	++value;
+
+    raw_hdr = PJ_POOL_ALLOC_T(ctx->pool, pjsip_parser_raw_hdr);
+    raw_hdr->hdr = hdr;
+    raw_hdr->cnt = 1;
+    for (h=hdr->next; h!=hdr; h=h->next)
+	++raw_hdr->cnt;
+    raw_hdr->name = *hname;
+    raw_hdr->value.ptr = value;
+    raw_hdr->value.slen = end - value;
+    raw_hdr->hash = 0;
+#if PJSIP_CHECK_RAW_HDR
+    raw_hdr->hash = raw_hdr_hash(raw_hdr);
+#endif
+
+    pj_list_push_back(&ctx->rdata->msg_info.raw_hdr, raw_hdr);
+}
+
+PJ_DEF(pj_bool_t) pjsip_parser_raw_hdr_check(
+				    const pjsip_parser_raw_hdr *raw_hdr)
+{
+#if PJSIP_CHECK_RAW_HDR
+    return raw_hdr_hash(raw_hdr) == raw_hdr->hash;
+#else
+    PJ_UNUSED_ARG(raw_hdr);
+    return PJ_TRUE;
+#endif
+}
+
 /* Public function to parse a header value. */
 PJ_DEF(void*) pjsip_parse_hdr( pj_pool_t *pool, const pj_str_t *hname,
 			       char *buf, pj_size_t size, int *parsed_len )
@@ -26,7 +26,10 @@
 #include <pj/array.h>
 #include <pj/assert.h>
 #include <pj/ctype.h>
+#include <pj/hash.h>
+#include <pj/list.h>
 #include <pj/log.h>
+#include <pj/os.h>
 #include <pj/pool.h>
 #include <pj/rand.h>
 #include <pj/string.h>
@@ -43,10 +46,42 @@ struct naptr_target
     unsigned		    pref;	    /**< Preference.	    */
 };
 
+/* Key of the resolved target cache */
+struct target_key
+{
+    pjsip_transport_type_e  type;		    /**< Transport type.    */
+    int			    port;		    /**< Port, or zero.	    */
+    char		    host[PJ_MAX_HOSTNAME];  /**< Host in lowercase. */
+};
+
+/* Resolved target cache entry */
+struct target_entry
+{
+    PJ_DECL_LIST_MEMBER(struct target_entry);
+
+    struct target_key	    key;	    /**< Target.		    */
+    pj_hash_entry_buf	    hbuf;	    /**< Hash buffer.		    */
+    pj_time_val		    expiry;	    /**< Expiration time.	    */
+    pjsip_server_addresses  server;	    /**< Resolved addresses.	    */
+    pj_uint8_t		    srv_idx[PJSIP_MAX_RESOLVED_ADDRESSES];
+					    /**< SRV record of each address */
+};
+
+/* Resolved target cache list head */
+struct target_list
+{
+    PJ_DECL_LIST_MEMBER(struct target_entry);
+};
+
 struct query
 {
     char		    *objname;
 
+    pjsip_resolver_t	    *resolver;
+    pj_bool_t		     cacheable;
+    struct target_key	     key;
+    unsigned		     ttl;
+
     pj_dns_type		     query_type;
     void		    *token;
     pjsip_resolver_callback *cb;
@@ -73,6 +108,13 @@ struct pjsip_resolver_t
 {
     pj_dns_resolver *res;
     pjsip_ext_resolver *ext_res;
+
+    /* Resolved target cache, most recently used first */
+    pj_pool_t	    *pool;
+    pj_mutex_t	    *mutex;
+    pj_hash_table_t *htarget;
+    struct target_list targets;
+    unsigned	     target_cnt;
 };
 
 
@@ -97,12 +139,52 @@ PJ_DEF(pj_status_t) pjsip_resolver_create( pj_pool_t *pool,
 
     PJ_ASSERT_RETURN(pool && p_res, PJ_EINVAL);
     resolver = PJ_POOL_ZALLOC_T(pool, pjsip_resolver_t);
+    pj_list_init(&resolver->targets);
+
+#if PJSIP_HAS_RESOLVER && PJSIP_RESOLVE_CACHE_SIZE > 0
+    {
+	pj_status_t status;
+
+	resolver->pool = pj_pool_create(pool->factory, "sipres%p", 1000, 4000,
+					NULL);
+	if (!resolver->pool)
+	    return PJ_ENOMEM;
+
+	status = pj_mutex_create_simple(resolver->pool, NULL,
+					&resolver->mutex);
+	if (status != PJ_SUCCESS) {
+	    pj_pool_release(resolver->pool);
+	    return status;
+	}
+
+	resolver->htarget = pj_hash_create(resolver->pool,
+					   PJSIP_RESOLVE_CACHE_SIZE);
+    }
+#endif
+
     *p_res = resolver;
 
     return PJ_SUCCESS;
 }
 
 
+#if PJSIP_HAS_RESOLVER
+/* Expire all resolved targets in the cache */
+static void flush_targets(pjsip_resolver_t *resolver)
+{
+    struct target_entry *e;
+
+    if (!resolver->htarget)
+	return;
+
+    pj_mutex_lock(resolver->mutex);
+    for (e=resolver->targets.next; e!=(void*)&resolver->targets; e=e->next)
+	pj_bzero(&e->expiry, sizeof(e->expiry));
+    pj_mutex_unlock(resolver->mutex);
+}
+#endif
+
+
 /*
  * Public API to set the DNS resolver instance for the SIP resolver.
  */
@@ -111,6 +193,7 @@ PJ_DEF(pj_status_t) pjsip_resolver_set_resolver(pjsip_resolver_t *res,
 {
 #if PJSIP_HAS_RESOLVER
     res->res = dns_res;
+    flush_targets(res);
     return PJ_SUCCESS;
 #else
     PJ_UNUSED_ARG(res);
@@ -161,6 +244,13 @@ PJ_DEF(void) pjsip_resolver_destroy(pjsip_resolver_t *resolver)
 #endif
 	resolver->res = NULL;
     }
+
+    if (resolver->mutex) {
+	pj_mutex_destroy(resolver->mutex);
+	resolver->mutex = NULL;
+    }
+    resolver->htarget = NULL;
+    pj_pool_safe_release(&resolver->pool);
 }
 
 /*
@@ -186,6 +276,212 @@ static int get_ip_addr_ver(const pj_str_t *host)
 }
 
 
+#if PJSIP_HAS_RESOLVER
+
+/* Initialize the resolved target cache key */
+static pj_bool_t init_target_key(struct target_key *key,
+				 pjsip_transport_type_e type,
+				 const pjsip_host_info *target)
+{
+    const pj_str_t *host = &target->addr.host;
+    pj_ssize_t i;
+
+    if (host->slen >= PJ_MAX_HOSTNAME)
+	return PJ_FALSE;
+
+    pj_bzero(key, sizeof(*key));
+    key->type = type;
+    key->port = target->addr.port;
+    for (i=0; i<host->slen; ++i)
+	key->host[i] = (char)pj_tolower(host->ptr[i]);
+
+    return PJ_TRUE;
+}
+
+/* Get the priority and weight of the n-th SRV target of the cache entry */
+#define TARGET_PRIO(e, start, n)    ((e)->server.entry[start[n]].priority)
+#define TARGET_WEIGHT(e, start, n)  ((e)->server.entry[start[n]].weight)
+
+/* Copy the addresses of the cache entry. The order of SRV targets with the
+ * same priority is selected again based on their weight as described in
+ * RFC 2782, so that the load is still shared among them.
+ */
+static void copy_target(const struct target_entry *e,
+			pjsip_server_addresses *addr)
+{
+    unsigned start[PJSIP_MAX_RESOLVED_ADDRESSES+1];
+    unsigned order[PJSIP_MAX_RESOLVED_ADDRESSES];
+    unsigned i, j, cnt = 0;
+
+    /* Addresses of the same SRV target are next to each other */
+    for (i=0; i<e->server.count; ++i) {
+	if (i == 0 || e->srv_idx[i] != e->srv_idx[i-1]) {
+	    order[cnt] = cnt;
+	    start[cnt++] = i;
+	}
+    }
+    start[cnt] = e->server.count;
+
+    /* Order the targets by priority, with the zero weight ones first */
+    for (i=1; i<cnt; ++i) {
+	unsigned t = order[i];
+
+	for (j=i; j>0; --j) {
+	    unsigned p = order[j-1];
+
+	    if (TARGET_PRIO(e, start, t) > TARGET_PRIO(e, start, p) ||
+		(TARGET_PRIO(e, start, t) == TARGET_PRIO(e, start, p) &&
+		 (TARGET_WEIGHT(e, start, t) != 0 ||
+		  TARGET_WEIGHT(e, start, p) == 0)))
+	    {
+		break;
+	    }
+	    order[j] = p;
+	}
+	order[j] = t;
+    }
+
+    /* Select the target among those with the same priority */
+    for (i=0; i<cnt; ++i) {
+	unsigned n, sum = 0, r;
+
+	for (n=i; n<cnt && TARGET_PRIO(e, start, order[n]) ==
+			   TARGET_PRIO(e, start, order[i]); ++n)
+	{
+	    sum += TARGET_WEIGHT(e, start, order[n]);
+	}
+
+	if (n - i > 1) {
+	    unsigned t;
+
+	    r = pj_rand() % (sum + 1);
+	    for (j=i, sum=0; j<n-1; ++j) {
+		sum += TARGET_WEIGHT(e, start, order[j]);
+		if (sum >= r)
+		    break;
+	    }
+
+	    t = order[i];
+	    order[i] = order[j];
+	    order[j] = t;
+	}
+    }
+
+    addr->count = 0;
+    for (i=0; i<cnt; ++i) {
+	unsigned t = order[i];
+	unsigned n = start[t+1] - start[t];
+
+	pj_memcpy(&addr->entry[addr->count], &e->server.entry[start[t]],
+		  n * sizeof(addr->entry[0]));
+	addr->count += n;
+    }
+}
+
+/* Find the target in the cache and copy its addresses */
+static pj_bool_t get_cached_target(pjsip_resolver_t *resolver,
+				   const struct target_key *key,
+				   pjsip_server_addresses *addr)
+{
+    struct target_entry *e;
+    pj_time_val now;
+
+    pj_gettimeofday(&now);
+
+    pj_mutex_lock(resolver->mutex);
+
+    e = (struct target_entry*) pj_hash_get(resolver->htarget, key,
+					   sizeof(*key), NULL);
+    if (e && PJ_TIME_VAL_GT(e->expiry, now)) {
+	pj_list_erase(e);
+	pj_list_push_front(&resolver->targets, e);
+	copy_target(e, addr);
+    } else {
+	e = NULL;
+    }
+
+    pj_mutex_unlock(resolver->mutex);
+
+    return e != NULL;
+}
+
+/* Save the resolved target to the cache */
+static void put_cached_target(struct query *query,
+			      const pjsip_server_addresses *addr,
+			      const pj_uint8_t srv_idx[],
+			      unsigned ttl)
+{
+    pjsip_resolver_t *resolver = query->resolver;
+    struct target_entry *e;
+
+    if (!query->cacheable || addr->count == 0)
+	return;
+
+    if (ttl > PJSIP_RESOLVE_CACHE_MAX_TTL)
+	ttl = PJSIP_RESOLVE_CACHE_MAX_TTL;
+    if (ttl == 0)
+	return;
+
+    pj_mutex_lock(resolver->mutex);
+
+    e = (struct target_entry*) pj_hash_get(resolver->htarget, &query->key,
+					   sizeof(query->key), NULL);
+    if (e) {
+	pj_list_erase(e);
+    } else {
+	if (resolver->target_cnt < PJSIP_RESOLVE_CACHE_SIZE) {
+	    e = PJ_POOL_ALLOC_T(resolver->pool, struct target_entry);
+	    ++resolver->target_cnt;
+	} else {
+	    /* Replace the least recently used entry */
+	    e = resolver->targets.prev;
+	    pj_list_erase(e);
+	    pj_hash_set(NULL, resolver->htarget, &e->key, sizeof(e->key),
+			0, NULL);
+	}
+	pj_memcpy(&e->key, &query->key, sizeof(e->key));
+	pj_hash_set_np(resolver->htarget, &e->key, sizeof(e->key), 0,
+		       e->hbuf, e);
+    }
+
+    pj_gettimeofday(&e->expiry);
+    e->expiry.sec += ttl;
+    e->server.count = addr->count;
+    pj_memcpy(e->server.entry, addr->entry,
+	      addr->count * sizeof(addr->entry[0]));
+    if (srv_idx)
+	pj_memcpy(e->srv_idx, srv_idx, addr->count);
+    else
+	pj_bzero(e->srv_idx, addr->count);
+
+    pj_list_push_front(&resolver->targets, e);
+
+    pj_mutex_unlock(resolver->mutex);
+}
+
+/* Keep the smallest TTL of the DNS A/AAAA responses */
+static void update_ttl(struct query *query, pj_status_t status,
+		       const pj_dns_parsed_packet *pkt)
+{
+    unsigned i, ttl;
+
+    if (status == PJ_SUCCESS && pkt && pkt->hdr.anscount) {
+	ttl = 0xFFFFFFFF;
+	for (i=0; i<pkt->hdr.anscount; ++i) {
+	    if (pkt->ans[i].ttl < ttl)
+		ttl = pkt->ans[i].ttl;
+	}
+    } else {
+	ttl = PJ_DNS_RESOLVER_INVALID_TTL;
+    }
+
+    if (ttl < query->ttl)
+	query->ttl = ttl;
+}
+
+#endif	/* PJSIP_HAS_RESOLVER */
+
+
 /*
  * This is the main function for performing server resolution.
  */
@@ -199,6 +495,10 @@ PJ_DEF(void) pjsip_resolve( pjsip_resolver_t *resolver,
     pj_status_t status = PJ_SUCCESS;
     int ip_addr_ver;
     struct query *query;
+#if PJSIP_HAS_RESOLVER
+    struct target_key key;
+    pj_bool_t cacheable = PJ_FALSE;
+#endif
     pjsip_transport_type_e type = target->type;
     int af = pj_AF_UNSPEC();
 
@@ -264,6 +564,26 @@ PJ_DEF(void) pjsip_resolve( pjsip_resolver_t *resolver,
     }
 
 
+#if PJSIP_HAS_RESOLVER
+    /* Check if the target has been resolved recently */
+    if (ip_addr_ver == 0 && resolver->res && resolver->htarget) {
+	cacheable = init_target_key(&key, type, target);
+	if (cacheable && get_cached_target(resolver, &key, &svr_addr)) {
+	    PJ_LOG(5,(THIS_FILE,
+		      "Target '%.*s:%d' type=%s resolved from cache to "
+		      "%d address(es)",
+		      (int)target->addr.host.slen,
+		      target->addr.host.ptr,
+		      target->addr.port,
+		      pjsip_transport_get_type_name(target->type),
+		      svr_addr.count));
+
+	    (*cb)(PJ_SUCCESS, token, &svr_addr);
+	    return;
+	}
+    }
+#endif
+
     /* If target is an IP address, or if resolver is not configured, 
      * we can just finish the resolution now using pj_gethostbyname()
      */
@@ -403,6 +723,11 @@ PJ_DEF(void) pjsip_resolve( pjsip_resolver_t *resolver,
     /* Build the query state */
     query = PJ_POOL_ZALLOC_T(pool, struct query);
     query->objname = THIS_FILE;
+    query->resolver = resolver;
+    query->cacheable = cacheable;
+    if (cacheable)
+	pj_memcpy(&query->key, &key, sizeof(key));
+    query->ttl = 0xFFFFFFFF;
     query->token = token;
     query->cb = cb;
     query->req.target = *target;
@@ -547,6 +872,8 @@ static void dns_a_callback(void *user_data,
     /* Reset outstanding job */
     query->object = NULL;
 
+    update_ttl(query, status, pkt);
+
     if (status == PJ_SUCCESS) {
 	pj_dns_addr_record rec;
 	unsigned i;
@@ -584,9 +911,10 @@ static void dns_a_callback(void *user_data,
 
     /* Call the callback if all DNS queries have been completed */
     if (query->object == NULL && query->object6 == NULL) {
-	if (srv->count > 0)
+	if (srv->count > 0) {
+	    put_cached_target(query, &query->server, NULL, query->ttl);
 	    (*query->cb)(PJ_SUCCESS, query->token, &query->server);
-	else
+	} else
 	    (*query->cb)(query->last_error, query->token, NULL);
     }
 }
@@ -605,6 +933,8 @@ static void dns_aaaa_callback(void *user_data,
     /* Reset outstanding job */
     query->object6 = NULL;
 
+    update_ttl(query, status, pkt);
+
     if (status == PJ_SUCCESS) {
 	pj_dns_addr_record rec;
 	unsigned i;
@@ -643,9 +973,10 @@ static void dns_aaaa_callback(void *user_data,
 
     /* Call the callback if all DNS queries have been completed */
     if (query->object == NULL && query->object6 == NULL) {
-	if (srv->count > 0)
+	if (srv->count > 0) {
+	    put_cached_target(query, &query->server, NULL, query->ttl);
 	    (*query->cb)(PJ_SUCCESS, query->token, &query->server);
-	else
+	} else
 	    (*query->cb)(query->last_error, query->token, NULL);
     }
 }
@@ -658,6 +989,7 @@ static void srv_resolver_cb(void *user_data,
 {
     struct query *query = (struct query*) user_data;
     pjsip_server_addresses srv;
+    pj_uint8_t srv_idx[PJSIP_MAX_RESOLVED_ADDRESSES];
     unsigned i;
 
     if (status != PJ_SUCCESS) {
@@ -678,6 +1010,7 @@ static void srv_resolver_cb(void *user_data,
 	for (j = 0; j < s->addr_count &&
 		    srv.count < PJSIP_MAX_RESOLVED_ADDRESSES; ++j)
 	{
+	    srv_idx[srv.count] = (pj_uint8_t)i;
 	    srv.entry[srv.count].type = query->naptr[0].type;
 	    srv.entry[srv.count].priority = rec->entry[i].priority;
 	    srv.entry[srv.count].weight = rec->entry[i].weight;
@@ -699,6 +1032,8 @@ static void srv_resolver_cb(void *user_data,
 	}
     }
 
+    put_cached_target(query, &srv, srv_idx, rec->ttl);
+
     /* Call the callback */
     (*query->cb)(PJ_SUCCESS, query->token, &srv);
 }
@@ -67,14 +67,24 @@ static pj_status_t mod_tsx_layer_unload(void);
 static pj_bool_t   mod_tsx_layer_on_rx_request(pjsip_rx_data *rdata);
 static pj_bool_t   mod_tsx_layer_on_rx_response(pjsip_rx_data *rdata);
 
+/* One shard of the transaction table. Each shard has its own hash table
+ * and mutex, so that lookups for transactions in different shards do not
+ * contend with each other.
+ */
+typedef struct tsx_shard
+{
+    pj_mutex_t		*mutex;
+    pj_hash_table_t	*htable;
+} tsx_shard;
+
 /* Transaction layer module definition. */
 static struct mod_tsx_layer
 {
     struct pjsip_module  mod;
     pj_pool_t		*pool;
     pjsip_endpoint	*endpt;
-    pj_mutex_t		*mutex;
-    pj_hash_table_t	*htable;
+    unsigned		 shard_cnt;
+    tsx_shard		*shards;
 } mod_tsx_layer = 
 {   {
 	NULL, NULL,			/* List's prev and next.    */
@@ -426,6 +436,94 @@ PJ_DEF(pj_status_t) pjsip_tsx_create_key( pj_pool_t *pool, pj_str_t *key,
  **
  *****************************************************************************
  **/
+/*
+ * Destroy the mutexes of the transaction table shards.
+ */
+static void destroy_shards(void)
+{
+    unsigned i;
+
+    for (i=0; i<mod_tsx_layer.shard_cnt; ++i) {
+	if (mod_tsx_layer.shards[i].mutex) {
+	    pj_mutex_destroy(mod_tsx_layer.shards[i].mutex);
+	    mod_tsx_layer.shards[i].mutex = NULL;
+	}
+    }
+    mod_tsx_layer.shard_cnt = 0;
+}
+
+
+/*
+ * Create the transaction table shards. The total capacity specified in
+ * pjsip_cfg()->tsx.max_count is divided evenly among the shards.
+ */
+static pj_status_t create_shards(pj_pool_t *pool)
+{
+    unsigned i, shard_cnt, shard_size;
+
+    shard_cnt = pjsip_cfg()->tsx.shard_cnt;
+    if (shard_cnt == 0)
+	shard_cnt = 1;
+    else if (shard_cnt > PJSIP_TSX_MAX_SHARD_COUNT)
+	shard_cnt = PJSIP_TSX_MAX_SHARD_COUNT;
+
+    /* Every shard needs room for at least one transaction */
+    shard_size = pjsip_cfg()->tsx.max_count / shard_cnt;
+    if (shard_size == 0)
+	shard_size = 1;
+
+    mod_tsx_layer.shards = (tsx_shard*)
+			   pj_pool_calloc(pool, shard_cnt, sizeof(tsx_shard));
+    mod_tsx_layer.shard_cnt = shard_cnt;
+
+    for (i=0; i<shard_cnt; ++i) {
+	tsx_shard *shard = &mod_tsx_layer.shards[i];
+	char name[PJ_MAX_OBJ_NAME];
+	pj_status_t status;
+
+	shard->htable = pj_hash_create2(pool, shard_size,
+					PJ_HASH_OPT_OPEN_ADDRESSING);
+	if (!shard->htable) {
+	    destroy_shards();
+	    return PJ_ENOMEM;
+	}
+
+	pj_ansi_snprintf(name, sizeof(name), "tsxlayer%u", i);
+	status = pj_mutex_create_recursive(pool, name, &shard->mutex);
+	if (status != PJ_SUCCESS) {
+	    destroy_shards();
+	    return status;
+	}
+    }
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Get the shard which holds the transaction with the specified key hash.
+ * The upper bits of the hash are used here, since the lower bits are
+ * used by the shard's hash table to select the bucket.
+ */
+PJ_INLINE(tsx_shard*) get_shard(pj_uint32_t hval)
+{
+    return &mod_tsx_layer.shards[(hval >> 16) % mod_tsx_layer.shard_cnt];
+}
+
+
+/*
+ * Get the hashed value of the transaction key.
+ */
+PJ_INLINE(pj_uint32_t) get_tsx_hval(pjsip_transaction *tsx)
+{
+#ifdef PRECALC_HASH
+    return tsx->hashed_key;
+#else
+    return pj_hash_calc_tolower(0, NULL, &tsx->transaction_key);
+#endif
+}
+
+
 /*
  * Create transaction layer module and registers it to the endpoint.
  */
@@ -470,15 +568,8 @@ PJ_DEF(pj_status_t) pjsip_tsx_layer_init_module(pjsip_endpoint *endpt)
     mod_tsx_layer.endpt = endpt;
 
 
-    /* Create hash table. */
-    mod_tsx_layer.htable = pj_hash_create( pool, pjsip_cfg()->tsx.max_count );
-    if (!mod_tsx_layer.htable) {
-	pjsip_endpt_release_pool(endpt, pool);
-	return PJ_ENOMEM;
-    }
-
-    /* Create group lock. */
-    status = pj_mutex_create_recursive(pool, "tsxlayer", &mod_tsx_layer.mutex);
+    /* Create the transaction table shards. */
+    status = create_shards(pool);
     if (status != PJ_SUCCESS) {
 	pjsip_endpt_release_pool(endpt, pool);
 	return status;
@@ -489,7 +580,7 @@ PJ_DEF(pj_status_t) pjsip_tsx_layer_init_module(pjsip_endpoint *endpt)
      */
     status = pjsip_endpt_register_module( endpt, &mod_tsx_layer.mod );
     if (status != PJ_SUCCESS) {
-	pj_mutex_destroy(mod_tsx_layer.mutex);
+	destroy_shards();
 	pjsip_endpt_release_pool(endpt, pool);
 	return status;
     }
@@ -534,21 +625,27 @@ PJ_DEF(pj_status_t) pjsip_tsx_layer_destroy(void)
  */
 static pj_status_t mod_tsx_layer_register_tsx( pjsip_transaction *tsx)
 {
+    pj_uint32_t hval;
+    tsx_shard *shard;
+
     pj_assert(tsx->transaction_key.slen != 0);
 
+    hval = get_tsx_hval(tsx);
+    shard = get_shard(hval);
+
     /* Lock hash table mutex. */
-    pj_mutex_lock(mod_tsx_layer.mutex);
+    pj_mutex_lock(shard->mutex);
 
     /* Check if no transaction with the same key exists. 
      * Do not use PJ_ASSERT_RETURN since it evaluates the expression
      * twice!
      */
-    if(pj_hash_get_lower(mod_tsx_layer.htable, 
+    if(pj_hash_get_lower(shard->htable, 
 		         tsx->transaction_key.ptr,
 		         (unsigned)tsx->transaction_key.slen, 
-		         NULL))
+		         &hval))
     {
-	pj_mutex_unlock(mod_tsx_layer.mutex);
+	pj_mutex_unlock(shard->mutex);
 	PJ_LOG(2,(THIS_FILE, 
 		  "Unable to register %.*s transaction (key exists)",
 		  (int)tsx->method.name.slen,
@@ -562,19 +659,13 @@ static pj_status_t mod_tsx_layer_register_tsx( pjsip_transaction *tsx)
 		tsx->transaction_key.ptr));
 
     /* Register the transaction to the hash table. */
-#ifdef PRECALC_HASH
-    pj_hash_set_lower( tsx->pool, mod_tsx_layer.htable,
+    pj_hash_set_lower( tsx->pool, shard->htable,
                        tsx->transaction_key.ptr,
     		       (unsigned)tsx->transaction_key.slen, 
-		       tsx->hashed_key, tsx);
-#else
-    pj_hash_set_lower( tsx->pool, mod_tsx_layer.htable,
-                       tsx->transaction_key.ptr,
-    		       tsx->transaction_key.slen, 0, tsx);
-#endif
+		       hval, tsx);
 
     /* Unlock mutex. */
-    pj_mutex_unlock(mod_tsx_layer.mutex);
+    pj_mutex_unlock(shard->mutex);
 
     return PJ_SUCCESS;
 }
@@ -585,6 +676,9 @@ static pj_status_t mod_tsx_layer_register_tsx( pjsip_transaction *tsx)
  */
 static void mod_tsx_layer_unregister_tsx( pjsip_transaction *tsx)
 {
+    pj_uint32_t hval;
+    tsx_shard *shard;
+
     if (mod_tsx_layer.mod.id == -1) {
 	/* The transaction layer has been unregistered. This could happen
 	 * if the transaction was pending on transport and the application
@@ -597,18 +691,15 @@ static void mod_tsx_layer_unregister_tsx( pjsip_transaction *tsx)
     pj_assert(tsx->transaction_key.slen != 0);
     //pj_assert(tsx->state != PJSIP_TSX_STATE_NULL);
 
+    hval = get_tsx_hval(tsx);
+    shard = get_shard(hval);
+
     /* Lock hash table mutex. */
-    pj_mutex_lock(mod_tsx_layer.mutex);
+    pj_mutex_lock(shard->mutex);
 
     /* Register the transaction to the hash table. */
-#ifdef PRECALC_HASH
-    pj_hash_set_lower( NULL, mod_tsx_layer.htable, tsx->transaction_key.ptr,
-    		       (unsigned)tsx->transaction_key.slen, tsx->hashed_key, 
-		       NULL);
-#else
-    pj_hash_set_lower( NULL, mod_tsx_layer.htable, tsx->transaction_key.ptr,
-    		       tsx->transaction_key.slen, 0, NULL);
-#endif
+    pj_hash_set_lower( NULL, shard->htable, tsx->transaction_key.ptr,
+    		       (unsigned)tsx->transaction_key.slen, hval, NULL);
 
     TSX_TRACE_((THIS_FILE, 
 		"Transaction %p unregistered, hkey=0x%p and key=%.*s",
@@ -616,7 +707,7 @@ static void mod_tsx_layer_unregister_tsx( pjsip_transaction *tsx)
 		tsx->transaction_key.ptr));
 
     /* Unlock mutex. */
-    pj_mutex_unlock(mod_tsx_layer.mutex);
+    pj_mutex_unlock(shard->mutex);
 }
 
 
@@ -626,14 +717,18 @@ static void mod_tsx_layer_unregister_tsx( pjsip_transaction *tsx)
  */
 PJ_DEF(unsigned) pjsip_tsx_layer_get_tsx_count(void)
 {
-    unsigned count;
+    unsigned i, count = 0;
 
     /* Are we registered? */
     PJ_ASSERT_RETURN(mod_tsx_layer.endpt!=NULL, 0);
 
-    pj_mutex_lock(mod_tsx_layer.mutex);
-    count = pj_hash_count(mod_tsx_layer.htable);
-    pj_mutex_unlock(mod_tsx_layer.mutex);
+    for (i=0; i<mod_tsx_layer.shard_cnt; ++i) {
+	tsx_shard *shard = &mod_tsx_layer.shards[i];
+
+	pj_mutex_lock(shard->mutex);
+	count += pj_hash_count(shard->htable);
+	pj_mutex_unlock(shard->mutex);
+    }
 
     return count;
 }
@@ -646,11 +741,15 @@ static pjsip_transaction* find_tsx( const pj_str_t *key, pj_bool_t lock,
 				    pj_bool_t add_ref )
 {
     pjsip_transaction *tsx;
-    pj_uint32_t hval = 0;
+    pj_uint32_t hval;
+    tsx_shard *shard;
+
+    hval = pj_hash_calc_tolower(0, NULL, key);
+    shard = get_shard(hval);
 
-    pj_mutex_lock(mod_tsx_layer.mutex);
+    pj_mutex_lock(shard->mutex);
     tsx = (pjsip_transaction*)
-    	  pj_hash_get_lower( mod_tsx_layer.htable, key->ptr, 
+    	  pj_hash_get_lower( shard->htable, key->ptr, 
 			     (unsigned)key->slen, &hval );
     
     /* Prevent the transaction to get deleted before we have chance to lock it.
@@ -658,7 +757,7 @@ static pjsip_transaction* find_tsx( const pj_str_t *key, pj_bool_t lock,
     if (tsx)
         pj_grp_lock_add_ref(tsx->grp_lock);
     
-    pj_mutex_unlock(mod_tsx_layer.mutex);
+    pj_mutex_unlock(shard->mutex);
 
     TSX_TRACE_((THIS_FILE, 
 		"Finding tsx with hkey=0x%p and key=%.*s: found %p",
@@ -718,26 +817,31 @@ static pj_status_t mod_tsx_layer_start(void)
 static pj_status_t mod_tsx_layer_stop(void)
 {
     pj_hash_iterator_t it_buf, *it;
+    unsigned i;
 
     PJ_LOG(4,(THIS_FILE, "Stopping transaction layer module"));
 
-    pj_mutex_lock(mod_tsx_layer.mutex);
-
-    /* Destroy all transactions. */
-    it = pj_hash_first(mod_tsx_layer.htable, &it_buf);
-    while (it) {
-	pjsip_transaction *tsx = (pjsip_transaction*) 
-				 pj_hash_this(mod_tsx_layer.htable, it);
-	pj_hash_iterator_t *next = pj_hash_next(mod_tsx_layer.htable, it);
-	if (tsx) {
-	    pjsip_tsx_terminate(tsx, PJSIP_SC_SERVICE_UNAVAILABLE);
-	    mod_tsx_layer_unregister_tsx(tsx);
-	    tsx_shutdown(tsx);
+    for (i=0; i<mod_tsx_layer.shard_cnt; ++i) {
+	tsx_shard *shard = &mod_tsx_layer.shards[i];
+
+	pj_mutex_lock(shard->mutex);
+
+	/* Destroy all transactions. */
+	it = pj_hash_first(shard->htable, &it_buf);
+	while (it) {
+	    pjsip_transaction *tsx = (pjsip_transaction*) 
+				     pj_hash_this(shard->htable, it);
+	    pj_hash_iterator_t *next = pj_hash_next(shard->htable, it);
+	    if (tsx) {
+		pjsip_tsx_terminate(tsx, PJSIP_SC_SERVICE_UNAVAILABLE);
+		mod_tsx_layer_unregister_tsx(tsx);
+		tsx_shutdown(tsx);
+	    }
+	    it = next;
 	}
-	it = next;
-    }
 
-    pj_mutex_unlock(mod_tsx_layer.mutex);
+	pj_mutex_unlock(shard->mutex);
+    }
 
     PJ_LOG(4,(THIS_FILE, "Stopped transaction layer module"));
 
@@ -750,8 +854,8 @@ static void tsx_layer_destroy(pjsip_endpoint *endpt)
 {
     PJ_UNUSED_ARG(endpt);
 
-    /* Destroy mutex. */
-    pj_mutex_destroy(mod_tsx_layer.mutex);
+    /* Destroy mutexes. */
+    destroy_shards();
 
     /* Release pool. */
     pjsip_endpt_release_pool(mod_tsx_layer.endpt, mod_tsx_layer.pool);
@@ -774,7 +878,12 @@ static pj_status_t mod_tsx_layer_unload(void)
      * crash when the pending transaction finally got error response
      * from transport and when it tries to unregister itself.
      */
-    if (pj_hash_count(mod_tsx_layer.htable) != 0) {
+    unsigned i, count = 0;
+
+    for (i=0; i<mod_tsx_layer.shard_cnt; ++i)
+	count += pj_hash_count(mod_tsx_layer.shards[i].htable);
+
+    if (count != 0) {
 	pj_status_t status;
 	status = pjsip_endpt_atexit(mod_tsx_layer.endpt, &tsx_layer_destroy);
 	if (status != PJ_SUCCESS) {
@@ -796,17 +905,21 @@ static pj_status_t mod_tsx_layer_unload(void)
 static pj_bool_t mod_tsx_layer_on_rx_request(pjsip_rx_data *rdata)
 {
     pj_str_t key;
-    pj_uint32_t hval = 0;
+    pj_uint32_t hval;
     pjsip_transaction *tsx;
+    tsx_shard *shard;
 
     pjsip_tsx_create_key(rdata->tp_info.pool, &key, PJSIP_ROLE_UAS,
 			 &rdata->msg_info.cseq->method, rdata);
 
+    hval = pj_hash_calc_tolower(0, NULL, &key);
+    shard = get_shard(hval);
+
     /* Find transaction. */
-    pj_mutex_lock( mod_tsx_layer.mutex );
+    pj_mutex_lock( shard->mutex );
 
     tsx = (pjsip_transaction*) 
-    	  pj_hash_get_lower( mod_tsx_layer.htable, key.ptr, (unsigned)key.slen, 
+    	  pj_hash_get_lower( shard->htable, key.ptr, (unsigned)key.slen, 
 			     &hval );
 
 
@@ -820,7 +933,7 @@ static pj_bool_t mod_tsx_layer_on_rx_request(pjsip_rx_data *rdata)
 	 * Reject the request so that endpoint passes the request to
 	 * upper layer modules.
 	 */
-	pj_mutex_unlock( mod_tsx_layer.mutex);
+	pj_mutex_unlock( shard->mutex);
 	return PJ_FALSE;
     }
 
@@ -830,7 +943,7 @@ static pj_bool_t mod_tsx_layer_on_rx_request(pjsip_rx_data *rdata)
     pj_grp_lock_add_ref(tsx->grp_lock);
     
     /* Unlock hash table. */
-    pj_mutex_unlock( mod_tsx_layer.mutex );
+    pj_mutex_unlock( shard->mutex );
 
     /* Simulate race condition! */
     PJ_RACE_ME(5);
@@ -850,17 +963,21 @@ static pj_bool_t mod_tsx_layer_on_rx_request(pjsip_rx_data *rdata)
 static pj_bool_t mod_tsx_layer_on_rx_response(pjsip_rx_data *rdata)
 {
     pj_str_t key;
-    pj_uint32_t hval = 0;
+    pj_uint32_t hval;
     pjsip_transaction *tsx;
+    tsx_shard *shard;
 
     pjsip_tsx_create_key(rdata->tp_info.pool, &key, PJSIP_ROLE_UAC,
 			 &rdata->msg_info.cseq->method, rdata);
 
+    hval = pj_hash_calc_tolower(0, NULL, &key);
+    shard = get_shard(hval);
+
     /* Find transaction. */
-    pj_mutex_lock( mod_tsx_layer.mutex );
+    pj_mutex_lock( shard->mutex );
 
     tsx = (pjsip_transaction*) 
-    	  pj_hash_get_lower( mod_tsx_layer.htable, key.ptr, (unsigned)key.slen, 
+    	  pj_hash_get_lower( shard->htable, key.ptr, (unsigned)key.slen, 
 			     &hval );
 
 
@@ -874,7 +991,7 @@ static pj_bool_t mod_tsx_layer_on_rx_response(pjsip_rx_data *rdata)
 	 * Reject the request so that endpoint passes the request to
 	 * upper layer modules.
 	 */
-	pj_mutex_unlock( mod_tsx_layer.mutex);
+	pj_mutex_unlock( shard->mutex);
 	return PJ_FALSE;
     }
 
@@ -884,7 +1001,7 @@ static pj_bool_t mod_tsx_layer_on_rx_response(pjsip_rx_data *rdata)
     pj_grp_lock_add_ref(tsx->grp_lock);
 
     /* Unlock hash table. */
-    pj_mutex_unlock( mod_tsx_layer.mutex );
+    pj_mutex_unlock( shard->mutex );
 
     /* Simulate race condition! */
     PJ_RACE_ME(5);
@@ -915,38 +1032,48 @@ PJ_DEF(void) pjsip_tsx_layer_dump(pj_bool_t detail)
 {
 #if PJ_LOG_MAX_LEVEL >= 3
     pj_hash_iterator_t itbuf, *it;
-
-    /* Lock mutex. */
-    pj_mutex_lock(mod_tsx_layer.mutex);
+    unsigned i;
 
     PJ_LOG(3, (THIS_FILE, "Dumping transaction table:"));
-    PJ_LOG(3, (THIS_FILE, " Total %d transactions", 
-			  pj_hash_count(mod_tsx_layer.htable)));
+    PJ_LOG(3, (THIS_FILE, " Total %d transactions in %d shard(s)", 
+			  pjsip_tsx_layer_get_tsx_count(),
+			  mod_tsx_layer.shard_cnt));
 
-    if (detail) {
-	it = pj_hash_first(mod_tsx_layer.htable, &itbuf);
-	if (it == NULL) {
-	    PJ_LOG(3, (THIS_FILE, " - none - "));
-	} else {
-	    while (it != NULL) {
-		pjsip_transaction *tsx = (pjsip_transaction*) 
-					 pj_hash_this(mod_tsx_layer.htable,it);
-
-		PJ_LOG(3, (THIS_FILE, " %s %s|%d|%s",
-			   tsx->obj_name,
-			   (tsx->last_tx? 
-				pjsip_tx_data_get_info(tsx->last_tx): 
-				"none"),
-			   tsx->status_code,
-			   pjsip_tsx_state_str(tsx->state)));
-
-		it = pj_hash_next(mod_tsx_layer.htable, it);
-	    }
-	}
+    if (!detail)
+	return;
+
+    if (pjsip_tsx_layer_get_tsx_count() == 0) {
+	PJ_LOG(3, (THIS_FILE, " - none - "));
+	return;
     }
 
-    /* Unlock mutex. */
-    pj_mutex_unlock(mod_tsx_layer.mutex);
+    for (i=0; i<mod_tsx_layer.shard_cnt; ++i) {
+	tsx_shard *shard = &mod_tsx_layer.shards[i];
+
+	/* Lock mutex. */
+	pj_mutex_lock(shard->mutex);
+
+	it = pj_hash_first(shard->htable, &itbuf);
+	while (it != NULL) {
+	    pjsip_transaction *tsx = (pjsip_transaction*) 
+				     pj_hash_this(shard->htable, it);
+
+	    PJ_LOG(3, (THIS_FILE, " %s %s|%d|%s",
+		       tsx->obj_name,
+		       (tsx->last_tx? 
+			    pjsip_tx_data_get_info(tsx->last_tx): 
+			    "none"),
+		       tsx->status_code,
+		       pjsip_tsx_state_str(tsx->state)));
+
+	    it = pj_hash_next(shard->htable, it);
+	}
+
+	/* Unlock mutex. */
+	pj_mutex_unlock(shard->mutex);
+    }
+#else
+    PJ_UNUSED_ARG(detail);
 #endif
 }
 
@@ -974,7 +1101,8 @@ static pj_status_t tsx_schedule_timer(pjsip_transaction *tsx,
                                       const pj_time_val *delay,
                                       int active_id)
 {
-    pj_timer_heap_t *timer_heap = pjsip_endpt_get_timer_heap(tsx->endpt);
+    pj_timer_heap_t *timer_heap = pjsip_endpt_get_entry_timer_heap(tsx->endpt,
+								   entry);
     pj_status_t status;
 
     pj_assert(active_id != 0);
@@ -989,7 +1117,8 @@ static pj_status_t tsx_schedule_timer(pjsip_transaction *tsx,
 static int tsx_cancel_timer(pjsip_transaction *tsx,
                             pj_timer_entry *entry)
 {
-    pj_timer_heap_t *timer_heap = pjsip_endpt_get_timer_heap(tsx->endpt);
+    pj_timer_heap_t *timer_heap = pjsip_endpt_get_entry_timer_heap(tsx->endpt,
+								   entry);
     return pj_timer_heap_cancel_if_active(timer_heap, entry, TIMER_INACTIVE);
 }
 
@@ -2033,6 +2162,31 @@ static void transport_callback(void *token, pjsip_tx_data *tdata,
      */
     pj_grp_lock_acquire(tsx->grp_lock);
     tsx->transport_flag &= ~(TSX_HAS_PENDING_TRANSPORT);
+
+    /* pjsip_transport_send() completes asynchronously when the transport
+     * can't send right away (e.g. the UDP socket buffer is full, or a
+     * TCP/TLS connection is still being established). Meanwhile the state
+     * handlers only flag the sends and retransmission scheduling they
+     * need, so these must be done here, like send_msg_callback() does,
+     * or the transaction would lose its retransmission timer.
+     */
+    if (sent > 0) {
+	/* Need to transmit a message? */
+	if (tsx->transport_flag & TSX_HAS_PENDING_SEND) {
+	    tsx->transport_flag &= ~(TSX_HAS_PENDING_SEND);
+	    tsx_send_msg(tsx, tsx->last_tx);
+	}
+
+	/* Need to reschedule retransmission? (see send_msg_callback()) */
+	if (tsx->transport_flag & TSX_HAS_PENDING_RESCHED &&
+	    !(tsx->transport_flag & TSX_HAS_PENDING_TRANSPORT))
+	{
+	    tsx->transport_flag &= ~(TSX_HAS_PENDING_RESCHED);
+	    if (!tsx->is_reliable) {
+		tsx_resched_retransmission(tsx);
+	    }
+	}
+    }
     pj_grp_lock_release(tsx->grp_lock);
 
     if (sent < 0) {
@@ -73,6 +73,21 @@ static const char *addr_string(const pj_sockaddr_t *addr)
 #   define PJSIP_TRANSPORT_ENTRY_ALLOC_CNT  16
 #endif
 
+/* Recycling of tdata and rdata clones rewinds the pool blocks, hence it
+ * can't be used with the alternate pool implementation.
+ */
+#if (PJSIP_TDATA_CACHE_SIZE || PJSIP_RDATA_CACHE_SIZE) && \
+    (!defined(PJ_HAS_POOL_ALT_API) || PJ_HAS_POOL_ALT_API==0)
+#   define TPMGR_HAS_MSG_CACHE	1
+#else
+#   define TPMGR_HAS_MSG_CACHE	0
+#endif
+
+/* Messages whose pool has grown beyond this are destroyed rather than
+ * recycled, so that a few large messages don't hold on to memory.
+ */
+#define MSG_CACHE_MAX_CAPACITY(len, inc)    ((len) + 4 * (inc))
+
 /* Prototype. */
 static pj_status_t mod_on_tx_msg(pjsip_tx_data *tdata);
 
@@ -96,6 +111,39 @@ static pjsip_module mod_msg_print =
     NULL,				/* on_tsx_state()		    */
 };
 
+#if TPMGR_HAS_MSG_CACHE
+/* Per-thread cache of destroyed tdata and freed rdata clones. Only the
+ * owning thread accesses the cache, except when the transport manager
+ * is dumped or destroyed.
+ */
+struct msg_cache
+{
+    PJ_DECL_LIST_MEMBER(struct msg_cache);
+    unsigned		tdata_cnt;
+    pjsip_tx_data      *tdata[PJSIP_TDATA_CACHE_SIZE + 1];
+    unsigned		rdata_cnt;
+    pjsip_rx_data      *rdata[PJSIP_RDATA_CACHE_SIZE + 1];
+    pjsip_tpmgr_cache_stat stat;
+};
+#endif
+
+/* The tdata and rdata clone as allocated from their pool. The pool mark
+ * is the end of the allocations that are kept when the message is
+ * recycled, or NULL if the message can't be recycled.
+ */
+typedef struct tx_data_obj
+{
+    pjsip_tx_data    tdata;
+    unsigned char   *pool_mark;
+} tx_data_obj;
+
+typedef struct rx_data_obj
+{
+    pjsip_rx_data    rdata;
+    unsigned char   *pool_mark;
+} rx_data_obj;
+
+
 /* Transport list item */
 typedef struct transport
 {
@@ -122,6 +170,9 @@ struct pjsip_tpmgr
     pjsip_tp_state_callback tp_state_cb;
     pjsip_tp_on_rx_dropped_cb tp_drop_data_cb;
 
+    /* Options for parsing incoming messages, see pjsip_parse_option. */
+    unsigned	     parse_options;
+
     /* Transmit data list, for transmit data cleanup when transport manager
      * is destroyed.
      */
@@ -129,6 +180,51 @@ struct pjsip_tpmgr
 
     /* List of free transport entry. */
     transport	     tp_entry_freelist;
+
+#if TPMGR_HAS_MSG_CACHE
+    /* Thread local index of the thread's message cache, and the list of
+     * all message caches.
+     */
+    long	     msg_cache_tls;
+    pj_list	     msg_cache_list;
+#endif
+
+    /* I/O workers of connection oriented transports, started on the
+     * first call to pjsip_tpmgr_get_io_worker().
+     */
+    pj_pool_t	    *io_worker_pool;
+    struct io_worker *io_worker;
+    unsigned	     io_worker_cnt;
+    unsigned	     io_worker_next;
+    pj_bool_t	     io_worker_started;
+    pj_atomic_t	    *io_worker_quit;
+};
+
+
+/* Maximum time an I/O worker waits in the ioqueue before polling its
+ * timer heap again, in msec.
+ */
+#define IO_WORKER_MAX_TIMEOUT	10
+
+/* Maximum time to wait for the connections of the I/O workers to be
+ * released when the transport manager is destroyed, in msec.
+ */
+#define IO_WORKER_STOP_TIMEOUT	2000
+
+/* I/O worker, polling its own ioqueue and timer heap in its own thread */
+struct io_worker
+{
+    pjsip_tpmgr	    *mgr;
+    pj_ioqueue_t    *ioqueue;
+    pj_timer_heap_t *timer_heap;
+    pj_thread_t	    *thread;
+    unsigned	     conn_cnt;
+
+    /* Number of connections whose group lock is not destroyed yet, i.e.
+     * which may still have a key registered in the ioqueue or a callback
+     * running in the worker.
+     */
+    pj_atomic_t	    *conn_active;
 };
 
 
@@ -430,6 +526,140 @@ PJ_DEF(void) pjsip_tpselector_dec_ref(pjsip_tpselector *sel)
  *
  *****************************************************************************/
 
+#if TPMGR_HAS_MSG_CACHE
+/* Get the calling thread's message cache, creating one if it doesn't
+ * exist yet. The cache of a thread is only freed when the transport
+ * manager is destroyed.
+ */
+static struct msg_cache *get_msg_cache(pjsip_tpmgr *mgr)
+{
+    struct msg_cache *mc;
+
+    mc = (struct msg_cache*) pj_thread_local_get(mgr->msg_cache_tls);
+    if (mc)
+	return mc;
+
+    pj_lock_acquire(mgr->lock);
+    mc = PJ_POOL_ZALLOC_T(mgr->pool, struct msg_cache);
+    if (pj_thread_local_set(mgr->msg_cache_tls, mc) != PJ_SUCCESS) {
+	pj_lock_release(mgr->lock);
+	return NULL;
+    }
+    pj_list_push_back(&mgr->msg_cache_list, mc);
+    pj_lock_release(mgr->lock);
+
+    return mc;
+}
+
+/* Rewind the pool of a recycled message to the mark. Unlike
+ * pj_pool_reset(), the blocks that were added to the pool are kept for
+ * the next message. The mark is always in the first block, which is the
+ * last in the block list.
+ */
+static void rewind_pool(pj_pool_t *pool, unsigned char *mark)
+{
+    pj_pool_block *block = pool->block_list.next;
+
+    while (block != &pool->block_list) {
+	block->cur = block->buf + (-(pj_ssize_t)block->buf &
+				   (PJ_POOL_ALIGNMENT-1));
+	block = block->next;
+    }
+    pool->block_list.prev->cur = mark;
+}
+
+/* Get the mark of the allocations made so far, or NULL if they don't
+ * fit in the first block.
+ */
+static unsigned char *get_pool_mark(pj_pool_t *pool)
+{
+    if (pool->block_list.next != pool->block_list.prev)
+	return NULL;
+    return pool->block_list.next->cur;
+}
+#endif	/* TPMGR_HAS_MSG_CACHE */
+
+/* Initialize the parts of tdata which are not kept by recycling. */
+static void tx_data_init(pjsip_tx_data *tdata)
+{
+    pj_ioqueue_op_key_init(&tdata->op_key.key, sizeof(tdata->op_key.key));
+    pj_list_init(tdata);
+
+#if defined(PJSIP_HAS_TX_DATA_LIST) && PJSIP_HAS_TX_DATA_LIST!=0
+    /* Append this just created tdata to transmit buffer list */
+    pj_lock_acquire(tdata->mgr->lock);
+    pj_list_push_back(&tdata->mgr->tdata_list, tdata);
+    pj_lock_release(tdata->mgr->lock);
+#endif
+
+#if defined(PJ_DEBUG) && PJ_DEBUG!=0
+    pj_atomic_inc( tdata->mgr->tdata_counter );
+#endif
+}
+
+#if PJSIP_TDATA_CACHE_SIZE && TPMGR_HAS_MSG_CACHE
+/* Take a tdata from the calling thread's cache. */
+static pjsip_tx_data *tx_data_reuse(pjsip_tpmgr *mgr)
+{
+    struct msg_cache *mc = get_msg_cache(mgr);
+    tx_data_obj *obj;
+    pj_pool_t *pool;
+    pj_lock_t *lock;
+    pj_atomic_t *ref_cnt;
+    char obj_name[PJ_MAX_OBJ_NAME];
+
+    if (!mc)
+	return NULL;
+
+    if (mc->tdata_cnt == 0) {
+	++mc->stat.tdata_created;
+	return NULL;
+    }
+    ++mc->stat.tdata_reused;
+
+    obj = (tx_data_obj*) mc->tdata[--mc->tdata_cnt];
+    pool = obj->tdata.pool;
+    lock = obj->tdata.lock;
+    ref_cnt = obj->tdata.ref_cnt;
+
+    pj_memcpy(obj_name, obj->tdata.obj_name, sizeof(obj_name));
+
+    rewind_pool(pool, obj->pool_mark);
+
+    pj_bzero(&obj->tdata, sizeof(pjsip_tx_data));
+    obj->tdata.pool = pool;
+    pj_memcpy(obj->tdata.obj_name, obj_name, sizeof(obj_name));
+    obj->tdata.mgr = mgr;
+    obj->tdata.lock = lock;
+    obj->tdata.ref_cnt = ref_cnt;
+
+    return &obj->tdata;
+}
+
+/* Keep the tdata in the calling thread's cache. The tdata has been
+ * removed from the transmit buffer list.
+ */
+static pj_bool_t tx_data_recycle(pjsip_tx_data *tdata)
+{
+    tx_data_obj *obj = (tx_data_obj*) tdata;
+    struct msg_cache *mc;
+
+    if (!obj->pool_mark ||
+	pj_pool_get_capacity(tdata->pool) >
+	    MSG_CACHE_MAX_CAPACITY(PJSIP_POOL_LEN_TDATA, PJSIP_POOL_INC_TDATA))
+    {
+	return PJ_FALSE;
+    }
+
+    mc = get_msg_cache(tdata->mgr);
+    if (!mc || mc->tdata_cnt == PJSIP_TDATA_CACHE_SIZE)
+	return PJ_FALSE;
+
+    mc->tdata[mc->tdata_cnt++] = tdata;
+    return PJ_TRUE;
+}
+#endif
+
 /*
  * Create new transmit buffer.
  */
@@ -437,18 +667,29 @@ PJ_DEF(pj_status_t) pjsip_tx_data_create( pjsip_tpmgr *mgr,
 					  pjsip_tx_data **p_tdata )
 {
     pj_pool_t *pool;
+    tx_data_obj *obj;
     pjsip_tx_data *tdata;
     pj_status_t status;
 
     PJ_ASSERT_RETURN(mgr && p_tdata, PJ_EINVAL);
 
+#if PJSIP_TDATA_CACHE_SIZE && TPMGR_HAS_MSG_CACHE
+    tdata = tx_data_reuse(mgr);
+    if (tdata) {
+	tx_data_init(tdata);
+	*p_tdata = tdata;
+	return PJ_SUCCESS;
+    }
+#endif
+
     pool = pjsip_endpt_create_pool( mgr->endpt, "tdta%p",
 				    PJSIP_POOL_LEN_TDATA,
 				    PJSIP_POOL_INC_TDATA );
     if (!pool)
 	return PJ_ENOMEM;
 
-    tdata = PJ_POOL_ZALLOC_T(pool, pjsip_tx_data);
+    obj = PJ_POOL_ZALLOC_T(pool, tx_data_obj);
+    tdata = &obj->tdata;
     tdata->pool = pool;
     tdata->mgr = mgr;
     pj_ansi_snprintf(tdata->obj_name, sizeof(tdata->obj_name), "tdta%p", tdata);
@@ -467,19 +708,11 @@ PJ_DEF(pj_status_t) pjsip_tx_data_create( pjsip_tpmgr *mgr,
 	return status;
     }
 
-    pj_ioqueue_op_key_init(&tdata->op_key.key, sizeof(tdata->op_key.key));
-    pj_list_init(tdata);
-
-#if defined(PJSIP_HAS_TX_DATA_LIST) && PJSIP_HAS_TX_DATA_LIST!=0
-    /* Append this just created tdata to transmit buffer list */
-    pj_lock_acquire(mgr->lock);
-    pj_list_push_back(&mgr->tdata_list, tdata);
-    pj_lock_release(mgr->lock);
+#if TPMGR_HAS_MSG_CACHE
+    obj->pool_mark = get_pool_mark(pool);
 #endif
 
-#if defined(PJ_DEBUG) && PJ_DEBUG!=0
-    pj_atomic_inc( tdata->mgr->tdata_counter );
-#endif
+    tx_data_init(tdata);
 
     *p_tdata = tdata;
     return PJ_SUCCESS;
@@ -510,6 +743,11 @@ static void tx_data_destroy(pjsip_tx_data *tdata)
     pj_lock_release(tdata->mgr->lock);
 #endif
 
+#if PJSIP_TDATA_CACHE_SIZE && TPMGR_HAS_MSG_CACHE
+    if (tx_data_recycle(tdata))
+	return;
+#endif
+
     pj_atomic_destroy( tdata->ref_cnt );
     pj_lock_destroy( tdata->lock );
     pjsip_endpt_release_pool( tdata->mgr->endpt, tdata->pool );
@@ -726,6 +964,60 @@ PJ_DEF(char*) pjsip_rx_data_get_info(pjsip_rx_data *rdata)
     return rdata->msg_info.info;
 }
 
+#if PJSIP_RDATA_CACHE_SIZE && TPMGR_HAS_MSG_CACHE
+/* Take an rdata clone from the calling thread's cache. */
+static pjsip_rx_data *rx_data_reuse(const pjsip_rx_data *src)
+{
+    pjsip_tpmgr *mgr = src->tp_info.transport->tpmgr;
+    struct msg_cache *mc;
+    rx_data_obj *obj;
+    pj_pool_t *pool;
+
+    if (!mgr || (mc = get_msg_cache(mgr)) == NULL)
+	return NULL;
+
+    if (mc->rdata_cnt == 0 ||
+	mc->rdata[mc->rdata_cnt-1]->tp_info.pool->factory !=
+	    src->tp_info.pool->factory)
+    {
+	++mc->stat.rdata_created;
+	return NULL;
+    }
+    ++mc->stat.rdata_reused;
+
+    obj = (rx_data_obj*) mc->rdata[--mc->rdata_cnt];
+    pool = obj->rdata.tp_info.pool;
+
+    rewind_pool(pool, obj->pool_mark);
+    pj_bzero(&obj->rdata, sizeof(pjsip_rx_data));
+    obj->rdata.tp_info.pool = pool;
+
+    return &obj->rdata;
+}
+
+/* Keep the rdata clone in the calling thread's cache. */
+static pj_bool_t rx_data_recycle(pjsip_rx_data *rdata)
+{
+    rx_data_obj *obj = (rx_data_obj*) rdata;
+    pjsip_tpmgr *mgr = rdata->tp_info.transport->tpmgr;
+    struct msg_cache *mc;
+
+    if (!mgr || !obj->pool_mark ||
+	pj_pool_get_capacity(rdata->tp_info.pool) >
+	    MSG_CACHE_MAX_CAPACITY(PJSIP_POOL_RDATA_LEN, PJSIP_POOL_RDATA_INC))
+    {
+	return PJ_FALSE;
+    }
+
+    mc = get_msg_cache(mgr);
+    if (!mc || mc->rdata_cnt == PJSIP_RDATA_CACHE_SIZE)
+	return PJ_FALSE;
+
+    mc->rdata[mc->rdata_cnt++] = rdata;
+    return PJ_TRUE;
+}
+#endif
+
 /* Clone pjsip_rx_data. */
 PJ_DEF(pj_status_t) pjsip_rx_data_clone( const pjsip_rx_data *src,
                                          unsigned flags,
@@ -737,15 +1029,29 @@ PJ_DEF(pj_status_t) pjsip_rx_data_clone( const pjsip_rx_data *src,
 
     PJ_ASSERT_RETURN(src && flags==0 && p_rdata, PJ_EINVAL);
 
-    pool = pj_pool_create(src->tp_info.pool->factory,
-                          "rtd%p",
-                          PJSIP_POOL_RDATA_LEN,
-                          PJSIP_POOL_RDATA_INC,
-                          NULL);
-    if (!pool)
-	return PJ_ENOMEM;
+#if PJSIP_RDATA_CACHE_SIZE && TPMGR_HAS_MSG_CACHE
+    dst = rx_data_reuse(src);
+    if (dst) {
+	pool = dst->tp_info.pool;
+    } else
+#endif
+    {
+	rx_data_obj *obj;
+
+	pool = pj_pool_create(src->tp_info.pool->factory,
+			      "rtd%p",
+			      PJSIP_POOL_RDATA_LEN,
+			      PJSIP_POOL_RDATA_INC,
+			      NULL);
+	if (!pool)
+	    return PJ_ENOMEM;
 
-    dst = PJ_POOL_ZALLOC_T(pool, pjsip_rx_data);
+	obj = PJ_POOL_ZALLOC_T(pool, rx_data_obj);
+#if TPMGR_HAS_MSG_CACHE
+	obj->pool_mark = get_pool_mark(pool);
+#endif
+	dst = &obj->rdata;
+    }
 
     /* Parts of tp_info */
     dst->tp_info.pool = pool;
@@ -754,11 +1060,23 @@ PJ_DEF(pj_status_t) pjsip_rx_data_clone( const pjsip_rx_data *src,
     /* pkt_info can be memcopied */
     pj_memcpy(&dst->pkt_info, &src->pkt_info, sizeof(src->pkt_info));
 
-    /* msg_info needs deep clone */
-    dst->msg_info.msg_buf = dst->pkt_info.packet;
+    /* msg_info needs deep clone. An oversized message is not in the
+     * packet buffer, so its text is copied too.
+     */
+    if (src->msg_info.len <= (int)sizeof(src->pkt_info.packet)) {
+	dst->msg_info.msg_buf = dst->pkt_info.packet;
+    } else {
+	dst->msg_info.msg_buf = (char*)
+				pj_pool_alloc(pool, src->msg_info.len + 1);
+	pj_memcpy(dst->msg_info.msg_buf, src->msg_info.msg_buf,
+		  src->msg_info.len);
+	dst->msg_info.msg_buf[src->msg_info.len] = '\0';
+    }
     dst->msg_info.len = src->msg_info.len;
     dst->msg_info.msg = pjsip_msg_clone(pool, src->msg_info.msg);
     pj_list_init(&dst->msg_info.parse_err);
+    pj_list_init(&dst->msg_info.raw_hdr);
+    dst->msg_info.lend = NULL;
 
 #define GET_MSG_HDR2(TYPE, type, var)	\
 			case PJSIP_H_##TYPE: \
@@ -801,14 +1119,131 @@ PJ_DEF(pj_status_t) pjsip_rx_data_clone( const pjsip_rx_data *src,
 /* Free previously cloned pjsip_rx_data. */
 PJ_DEF(pj_status_t) pjsip_rx_data_free_cloned(pjsip_rx_data *rdata)
 {
+    pjsip_transport *tp;
+
     PJ_ASSERT_RETURN(rdata, PJ_EINVAL);
 
-    pjsip_transport_dec_ref(rdata->tp_info.transport);
-    pj_pool_release(rdata->tp_info.pool);
+    tp = rdata->tp_info.transport;
+
+    pjsip_rx_data_release_buf(rdata);
+
+#if PJSIP_RDATA_CACHE_SIZE && TPMGR_HAS_MSG_CACHE
+    if (!rx_data_recycle(rdata))
+#endif
+	pj_pool_release(rdata->tp_info.pool);
+
+    pjsip_transport_dec_ref(tp);
+
+    return PJ_SUCCESS;
+}
+
+/* Message which refers to the packet buffer of rdata */
+struct pjsip_rx_data_lend
+{
+    struct pjsip_rx_data_lend	*next;
+    pjsip_tx_data		*tdata;
+};
+
+PJ_DEF(pj_status_t) pjsip_rx_data_lend_buf(pjsip_rx_data *rdata,
+					   pjsip_tx_data *tdata)
+{
+    struct pjsip_rx_data_lend *lend;
+
+    PJ_ASSERT_RETURN(rdata && tdata, PJ_EINVAL);
+    PJ_ASSERT_RETURN(tdata->lent_buf == NULL, PJ_EINVALIDOP);
+
+    lend = PJ_POOL_ALLOC_T(rdata->tp_info.pool, struct pjsip_rx_data_lend);
+    if (!lend)
+	return PJ_ENOMEM;
+
+    pjsip_tx_data_add_ref(tdata);
+    lend->tdata = tdata;
+    lend->next = rdata->msg_info.lend;
+    rdata->msg_info.lend = lend;
+
+    tdata->lent_buf = rdata->msg_info.msg_buf;
+    tdata->lent_len = rdata->msg_info.len;
 
     return PJ_SUCCESS;
 }
 
+/* Move the string to the copy of the packet if it's in the packet. */
+static void rebase_str(pj_str_t *str, const char *pkt, pj_ssize_t len,
+		       pj_pool_t *pool, char **p_copy)
+{
+    if (str->ptr < pkt || str->ptr + str->slen > pkt + len)
+	return;
+
+    if (*p_copy == NULL) {
+	*p_copy = (char*) pj_pool_alloc(pool, len + 1);
+	pj_memcpy(*p_copy, pkt, len);
+	(*p_copy)[len] = '\0';
+    }
+    str->ptr = *p_copy + (str->ptr - pkt);
+}
+
+/* Move the lazy headers and body of the message which still refer to the
+ * packet to a copy of the packet in the tdata's pool.
+ */
+PJ_DEF(void) pjsip_tx_data_own_buf(pjsip_tx_data *tdata)
+{
+    const char *pkt = tdata->lent_buf;
+    pj_ssize_t len = tdata->lent_len;
+    pjsip_msg *msg = tdata->msg;
+    pjsip_hdr *hdr;
+    char *copy = NULL;
+
+    if (!pkt)
+	return;
+
+    tdata->lent_buf = NULL;
+    tdata->lent_len = 0;
+
+    if (!msg)
+	return;
+
+    for (hdr=msg->hdr.next; hdr!=&msg->hdr; hdr=hdr->next) {
+	pjsip_lazy_hdr *lhdr = (pjsip_lazy_hdr*)hdr;
+
+	if (!pjsip_hdr_is_lazy(hdr))
+	    continue;
+
+	rebase_str(&lhdr->name, pkt, len, tdata->pool, &copy);
+	rebase_str(&lhdr->sname, pkt, len, tdata->pool, &copy);
+	rebase_str(&lhdr->hvalue, pkt, len, tdata->pool, &copy);
+    }
+
+    if (msg->body) {
+	pj_str_t data;
+
+	data.ptr = (char*)msg->body->data;
+	data.slen = msg->body->len;
+	rebase_str(&data, pkt, len, tdata->pool, &copy);
+	msg->body->data = data.ptr;
+    }
+}
+
+PJ_DEF(void) pjsip_rx_data_release_buf(pjsip_rx_data *rdata)
+{
+    struct pjsip_rx_data_lend *lend;
+
+    PJ_ASSERT_ON_FAIL(rdata, return);
+
+    lend = rdata->msg_info.lend;
+    rdata->msg_info.lend = NULL;
+
+    for (; lend; lend = lend->next) {
+	pjsip_tx_data *tdata = lend->tdata;
+
+	/* Nothing to keep if we hold the last reference. Otherwise the
+	 * message has usually been sent and owns its buffer already.
+	 */
+	if (pj_atomic_get(tdata->ref_cnt) > 1)
+	    pjsip_tx_data_own_buf(tdata);
+	pjsip_tx_data_dec_ref(tdata);
+    }
+}
+
 /*****************************************************************************
  *
  * TRANSPORT KEY
@@ -866,6 +1301,9 @@ PJ_DEF(pj_status_t) pjsip_transport_send(  pjsip_transport *tr,
 
     PJ_ASSERT_RETURN(tr && tdata && addr, PJ_EINVAL);
 
+    /* The transport may print the message from another thread */
+    pjsip_tx_data_own_buf(tdata);
+
     /* Is it currently being sent? */
     if (tdata->is_pending) {
 	pj_assert(!"Invalid operation step!");
@@ -1520,7 +1958,8 @@ PJ_DEF(pj_status_t) pjsip_tpmgr_create( pj_pool_t *pool,
     pj_list_init(&mgr->tdata_list);
     pj_list_init(&mgr->tp_entry_freelist);
 
-    mgr->table = pj_hash_create(mgr->pool, PJSIP_TPMGR_HTABLE_SIZE);
+    mgr->table = pj_hash_create2(mgr->pool, PJSIP_TPMGR_HTABLE_SIZE,
+				 PJ_HASH_OPT_OPEN_ADDRESSING);
     if (!mgr->table)
 	return PJ_ENOMEM;
 
@@ -1546,6 +1985,18 @@ PJ_DEF(pj_status_t) pjsip_tpmgr_create( pj_pool_t *pool,
     }
 #endif
 
+#if TPMGR_HAS_MSG_CACHE
+    pj_list_init(&mgr->msg_cache_list);
+    status = pj_thread_local_alloc(&mgr->msg_cache_tls);
+    if (status != PJ_SUCCESS) {
+#if defined(PJ_DEBUG) && PJ_DEBUG!=0
+	pj_atomic_destroy(mgr->tdata_counter);
+#endif
+    	pj_lock_destroy(mgr->lock);
+    	return status;
+    }
+#endif
+
     /* Set transport state callback */
     pjsip_tpmgr_set_state_cb(mgr, &tp_state_callback);
 
@@ -1782,6 +2233,257 @@ PJ_DEF(unsigned) pjsip_tpmgr_get_transport_count(pjsip_tpmgr *mgr)
     return nr_of_transports;
 }
 
+/*
+ * Get tdata and rdata clone recycling statistics.
+ */
+PJ_DEF(pj_status_t) pjsip_tpmgr_get_cache_stat(pjsip_tpmgr *mgr,
+					       pjsip_tpmgr_cache_stat *stat)
+{
+    PJ_ASSERT_RETURN(mgr && stat, PJ_EINVAL);
+
+    pj_bzero(stat, sizeof(*stat));
+
+#if TPMGR_HAS_MSG_CACHE
+    {
+	struct msg_cache *mc;
+
+	pj_lock_acquire(mgr->lock);
+	mc = (struct msg_cache*) mgr->msg_cache_list.next;
+	while (mc != (struct msg_cache*) &mgr->msg_cache_list) {
+	    stat->tdata_reused += mc->stat.tdata_reused;
+	    stat->tdata_created += mc->stat.tdata_created;
+	    stat->rdata_reused += mc->stat.rdata_reused;
+	    stat->rdata_created += mc->stat.rdata_created;
+	    mc = mc->next;
+	}
+	pj_lock_release(mgr->lock);
+    }
+#endif
+
+    return PJ_SUCCESS;
+}
+
+/* Thread function of the I/O workers */
+static int PJ_THREAD_FUNC io_worker_thread(void *arg)
+{
+    struct io_worker *w = (struct io_worker*) arg;
+
+    while (pj_atomic_get(w->mgr->io_worker_quit) == 0) {
+	pj_time_val timeout = {0, 0};
+
+	pj_timer_heap_poll(w->timer_heap, &timeout);
+
+	if (timeout.sec > 0 || timeout.msec > IO_WORKER_MAX_TIMEOUT) {
+	    timeout.sec = 0;
+	    timeout.msec = IO_WORKER_MAX_TIMEOUT;
+	}
+	pj_ioqueue_poll(w->ioqueue, &timeout);
+    }
+
+    return 0;
+}
+
+/* Group lock destroy handler of the connections pinned to a worker */
+static void io_worker_on_conn_destroy(void *arg)
+{
+    struct io_worker *w = (struct io_worker*) arg;
+    pj_atomic_dec(w->conn_active);
+}
+
+/*
+ * Stop the I/O workers and destroy their ioqueues and timer heaps. This is
+ * called after the transports have been destroyed, but their sockets may
+ * still be registered to the ioqueues or have callbacks running in the
+ * workers until their group locks are destroyed. So the workers keep
+ * polling until that happens, and the ioqueue of a worker whose
+ * connections outlive IO_WORKER_STOP_TIMEOUT is leaked rather than
+ * destroyed under them.
+ */
+static void stop_io_workers(pjsip_tpmgr *mgr)
+{
+    pj_time_val now, end;
+    pj_bool_t leaked = PJ_FALSE;
+    unsigned i;
+
+    pj_gettickcount(&end);
+    end.msec += IO_WORKER_STOP_TIMEOUT;
+    pj_time_val_normalize(&end);
+
+    for (;;) {
+	unsigned busy = 0;
+
+	for (i=0; i<mgr->io_worker_cnt; ++i) {
+	    struct io_worker *w = &mgr->io_worker[i];
+	    if (w->thread && w->conn_active &&
+		pj_atomic_get(w->conn_active) > 0)
+	    {
+		++busy;
+	    }
+	}
+
+	pj_gettickcount(&now);
+	if (busy == 0)
+	    break;
+	if (PJ_TIME_VAL_GTE(now, end)) {
+	    PJ_LOG(2,(THIS_FILE, "Timed out after %d ms waiting for the "
+		      "connections of %u I/O worker(s) to be released",
+		      IO_WORKER_STOP_TIMEOUT, busy));
+	    break;
+	}
+
+	pj_thread_sleep(IO_WORKER_MAX_TIMEOUT);
+    }
+
+    if (mgr->io_worker_quit)
+	pj_atomic_set(mgr->io_worker_quit, 1);
+
+    for (i=0; i<mgr->io_worker_cnt; ++i) {
+	struct io_worker *w = &mgr->io_worker[i];
+
+	if (w->thread) {
+	    pj_thread_join(w->thread);
+	    pj_thread_destroy(w->thread);
+	    w->thread = NULL;
+	}
+	if (w->conn_active && pj_atomic_get(w->conn_active) > 0) {
+	    PJ_LOG(2,(THIS_FILE, "I/O worker %u still has %ld connection(s) "
+		      "after %d ms, leaking its ioqueue", i,
+		      pj_atomic_get(w->conn_active), IO_WORKER_STOP_TIMEOUT));
+	    leaked = PJ_TRUE;
+	    continue;
+	}
+	if (w->ioqueue) {
+	    pj_ioqueue_destroy(w->ioqueue);
+	    w->ioqueue = NULL;
+	}
+	if (w->timer_heap) {
+	    pj_timer_heap_destroy(w->timer_heap);
+	    w->timer_heap = NULL;
+	}
+	if (w->conn_active) {
+	    pj_atomic_destroy(w->conn_active);
+	    w->conn_active = NULL;
+	}
+    }
+    mgr->io_worker_cnt = 0;
+
+    if (mgr->io_worker_quit) {
+	pj_atomic_destroy(mgr->io_worker_quit);
+	mgr->io_worker_quit = NULL;
+    }
+
+    /* The leaked workers are still referenced by the destroy handlers of
+     * their connections.
+     */
+    if (mgr->io_worker_pool && !leaked)
+	pj_pool_release(mgr->io_worker_pool);
+    mgr->io_worker_pool = NULL;
+}
+
+/* Start the I/O workers, with mgr->lock held */
+static pj_status_t start_io_workers(pjsip_tpmgr *mgr, unsigned cnt)
+{
+    unsigned i;
+    pj_status_t status;
+
+    mgr->io_worker_pool = pjsip_endpt_create_pool(mgr->endpt, "sipio%p",
+						  512, 512);
+    if (!mgr->io_worker_pool)
+	return PJ_ENOMEM;
+
+    mgr->io_worker = (struct io_worker*)
+		     pj_pool_calloc(mgr->io_worker_pool, cnt,
+				    sizeof(struct io_worker));
+
+    status = pj_atomic_create(mgr->io_worker_pool, 0, &mgr->io_worker_quit);
+    if (status != PJ_SUCCESS)
+	goto on_error;
+
+    for (i=0; i<cnt; ++i) {
+	struct io_worker *w = &mgr->io_worker[i];
+	char name[PJ_MAX_OBJ_NAME];
+
+	w->mgr = mgr;
+	mgr->io_worker_cnt = i + 1;
+
+	status = pj_atomic_create(mgr->io_worker_pool, 0, &w->conn_active);
+	if (status != PJ_SUCCESS)
+	    goto on_error;
+
+	status = pj_ioqueue_create(mgr->io_worker_pool, PJSIP_MAX_TRANSPORTS,
+				   &w->ioqueue);
+	if (status != PJ_SUCCESS)
+	    goto on_error;
+
+	status = pj_timer_heap_create(mgr->io_worker_pool,
+				      PJSIP_MAX_TRANSPORTS * 2,
+				      &w->timer_heap);
+	if (status != PJ_SUCCESS)
+	    goto on_error;
+
+	pj_ansi_snprintf(name, sizeof(name), "sipio%u", i);
+	status = pj_thread_create(mgr->io_worker_pool, name,
+				  &io_worker_thread, w,
+				  0, 0, &w->thread);
+	if (status != PJ_SUCCESS)
+	    goto on_error;
+    }
+
+    PJ_LOG(4,(THIS_FILE, "Started %u I/O workers for connections", cnt));
+    return PJ_SUCCESS;
+
+on_error:
+    PJ_PERROR(2,(THIS_FILE, status, "Error starting I/O workers"));
+    stop_io_workers(mgr);
+    return status;
+}
+
+/*
+ * Get the ioqueue and timer heap for a new connection.
+ */
+PJ_DEF(pj_status_t) pjsip_tpmgr_get_io_worker(pjsip_tpmgr *mgr,
+					      pj_grp_lock_t *grp_lock,
+					      pj_ioqueue_t **p_ioqueue,
+					      pj_timer_heap_t **p_timer_heap)
+{
+    struct io_worker *w;
+    pj_status_t status = PJ_SUCCESS;
+
+    PJ_ASSERT_RETURN(mgr && grp_lock && p_ioqueue && p_timer_heap,
+		     PJ_EINVAL);
+
+    pj_lock_acquire(mgr->lock);
+
+    if (!mgr->io_worker_started && pjsip_cfg()->tcp.io_worker_cnt) {
+	status = start_io_workers(mgr, pjsip_cfg()->tcp.io_worker_cnt);
+	if (status != PJ_SUCCESS) {
+	    pj_lock_release(mgr->lock);
+	    return status;
+	}
+	mgr->io_worker_started = PJ_TRUE;
+    }
+
+    if (mgr->io_worker_cnt == 0) {
+	pj_lock_release(mgr->lock);
+	*p_ioqueue = pjsip_endpt_get_ioqueue(mgr->endpt);
+	*p_timer_heap = pjsip_endpt_get_timer_heap(mgr->endpt);
+	return PJ_SUCCESS;
+    }
+
+    w = &mgr->io_worker[mgr->io_worker_next++ % mgr->io_worker_cnt];
+    ++w->conn_cnt;
+    pj_atomic_inc(w->conn_active);
+    *p_ioqueue = w->ioqueue;
+    *p_timer_heap = w->timer_heap;
+
+    pj_lock_release(mgr->lock);
+
+    /* The worker must outlive the connection's socket and callbacks */
+    pj_grp_lock_add_handler(grp_lock, NULL, w, &io_worker_on_conn_destroy);
+
+    return PJ_SUCCESS;
+}
+
 /*
  * pjsip_tpmgr_destroy()
  *
@@ -1848,6 +2550,33 @@ PJ_DEF(pj_status_t) pjsip_tpmgr_destroy( pjsip_tpmgr *mgr )
 	PJ_LOG(3,(THIS_FILE, "Cleaned up dangling transmit buffer(s)."));
     }
 
+    /*
+     * Stop the I/O workers, now that all the connections are closed and
+     * the dangling transmit buffers no longer hold them.
+     */
+    stop_io_workers(mgr);
+
+#if TPMGR_HAS_MSG_CACHE
+    /*
+     * Destroy the recycled tdata and rdata clones.
+     */
+    while (!pj_list_empty(&mgr->msg_cache_list)) {
+	struct msg_cache *mc = (struct msg_cache*) mgr->msg_cache_list.next;
+
+	while (mc->tdata_cnt) {
+	    pjsip_tx_data *tdata = mc->tdata[--mc->tdata_cnt];
+	    pj_atomic_destroy(tdata->ref_cnt);
+	    pj_lock_destroy(tdata->lock);
+	    pjsip_endpt_release_pool(mgr->endpt, tdata->pool);
+	}
+	while (mc->rdata_cnt) {
+	    pj_pool_release(mc->rdata[--mc->rdata_cnt]->tp_info.pool);
+	}
+	pj_list_erase(mc);
+    }
+    pj_thread_local_free(mgr->msg_cache_tls);
+#endif
+
 #if defined(PJ_DEBUG) && PJ_DEBUG!=0
     pj_atomic_destroy(mgr->tdata_counter);
 #endif
@@ -1867,6 +2596,258 @@ PJ_DEF(pj_status_t) pjsip_tpmgr_destroy( pjsip_tpmgr *mgr )
 }
 
 
+/* Initialize msg_info of rdata for the message in the buffer. Endpoint
+ * might inspect the values there when we call the callback to report
+ * some errors.
+ */
+static void init_rx_msg_info(pjsip_rx_data *rdata, char *msg_buf,
+			     pj_size_t len)
+{
+    pj_bzero(&rdata->msg_info, sizeof(rdata->msg_info));
+    pj_list_init(&rdata->msg_info.parse_err);
+    pj_list_init(&rdata->msg_info.raw_hdr);
+    rdata->msg_info.msg_buf = msg_buf;
+    rdata->msg_info.len = (int)len;
+}
+
+/* Parse a complete message and pass it to the endpoint. Returns the
+ * number of bytes of the buffer which were processed.
+ */
+static pj_size_t process_rx_msg(pjsip_tpmgr *mgr, pjsip_rx_data *rdata,
+				char *current_pkt, pj_size_t msg_fragment_size)
+{
+    pjsip_transport *tr = rdata->tp_info.transport;
+    pjsip_msg *msg;
+    char saved;
+
+    init_rx_msg_info(rdata, current_pkt, msg_fragment_size);
+
+    /* Null terminate packet */
+    saved = current_pkt[msg_fragment_size];
+    current_pkt[msg_fragment_size] = '\0';
+
+    /* Parse the message. */
+    rdata->msg_info.msg = msg = 
+	pjsip_parse_rdata2( current_pkt, msg_fragment_size, rdata,
+			    mgr->parse_options);
+
+    /* Restore null termination */
+    current_pkt[msg_fragment_size] = saved;
+
+    /* Check for parsing syntax error */
+    if (msg==NULL || !pj_list_empty(&rdata->msg_info.parse_err)) {
+	pjsip_parser_err_report *err;
+	char buf[256];
+	pj_str_t tmp;
+
+	/* Gather syntax error information */
+	tmp.ptr = buf; tmp.slen = 0;
+	err = rdata->msg_info.parse_err.next;
+	while (err != &rdata->msg_info.parse_err) {
+	    int len;
+	    len = pj_ansi_snprintf(tmp.ptr+tmp.slen, sizeof(buf)-tmp.slen,
+				   ": %s exception when parsing '%.*s' "
+				   "header on line %d col %d",
+				   pj_exception_id_name(err->except_code),
+				   (int)err->hname.slen, err->hname.ptr,
+				   err->line, err->col);
+	    if (len >= (int)sizeof(buf)-tmp.slen) {
+		len = (int)sizeof(buf)-tmp.slen;
+	    }
+	    if (len > 0) {
+		tmp.slen += len;
+	    }
+	    err = err->next;
+	}
+
+	/* Only print error message if there's error.
+	 * Sometimes we receive blank packets (packets with only CRLF)
+	 * which were sent to keep NAT bindings.
+	 */
+	if (tmp.slen) {
+	    PJ_LOG(1, (THIS_FILE, 
+		  "Error processing %d bytes packet from %s %s:%d %.*s:\n"
+		  "%.*s\n"
+		  "-- end of packet.",
+		  msg_fragment_size,
+		  rdata->tp_info.transport->type_name,
+		  rdata->pkt_info.src_name, 
+		  rdata->pkt_info.src_port,
+		  (int)tmp.slen, tmp.ptr,
+		  (int)msg_fragment_size,
+		  rdata->msg_info.msg_buf));
+	}
+
+	/* Notify application about the dropped data (syntax error) */
+	if (tmp.slen && mgr->tp_drop_data_cb) {
+	    pjsip_tp_dropped_data dd;
+	    pj_bzero(&dd, sizeof(dd));
+	    dd.tp = tr;
+	    dd.data = current_pkt;
+	    dd.len = msg_fragment_size;
+	    dd.status = PJSIP_EINVALIDMSG;
+	    (*mgr->tp_drop_data_cb)(&dd);
+
+	    if (dd.len > 0 && dd.len < msg_fragment_size)
+		msg_fragment_size = dd.len;
+	}
+
+	return msg_fragment_size;
+    }
+
+    /* Perform basic header checking. */
+    if (rdata->msg_info.cid == NULL ||
+	rdata->msg_info.cid->id.slen == 0 || 
+	rdata->msg_info.from == NULL || 
+	rdata->msg_info.to == NULL || 
+	rdata->msg_info.via == NULL || 
+	rdata->msg_info.cseq == NULL) 
+    {
+	mgr->on_rx_msg(mgr->endpt, PJSIP_EMISSINGHDR, rdata);
+
+	/* Notify application about the missing header. */
+	if (mgr->tp_drop_data_cb) {
+	    pjsip_tp_dropped_data dd;
+	    pj_bzero(&dd, sizeof(dd));
+	    dd.tp = tr;
+	    dd.data = current_pkt;
+	    dd.len = msg_fragment_size;
+	    dd.status = PJSIP_EMISSINGHDR;
+	    (*mgr->tp_drop_data_cb)(&dd);	    
+	}
+	return msg_fragment_size;
+    }
+
+    /* For request: */
+    if (rdata->msg_info.msg->type == PJSIP_REQUEST_MSG) {
+	/* always add received parameter to the via. */
+	pj_strdup2(rdata->tp_info.pool, 
+		   &rdata->msg_info.via->recvd_param, 
+		   rdata->pkt_info.src_name);
+
+	/* RFC 3581:
+	 * If message contains "rport" param, put the received port there.
+	 */
+	if (rdata->msg_info.via->rport_param == 0) {
+	    rdata->msg_info.via->rport_param = rdata->pkt_info.src_port;
+	}
+    } else {
+	/* Drop malformed responses */
+	if (rdata->msg_info.msg->line.status.code < 100 ||
+	    rdata->msg_info.msg->line.status.code >= 700)
+	{
+	    mgr->on_rx_msg(mgr->endpt, PJSIP_EINVALIDSTATUS, rdata);
+
+	    /* Notify application about the invalid status. */
+	    if (mgr->tp_drop_data_cb) {
+		pjsip_tp_dropped_data dd;
+		pj_bzero(&dd, sizeof(dd));
+		dd.tp = tr;
+		dd.data = current_pkt;
+		dd.len = msg_fragment_size;
+		dd.status = PJSIP_EINVALIDSTATUS;
+		(*mgr->tp_drop_data_cb)(&dd);	    
+	    }
+	    return msg_fragment_size;
+	}
+    }
+
+    /* Drop response message if it has more than one Via.
+    */
+    /* This is wrong. Proxy DOES receive responses with multiple
+     * Via headers! Thanks Aldo <acampi at deis.unibo.it> for pointing
+     * this out.
+
+    if (msg->type == PJSIP_RESPONSE_MSG) {
+	pjsip_hdr *hdr;
+	hdr = (pjsip_hdr*)rdata->msg_info.via->next;
+	if (hdr != &msg->hdr) {
+	    hdr = pjsip_msg_find_hdr(msg, PJSIP_H_VIA, hdr);
+	    if (hdr) {
+		mgr->on_rx_msg(mgr->endpt, PJSIP_EMULTIPLEVIA, rdata);
+		return msg_fragment_size;
+	    }
+	}
+    }
+    */
+
+    /* Call the transport manager's upstream message callback.
+     */
+    mgr->on_rx_msg(mgr->endpt, PJ_SUCCESS, rdata);
+
+    /* The packet buffer will be reused for the next message */
+    pjsip_rx_data_release_buf(rdata);
+
+    return msg_fragment_size;
+}
+
+/* Find the size of the message at the start of the buffer of a stream
+ * oriented transport. The end of the headers is only searched in the
+ * data which has not been scanned by the previous calls, and once the
+ * message size is known it is simply compared with the data received.
+ */
+static pj_status_t frame_stream_msg(pjsip_rx_framer *fr, const char *buf,
+				    pj_size_t size, pj_size_t *msg_size)
+{
+    if (fr->msg_size == 0) {
+	const pj_str_t end_hdr = { "\n\r\n", 3};
+	pj_size_t start = (fr->scanned > 2) ? fr->scanned - 2 : 0;
+	pj_str_t cur_msg;
+	pj_status_t status;
+
+	*msg_size = size;
+
+	cur_msg.ptr = (char*)buf + start;
+	cur_msg.slen = size - start;
+	if (pj_strstr(&cur_msg, &end_hdr) == NULL) {
+	    fr->scanned = size;
+	    return PJSIP_EPARTIALMSG;
+	}
+
+	/* Headers are complete, get the message size from Content-Length */
+	status = pjsip_find_msg(buf, size, PJ_FALSE, msg_size);
+	if (status != PJ_SUCCESS && status != PJSIP_EPARTIALMSG)
+	    return status;
+
+	fr->msg_size = *msg_size;
+    }
+
+    *msg_size = fr->msg_size;
+    return (fr->msg_size <= size) ? PJ_SUCCESS : PJSIP_EPARTIALMSG;
+}
+
+/* Start receiving a message which is bigger than the receive buffer into
+ * a buffer of its own.
+ */
+static pj_status_t start_oversized_msg(pjsip_transport *tr,
+				       pjsip_rx_framer *fr,
+				       const char *data, pj_size_t len)
+{
+    fr->pool = pjsip_endpt_create_pool(tr->endpt, "rxmsg%p",
+				       PJSIP_MAX_PKT_LEN, PJSIP_MAX_PKT_LEN);
+    if (!fr->pool)
+	return PJ_ENOMEM;
+
+    fr->buf = (char*) pj_pool_alloc(fr->pool, fr->msg_size + 1);
+    pj_memcpy(fr->buf, data, len);
+    fr->len = len;
+
+    PJ_LOG(5,(tr->obj_name, "Receiving %lu bytes message",
+	      (unsigned long)fr->msg_size));
+
+    return PJ_SUCCESS;
+}
+
+/*
+ * Reset framing state.
+ */
+PJ_DEF(void) pjsip_rx_framer_reset(pjsip_rx_framer *fr)
+{
+    if (fr->pool)
+	pj_pool_release(fr->pool);
+    pj_bzero(fr, sizeof(*fr));
+}
+
 /*
  * pjsip_tpmgr_receive_packet()
  *
@@ -1876,6 +2857,7 @@ PJ_DEF(pj_ssize_t) pjsip_tpmgr_receive_packet( pjsip_tpmgr *mgr,
 					       pjsip_rx_data *rdata)
 {
     pjsip_transport *tr = rdata->tp_info.transport;
+    pjsip_rx_framer *fr = &rdata->tp_info.framer;
 
     char *current_pkt;
     pj_size_t remaining_len;
@@ -1897,12 +2879,34 @@ PJ_DEF(pj_ssize_t) pjsip_tpmgr_receive_packet( pjsip_tpmgr *mgr,
      */
     current_pkt[remaining_len] = '\0';
 
+    /* Append to the oversized message being received, if any. */
+    if (fr->buf) {
+	pj_size_t len = fr->msg_size - fr->len;
+
+	if (len > remaining_len)
+	    len = remaining_len;
+
+	pj_memcpy(fr->buf + fr->len, current_pkt, len);
+	fr->len += len;
+	current_pkt += len;
+	remaining_len -= len;
+	total_processed += len;
+
+	if (fr->len < fr->msg_size)
+	    return total_processed;
+
+	fr->buf[fr->len] = '\0';
+	process_rx_msg(mgr, rdata, fr->buf, fr->msg_size);
+	pjsip_rx_framer_reset(fr);
+
+	if (remaining_len == 0)
+	    return total_processed;
+    }
+
     /* Process all message fragments. */
     while (remaining_len > 0) {
 
-	pjsip_msg *msg;
 	char *p, *end;
-	char saved;
 	pj_size_t msg_fragment_size;
 
 	/* Skip leading newlines as pjsip_find_msg() currently can't
@@ -1936,22 +2940,27 @@ PJ_DEF(pj_ssize_t) pjsip_tpmgr_receive_packet( pjsip_tpmgr *mgr,
 	/* Initialize default fragment size. */
 	msg_fragment_size = remaining_len;
 
-	/* Clear and init msg_info in rdata. 
-	 * Endpoint might inspect the values there when we call the callback
-	 * to report some errors.
-	 */
-	pj_bzero(&rdata->msg_info, sizeof(rdata->msg_info));
-	pj_list_init(&rdata->msg_info.parse_err);
-	rdata->msg_info.msg_buf = current_pkt;
-	rdata->msg_info.len = (int)remaining_len;
-
 	/* For TCP transport, check if the whole message has been received. */
 	if ((tr->flag & PJSIP_TRANSPORT_DATAGRAM) == 0) {
 	    pj_status_t msg_status;
-	    msg_status = pjsip_find_msg(current_pkt, remaining_len, PJ_FALSE, 
-                                        &msg_fragment_size);
+	    msg_status = frame_stream_msg(fr, current_pkt, remaining_len,
+					  &msg_fragment_size);
+
+	    /* A message too big for the receive buffer is received into
+	     * a buffer of its own, if its headers fit.
+	     */
+	    if (msg_status == PJSIP_EPARTIALMSG &&
+		fr->msg_size > PJSIP_MAX_PKT_LEN &&
+		fr->msg_size <= PJSIP_MAX_STREAM_MSG_LEN &&
+		start_oversized_msg(tr, fr, current_pkt,
+				    remaining_len) == PJ_SUCCESS)
+	    {
+		return total_processed + remaining_len;
+	    }
+
 	    if (msg_status != PJ_SUCCESS) {
 		if (remaining_len == PJSIP_MAX_PKT_LEN) {
+		    init_rx_msg_info(rdata, current_pkt, remaining_len);
 		    mgr->on_rx_msg(mgr->endpt, PJSIP_ERXOVERFLOW, rdata);
 		    
 		    /* Notify application about the message overflow */
@@ -1966,171 +2975,22 @@ PJ_DEF(pj_ssize_t) pjsip_tpmgr_receive_packet( pjsip_tpmgr *mgr,
 	    	    }
 		    
 		    /* Exhaust all data. */
+		    pjsip_rx_framer_reset(fr);
 		    return rdata->pkt_info.len;
 		} else {
 		    /* Not enough data in packet. */
 		    return total_processed;
 		}
 	    }
-	}
-
-	/* Update msg_info. */
-	rdata->msg_info.len = (int)msg_fragment_size;
-
-	/* Null terminate packet */
-	saved = current_pkt[msg_fragment_size];
-	current_pkt[msg_fragment_size] = '\0';
-
-	/* Parse the message. */
-	rdata->msg_info.msg = msg = 
-	    pjsip_parse_rdata( current_pkt, msg_fragment_size, rdata);
-
-	/* Restore null termination */
-	current_pkt[msg_fragment_size] = saved;
-
-	/* Check for parsing syntax error */
-	if (msg==NULL || !pj_list_empty(&rdata->msg_info.parse_err)) {
-	    pjsip_parser_err_report *err;
-	    char buf[256];
-	    pj_str_t tmp;
-
-	    /* Gather syntax error information */
-	    tmp.ptr = buf; tmp.slen = 0;
-	    err = rdata->msg_info.parse_err.next;
-	    while (err != &rdata->msg_info.parse_err) {
-		int len;
-		len = pj_ansi_snprintf(tmp.ptr+tmp.slen, sizeof(buf)-tmp.slen,
-				       ": %s exception when parsing '%.*s' "
-				       "header on line %d col %d",
-				       pj_exception_id_name(err->except_code),
-				       (int)err->hname.slen, err->hname.ptr,
-				       err->line, err->col);
-		if (len >= (int)sizeof(buf)-tmp.slen) {
-		    len = (int)sizeof(buf)-tmp.slen;
-		}
-		if (len > 0) {
-		    tmp.slen += len;
-		}
-		err = err->next;
-	    }
-
-	    /* Only print error message if there's error.
-	     * Sometimes we receive blank packets (packets with only CRLF)
-	     * which were sent to keep NAT bindings.
-	     */
-	    if (tmp.slen) {
-		PJ_LOG(1, (THIS_FILE, 
-		      "Error processing %d bytes packet from %s %s:%d %.*s:\n"
-		      "%.*s\n"
-		      "-- end of packet.",
-		      msg_fragment_size,
-		      rdata->tp_info.transport->type_name,
-		      rdata->pkt_info.src_name, 
-		      rdata->pkt_info.src_port,
-		      (int)tmp.slen, tmp.ptr,
-		      (int)msg_fragment_size,
-		      rdata->msg_info.msg_buf));
-	    }
-
-	    /* Notify application about the dropped data (syntax error) */
-	    if (tmp.slen && mgr->tp_drop_data_cb) {
-		pjsip_tp_dropped_data dd;
-		pj_bzero(&dd, sizeof(dd));
-		dd.tp = tr;
-		dd.data = current_pkt;
-		dd.len = msg_fragment_size;
-		dd.status = PJSIP_EINVALIDMSG;
-		(*mgr->tp_drop_data_cb)(&dd);
-		
-		if (dd.len > 0 && dd.len < msg_fragment_size)
-		    msg_fragment_size = dd.len;
-	    }
-
-	    goto finish_process_fragment;
-	}
-
-	/* Perform basic header checking. */
-	if (rdata->msg_info.cid == NULL ||
-	    rdata->msg_info.cid->id.slen == 0 || 
-	    rdata->msg_info.from == NULL || 
-	    rdata->msg_info.to == NULL || 
-	    rdata->msg_info.via == NULL || 
-	    rdata->msg_info.cseq == NULL) 
-	{
-	    mgr->on_rx_msg(mgr->endpt, PJSIP_EMISSINGHDR, rdata);
-
-	    /* Notify application about the missing header. */
-	    if (mgr->tp_drop_data_cb) {
-		pjsip_tp_dropped_data dd;
-		pj_bzero(&dd, sizeof(dd));
-		dd.tp = tr;
-		dd.data = current_pkt;
-		dd.len = msg_fragment_size;
-		dd.status = PJSIP_EMISSINGHDR;
-		(*mgr->tp_drop_data_cb)(&dd);	    
-	    }
-	    goto finish_process_fragment;
-	}
-
-	/* For request: */
-	if (rdata->msg_info.msg->type == PJSIP_REQUEST_MSG) {
-	    /* always add received parameter to the via. */
-	    pj_strdup2(rdata->tp_info.pool, 
-		       &rdata->msg_info.via->recvd_param, 
-		       rdata->pkt_info.src_name);
-
-	    /* RFC 3581:
-	     * If message contains "rport" param, put the received port there.
-	     */
-	    if (rdata->msg_info.via->rport_param == 0) {
-		rdata->msg_info.via->rport_param = rdata->pkt_info.src_port;
-	    }
-	} else {
-	    /* Drop malformed responses */
-	    if (rdata->msg_info.msg->line.status.code < 100 ||
-		rdata->msg_info.msg->line.status.code >= 700)
-	    {
-		mgr->on_rx_msg(mgr->endpt, PJSIP_EINVALIDSTATUS, rdata);
-
-		/* Notify application about the invalid status. */
-		if (mgr->tp_drop_data_cb) {
-		    pjsip_tp_dropped_data dd;
-		    pj_bzero(&dd, sizeof(dd));
-		    dd.tp = tr;
-		    dd.data = current_pkt;
-		    dd.len = msg_fragment_size;
-		    dd.status = PJSIP_EINVALIDSTATUS;
-		    (*mgr->tp_drop_data_cb)(&dd);	    
-		}
-		goto finish_process_fragment;
-	    }
-	}
 
-	/* Drop response message if it has more than one Via.
-	*/
-	/* This is wrong. Proxy DOES receive responses with multiple
-	 * Via headers! Thanks Aldo <acampi at deis.unibo.it> for pointing
-	 * this out.
-
-	if (msg->type == PJSIP_RESPONSE_MSG) {
-	    pjsip_hdr *hdr;
-	    hdr = (pjsip_hdr*)rdata->msg_info.via->next;
-	    if (hdr != &msg->hdr) {
-		hdr = pjsip_msg_find_hdr(msg, PJSIP_H_VIA, hdr);
-		if (hdr) {
-		    mgr->on_rx_msg(mgr->endpt, PJSIP_EMULTIPLEVIA, rdata);
-		    goto finish_process_fragment;
-		}
-	    }
+	    /* The next message is framed from scratch */
+	    pjsip_rx_framer_reset(fr);
 	}
-	*/
-
-	/* Call the transport manager's upstream message callback.
-	 */
-	mgr->on_rx_msg(mgr->endpt, PJ_SUCCESS, rdata);
 
+	/* Parse the message and pass it to endpoint. */
+	msg_fragment_size = process_rx_msg(mgr, rdata, current_pkt,
+					   msg_fragment_size);
 
-finish_process_fragment:
 	total_processed += msg_fragment_size;
 	current_pkt += msg_fragment_size;
 	remaining_len -= msg_fragment_size;
@@ -2421,6 +3281,33 @@ PJ_DEF(void) pjsip_tpmgr_dump_transports(pjsip_tpmgr *mgr)
 	      pj_atomic_get(mgr->tdata_counter)));
 #endif
 
+#if TPMGR_HAS_MSG_CACHE
+    {
+	pjsip_tpmgr_cache_stat st;
+	pj_size_t tdata_total, rdata_total;
+
+	pjsip_tpmgr_get_cache_stat(mgr, &st);
+	tdata_total = st.tdata_reused + st.tdata_created;
+	rdata_total = st.rdata_reused + st.rdata_created;
+	PJ_LOG(3,(THIS_FILE, " Recycled transmit buffers: %u of %u (%u%%), "
+		  "rdata clones: %u of %u (%u%%)",
+		  (unsigned)st.tdata_reused, (unsigned)tdata_total,
+		  (unsigned)(tdata_total ? st.tdata_reused*100/tdata_total : 0),
+		  (unsigned)st.rdata_reused, (unsigned)rdata_total,
+		  (unsigned)(rdata_total ? st.rdata_reused*100/rdata_total : 0)));
+    }
+#endif
+
+    if (mgr->io_worker_cnt) {
+	unsigned i;
+
+	PJ_LOG(3, (THIS_FILE, " Connections assigned to I/O workers:"));
+	for (i=0; i<mgr->io_worker_cnt; ++i) {
+	    PJ_LOG(3, (THIS_FILE, "  worker %u: %u", i,
+		       mgr->io_worker[i].conn_cnt));
+	}
+    }
+
     PJ_LOG(3, (THIS_FILE, " Dumping listeners:"));
     factory = mgr->factory_list.next;
     while (factory != &mgr->factory_list) {
@@ -2647,3 +3534,16 @@ PJ_DEF(pj_status_t) pjsip_tpmgr_set_drop_data_cb(pjsip_tpmgr *mgr,
 
     return PJ_SUCCESS;
 }
+
+/*
+ * Set options for parsing incoming messages.
+ */
+PJ_DEF(pj_status_t) pjsip_tpmgr_set_parse_options(pjsip_tpmgr *mgr,
+						  unsigned options)
+{
+    PJ_ASSERT_RETURN(mgr, PJ_EINVAL);
+
+    mgr->parse_options = options;
+
+    return PJ_SUCCESS;
+}
@@ -75,7 +75,8 @@ struct tcp_listener
  * A delayed transmission occurs when application sends tx_data when
  * the TCP connect/establishment is still in progress. These delayed
  * transmission will be "flushed" once the socket is connected (either
- * successfully or with errors).
+ * successfully or with errors). It is also used to queue the tx_data
+ * sent while a previous write on the socket is still in progress.
  */
 struct delayed_tdata
 {
@@ -107,6 +108,9 @@ struct tcp_transport
     pj_activesock_t	    *asock;
     pj_bool_t		     has_pending_connect;
 
+    /* Timer heap of the I/O worker serving this connection. */
+    pj_timer_heap_t	    *timer_heap;
+
     /* Keep-alive timer. */
     pj_timer_entry	     ka_timer;
     pj_time_val		     last_activity;
@@ -122,6 +126,16 @@ struct tcp_transport
     /* Pending transmission list. */
     struct delayed_tdata     delayed_list;
 
+    /* Number of writes in progress, the messages queued meanwhile, and
+     * the messages sent in the coalesced write in progress.
+     */
+    unsigned		     tx_pending;
+    struct delayed_tdata     tx_queue;
+    struct delayed_tdata     tx_batch;
+    pjsip_tx_data_op_key     tx_op_key;
+    char		    *tx_buf;
+    pjsip_transport_tx_stat  tx_stat;
+
     /* Group lock to be used by TCP transport and ioqueue key */
     pj_grp_lock_t	    *grp_lock;
 
@@ -639,6 +653,8 @@ static pj_status_t tcp_create( struct tcp_listener *listener,
     tcp->sock = sock;
     /*tcp->listener = listener;*/
     pj_list_init(&tcp->delayed_list);
+    pj_list_init(&tcp->tx_queue);
+    pj_list_init(&tcp->tx_batch);
     tcp->base.pool = pool;
 
     pj_ansi_snprintf(tcp->base.obj_name, PJ_MAX_OBJ_NAME, 
@@ -700,7 +716,15 @@ static pj_status_t tcp_create( struct tcp_listener *listener,
     tcp_callback.on_data_sent = &on_data_sent;
     tcp_callback.on_connect_complete = &on_connect_complete;
 
-    ioqueue = pjsip_endpt_get_ioqueue(listener->endpt);
+    /* All the socket events and timers of this connection are handled
+     * by the same I/O worker.
+     */
+    status = pjsip_tpmgr_get_io_worker(listener->tpmgr, tcp->grp_lock,
+				       &ioqueue, &tcp->timer_heap);
+    if (status != PJ_SUCCESS) {
+	goto on_error;
+    }
+
     status = pj_activesock_create(pool, sock, pj_SOCK_STREAM(), &asock_cfg,
 				  ioqueue, &tcp_callback, tcp, &tcp->asock);
     if (status != PJ_SUCCESS) {
@@ -729,9 +753,9 @@ static pj_status_t tcp_create( struct tcp_listener *listener,
 	tcp->initial_timer.cb = &tcp_initial_timer;
 	
 	delay.sec = listener->initial_timeout;
-	pjsip_endpt_schedule_timer(listener->endpt, 
-				    &tcp->initial_timer, 
-				    &delay);
+	pj_timer_heap_schedule(tcp->timer_heap, 
+				&tcp->initial_timer, 
+				&delay);
 	tcp->initial_timer.id = PJ_TRUE;
     }
 
@@ -753,6 +777,211 @@ on_error:
 }
 
 
+/* Notify sip_transport.c that the message has been sent. */
+static void tcp_notify_sent(struct tcp_transport *tcp,
+			    pjsip_tx_data_op_key *tdata_op_key,
+			    pj_ssize_t bytes_sent)
+{
+    tdata_op_key->tdata = NULL;
+
+    if (tdata_op_key->callback) {
+	if (bytes_sent == 0)
+	    bytes_sent = -PJ_RETURN_OS_ERROR(OSERR_ENOTCONN);
+
+	tdata_op_key->callback(&tcp->base, tdata_op_key->token, bytes_sent);
+
+	/* Mark last activity time */
+	pj_gettimeofday(&tcp->last_activity);
+    }
+}
+
+
+/* Notify the messages carried by the completed write. */
+static void tcp_notify_tx(struct tcp_transport *tcp,
+			  pj_ioqueue_op_key_t *op_key,
+			  pj_ssize_t bytes_sent)
+{
+    struct delayed_tdata batch;
+
+    if (op_key != &tcp->tx_op_key.key) {
+	tcp_notify_sent(tcp, (pjsip_tx_data_op_key*)op_key, bytes_sent);
+	return;
+    }
+
+    pj_list_init(&batch);
+    pj_lock_acquire(tcp->base.lock);
+    pj_list_merge_last(&batch, &tcp->tx_batch);
+    pj_lock_release(tcp->base.lock);
+
+    while (!pj_list_empty(&batch)) {
+	struct delayed_tdata *tx = batch.next;
+	pjsip_tx_data *tdata = tx->tdata_op_key->tdata;
+
+	pj_list_erase(tx);
+	tcp_notify_sent(tcp, tx->tdata_op_key, (bytes_sent <= 0) ? bytes_sent :
+			(tdata->buf.cur - tdata->buf.start));
+    }
+}
+
+
+/* Put the message in the transmit queue. Transport lock must be held. */
+static void tcp_queue_tx(struct tcp_transport *tcp, struct delayed_tdata *tx)
+{
+    pjsip_tx_data *tdata = tx->tdata_op_key->tdata;
+
+    pj_list_push_back(&tcp->tx_queue, tx);
+    tcp->tx_stat.queued_bytes += (tdata->buf.cur - tdata->buf.start);
+    ++tcp->tx_stat.total_queued_msgs;
+    if (++tcp->tx_stat.queued_msgs > tcp->tx_stat.max_queued_msgs)
+	tcp->tx_stat.max_queued_msgs = tcp->tx_stat.queued_msgs;
+}
+
+
+/* Remove the first message from the transmit queue. Transport lock must
+ * be held.
+ */
+static struct delayed_tdata *tcp_dequeue_tx(struct tcp_transport *tcp)
+{
+    struct delayed_tdata *tx = tcp->tx_queue.next;
+    pjsip_tx_data *tdata = tx->tdata_op_key->tdata;
+
+    pj_list_erase(tx);
+    tcp->tx_stat.queued_bytes -= (tdata->buf.cur - tdata->buf.start);
+    --tcp->tx_stat.queued_msgs;
+    return tx;
+}
+
+
+/* Cancel the queued messages, and the messages in the coalesced write
+ * which hasn't completed.
+ */
+static void tcp_cancel_tx_queue(struct tcp_transport *tcp, 
+				pj_status_t reason)
+{
+    struct delayed_tdata cancelled;
+
+    pj_list_init(&cancelled);
+    pj_lock_acquire(tcp->base.lock);
+    pj_list_merge_last(&cancelled, &tcp->tx_batch);
+    pj_list_merge_last(&cancelled, &tcp->tx_queue);
+    tcp->tx_stat.queued_msgs = 0;
+    tcp->tx_stat.queued_bytes = 0;
+    pj_lock_release(tcp->base.lock);
+
+    while (!pj_list_empty(&cancelled)) {
+	struct delayed_tdata *tx = cancelled.next;
+
+	pj_list_erase(tx);
+	tcp_notify_sent(tcp, tx->tdata_op_key, -reason);
+    }
+}
+
+
+/* Shutdown the transport after send() error or closure. */
+static void tcp_on_tx_error(struct tcp_transport *tcp, pj_ssize_t bytes_sent)
+{
+    pj_status_t status;
+
+    PJ_LOG(5,(tcp->base.obj_name, "TCP send() error, sent=%d", 
+	      bytes_sent));
+
+    status = (bytes_sent == 0) ? PJ_RETURN_OS_ERROR(OSERR_ENOTCONN) :
+				 (pj_status_t)-bytes_sent;
+
+    tcp_init_shutdown(tcp, status);
+    tcp_cancel_tx_queue(tcp, status);
+}
+
+
+/*
+ * Send the queued messages, once there is no write in progress. The
+ * messages are copied to the transport's buffer to be sent in a single
+ * write, as long as they fit.
+ */
+static void tcp_flush_tx_queue(struct tcp_transport *tcp)
+{
+    pj_lock_acquire(tcp->base.lock);
+    while (tcp->tx_pending == 0 && !pj_list_empty(&tcp->tx_queue) &&
+	   !tcp->is_closing)
+    {
+	struct delayed_tdata *tx = tcp->tx_queue.next;
+	pjsip_tx_data *tdata = tx->tdata_op_key->tdata;
+	pjsip_tx_data *next_tdata = NULL;
+	pj_ioqueue_op_key_t *op_key;
+	pj_ssize_t size;
+	char *buf;
+	pj_status_t status;
+
+	size = tdata->buf.cur - tdata->buf.start;
+	if (tx->next != &tcp->tx_queue)
+	    next_tdata = tx->next->tdata_op_key->tdata;
+
+	if (next_tdata && size + (next_tdata->buf.cur -
+				  next_tdata->buf.start) <=
+			  PJSIP_TCP_TX_COALESCE_SIZE)
+	{
+	    /* Coalesce the messages which fit in the buffer */
+	    if (!tcp->tx_buf) {
+		tcp->tx_buf = (char*) pj_pool_alloc(tcp->base.pool,
+						    PJSIP_TCP_TX_COALESCE_SIZE);
+	    }
+
+	    size = 0;
+	    do {
+		pj_size_t len;
+
+		tx = tcp_dequeue_tx(tcp);
+		tdata = tx->tdata_op_key->tdata;
+		len = tdata->buf.cur - tdata->buf.start;
+
+		pj_memcpy(tcp->tx_buf + size, tdata->buf.start, len);
+		size += len;
+		pj_list_push_back(&tcp->tx_batch, tx);
+		++tcp->tx_stat.coalesced_msgs;
+
+		if (pj_list_empty(&tcp->tx_queue))
+		    break;
+		tdata = tcp->tx_queue.next->tdata_op_key->tdata;
+	    } while (size + (tdata->buf.cur - tdata->buf.start) <=
+		     PJSIP_TCP_TX_COALESCE_SIZE);
+
+	    ++tcp->tx_stat.coalesced_writes;
+	    op_key = &tcp->tx_op_key.key;
+	    buf = tcp->tx_buf;
+
+	} else {
+	    /* Send the message on its own */
+	    tx = tcp_dequeue_tx(tcp);
+	    op_key = (pj_ioqueue_op_key_t*)tx->tdata_op_key;
+	    buf = tdata->buf.start;
+	}
+
+	++tcp->tx_pending;
+	pj_lock_release(tcp->base.lock);
+
+	/* send! */
+	status = pj_activesock_send(tcp->asock, op_key, buf, &size, 0);
+	if (status == PJ_EPENDING)
+	    return;
+
+	/* Completed immediately */
+	if (status != PJ_SUCCESS)
+	    size = -status;
+	tcp_notify_tx(tcp, op_key, size);
+
+	pj_lock_acquire(tcp->base.lock);
+	--tcp->tx_pending;
+
+	if (size <= 0) {
+	    pj_lock_release(tcp->base.lock);
+	    tcp_on_tx_error(tcp, size);
+	    return;
+	}
+    }
+    pj_lock_release(tcp->base.lock);
+}
+
+
 /* Flush all delayed transmision once the socket is connected. */
 static void tcp_flush_pending_tx(struct tcp_transport *tcp)
 {
@@ -762,35 +991,22 @@ static void tcp_flush_pending_tx(struct tcp_transport *tcp)
     pj_lock_acquire(tcp->base.lock);
     while (!pj_list_empty(&tcp->delayed_list)) {
 	struct delayed_tdata *pending_tx;
-	pjsip_tx_data *tdata;
-	pj_ioqueue_op_key_t *op_key;
-	pj_ssize_t size;
-	pj_status_t status;
 
 	pending_tx = tcp->delayed_list.next;
 	pj_list_erase(pending_tx);
 
-	tdata = pending_tx->tdata_op_key->tdata;
-	op_key = (pj_ioqueue_op_key_t*)pending_tx->tdata_op_key;
-
         if (pending_tx->timeout.sec > 0 &&
             PJ_TIME_VAL_GT(now, pending_tx->timeout))
         {
             continue;
         }
 
-	/* send! */
-	size = tdata->buf.cur - tdata->buf.start;
-	status = pj_activesock_send(tcp->asock, op_key, tdata->buf.start, 
-				    &size, 0);
-	if (status != PJ_EPENDING) {
-            pj_lock_release(tcp->base.lock);
-	    on_data_sent(tcp->asock, op_key, size);
-            pj_lock_acquire(tcp->base.lock);
-	}
-
+	/* Queue it, so the delayed messages are sent together */
+	tcp_queue_tx(tcp, pending_tx);
     }
     pj_lock_release(tcp->base.lock);
+
+    tcp_flush_tx_queue(tcp);
 }
 
 
@@ -832,28 +1048,26 @@ static pj_status_t tcp_destroy(pjsip_transport *transport,
 
     /* Stop keep-alive timer. */
     if (tcp->ka_timer.id) {
-	pjsip_endpt_cancel_timer(tcp->base.endpt, &tcp->ka_timer);
+	pj_timer_heap_cancel(tcp->timer_heap, &tcp->ka_timer);
 	tcp->ka_timer.id = PJ_FALSE;
     }
 
     /* Stop initial timer. */
     if (tcp->initial_timer.id) {
-	pjsip_endpt_cancel_timer(tcp->base.endpt, &tcp->initial_timer);
+	pj_timer_heap_cancel(tcp->timer_heap, &tcp->initial_timer);
 	tcp->initial_timer.id = PJ_FALSE;
     }
 
     /* Cancel all delayed transmits */
     while (!pj_list_empty(&tcp->delayed_list)) {
 	struct delayed_tdata *pending_tx;
-	pj_ioqueue_op_key_t *op_key;
 
 	pending_tx = tcp->delayed_list.next;
 	pj_list_erase(pending_tx);
 
-	op_key = (pj_ioqueue_op_key_t*)pending_tx->tdata_op_key;
-
-	on_data_sent(tcp->asock, op_key, -reason);
+	tcp_notify_sent(tcp, pending_tx->tdata_op_key, -reason);
     }
+    tcp_cancel_tx_queue(tcp, reason);
 
     if (tcp->asock) {
 	pj_activesock_close(tcp->asock);
@@ -889,6 +1103,8 @@ static void tcp_on_destroy(void *arg)
 	tcp->base.ref_cnt = NULL;
     }
 
+    pjsip_rx_framer_reset(&tcp->rdata.tp_info.framer);
+
     if (tcp->rdata.tp_info.pool) {
 	pj_pool_release(tcp->rdata.tp_info.pool);
 	tcp->rdata.tp_info.pool = NULL;
@@ -1178,9 +1394,9 @@ static pj_bool_t on_accept_complete(pj_activesock_t *asock,
 	    if (pjsip_cfg()->tcp.keep_alive_interval) {
 		pj_time_val delay = { 0 };
 		delay.sec = pjsip_cfg()->tcp.keep_alive_interval;
-		pjsip_endpt_schedule_timer(listener->endpt, 
-					   &tcp->ka_timer, 
-					   &delay);
+		pj_timer_heap_schedule(tcp->timer_heap, 
+				       &tcp->ka_timer, 
+				       &delay);
 		tcp->ka_timer.id = PJ_TRUE;
 		pj_gettimeofday(&tcp->last_activity);
 	    }
@@ -1208,40 +1424,25 @@ static pj_bool_t on_data_sent(pj_activesock_t *asock,
 {
     struct tcp_transport *tcp = (struct tcp_transport*) 
     				pj_activesock_get_user_data(asock);
-    pjsip_tx_data_op_key *tdata_op_key = (pjsip_tx_data_op_key*)op_key;
 
     /* Note that op_key may be the op_key from keep-alive, thus
      * it will not have tdata etc.
      */
+    tcp_notify_tx(tcp, op_key, bytes_sent);
 
-    tdata_op_key->tdata = NULL;
-
-    if (tdata_op_key->callback) {
-	/*
-	 * Notify sip_transport.c that packet has been sent.
-	 */
-	if (bytes_sent == 0)
-	    bytes_sent = -PJ_RETURN_OS_ERROR(OSERR_ENOTCONN);
-
-	tdata_op_key->callback(&tcp->base, tdata_op_key->token, bytes_sent);
-
-	/* Mark last activity time */
-	pj_gettimeofday(&tcp->last_activity);
+    /* Send the messages queued while the write was in progress */
+    if (op_key != &tcp->ka_op_key.key) {
+	pj_lock_acquire(tcp->base.lock);
+	--tcp->tx_pending;
+	pj_lock_release(tcp->base.lock);
 
+	if (bytes_sent > 0)
+	    tcp_flush_tx_queue(tcp);
     }
 
     /* Check for error/closure */
     if (bytes_sent <= 0) {
-	pj_status_t status;
-
-	PJ_LOG(5,(tcp->base.obj_name, "TCP send() error, sent=%d", 
-		  bytes_sent));
-
-	status = (bytes_sent == 0) ? PJ_RETURN_OS_ERROR(OSERR_ENOTCONN) :
-				     (pj_status_t)-bytes_sent;
-
-	tcp_init_shutdown(tcp, status);
-
+	tcp_on_tx_error(tcp, bytes_sent);
 	return PJ_FALSE;
     }
 
@@ -1322,6 +1523,28 @@ static pj_status_t tcp_send_msg(pjsip_transport *transport,
 	pj_lock_release(tcp->base.lock);
     } 
     
+    if (!delayed) {
+	/*
+	 * If a write is still in progress, queue the message to be sent
+	 * together with the other queued messages when the write completes.
+	 */
+	pj_lock_acquire(tcp->base.lock);
+
+	if (tcp->tx_pending || !pj_list_empty(&tcp->tx_queue)) {
+	    struct delayed_tdata *queued_tdata;
+
+	    queued_tdata = PJ_POOL_ZALLOC_T(tdata->pool, struct delayed_tdata);
+	    queued_tdata->tdata_op_key = &tdata->op_key;
+	    tcp_queue_tx(tcp, queued_tdata);
+	    status = PJ_EPENDING;
+	    delayed = PJ_TRUE;
+	} else {
+	    ++tcp->tx_pending;
+	}
+
+	pj_lock_release(tcp->base.lock);
+    }
+
     if (!delayed) {
 	/*
 	 * Transport is ready to go. Send the packet to ioqueue to be
@@ -1336,6 +1559,10 @@ static pj_status_t tcp_send_msg(pjsip_transport *transport,
 	    /* Not pending (could be immediate success or error) */
 	    tdata->op_key.tdata = NULL;
 
+	    pj_lock_acquire(tcp->base.lock);
+	    --tcp->tx_pending;
+	    pj_lock_release(tcp->base.lock);
+
 	    /* Shutdown transport on closure/errors */
 	    if (size <= 0) {
 
@@ -1346,6 +1573,11 @@ static pj_status_t tcp_send_msg(pjsip_transport *transport,
 		    status = PJ_RETURN_OS_ERROR(OSERR_ENOTCONN);
 
 		tcp_init_shutdown(tcp, status);
+		tcp_cancel_tx_queue(tcp, status);
+
+	    } else {
+		/* Send the messages queued meanwhile */
+		tcp_flush_tx_queue(tcp);
 	    }
 	}
     }
@@ -1363,13 +1595,13 @@ static pj_status_t tcp_shutdown(pjsip_transport *transport)
     
     /* Stop keep-alive timer. */
     if (tcp->ka_timer.id) {
-	pjsip_endpt_cancel_timer(tcp->base.endpt, &tcp->ka_timer);
+	pj_timer_heap_cancel(tcp->timer_heap, &tcp->ka_timer);
 	tcp->ka_timer.id = PJ_FALSE;
     }
 
     /* Stop initial timer. */
     if (tcp->initial_timer.id) {
-	pjsip_endpt_cancel_timer(tcp->base.endpt, &tcp->initial_timer);
+	pj_timer_heap_cancel(tcp->timer_heap, &tcp->initial_timer);
 	tcp->initial_timer.id = PJ_FALSE;
     }
 
@@ -1402,7 +1634,7 @@ static pj_bool_t on_data_read(pj_activesock_t *asock,
     }
 
     if (tcp->initial_timer.id) {
-	pjsip_endpt_cancel_timer(tcp->base.endpt, &tcp->initial_timer);
+	pj_timer_heap_cancel(tcp->timer_heap, &tcp->initial_timer);
 	tcp->initial_timer.id = PJ_FALSE;
     }
 
@@ -1495,14 +1727,11 @@ static pj_bool_t on_connect_complete(pj_activesock_t *asock,
 	/* Cancel all delayed transmits */
 	while (!pj_list_empty(&tcp->delayed_list)) {
 	    struct delayed_tdata *pending_tx;
-	    pj_ioqueue_op_key_t *op_key;
 
 	    pending_tx = tcp->delayed_list.next;
 	    pj_list_erase(pending_tx);
 
-	    op_key = (pj_ioqueue_op_key_t*)pending_tx->tdata_op_key;
-
-	    on_data_sent(tcp->asock, op_key, -status);
+	    tcp_notify_sent(tcp, pending_tx->tdata_op_key, -status);
 	}
 
 	tcp_init_shutdown(tcp, status);
@@ -1559,8 +1788,8 @@ static pj_bool_t on_connect_complete(pj_activesock_t *asock,
     if (pjsip_cfg()->tcp.keep_alive_interval) {
 	pj_time_val delay = { 0 };
 	delay.sec = pjsip_cfg()->tcp.keep_alive_interval;
-	pjsip_endpt_schedule_timer(tcp->base.endpt, &tcp->ka_timer, 
-				   &delay);
+	pj_timer_heap_schedule(tcp->timer_heap, &tcp->ka_timer, 
+			       &delay);
 	tcp->ka_timer.id = PJ_TRUE;
 	pj_gettimeofday(&tcp->last_activity);
     }
@@ -1590,8 +1819,8 @@ static void tcp_keep_alive_timer(pj_timer_heap_t *th, pj_timer_entry *e)
 	delay.sec = pjsip_cfg()->tcp.keep_alive_interval - now.sec;
 	delay.msec = 0;
 
-	pjsip_endpt_schedule_timer(tcp->base.endpt, &tcp->ka_timer, 
-				   &delay);
+	pj_timer_heap_schedule(tcp->timer_heap, &tcp->ka_timer, 
+			       &delay);
 	tcp->ka_timer.id = PJ_TRUE;
 	return;
     }
@@ -1618,8 +1847,8 @@ static void tcp_keep_alive_timer(pj_timer_heap_t *th, pj_timer_entry *e)
     delay.sec = pjsip_cfg()->tcp.keep_alive_interval;
     delay.msec = 0;
 
-    pjsip_endpt_schedule_timer(tcp->base.endpt, &tcp->ka_timer, 
-			       &delay);
+    pj_timer_heap_schedule(tcp->timer_heap, &tcp->ka_timer, 
+			   &delay);
     tcp->ka_timer.id = PJ_TRUE;
 }
 
@@ -1643,6 +1872,22 @@ PJ_DEF(pj_sock_t) pjsip_tcp_transport_get_socket(pjsip_transport *transport)
 }
 
 
+PJ_DEF(pj_status_t) pjsip_tcp_transport_get_tx_stat(
+					pjsip_transport *transport,
+					pjsip_transport_tx_stat *stat)
+{
+    struct tcp_transport *tcp = (struct tcp_transport*)transport;
+
+    PJ_ASSERT_RETURN(transport && stat, PJ_EINVAL);
+
+    pj_lock_acquire(tcp->base.lock);
+    pj_memcpy(stat, &tcp->tx_stat, sizeof(*stat));
+    pj_lock_release(tcp->base.lock);
+
+    return PJ_SUCCESS;
+}
+
+
 PJ_DEF(pj_status_t) pjsip_tcp_transport_lis_start(pjsip_tpfactory *factory,
 						 const pj_sockaddr *local,
 					         const pjsip_host_port *a_name)
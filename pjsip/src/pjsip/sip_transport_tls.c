@@ -70,7 +70,8 @@ struct tls_listener
  * A delayed transmission occurs when application sends tx_data when
  * the TLS connect/establishment is still in progress. These delayed
  * transmission will be "flushed" once the socket is connected (either
- * successfully or with errors).
+ * successfully or with errors). It is also used to queue the tx_data
+ * sent while a previous write on the socket is still in progress.
  */
 struct delayed_tdata
 {
@@ -96,6 +97,9 @@ struct tls_transport
     pj_bool_t		     has_pending_connect;
     pj_bool_t		     verify_server;
 
+    /* Timer heap of the I/O worker serving this connection. */
+    pj_timer_heap_t	    *timer_heap;
+
     /* Keep-alive timer. */
     pj_timer_entry	     ka_timer;
     pj_time_val		     last_activity;
@@ -111,6 +115,16 @@ struct tls_transport
     /* Pending transmission list. */
     struct delayed_tdata     delayed_list;
 
+    /* Number of writes in progress, the messages queued meanwhile, and
+     * the messages sent in the coalesced write in progress.
+     */
+    unsigned		     tx_pending;
+    struct delayed_tdata     tx_queue;
+    struct delayed_tdata     tx_batch;
+    pjsip_tx_data_op_key     tx_op_key;
+    char		    *tx_buf;
+    pjsip_transport_tx_stat  tx_stat;
+
     /* Group lock to be used by TLS transport and ioqueue key */
     pj_grp_lock_t	    *grp_lock;
 };
@@ -163,6 +177,7 @@ static pj_status_t tls_create(struct tls_listener *listener,
 			      const pj_sockaddr *remote,
 			      const pj_str_t *remote_name,
 			      pj_grp_lock_t *glock,
+			      pj_timer_heap_t *timer_heap,
 			      struct tls_transport **p_tls);
 
 
@@ -752,6 +767,22 @@ PJ_DEF(pj_status_t) pjsip_tls_transport_restart(pjsip_tpfactory *factory,
 }
 
 
+PJ_DEF(pj_status_t) pjsip_tls_transport_get_tx_stat(
+					pjsip_transport *transport,
+					pjsip_transport_tx_stat *stat)
+{
+    struct tls_transport *tls = (struct tls_transport*)transport;
+
+    PJ_ASSERT_RETURN(transport && stat, PJ_EINVAL);
+
+    pj_lock_acquire(tls->base.lock);
+    pj_memcpy(stat, &tls->tx_stat, sizeof(*stat));
+    pj_lock_release(tls->base.lock);
+
+    return PJ_SUCCESS;
+}
+
+
 /***************************************************************************/
 /*
  * TLS Transport
@@ -797,6 +828,7 @@ static pj_status_t tls_create( struct tls_listener *listener,
 			       const pj_sockaddr *remote,
 			       const pj_str_t *remote_name,
 			       pj_grp_lock_t *glock,
+			       pj_timer_heap_t *timer_heap,
 			       struct tls_transport **p_tls)
 {
     struct tls_transport *tls;
@@ -821,6 +853,8 @@ static pj_status_t tls_create( struct tls_listener *listener,
     tls->is_server = is_server;
     tls->verify_server = listener->tls_setting.verify_server;
     pj_list_init(&tls->delayed_list);
+    pj_list_init(&tls->tx_queue);
+    pj_list_init(&tls->tx_batch);
     tls->base.pool = pool;
 
     pj_ansi_snprintf(tls->base.obj_name, PJ_MAX_OBJ_NAME, 
@@ -873,6 +907,7 @@ static pj_status_t tls_create( struct tls_listener *listener,
     }
 
     tls->base.endpt = listener->endpt;
+    tls->timer_heap = timer_heap;
     tls->base.tpmgr = listener->tpmgr;
     tls->base.send_msg = &tls_send_msg;
     tls->base.do_shutdown = &tls_shutdown;
@@ -918,6 +953,211 @@ on_error:
 }
 
 
+/* Notify sip_transport.c that the message has been sent. */
+static void tls_notify_sent(struct tls_transport *tls,
+			    pjsip_tx_data_op_key *tdata_op_key,
+			    pj_ssize_t bytes_sent)
+{
+    tdata_op_key->tdata = NULL;
+
+    if (tdata_op_key->callback) {
+	if (bytes_sent == 0)
+	    bytes_sent = -PJ_RETURN_OS_ERROR(OSERR_ENOTCONN);
+
+	tdata_op_key->callback(&tls->base, tdata_op_key->token, bytes_sent);
+
+	/* Mark last activity time */
+	pj_gettimeofday(&tls->last_activity);
+    }
+}
+
+
+/* Notify the messages carried by the completed write. */
+static void tls_notify_tx(struct tls_transport *tls,
+			  pj_ioqueue_op_key_t *op_key,
+			  pj_ssize_t bytes_sent)
+{
+    struct delayed_tdata batch;
+
+    if (op_key != &tls->tx_op_key.key) {
+	tls_notify_sent(tls, (pjsip_tx_data_op_key*)op_key, bytes_sent);
+	return;
+    }
+
+    pj_list_init(&batch);
+    pj_lock_acquire(tls->base.lock);
+    pj_list_merge_last(&batch, &tls->tx_batch);
+    pj_lock_release(tls->base.lock);
+
+    while (!pj_list_empty(&batch)) {
+	struct delayed_tdata *tx = batch.next;
+	pjsip_tx_data *tdata = tx->tdata_op_key->tdata;
+
+	pj_list_erase(tx);
+	tls_notify_sent(tls, tx->tdata_op_key, (bytes_sent <= 0) ? bytes_sent :
+			(tdata->buf.cur - tdata->buf.start));
+    }
+}
+
+
+/* Put the message in the transmit queue. Transport lock must be held. */
+static void tls_queue_tx(struct tls_transport *tls, struct delayed_tdata *tx)
+{
+    pjsip_tx_data *tdata = tx->tdata_op_key->tdata;
+
+    pj_list_push_back(&tls->tx_queue, tx);
+    tls->tx_stat.queued_bytes += (tdata->buf.cur - tdata->buf.start);
+    ++tls->tx_stat.total_queued_msgs;
+    if (++tls->tx_stat.queued_msgs > tls->tx_stat.max_queued_msgs)
+	tls->tx_stat.max_queued_msgs = tls->tx_stat.queued_msgs;
+}
+
+
+/* Remove the first message from the transmit queue. Transport lock must
+ * be held.
+ */
+static struct delayed_tdata *tls_dequeue_tx(struct tls_transport *tls)
+{
+    struct delayed_tdata *tx = tls->tx_queue.next;
+    pjsip_tx_data *tdata = tx->tdata_op_key->tdata;
+
+    pj_list_erase(tx);
+    tls->tx_stat.queued_bytes -= (tdata->buf.cur - tdata->buf.start);
+    --tls->tx_stat.queued_msgs;
+    return tx;
+}
+
+
+/* Cancel the queued messages, and the messages in the coalesced write
+ * which hasn't completed.
+ */
+static void tls_cancel_tx_queue(struct tls_transport *tls, 
+				pj_status_t reason)
+{
+    struct delayed_tdata cancelled;
+
+    pj_list_init(&cancelled);
+    pj_lock_acquire(tls->base.lock);
+    pj_list_merge_last(&cancelled, &tls->tx_batch);
+    pj_list_merge_last(&cancelled, &tls->tx_queue);
+    tls->tx_stat.queued_msgs = 0;
+    tls->tx_stat.queued_bytes = 0;
+    pj_lock_release(tls->base.lock);
+
+    while (!pj_list_empty(&cancelled)) {
+	struct delayed_tdata *tx = cancelled.next;
+
+	pj_list_erase(tx);
+	tls_notify_sent(tls, tx->tdata_op_key, -reason);
+    }
+}
+
+
+/* Shutdown the transport after send() error or closure. */
+static void tls_on_tx_error(struct tls_transport *tls, pj_ssize_t bytes_sent)
+{
+    pj_status_t status;
+
+    PJ_LOG(5,(tls->base.obj_name, "TLS send() error, sent=%d", 
+	      bytes_sent));
+
+    status = (bytes_sent == 0) ? PJ_RETURN_OS_ERROR(OSERR_ENOTCONN) :
+				 (pj_status_t)-bytes_sent;
+
+    tls_init_shutdown(tls, status);
+    tls_cancel_tx_queue(tls, status);
+}
+
+
+/*
+ * Send the queued messages, once there is no write in progress. The
+ * messages are copied to the transport's buffer to be sent in a single
+ * write, as long as they fit.
+ */
+static void tls_flush_tx_queue(struct tls_transport *tls)
+{
+    pj_lock_acquire(tls->base.lock);
+    while (tls->tx_pending == 0 && !pj_list_empty(&tls->tx_queue) &&
+	   !tls->is_closing)
+    {
+	struct delayed_tdata *tx = tls->tx_queue.next;
+	pjsip_tx_data *tdata = tx->tdata_op_key->tdata;
+	pjsip_tx_data *next_tdata = NULL;
+	pj_ioqueue_op_key_t *op_key;
+	pj_ssize_t size;
+	char *buf;
+	pj_status_t status;
+
+	size = tdata->buf.cur - tdata->buf.start;
+	if (tx->next != &tls->tx_queue)
+	    next_tdata = tx->next->tdata_op_key->tdata;
+
+	if (next_tdata && size + (next_tdata->buf.cur -
+				  next_tdata->buf.start) <=
+			  PJSIP_TCP_TX_COALESCE_SIZE)
+	{
+	    /* Coalesce the messages which fit in the buffer */
+	    if (!tls->tx_buf) {
+		tls->tx_buf = (char*) pj_pool_alloc(tls->base.pool,
+						    PJSIP_TCP_TX_COALESCE_SIZE);
+	    }
+
+	    size = 0;
+	    do {
+		pj_size_t len;
+
+		tx = tls_dequeue_tx(tls);
+		tdata = tx->tdata_op_key->tdata;
+		len = tdata->buf.cur - tdata->buf.start;
+
+		pj_memcpy(tls->tx_buf + size, tdata->buf.start, len);
+		size += len;
+		pj_list_push_back(&tls->tx_batch, tx);
+		++tls->tx_stat.coalesced_msgs;
+
+		if (pj_list_empty(&tls->tx_queue))
+		    break;
+		tdata = tls->tx_queue.next->tdata_op_key->tdata;
+	    } while (size + (tdata->buf.cur - tdata->buf.start) <=
+		     PJSIP_TCP_TX_COALESCE_SIZE);
+
+	    ++tls->tx_stat.coalesced_writes;
+	    op_key = &tls->tx_op_key.key;
+	    buf = tls->tx_buf;
+
+	} else {
+	    /* Send the message on its own */
+	    tx = tls_dequeue_tx(tls);
+	    op_key = (pj_ioqueue_op_key_t*)tx->tdata_op_key;
+	    buf = tdata->buf.start;
+	}
+
+	++tls->tx_pending;
+	pj_lock_release(tls->base.lock);
+
+	/* send! */
+	status = pj_ssl_sock_send(tls->ssock, op_key, buf, &size, 0);
+	if (status == PJ_EPENDING)
+	    return;
+
+	/* Completed immediately */
+	if (status != PJ_SUCCESS)
+	    size = -status;
+	tls_notify_tx(tls, op_key, size);
+
+	pj_lock_acquire(tls->base.lock);
+	--tls->tx_pending;
+
+	if (size <= 0) {
+	    pj_lock_release(tls->base.lock);
+	    tls_on_tx_error(tls, size);
+	    return;
+	}
+    }
+    pj_lock_release(tls->base.lock);
+}
+
+
 /* Flush all delayed transmision once the socket is connected. */
 static void tls_flush_pending_tx(struct tls_transport *tls)
 {
@@ -927,35 +1167,22 @@ static void tls_flush_pending_tx(struct tls_transport *tls)
     pj_lock_acquire(tls->base.lock);
     while (!pj_list_empty(&tls->delayed_list)) {
 	struct delayed_tdata *pending_tx;
-	pjsip_tx_data *tdata;
-	pj_ioqueue_op_key_t *op_key;
-	pj_ssize_t size;
-	pj_status_t status;
 
 	pending_tx = tls->delayed_list.next;
 	pj_list_erase(pending_tx);
 
-	tdata = pending_tx->tdata_op_key->tdata;
-	op_key = (pj_ioqueue_op_key_t*)pending_tx->tdata_op_key;
-
         if (pending_tx->timeout.sec > 0 &&
             PJ_TIME_VAL_GT(now, pending_tx->timeout))
         {
             continue;
         }
 
-	/* send! */
-	size = tdata->buf.cur - tdata->buf.start;
-	status = pj_ssl_sock_send(tls->ssock, op_key, tdata->buf.start, 
-				  &size, 0);
-
-	if (status != PJ_EPENDING) {
-            pj_lock_release(tls->base.lock);
-	    on_data_sent(tls->ssock, op_key, size);
-            pj_lock_acquire(tls->base.lock);
-	}
+	/* Queue it, so the delayed messages are sent together */
+	tls_queue_tx(tls, pending_tx);
     }
     pj_lock_release(tls->base.lock);
+
+    tls_flush_tx_queue(tls);
 }
 
 
@@ -978,6 +1205,8 @@ static void tls_on_destroy(void *arg)
 {
     struct tls_transport *tls = (struct tls_transport*)arg;
 
+    pjsip_rx_framer_reset(&tls->rdata.tp_info.framer);
+
     if (tls->rdata.tp_info.pool) {
 	pj_pool_secure_release(&tls->rdata.tp_info.pool);
     }
@@ -1035,22 +1264,20 @@ static pj_status_t tls_destroy(pjsip_transport *transport,
 
     /* Stop keep-alive timer. */
     if (tls->ka_timer.id) {
-	pjsip_endpt_cancel_timer(tls->base.endpt, &tls->ka_timer);
+	pj_timer_heap_cancel(tls->timer_heap, &tls->ka_timer);
 	tls->ka_timer.id = PJ_FALSE;
     }
 
     /* Cancel all delayed transmits */
     while (!pj_list_empty(&tls->delayed_list)) {
 	struct delayed_tdata *pending_tx;
-	pj_ioqueue_op_key_t *op_key;
 
 	pending_tx = tls->delayed_list.next;
 	pj_list_erase(pending_tx);
 
-	op_key = (pj_ioqueue_op_key_t*)pending_tx->tdata_op_key;
-
-	on_data_sent(tls->ssock, op_key, -reason);
+	tls_notify_sent(tls, pending_tx->tdata_op_key, -reason);
     }
+    tls_cancel_tx_queue(tls, reason);
 
     if (tls->ssock) {
 	pj_ssl_sock_close(tls->ssock);
@@ -1175,8 +1402,6 @@ static pj_status_t lis_create_transport(pjsip_tpfactory *factory,
     ssock_param.cb.on_data_read = &on_data_read;
     ssock_param.cb.on_data_sent = &on_data_sent;
     ssock_param.async_cnt = 1;
-    ssock_param.ioqueue = pjsip_endpt_get_ioqueue(listener->endpt);
-    ssock_param.timer_heap = pjsip_endpt_get_timer_heap(listener->endpt);
     ssock_param.server_name = remote_name;
     ssock_param.timeout = listener->tls_setting.timeout;
     ssock_param.user_data = NULL; /* pending, must be set later */
@@ -1215,6 +1440,15 @@ static pj_status_t lis_create_transport(pjsip_tpfactory *factory,
 	return status;
 
     ssock_param.grp_lock = glock;
+    status = pjsip_tpmgr_get_io_worker(listener->tpmgr, glock,
+				       &ssock_param.ioqueue,
+				       &ssock_param.timer_heap);
+    if (status != PJ_SUCCESS) {
+	pj_grp_lock_destroy(glock);
+	pj_pool_release(pool);
+	return status;
+    }
+
     status = pj_ssl_sock_create(pool, &ssock_param, &ssock);
     if (status != PJ_SUCCESS) {
 	pj_grp_lock_destroy(glock);
@@ -1237,7 +1471,8 @@ static pj_status_t lis_create_transport(pjsip_tpfactory *factory,
 
     /* Create the transport descriptor */
     status = tls_create(listener, pool, ssock, PJ_FALSE, &local_addr, 
-			rem_addr, &remote_name, glock, &tls);
+			rem_addr, &remote_name, glock, ssock_param.timer_heap,
+			&tls);
     if (status != PJ_SUCCESS)
 	return status;
 
@@ -1398,7 +1633,8 @@ static pj_bool_t on_accept_complete2(pj_ssl_sock_t *ssock,
      */
     status = tls_create( listener, NULL, new_ssock, PJ_TRUE,
 			 &ssl_info.local_addr, &tmp_src_addr, NULL,
-			 ssl_info.grp_lock, &tls);
+			 ssl_info.grp_lock,
+			 pjsip_endpt_get_timer_heap(listener->endpt), &tls);
     
     if (status != PJ_SUCCESS) {
 	if (listener->tls_setting.on_accept_fail_cb) {
@@ -1473,9 +1709,9 @@ static pj_bool_t on_accept_complete2(pj_ssl_sock_t *ssock,
 	if (pjsip_cfg()->tls.keep_alive_interval) {
 	    pj_time_val delay = {0};	    
 	    delay.sec = pjsip_cfg()->tls.keep_alive_interval;
-	    pjsip_endpt_schedule_timer(listener->endpt, 
-				       &tls->ka_timer, 
-				       &delay);
+	    pj_timer_heap_schedule(tls->timer_heap, 
+				   &tls->ka_timer, 
+				   &delay);
 	    tls->ka_timer.id = PJ_TRUE;
 	    pj_gettimeofday(&tls->last_activity);
 	}
@@ -1506,43 +1742,28 @@ static pj_bool_t on_data_sent(pj_ssl_sock_t *ssock,
 {
     struct tls_transport *tls = (struct tls_transport*) 
     				pj_ssl_sock_get_user_data(ssock);
-    pjsip_tx_data_op_key *tdata_op_key = (pjsip_tx_data_op_key*)op_key;
 
     /* Note that op_key may be the op_key from keep-alive, thus
      * it will not have tdata etc.
      */
+    tls_notify_tx(tls, op_key, bytes_sent);
 
-    tdata_op_key->tdata = NULL;
-
-    if (tdata_op_key->callback) {
-	/*
-	 * Notify sip_transport.c that packet has been sent.
-	 */
-	if (bytes_sent == 0)
-	    bytes_sent = -PJ_RETURN_OS_ERROR(OSERR_ENOTCONN);
-
-	tdata_op_key->callback(&tls->base, tdata_op_key->token, bytes_sent);
-
-	/* Mark last activity time */
-	pj_gettimeofday(&tls->last_activity);
+    /* Send the messages queued while the write was in progress */
+    if (op_key != &tls->ka_op_key.key) {
+	pj_lock_acquire(tls->base.lock);
+	--tls->tx_pending;
+	pj_lock_release(tls->base.lock);
 
+	if (bytes_sent > 0)
+	    tls_flush_tx_queue(tls);
     }
 
     /* Check for error/closure */
     if (bytes_sent <= 0) {
-	pj_status_t status;
-
-	PJ_LOG(5,(tls->base.obj_name, "TLS send() error, sent=%d", 
-		  bytes_sent));
-
-	status = (bytes_sent == 0) ? PJ_RETURN_OS_ERROR(OSERR_ENOTCONN) :
-				     (pj_status_t)-bytes_sent;
-
-	tls_init_shutdown(tls, status);
-
+	tls_on_tx_error(tls, bytes_sent);
 	return PJ_FALSE;
     }
-    
+
     return PJ_TRUE;
 }
 
@@ -1620,6 +1841,28 @@ static pj_status_t tls_send_msg(pjsip_transport *transport,
 	pj_lock_release(tls->base.lock);
     } 
     
+    if (!delayed) {
+	/*
+	 * If a write is still in progress, queue the message to be sent
+	 * together with the other queued messages when the write completes.
+	 */
+	pj_lock_acquire(tls->base.lock);
+
+	if (tls->tx_pending || !pj_list_empty(&tls->tx_queue)) {
+	    struct delayed_tdata *queued_tdata;
+
+	    queued_tdata = PJ_POOL_ZALLOC_T(tdata->pool, struct delayed_tdata);
+	    queued_tdata->tdata_op_key = &tdata->op_key;
+	    tls_queue_tx(tls, queued_tdata);
+	    status = PJ_EPENDING;
+	    delayed = PJ_TRUE;
+	} else {
+	    ++tls->tx_pending;
+	}
+
+	pj_lock_release(tls->base.lock);
+    }
+
     if (!delayed) {
 	/*
 	 * Transport is ready to go. Send the packet to ioqueue to be
@@ -1634,6 +1877,10 @@ static pj_status_t tls_send_msg(pjsip_transport *transport,
 	    /* Not pending (could be immediate success or error) */
 	    tdata->op_key.tdata = NULL;
 
+	    pj_lock_acquire(tls->base.lock);
+	    --tls->tx_pending;
+	    pj_lock_release(tls->base.lock);
+
 	    /* Shutdown transport on closure/errors */
 	    if (size <= 0) {
 
@@ -1644,6 +1891,11 @@ static pj_status_t tls_send_msg(pjsip_transport *transport,
 		    status = PJ_RETURN_OS_ERROR(OSERR_ENOTCONN);
 
 		tls_init_shutdown(tls, status);
+		tls_cancel_tx_queue(tls, status);
+
+	    } else {
+		/* Send the messages queued meanwhile */
+		tls_flush_tx_queue(tls);
 	    }
 	}
     }
@@ -1661,7 +1913,7 @@ static pj_status_t tls_shutdown(pjsip_transport *transport)
     
     /* Stop keep-alive timer. */
     if (tls->ka_timer.id) {
-	pjsip_endpt_cancel_timer(tls->base.endpt, &tls->ka_timer);
+	pj_timer_heap_cancel(tls->timer_heap, &tls->ka_timer);
 	tls->ka_timer.id = PJ_FALSE;
     }
 
@@ -1781,14 +2033,11 @@ static pj_bool_t on_connect_complete(pj_ssl_sock_t *ssock,
 	/* Cancel all delayed transmits */
 	while (!pj_list_empty(&tls->delayed_list)) {
 	    struct delayed_tdata *pending_tx;
-	    pj_ioqueue_op_key_t *op_key;
 
 	    pending_tx = tls->delayed_list.next;
 	    pj_list_erase(pending_tx);
 
-	    op_key = (pj_ioqueue_op_key_t*)pending_tx->tdata_op_key;
-
-	    on_data_sent(tls->ssock, op_key, -status);
+	    tls_notify_sent(tls, pending_tx->tdata_op_key, -status);
 	}
 
 	goto on_error;
@@ -1926,14 +2175,11 @@ static pj_bool_t on_connect_complete(pj_ssl_sock_t *ssock,
 	/* Cancel all delayed transmits */
 	while (!pj_list_empty(&tls->delayed_list)) {
 	    struct delayed_tdata *pending_tx;
-	    pj_ioqueue_op_key_t *op_key;
 
 	    pending_tx = tls->delayed_list.next;
 	    pj_list_erase(pending_tx);
 
-	    op_key = (pj_ioqueue_op_key_t*)pending_tx->tdata_op_key;
-
-	    on_data_sent(tls->ssock, op_key, -status);
+	    tls_notify_sent(tls, pending_tx->tdata_op_key, -status);
 	}
 
 	return PJ_FALSE;
@@ -1964,8 +2210,8 @@ static pj_bool_t on_connect_complete(pj_ssl_sock_t *ssock,
     if (pjsip_cfg()->tls.keep_alive_interval) {
 	pj_time_val delay = {0};	    
 	delay.sec = pjsip_cfg()->tls.keep_alive_interval;
-	pjsip_endpt_schedule_timer(tls->base.endpt, &tls->ka_timer, 
-				   &delay);
+	pj_timer_heap_schedule(tls->timer_heap, &tls->ka_timer, 
+			       &delay);
 	tls->ka_timer.id = PJ_TRUE;
 	pj_gettimeofday(&tls->last_activity);
     }
@@ -2001,8 +2247,8 @@ static void tls_keep_alive_timer(pj_timer_heap_t *th, pj_timer_entry *e)
 	delay.sec = pjsip_cfg()->tls.keep_alive_interval - now.sec;
 	delay.msec = 0;
 
-	pjsip_endpt_schedule_timer(tls->base.endpt, &tls->ka_timer, 
-				   &delay);
+	pj_timer_heap_schedule(tls->timer_heap, &tls->ka_timer, 
+			       &delay);
 	tls->ka_timer.id = PJ_TRUE;
 	return;
     }
@@ -2031,8 +2277,8 @@ static void tls_keep_alive_timer(pj_timer_heap_t *th, pj_timer_entry *e)
     delay.sec = pjsip_cfg()->tls.keep_alive_interval;
     delay.msec = 0;
 
-    pjsip_endpt_schedule_timer(tls->base.endpt, &tls->ka_timer, 
-			       &delay);
+    pj_timer_heap_schedule(tls->timer_heap, &tls->ka_timer, 
+			   &delay);
     tls->ka_timer.id = PJ_TRUE;
 }
 
@@ -54,6 +54,8 @@ struct dlg_set_head
     PJ_DECL_LIST_MEMBER(pjsip_dialog);
 };
 
+struct dlg_shard;
+
 /* This struct represents a dialog set.
  * This is the value that will be put in the UA's hash table.
  */
@@ -67,8 +69,23 @@ struct dlg_set
 
     /* List of dialog in this dialog set. */
     struct dlg_set_head  dlg_list;
+
+    /* The shard where this dialog set is registered. */
+    struct dlg_shard	*shard;
 };
 
+/* One shard of the dialog set table. A dialog set is placed in the shard
+ * selected by the hash of its Call-ID, and in the shard's hash table by
+ * its local tag. Each shard has its own mutex, so that messages for 
+ * dialogs in different shards do not contend with each other.
+ */
+typedef struct dlg_shard
+{
+    pj_mutex_t		*mutex;
+    pj_hash_table_t	*dlg_table;
+    struct dlg_set	 free_dlgset_nodes;
+} dlg_shard;
+
 
 /*
  * Module interface.
@@ -78,10 +95,9 @@ static struct user_agent
     pjsip_module	 mod;
     pj_pool_t		*pool;
     pjsip_endpoint	*endpt;
-    pj_mutex_t		*mutex;
-    pj_hash_table_t	*dlg_table;
+    unsigned		 shard_cnt;
+    dlg_shard		*shards;
     pjsip_ua_init_param  param;
-    struct dlg_set	 free_dlgset_nodes;
 
 } mod_ua = 
 {
@@ -102,6 +118,89 @@ static struct user_agent
   }
 };
 
+/*
+ * Destroy the mutexes of the dialog set table shards.
+ */
+static void destroy_shards(void)
+{
+    unsigned i;
+
+    for (i=0; i<mod_ua.shard_cnt; ++i) {
+	if (mod_ua.shards[i].mutex) {
+	    pj_mutex_destroy(mod_ua.shards[i].mutex);
+	    mod_ua.shards[i].mutex = NULL;
+	}
+    }
+    mod_ua.shard_cnt = 0;
+}
+
+/*
+ * Create the dialog set table shards. The initial capacity specified in
+ * PJSIP_MAX_DIALOG_COUNT is divided evenly among the shards, and the
+ * tables grow as dialogs are added.
+ */
+static pj_status_t create_shards(pj_pool_t *pool)
+{
+    unsigned i, shard_cnt, shard_size;
+
+    shard_cnt = pjsip_cfg()->dlg.shard_cnt;
+    if (shard_cnt == 0) {
+	/* One shard per worker, rounded up to a power of two. Sharding
+	 * only slows the lookups down when there's a single worker.
+	 */
+	unsigned worker_cnt = pjsip_cfg()->endpt.rx_worker_cnt;
+
+	shard_cnt = 1;
+	while (shard_cnt < worker_cnt)
+	    shard_cnt <<= 1;
+    }
+    if (shard_cnt > PJSIP_DLG_MAX_SHARD_COUNT)
+	shard_cnt = PJSIP_DLG_MAX_SHARD_COUNT;
+
+    shard_size = PJSIP_MAX_DIALOG_COUNT / shard_cnt;
+
+    mod_ua.shards = (dlg_shard*)
+		    pj_pool_calloc(pool, shard_cnt, sizeof(dlg_shard));
+    mod_ua.shard_cnt = shard_cnt;
+
+    for (i=0; i<shard_cnt; ++i) {
+	dlg_shard *shard = &mod_ua.shards[i];
+	char name[PJ_MAX_OBJ_NAME];
+	pj_status_t status;
+
+	shard->dlg_table = pj_hash_create2(pool, shard_size,
+					   PJ_HASH_OPT_OPEN_ADDRESSING);
+	if (!shard->dlg_table) {
+	    destroy_shards();
+	    return PJ_ENOMEM;
+	}
+	pj_list_init(&shard->free_dlgset_nodes);
+
+	pj_ansi_snprintf(name, sizeof(name), " ua%u", i);
+	status = pj_mutex_create_recursive(pool, name, &shard->mutex);
+	if (status != PJ_SUCCESS) {
+	    destroy_shards();
+	    return status;
+	}
+    }
+
+    return PJ_SUCCESS;
+}
+
+/*
+ * Get the shard which holds the dialog sets with the specified Call-ID.
+ */
+PJ_INLINE(dlg_shard*) get_shard(const pj_str_t *call_id)
+{
+    pj_uint32_t hval;
+
+    if (mod_ua.shard_cnt == 1)
+	return &mod_ua.shards[0];
+
+    hval = pj_hash_calc(0, call_id->ptr, (unsigned)call_id->slen);
+    return &mod_ua.shards[hval % mod_ua.shard_cnt];
+}
+
 /* 
  * mod_ua_load()
  *
@@ -118,16 +217,10 @@ static pj_status_t mod_ua_load(pjsip_endpoint *endpt)
     if (mod_ua.pool == NULL)
 	return PJ_ENOMEM;
 
-    status = pj_mutex_create_recursive(mod_ua.pool, " ua%p", &mod_ua.mutex);
+    status = create_shards(mod_ua.pool);
     if (status != PJ_SUCCESS)
 	return status;
 
-    mod_ua.dlg_table = pj_hash_create(mod_ua.pool, PJSIP_MAX_DIALOG_COUNT);
-    if (mod_ua.dlg_table == NULL)
-	return PJ_ENOMEM;
-
-    pj_list_init(&mod_ua.free_dlgset_nodes);
-
     /* Initialize dialog lock. */
     status = pj_thread_local_alloc(&pjsip_dlg_lock_tls_id);
     if (status != PJ_SUCCESS)
@@ -147,7 +240,7 @@ static pj_status_t mod_ua_load(pjsip_endpoint *endpt)
 static pj_status_t mod_ua_unload(void)
 {
     pj_thread_local_free(pjsip_dlg_lock_tls_id);
-    pj_mutex_destroy(mod_ua.mutex);
+    destroy_shards();
 
     /* Release pool */
     if (mod_ua.pool) {
@@ -261,18 +354,18 @@ PJ_DEF(void) pjsip_ua_create_dlg_set_key( pj_pool_t *pool,
  * This will first look in the free nodes list, then allocate
  * a new one from UA's pool when one is not available.
  */
-static struct dlg_set *alloc_dlgset_node(void)
+static struct dlg_set *alloc_dlgset_node(dlg_shard *shard)
 {
     struct dlg_set *set;
 
-    if (!pj_list_empty(&mod_ua.free_dlgset_nodes)) {
-	set = mod_ua.free_dlgset_nodes.next;
+    if (!pj_list_empty(&shard->free_dlgset_nodes)) {
+	set = shard->free_dlgset_nodes.next;
 	pj_list_erase(set);
-	return set;
     } else {
 	set = PJ_POOL_ALLOC_T(mod_ua.pool, struct dlg_set);
-	return set;
     }
+    set->shard = shard;
+    return set;
 }
 
 /*
@@ -282,6 +375,8 @@ static struct dlg_set *alloc_dlgset_node(void)
 PJ_DEF(pj_status_t) pjsip_ua_register_dlg( pjsip_user_agent *ua,
 					   pjsip_dialog *dlg )
 {
+    dlg_shard *shard;
+
     /* Sanity check. */
     PJ_ASSERT_RETURN(ua && dlg, PJ_EINVAL);
 
@@ -294,15 +389,16 @@ PJ_DEF(pj_status_t) pjsip_ua_register_dlg( pjsip_user_agent *ua,
     //		     (dlg->role==PJSIP_ROLE_UAS && dlg->remote.info->tag.slen
     //		      && dlg->remote.tag_hval != 0), PJ_EBUG);
 
-    /* Lock the user agent. */
-    pj_mutex_lock(mod_ua.mutex);
+    /* Lock the shard of the dialog's Call-ID. */
+    shard = get_shard(&dlg->call_id->id);
+    pj_mutex_lock(shard->mutex);
 
     /* For UAC, check if there is existing dialog in the same set. */
     if (dlg->role == PJSIP_ROLE_UAC) {
 	struct dlg_set *dlg_set;
 
 	dlg_set = (struct dlg_set*)
-		  pj_hash_get_lower( mod_ua.dlg_table,
+		  pj_hash_get_lower( shard->dlg_table,
                                      dlg->local.info->tag.ptr, 
 			             (unsigned)dlg->local.info->tag.slen,
 			             &dlg->local.tag_hval);
@@ -320,14 +416,14 @@ PJ_DEF(pj_status_t) pjsip_ua_register_dlg( pjsip_user_agent *ua,
 	    /* This is the first dialog in the dialog set. 
 	     * Create the dialog set and add this dialog to it.
 	     */
-	    dlg_set = alloc_dlgset_node();
+	    dlg_set = alloc_dlgset_node(shard);
 	    pj_list_init(&dlg_set->dlg_list);
 	    pj_list_push_back(&dlg_set->dlg_list, dlg);
 
 	    dlg->dlg_set = dlg_set;
 
 	    /* Register the dialog set in the hash table. */
-	    pj_hash_set_np_lower(mod_ua.dlg_table, 
+	    pj_hash_set_np_lower(shard->dlg_table, 
 			         dlg->local.info->tag.ptr,
                                  (unsigned)dlg->local.info->tag.slen,
 			         dlg->local.tag_hval, dlg_set->ht_entry,
@@ -338,20 +434,20 @@ PJ_DEF(pj_status_t) pjsip_ua_register_dlg( pjsip_user_agent *ua,
 	/* For UAS, create the dialog set with a single dialog as member. */
 	struct dlg_set *dlg_set;
 
-	dlg_set = alloc_dlgset_node();
+	dlg_set = alloc_dlgset_node(shard);
 	pj_list_init(&dlg_set->dlg_list);
 	pj_list_push_back(&dlg_set->dlg_list, dlg);
 
 	dlg->dlg_set = dlg_set;
 
-	pj_hash_set_np_lower(mod_ua.dlg_table, 
+	pj_hash_set_np_lower(shard->dlg_table, 
 		             dlg->local.info->tag.ptr,
                              (unsigned)dlg->local.info->tag.slen,
 		             dlg->local.tag_hval, dlg_set->ht_entry, dlg_set);
     }
 
-    /* Unlock user agent. */
-    pj_mutex_unlock(mod_ua.mutex);
+    /* Unlock the shard. */
+    pj_mutex_unlock(shard->mutex);
 
     /* Done. */
     return PJ_SUCCESS;
@@ -362,6 +458,7 @@ PJ_DEF(pj_status_t) pjsip_ua_unregister_dlg( pjsip_user_agent *ua,
 					     pjsip_dialog *dlg )
 {
     struct dlg_set *dlg_set;
+    dlg_shard *shard;
     pjsip_dialog *d;
 
     /* Sanity-check arguments. */
@@ -370,11 +467,12 @@ PJ_DEF(pj_status_t) pjsip_ua_unregister_dlg( pjsip_user_agent *ua,
     /* Check that dialog has been registered. */
     PJ_ASSERT_RETURN(dlg->dlg_set, PJ_EINVALIDOP);
 
-    /* Lock user agent. */
-    pj_mutex_lock(mod_ua.mutex);
+    /* Lock the shard where the dialog set is registered. */
+    dlg_set = (struct dlg_set*) dlg->dlg_set;
+    shard = dlg_set->shard;
+    pj_mutex_lock(shard->mutex);
 
     /* Find this dialog from the dialog set. */
-    dlg_set = (struct dlg_set*) dlg->dlg_set;
     d = dlg_set->dlg_list.next;
     while (d != (pjsip_dialog*)&dlg_set->dlg_list && d != dlg) {
 	d = d->next;
@@ -382,7 +480,7 @@ PJ_DEF(pj_status_t) pjsip_ua_unregister_dlg( pjsip_user_agent *ua,
 
     if (d != dlg) {
 	pj_assert(!"Dialog is not registered!");
-	pj_mutex_unlock(mod_ua.mutex);
+	pj_mutex_unlock(shard->mutex);
 	return PJ_EINVALIDOP;
     }
 
@@ -391,16 +489,16 @@ PJ_DEF(pj_status_t) pjsip_ua_unregister_dlg( pjsip_user_agent *ua,
 
     /* If dialog list is empty, remove the dialog set from the hash table. */
     if (pj_list_empty(&dlg_set->dlg_list)) {
-	pj_hash_set_lower(NULL, mod_ua.dlg_table, dlg->local.info->tag.ptr,
+	pj_hash_set_lower(NULL, shard->dlg_table, dlg->local.info->tag.ptr,
 		          (unsigned)dlg->local.info->tag.slen, 
 			  dlg->local.tag_hval, NULL);
 
 	/* Return dlg_set to free nodes. */
-	pj_list_push_back(&mod_ua.free_dlgset_nodes, dlg_set);
+	pj_list_push_back(&shard->free_dlgset_nodes, dlg_set);
     }
 
-    /* Unlock user agent. */
-    pj_mutex_unlock(mod_ua.mutex);
+    /* Unlock the shard. */
+    pj_mutex_unlock(shard->mutex);
 
     /* Done. */
     return PJ_SUCCESS;
@@ -429,13 +527,17 @@ PJ_DEF(pjsip_dialog*) pjsip_tsx_get_dlg( pjsip_transaction *tsx )
  */
 PJ_DEF(unsigned) pjsip_ua_get_dlg_set_count(void)
 {
-    unsigned count;
+    unsigned i, count = 0;
 
     PJ_ASSERT_RETURN(mod_ua.endpt, 0);
 
-    pj_mutex_lock(mod_ua.mutex);
-    count = pj_hash_count(mod_ua.dlg_table);
-    pj_mutex_unlock(mod_ua.mutex);
+    for (i=0; i<mod_ua.shard_cnt; ++i) {
+	dlg_shard *shard = &mod_ua.shards[i];
+
+	pj_mutex_lock(shard->mutex);
+	count += pj_hash_count(shard->dlg_table);
+	pj_mutex_unlock(shard->mutex);
+    }
 
     return count;
 }
@@ -450,20 +552,22 @@ PJ_DEF(pjsip_dialog*) pjsip_ua_find_dialog(const pj_str_t *call_id,
 					   pj_bool_t lock_dialog)
 {
     struct dlg_set *dlg_set;
+    dlg_shard *shard;
     pjsip_dialog *dlg;
 
     PJ_ASSERT_RETURN(call_id && local_tag && remote_tag, NULL);
 
-    /* Lock user agent. */
-    pj_mutex_lock(mod_ua.mutex);
+    /* Lock the shard of the Call-ID. */
+    shard = get_shard(call_id);
+    pj_mutex_lock(shard->mutex);
 
     /* Lookup the dialog set. */
     dlg_set = (struct dlg_set*)
-    	      pj_hash_get_lower(mod_ua.dlg_table, local_tag->ptr,
+    	      pj_hash_get_lower(shard->dlg_table, local_tag->ptr,
                                 (unsigned)local_tag->slen, NULL);
     if (dlg_set == NULL) {
 	/* Not found */
-	pj_mutex_unlock(mod_ua.mutex);
+	pj_mutex_unlock(shard->mutex);
 	return NULL;
     }
 
@@ -479,7 +583,7 @@ PJ_DEF(pjsip_dialog*) pjsip_ua_find_dialog(const pj_str_t *call_id,
 
     if (dlg == (pjsip_dialog*)&dlg_set->dlg_list) {
 	/* Not found */
-	pj_mutex_unlock(mod_ua.mutex);
+	pj_mutex_unlock(shard->mutex);
 	return NULL;
     }
 
@@ -489,7 +593,7 @@ PJ_DEF(pjsip_dialog*) pjsip_ua_find_dialog(const pj_str_t *call_id,
 	PJ_LOG(6, (THIS_FILE, "Dialog not found: local and remote tags "
 		              "matched but not call id"));
 
-        pj_mutex_unlock(mod_ua.mutex);
+        pj_mutex_unlock(shard->mutex);
         return NULL;
     }
 
@@ -497,26 +601,26 @@ PJ_DEF(pjsip_dialog*) pjsip_ua_find_dialog(const pj_str_t *call_id,
 	if (pjsip_dlg_try_inc_lock(dlg) != PJ_SUCCESS) {
 
 	    /*
-	     * Unable to acquire dialog's lock while holding the user
-	     * agent's mutex. Release the UA mutex before retrying once
+	     * Unable to acquire dialog's lock while holding the shard's
+	     * mutex. Release the shard mutex before retrying once
 	     * more.
 	     *
 	     * THIS MAY CAUSE RACE CONDITION!
 	     */
 
-	    /* Unlock user agent. */
-	    pj_mutex_unlock(mod_ua.mutex);
+	    /* Unlock the shard. */
+	    pj_mutex_unlock(shard->mutex);
 	    /* Lock dialog */
 	    pjsip_dlg_inc_lock(dlg);
 
 	} else {
-	    /* Unlock user agent. */
-	    pj_mutex_unlock(mod_ua.mutex);
+	    /* Unlock the shard. */
+	    pj_mutex_unlock(shard->mutex);
 	}
 
     } else {
-	/* Unlock user agent. */
-	pj_mutex_unlock(mod_ua.mutex);
+	/* Unlock the shard. */
+	pj_mutex_unlock(shard->mutex);
     }
 
     return dlg;
@@ -525,8 +629,10 @@ PJ_DEF(pjsip_dialog*) pjsip_ua_find_dialog(const pj_str_t *call_id,
 
 /*
  * Find the first dialog in dialog set in hash table for an incoming message.
+ * The shard of the message's Call-ID must be locked.
  */
-static struct dlg_set *find_dlg_set_for_msg( pjsip_rx_data *rdata )
+static struct dlg_set *find_dlg_set_for_msg( dlg_shard *shard,
+					     pjsip_rx_data *rdata )
 {
     /* CANCEL message doesn't have To tag, so we must lookup the dialog
      * by finding the INVITE UAS transaction being cancelled.
@@ -579,7 +685,7 @@ static struct dlg_set *find_dlg_set_for_msg( pjsip_rx_data *rdata )
 
 	/* Lookup the dialog set. */
 	dlg_set = (struct dlg_set*)
-		  pj_hash_get_lower(mod_ua.dlg_table, tag->ptr, 
+		  pj_hash_get_lower(shard->dlg_table, tag->ptr, 
 				    (unsigned)tag->slen, NULL);
 	return dlg_set;
     }
@@ -589,6 +695,7 @@ static struct dlg_set *find_dlg_set_for_msg( pjsip_rx_data *rdata )
 static pj_bool_t mod_ua_on_rx_request(pjsip_rx_data *rdata)
 {
     struct dlg_set *dlg_set;
+    dlg_shard *shard;
     pj_str_t *from_tag;
     pjsip_dialog *dlg;
     pj_status_t status;
@@ -606,20 +713,22 @@ static pj_bool_t mod_ua_on_rx_request(pjsip_rx_data *rdata)
     if (rdata->msg_info.msg->line.req.method.id == PJSIP_REGISTER_METHOD)
 	return PJ_FALSE;
 
+    shard = get_shard(&rdata->msg_info.cid->id);
+
 retry_on_deadlock:
 
-    /* Lock user agent before looking up the dialog hash table. */
-    pj_mutex_lock(mod_ua.mutex);
+    /* Lock the shard before looking up the dialog hash table. */
+    pj_mutex_lock(shard->mutex);
 
     /* Lookup the dialog set, based on the To tag header. */
-    dlg_set = find_dlg_set_for_msg(rdata);
+    dlg_set = find_dlg_set_for_msg(shard, rdata);
 
     /* If dialog is not found, respond with 481 (Call/Transaction
      * Does Not Exist).
      */
     if (dlg_set == NULL) {
 	/* Unable to find dialog. */
-	pj_mutex_unlock(mod_ua.mutex);
+	pj_mutex_unlock(shard->mutex);
 
 	if (rdata->msg_info.msg->line.req.method.id != PJSIP_ACK_METHOD) {
 	    PJ_LOG(5,(THIS_FILE, 
@@ -660,7 +769,7 @@ retry_on_deadlock:
 
 	if (first_dlg->remote.info->tag.slen != 0) {
 	    /* Not found. Mulfunction UAC? */
-	    pj_mutex_unlock(mod_ua.mutex);
+	    pj_mutex_unlock(shard->mutex);
 
 	    if (rdata->msg_info.msg->line.req.method.id != PJSIP_ACK_METHOD) {
 		PJ_LOG(5,(THIS_FILE, 
@@ -689,16 +798,16 @@ retry_on_deadlock:
     status = pjsip_dlg_try_inc_lock(dlg);
     if (status != PJ_SUCCESS) {
 	/* Failed to acquire dialog mutex immediately, this could be 
-	 * because of deadlock. Release UA mutex, yield, and retry 
+	 * because of deadlock. Release shard mutex, yield, and retry 
 	 * the whole thing once again.
 	 */
-	pj_mutex_unlock(mod_ua.mutex);
+	pj_mutex_unlock(shard->mutex);
 	pj_thread_sleep(0);
 	goto retry_on_deadlock;
     }
 
     /* Done with processing in UA layer, release lock */
-    pj_mutex_unlock(mod_ua.mutex);
+    pj_mutex_unlock(shard->mutex);
 
     /* Pass to dialog. */
     pjsip_dlg_on_rx_request(dlg, rdata);
@@ -717,6 +826,7 @@ static pj_bool_t mod_ua_on_rx_response(pjsip_rx_data *rdata)
 {
     pjsip_transaction *tsx;
     struct dlg_set *dlg_set;
+    dlg_shard *shard;
     pjsip_dialog *dlg;
     pj_status_t status;
 
@@ -730,12 +840,14 @@ static pj_bool_t mod_ua_on_rx_response(pjsip_rx_data *rdata)
      * the response is a forked response.
      */
 
+    shard = get_shard(&rdata->msg_info.cid->id);
+
 retry_on_deadlock:
 
     dlg = NULL;
 
-    /* Lock user agent dlg table before we're doing anything. */
-    pj_mutex_lock(mod_ua.mutex);
+    /* Lock the shard of dlg table before we're doing anything. */
+    pj_mutex_lock(shard->mutex);
 
     /* Check if transaction is present. */
     tsx = pjsip_rdata_get_tsx(rdata);
@@ -744,7 +856,7 @@ retry_on_deadlock:
 	dlg = pjsip_tsx_get_dlg(tsx);
 	if (!dlg) {
 	    /* Unlock dialog hash table. */
-	    pj_mutex_unlock(mod_ua.mutex);
+	    pj_mutex_unlock(shard->mutex);
 	    return PJ_FALSE;
 	}
 
@@ -771,21 +883,21 @@ retry_on_deadlock:
 	     * or a very late response.
 	     */
 	    /* Unlock dialog hash table. */
-	    pj_mutex_unlock(mod_ua.mutex);
+	    pj_mutex_unlock(shard->mutex);
 	    return PJ_FALSE;
 	}
 
 
 	/* Get the dialog set. */
 	dlg_set = (struct dlg_set*)
-		  pj_hash_get_lower(mod_ua.dlg_table, 
+		  pj_hash_get_lower(shard->dlg_table, 
 			            rdata->msg_info.from->tag.ptr,
 			            (unsigned)rdata->msg_info.from->tag.slen,
 			            NULL);
 
 	if (!dlg_set) {
 	    /* Unlock dialog hash table. */
-	    pj_mutex_unlock(mod_ua.mutex);
+	    pj_mutex_unlock(shard->mutex);
 
 	    /* Strayed 2xx response!! */
 	    PJ_LOG(4,(THIS_FILE, 
@@ -855,7 +967,7 @@ retry_on_deadlock:
 		dlg = (*mod_ua.param.on_dlg_forked)(dlg_set->dlg_list.next, 
 						    rdata);
 		if (dlg == NULL) {
-		    pj_mutex_unlock(mod_ua.mutex);
+		    pj_mutex_unlock(shard->mutex);
 		    return PJ_TRUE;
 		}
 	    } else {
@@ -899,15 +1011,15 @@ retry_on_deadlock:
     if (status != PJ_SUCCESS) {
 	/* Failed to acquire dialog mutex. This could indicate a deadlock
 	 * situation, and for safety, try to avoid deadlock by releasing
-	 * UA mutex, yield, and retry the whole processing once again.
+	 * shard mutex, yield, and retry the whole processing once again.
 	 */
-	pj_mutex_unlock(mod_ua.mutex);
+	pj_mutex_unlock(shard->mutex);
 	pj_thread_sleep(0);
 	goto retry_on_deadlock;
     }
 
     /* We're done with processing in the UA layer, we can release the mutex */
-    pj_mutex_unlock(mod_ua.mutex);
+    pj_mutex_unlock(shard->mutex);
 
     /* Pass the response to the dialog. */
     pjsip_dlg_on_rx_response(dlg, rdata);
@@ -953,21 +1065,29 @@ PJ_DEF(void) pjsip_ua_dump(pj_bool_t detail)
 #if PJ_LOG_MAX_LEVEL >= 3
     pj_hash_iterator_t itbuf, *it;
     char dlginfo[128];
-
-    pj_mutex_lock(mod_ua.mutex);
+    unsigned i;
 
     PJ_LOG(3, (THIS_FILE, "Number of dialog sets: %u", 
-			  pj_hash_count(mod_ua.dlg_table)));
+			  pjsip_ua_get_dlg_set_count()));
+
+    for (i=0; detail && i<mod_ua.shard_cnt; ++i) {
+	dlg_shard *shard = &mod_ua.shards[i];
 
-    if (detail && pj_hash_count(mod_ua.dlg_table)) {
-	PJ_LOG(3, (THIS_FILE, "Dumping dialog sets:"));
-	it = pj_hash_first(mod_ua.dlg_table, &itbuf);
-	for (; it != NULL; it = pj_hash_next(mod_ua.dlg_table, it))  {
+	pj_mutex_lock(shard->mutex);
+
+	if (pj_hash_count(shard->dlg_table) == 0) {
+	    pj_mutex_unlock(shard->mutex);
+	    continue;
+	}
+
+	PJ_LOG(3, (THIS_FILE, "Dumping dialog sets (shard %u):", i));
+	it = pj_hash_first(shard->dlg_table, &itbuf);
+	for (; it != NULL; it = pj_hash_next(shard->dlg_table, it))  {
 	    struct dlg_set *dlg_set;
 	    pjsip_dialog *dlg;
 	    const char *title;
 
-	    dlg_set = (struct dlg_set*) pj_hash_this(mod_ua.dlg_table, it);
+	    dlg_set = (struct dlg_set*) pj_hash_this(shard->dlg_table, it);
 	    if (!dlg_set || pj_list_empty(&dlg_set->dlg_list)) continue;
 
 	    /* First dialog in dialog set. */
@@ -987,9 +1107,9 @@ PJ_DEF(void) pjsip_ua_dump(pj_bool_t detail)
 		dlg = dlg->next;
 	    }
 	}
-    }
 
-    pj_mutex_unlock(mod_ua.mutex);
+	pj_mutex_unlock(shard->mutex);
+    }
 #endif
 }
 
@@ -1390,6 +1390,9 @@ PJ_DEF(pj_status_t) pjsip_endpt_send_request_stateless(pjsip_endpoint *endpt,
 
     PJ_ASSERT_RETURN(endpt && tdata, PJ_EINVAL);
 
+    /* The resolver may complete in another thread */
+    pjsip_tx_data_own_buf(tdata);
+
     /* Get destination name to contact. */
     status = pjsip_process_route_set(tdata, &dest_info);
     if (status != PJ_SUCCESS)
@@ -1774,6 +1777,9 @@ PJ_DEF(pj_status_t) pjsip_endpt_send_response( pjsip_endpoint *endpt,
     pjsip_send_state *send_state;
     pj_status_t status;
 
+    /* The resolver may complete in another thread */
+    pjsip_tx_data_own_buf(tdata);
+
     /* Create structure to keep the sending state. */
     send_state = PJ_POOL_ZALLOC_T(tdata->pool, pjsip_send_state);
     send_state->endpt = endpt;
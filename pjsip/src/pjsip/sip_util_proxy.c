@@ -30,6 +30,144 @@
 #include <pjlib-util/md5.h>
 
 
+/* State to copy the unchanged headers of a message parsed in lazy mode
+ * as raw text. The headers refer to the packet buffer of the rdata (see
+ * pjsip_rx_data_lend_buf()), so that adjacent lines are printed with one
+ * copy.
+ */
+typedef struct raw_fwd
+{
+    char			*pkt;	    /* Received packet, or NULL.    */
+    pj_ssize_t			 len;	    /* Length of the packet.	    */
+    const pjsip_parser_raw_hdr	*raw_hdr;   /* Next raw header line.	    */
+    const pjsip_parser_raw_hdr	*raw_end;   /* End of raw header list.	    */
+} raw_fwd;
+
+static void raw_fwd_init(raw_fwd *rf, pjsip_tx_data *tdata,
+			 pjsip_rx_data *rdata)
+{
+    const pjsip_parser_raw_hdr *list = &rdata->msg_info.raw_hdr;
+
+    pj_bzero(rf, sizeof(*rf));
+
+    /* Raw header lines are only recorded in lazy parsing mode */
+    if (list->next == NULL || pj_list_empty(list) ||
+	rdata->msg_info.msg_buf == NULL || rdata->msg_info.len <= 0)
+    {
+	return;
+    }
+
+    if (pjsip_rx_data_lend_buf(rdata, tdata) != PJ_SUCCESS)
+	return;
+
+    rf->pkt = rdata->msg_info.msg_buf;
+    rf->len = rdata->msg_info.len;
+    rf->raw_hdr = list->next;
+    rf->raw_end = list;
+}
+
+/* Check that a string is in the packet. */
+static pj_bool_t raw_fwd_in_pkt(const raw_fwd *rf, const pj_str_t *str)
+{
+    return str->ptr >= rf->pkt && str->ptr + str->slen <= rf->pkt + rf->len;
+}
+
+/* Create lazy header for the unchanged header line starting at *p_hsrc,
+ * and move *p_hsrc to the last header parsed from the line. Returns NULL
+ * if the line can't be copied as raw text, e.g. when one of its headers
+ * needs to be modified or removed (skip).
+ */
+static pjsip_hdr *raw_fwd_clone(raw_fwd *rf, pj_pool_t *pool,
+				const pjsip_hdr **p_hsrc,
+				const pjsip_hdr *end,
+				const pjsip_hdr *skip)
+{
+    const pjsip_hdr *hsrc = *p_hsrc, *last;
+    const pjsip_parser_raw_hdr *raw_hdr;
+    unsigned i;
+
+    if (!rf->pkt)
+	return NULL;
+
+    /* Lazy header which has not been parsed */
+    if (pjsip_hdr_is_lazy(hsrc)) {
+	const pjsip_lazy_hdr *lhdr = (const pjsip_lazy_hdr*)hsrc;
+
+	if (!raw_fwd_in_pkt(rf, &hsrc->name) ||
+	    !raw_fwd_in_pkt(rf, &lhdr->hvalue))
+	{
+	    return NULL;
+	}
+	return (pjsip_hdr*) pjsip_lazy_hdr_create(pool, &hsrc->name,
+						  &lhdr->hvalue);
+    }
+
+    /* Parsed header line. The header list of the message may have been
+     * changed, so skip the lines whose header is no longer found.
+     */
+    raw_hdr = rf->raw_hdr;
+    while (raw_hdr != rf->raw_end && raw_hdr->hdr != hsrc)
+	raw_hdr = raw_hdr->next;
+    if (raw_hdr == rf->raw_end)
+	return NULL;
+    rf->raw_hdr = raw_hdr->next;
+
+    /* All headers parsed from the line must be forwarded unchanged */
+    last = hsrc;
+    for (i=0; i<raw_hdr->cnt; ++i) {
+	if (last == end || last == skip ||
+	    last->type == PJSIP_H_MAX_FORWARDS ||
+	    last->type == PJSIP_H_CONTENT_LENGTH ||
+	    last->type == PJSIP_H_CONTENT_TYPE)
+	{
+	    return NULL;
+	}
+	if (i+1 < raw_hdr->cnt)
+	    last = last->next;
+    }
+
+    if (!raw_fwd_in_pkt(rf, &raw_hdr->name) ||
+	!raw_fwd_in_pkt(rf, &raw_hdr->value))
+    {
+	return NULL;
+    }
+
+    /* The headers of the received message must not have been modified in
+     * place (see PJSIP_PARSE_LAZY), or the changes would be lost.
+     */
+    pj_assert(pjsip_parser_raw_hdr_check(raw_hdr));
+
+    *p_hsrc = last;
+    return (pjsip_hdr*) pjsip_lazy_hdr_create(pool, &raw_hdr->name,
+					      &raw_hdr->value);
+}
+
+/* Clone message body, sharing the packet buffer if possible. */
+static pjsip_msg_body *raw_fwd_clone_body(const raw_fwd *rf, pj_pool_t *pool,
+					  const pjsip_msg_body *src)
+{
+    pjsip_msg_body *body;
+    pj_str_t data;
+
+    data.ptr = (char*)src->data;
+    data.slen = src->len;
+
+    if (!rf->pkt || src->print_body != &pjsip_print_text_body ||
+	!raw_fwd_in_pkt(rf, &data))
+    {
+	return pjsip_msg_body_clone(pool, src);
+    }
+
+    body = PJ_POOL_ZALLOC_T(pool, pjsip_msg_body);
+    pjsip_media_type_cp(pool, &body->content_type, &src->content_type);
+    body->data = data.ptr;
+    body->len = src->len;
+    body->print_body = src->print_body;
+    body->clone_data = src->clone_data;
+    return body;
+}
+
+
 /**
  * Clone the incoming SIP request or response message. A forwarding proxy
  * typically would need to clone the incoming SIP message before processing
@@ -122,6 +260,9 @@ PJ_DEF(pj_status_t) pjsip_endpt_create_request_fwd(pjsip_endpoint *endpt,
 	pjsip_msg *dst;
 	const pjsip_msg *src = rdata->msg_info.msg;
 	const pjsip_hdr *hsrc;
+	raw_fwd rf;
+
+	raw_fwd_init(&rf, tdata, rdata);
 
 	/* Create the request */
 	tdata->msg = dst = pjsip_msg_create(tdata->pool, PJSIP_REQUEST_MSG);
@@ -197,8 +338,13 @@ PJ_DEF(pj_status_t) pjsip_endpt_create_request_fwd(pjsip_endpoint *endpt,
 	    }
 #endif
 
-	    /* Clone the header */
-	    hdst = (pjsip_hdr*) pjsip_hdr_clone(tdata->pool, hsrc);
+	    /* Clone the header, as raw text if it's unchanged. The top Via
+	     * has been updated by the transport (received and rport).
+	     */
+	    hdst = raw_fwd_clone(&rf, tdata->pool, &hsrc, &src->hdr,
+				 (pjsip_hdr*)rdata->msg_info.via);
+	    if (!hdst)
+		hdst = (pjsip_hdr*) pjsip_hdr_clone(tdata->pool, hsrc);
 
 	    /* If this is Max-Forward header, decrement the value */
 	    if (hdst->type == PJSIP_H_MAX_FORWARDS) {
@@ -225,7 +371,7 @@ PJ_DEF(pj_status_t) pjsip_endpt_create_request_fwd(pjsip_endpoint *endpt,
 
 	/* Clone request body */
 	if (src->body) {
-	    dst->body = pjsip_msg_body_clone(tdata->pool, src->body);
+	    dst->body = raw_fwd_clone_body(&rf, tdata->pool, src->body);
 	}
 
     }
@@ -267,6 +413,9 @@ PJ_DEF(pj_status_t) pjsip_endpt_create_response_fwd( pjsip_endpoint *endpt,
 	pjsip_msg *dst;
 	const pjsip_msg *src = rdata->msg_info.msg;
 	const pjsip_hdr *hsrc;
+	raw_fwd rf;
+
+	raw_fwd_init(&rf, tdata, rdata);
 
 	/* Create the request */
 	tdata->msg = dst = pjsip_msg_create(tdata->pool, PJSIP_RESPONSE_MSG);
@@ -279,6 +428,7 @@ PJ_DEF(pj_status_t) pjsip_endpt_create_response_fwd( pjsip_endpoint *endpt,
 	/* Duplicate all headers */
 	hsrc = src->hdr.next;
 	while (hsrc != &src->hdr) {
+	    pjsip_hdr *hdst;
 	    
 	    /* Skip Content-Type and Content-Length as these would be 
 	     * generated when the the message is printed.
@@ -297,15 +447,20 @@ PJ_DEF(pj_status_t) pjsip_endpt_create_response_fwd( pjsip_endpoint *endpt,
 		continue;
 	    }
 
-	    pjsip_msg_add_hdr(dst, 
-	    		      (pjsip_hdr*)pjsip_hdr_clone(tdata->pool, hsrc));
+	    /* Clone the header, as raw text if it's unchanged */
+	    hdst = raw_fwd_clone(&rf, tdata->pool, &hsrc, &src->hdr,
+				 (pjsip_hdr*)rdata->msg_info.via);
+	    if (!hdst)
+		hdst = (pjsip_hdr*) pjsip_hdr_clone(tdata->pool, hsrc);
+
+	    pjsip_msg_add_hdr(dst, hdst);
 
 	    hsrc = hsrc->next;
 	}
 
 	/* Clone message body */
 	if (src->body)
-	    dst->body = pjsip_msg_body_clone(tdata->pool, src->body);
+	    dst->body = raw_fwd_clone_body(&rf, tdata->pool, src->body);
 
 
     }
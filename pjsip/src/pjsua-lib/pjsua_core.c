@@ -796,16 +796,13 @@ static int worker_thread(void *arg)
 /* Timer heap worker thread function. */
 static int worker_thread_timer(void *arg)
 {
-    pj_timer_heap_t *th;
-
     PJ_UNUSED_ARG(arg);
 
-    th = pjsip_endpt_get_timer_heap(pjsua_var.endpt);
     while (!pjsua_var.thread_quit_flag) {
 	pj_time_val timeout = {0, 0};
-	int c;
+	unsigned c;
 
-	c = pj_timer_heap_poll(th, &timeout);
+	c = pjsip_endpt_poll_timers(pjsua_var.endpt, &timeout);
 	if (c == 0) {
 	    /* Sleep if no event */
 	    enum { MAX_SLEEP_MS = 100 };
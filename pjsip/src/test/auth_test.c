@@ -0,0 +1,441 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "test.h"
+#include <pjsip.h>
+#include <pjsip/sip_auth_parser.h>
+#include <pjlib.h>
+
+#define THIS_FILE   "auth_test.c"
+
+/*
+ * Digest authentication: the server with signed nonces, nonce-count
+ * checking, SHA-256 and the credential cache, and the client answering
+ * it on refreshes.
+ */
+
+static pjsip_auth_srv auth_srv;
+
+/* Account lookup, the test may change the password or delete the account */
+static unsigned lookup_cnt;
+static pj_str_t acc_password = { "password", 8 };
+static pj_bool_t acc_deleted;
+
+static pj_status_t auth_lookup(pj_pool_t *pool,
+			       const pjsip_auth_lookup_cred_param *param,
+			       pjsip_cred_info *cred_info)
+{
+    ++lookup_cnt;
+
+    if (acc_deleted || pj_strcmp2(&param->acc_name, "user") != 0)
+	return PJSIP_EAUTHACCNOTFOUND;
+
+    pj_bzero(cred_info, sizeof(*cred_info));
+    pj_strdup(pool, &cred_info->realm, &param->realm);
+    cred_info->scheme = pj_str("digest");
+    cred_info->username = pj_str("user");
+    cred_info->data_type = PJSIP_CRED_DATA_PLAIN_PASSWD;
+    cred_info->data = acc_password;
+    return PJ_SUCCESS;
+}
+
+/* Have the server verify a REGISTER with the authorization created from
+ * the nonce and the password.
+ */
+static pj_status_t auth_verify(pj_pool_t *pool, const pj_str_t *nonce,
+			       pjsip_auth_algorithm_type algorithm,
+			       const char *nc, const char *password)
+{
+    const pj_str_t uri = pj_str("sip:pjsip.org");
+    const pj_str_t method = pj_str("REGISTER");
+    const pj_str_t cnonce = pj_str("abcdef");
+    const pj_str_t realm = pj_str("test");
+    pj_str_t nc_str = pj_str((char*)nc);
+    pjsip_cred_info cred;
+    char digest_buf[PJSIP_SHA256STRLEN];
+    pj_str_t digest;
+    pjsip_rx_data rdata;
+    char *msg;
+    int len, code;
+    pj_status_t status;
+
+    pj_bzero(&cred, sizeof(cred));
+    cred.username = pj_str("user");
+    cred.data_type = PJSIP_CRED_DATA_PLAIN_PASSWD;
+    cred.data = pj_str((char*)password);
+
+    digest.ptr = digest_buf;
+    digest.slen = sizeof(digest_buf);
+    status = pjsip_auth_create_digest2(&digest, nonce, &nc_str, &cnonce,
+				       &pjsip_AUTH_STR, &uri, &realm, &cred,
+				       &method, algorithm);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    msg = (char*) pj_pool_alloc(pool, 1000);
+    len = pj_ansi_snprintf(msg, 1000,
+	"REGISTER sip:pjsip.org SIP/2.0\r\n"
+	"Via: SIP/2.0/UDP 127.0.0.1;branch=z9hG4bKauth-srv\r\n"
+	"From: <sip:user@pjsip.org>;tag=auth-srv\r\n"
+	"To: <sip:user@pjsip.org>\r\n"
+	"Call-ID: auth-srv-test\r\n"
+	"CSeq: 1 REGISTER\r\n"
+	"Authorization: Digest username=\"user\", realm=\"test\", "
+	"nonce=\"%.*s\", uri=\"sip:pjsip.org\", response=\"%.*s\", "
+	"algorithm=%s, qop=auth, nc=%s, cnonce=\"abcdef\"\r\n"
+	"Content-Length: 0\r\n"
+	"\r\n",
+	(int)nonce->slen, nonce->ptr, (int)digest.slen, digest.ptr,
+	(algorithm == PJSIP_AUTH_ALGORITHM_SHA256 ? "SHA-256" : "MD5"), nc);
+
+    pj_bzero(&rdata, sizeof(rdata));
+    rdata.tp_info.pool = pool;
+    pj_list_init(&rdata.msg_info.parse_err);
+    if (!pjsip_parse_rdata(msg, len, &rdata))
+	return PJSIP_EINVALIDMSG;
+
+    return pjsip_auth_srv_verify(&auth_srv, &rdata, &code);
+}
+
+static int auth_srv_test(void)
+{
+    pj_pool_t *pool;
+    pjsip_tx_data *tdata;
+    pjsip_www_authenticate_hdr *hchal;
+    pj_str_t nonce, bad_nonce;
+    pj_str_t user = pj_str("user");
+    int rc = 0;
+    pj_status_t status;
+
+    PJ_LOG(3,(THIS_FILE, "  server authentication"));
+
+    pool = pjsip_endpt_create_pool(endpt, "auth-srv", 4000, 4000);
+
+    /* Challenge: SHA-256 must be offered first */
+    status = pjsip_endpt_create_tdata(endpt, &tdata);
+    if (status != PJ_SUCCESS) {
+	rc = -200;
+	goto on_return;
+    }
+    pjsip_tx_data_add_ref(tdata);
+    tdata->msg = pjsip_msg_create(tdata->pool, PJSIP_RESPONSE_MSG);
+    pjsip_auth_srv_challenge(&auth_srv, NULL, NULL, NULL, PJ_FALSE, tdata);
+    hchal = (pjsip_www_authenticate_hdr*)
+	    pjsip_msg_find_hdr(tdata->msg, PJSIP_H_WWW_AUTHENTICATE, NULL);
+    if (!hchal || pj_strcmp(&hchal->challenge.digest.algorithm,
+			    &pjsip_SHA256_STR) != 0 ||
+	!pjsip_msg_find_hdr(tdata->msg, PJSIP_H_WWW_AUTHENTICATE, hchal->next))
+    {
+	pjsip_tx_data_dec_ref(tdata);
+	rc = -205;
+	goto on_return;
+    }
+    pj_strdup(pool, &nonce, &hchal->challenge.digest.nonce);
+
+    /* A nonce of the application would never be accepted */
+    status = pjsip_auth_srv_challenge(&auth_srv, NULL, &nonce, NULL,
+				      PJ_FALSE, tdata);
+    pjsip_tx_data_dec_ref(tdata);
+    if (status != PJ_EINVALIDOP) {
+	PJ_LOG(3,(THIS_FILE, "   error: challenge with the given nonce"));
+	rc = -207;
+	goto on_return;
+    }
+
+    /* First use of the nonce looks up the account */
+    lookup_cnt = 0;
+    status = auth_verify(pool, &nonce, PJSIP_AUTH_ALGORITHM_SHA256,
+			 "00000001", "password");
+    if (status != PJ_SUCCESS || lookup_cnt != 1) {
+	app_perror("   error: first authorization", status);
+	rc = -210;
+	goto on_return;
+    }
+
+    /* Replay must be rejected as stale */
+    status = auth_verify(pool, &nonce, PJSIP_AUTH_ALGORITHM_SHA256,
+			 "00000001", "password");
+    if (status != PJSIP_EAUTHSTALENONCE) {
+	app_perror("   error: replayed authorization", status);
+	rc = -220;
+	goto on_return;
+    }
+
+    /* Next nonce-count with MD5 is served from the cache */
+    status = auth_verify(pool, &nonce, PJSIP_AUTH_ALGORITHM_MD5,
+			 "00000002", "password");
+    if (status != PJ_SUCCESS || lookup_cnt != 1) {
+	app_perror("   error: cached authorization", status);
+	rc = -230;
+	goto on_return;
+    }
+
+    /* Forged nonce */
+    pj_strdup(pool, &bad_nonce, &nonce);
+    bad_nonce.ptr[0] = (char)(bad_nonce.ptr[0] == '0' ? '1' : '0');
+    status = auth_verify(pool, &bad_nonce, PJSIP_AUTH_ALGORITHM_MD5,
+			 "00000001", "password");
+    if (status != PJSIP_EAUTHINNONCE) {
+	app_perror("   error: forged nonce", status);
+	rc = -240;
+	goto on_return;
+    }
+
+    /* Changed password is picked up although the old one is cached */
+    acc_password = pj_str("changed");
+    status = auth_verify(pool, &nonce, PJSIP_AUTH_ALGORITHM_SHA256,
+			 "00000003", "changed");
+    if (status != PJ_SUCCESS || lookup_cnt != 2) {
+	app_perror("   error: changed password", status);
+	rc = -250;
+	goto on_return;
+    }
+
+    /* ..and the old password doesn't work anymore */
+    status = auth_verify(pool, &nonce, PJSIP_AUTH_ALGORITHM_SHA256,
+			 "00000004", "password");
+    if (status != PJSIP_EAUTHINVALIDDIGEST) {
+	app_perror("   error: old password", status);
+	rc = -260;
+	goto on_return;
+    }
+
+    /* Deleted account is rejected once it's invalidated */
+    status = auth_verify(pool, &nonce, PJSIP_AUTH_ALGORITHM_SHA256,
+			 "00000005", "changed");
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: authorization before deletion", status);
+	rc = -270;
+	goto on_return;
+    }
+    acc_deleted = PJ_TRUE;
+    pjsip_auth_srv_invalidate(&auth_srv, &user);
+    status = auth_verify(pool, &nonce, PJSIP_AUTH_ALGORITHM_SHA256,
+			 "00000006", "changed");
+    if (status != PJSIP_EAUTHACCNOTFOUND) {
+	app_perror("   error: deleted account", status);
+	rc = -280;
+	goto on_return;
+    }
+
+    /* Invalidating all accounts makes the next request look up again */
+    acc_deleted = PJ_FALSE;
+    status = auth_verify(pool, &nonce, PJSIP_AUTH_ALGORITHM_SHA256,
+			 "00000007", "changed");
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: authorization after deletion", status);
+	rc = -290;
+	goto on_return;
+    }
+    lookup_cnt = 0;
+    pjsip_auth_srv_invalidate(&auth_srv, NULL);
+    status = auth_verify(pool, &nonce, PJSIP_AUTH_ALGORITHM_SHA256,
+			 "00000008", "changed");
+    if (status != PJ_SUCCESS || lookup_cnt != 1) {
+	app_perror("   error: authorization after flushing", status);
+	rc = -295;
+	goto on_return;
+    }
+
+on_return:
+    acc_password = pj_str("password");
+    acc_deleted = PJ_FALSE;
+    pjsip_auth_srv_invalidate(&auth_srv, NULL);
+    pj_pool_release(pool);
+    return rc;
+}
+
+/* Client authentication: refreshes reuse the HA1 and the header template */
+#define CLT_REFRESH_CNT	    100
+
+static pj_status_t auth_clt_verify(pj_pool_t *pool, pjsip_tx_data *tdata)
+{
+    pjsip_rx_data rdata;
+    char *msg;
+    int len, code;
+
+    msg = (char*) pj_pool_alloc(pool, PJSIP_MAX_PKT_LEN);
+    len = pjsip_msg_print(tdata->msg, msg, PJSIP_MAX_PKT_LEN);
+    if (len < 1)
+	return PJSIP_EMSGTOOLONG;
+
+    pj_bzero(&rdata, sizeof(rdata));
+    rdata.tp_info.pool = pool;
+    pj_list_init(&rdata.msg_info.parse_err);
+    if (!pjsip_parse_rdata(msg, len, &rdata))
+	return PJSIP_EINVALIDMSG;
+
+    return pjsip_auth_srv_verify(&auth_srv, &rdata, &code);
+}
+
+static int auth_clt_test(void)
+{
+    const pj_str_t target = pj_str("sip:pjsip.org");
+    const pj_str_t from = pj_str("<sip:user@pjsip.org>");
+    pj_str_t realm = pj_str("test");
+    pj_str_t qop = pj_str("auth");
+    pj_pool_t *pool;
+    pjsip_auth_clt_sess sess;
+    pjsip_cred_info cred;
+    pjsip_tx_data *chal_tdata = NULL;
+    pjsip_rx_data chal_rdata;
+    pjsip_authorization_hdr *tmpl_hdr = NULL;
+    pj_size_t pool_size = 0;
+    unsigned i;
+    int rc = 0;
+    pj_status_t status;
+
+    PJ_LOG(3,(THIS_FILE, "  client authentication"));
+
+    pool = pjsip_endpt_create_pool(endpt, "auth-clt", 4000, 4000);
+    pj_bzero(&sess, sizeof(sess));
+    pjsip_auth_clt_init(&sess, endpt, pool, 0);
+
+    pj_bzero(&cred, sizeof(cred));
+    cred.realm = pj_str("*");
+    cred.scheme = pjsip_DIGEST_STR;
+    cred.username = pj_str("user");
+    cred.data_type = PJSIP_CRED_DATA_PLAIN_PASSWD;
+    cred.data = acc_password;
+    pjsip_auth_clt_set_credentials(&sess, 1, &cred);
+
+    status = pjsip_auth_clt_precompute_ha1(&sess, &realm,
+					   PJSIP_AUTH_ALGORITHM_SHA256);
+    if (status != PJ_SUCCESS ||
+	sess.cached_ha1[0].ha1.slen != PJSIP_SHA256STRLEN)
+    {
+	app_perror("   error: precomputing HA1", status);
+	rc = -300;
+	goto on_return;
+    }
+
+    /* The challenge which every refresh is answered to */
+    status = pjsip_endpt_create_tdata(endpt, &chal_tdata);
+    if (status != PJ_SUCCESS) {
+	rc = -305;
+	goto on_return;
+    }
+    pjsip_tx_data_add_ref(chal_tdata);
+    chal_tdata->msg = pjsip_msg_create(chal_tdata->pool, PJSIP_RESPONSE_MSG);
+    chal_tdata->msg->line.status.code = 401;
+    pjsip_auth_srv_challenge(&auth_srv, &qop, NULL, NULL, PJ_FALSE,
+			     chal_tdata);
+    pj_bzero(&chal_rdata, sizeof(chal_rdata));
+    chal_rdata.msg_info.msg = chal_tdata->msg;
+
+    for (i=0; i<CLT_REFRESH_CNT; ++i) {
+	pjsip_tx_data *tdata, *new_tdata;
+	pjsip_authorization_hdr *hauth;
+	pjsip_cached_auth *auth;
+	char nc[16];
+
+	status = pjsip_endpt_create_request(endpt, &pjsip_register_method,
+					    &target, &from, &from, NULL, NULL,
+					    -1, NULL, &tdata);
+	if (status != PJ_SUCCESS) {
+	    rc = -310;
+	    break;
+	}
+
+	status = pjsip_auth_clt_init_req(&sess, tdata);
+	if (status == PJ_SUCCESS)
+	    status = pjsip_auth_clt_reinit_req(&sess, &chal_rdata, tdata,
+					       &new_tdata);
+	if (status != PJ_SUCCESS) {
+	    app_perror("   error: reinit request", status);
+	    pjsip_tx_data_dec_ref(tdata);
+	    rc = -320;
+	    break;
+	}
+	pjsip_tx_data_dec_ref(new_tdata);
+
+	/* Same nonce, so only the nonce-count changes */
+	pj_ansi_snprintf(nc, sizeof(nc), "%08u", i+1);
+	hauth = (pjsip_authorization_hdr*)
+		pjsip_msg_find_hdr(tdata->msg, PJSIP_H_AUTHORIZATION, NULL);
+	if (!hauth || pj_strcmp2(&hauth->credential.digest.nc, nc) != 0) {
+	    pjsip_tx_data_dec_ref(tdata);
+	    rc = -330;
+	    break;
+	}
+
+	status = auth_clt_verify(tdata->pool, tdata);
+	pjsip_tx_data_dec_ref(tdata);
+	if (status != PJ_SUCCESS) {
+	    app_perror("   error: server rejected refresh", status);
+	    rc = -340;
+	    break;
+	}
+
+	/* The template is created once and the session pool stays */
+	auth = sess.cached_auth.next;
+	if (i == 0) {
+	    tmpl_hdr = auth->tmpl_hdr;
+	    pool_size = pj_pool_get_used_size(auth->pool);
+	} else if (auth->tmpl_hdr != tmpl_hdr ||
+		   pj_pool_get_used_size(auth->pool) != pool_size)
+	{
+	    PJ_LOG(3,(THIS_FILE, "   error: template recreated on refresh %u",
+		      i));
+	    rc = -350;
+	    break;
+	}
+    }
+
+on_return:
+    if (chal_tdata)
+	pjsip_tx_data_dec_ref(chal_tdata);
+    pjsip_auth_clt_deinit(&sess);
+    pj_pool_release(pool);
+    return rc;
+}
+
+int auth_test(void)
+{
+    pjsip_auth_srv_init_param prm;
+    pj_str_t realm = pj_str("test");
+    pj_pool_t *pool;
+    pj_status_t status;
+    int rc;
+
+    PJ_LOG(3,(THIS_FILE, "Digest authentication test"));
+
+    /* The server with every option enabled */
+    pool = pjsip_endpt_create_pool(endpt, "auth-test", 4000, 4000);
+    pj_bzero(&prm, sizeof(prm));
+    prm.realm = &realm;
+    prm.lookup2 = &auth_lookup;
+    prm.options = PJSIP_AUTH_SRV_VERIFY_NONCE | PJSIP_AUTH_SRV_SHA256;
+    prm.cache_size = 4;
+    status = pjsip_auth_srv_init2(pool, &auth_srv, &prm);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error creating authentication server", status);
+	pj_pool_release(pool);
+	return -10;
+    }
+
+    rc = auth_srv_test();
+    if (rc == 0)
+	rc = auth_clt_test();
+
+    pjsip_auth_srv_deinit(&auth_srv);
+    pj_pool_release(pool);
+    return rc;
+}
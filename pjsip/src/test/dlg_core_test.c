@@ -21,3 +21,216 @@
 #include "test.h"
 #include <pjsip.h>
 
+#include <pjlib.h>
+
+#define THIS_FILE   "dlg_core_test.c"
+
+/* Shared state of the dialog lookup benchmark */
+static struct lookup_bench
+{
+    pjsip_dialog   **dlg;
+    unsigned	     dlg_cnt;
+    unsigned	     lookups;
+    pj_atomic_t	    *found;
+} lookup_bench;
+
+static int lookup_thread(void *arg)
+{
+    unsigned i, found = 0;
+
+    PJ_UNUSED_ARG(arg);
+
+    for (i=0; i<lookup_bench.lookups; ++i) {
+	pjsip_dialog *dlg = lookup_bench.dlg[i % lookup_bench.dlg_cnt];
+
+	if (pjsip_ua_find_dialog(&dlg->call_id->id, &dlg->local.info->tag,
+				 &dlg->remote.info->tag, PJ_FALSE) == dlg)
+	{
+	    ++found;
+	}
+    }
+
+    pj_atomic_add(lookup_bench.found, found);
+    return 0;
+}
+
+/*
+ * Measure the dialog lookup throughput with the specified number of
+ * threads doing lookups concurrently.
+ */
+static int dlg_lookup_bench(unsigned thread_cnt, unsigned lookups_per_thread,
+			    pj_pool_t *pool, unsigned *p_speed)
+{
+    enum { MAX_THREADS = 16 };
+    pj_thread_t *threads[MAX_THREADS];
+    pj_timestamp t1, t2, freq;
+    pj_status_t status = PJ_SUCCESS;
+    unsigned i;
+
+    PJ_ASSERT_RETURN(thread_cnt <= MAX_THREADS, PJ_EINVAL);
+
+    pj_get_timestamp_freq(&freq);
+    lookup_bench.lookups = lookups_per_thread;
+    pj_atomic_set(lookup_bench.found, 0);
+
+    pj_get_timestamp(&t1);
+    for (i=0; i<thread_cnt; ++i) {
+	status = pj_thread_create(pool, "dlglookup%p", &lookup_thread, NULL,
+				  0, 0, &threads[i]);
+	if (status != PJ_SUCCESS) {
+	    thread_cnt = i;
+	    break;
+	}
+    }
+    for (i=0; i<thread_cnt; ++i) {
+	pj_thread_join(threads[i]);
+	pj_thread_destroy(threads[i]);
+    }
+    pj_get_timestamp(&t2);
+
+    if (status != PJ_SUCCESS) {
+	app_perror("    error: unable to create thread", status);
+	return status;
+    }
+
+    if ((unsigned)pj_atomic_get(lookup_bench.found) != 
+	thread_cnt * lookups_per_thread)
+    {
+	PJ_LOG(3,(THIS_FILE, "    error: some dialogs were not found"));
+	return -10;
+    }
+
+    pj_sub_timestamp(&t2, &t1);
+    if (t2.u64 == 0) t2.u64 = 1;
+    *p_speed = (unsigned)(freq.u64 * thread_cnt * lookups_per_thread / 
+			  t2.u64);
+    return 0;
+}
+
+/*
+ * Register dialogs with the specified number of dialog table shards,
+ * check that they can be found, and benchmark the lookups.
+ */
+static int dlg_table_test(unsigned shard_cnt, unsigned dlg_cnt)
+{
+    enum { LOOKUPS = 200000 };
+    static const unsigned threads[] = { 1, 2, 4, 8 };
+    pj_str_t local_uri = pj_str("<sip:alice@example.com>");
+    pj_str_t remote_uri = pj_str("<sip:bob@example.com>");
+    pj_str_t target = pj_str("sip:bob@127.0.0.1");
+    unsigned old_shard_cnt, base_cnt, speed, i;
+    pj_pool_t *pool;
+    int rc = 0;
+
+    PJ_LOG(3,(THIS_FILE, "  %u dialogs, %u shard(s)..", dlg_cnt, shard_cnt));
+
+    old_shard_cnt = pjsip_cfg()->dlg.shard_cnt;
+    pjsip_cfg()->dlg.shard_cnt = shard_cnt;
+    rc = pjsip_ua_init_module(endpt, NULL);
+    pjsip_cfg()->dlg.shard_cnt = old_shard_cnt;
+    if (rc != PJ_SUCCESS) {
+	app_perror("    error: unable to init UA module", rc);
+	return -100;
+    }
+
+    pool = pjsip_endpt_create_pool(endpt, "dlgtest", 1000, 1000);
+    lookup_bench.dlg = (pjsip_dialog**)
+		       pj_pool_zalloc(pool, dlg_cnt * sizeof(pjsip_dialog*));
+    rc = pj_atomic_create(pool, 0, &lookup_bench.found);
+    if (rc != PJ_SUCCESS) {
+	rc = -110;
+	goto on_return;
+    }
+
+    /* Register more dialogs than the initial table capacity */
+    base_cnt = pjsip_ua_get_dlg_set_count();
+    for (i=0; i<dlg_cnt; ++i) {
+	rc = pjsip_dlg_create_uac(pjsip_ua_instance(), &local_uri, NULL,
+				  &remote_uri, &target, 
+				  &lookup_bench.dlg[i]);
+	if (rc != PJ_SUCCESS) {
+	    app_perror("    error: unable to create dialog", rc);
+	    rc = -120;
+	    goto on_return;
+	}
+	++lookup_bench.dlg_cnt;
+    }
+
+    if (pjsip_ua_get_dlg_set_count() != base_cnt + dlg_cnt) {
+	PJ_LOG(3,(THIS_FILE, "    error: invalid dialog set count"));
+	rc = -130;
+	goto on_return;
+    }
+
+    /* All dialogs must be found, and only with the right Call-ID */
+    for (i=0; i<dlg_cnt; ++i) {
+	pjsip_dialog *dlg = lookup_bench.dlg[i];
+	pj_str_t bad_cid = pj_str("bad-call-id");
+
+	if (pjsip_ua_find_dialog(&dlg->call_id->id, &dlg->local.info->tag,
+				 &dlg->remote.info->tag, PJ_FALSE) != dlg ||
+	    pjsip_ua_find_dialog(&bad_cid, &dlg->local.info->tag,
+				 &dlg->remote.info->tag, PJ_FALSE) != NULL)
+	{
+	    PJ_LOG(3,(THIS_FILE, "    error: dialog %u lookup failed", i));
+	    rc = -140;
+	    goto on_return;
+	}
+    }
+
+#if INCLUDE_BENCHMARKS
+    for (i=0; i<PJ_ARRAY_SIZE(threads); ++i) {
+	rc = dlg_lookup_bench(threads[i], LOOKUPS, pool, &speed);
+	if (rc != 0)
+	    goto on_return;
+
+	PJ_LOG(3,(THIS_FILE, "    %u thread(s): %u lookups/sec",
+		  threads[i], speed));
+    }
+#else
+    PJ_UNUSED_ARG(threads);
+    PJ_UNUSED_ARG(speed);
+#endif
+
+on_return:
+    /* Destroy the dialogs */
+    for (i=0; i<lookup_bench.dlg_cnt; ++i) {
+	pjsip_dlg_inc_lock(lookup_bench.dlg[i]);
+	pjsip_dlg_dec_lock(lookup_bench.dlg[i]);
+    }
+    if (rc == 0 && pjsip_ua_get_dlg_set_count() != base_cnt) {
+	PJ_LOG(3,(THIS_FILE, "    error: dialogs were not unregistered"));
+	rc = -150;
+    }
+
+    if (lookup_bench.found)
+	pj_atomic_destroy(lookup_bench.found);
+    pj_bzero(&lookup_bench, sizeof(lookup_bench));
+    pjsip_endpt_release_pool(endpt, pool);
+    pjsip_ua_destroy();
+    return rc;
+}
+
+int dlg_core_test(void)
+{
+    enum { DLG_CNT = 4000 };
+    int rc;
+
+    /* The test needs to reinitialize the UA layer with different
+     * settings.
+     */
+    if (pjsip_ua_instance()->id != -1) {
+	PJ_LOG(3,(THIS_FILE, "  skipped: UA layer is already initialized"));
+	return 0;
+    }
+
+    rc = dlg_table_test(1, DLG_CNT);
+    if (rc != 0)
+	return rc;
+
+    rc = dlg_table_test(8, DLG_CNT);
+    if (rc != 0)
+	return rc;
+
+    return 0;
+}
@@ -321,6 +321,38 @@ static void add_dns_entries(pj_dns_resolver *resv)
 }
 
 
+/* Replace the A record of a host in the DNS cache */
+static void set_a_record(pj_dns_resolver *resv, char *name, char *addr)
+{
+    pj_dns_parsed_packet pkt;
+    pj_dns_parsed_query q;
+    pj_dns_parsed_rr ans;
+    pj_str_t tmp;
+
+    pj_bzero(&pkt, sizeof(pkt));
+    pj_bzero(&q, sizeof(q));
+    pj_bzero(&ans, sizeof(ans));
+
+    ans.name = pj_str(name);
+    ans.type = PJ_DNS_TYPE_A;
+    ans.dnsclass = PJ_DNS_CLASS_IN;
+    ans.ttl = 3600;
+    ans.rdata.a.ip_addr = pj_inet_addr(pj_cstr(&tmp, addr));
+
+    q.name = ans.name;
+    q.type = ans.type;
+    q.dnsclass = ans.dnsclass;
+
+    pkt.hdr.flags = PJ_DNS_SET_QR(1);
+    pkt.hdr.qdcount = 1;
+    pkt.hdr.anscount = 1;
+    pkt.q = &q;
+    pkt.ans = &ans;
+
+    pj_dns_resolver_add_entry(resv, &pkt, PJ_FALSE);
+}
+
+
 /*
  * Perform server resolution where the results are expected to
  * come in strict order.
@@ -633,6 +665,30 @@ int resolve_test(void)
     }
 
 
+    /* The resolved target is cached, so changing the DNS record doesn't
+     * affect it until the cache is flushed by setting the resolver.
+     */
+    {
+	pjsip_server_addresses ref;
+
+	set_a_record(resv, "sip06.domain.com", "8.8.8.8");
+
+	create_ref(&ref, PJSIP_TRANSPORT_UDP, "6.6.6.6", 50060);
+	status = test_resolve("resolved target cache", pool, PJSIP_TRANSPORT_UNSPECIFIED, "domain.com", 0, &ref);
+	if (status != PJ_SUCCESS)
+	    return -162;
+
+	pjsip_endpt_set_resolver(endpt, resv);
+
+	create_ref(&ref, PJSIP_TRANSPORT_UDP, "8.8.8.8", 50060);
+	status = test_resolve("resolved target cache flush", pool, PJSIP_TRANSPORT_UNSPECIFIED, "domain.com", 0, &ref);
+	if (status != PJ_SUCCESS)
+	    return -164;
+
+	set_a_record(resv, "sip06.domain.com", "6.6.6.6");
+	pjsip_endpt_set_resolver(endpt, resv);
+    }
+
     /* Round robin/load balance test */
     if (round_robin_test(pool) != 0)
 	return -170;
@@ -0,0 +1,175 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "test.h"
+#include <pjsip.h>
+#include <pjlib.h>
+
+#define THIS_FILE   "endpt_timer_test.c"
+
+/*
+ * Endpoint timers split into several heaps
+ * (pjsip_cfg_t.endpt.timer_shard_cnt).
+ *
+ * Entries are scheduled and cancelled with the endpoint timer functions,
+ * and directly on the heap returned by pjsip_endpt_get_timer_heap(). The
+ * entries which are not cancelled must expire exactly once when the
+ * endpoint is polled, and the cancelled ones must not expire.
+ *
+ * The test recreates the endpoint, so it must be run after the tests
+ * which use the global endpoint.
+ */
+#define SHARD_CNT	4
+#define ENTRY_CNT	64
+#define DIRECT_CNT	8
+
+static int fired[ENTRY_CNT + DIRECT_CNT];
+
+static void timer_cb(pj_timer_heap_t *ht, pj_timer_entry *entry)
+{
+    PJ_UNUSED_ARG(ht);
+    ++fired[entry->id];
+}
+
+static int check_timers(pj_timer_entry *entries)
+{
+    pj_timer_heap_t *heap[SHARD_CNT];
+    pj_timer_heap_t *direct_heap = pjsip_endpt_get_timer_heap(endpt);
+    unsigned heap_cnt = 0;
+    pj_time_val now, end;
+    int i;
+
+    pj_bzero(fired, sizeof(fired));
+
+    for (i=0; i<ENTRY_CNT; ++i) {
+	pj_timer_entry *e = &entries[i];
+	pj_timer_heap_t *ht = pjsip_endpt_get_entry_timer_heap(endpt, e);
+	pj_time_val delay;
+	unsigned j;
+
+	for (j=0; j<heap_cnt && heap[j] != ht; ++j)
+	    ;
+	if (j == heap_cnt) {
+	    if (heap_cnt == SHARD_CNT) {
+		PJ_LOG(3,(THIS_FILE, "   error: too many timer heaps"));
+		return -10;
+	    }
+	    heap[heap_cnt++] = ht;
+	}
+
+	pj_timer_entry_init(e, i, NULL, &timer_cb);
+	delay.sec = 0;
+	delay.msec = (i % 5) * 10;
+	if (pjsip_endpt_schedule_timer(endpt, e, &delay) != PJ_SUCCESS) {
+	    PJ_LOG(3,(THIS_FILE, "   error: unable to schedule timer"));
+	    return -20;
+	}
+    }
+
+    /* The entries must be spread over the heaps */
+    if (heap_cnt < 2) {
+	PJ_LOG(3,(THIS_FILE, "   error: all entries are in one heap"));
+	return -30;
+    }
+
+    for (i=ENTRY_CNT; i<ENTRY_CNT+DIRECT_CNT; ++i) {
+	pj_time_val delay = {0, 10};
+
+	pj_timer_entry_init(&entries[i], i, NULL, &timer_cb);
+	if (pj_timer_heap_schedule(direct_heap, &entries[i], &delay) !=
+	    PJ_SUCCESS)
+	{
+	    PJ_LOG(3,(THIS_FILE, "   error: unable to schedule timer"));
+	    return -40;
+	}
+    }
+
+    /* Cancel the odd entries, each on its own heap */
+    for (i=1; i<ENTRY_CNT; i+=2)
+	pjsip_endpt_cancel_timer(endpt, &entries[i]);
+    for (i=ENTRY_CNT+1; i<ENTRY_CNT+DIRECT_CNT; i+=2)
+	pj_timer_heap_cancel(direct_heap, &entries[i]);
+
+    pj_gettickcount(&end);
+    end.msec += 200;
+    pj_time_val_normalize(&end);
+    do {
+	pj_time_val timeout = {0, 10};
+	pjsip_endpt_handle_events(endpt, &timeout);
+	pj_gettickcount(&now);
+    } while (PJ_TIME_VAL_LT(now, end));
+
+    for (i=0; i<ENTRY_CNT+DIRECT_CNT; ++i) {
+	if (fired[i] != (i % 2 ? 0 : 1)) {
+	    PJ_LOG(3,(THIS_FILE, "   error: entry %d expired %d time(s)",
+		      i, fired[i]));
+	    return -50;
+	}
+    }
+
+    return 0;
+}
+
+int endpt_timer_test(void)
+{
+    unsigned old_shard_cnt = pjsip_cfg()->endpt.timer_shard_cnt;
+    pj_timer_entry *entries;
+    pj_pool_t *pool;
+    pj_status_t status;
+    int rc;
+
+    PJ_LOG(3,(THIS_FILE, "  endpoint timer test with %d heaps..",
+	      SHARD_CNT));
+
+    pjsip_endpt_destroy(endpt);
+    endpt = NULL;
+
+    pjsip_cfg()->endpt.timer_shard_cnt = SHARD_CNT;
+    status = pjsip_endpt_create(&caching_pool.factory, "endpt", &endpt);
+    pjsip_cfg()->endpt.timer_shard_cnt = old_shard_cnt;
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to create endpoint", status);
+	endpt = NULL;
+	rc = -100;
+	goto on_return;
+    }
+
+    pool = pjsip_endpt_create_pool(endpt, "timertest", 4000, 4000);
+    entries = (pj_timer_entry*)
+	      pj_pool_calloc(pool, ENTRY_CNT + DIRECT_CNT,
+			     sizeof(pj_timer_entry));
+
+    rc = check_timers(entries);
+
+    pjsip_endpt_release_pool(endpt, pool);
+
+on_return:
+    if (endpt)
+	pjsip_endpt_destroy(endpt);
+
+    /* Recreate the global endpoint with a single heap */
+    if (pjsip_endpt_create(&caching_pool.factory, "endpt", &endpt) !=
+	PJ_SUCCESS && rc == 0)
+    {
+	rc = -110;
+    }
+
+    return rc;
+}
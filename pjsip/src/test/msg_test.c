@@ -39,6 +39,7 @@ static pjsip_msg *create_msg1(pj_pool_t *pool);
 #define FLAG_DETECT_ONLY	1
 #define FLAG_PARSE_ONLY		4
 #define FLAG_PRINT_ONLY		8
+#define FLAG_LAZY_PARSE		16
 
 struct test_msg
 {
@@ -251,7 +252,8 @@ static pj_status_t test_entry( pj_pool_t *pool, struct test_msg *entry )
     pj_str_t str1, str2;
     pjsip_hdr *hdr1, *hdr2;
     pj_timestamp t1, t2;
-    pjsip_parser_err_report err_list;
+    static pjsip_rx_data rdata;
+    pjsip_parser_err_report err_report, *err_list;
     pj_size_t msg_size;
     char msgbuf1[PJSIP_MAX_PKT_LEN];
     char msgbuf2[PJSIP_MAX_PKT_LEN];
@@ -292,18 +294,33 @@ static pj_status_t test_entry( pj_pool_t *pool, struct test_msg *entry )
     if (var.flag & FLAG_DETECT_ONLY)
 	return PJ_SUCCESS;
     
-    /* Parse message. */
+    /* Parse message. Lazy parsing is done on rdata, as the transport
+     * does, so that the raw header lines are recorded too.
+     */
 parse_msg:
     var.parse_len = var.parse_len + entry->len;
+    if (var.flag & FLAG_LAZY_PARSE) {
+	pj_bzero(&rdata.msg_info, sizeof(rdata.msg_info));
+	rdata.tp_info.pool = pool;
+	err_list = &rdata.msg_info.parse_err;
+    } else {
+	err_list = &err_report;
+    }
+    pj_list_init(err_list);
     pj_get_timestamp(&t1);
-    pj_list_init(&err_list);
-    parsed_msg = pjsip_parse_msg(pool, entry->msg, entry->len, &err_list);
+    if (var.flag & FLAG_LAZY_PARSE) {
+	parsed_msg = pjsip_parse_rdata2(entry->msg, entry->len, &rdata,
+					PJSIP_PARSE_LAZY);
+    } else {
+	parsed_msg = pjsip_parse_msg2(pool, entry->msg, entry->len, err_list,
+				      0);
+    }
     if (parsed_msg == NULL) {
 	if (entry->expected_status != STATUS_SYNTAX_ERROR) {
 	    status = -10;
-	    if (err_list.next != &err_list) {
+	    if (err_list->next != err_list) {
 		PJ_LOG(3,(THIS_FILE, "   Syntax error in line %d col %d",
-			      err_list.next->line, err_list.next->col));
+			      err_list->next->line, err_list->next->col));
 	    }
 	    goto on_return;
 	}
@@ -315,6 +332,16 @@ parse_msg:
     if ((var.flag & FLAG_PARSE_ONLY) || entry->creator==NULL)
 	return PJ_SUCCESS;
 
+    /* Parse the remaining lazy headers so they can be compared. */
+    if (parsed_msg && (var.flag & FLAG_LAZY_PARSE)) {
+	hdr1 = parsed_msg->hdr.next;
+	while (hdr1 != &parsed_msg->hdr) {
+	    hdr2 = hdr1->next;
+	    pjsip_lazy_hdr_decode((pjsip_lazy_hdr*)hdr1);
+	    hdr1 = hdr2;
+	}
+    }
+
     /* Create reference message. */
     ref_msg = entry->creator(pool);
 
@@ -840,19 +867,349 @@ static pj_status_t simple_test(void)
 	    return status;
     }
 
-    return PJ_SUCCESS;
+    /* Repeat with lazy parsing */
+    var.flag = FLAG_LAZY_PARSE;
+    for (i=0; i<PJ_ARRAY_SIZE(test_array); ++i) {
+	pj_pool_t *pool;
+	pool = pjsip_endpt_create_pool(endpt, NULL, POOL_SIZE, POOL_SIZE);
+	status = test_entry( pool, &test_array[i] );
+	pjsip_endpt_release_pool(endpt, pool);
+
+	if (status != PJ_SUCCESS)
+	    break;
+    }
+    var.flag = 0;
+
+    return status;
+}
+
+/* Test lookup, cloning, and printing of lazily parsed headers. */
+static int lazy_test(void)
+{
+    char msgbuf[] = 
+	"INVITE sip:user@foo SIP/2.0\r\n"
+	"Via: SIP/2.0/UDP 10.0.0.1:5060;branch=z9hG4bK-lazy-test\r\n"
+	"From: <sip:alice@foo>;tag=1234\r\n"
+	"To: <sip:user@foo>\r\n"
+	"Call-ID: lazy-test@foo\r\n"
+	"CSeq: 1 INVITE\r\n"
+	"m: <sip:alice@10.0.0.1>;expires=60,\r\n"
+	"  <sip:alice@10.0.0.2>\r\n"
+	"Expires: 300\r\n"
+	"Max-Forwards: 70\r\n"
+	"Content-Length: 0\r\n"
+	"\r\n";
+    const pj_str_t STR_EXPIRES = { "Expires", 7 };
+    pj_pool_t *pool;
+    pjsip_msg *msg, *clone;
+    pjsip_hdr *hdr;
+    pjsip_contact_hdr *contact;
+    pjsip_expires_hdr *expires;
+    pjsip_sip_uri *uri;
+    char printbuf[PJSIP_MAX_PKT_LEN];
+    unsigned lazy_cnt;
+    pj_ssize_t len;
+    int rc = 0;
+
+    PJ_LOG(3,(THIS_FILE, "  lazy parsing test.."));
+
+    pool = pjsip_endpt_create_pool(endpt, NULL, POOL_SIZE, POOL_SIZE);
+
+    msg = pjsip_parse_msg2(pool, msgbuf, pj_ansi_strlen(msgbuf), NULL,
+			   PJSIP_PARSE_LAZY);
+    if (!msg) {
+	rc = -800;
+	goto on_return;
+    }
+
+    /* Only Contact and Expires should be lazy */
+    for (lazy_cnt=0, hdr=msg->hdr.next; hdr!=&msg->hdr; hdr=hdr->next) {
+	if (pjsip_hdr_is_lazy(hdr))
+	    ++lazy_cnt;
+    }
+    if (lazy_cnt != 2) {
+	rc = -810;
+	goto on_return;
+    }
+
+    hdr = (pjsip_hdr*) pjsip_msg_find_hdr(msg, PJSIP_H_VIA, NULL);
+    if (!hdr || pjsip_hdr_is_lazy(hdr)) {
+	rc = -820;
+	goto on_return;
+    }
+
+    /* Clone must keep the lazy headers */
+    clone = pjsip_msg_clone(pool, msg);
+    len = pjsip_msg_print(clone, printbuf, sizeof(printbuf));
+    if (len < 1) {
+	rc = -830;
+	goto on_return;
+    }
+
+    /* Compact form Contact with continuation line */
+    contact = (pjsip_contact_hdr*) 
+	      pjsip_msg_find_hdr(msg, PJSIP_H_CONTACT, NULL);
+    if (!contact || contact->expires != 60) {
+	rc = -840;
+	goto on_return;
+    }
+    uri = (pjsip_sip_uri*) pjsip_uri_get_uri(contact->uri);
+    if (pj_strcmp2(&uri->host, "10.0.0.1") != 0) {
+	rc = -850;
+	goto on_return;
+    }
+    contact = (pjsip_contact_hdr*) 
+	      pjsip_msg_find_hdr(msg, PJSIP_H_CONTACT, contact->next);
+    if (!contact) {
+	rc = -860;
+	goto on_return;
+    }
+    uri = (pjsip_sip_uri*) pjsip_uri_get_uri(contact->uri);
+    if (pj_strcmp2(&uri->host, "10.0.0.2") != 0) {
+	rc = -870;
+	goto on_return;
+    }
+
+    expires = (pjsip_expires_hdr*) 
+	      pjsip_msg_find_hdr_by_name(msg, &STR_EXPIRES, NULL);
+    if (!expires || expires->type != PJSIP_H_EXPIRES ||
+	expires->ivalue != 300)
+    {
+	rc = -880;
+	goto on_return;
+    }
+
+    for (hdr=msg->hdr.next; hdr!=&msg->hdr; hdr=hdr->next) {
+	if (pjsip_hdr_is_lazy(hdr)) {
+	    rc = -890;
+	    goto on_return;
+	}
+    }
+
+    /* The clone is still usable after the original is decoded */
+    contact = (pjsip_contact_hdr*) 
+	      pjsip_msg_find_hdr(clone, PJSIP_H_CONTACT, NULL);
+    if (!contact || contact->expires != 60) {
+	rc = -900;
+	goto on_return;
+    }
+
+    len = pjsip_msg_print(msg, printbuf, sizeof(printbuf));
+    if (len < 1) {
+	rc = -910;
+	goto on_return;
+    }
+
+on_return:
+    pjsip_endpt_release_pool(endpt, pool);
+    return rc;
+}
+
+
+/* Forward request in rdata, and return the encoded message. The packet
+ * buffer is then released and overwritten, and the forwarded message must
+ * still encode to the same text. If own is set, the message takes its own
+ * copy of the packet before the buffer is released, as it does when it's
+ * sent.
+ */
+static int fwd_encode(char *msgbuf, pj_size_t len, unsigned options,
+		      pj_bool_t own, pj_pool_t *pool, pj_str_t *out)
+{
+    static pjsip_rx_data rdata;
+    pjsip_tx_data *tdata;
+    pj_status_t status;
+
+    pj_bzero(&rdata, sizeof(rdata));
+    rdata.tp_info.pool = pool;
+    rdata.msg_info.msg_buf = msgbuf;
+    rdata.msg_info.len = (int)len;
+    pj_list_init(&rdata.msg_info.parse_err);
+
+    if (!pjsip_parse_rdata2(msgbuf, len, &rdata, options))
+	return -1;
+
+    rdata.msg_info.via = (pjsip_via_hdr*)
+	pjsip_msg_find_hdr(rdata.msg_info.msg, PJSIP_H_VIA, NULL);
+    rdata.msg_info.cid = (pjsip_cid_hdr*)
+	pjsip_msg_find_hdr(rdata.msg_info.msg, PJSIP_H_CALL_ID, NULL);
+    rdata.msg_info.cseq = (pjsip_cseq_hdr*)
+	pjsip_msg_find_hdr(rdata.msg_info.msg, PJSIP_H_CSEQ, NULL);
+
+    status = pjsip_endpt_create_request_fwd(endpt, &rdata, NULL, NULL, 0,
+					    &tdata);
+    if (status != PJ_SUCCESS)
+	return -2;
+
+    status = pjsip_tx_data_encode(tdata);
+    if (status != PJ_SUCCESS) {
+	pjsip_tx_data_dec_ref(tdata);
+	return -3;
+    }
+
+    out->slen = tdata->buf.cur - tdata->buf.start;
+    out->ptr = (char*) pj_pool_alloc(pool, out->slen + 1);
+    pj_memcpy(out->ptr, tdata->buf.start, out->slen);
+    out->ptr[out->slen] = '\0';
+
+    if (own) {
+	pjsip_tx_data_own_buf(tdata);
+	if (tdata->lent_buf != NULL) {
+	    pjsip_tx_data_dec_ref(tdata);
+	    return -5;
+	}
+    }
+
+    pjsip_rx_data_release_buf(&rdata);
+    pj_memset(msgbuf, 'x', len);
+
+    pjsip_tx_data_invalidate_msg(tdata);
+    status = pjsip_tx_data_encode(tdata);
+    if (status != PJ_SUCCESS ||
+	tdata->buf.cur - tdata->buf.start != out->slen ||
+	pj_memcmp(tdata->buf.start, out->ptr, out->slen) != 0)
+    {
+	pjsip_tx_data_dec_ref(tdata);
+	return -4;
+    }
+
+    pjsip_tx_data_dec_ref(tdata);
+    return 0;
+}
+
+/* Test forwarding of lazily parsed request, which copies the unchanged
+ * header lines as raw text.
+ */
+static int fwd_test(void)
+{
+    char msgbuf[] = 
+	"MESSAGE sip:user@foo SIP/2.0\r\n"
+	"Via: SIP/2.0/UDP 10.0.0.1:5060;branch=z9hG4bK-fwd-test\r\n"
+	"Max-Forwards: 70\r\n"
+	"From: <sip:alice@foo>;tag=1234\r\n"
+	"To: <sip:user@foo>\r\n"
+	"Call-ID: fwd-test@foo\r\n"
+	"CSeq: 1 MESSAGE\r\n"
+	"m: <sip:alice@10.0.0.1>;expires=60,\r\n"
+	"  <sip:alice@10.0.0.2>\r\n"
+	"User-Agent: msg_test\r\n"
+	"X-Custom:   some value\r\n"
+	"Content-Type: text/plain\r\n"
+	"Content-Length: 5\r\n"
+	"\r\n"
+	"Hello";
+    const char *raw_lines[] =
+    {
+	"\r\nVia: SIP/2.0/UDP 10.0.0.1:5060;branch=z9hG4bK-fwd-test\r\n",
+	"\r\nFrom: <sip:alice@foo>;tag=1234\r\n"
+	"To: <sip:user@foo>\r\n"
+	"Call-ID: fwd-test@foo\r\n"
+	"CSeq: 1 MESSAGE\r\n"
+	"m: <sip:alice@10.0.0.1>;expires=60,\r\n"
+	"  <sip:alice@10.0.0.2>\r\n"
+	"User-Agent: msg_test\r\n"
+	"X-Custom:   some value\r\n",
+	"\r\nMax-Forwards: 69\r\n",
+	"\r\n\r\nHello"
+    };
+    char buf[sizeof(msgbuf)];
+    pj_pool_t *pool;
+    pj_str_t full, raw, owned;
+    pjsip_msg *msg1, *msg2;
+    pjsip_hdr *hdr1, *hdr2;
+    unsigned i;
+    int rc = 0;
+
+    PJ_LOG(3,(THIS_FILE, "  lazy forwarding test.."));
+
+    pool = pjsip_endpt_create_pool(endpt, NULL, POOL_SIZE, POOL_SIZE);
+
+    pj_memcpy(buf, msgbuf, sizeof(msgbuf));
+    rc = fwd_encode(buf, sizeof(msgbuf)-1, 0, PJ_FALSE, pool, &full);
+    if (rc != 0) {
+	rc -= 1000;
+	goto on_return;
+    }
+
+    pj_memcpy(buf, msgbuf, sizeof(msgbuf));
+    rc = fwd_encode(buf, sizeof(msgbuf)-1, PJSIP_PARSE_LAZY, PJ_FALSE,
+		    pool, &raw);
+    if (rc != 0) {
+	rc -= 1010;
+	goto on_return;
+    }
+
+    pj_memcpy(buf, msgbuf, sizeof(msgbuf));
+    rc = fwd_encode(buf, sizeof(msgbuf)-1, PJSIP_PARSE_LAZY, PJ_TRUE,
+		    pool, &owned);
+    if (rc != 0) {
+	rc -= 1070;
+	goto on_return;
+    }
+    if (pj_strcmp(&owned, &raw) != 0) {
+	rc = -1080;
+	goto on_return;
+    }
+
+    /* Unchanged lines must be copied verbatim */
+    for (i=0; i<PJ_ARRAY_SIZE(raw_lines); ++i) {
+	if (!pj_ansi_strstr(raw.ptr, raw_lines[i])) {
+	    PJ_LOG(3,(THIS_FILE, "   error: line %d not found in:\n%s",
+		      i, raw.ptr));
+	    rc = -1020;
+	    goto on_return;
+	}
+    }
+
+    /* Both must parse to equivalent messages */
+    msg1 = pjsip_parse_msg(pool, full.ptr, full.slen, NULL);
+    msg2 = pjsip_parse_msg(pool, raw.ptr, raw.slen, NULL);
+    if (!msg1 || !msg2) {
+	rc = -1030;
+	goto on_return;
+    }
+
+    hdr1 = msg1->hdr.next;
+    hdr2 = msg2->hdr.next;
+    while (hdr1 != &msg1->hdr && hdr2 != &msg2->hdr) {
+	char str1[256], str2[256];
+	int len1, len2;
+
+	len1 = pjsip_hdr_print_on(hdr1, str1, sizeof(str1));
+	len2 = pjsip_hdr_print_on(hdr2, str2, sizeof(str2));
+	if (len1 < 1 || len1 != len2 || pj_memcmp(str1, str2, len1) != 0) {
+	    rc = -1040;
+	    goto on_return;
+	}
+	hdr1 = hdr1->next;
+	hdr2 = hdr2->next;
+    }
+    if (hdr1 != &msg1->hdr || hdr2 != &msg2->hdr) {
+	rc = -1050;
+	goto on_return;
+    }
+
+    if (!msg2->body || msg2->body->len != 5 ||
+	pj_memcmp(msg2->body->data, "Hello", 5) != 0)
+    {
+	rc = -1060;
+	goto on_return;
+    }
+
+on_return:
+    pjsip_endpt_release_pool(endpt, pool);
+    return rc;
 }
 
 
 #if INCLUDE_BENCHMARKS
 static int msg_benchmark(unsigned *p_detect, unsigned *p_parse, 
-			 unsigned *p_print)
+			 unsigned *p_lazy_parse, unsigned *p_print)
 {
     pj_pool_t *pool;
     int i, loop;
     pj_timestamp zero;
     pj_time_val elapsed;
-    pj_highprec_t avg_detect, avg_parse, avg_print, kbytes;
+    pj_highprec_t avg_detect, avg_parse, avg_lazy_parse, avg_print, kbytes;
     pj_status_t status = PJ_SUCCESS;
 
     pj_bzero(&var, sizeof(var));
@@ -917,6 +1274,44 @@ static int msg_benchmark(unsigned *p_detect, unsigned *p_parse,
 	      (unsigned)avg_print));
 
     *p_print = (unsigned)avg_print;
+
+    /* Parse only, with lazy header parsing */
+    var.flag = FLAG_PARSE_ONLY | FLAG_LAZY_PARSE;
+    var.parse_len = 0;
+    var.parse_time.u64 = 0;
+
+    for (loop=0; loop<LOOP; ++loop) {
+	for (i=0; i<(int)PJ_ARRAY_SIZE(test_array); ++i) {
+	    pool = pjsip_endpt_create_pool(endpt, NULL, POOL_SIZE, POOL_SIZE);
+	    status = test_entry( pool, &test_array[i] );
+	    pjsip_endpt_release_pool(endpt, pool);
+
+	    if (status != PJ_SUCCESS)
+		break;
+	}
+    }
+    var.flag = 0;
+
+    if (status != PJ_SUCCESS)
+	return status;
+
+    kbytes = var.parse_len;
+    pj_highprec_mod(kbytes, 1000000);
+    pj_highprec_div(kbytes, 100000);
+    elapsed = pj_elapsed_time(&zero, &var.parse_time);
+    avg_lazy_parse = pj_elapsed_usec(&zero, &var.parse_time);
+    pj_highprec_mul(avg_lazy_parse, AVERAGE_MSG_LEN);
+    pj_highprec_div(avg_lazy_parse, var.parse_len);
+    avg_lazy_parse = 1000000 / avg_lazy_parse;
+
+    PJ_LOG(3,(THIS_FILE, 
+	      "    %u.%u MB lazily parsed in %d.%03ds "
+	      "(avg=%d msg parsing/sec)", 
+	      (unsigned)(var.parse_len/1000000), (unsigned)kbytes,
+	      elapsed.sec, elapsed.msec,
+	      (unsigned)avg_lazy_parse));
+    *p_lazy_parse = (unsigned)avg_lazy_parse;
+
     return status;
 }
 #endif	/* INCLUDE_BENCHMARKS */
@@ -1993,6 +2388,7 @@ int msg_test(void)
     struct {
 	unsigned detect;
 	unsigned parse;
+	unsigned lazy_parse;
 	unsigned print;
     } run[COUNT];
     unsigned i, max, avg_len;
@@ -2007,10 +2403,19 @@ int msg_test(void)
     if (status != PJ_SUCCESS)
 	return status;
 
+    status = lazy_test();
+    if (status != 0)
+	return status;
+
+    status = fwd_test();
+    if (status != 0)
+	return status;
+
 #if INCLUDE_BENCHMARKS
     for (i=0; i<COUNT; ++i) {
 	PJ_LOG(3,(THIS_FILE, "  benchmarking (%d of %d)..", i+1, COUNT));
-	status = msg_benchmark(&run[i].detect, &run[i].parse, &run[i].print);
+	status = msg_benchmark(&run[i].detect, &run[i].parse, 
+			       &run[i].lazy_parse, &run[i].print);
 	if (status != PJ_SUCCESS)
 	    return status;
     }
@@ -2054,6 +2459,20 @@ int msg_test(void)
 		" worth of SIP messages that can be parsed per second). "
 		"The value is derived from msg-parse-per-sec above.");
 
+    /* Print maximum lazy parse/sec */
+    for (i=0, max=0; i<COUNT; ++i)
+	if (run[i].lazy_parse > max) max = run[i].lazy_parse;
+
+    PJ_LOG(3,("", "  Maximum message lazy parsing/sec=%u", max));
+
+    pj_ansi_sprintf(desc, "Number of SIP messages "
+			  "can be <b>parsed</b> by <tt>pjsip_parse_rdata2()</tt> "
+			  "with <tt>PJSIP_PARSE_LAZY</tt> option "
+			  "per second (tested with %d message sets with "
+			  "average message length of "
+			  "%d bytes)", (int)PJ_ARRAY_SIZE(test_array), avg_len);
+    report_ival("msg-lazy-parse-per-sec", max, "msg/sec", desc);
+
 
     /* Print maximum print/sec */
     for (i=0, max=0; i<COUNT; ++i)
@@ -313,6 +313,10 @@ int test_main(void)
     DO_TEST(tsx_bench());
 #endif
 
+#if INCLUDE_DLG_CORE_TEST
+    DO_TEST(dlg_core_test());
+#endif
+
 #if INCLUDE_UDP_TEST
     DO_TEST(transport_udp_test());
 #endif
@@ -369,9 +373,25 @@ int test_main(void)
     DO_TEST(regc_test());
 #endif
 
+#if INCLUDE_AUTH_TEST
+    DO_TEST(auth_test());
+#endif
+
     /*
-     * Better be last because it recreates the endpt
+     * These better be last because they recreate the endpt
      */
+#if INCLUDE_RX_WORKER_TEST
+    DO_TEST(rx_worker_test());
+#endif
+
+#if INCLUDE_IO_WORKER_TEST
+    DO_TEST(io_worker_test());
+#endif
+
+#if INCLUDE_ENDPT_TIMER_TEST
+    DO_TEST(endpt_timer_test());
+#endif
+
 #if INCLUDE_TSX_DESTROY_TEST
     DO_TEST(tsx_destroy_test());
 #endif
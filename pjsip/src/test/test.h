@@ -60,14 +60,19 @@ extern pj_caching_pool caching_pool;
 #define INCLUDE_MULTIPART_TEST	INCLUDE_MESSAGING_GROUP
 #define INCLUDE_TXDATA_TEST	INCLUDE_MESSAGING_GROUP
 #define INCLUDE_TSX_BENCH	INCLUDE_MESSAGING_GROUP
+#define INCLUDE_DLG_CORE_TEST	INCLUDE_MESSAGING_GROUP
 #define INCLUDE_UDP_TEST	INCLUDE_TRANSPORT_GROUP
 #define INCLUDE_LOOP_TEST	INCLUDE_TRANSPORT_GROUP
 #define INCLUDE_TCP_TEST	INCLUDE_TRANSPORT_GROUP
 #define INCLUDE_RESOLVE_TEST	INCLUDE_TRANSPORT_GROUP
+#define INCLUDE_RX_WORKER_TEST	INCLUDE_TRANSPORT_GROUP
+#define INCLUDE_IO_WORKER_TEST	INCLUDE_TRANSPORT_GROUP
 #define INCLUDE_TSX_TEST	INCLUDE_TSX_GROUP
 #define INCLUDE_TSX_DESTROY_TEST INCLUDE_TSX_GROUP
+#define INCLUDE_ENDPT_TIMER_TEST INCLUDE_TSX_GROUP
 #define INCLUDE_INV_OA_TEST	INCLUDE_INV_GROUP
 #define INCLUDE_REGC_TEST	INCLUDE_REGC_GROUP
+#define INCLUDE_AUTH_TEST	INCLUDE_REGC_GROUP
 
 
 /* The tests */
@@ -77,12 +82,17 @@ int msg_err_test(void);
 int multipart_test(void);
 int txdata_test(void);
 int tsx_bench(void);
+int dlg_core_test(void);
 int tsx_destroy_test(void);
+int endpt_timer_test(void);
 int transport_udp_test(void);
 int transport_loop_test(void);
 int transport_tcp_test(void);
 int resolve_test(void);
+int rx_worker_test(void);
+int io_worker_test(void);
 int regc_test(void);
+int auth_test(void);
 
 struct tsx_test_param
 {
@@ -148,6 +148,159 @@ static pj_status_t multi_listener_test(pjsip_tpfactory *factory[],
     return PJ_SUCCESS;
 }
 
+/*
+ * Messages bigger than the receive buffer, and messages split across
+ * several writes.
+ */
+static pj_bool_t large_on_rx_request(pjsip_rx_data *rdata);
+
+static struct mod_large_test
+{
+    pjsip_module    mod;
+    unsigned	    count;
+    unsigned	    body_len[8];
+} mod_large =
+{
+    {
+    NULL, NULL,				/* prev and next	*/
+    { "mod-large-test", 14},		/* Name.		*/
+    -1,					/* Id			*/
+    PJSIP_MOD_PRIORITY_TSX_LAYER-1,	/* Priority		*/
+    NULL,				/* load()		*/
+    NULL,				/* start()		*/
+    NULL,				/* stop()		*/
+    NULL,				/* unload()		*/
+    &large_on_rx_request,		/* on_rx_request()	*/
+    NULL,				/* on_rx_response()	*/
+    NULL,				/* tsx_handler()	*/
+    }
+};
+
+static pj_bool_t large_on_rx_request(pjsip_rx_data *rdata)
+{
+    pjsip_msg_body *body = rdata->msg_info.msg->body;
+    unsigned len = body ? body->len : 0;
+
+    if (pj_strcmp2(&rdata->msg_info.cid->id, "large-msg-test") != 0)
+	return PJ_FALSE;
+
+    /* The body ends with a character which depends on its length */
+    if (len && ((char*)body->data)[len-1] != (char)('a' + len % 26))
+	len = (unsigned)-1;
+
+    if (mod_large.count < PJ_ARRAY_SIZE(mod_large.body_len))
+	mod_large.body_len[mod_large.count] = len;
+    ++mod_large.count;
+
+    return PJ_TRUE;
+}
+
+static pj_status_t large_send(const pj_sockaddr_in *rem_addr,
+			      const char *data, int len)
+{
+    pj_status_t status;
+
+    status = pjsip_tpmgr_send_raw(pjsip_endpt_get_tpmgr(endpt),
+				  PJSIP_TRANSPORT_TCP, NULL, NULL,
+				  data, len, rem_addr, sizeof(*rem_addr),
+				  NULL, NULL);
+    return (status == PJ_EPENDING) ? PJ_SUCCESS : status;
+}
+
+static int large_msg_test(const pj_sockaddr_in *rem_addr)
+{
+    const unsigned body_len[] = { 10, 30000, PJSIP_MAX_STREAM_MSG_LEN / 2,
+				  10, 100 };
+    enum { SPLIT_IDX = 4 };
+    pj_pool_t *pool;
+    char *msg;
+    unsigned i;
+    int rc = 0;
+    pj_status_t status;
+
+    PJ_LOG(3,(THIS_FILE, "  large message test..."));
+
+    pool = pjsip_endpt_create_pool(endpt, "large", 4000, 4000);
+    msg = (char*) pj_pool_alloc(pool, PJSIP_MAX_STREAM_MSG_LEN);
+
+    status = pjsip_endpt_register_module(endpt, &mod_large.mod);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error registering module", status);
+	pj_pool_release(pool);
+	return -100;
+    }
+    mod_large.count = 0;
+
+    for (i=0; i<PJ_ARRAY_SIZE(body_len); ++i) {
+	int len;
+	unsigned j;
+
+	len = pj_ansi_snprintf(msg, 1000,
+			       "MESSAGE sip:alice@127.0.0.1 SIP/2.0\r\n"
+			       "Via: SIP/2.0/TCP 127.0.0.1;branch=z9hG4bK%u\r\n"
+			       "From: <sip:bob@127.0.0.1>;tag=large\r\n"
+			       "To: <sip:alice@127.0.0.1>\r\n"
+			       "Call-ID: large-msg-test\r\n"
+			       "CSeq: %u MESSAGE\r\n"
+			       "Content-Type: text/plain\r\n"
+			       "Content-Length: %u\r\n"
+			       "\r\n", i, i, body_len[i]);
+	for (j=0; j<body_len[i]; ++j)
+	    msg[len+j] = (char)('a' + (j+1) % 26);
+	len += body_len[i];
+
+	if (i == SPLIT_IDX) {
+	    /* Send in pieces, splitting the headers and the body */
+	    const int split[] = { 0, 7, 60, len - 40, len - 1, len };
+	    unsigned k;
+
+	    for (k=1; k<PJ_ARRAY_SIZE(split) && status==PJ_SUCCESS; ++k) {
+		pj_time_val delay = {0, 50};
+
+		status = large_send(rem_addr, msg + split[k-1],
+				    split[k] - split[k-1]);
+		pjsip_endpt_handle_events(endpt, &delay);
+	    }
+	} else {
+	    status = large_send(rem_addr, msg, len);
+	}
+
+	if (status != PJ_SUCCESS) {
+	    app_perror("   error sending message", status);
+	    rc = -110;
+	    goto on_return;
+	}
+    }
+
+    /* Wait until all messages are received */
+    for (i=0; i<200 && mod_large.count < PJ_ARRAY_SIZE(body_len); ++i) {
+	pj_time_val delay = {0, 10};
+	pjsip_endpt_handle_events(endpt, &delay);
+    }
+
+    if (mod_large.count != PJ_ARRAY_SIZE(body_len)) {
+	PJ_LOG(3,(THIS_FILE, "   error: received %u of %u messages",
+		  mod_large.count, PJ_ARRAY_SIZE(body_len)));
+	rc = -120;
+	goto on_return;
+    }
+
+    for (i=0; i<PJ_ARRAY_SIZE(body_len); ++i) {
+	if (mod_large.body_len[i] != body_len[i]) {
+	    PJ_LOG(3,(THIS_FILE, "   error: message %u has body length %d, "
+		      "expecting %u", i, (int)mod_large.body_len[i],
+		      body_len[i]));
+	    rc = -130;
+	    goto on_return;
+	}
+    }
+
+on_return:
+    pjsip_endpt_unregister_module(endpt, &mod_large.mod);
+    pj_pool_release(pool);
+    return rc;
+}
+
 int transport_tcp_test(void)
 {
     enum { SEND_RECV_LOOP = 8 };
@@ -182,6 +335,40 @@ int transport_tcp_test(void)
     if (transport_load_test(url) != 0)
 	return -60;
 
+    /* The requests sent by the load test while the connection was busy
+     * must have been coalesced, and none must be left in the queue.
+     */
+    {
+	pjsip_transport *tp;
+	pjsip_transport_tx_stat tx_stat;
+
+	status = pjsip_endpt_acquire_transport(endpt, PJSIP_TRANSPORT_TCP,
+					       &rem_addr, sizeof(rem_addr),
+					       NULL, &tp);
+	if (status != PJ_SUCCESS)
+	    return -61;
+
+	status = pjsip_tcp_transport_get_tx_stat(tp, &tx_stat);
+	pjsip_transport_dec_ref(tp);
+	if (status != PJ_SUCCESS)
+	    return -62;
+
+	PJ_LOG(3,(THIS_FILE, "   %u msgs queued (max %u), %u coalesced "
+		  "writes carrying %u msgs", tx_stat.total_queued_msgs,
+		  tx_stat.max_queued_msgs, tx_stat.coalesced_writes,
+		  tx_stat.coalesced_msgs));
+
+	if (tx_stat.queued_msgs != 0 || tx_stat.queued_bytes != 0)
+	    return -63;
+	if (tx_stat.max_queued_msgs > 1 && tx_stat.coalesced_writes == 0)
+	    return -64;
+    }
+
+    /* Large message test */
+    status = large_msg_test(&rem_addr);
+    if (status != 0)
+	return status;
+
     /* Basic transport's send/receive loopback test. */
     for (i=0; i<SEND_RECV_LOOP; ++i) {
 	status = transport_send_recv_test(PJSIP_TRANSPORT_TCP, tcp[0], url,
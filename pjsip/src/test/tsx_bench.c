@@ -79,13 +79,10 @@ static int uac_tsx_bench(unsigned working_set, pj_timestamp *p_elapsed)
 on_error:
     for (i=0; i<working_set; ++i) {
 	if (tsx[i]) {
-	    pj_timer_heap_t *th;
-
 	    pjsip_tsx_terminate(tsx[i], 601);
 	    tsx[i] = NULL;
 
-	    th = pjsip_endpt_get_timer_heap(endpt);
-	    pj_timer_heap_poll(th, NULL);
+	    pjsip_endpt_poll_timers(endpt, NULL);
 	}
     }
     pjsip_tx_data_dec_ref(request);
@@ -182,27 +179,250 @@ static int uas_tsx_bench(unsigned working_set, pj_timestamp *p_elapsed)
 on_error:
     for (i=0; i<working_set; ++i) {
 	if (tsx[i]) {
-	    pj_timer_heap_t *th;
-
 	    pjsip_tsx_terminate(tsx[i], 601);
 	    tsx[i] = NULL;
 
-	    th = pjsip_endpt_get_timer_heap(endpt);
-	    pj_timer_heap_poll(th, NULL);
+	    pjsip_endpt_poll_timers(endpt, NULL);
+	}
+    }
+    pjsip_tx_data_dec_ref(request);
+    flush_events(2000);
+    return status;
+}
+
+
+
+/* Shared state of the transaction lookup benchmark */
+static struct lookup_bench
+{
+    pj_str_t	    *keys;
+    unsigned	     key_cnt;
+    unsigned	     lookups;
+    pj_atomic_t	    *found;
+} lookup_bench;
+
+static int lookup_thread(void *arg)
+{
+    unsigned i, found = 0;
+
+    PJ_UNUSED_ARG(arg);
+
+    for (i=0; i<lookup_bench.lookups; ++i) {
+	const pj_str_t *key = &lookup_bench.keys[i % lookup_bench.key_cnt];
+	if (pjsip_tsx_layer_find_tsx(key, PJ_FALSE) != NULL)
+	    ++found;
+    }
+
+    pj_atomic_add(lookup_bench.found, found);
+    return 0;
+}
+
+/*
+ * Measure the transaction lookup throughput with the specified number
+ * of threads doing lookups concurrently.
+ */
+static int tsx_lookup_bench(unsigned working_set, unsigned thread_cnt,
+			    unsigned lookups_per_thread, unsigned *p_speed)
+{
+    enum { MAX_THREADS = 16 };
+    unsigned i;
+    pj_pool_t *pool;
+    pjsip_tx_data *request;
+    pjsip_transaction **tsx;
+    pj_thread_t *threads[MAX_THREADS];
+    pj_timestamp t1, t2, freq;
+    pjsip_via_hdr *via;
+    pj_status_t status;
+
+    pj_str_t str_target = pj_str("sip:someuser@someprovider.com");
+    pj_str_t str_from = pj_str("\"Local User\" <sip:localuser@serviceprovider.com>");
+    pj_str_t str_to = pj_str("\"Remote User\" <sip:remoteuser@serviceprovider.com>");
+    pj_str_t str_contact = str_from;
+
+    PJ_ASSERT_RETURN(thread_cnt <= MAX_THREADS, PJ_EINVAL);
+
+    pj_get_timestamp_freq(&freq);
+
+    pool = pjsip_endpt_create_pool(endpt, "tsxlookup", 1000, 1000);
+    if (!pool)
+	return PJ_ENOMEM;
+
+    status = pjsip_endpt_create_request(endpt, &pjsip_options_method,
+					&str_target, &str_from, &str_to,
+					&str_contact, NULL, -1, NULL,
+					&request);
+    if (status != PJ_SUCCESS) {
+	app_perror("    error: unable to create request", status);
+	pj_pool_release(pool);
+	return status;
+    }
+
+    via = (pjsip_via_hdr*) pjsip_msg_find_hdr(request->msg, PJSIP_H_VIA,
+					      NULL);
+
+    tsx = (pjsip_transaction**)
+	  pj_pool_zalloc(pool, working_set * sizeof(pjsip_transaction*));
+    lookup_bench.keys = (pj_str_t*)
+			pj_pool_zalloc(pool, working_set * sizeof(pj_str_t));
+    lookup_bench.key_cnt = working_set;
+    lookup_bench.lookups = lookups_per_thread;
+
+    status = pj_atomic_create(pool, 0, &lookup_bench.found);
+    if (status != PJ_SUCCESS)
+	goto on_error;
+
+    pj_bzero(&mod_tsx_user, sizeof(mod_tsx_user));
+    mod_tsx_user.id = -1;
+
+    /* Populate the transaction table */
+    for (i=0; i<working_set; ++i) {
+	status = pjsip_tsx_create_uac(&mod_tsx_user, request, &tsx[i]);
+	if (status != PJ_SUCCESS)
+	    goto on_error;
+	pj_strdup(pool, &lookup_bench.keys[i], &tsx[i]->transaction_key);
+	via->branch_param.slen = 0;
+    }
+
+    /* Run the lookup threads */
+    pj_get_timestamp(&t1);
+    for (i=0; i<thread_cnt; ++i) {
+	status = pj_thread_create(pool, "tsxlookup%p", &lookup_thread, NULL,
+				  0, 0, &threads[i]);
+	if (status != PJ_SUCCESS) {
+	    thread_cnt = i;
+	    break;
+	}
+    }
+    for (i=0; i<thread_cnt; ++i) {
+	pj_thread_join(threads[i]);
+	pj_thread_destroy(threads[i]);
+    }
+    pj_get_timestamp(&t2);
 
+    if (status != PJ_SUCCESS) {
+	app_perror("    error: unable to create thread", status);
+	goto on_error;
+    }
+
+    if ((unsigned)pj_atomic_get(lookup_bench.found) != 
+	thread_cnt * lookups_per_thread)
+    {
+	PJ_LOG(3,(THIS_FILE, "    error: some transactions were not found"));
+	status = -10;
+	goto on_error;
+    }
+
+    pj_sub_timestamp(&t2, &t1);
+    if (t2.u64 == 0) t2.u64 = 1;
+    *p_speed = (unsigned)(freq.u64 * thread_cnt * lookups_per_thread / 
+			  t2.u64);
+
+on_error:
+    for (i=0; i<working_set; ++i) {
+	if (tsx[i]) {
+	    pjsip_tsx_terminate(tsx[i], 601);
+	    tsx[i] = NULL;
+	    pjsip_endpt_poll_timers(endpt, NULL);
 	}
     }
+    if (lookup_bench.found)
+	pj_atomic_destroy(lookup_bench.found);
+    pj_bzero(&lookup_bench, sizeof(lookup_bench));
     pjsip_tx_data_dec_ref(request);
+    pj_pool_release(pool);
     flush_events(2000);
     return status;
 }
 
 
+/*
+ * Measure the rate of transmit buffer allocation, keeping a few buffers
+ * outstanding at a time as when transactions are in progress. Each buffer
+ * gets a message and is printed, so that its pool grows as usual. The
+ * same is done without recycling, by creating and destroying the pool,
+ * reference counter and lock of each buffer.
+ */
+static int tdata_alloc_bench(unsigned count, unsigned *p_speed,
+			     unsigned *p_ref_speed, unsigned *p_reused)
+{
+    enum { OUTSTANDING = 8 };
+    pjsip_tx_data *tdata[OUTSTANDING];
+    pjsip_tpmgr_cache_stat st1, st2;
+    pj_timestamp t1, t2, freq;
+    pjsip_tpmgr *mgr;
+    pj_size_t total;
+    unsigned i, j;
+    pj_status_t status;
+
+    pj_get_timestamp_freq(&freq);
+    mgr = pjsip_endpt_get_tpmgr(endpt);
+
+    pjsip_tpmgr_get_cache_stat(mgr, &st1);
+    pj_get_timestamp(&t1);
+    for (i=0; i<count; i+=OUTSTANDING) {
+	for (j=0; j<OUTSTANDING; ++j) {
+	    status = pjsip_tx_data_create(mgr, &tdata[j]);
+	    if (status != PJ_SUCCESS) {
+		app_perror("    error: unable to create tdata", status);
+		while (j--)
+		    pjsip_tx_data_dec_ref(tdata[j]);
+		return status;
+	    }
+	    pjsip_tx_data_add_ref(tdata[j]);
+	    tdata[j]->msg = pjsip_msg_create(tdata[j]->pool,
+					     PJSIP_RESPONSE_MSG);
+	    tdata[j]->msg->line.status.code = 200;
+	    tdata[j]->msg->line.status.reason = pj_str("OK");
+	    pjsip_tx_data_encode(tdata[j]);
+	}
+	for (j=0; j<OUTSTANDING; ++j)
+	    pjsip_tx_data_dec_ref(tdata[j]);
+    }
+    pj_get_timestamp(&t2);
+    pjsip_tpmgr_get_cache_stat(mgr, &st2);
+
+    pj_sub_timestamp(&t2, &t1);
+    if (t2.u64 == 0) t2.u64 = 1;
+    *p_speed = (unsigned)(freq.u64 * count / t2.u64);
+
+    total = (st2.tdata_reused - st1.tdata_reused) +
+	    (st2.tdata_created - st1.tdata_created);
+    *p_reused = total ? (unsigned)((st2.tdata_reused - st1.tdata_reused) *
+				   100 / total) : 0;
+
+    /* Reference: what each allocation costs without recycling */
+    pj_get_timestamp(&t1);
+    for (i=0; i<count; ++i) {
+	pj_pool_t *pool;
+	pj_atomic_t *ref_cnt;
+	pj_lock_t *lock;
+
+	pool = pjsip_endpt_create_pool(endpt, "tdta%p", PJSIP_POOL_LEN_TDATA,
+				       PJSIP_POOL_INC_TDATA);
+	if (!pool)
+	    return PJ_ENOMEM;
+	pj_pool_zalloc(pool, sizeof(pjsip_tx_data));
+	pj_atomic_create(pool, 0, &ref_cnt);
+	pj_lock_create_null_mutex(pool, "tdta%p", &lock);
+	pj_pool_alloc(pool, PJSIP_MAX_PKT_LEN);
+	pj_lock_destroy(lock);
+	pj_atomic_destroy(ref_cnt);
+	pjsip_endpt_release_pool(endpt, pool);
+    }
+    pj_get_timestamp(&t2);
+
+    pj_sub_timestamp(&t2, &t1);
+    if (t2.u64 == 0) t2.u64 = 1;
+    *p_ref_speed = (unsigned)(freq.u64 * count / t2.u64);
+
+    return PJ_SUCCESS;
+}
 
 int tsx_bench(void)
 {
-    enum { WORKING_SET=10000, REPEAT = 4 };
-    unsigned i, speed;
+    enum { WORKING_SET=10000, REPEAT = 4, LOOKUP_MAX_THREADS = 8,
+	   LOOKUP_COUNT = 200000, ALLOC_COUNT = 200000 };
+    unsigned i, speed, ref_speed, reused;
     pj_timestamp usec[REPEAT], min, freq;
     char desc[250];
     int status;
@@ -290,6 +510,49 @@ int tsx_bench(void)
     report_ival("create-uas-tsx-per-sec", 
 		speed, "tsx/sec", desc);
 
+
+    /*
+     * Benchmark transmit buffer allocation
+     */
+    PJ_LOG(3,(THIS_FILE, "   benchmarking tdata allocation:"));
+    status = tdata_alloc_bench(ALLOC_COUNT, &speed, &ref_speed, &reused);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    PJ_LOG(3,(THIS_FILE, "    tdata allocated at %d tdata/sec (%d%% reused), "
+			 "%d tdata/sec without recycling",
+	      speed, reused, ref_speed));
+
+    pj_ansi_sprintf(desc, "Number of transmit buffers that can be created, "
+			  "printed and destroyed per second with "
+			  "<tt>pjsip_tx_data_create()</tt>, with %d%% of them "
+			  "recycled.", reused);
+    report_ival("tdata-alloc-per-sec", speed, "tdata/sec", desc);
+
+
+    /*
+     * Benchmark transaction lookup with increasing number of threads
+     */
+    PJ_LOG(3,(THIS_FILE, "   benchmarking transaction lookup (%d shards):",
+	      pjsip_cfg()->tsx.shard_cnt));
+    for (i=1; i<=LOOKUP_MAX_THREADS; i*=2) {
+	char name[40];
+
+	status = tsx_lookup_bench(WORKING_SET, i, LOOKUP_COUNT, &speed);
+	if (status != PJ_SUCCESS)
+	    return status;
+
+	PJ_LOG(3,(THIS_FILE, "    %2d thread(s): %d lookups/sec", i, speed));
+
+	pj_ansi_snprintf(name, sizeof(name), "tsx-lookup-%d-threads", i);
+	pj_ansi_snprintf(desc, sizeof(desc), 
+			 "Number of transaction lookups per second with "
+			 "<tt>pjsip_tsx_layer_find_tsx()</tt> from %d "
+			 "concurrent threads, with %d transactions in the "
+			 "table.", i, WORKING_SET);
+	report_ival(name, speed, "lookups/sec", desc);
+    }
+
     return PJ_SUCCESS;
 }
 
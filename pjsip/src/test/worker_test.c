@@ -0,0 +1,466 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "test.h"
+#include <pjsip.h>
+#include <pjlib.h>
+
+#define THIS_FILE   "worker_test.c"
+
+/*
+ * These tests recreate the endpoint with worker threads enabled, so they
+ * must be run after the tests which use the global endpoint.
+ */
+
+/**************************************************************************
+ * Incoming message workers (pjsip_cfg_t.endpt.rx_worker_cnt).
+ *
+ * Requests of several calls are sent to the endpoint's own UDP transport,
+ * and the module checks that they're processed by the workers in order
+ * within each call. Then the workers are blocked while more requests are
+ * queued, and the endpoint is destroyed: the queued requests must all be
+ * processed and their memory released.
+ */
+#define RX_WORKER_CNT	2
+#define RX_CALL_CNT	4
+#define RX_MSG_CNT	50
+#define RX_QUEUED_CNT	40
+
+static struct rx_worker_state
+{
+    pj_thread_t	*main_thread;
+    pj_atomic_t	*count;
+    pj_sem_t	*block;
+    pj_bool_t	 blocking;
+    int		 last_cseq[RX_CALL_CNT];
+    int		 err;
+} rxw;
+
+static pj_bool_t rxw_on_rx_request(pjsip_rx_data *rdata)
+{
+    const pj_str_t *call_id = &rdata->msg_info.cid->id;
+    int idx;
+
+    if (call_id->slen < 5 || pj_ansi_strncmp(call_id->ptr, "rxw-", 4) != 0)
+	return PJ_FALSE;
+
+    idx = call_id->ptr[4] - '0';
+    if (idx < 0 || idx >= RX_CALL_CNT) {
+	rxw.err = -10;
+	return PJ_TRUE;
+    }
+
+    if (rxw.blocking)
+	pj_sem_wait(rxw.block);
+
+    if (pj_thread_this() == rxw.main_thread)
+	rxw.err = -20;
+
+    /* Messages of the same call are processed by the same worker */
+    if (rdata->msg_info.cseq->cseq <= rxw.last_cseq[idx])
+	rxw.err = -30;
+    rxw.last_cseq[idx] = rdata->msg_info.cseq->cseq;
+
+    pj_atomic_inc(rxw.count);
+    return PJ_TRUE;
+}
+
+static pjsip_module rxw_mod =
+{
+    NULL, NULL,				/* prev and next	*/
+    { "mod-rxw-test", 12},		/* Name.		*/
+    -1,					/* Id			*/
+    PJSIP_MOD_PRIORITY_APPLICATION,	/* Priority		*/
+    NULL,				/* load()		*/
+    NULL,				/* start()		*/
+    NULL,				/* stop()		*/
+    NULL,				/* unload()		*/
+    &rxw_on_rx_request,			/* on_rx_request()	*/
+    NULL,				/* on_rx_response()	*/
+    NULL,				/* tsx_handler()	*/
+};
+
+static pj_status_t rxw_send(const pj_str_t *target, int call, int cseq)
+{
+    pj_str_t from = pj_str("<sip:rxw@127.0.0.1>");
+    char call_id_buf[16];
+    pj_str_t call_id;
+    pjsip_tx_data *tdata;
+    pj_status_t status;
+
+    pj_ansi_snprintf(call_id_buf, sizeof(call_id_buf), "rxw-%d", call);
+    call_id = pj_str(call_id_buf);
+
+    status = pjsip_endpt_create_request(endpt, &pjsip_options_method,
+					target, &from, target, NULL,
+					&call_id, cseq, NULL, &tdata);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    return pjsip_endpt_send_request_stateless(endpt, tdata, NULL, NULL);
+}
+
+/* Poll the endpoint until the module has processed count requests */
+static void rxw_wait(int count, unsigned msec)
+{
+    pj_time_val timeout = {0, 10};
+    pj_time_val now, end;
+
+    pj_gettickcount(&end);
+    end.msec += msec;
+    pj_time_val_normalize(&end);
+
+    do {
+	pjsip_endpt_handle_events(endpt, &timeout);
+	pj_gettickcount(&now);
+    } while (pj_atomic_get(rxw.count) < count && PJ_TIME_VAL_LT(now, end));
+}
+
+int rx_worker_test(void)
+{
+    unsigned old_worker_cnt = pjsip_cfg()->endpt.rx_worker_cnt;
+    pjsip_transport *udp;
+    pj_sockaddr_in addr;
+    pj_pool_t *pool = NULL;
+    pj_size_t pool_cnt;
+    char target_buf[64];
+    pj_str_t target;
+    int i, j, rc = 0;
+    pj_status_t status;
+
+    PJ_LOG(3,(THIS_FILE, "  incoming message worker test.."));
+
+    pjsip_endpt_destroy(endpt);
+    endpt = NULL;
+    pool_cnt = caching_pool.used_count;
+
+    pool = pj_pool_create(&caching_pool.factory, "rxw", 512, 512, NULL);
+    pj_bzero(&rxw, sizeof(rxw));
+    rxw.main_thread = pj_thread_this();
+    if (pj_atomic_create(pool, 0, &rxw.count) != PJ_SUCCESS ||
+	pj_sem_create(pool, "rxw", 0, RX_QUEUED_CNT, &rxw.block) != PJ_SUCCESS)
+    {
+	rc = -100;
+	goto on_return;
+    }
+
+    pjsip_cfg()->endpt.rx_worker_cnt = RX_WORKER_CNT;
+    status = pjsip_endpt_create(&caching_pool.factory, "endpt", &endpt);
+    pjsip_cfg()->endpt.rx_worker_cnt = old_worker_cnt;
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to create endpoint", status);
+	endpt = NULL;
+	rc = -110;
+	goto on_return;
+    }
+
+    pj_sockaddr_in_init(&addr, NULL, 0);
+    addr.sin_addr.s_addr = pj_htonl(0x7F000001);
+    status = pjsip_udp_transport_start(endpt, &addr, NULL, 1, &udp);
+    if (status == PJ_SUCCESS)
+	status = pjsip_endpt_register_module(endpt, &rxw_mod);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to start transport", status);
+	rc = -120;
+	goto on_return;
+    }
+
+    pj_ansi_snprintf(target_buf, sizeof(target_buf), "sip:rxw@127.0.0.1:%d",
+		     udp->local_name.port);
+    target = pj_str(target_buf);
+
+    /* Requests are processed by the workers, in order within each call */
+    for (i=0; i<RX_MSG_CNT && !rxw.err; ++i) {
+	for (j=0; j<RX_CALL_CNT; ++j) {
+	    if (rxw_send(&target, j, i+1) != PJ_SUCCESS) {
+		rc = -130;
+		goto on_return;
+	    }
+	}
+	rxw_wait((i+1) * RX_CALL_CNT, 5000);
+	if (pj_atomic_get(rxw.count) != (i+1) * RX_CALL_CNT) {
+	    PJ_LOG(3,(THIS_FILE, "   error: %ld of %d requests processed",
+		      pj_atomic_get(rxw.count), (i+1) * RX_CALL_CNT));
+	    rc = -140;
+	    goto on_return;
+	}
+    }
+    if (rxw.err) {
+	rc = rxw.err;
+	goto on_return;
+    }
+
+    /* Block the workers and queue more requests */
+    rxw.blocking = PJ_TRUE;
+    for (i=0; i<RX_QUEUED_CNT; ++i) {
+	if (rxw_send(&target, i % RX_CALL_CNT,
+		     RX_MSG_CNT + 1 + i / RX_CALL_CNT) != PJ_SUCCESS)
+	{
+	    rc = -150;
+	    goto on_return;
+	}
+	if (i % 8 == 7)
+	    flush_events(20);
+    }
+    flush_events(200);
+
+    /* Destroying the endpoint must process the queued requests */
+    for (i=0; i<RX_QUEUED_CNT; ++i)
+	pj_sem_post(rxw.block);
+    pjsip_endpt_destroy(endpt);
+    endpt = NULL;
+
+    if (pj_atomic_get(rxw.count) != RX_MSG_CNT*RX_CALL_CNT + RX_QUEUED_CNT) {
+	PJ_LOG(3,(THIS_FILE, "   error: %ld of %d requests processed",
+		  pj_atomic_get(rxw.count),
+		  RX_MSG_CNT*RX_CALL_CNT + RX_QUEUED_CNT));
+	rc = -160;
+	goto on_return;
+    }
+    if (rxw.err) {
+	rc = rxw.err;
+	goto on_return;
+    }
+
+on_return:
+    if (endpt) {
+	if (rxw.blocking) {
+	    for (i=0; i<RX_QUEUED_CNT; ++i)
+		pj_sem_post(rxw.block);
+	}
+	pjsip_endpt_destroy(endpt);
+	endpt = NULL;
+    }
+    if (rxw.block)
+	pj_sem_destroy(rxw.block);
+    if (rxw.count)
+	pj_atomic_destroy(rxw.count);
+    if (pool)
+	pj_pool_release(pool);
+
+    if (rc == 0 && caching_pool.used_count > pool_cnt) {
+	PJ_LOG(3,(THIS_FILE, "   error: %d pool(s) leaked",
+		  (int)(caching_pool.used_count - pool_cnt)));
+	rc = -170;
+    }
+
+    /* Recreate the global endpoint without workers */
+    if (pjsip_endpt_create(&caching_pool.factory, "endpt", &endpt) !=
+	PJ_SUCCESS && rc == 0)
+    {
+	rc = -180;
+    }
+
+    return rc;
+}
+
+
+/**************************************************************************
+ * I/O workers of connection oriented transports
+ * (pjsip_cfg_t.tcp.io_worker_cnt).
+ *
+ * Requests are sent over a TCP connection to the endpoint's own listener,
+ * and the module checks that they're all received by the same I/O worker
+ * thread. The endpoint is then destroyed with the connections still open
+ * and a request in flight: the workers must only be destroyed after the
+ * connections are gone, and all their memory must be released.
+ */
+#define IO_WORKER_CNT	2
+#define IO_MSG_CNT	20
+
+static struct io_worker_state
+{
+    pj_thread_t	*thread;
+    pj_atomic_t	*count;
+    int		 err;
+} iow;
+
+static pj_bool_t iow_on_rx_request(pjsip_rx_data *rdata)
+{
+    const pj_str_t *call_id = &rdata->msg_info.cid->id;
+    pj_thread_t *thread = pj_thread_this();
+
+    if (call_id->slen < 4 || pj_ansi_strncmp(call_id->ptr, "iow-", 4) != 0)
+	return PJ_FALSE;
+
+    if (pj_ansi_strncmp(pj_thread_get_name(thread), "sipio", 5) != 0)
+	iow.err = -10;
+
+    /* The connection is served by the same worker */
+    if (iow.thread == NULL)
+	iow.thread = thread;
+    else if (iow.thread != thread)
+	iow.err = -20;
+
+    pj_atomic_inc(iow.count);
+    return PJ_TRUE;
+}
+
+static pjsip_module iow_mod =
+{
+    NULL, NULL,				/* prev and next	*/
+    { "mod-iow-test", 12},		/* Name.		*/
+    -1,					/* Id			*/
+    PJSIP_MOD_PRIORITY_APPLICATION,	/* Priority		*/
+    NULL,				/* load()		*/
+    NULL,				/* start()		*/
+    NULL,				/* stop()		*/
+    NULL,				/* unload()		*/
+    &iow_on_rx_request,			/* on_rx_request()	*/
+    NULL,				/* on_rx_response()	*/
+    NULL,				/* tsx_handler()	*/
+};
+
+static pj_status_t iow_send(const pj_str_t *target, int cseq)
+{
+    pj_str_t from = pj_str("<sip:iow@127.0.0.1>");
+    pj_str_t call_id = pj_str("iow-0");
+    pjsip_tx_data *tdata;
+    pj_status_t status;
+
+    status = pjsip_endpt_create_request(endpt, &pjsip_options_method,
+					target, &from, target, NULL,
+					&call_id, cseq, NULL, &tdata);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    return pjsip_endpt_send_request_stateless(endpt, tdata, NULL, NULL);
+}
+
+int io_worker_test(void)
+{
+    unsigned old_worker_cnt = pjsip_cfg()->tcp.io_worker_cnt;
+    pjsip_tpfactory *tcp;
+    pj_sockaddr_in addr;
+    pj_pool_t *pool = NULL;
+    pj_size_t pool_cnt;
+    char target_buf[80];
+    pj_str_t target;
+    pj_time_val timeout = {0, 10};
+    pj_time_val now, end;
+    int i, rc = 0;
+    pj_status_t status;
+
+    PJ_LOG(3,(THIS_FILE, "  connection I/O worker test.."));
+
+    pjsip_endpt_destroy(endpt);
+    endpt = NULL;
+    pool_cnt = caching_pool.used_count;
+
+    pool = pj_pool_create(&caching_pool.factory, "iow", 512, 512, NULL);
+    pj_bzero(&iow, sizeof(iow));
+    if (pj_atomic_create(pool, 0, &iow.count) != PJ_SUCCESS) {
+	rc = -100;
+	goto on_return;
+    }
+
+    /* The workers are started by the first connection */
+    pjsip_cfg()->tcp.io_worker_cnt = IO_WORKER_CNT;
+
+    status = pjsip_endpt_create(&caching_pool.factory, "endpt", &endpt);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to create endpoint", status);
+	endpt = NULL;
+	rc = -110;
+	goto on_return;
+    }
+
+    pj_sockaddr_in_init(&addr, NULL, 0);
+    addr.sin_addr.s_addr = pj_htonl(0x7F000001);
+    status = pjsip_tcp_transport_start(endpt, &addr, 1, &tcp);
+    if (status == PJ_SUCCESS)
+	status = pjsip_endpt_register_module(endpt, &iow_mod);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to start transport", status);
+	rc = -120;
+	goto on_return;
+    }
+
+    pj_ansi_snprintf(target_buf, sizeof(target_buf),
+		     "sip:iow@127.0.0.1:%d;transport=tcp",
+		     tcp->addr_name.port);
+    target = pj_str(target_buf);
+
+    for (i=0; i<IO_MSG_CNT; ++i) {
+	if (iow_send(&target, i+1) != PJ_SUCCESS) {
+	    rc = -130;
+	    goto on_return;
+	}
+    }
+
+    /* The endpoint only has to poll the timers, the connections are
+     * served by the workers.
+     */
+    pj_gettickcount(&end);
+    end.sec += 5;
+    do {
+	pjsip_endpt_handle_events(endpt, &timeout);
+	pj_gettickcount(&now);
+    } while (pj_atomic_get(iow.count) < IO_MSG_CNT &&
+	     PJ_TIME_VAL_LT(now, end));
+
+    if (pj_atomic_get(iow.count) != IO_MSG_CNT) {
+	PJ_LOG(3,(THIS_FILE, "   error: %ld of %d requests received",
+		  pj_atomic_get(iow.count), IO_MSG_CNT));
+	rc = -140;
+	goto on_return;
+    }
+    if (iow.err) {
+	rc = iow.err;
+	goto on_return;
+    }
+
+    /* Destroy the endpoint with a request in flight */
+    if (iow_send(&target, IO_MSG_CNT+1) != PJ_SUCCESS) {
+	rc = -150;
+	goto on_return;
+    }
+
+on_return:
+    if (endpt) {
+	pjsip_endpt_destroy(endpt);
+	endpt = NULL;
+    }
+    pjsip_cfg()->tcp.io_worker_cnt = old_worker_cnt;
+
+    if (iow.count)
+	pj_atomic_destroy(iow.count);
+    if (pool)
+	pj_pool_release(pool);
+
+    if (rc == 0 && iow.err)
+	rc = iow.err;
+
+    /* Workers with connections left are leaked rather than destroyed */
+    if (rc == 0 && caching_pool.used_count > pool_cnt) {
+	PJ_LOG(3,(THIS_FILE, "   error: %d pool(s) leaked",
+		  (int)(caching_pool.used_count - pool_cnt)));
+	rc = -160;
+    }
+
+    /* Recreate the global endpoint without workers */
+    if (pjsip_endpt_create(&caching_pool.factory, "endpt", &endpt) !=
+	PJ_SUCCESS && rc == 0)
+    {
+	rc = -170;
+    }
+
+    return rc;
+}